@@ -18,50 +18,36 @@
 #include <log_manager.h>
 #include <errno.h>
 
-/** Maximum byte size of an integer value */
-#define MAX_INTEGER_SIZE 10
-
 #define avro_decode(n) ((n >> 1) ^ -(n & 1))
 #define encode_long(n) ((n << 1) ^ (n >> 63))
 #define more_bytes(b) (b & 0x80)
 
 /**
- * @brief Read an Avro integer
+ * @brief Decode an Avro integer from memory
  *
- * The integer lengths are all variable and the last bit in a byte indicates
- * if more bytes belong to the integer value. The real value of the integer is
- * the concatenation of the lowest seven bits of each byte. This value is encoded
- * in a zigzag patten i.e. first value is -1, second 1, third -2 and so on.
- * @param file The source FILE handle
- * @param dest Destination where the read value is written
- * @return True if value was read successfully
+ * @param ptr Start of the encoded value
+ * @param end End of the readable memory
+ * @param dest Destination where the decoded value is written
+ * @return Number of bytes decoded, 0 if the value continues past @c end or
+ * -1 if the value is too large
  */
-bool maxavro_read_integer(MAXAVRO_FILE* file, uint64_t *dest)
+static int decode_integer(const uint8_t *ptr, const uint8_t *end, uint64_t *dest)
 {
     uint64_t rval = 0;
-    uint8_t nread = 0;
+    int nread = 0;
     uint8_t byte;
+
     do
     {
         if (nread >= MAX_INTEGER_SIZE)
         {
-            file->last_error = MAXAVRO_ERR_VALUE_OVERFLOW;
-            return false;
+            return -1;
         }
-        size_t rdsz = fread(&byte, sizeof(byte), 1, file->file);
-        if (rdsz != sizeof(byte))
+        if (ptr + nread >= end)
         {
-            if (rdsz != 0)
-            {
-                MXS_ERROR("Failed to read %lu bytes from '%s'", sizeof(byte), file->filename);
-                file->last_error = MAXAVRO_ERR_IO;
-            }
-            else
-            {
-                MXS_DEBUG("Read 0 bytes from file '%s'", file->filename);
-            }
-            return false;
+            return 0;
         }
+        byte = ptr[nread];
         rval |= (uint64_t)(byte & 0x7f) << (nread++ * 7);
     }
     while (more_bytes(byte));
@@ -70,9 +56,64 @@ bool maxavro_read_integer(MAXAVRO_FILE* file, uint64_t *dest)
     {
         *dest = avro_decode(rval);
     }
+    return nread;
+}
+
+/**
+ * @brief Read an Avro integer
+ *
+ * The integer lengths are all variable and the last bit in a byte indicates
+ * if more bytes belong to the integer value. The real value of the integer is
+ * the concatenation of the lowest seven bits of each byte. This value is encoded
+ * in a zigzag patten i.e. first value is -1, second 1, third -2 and so on.
+ * @param file The source file
+ * @param dest Destination where the read value is written
+ * @return True if value was read successfully
+ */
+bool maxavro_read_integer(MAXAVRO_FILE* file, uint64_t *dest)
+{
+    int nread = 0;
+
+    if (file->pos < file->map_size)
+    {
+        nread = decode_integer(file->map + file->pos, file->map + file->map_size, dest);
+    }
+
+    if (nread == 0 && maxavro_file_remap(file) && file->pos < file->map_size)
+    {
+        /** The value may continue in the part that was just mapped */
+        nread = decode_integer(file->map + file->pos, file->map + file->map_size, dest);
+    }
+
+    if (nread < 0)
+    {
+        file->last_error = MAXAVRO_ERR_VALUE_OVERFLOW;
+        return false;
+    }
+    else if (nread == 0)
+    {
+        MXS_DEBUG("Read 0 bytes from file '%s'", file->filename);
+        return false;
+    }
+
+    file->pos += nread;
     return true;
 }
 
+/**
+ * @brief Decode an Avro integer from a memory buffer
+ *
+ * @param ptr Start of the encoded value
+ * @param end End of the buffer
+ * @param dest Destination where the decoded value is written
+ * @return Number of bytes decoded or 0 if the buffer does not hold a valid value
+ */
+int maxavro_decode_integer(const uint8_t *ptr, const uint8_t *end, uint64_t *dest)
+{
+    int rval = decode_integer(ptr, end, dest);
+    return rval > 0 ? rval : 0;
+}
+
 /**
  * @brief Calculate the length of an Avro integer
  *
@@ -110,23 +151,15 @@ char* maxavro_read_string(MAXAVRO_FILE* file)
 
     if (maxavro_read_integer(file, &len))
     {
-        key = malloc(len + 1);
-        if (key)
+        if (!maxavro_readable(file, file->pos + len))
         {
-            size_t nread = fread(key, 1, len, file->file);
-            if (nread == len)
-            {
-                key[len] = '\0';
-            }
-            else
-            {
-                if (nread != 0)
-                {
-                    file->last_error = MAXAVRO_ERR_IO;
-                }
-                free(key);
-                key = NULL;
-            }
+            file->last_error = MAXAVRO_ERR_IO;
+        }
+        else if ((key = malloc(len + 1)))
+        {
+            memcpy(key, file->map + file->pos, len);
+            key[len] = '\0';
+            file->pos += len;
         }
         else
         {
@@ -149,12 +182,13 @@ bool maxavro_skip_string(MAXAVRO_FILE* file)
 
     if (maxavro_read_integer(file, &len))
     {
-        if (fseek(file->file, len, SEEK_CUR) != 0)
+        if (!maxavro_readable(file, file->pos + len))
         {
             file->last_error = MAXAVRO_ERR_IO;
         }
         else
         {
+            file->pos += len;
             return true;
         }
     }
@@ -186,13 +220,18 @@ uint64_t avro_length_string(const char* str)
  */
 bool maxavro_read_float(MAXAVRO_FILE* file, float *dest)
 {
-    size_t nread = fread(dest, 1, sizeof(*dest), file->file);
-    if (nread != sizeof(*dest) && nread != 0)
+    if (!maxavro_readable(file, file->pos + sizeof(*dest)))
     {
-        file->last_error = MAXAVRO_ERR_IO;
+        if (file->pos < file->map_size)
+        {
+            file->last_error = MAXAVRO_ERR_IO;
+        }
         return false;
     }
-    return nread == sizeof(*dest);
+
+    memcpy(dest, file->map + file->pos, sizeof(*dest));
+    file->pos += sizeof(*dest);
+    return true;
 }
 
 /**
@@ -217,13 +256,18 @@ uint64_t avro_length_float(float val)
  */
 bool maxavro_read_double(MAXAVRO_FILE* file, double *dest)
 {
-    size_t nread = fread(dest, 1, sizeof(*dest), file->file);
-    if (nread != sizeof(*dest) && nread != 0)
+    if (!maxavro_readable(file, file->pos + sizeof(*dest)))
     {
-        file->last_error = MAXAVRO_ERR_IO;
+        if (file->pos < file->map_size)
+        {
+            file->last_error = MAXAVRO_ERR_IO;
+        }
         return false;
     }
-    return nread == sizeof(*dest);
+
+    memcpy(dest, file->map + file->pos, sizeof(*dest));
+    file->pos += sizeof(*dest);
+    return true;
 }
 
 /**
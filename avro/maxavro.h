@@ -24,6 +24,9 @@
 #define AVRO_MAGIC_SIZE 4
 #define SYNC_MARKER_SIZE 16
 
+/** Maximum byte size of an integer value */
+#define MAX_INTEGER_SIZE 10
+
 /** The file magic */
 static const char avro_magic[] = {0x4f, 0x62, 0x6a, 0x01};
 
@@ -63,9 +66,21 @@ enum maxavro_error
     MAXAVRO_ERR_VALUE_OVERFLOW
 };
 
+/** An entry in the block index of a file */
 typedef struct
 {
-    FILE* file;
+    long offset; /*< File offset where the block starts */
+    uint64_t size; /*< Size of the block including the sync marker */
+    uint64_t records; /*< Number of records in the block */
+    uint64_t first_record; /*< Number of the first record of the block in the file */
+} MAXAVRO_BLOCK_INDEX;
+
+typedef struct
+{
+    int fd; /*< The file descriptor */
+    uint8_t *map; /*< Read-only memory map of the file */
+    size_t map_size; /*< Number of bytes mapped */
+    uint64_t pos; /*< Current read position in the file */
     char* filename; /*< The filename */
     MAXAVRO_SCHEMA* schema;
     uint64_t blocks_read; /*< Total number of data blocks read */
@@ -76,7 +91,7 @@ typedef struct
     uint64_t bytes_read_from_block;
     uint64_t block_size; /*< Size of the block in bytes */
 
-    /** The position @c ftell returns before the first record is read  */
+    /** The read position before the first record is read */
     long header_end_pos;
     long data_start_pos;
     long block_start_pos;
@@ -86,6 +101,9 @@ typedef struct
                          * to know when to read it and when not to.  */
     enum maxavro_error last_error; /*< Last error */
     uint8_t sync[SYNC_MARKER_SIZE];
+    MAXAVRO_BLOCK_INDEX *index; /*< Offsets and record counts of the complete blocks */
+    size_t index_count; /*< Number of blocks in the index */
+    size_t index_size; /*< Allocated size of the index */
 } MAXAVRO_FILE;
 
 /** A record field value */
@@ -139,6 +157,7 @@ bool maxavro_datablock_add_double(MAXAVRO_DATABLOCK *file, double val);
 
 /** Reading primitives */
 bool maxavro_read_integer(MAXAVRO_FILE *file, uint64_t *val);
+int maxavro_decode_integer(const uint8_t *ptr, const uint8_t *end, uint64_t *dest);
 char* maxavro_read_string(MAXAVRO_FILE *file);
 bool maxavro_skip_string(MAXAVRO_FILE* file);
 bool maxavro_read_float(MAXAVRO_FILE *file, float *dest);
@@ -155,10 +174,15 @@ bool maxavro_record_seek(MAXAVRO_FILE *file, uint64_t offset);
 bool maxavro_record_set_pos(MAXAVRO_FILE *file, long pos);
 bool maxavro_next_block(MAXAVRO_FILE *file);
 
+/** Block index */
+size_t maxavro_index_update(MAXAVRO_FILE *file);
+const MAXAVRO_BLOCK_INDEX* maxavro_index_find(MAXAVRO_FILE *file, uint64_t record);
+
 /** File operations */
 MAXAVRO_FILE* maxavro_file_open(const char* filename);
 void maxavro_file_close(MAXAVRO_FILE *file);
 GWBUF* maxavro_file_binary_header(MAXAVRO_FILE *file);
+bool maxavro_file_remap(MAXAVRO_FILE *file);
 
 /** File error functions */
 enum maxavro_error maxavro_get_error(MAXAVRO_FILE *file);
@@ -168,4 +192,17 @@ const char* maxavro_get_error_string(MAXAVRO_FILE *file);
 MAXAVRO_SCHEMA* maxavro_schema_alloc(const char* json);
 void maxavro_schema_free(MAXAVRO_SCHEMA* schema);
 
+/**
+ * @brief Check that the file is readable up to an offset
+ *
+ * The file is mapped again if it has grown since it was last mapped.
+ * @param file File to check
+ * @param end The offset up to which the file must be readable
+ * @return True if the bytes before @c end can be read from the map
+ */
+static inline bool maxavro_readable(MAXAVRO_FILE *file, uint64_t end)
+{
+    return end <= file->map_size || (maxavro_file_remap(file) && end <= file->map_size);
+}
+
 #endif
@@ -61,19 +61,23 @@ void maxavro_datablock_free(MAXAVRO_DATABLOCK* block)
 bool maxavro_datablock_finalize(MAXAVRO_DATABLOCK* block)
 {
     bool rval = true;
-    FILE *file = block->avrofile->file;
+    int fd = block->avrofile->fd;
 
     /** Store the current position so we can truncate the file if a write fails */
-    long pos = ftell(file);
-
-    if (!maxavro_write_integer(file, block->records) ||
-        !maxavro_write_integer(file, block->datasize) ||
-        fwrite(block->buffer, 1, block->datasize, file) != block->datasize ||
-        fwrite(block->avrofile->sync, 1, SYNC_MARKER_SIZE, file) != SYNC_MARKER_SIZE)
+    off_t pos = lseek(fd, 0, SEEK_END);
+    uint8_t header[MAX_INTEGER_SIZE * 2];
+    uint64_t header_size = maxavro_encode_integer(header, block->records);
+    header_size += maxavro_encode_integer(header + header_size, block->datasize);
+
+    if (pos == -1 ||
+        write(fd, header, header_size) != header_size ||
+        write(fd, block->buffer, block->datasize) != block->datasize ||
+        write(fd, block->avrofile->sync, SYNC_MARKER_SIZE) != SYNC_MARKER_SIZE)
     {
-        int fd = fileno(file);
-        ftruncate(fd, pos);
-        fseek(file, 0, SEEK_END);
+        if (pos != -1)
+        {
+            ftruncate(fd, pos);
+        }
         rval = false;
     }
     else
@@ -14,36 +14,37 @@
 #include "maxavro.h"
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <log_manager.h>
 
 
-static bool maxavro_read_sync(FILE *file, uint8_t* sync)
+static bool maxavro_read_sync(MAXAVRO_FILE *file, uint8_t* sync)
 {
-    return fread(sync, 1, SYNC_MARKER_SIZE, file) == SYNC_MARKER_SIZE;
+    if (maxavro_readable(file, file->pos + SYNC_MARKER_SIZE))
+    {
+        memcpy(sync, file->map + file->pos, SYNC_MARKER_SIZE);
+        file->pos += SYNC_MARKER_SIZE;
+        return true;
+    }
+    return false;
 }
 
 bool maxavro_verify_block(MAXAVRO_FILE *file)
 {
-    char sync[SYNC_MARKER_SIZE];
-    int rc = fread(sync, 1, SYNC_MARKER_SIZE, file->file);
-    if (rc != SYNC_MARKER_SIZE)
+    if (!maxavro_readable(file, file->pos + SYNC_MARKER_SIZE))
     {
-        if (rc == -1)
-        {
-            MXS_ERROR("Failed to read file: %d %s", errno, strerror(errno));
-        }
-        else
-        {
-            MXS_ERROR("Short read when reading sync marker. Read %d bytes instead of %d",
-                      rc, SYNC_MARKER_SIZE);
-        }
+        MXS_ERROR("Short read when reading sync marker. Read %lu bytes instead of %d",
+                  file->map_size > file->pos ? file->map_size - file->pos : 0, SYNC_MARKER_SIZE);
         return false;
     }
 
-    if (memcmp(file->sync, sync, SYNC_MARKER_SIZE))
+    if (memcmp(file->sync, file->map + file->pos, SYNC_MARKER_SIZE))
     {
-        long pos = ftell(file->file);
-        long expected = file->data_start_pos + file->block_size + SYNC_MARKER_SIZE;
+        long pos = file->pos;
+        long expected = file->data_start_pos + file->block_size;
         if (pos != expected)
         {
             MXS_ERROR("Sync marker mismatch due to wrong file offset. file is at %ld "
@@ -57,6 +58,7 @@ bool maxavro_verify_block(MAXAVRO_FILE *file)
     }
 
     /** Increment block count */
+    file->pos += SYNC_MARKER_SIZE;
     file->blocks_read++;
     file->bytes_read += file->block_size;
     return true;
@@ -65,29 +67,77 @@ bool maxavro_verify_block(MAXAVRO_FILE *file)
 bool maxavro_read_datablock_start(MAXAVRO_FILE* file)
 {
     /** The actual start of the binary block */
-    file->block_start_pos = ftell(file->file);
+    file->block_start_pos = file->pos;
     file->metadata_read = false;
     uint64_t records, bytes;
     bool rval = maxavro_read_integer(file, &records) && maxavro_read_integer(file, &bytes);
 
+    if (rval && !maxavro_readable(file, file->pos + bytes + SYNC_MARKER_SIZE))
+    {
+        /** The block is still being written, it is read once it is complete */
+        rval = false;
+    }
+
     if (rval)
     {
         file->block_size = bytes;
         file->records_in_block = records;
         file->records_read_from_block = 0;
-        file->data_start_pos = ftell(file->file);
+        file->data_start_pos = file->pos;
         ss_dassert(file->data_start_pos > file->block_start_pos);
         file->metadata_read = true;
     }
-    else if (maxavro_get_error(file) != MAXAVRO_ERR_NONE)
+    else
     {
-        MXS_ERROR("Failed to read data block start.");
+        file->pos = file->block_start_pos;
+
+        if (maxavro_get_error(file) != MAXAVRO_ERR_NONE)
+        {
+            MXS_ERROR("Failed to read data block start.");
+        }
     }
-    else if (feof(file->file))
+    return rval;
+}
+
+/**
+ * @brief Map the file into memory
+ *
+ * The file is mapped again if it has grown since it was last mapped. Pointers
+ * into the old map are not valid after this function returns.
+ *
+ * @param file File to map
+ * @return True if the file is mapped, false if an error occurred
+ */
+bool maxavro_file_remap(MAXAVRO_FILE *file)
+{
+    struct stat st;
+
+    if (fstat(file->fd, &st) == -1)
     {
-        clearerr(file->file);
+        MXS_ERROR("Failed to stat file '%s': %d, %s", file->filename, errno, strerror(errno));
+        file->last_error = MAXAVRO_ERR_IO;
+        return false;
     }
-    return rval;
+
+    if ((size_t)st.st_size > file->map_size)
+    {
+        void *map = file->map ?
+                    mremap(file->map, file->map_size, st.st_size, MREMAP_MAYMOVE) :
+                    mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
+
+        if (map == MAP_FAILED)
+        {
+            MXS_ERROR("Failed to map %ld bytes of file '%s': %d, %s", (long)st.st_size,
+                      file->filename, errno, strerror(errno));
+            file->last_error = MAXAVRO_ERR_MEMORY;
+            return false;
+        }
+
+        file->map = map;
+        file->map_size = st.st_size;
+    }
+
+    return true;
 }
 
 /** The header metadata is encoded as an Avro map with @c bytes encoded
@@ -124,61 +174,68 @@ static char* read_schema(MAXAVRO_FILE* file)
  *
  * This function performs checks on the file header and creates an internal
  * representation of the file's schema. This schema can be accessed for more
- * information about the fields.
+ * information about the fields. The file is read through a read-only memory
+ * map which is extended when the file grows.
  * @param filename File to open
  * @return Pointer to opened file or NULL if an error occurred
  */
 MAXAVRO_FILE* maxavro_file_open(const char* filename)
 {
-    FILE *file = fopen(filename, "rb");
-    if (!file)
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
     {
         MXS_ERROR("Failed to open file '%s': %d, %s", filename, errno, strerror(errno));
         return NULL;
     }
 
-    char magic[AVRO_MAGIC_SIZE];
+    MAXAVRO_FILE* avrofile = calloc(1, sizeof(MAXAVRO_FILE));
+
+    if (avrofile == NULL || (avrofile->filename = strdup(filename)) == NULL)
+    {
+        MXS_ERROR("Memory allocation failed when opening file '%s'.", filename);
+        close(fd);
+        free(avrofile);
+        return NULL;
+    }
+
+    avrofile->fd = fd;
+    avrofile->last_error = MAXAVRO_ERR_NONE;
 
-    if (fread(magic, 1, AVRO_MAGIC_SIZE, file) != AVRO_MAGIC_SIZE)
+    if (!maxavro_readable(avrofile, AVRO_MAGIC_SIZE))
     {
-        fclose(file);
         MXS_ERROR("Failed to read file magic marker from '%s'", filename);
+        maxavro_file_close(avrofile);
         return NULL;
     }
 
-    if (memcmp(magic, avro_magic, AVRO_MAGIC_SIZE) != 0)
+    if (memcmp(avrofile->map, avro_magic, AVRO_MAGIC_SIZE) != 0)
     {
-        fclose(file);
         MXS_ERROR("Error: Avro magic marker bytes are not correct.");
+        maxavro_file_close(avrofile);
         return NULL;
     }
 
-    MAXAVRO_FILE* avrofile = calloc(1, sizeof(MAXAVRO_FILE));
+    avrofile->pos = AVRO_MAGIC_SIZE;
+    char *schema = read_schema(avrofile);
+    avrofile->schema = schema ? maxavro_schema_alloc(schema) : NULL;
+    free(schema);
 
-    if (avrofile)
+    if (!avrofile->schema || !maxavro_read_sync(avrofile, avrofile->sync))
     {
-        avrofile->file = file;
-        avrofile->filename = strdup(filename);
-        char *schema = read_schema(avrofile);
-        avrofile->schema = schema ? maxavro_schema_alloc(schema) : NULL;
-        avrofile->last_error = MAXAVRO_ERR_NONE;
-
-        if (!schema || !avrofile->schema ||
-            !maxavro_read_sync(file, avrofile->sync) ||
-            !maxavro_read_datablock_start(avrofile))
-        {
-            MXS_ERROR("Failed to initialize avrofile.");
-            free(avrofile->schema);
-            free(avrofile);
-            avrofile = NULL;
-        }
-        avrofile->header_end_pos = avrofile->block_start_pos;
-        free(schema);
+        MXS_ERROR("Failed to initialize avrofile.");
+        maxavro_file_close(avrofile);
+        return NULL;
     }
-    else
+
+    avrofile->header_end_pos = avrofile->pos;
+
+    /** The first data block might not be completely written yet in which
+     * case it is read when records are requested */
+    if (!maxavro_read_datablock_start(avrofile) &&
+        maxavro_get_error(avrofile) != MAXAVRO_ERR_NONE)
     {
-        fclose(file);
-        free(avrofile);
+        MXS_ERROR("Failed to initialize avrofile.");
+        maxavro_file_close(avrofile);
         avrofile = NULL;
     }
 
@@ -229,8 +286,13 @@ void maxavro_file_close(MAXAVRO_FILE *file)
 {
     if (file)
     {
-        fclose(file->file);
+        if (file->map)
+        {
+            munmap(file->map, file->map_size);
+        }
+        close(file->fd);
         free(file->filename);
+        free(file->index);
         maxavro_schema_free(file->schema);
         free(file);
     }
@@ -248,19 +310,14 @@ void maxavro_file_close(MAXAVRO_FILE *file)
 GWBUF* maxavro_file_binary_header(MAXAVRO_FILE *file)
 {
     long pos = file->header_end_pos;
-    fseek(file->file, 0, SEEK_SET);
-    GWBUF *rval = gwbuf_alloc(pos);
-    if (rval)
+    GWBUF *rval = NULL;
+
+    if (maxavro_readable(file, pos))
     {
-        if (fread(GWBUF_DATA(rval), 1, pos, file->file) != pos)
+        if ((rval = gwbuf_alloc_and_load(pos, file->map)) == NULL)
         {
-            gwbuf_free(rval);
-            rval = NULL;
+            MXS_ERROR("Memory allocation failed when allocating %ld bytes.", pos);
         }
     }
-    else
-    {
-        MXS_ERROR("Memory allocation failed when allocating %ld bytes.", pos);
-    }
     return rval;
 }
@@ -37,10 +37,9 @@ static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *fie
     {
         case MAXAVRO_TYPE_BOOL:
         {
-            int i = 0;
-            if (fread(&i, 1, 1, file->file) == 1)
+            if (maxavro_readable(file, file->pos + 1))
             {
-                value = json_pack("b", i);
+                value = json_pack("b", (int)file->map[file->pos++]);
             }
         }
         break;
@@ -166,7 +165,7 @@ json_t* maxavro_record_read_json(MAXAVRO_FILE *file)
                 }
                 else
                 {
-                    long pos = ftell(file->file);
+                    long pos = file->pos;
                     MXS_ERROR("Failed to read field value '%s', type '%s' at "
                               "file offset %ld, record numer %lu.",
                               file->schema->fields[i].name,
@@ -209,64 +208,212 @@ bool maxavro_next_block(MAXAVRO_FILE *file)
         if (file->records_read_from_block < file->records_in_block)
         {
             file->records_read += file->records_in_block - file->records_read_from_block;
-            long curr_pos = ftell(file->file);
-            long offset = (long) file->block_size - (curr_pos - file->data_start_pos);
+            file->pos = file->data_start_pos + file->block_size;
+        }
+
+        return maxavro_verify_block(file) && maxavro_read_datablock_start(file);
+    }
+    return false;
+}
 
-            if (offset > 0)
+/**
+ * @brief Update the block index of a file
+ *
+ * The headers of the complete data blocks that follow the last indexed block
+ * are read from the memory map. The current read position is not changed.
+ *
+ * @param file File to index
+ * @return Number of blocks in the index
+ */
+size_t maxavro_index_update(MAXAVRO_FILE *file)
+{
+    if (file->header_end_pos == 0 || !maxavro_file_remap(file))
+    {
+        return file->index_count;
+    }
+
+    MAXAVRO_BLOCK_INDEX *last = file->index_count ? &file->index[file->index_count - 1] : NULL;
+    uint64_t offset = last ? last->offset + last->size : file->header_end_pos;
+    uint64_t record = last ? last->first_record + last->records : 0;
+    const uint8_t *end = file->map + file->map_size;
+
+    while (offset < file->map_size)
+    {
+        const uint8_t *ptr = file->map + offset;
+        uint64_t records, bytes;
+        int n_records = maxavro_decode_integer(ptr, end, &records);
+        int n_bytes = n_records ? maxavro_decode_integer(ptr + n_records, end, &bytes) : 0;
+        uint64_t avail = end - ptr;
+
+        if (n_bytes == 0 || avail < n_records + n_bytes + SYNC_MARKER_SIZE ||
+            bytes > avail - n_records - n_bytes - SYNC_MARKER_SIZE ||
+            memcmp(ptr + n_records + n_bytes + bytes, file->sync, SYNC_MARKER_SIZE) != 0)
+        {
+            /** The block is not complete yet */
+            break;
+        }
+
+        if (file->index_count == file->index_size)
+        {
+            size_t size = file->index_size ? file->index_size * 2 : 64;
+            MAXAVRO_BLOCK_INDEX *index = realloc(file->index, size * sizeof(*index));
+
+            if (index == NULL)
             {
-                fseek(file->file, offset, SEEK_CUR);
+                file->last_error = MAXAVRO_ERR_MEMORY;
+                break;
             }
+
+            file->index = index;
+            file->index_size = size;
         }
 
-        return maxavro_verify_block(file) && maxavro_read_datablock_start(file);
+        MAXAVRO_BLOCK_INDEX *block = &file->index[file->index_count++];
+        block->offset = offset;
+        block->size = n_records + n_bytes + bytes + SYNC_MARKER_SIZE;
+        block->records = records;
+        block->first_record = record;
+
+        offset += block->size;
+        record += records;
+    }
+
+    return file->index_count;
+}
+
+/**
+ * @brief Find the block that contains a record
+ *
+ * @param file File to search
+ * @param record Number of the record, the first record of the file is zero
+ * @return The index entry of the block or NULL if the record is not in a
+ * complete block of the file
+ */
+const MAXAVRO_BLOCK_INDEX* maxavro_index_find(MAXAVRO_FILE *file, uint64_t record)
+{
+    MAXAVRO_BLOCK_INDEX *last = file->index_count ? &file->index[file->index_count - 1] : NULL;
+
+    if (last == NULL || record >= last->first_record + last->records)
+    {
+        maxavro_index_update(file);
     }
+
+    size_t low = 0;
+    size_t high = file->index_count;
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        MAXAVRO_BLOCK_INDEX *block = &file->index[mid];
+
+        if (record < block->first_record)
+        {
+            high = mid;
+        }
+        else if (record >= block->first_record + block->records)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            return block;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Find the number of the next record to be read
+ *
+ * @param file File to check
+ * @param dest Where the record number is stored
+ * @return True if the current block is in the block index
+ */
+static bool current_record(MAXAVRO_FILE *file, uint64_t *dest)
+{
+    if (!file->metadata_read)
+    {
+        return false;
+    }
+
+    if (file->index_count == 0 || file->index[file->index_count - 1].offset < file->block_start_pos)
+    {
+        maxavro_index_update(file);
+    }
+
+    size_t low = 0;
+    size_t high = file->index_count;
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+
+        if (file->index[mid].offset < file->block_start_pos)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    if (low < file->index_count && file->index[low].offset == file->block_start_pos)
+    {
+        *dest = file->index[low].first_record + file->records_read_from_block;
+        return true;
+    }
+
     return false;
 }
 
 /**
  * @brief Seek to a position in the Avro file
  *
- * This moves the current position of the file, skipping data blocks if necessary.
+ * This moves the current position of the file forward by @c offset records.
+ * The block that contains the record is found from the block index after
+ * which only that block is decoded.
  *
- * @param file
- * @param position
- * @return
+ * @param file File to seek
+ * @param offset Number of records to skip
+ * @return True if the position was found, false if the file has less records
  */
 bool maxavro_record_seek(MAXAVRO_FILE *file, uint64_t offset)
 {
-    bool rval = true;
+    uint64_t record;
 
-    if (offset < file->records_in_block - file->records_read_from_block)
+    if (file->last_error != MAXAVRO_ERR_NONE)
     {
-        /** Seek to the end of the block or to the position we want */
-        while (offset-- > 0)
-        {
-            skip_record(file);
-        }
+        return false;
     }
-    else
+
+    if (offset >= file->records_in_block - file->records_read_from_block)
     {
-        /** We're seeking past a block boundary */
-        offset -= (file->records_in_block - file->records_read_from_block);
-        maxavro_next_block(file);
+        const MAXAVRO_BLOCK_INDEX *block;
 
-        while (offset > file->records_in_block)
+        if (!current_record(file, &record) || (block = maxavro_index_find(file, record + offset)) == NULL)
         {
-            /** Skip full blocks that don't have the position we want */
-            offset -= file->records_in_block;
-            fseek(file->file, file->block_size, SEEK_CUR);
-            maxavro_next_block(file);
+            return false;
         }
 
-        ss_dassert(offset <= file->records_in_block);
+        /** Move directly to the block that has the record we want */
+        file->records_read += block->first_record - record;
+        offset = record + offset - block->first_record;
+        file->pos = block->offset;
 
-        while (offset-- > 0)
+        if (!maxavro_read_datablock_start(file))
         {
-            skip_record(file);
+            return false;
         }
     }
 
-    return rval;
+    while (offset-- > 0)
+    {
+        skip_record(file);
+    }
+
+    return true;
 }
 
 /**
@@ -282,15 +429,15 @@ bool maxavro_record_seek(MAXAVRO_FILE *file, uint64_t offset)
  */
 bool maxavro_record_set_pos(MAXAVRO_FILE *file, long pos)
 {
-    fseek(file->file, pos - SYNC_MARKER_SIZE, SEEK_SET);
+    file->pos = pos - SYNC_MARKER_SIZE;
     return maxavro_verify_block(file) && maxavro_read_datablock_start(file);
 }
 
 /**
  * @brief Read native Avro data
  *
- * This function reads a complete Avro data block from the disk and returns
- * the read data in its native Avro format.
+ * This function copies a complete Avro data block from the memory map of the
+ * file and returns the data in its native Avro format.
  *
  * @param file File to read from
  * @return Buffer containing the complete binary data block or NULL if an error
@@ -307,31 +454,15 @@ GWBUF* maxavro_record_read_binary(MAXAVRO_FILE *file)
             return NULL;
         }
 
+        /** A block is only started when it is completely in the map */
         long data_size = (file->data_start_pos - file->block_start_pos) + file->block_size;
         ss_dassert(data_size > 0);
-        rval = gwbuf_alloc(data_size + SYNC_MARKER_SIZE);
+        ss_dassert(file->block_start_pos + data_size + SYNC_MARKER_SIZE <= file->map_size);
+        rval = gwbuf_alloc_and_load(data_size + SYNC_MARKER_SIZE, file->map + file->block_start_pos);
 
         if (rval)
         {
-            fseek(file->file, file->block_start_pos, SEEK_SET);
-
-            if (fread(GWBUF_DATA(rval), 1, data_size, file->file) == data_size)
-            {
-                memcpy(((uint8_t*) GWBUF_DATA(rval)) + data_size, file->sync, sizeof(file->sync));
-                maxavro_next_block(file);
-            }
-            else
-            {
-                if (ferror(file->file))
-                {
-                    char err[STRERROR_BUFLEN];
-                    MXS_ERROR("Failed to read %ld bytes: %d, %s", data_size, errno,
-                              strerror_r(errno, err, sizeof(err)));
-                    file->last_error = MAXAVRO_ERR_IO;
-                }
-                gwbuf_free(rval);
-                rval = NULL;
-            }
+            maxavro_next_block(file);
         }
         else
         {
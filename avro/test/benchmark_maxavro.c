@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file benchmark_maxavro.c - Benchmark of the Avro file reader
+ *
+ * Writes an Avro file with the same schema as the avrorouter uses for its
+ * change records and reports
+ * - seek.index.us:  the time to seek to a random record with the block index
+ *                   and to read the record
+ * - seek.scan.us:   the time to find the same record by reading all records
+ *                   before it, as a GTID search without an index does
+ * - json.records/s and json.MB/s: streaming of the records as JSON
+ * - binary.records/s and binary.MB/s: streaming of the data blocks in the
+ *                   native Avro format
+ *
+ * The value of the sequence field of a record is its record number which is
+ * used to check that the seeks end up at the right record.
+ *
+ * Usage: benchmark_maxavro [records [records per block [directory]]]
+ */
+
+#include <maxavro.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define DEFAULT_RECORDS   1000000
+#define DEFAULT_BLOCK     1000
+#define SEEK_ITERATIONS   10000
+#define SCAN_ITERATIONS   20
+
+static const char schema[] =
+    "{\"namespace\": \"MaxScaleChangeDataSchema.avro\", \"type\": \"record\", "
+    "\"name\": \"ChangeRecord\", \"fields\": ["
+    "{\"name\": \"domain\", \"type\": \"int\"}, "
+    "{\"name\": \"server_id\", \"type\": \"int\"}, "
+    "{\"name\": \"sequence\", \"type\": \"int\"}, "
+    "{\"name\": \"event_number\", \"type\": \"int\"}, "
+    "{\"name\": \"timestamp\", \"type\": \"int\"}, "
+    "{\"name\": \"event_type\", \"type\": {\"type\": \"enum\", \"name\": \"EVENT_TYPES\", "
+    "\"symbols\": [\"insert\", \"update_before\", \"update_after\", \"delete\"]}}, "
+    "{\"name\": \"id\", \"type\": \"int\"}, "
+    "{\"name\": \"data\", \"type\": \"string\"}]}";
+
+static const uint8_t sync_marker[SYNC_MARKER_SIZE] =
+{
+    0x4d, 0x61, 0x78, 0x53, 0x63, 0x61, 0x6c, 0x65,
+    0x42, 0x65, 0x6e, 0x63, 0x68, 0x6d, 0x61, 0x72
+};
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static size_t
+encode_integer(uint8_t *dest, int64_t value)
+{
+    uint64_t encval = ((uint64_t)value << 1) ^ (value >> 63);
+    size_t n = 0;
+
+    while (encval & ~0x7fUL)
+    {
+        dest[n++] = 0x80 | (encval & 0x7f);
+        encval >>= 7;
+    }
+
+    dest[n++] = encval;
+    return n;
+}
+
+static size_t
+encode_string(uint8_t *dest, const char *str)
+{
+    size_t len = strlen(str);
+    size_t n = encode_integer(dest, len);
+    memcpy(dest + n, str, len);
+    return n + len;
+}
+
+static bool
+write_file(const char *filename, uint64_t records, uint64_t block_records)
+{
+    FILE *file = fopen(filename, "wb");
+
+    if (file == NULL)
+    {
+        perror(filename);
+        return false;
+    }
+
+    uint8_t header[sizeof(schema) + 128];
+    size_t len = 0;
+
+    memcpy(header, avro_magic, AVRO_MAGIC_SIZE);
+    len += AVRO_MAGIC_SIZE;
+    len += encode_integer(header + len, 2);
+    len += encode_string(header + len, "avro.codec");
+    len += encode_string(header + len, "null");
+    len += encode_string(header + len, "avro.schema");
+    len += encode_string(header + len, schema);
+    len += encode_integer(header + len, 0);
+    memcpy(header + len, sync_marker, SYNC_MARKER_SIZE);
+    len += SYNC_MARKER_SIZE;
+
+    bool rval = fwrite(header, 1, len, file) == len;
+    uint8_t *block = malloc(block_records * 128);
+    uint64_t record = 0;
+
+    while (rval && record < records)
+    {
+        uint64_t n_records = records - record < block_records ? records - record : block_records;
+        size_t size = 0;
+        char data[64];
+
+        for (uint64_t i = 0; i < n_records; i++, record++)
+        {
+            snprintf(data, sizeof(data), "row %lu of the benchmark table", record);
+            size += encode_integer(block + size, 0);
+            size += encode_integer(block + size, 3000);
+            size += encode_integer(block + size, record);
+            size += encode_integer(block + size, 1);
+            size += encode_integer(block + size, 1476000000 + record / 100);
+            size += encode_integer(block + size, 0);
+            size += encode_integer(block + size, record * 7);
+            size += encode_string(block + size, data);
+        }
+
+        len = encode_integer(header, n_records);
+        len += encode_integer(header + len, size);
+
+        rval = fwrite(header, 1, len, file) == len &&
+               fwrite(block, 1, size, file) == size &&
+               fwrite(sync_marker, 1, SYNC_MARKER_SIZE, file) == SYNC_MARKER_SIZE;
+    }
+
+    free(block);
+    return fclose(file) == 0 && rval;
+}
+
+/** Move to the first data block of the file */
+static bool
+rewind_file(MAXAVRO_FILE *file)
+{
+    return maxavro_record_set_pos(file, file->header_end_pos);
+}
+
+/** Check that the next record is the expected one */
+static bool
+check_record(MAXAVRO_FILE *file, uint64_t record)
+{
+    json_t *row = maxavro_record_read_json(file);
+    bool rval = row && json_integer_value(json_object_get(row, "sequence")) == record;
+    json_decref(row);
+
+    if (!rval)
+    {
+        fprintf(stderr, "Seek to record %lu failed\n", record);
+    }
+
+    return rval;
+}
+
+static bool
+bench_seek(MAXAVRO_FILE *file, uint64_t records)
+{
+    double index_time = 0;
+    double scan_time = 0;
+
+    srand(records);
+
+    for (int i = 0; i < SEEK_ITERATIONS; i++)
+    {
+        uint64_t record = (uint64_t)rand() * RAND_MAX % records;
+
+        if (!rewind_file(file))
+        {
+            return false;
+        }
+
+        double start = now();
+
+        if (!maxavro_record_seek(file, record) || !check_record(file, record))
+        {
+            return false;
+        }
+
+        index_time += now() - start;
+    }
+
+    for (int i = 0; i < SCAN_ITERATIONS; i++)
+    {
+        uint64_t record = (uint64_t)rand() * RAND_MAX % records;
+        bool found = false;
+
+        if (!rewind_file(file))
+        {
+            return false;
+        }
+
+        double start = now();
+
+        do
+        {
+            json_t *row;
+
+            while (!found && (row = maxavro_record_read_json(file)))
+            {
+                found = json_integer_value(json_object_get(row, "sequence")) == record;
+                json_decref(row);
+            }
+        }
+        while (!found && maxavro_next_block(file));
+
+        scan_time += now() - start;
+
+        if (!found)
+        {
+            fprintf(stderr, "Record %lu not found\n", record);
+            return false;
+        }
+    }
+
+    printf("seek.index.us: %.2f\n", index_time * 1000000 / SEEK_ITERATIONS);
+    printf("seek.scan.us: %.2f\n", scan_time * 1000000 / SCAN_ITERATIONS);
+    return true;
+}
+
+static bool
+bench_json(MAXAVRO_FILE *file, uint64_t records)
+{
+    uint64_t n = 0;
+    uint64_t bytes = 0;
+
+    if (!rewind_file(file))
+    {
+        return false;
+    }
+
+    double start = now();
+
+    do
+    {
+        json_t *row;
+
+        while ((row = maxavro_record_read_json(file)))
+        {
+            char *json = json_dumps(row, JSON_PRESERVE_ORDER);
+            bytes += strlen(json);
+            free(json);
+            json_decref(row);
+            n++;
+        }
+    }
+    while (maxavro_next_block(file));
+
+    double elapsed = now() - start;
+
+    printf("json.records/s: %.0f\n", n / elapsed);
+    printf("json.MB/s: %.1f\n", bytes / elapsed / (1024 * 1024));
+
+    return n == records;
+}
+
+static bool
+bench_binary(MAXAVRO_FILE *file, uint64_t records)
+{
+    uint64_t bytes = 0;
+    GWBUF *buffer;
+
+    if (!rewind_file(file))
+    {
+        return false;
+    }
+
+    uint64_t records_read = file->records_read;
+    double start = now();
+
+    while ((buffer = maxavro_record_read_binary(file)))
+    {
+        bytes += gwbuf_length(buffer);
+        gwbuf_free(buffer);
+    }
+
+    double elapsed = now() - start;
+    uint64_t n = file->records_read - records_read;
+
+    printf("binary.records/s: %.0f\n", n / elapsed);
+    printf("binary.MB/s: %.1f\n", bytes / elapsed / (1024 * 1024));
+
+    return n == records;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t records = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_RECORDS;
+    uint64_t block_records = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_BLOCK;
+    const char *directory = argc > 3 ? argv[3] : "/tmp";
+    char filename[PATH_MAX + 1];
+
+    if (records == 0 || block_records == 0)
+    {
+        fprintf(stderr, "Usage: %s [records [records per block [directory]]]\n", argv[0]);
+        return 1;
+    }
+
+    snprintf(filename, sizeof(filename), "%s/benchmark_maxavro.%d.avro", directory, getpid());
+
+    if (!write_file(filename, records, block_records))
+    {
+        unlink(filename);
+        return 1;
+    }
+
+    MAXAVRO_FILE *file = maxavro_file_open(filename);
+    int rval = 1;
+
+    if (file)
+    {
+        double start = now();
+        size_t blocks = maxavro_index_update(file);
+        printf("index.blocks: %lu\n", blocks);
+        printf("index.ms: %.3f\n", (now() - start) * 1000);
+
+        if (bench_seek(file, records) && bench_json(file, records) && bench_binary(file, records))
+        {
+            rval = 0;
+        }
+
+        maxavro_file_close(file);
+    }
+
+    unlink(filename);
+    return rval;
+}
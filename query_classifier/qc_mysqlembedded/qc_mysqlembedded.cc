@@ -2086,6 +2086,7 @@ static QUERY_CLASSIFIER qc =
     qc_query_has_clause,
     qc_get_affected_fields,
     qc_get_database_names,
+    NULL,
 };
 
  /* @see function load_module in load_utils.c for explanation of the following
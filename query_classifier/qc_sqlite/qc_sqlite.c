@@ -13,10 +13,15 @@
 
 #include <sqliteInt.h>
 
+#include <ctype.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
+#include <atomic.h>
+#include <spinlock.h>
 #include <log_manager.h>
 #include <modinfo.h>
+#include <modutil.h>
 #include <mysql_client_server_protocol.h>
 #include <platform.h>
 #include <query_classifier.h>
@@ -77,6 +82,7 @@ typedef struct qc_sqlite_info
     size_t database_names_capacity;  // The capacity of database_names.
     int keyword_1;                   // The first encountered keyword.
     int keyword_2;                   // The second encountered keyword.
+    int refcount;                    // Number of buffers and cache entries referring to this.
 } QC_SQLITE_INFO;
 
 typedef enum qc_log_level
@@ -88,6 +94,106 @@ typedef enum qc_log_level
 } qc_log_level_t;
 
 
+/**
+ * The default number of classifications cached by each thread.
+ */
+#define QC_DEFAULT_CACHE_SIZE 1024
+
+/**
+ * Longest canonical statement that is cached. Longer statements are
+ * typically bulk inserts that are not repeated in the same form.
+ */
+#define QC_CACHE_MAX_STATEMENT 2048
+
+/**
+ * Statements whose classification depends on the values of their literals,
+ * e.g. SET autocommit=1, are not cached.
+ */
+#define QC_CACHE_EXCLUDED_TYPES (QUERY_TYPE_SESSION_WRITE | QUERY_TYPE_GSYSVAR_WRITE | \
+                                 QUERY_TYPE_ENABLE_AUTOCOMMIT | QUERY_TYPE_DISABLE_AUTOCOMMIT | \
+                                 QUERY_TYPE_PREPARE_NAMED_STMT)
+
+/**
+ * A cached classification.
+ */
+typedef struct qc_cache_entry
+{
+    uint64_t hash;                   // Hash of the canonical statement.
+    char* canonical;                 // The canonical statement.
+    size_t canonical_len;            // The length of the canonical statement.
+    QC_SQLITE_INFO* info;            // The classification, shared with the buffers.
+    uint64_t parse_ns;               // The time it took to parse the statement.
+    struct qc_cache_entry* next;     // The next entry in the same bucket.
+    struct qc_cache_entry* lru_prev; // The next more recently used entry.
+    struct qc_cache_entry* lru_next; // The next less recently used entry.
+} QC_CACHE_ENTRY;
+
+/**
+ * Classification statistics of a thread. The counters are only updated by
+ * the thread itself, so qc_sqlite_get_cache_stats() may see values that are
+ * slightly behind. The statistics of a thread are kept after it has ended,
+ * so that the totals do not go backwards.
+ */
+typedef struct qc_sqlite_stats
+{
+    uint64_t fast_path;   // Statements classified without parsing them.
+    uint64_t hits;        // Statements whose classification was found in the cache.
+    uint64_t misses;      // Statements that had to be parsed.
+    uint64_t evictions;   // Classifications removed to make room for new ones.
+    uint64_t uncacheable; // Parsed statements that could not be cached.
+    uint64_t entries;     // Classifications in the cache of the thread.
+    uint64_t parse_ns;    // Time spent parsing statements.
+    uint64_t saved_ns;    // Parsing time the cache hits saved.
+    struct qc_sqlite_stats* next; // The statistics of the next thread.
+} QC_SQLITE_STATS;
+
+/**
+ * The maximum number of select list items and where clause conditions
+ * of a statement classified by the fast path.
+ */
+#define FAST_PATH_MAX_ITEMS 16
+
+/**
+ * The tokens recognized by the fast path.
+ */
+typedef enum fast_path_token
+{
+    FP_END,       // The end of the statement.
+    FP_WORD,      // An unquoted identifier or keyword.
+    FP_QUOTED,    // A backquoted identifier.
+    FP_INTEGER,   // An unsigned integer.
+    FP_STRING,    // A single quoted string.
+    FP_PARAMETER, // A '?' placeholder.
+    FP_COMMA,
+    FP_DOT,
+    FP_EQ,
+    FP_STAR,
+    FP_SEMICOLON,
+    FP_OTHER,     // Anything else, the statement is left to the parser.
+} fast_path_token_t;
+
+/**
+ * The state of the fast path tokenizer.
+ */
+typedef struct fast_path_lexer
+{
+    const char* pos;         // The start of the next token.
+    const char* end;         // The end of the statement.
+    fast_path_token_t token; // The current token.
+    const char* z;           // The text of the current token, without quotes.
+    size_t n;                // The length of the text.
+} FAST_PATH_LEXER;
+
+/**
+ * A name in a statement classified by the fast path.
+ */
+typedef struct fast_path_name
+{
+    const char* z;  // The name, not NULL terminated.
+    size_t n;       // The length of the name.
+    bool is_column; // Whether it is a column, or a literal or '*' in a select list.
+} FAST_PATH_NAME;
+
 /**
  * The state of qc_sqlite.
  */
@@ -95,6 +201,10 @@ static struct
 {
     bool initialized;
     qc_log_level_t log_level;
+    size_t cache_size; // The number of classifications cached by each thread.
+    bool fast_path;    // Whether trivial statements are classified without parsing them.
+    SPINLOCK stats_lock;     // Protects stats.
+    QC_SQLITE_STATS* stats;  // The statistics of all threads.
 } this_unit;
 
 /**
@@ -105,6 +215,14 @@ static thread_local struct
     bool initialized;
     sqlite3* db;      // Thread specific database handle.
     QC_SQLITE_INFO* info;
+    QC_CACHE_ENTRY* cache_entries;  // The cache entries, this_unit.cache_size of them.
+    size_t cache_used;              // The number of entries in use.
+    QC_CACHE_ENTRY** cache_buckets; // The hash table of the cache.
+    size_t cache_mask;              // The number of buckets minus one.
+    QC_CACHE_ENTRY* cache_lru_head; // The most recently used entry.
+    QC_CACHE_ENTRY* cache_lru_tail; // The least recently used entry.
+    QC_SQLITE_STATS* stats;         // The statistics of this thread, in this_unit.stats.
+    char* canonical;                // Buffer for the canonical statement being classified.
 } this_thread;
 
 /**
@@ -120,15 +238,22 @@ typedef enum qc_token_position
 
 static void append_affected_field(QC_SQLITE_INFO* info, const char* s);
 static void buffer_object_free(void* data);
+static bool cache_alloc(void);
+static void cache_free(void);
+static QC_SQLITE_INFO* cache_get(uint64_t hash, size_t len);
+static int cache_key(uint8_t command, const char* query, size_t len, uint64_t* phash);
+static void cache_put(uint64_t hash, size_t len, QC_SQLITE_INFO* info, uint64_t parse_ns);
 static char** copy_string_array(char** strings, int* pn);
 static void enlarge_string_array(size_t n, size_t len, char*** ppzStrings, size_t* pCapacity);
 static bool ensure_query_is_parsed(GWBUF* query);
+static QC_SQLITE_INFO* fast_path_classify(const char* query, size_t len);
 static void free_string_array(char** sa);
 static QC_SQLITE_INFO* get_query_info(GWBUF* query);
 static QC_SQLITE_INFO* info_alloc(void);
 static void info_finish(QC_SQLITE_INFO* info);
 static void info_free(QC_SQLITE_INFO* info);
 static QC_SQLITE_INFO* info_init(QC_SQLITE_INFO* info);
+static void info_release(QC_SQLITE_INFO* info);
 static bool is_submitted_query(const QC_SQLITE_INFO* info, const Parse* pParse);
 static bool parse_query(GWBUF* query);
 static void parse_query_string(const char* query, size_t len);
@@ -170,6 +295,7 @@ extern void exposed_sqlite3FinishTrigger(Parse *pParse,
                                          TriggerStep *pStepList,
                                          Token *pAll);
 extern int exposed_sqlite3Dequote(char *z);
+extern int exposed_sqlite3KeywordCode(const unsigned char* z, int n);
 extern int exposed_sqlite3EndTable(Parse*, Token*, Token*, u8, Select*);
 extern int exposed_sqlite3Select(Parse* pParse, Select* p, SelectDest* pDest);
 extern void exposed_sqlite3StartTable(Parse *pParse,   /* Parser context */
@@ -182,64 +308,859 @@ extern void exposed_sqlite3StartTable(Parse *pParse,   /* Parser context */
 extern void maxscaleCollectInfoFromSelect(Parse*, Select*);
 
 /**
- * Used for freeing a QC_SQLITE_INFO object added to a GWBUF.
+ * Used for freeing a QC_SQLITE_INFO object added to a GWBUF.
+ *
+ * @param object A pointer to a QC_SQLITE_INFO object.
+ */
+static void buffer_object_free(void* data)
+{
+    info_release((QC_SQLITE_INFO*) data);
+}
+
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Allocates the classification cache of the current thread.
+ *
+ * @return True, if the cache could be allocated or it is disabled.
+ */
+static bool cache_alloc(void)
+{
+    size_t n_buckets = 1;
+
+    if (this_unit.cache_size == 0)
+    {
+        return true;
+    }
+
+    while (n_buckets < 2 * this_unit.cache_size)
+    {
+        n_buckets *= 2;
+    }
+
+    this_thread.cache_entries = (QC_CACHE_ENTRY*) MXS_CALLOC(this_unit.cache_size, sizeof(QC_CACHE_ENTRY));
+    this_thread.cache_buckets = (QC_CACHE_ENTRY**) MXS_CALLOC(n_buckets, sizeof(QC_CACHE_ENTRY*));
+    this_thread.canonical = (char*) MXS_MALLOC(QC_CACHE_MAX_STATEMENT);
+
+    if (!this_thread.cache_entries || !this_thread.cache_buckets || !this_thread.canonical)
+    {
+        cache_free();
+        return false;
+    }
+
+    this_thread.cache_mask = n_buckets - 1;
+    this_thread.cache_used = 0;
+    this_thread.cache_lru_head = NULL;
+    this_thread.cache_lru_tail = NULL;
+
+    return true;
+}
+
+/**
+ * Frees the classification cache of the current thread. The classifications
+ * still attached to buffers are freed when the buffers are.
+ */
+static void cache_free(void)
+{
+    for (size_t i = 0; i < this_thread.cache_used; ++i)
+    {
+        info_release(this_thread.cache_entries[i].info);
+        MXS_FREE(this_thread.cache_entries[i].canonical);
+    }
+
+    MXS_FREE(this_thread.cache_entries);
+    MXS_FREE(this_thread.cache_buckets);
+    MXS_FREE(this_thread.canonical);
+
+    this_thread.cache_entries = NULL;
+    this_thread.cache_buckets = NULL;
+    this_thread.canonical = NULL;
+    this_thread.cache_used = 0;
+    this_thread.cache_lru_head = NULL;
+    this_thread.cache_lru_tail = NULL;
+    this_thread.stats->entries = 0;
+}
+
+static void cache_lru_unlink(QC_CACHE_ENTRY* entry)
+{
+    if (entry->lru_prev)
+    {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else
+    {
+        this_thread.cache_lru_head = entry->lru_next;
+    }
+
+    if (entry->lru_next)
+    {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else
+    {
+        this_thread.cache_lru_tail = entry->lru_prev;
+    }
+}
+
+static void cache_lru_push(QC_CACHE_ENTRY* entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = this_thread.cache_lru_head;
+
+    if (this_thread.cache_lru_head)
+    {
+        this_thread.cache_lru_head->lru_prev = entry;
+    }
+    else
+    {
+        this_thread.cache_lru_tail = entry;
+    }
+
+    this_thread.cache_lru_head = entry;
+}
+
+/**
+ * Creates the cache key of a statement. The command byte followed by the
+ * digest of the statement is written to the thread's canonical buffer, see
+ * modutil_digest(). Unlike the default digest, the key keeps the case of the
+ * statement, executable comments, optimizer hints and double quoted strings,
+ * as they can change the classification.
+ *
+ * @param command The command byte of the packet.
+ * @param query   The statement.
+ * @param len     The length of the statement.
+ * @param phash   The hash of the canonical statement is returned here.
+ *
+ * @return The length of the canonical statement, or -1 if the statement
+ *         cannot be cached.
+ */
+static int cache_key(uint8_t command, const char* query, size_t len, uint64_t* phash)
+{
+    const int flags = MODUTIL_DIGEST_KEEP_CASE | MODUTIL_DIGEST_KEEP_HINTS |
+        MODUTIL_DIGEST_KEEP_DQUOTED | MODUTIL_DIGEST_EXACT;
+    uint64_t hash;
+
+    this_thread.canonical[0] = command;
+    int rv = modutil_digest(query, len, flags, this_thread.canonical + 1, QC_CACHE_MAX_STATEMENT - 1, &hash);
+
+    if (rv >= 0)
+    {
+        // Mix the command into the hash as FNV-1a does.
+        *phash = (hash ^ command) * 0x100000001b3ULL;
+        ++rv;
+    }
+
+    return rv;
+}
+
+/**
+ * Looks up the classification of the statement in the thread's canonical
+ * buffer.
+ *
+ * @param hash The hash of the canonical statement.
+ * @param len  The length of the canonical statement.
+ *
+ * @return The classification with its reference count incremented, or NULL
+ *         if the statement is not in the cache.
+ */
+static QC_SQLITE_INFO* cache_get(uint64_t hash, size_t len)
+{
+    QC_CACHE_ENTRY* entry = this_thread.cache_buckets[hash & this_thread.cache_mask];
+
+    while (entry && (entry->hash != hash || entry->canonical_len != len ||
+                     memcmp(entry->canonical, this_thread.canonical, len) != 0))
+    {
+        entry = entry->next;
+    }
+
+    if (entry)
+    {
+        if (entry != this_thread.cache_lru_head)
+        {
+            cache_lru_unlink(entry);
+            cache_lru_push(entry);
+        }
+
+        atomic_add(&entry->info->refcount, 1);
+
+        this_thread.stats->hits++;
+        this_thread.stats->saved_ns += entry->parse_ns;
+
+        return entry->info;
+    }
+
+    this_thread.stats->misses++;
+
+    return NULL;
+}
+
+/**
+ * Adds the classification of the statement in the thread's canonical buffer
+ * to the cache. The least recently used classification is evicted if the
+ * cache is full.
+ *
+ * @param hash     The hash of the canonical statement.
+ * @param len      The length of the canonical statement.
+ * @param info     The classification.
+ * @param parse_ns The time it took to parse the statement.
+ */
+static void cache_put(uint64_t hash, size_t len, QC_SQLITE_INFO* info, uint64_t parse_ns)
+{
+    if (!qc_info_was_parsed(info->status) || (info->types & QC_CACHE_EXCLUDED_TYPES))
+    {
+        this_thread.stats->uncacheable++;
+        return;
+    }
+
+    char* canonical = (char*) MXS_MALLOC(len);
+
+    if (!canonical)
+    {
+        return;
+    }
+
+    memcpy(canonical, this_thread.canonical, len);
+
+    QC_CACHE_ENTRY* entry;
+
+    if (this_thread.cache_used < this_unit.cache_size)
+    {
+        entry = &this_thread.cache_entries[this_thread.cache_used++];
+        this_thread.stats->entries = this_thread.cache_used;
+    }
+    else
+    {
+        entry = this_thread.cache_lru_tail;
+        cache_lru_unlink(entry);
+
+        QC_CACHE_ENTRY** pprev = &this_thread.cache_buckets[entry->hash & this_thread.cache_mask];
+
+        while (*pprev != entry)
+        {
+            pprev = &(*pprev)->next;
+        }
+
+        *pprev = entry->next;
+
+        info_release(entry->info);
+        MXS_FREE(entry->canonical);
+        this_thread.stats->evictions++;
+    }
+
+    atomic_add(&info->refcount, 1);
+
+    entry->hash = hash;
+    entry->canonical = canonical;
+    entry->canonical_len = len;
+    entry->info = info;
+    entry->parse_ns = parse_ns;
+
+    QC_CACHE_ENTRY** bucket = &this_thread.cache_buckets[hash & this_thread.cache_mask];
+    entry->next = *bucket;
+    *bucket = entry;
+
+    cache_lru_push(entry);
+}
+
+static char** copy_string_array(char** strings, int* pn)
+{
+    size_t n = 0;
+
+    char** ss = strings;
+    *pn = 0;
+
+    while (*ss)
+    {
+        ++ss;
+        ++(*pn);
+    }
+
+    ss = (char**) MXS_MALLOC((*pn + 1) * sizeof(char*));
+    MXS_ABORT_IF_NULL(ss);
+
+    ss[*pn] = 0;
+
+    for (int i = 0; i < *pn; ++i)
+    {
+        ss[i] = MXS_STRDUP(strings[i]);
+        MXS_ABORT_IF_NULL(ss[i]);
+    }
+
+    return ss;
+}
+
+static void enlarge_string_array(size_t n, size_t len, char*** ppzStrings, size_t* pCapacity)
+{
+    if (len + n >= *pCapacity)
+    {
+        int capacity = *pCapacity ? *pCapacity * 2 : 4;
+
+        *ppzStrings = (char**) MXS_REALLOC(*ppzStrings, capacity * sizeof(char**));
+        MXS_ABORT_IF_NULL(*ppzStrings);
+        *pCapacity = capacity;
+    }
+}
+
+static bool ensure_query_is_parsed(GWBUF* query)
+{
+    bool parsed = query_is_parsed(query);
+
+    if (!parsed)
+    {
+        parsed = parse_query(query);
+    }
+
+    return parsed;
+}
+
+/**
+ * Moves the fast path tokenizer to the next token of the statement.
+ *
+ * @param l The tokenizer.
+ *
+ * @return The new current token.
+ */
+static fast_path_token_t fast_path_next(FAST_PATH_LEXER* l)
+{
+    const char* p = l->pos;
+    const char* end = l->end;
+
+    while ((p < end) && isspace((unsigned char)*p))
+    {
+        ++p;
+    }
+
+    l->z = p;
+    l->n = 0;
+
+    if ((p == end) || (*p == 0))
+    {
+        l->token = FP_END;
+    }
+    else if (isalpha((unsigned char)*p) || (*p == '_'))
+    {
+        while ((p < end) && (isalnum((unsigned char)*p) || (*p == '_') || (*p == '$')))
+        {
+            ++p;
+        }
+
+        l->n = p - l->z;
+        // An introducer or a hexadecimal or binary literal, e.g. _utf8'a' or x'0a'.
+        l->token = ((p < end) && (*p == '\'')) ? FP_OTHER : FP_WORD;
+    }
+    else if (isdigit((unsigned char)*p))
+    {
+        while ((p < end) && isdigit((unsigned char)*p))
+        {
+            ++p;
+        }
+
+        l->n = p - l->z;
+        // E.g. 1.5, 1e3, 0x0a or an identifier such as 1a.
+        bool is_integer = (p == end) || !(isalpha((unsigned char)*p) || (*p == '_') || (*p == '$') || (*p == '.'));
+        l->token = is_integer ? FP_INTEGER : FP_OTHER;
+    }
+    else if ((*p == '\'') || (*p == '`'))
+    {
+        char quote = *p++;
+        l->z = p;
+
+        while ((p < end) && (*p != quote))
+        {
+            if ((quote == '\'') && (*p == '\\') && (p + 1 < end))
+            {
+                ++p;
+            }
+
+            ++p;
+        }
+
+        l->n = p - l->z;
+
+        if ((p == end) || ((p + 1 < end) && (p[1] == quote)))
+        {
+            // Unterminated, or a quote within the string or identifier.
+            l->token = FP_OTHER;
+        }
+        else if (quote == '`')
+        {
+            // Names starting with a quote would be dequoted once more by update_names().
+            bool is_plain = (l->n != 0) && !strchr("\"'[", *l->z);
+            l->token = is_plain ? FP_QUOTED : FP_OTHER;
+        }
+        else
+        {
+            l->token = FP_STRING;
+        }
+
+        ++p;
+    }
+    else
+    {
+        switch (*p)
+        {
+        case '?':
+            l->token = FP_PARAMETER;
+            break;
+
+        case ',':
+            l->token = FP_COMMA;
+            break;
+
+        case '.':
+            l->token = FP_DOT;
+            break;
+
+        case '=':
+            l->token = FP_EQ;
+            break;
+
+        case '*':
+            l->token = FP_STAR;
+            break;
+
+        case ';':
+            l->token = FP_SEMICOLON;
+            break;
+
+        default:
+            l->token = FP_OTHER;
+        }
+
+        ++p;
+    }
+
+    l->pos = p;
+
+    return l->token;
+}
+
+/**
+ * Checks whether the current token is a particular keyword and, if it is,
+ * moves to the next token.
+ *
+ * @param l       The tokenizer.
+ * @param keyword The keyword, in upper case.
+ *
+ * @return True, if the current token was the keyword.
+ */
+static bool fast_path_keyword(FAST_PATH_LEXER* l, const char* keyword)
+{
+    bool rv = (l->token == FP_WORD) && (strlen(keyword) == l->n) && (strncasecmp(l->z, keyword, l->n) == 0);
+
+    if (rv)
+    {
+        fast_path_next(l);
+    }
+
+    return rv;
+}
+
+/**
+ * Checks whether the current and the next token are particular keywords and,
+ * if they are, moves past them. Otherwise the tokenizer is left where it was,
+ * so that a failed alternative does not consume the tokens of the next one.
+ *
+ * @param l      The tokenizer.
+ * @param first  The first keyword, in upper case.
+ * @param second The second keyword, in upper case.
+ *
+ * @return True, if the tokens were the keywords.
+ */
+static bool fast_path_keywords(FAST_PATH_LEXER* l, const char* first, const char* second)
+{
+    FAST_PATH_LEXER saved = *l;
+    bool rv = fast_path_keyword(l, first) && fast_path_keyword(l, second);
+
+    if (!rv)
+    {
+        *l = saved;
+    }
+
+    return rv;
+}
+
+/**
+ * Checks whether the current token is a name and, if it is, stores it and
+ * moves to the next token. Unquoted keywords are not accepted as names, as
+ * the parser may treat them differently.
+ *
+ * @param l    The tokenizer.
+ * @param name The name is stored here.
+ *
+ * @return True, if the current token was a name.
+ */
+static bool fast_path_name(FAST_PATH_LEXER* l, FAST_PATH_NAME* name)
+{
+    bool rv = false;
+
+    if (l->token == FP_QUOTED)
+    {
+        rv = true;
+    }
+    else if (l->token == FP_WORD)
+    {
+        rv = (exposed_sqlite3KeywordCode((const unsigned char*)l->z, l->n) == TK_ID) &&
+             !((l->n == 4) && (strncasecmp(l->z, "true", 4) == 0)) &&
+             !((l->n == 5) && (strncasecmp(l->z, "false", 5) == 0));
+    }
+
+    if (rv)
+    {
+        name->z = l->z;
+        name->n = l->n;
+        name->is_column = true;
+
+        fast_path_next(l);
+    }
+
+    return rv;
+}
+
+/**
+ * Checks whether the current token is a literal and, if it is, moves to
+ * the next token.
+ *
+ * @param l The tokenizer.
+ *
+ * @return True, if the current token was a literal.
+ */
+static bool fast_path_literal(FAST_PATH_LEXER* l)
+{
+    bool rv = (l->token == FP_INTEGER) || (l->token == FP_STRING) || (l->token == FP_PARAMETER);
+
+    if (rv)
+    {
+        fast_path_next(l);
+    }
+
+    return rv;
+}
+
+/**
+ * Checks whether the statement ends at the current token.
+ *
+ * @param l The tokenizer.
+ *
+ * @return True, if nothing but an optional ';' follows.
+ */
+static bool fast_path_end(FAST_PATH_LEXER* l)
+{
+    if (l->token == FP_SEMICOLON)
+    {
+        fast_path_next(l);
+    }
+
+    return l->token == FP_END;
+}
+
+/**
+ * Checks whether the current token starts a column or, in a select list,
+ * '*' or a literal, and stores the column name. A qualified column name is
+ * stored without the qualifier.
+ *
+ * @param l       The tokenizer.
+ * @param column  The column is stored here.
+ * @param is_item Whether '*' and literals are accepted.
+ *
+ * @return True, if the current token started a column.
+ */
+static bool fast_path_column(FAST_PATH_LEXER* l, FAST_PATH_NAME* column, bool is_item)
+{
+    bool rv = false;
+
+    if (is_item && (l->token == FP_STAR))
+    {
+        column->z = "*";
+        column->n = 1;
+        column->is_column = false;
+
+        fast_path_next(l);
+        rv = true;
+    }
+    else if (is_item && fast_path_literal(l))
+    {
+        column->z = NULL;
+        column->n = 0;
+        column->is_column = false;
+        rv = true;
+    }
+    else if (fast_path_name(l, column))
+    {
+        rv = true;
+
+        if (l->token == FP_DOT)
+        {
+            fast_path_next(l);
+            rv = fast_path_name(l, column);
+        }
+    }
+
+    return rv;
+}
+
+/**
+ * Recognizes SELECT statements of the form
  *
- * @param object A pointer to a QC_SQLITE_INFO object.
+ *   SELECT item[, item]... [FROM [db.]tbl [WHERE col = literal [AND col = literal]...]] [LIMIT n]
+ *
+ * where an item is '*', a literal or a column, and classifies them as the
+ * parser would.
+ *
+ * @param l The tokenizer, positioned after SELECT.
+ *
+ * @return The classification, or NULL if the statement is not of this form.
  */
-static void buffer_object_free(void* data)
+static QC_SQLITE_INFO* fast_path_select(FAST_PATH_LEXER* l)
 {
-    info_free((QC_SQLITE_INFO*) data);
-}
+    FAST_PATH_NAME items[FAST_PATH_MAX_ITEMS];
+    FAST_PATH_NAME conditions[FAST_PATH_MAX_ITEMS];
+    FAST_PATH_NAME database = { NULL, 0, false };
+    FAST_PATH_NAME table = { NULL, 0, false };
+    int n_items = 0;
+    int n_conditions = 0;
 
-static char** copy_string_array(char** strings, int* pn)
-{
-    size_t n = 0;
+    for (;;)
+    {
+        if ((n_items == FAST_PATH_MAX_ITEMS) || !fast_path_column(l, &items[n_items++], true))
+        {
+            return NULL;
+        }
 
-    char** ss = strings;
-    *pn = 0;
+        if (l->token != FP_COMMA)
+        {
+            break;
+        }
 
-    while (*ss)
+        fast_path_next(l);
+    }
+
+    if (fast_path_keyword(l, "FROM"))
     {
-        ++ss;
-        ++(*pn);
+        if (!fast_path_name(l, &table))
+        {
+            return NULL;
+        }
+
+        if (l->token == FP_DOT)
+        {
+            database = table;
+            fast_path_next(l);
+
+            if (!fast_path_name(l, &table))
+            {
+                return NULL;
+            }
+        }
+
+        if (fast_path_keyword(l, "WHERE"))
+        {
+            do
+            {
+                if ((n_conditions == FAST_PATH_MAX_ITEMS) ||
+                    !fast_path_column(l, &conditions[n_conditions++], false) ||
+                    (l->token != FP_EQ))
+                {
+                    return NULL;
+                }
+
+                fast_path_next(l);
+
+                if (!fast_path_literal(l))
+                {
+                    return NULL;
+                }
+            }
+            while (fast_path_keyword(l, "AND"));
+        }
+    }
+    else
+    {
+        for (int i = 0; i < n_items; ++i)
+        {
+            if (items[i].z && !items[i].is_column)
+            {
+                return NULL; // SELECT * without FROM
+            }
+        }
     }
 
-    ss = (char**) MXS_MALLOC((*pn + 1) * sizeof(char*));
-    MXS_ABORT_IF_NULL(ss);
+    if (fast_path_keyword(l, "LIMIT"))
+    {
+        if (l->token != FP_INTEGER)
+        {
+            return NULL;
+        }
 
-    ss[*pn] = 0;
+        fast_path_next(l);
+    }
 
-    for (int i = 0; i < *pn; ++i)
+    if (!fast_path_end(l))
     {
-        ss[i] = MXS_STRDUP(strings[i]);
-        MXS_ABORT_IF_NULL(ss[i]);
+        return NULL;
     }
 
-    return ss;
-}
+    QC_SQLITE_INFO* info = info_alloc();
 
-static void enlarge_string_array(size_t n, size_t len, char*** ppzStrings, size_t* pCapacity)
-{
-    if (len + n >= *pCapacity)
+    if (info)
     {
-        int capacity = *pCapacity ? *pCapacity * 2 : 4;
+        info->status = QC_QUERY_PARSED;
+        info->types = QUERY_TYPE_READ;
+        info->operation = QUERY_OP_SELECT;
 
-        *ppzStrings = (char**) MXS_REALLOC(*ppzStrings, capacity * sizeof(char**));
-        MXS_ABORT_IF_NULL(*ppzStrings);
-        *pCapacity = capacity;
+        if (table.z)
+        {
+            char zTable[table.n + 1];
+            char zDatabase[database.n + 1];
+
+            memcpy(zTable, table.z, table.n);
+            zTable[table.n] = 0;
+
+            if (database.z)
+            {
+                memcpy(zDatabase, database.z, database.n);
+                zDatabase[database.n] = 0;
+            }
+
+            update_names(info, database.z ? zDatabase : NULL, zTable);
+            info->is_real_query = true;
+        }
+
+        for (int i = 0; i < n_items; ++i)
+        {
+            if (items[i].z)
+            {
+                char zName[items[i].n + 1];
+                memcpy(zName, items[i].z, items[i].n);
+                zName[items[i].n] = 0;
+
+                append_affected_field(info, zName);
+            }
+        }
+
+        info->has_clause = n_conditions != 0;
+
+        for (int i = 0; i < n_conditions; ++i)
+        {
+            bool exclude = false;
+
+            // As in should_exclude(), columns of the select list are not reported twice.
+            for (int j = 0; !exclude && (j < n_items); ++j)
+            {
+                exclude = items[j].is_column && (items[j].n == conditions[i].n) &&
+                          (strncasecmp(items[j].z, conditions[i].z, conditions[i].n) == 0);
+            }
+
+            if (!exclude)
+            {
+                char zName[conditions[i].n + 1];
+                memcpy(zName, conditions[i].z, conditions[i].n);
+                zName[conditions[i].n] = 0;
+
+                append_affected_field(info, zName);
+            }
+        }
     }
+
+    return info;
 }
 
-static bool ensure_query_is_parsed(GWBUF* query)
+/**
+ * Classifies trivial statements without parsing them. The recognized
+ * statements are BEGIN, START TRANSACTION, COMMIT, ROLLBACK, USE db,
+ * SET autocommit and simple SELECTs, see fast_path_select(). Whenever
+ * the statement is not exactly of one of these forms, e.g. if it contains
+ * comments, functions or keywords used as names, it is left to the parser.
+ *
+ * @param query The statement.
+ * @param len   The length of the statement.
+ *
+ * @return The classification, or NULL if the statement must be parsed.
+ */
+static QC_SQLITE_INFO* fast_path_classify(const char* query, size_t len)
 {
-    bool parsed = query_is_parsed(query);
+    FAST_PATH_LEXER l = { query, query + len, FP_END, NULL, 0 };
+    QC_SQLITE_INFO* info = NULL;
+    uint32_t types = QUERY_TYPE_UNKNOWN;
+    qc_query_op_t operation = QUERY_OP_UNDEFINED;
+    FAST_PATH_NAME name;
 
-    if (!parsed)
+    fast_path_next(&l);
+
+    if (fast_path_keyword(&l, "SELECT"))
     {
-        parsed = parse_query(query);
+        return fast_path_select(&l);
+    }
+    else if (fast_path_keyword(&l, "BEGIN") ||
+             fast_path_keywords(&l, "START", "TRANSACTION"))
+    {
+        types = QUERY_TYPE_BEGIN_TRX;
+    }
+    else if (fast_path_keyword(&l, "COMMIT"))
+    {
+        types = QUERY_TYPE_COMMIT;
+    }
+    else if (fast_path_keyword(&l, "ROLLBACK"))
+    {
+        types = QUERY_TYPE_ROLLBACK;
+    }
+    else if (fast_path_keyword(&l, "USE"))
+    {
+        if (fast_path_name(&l, &name))
+        {
+            types = QUERY_TYPE_SESSION_WRITE;
+            operation = QUERY_OP_CHANGE_DB;
+        }
     }
+    else if (fast_path_keywords(&l, "SET", "AUTOCOMMIT") && (l.token == FP_EQ))
+    {
+        fast_path_next(&l);
 
-    return parsed;
+        int enable = -1;
+
+        if (l.token == FP_INTEGER)
+        {
+            if (l.n == 1)
+            {
+                enable = (*l.z == '1') ? 1 : ((*l.z == '0') ? 0 : -1);
+            }
+
+            fast_path_next(&l);
+        }
+        else if (fast_path_keyword(&l, "ON") || fast_path_keyword(&l, "TRUE"))
+        {
+            enable = 1;
+        }
+        else if (fast_path_keyword(&l, "OFF") || fast_path_keyword(&l, "FALSE"))
+        {
+            enable = 0;
+        }
+
+        // As in maxscaleSet().
+        if (enable == 1)
+        {
+            types = QUERY_TYPE_GSYSVAR_WRITE | QUERY_TYPE_ENABLE_AUTOCOMMIT | QUERY_TYPE_COMMIT;
+        }
+        else if (enable == 0)
+        {
+            types = QUERY_TYPE_GSYSVAR_WRITE | QUERY_TYPE_BEGIN_TRX | QUERY_TYPE_DISABLE_AUTOCOMMIT;
+        }
+    }
+
+    if ((types != QUERY_TYPE_UNKNOWN) && fast_path_end(&l) && (info = info_alloc()))
+    {
+        info->status = QC_QUERY_PARSED;
+        info->types = types;
+        info->operation = operation;
+    }
+
+    return info;
 }
 
 static void free_string_array(char** sa)
@@ -299,6 +1220,21 @@ static void info_free(QC_SQLITE_INFO* info)
     }
 }
 
+/**
+ * Releases a reference to a QC_SQLITE_INFO object. A classification may be
+ * shared by the buffers of several threads and the classification cache, and
+ * it is freed when the last reference is released.
+ *
+ * @param info The object to release.
+ */
+static void info_release(QC_SQLITE_INFO* info)
+{
+    if (info && atomic_add(&info->refcount, -1) == 1)
+    {
+        info_free(info);
+    }
+}
+
 static QC_SQLITE_INFO* info_init(QC_SQLITE_INFO* info)
 {
     memset(info, 0, sizeof(*info));
@@ -325,6 +1261,7 @@ static QC_SQLITE_INFO* info_init(QC_SQLITE_INFO* info)
     info->database_names_capacity = 0;
     info->keyword_1 = 0; // Sqlite3 starts numbering tokens from 1, so 0 means
     info->keyword_2 = 0; // that we have not seen a keyword.
+    info->refcount = 1;
 
     return info;
 }
@@ -432,18 +1369,36 @@ static bool parse_query(GWBUF* query)
     bool parsed = false;
     ss_dassert(!query_is_parsed(query));
 
-    QC_SQLITE_INFO* info = info_alloc();
+    // TODO: Somewhere it needs to be ensured that this buffer is contiguous.
+    // TODO: Where is it checked that the GWBUF really contains a query?
+    uint8_t* data = (uint8_t*) GWBUF_DATA(query);
+    size_t len = MYSQL_GET_PACKET_LEN(data) - 1; // Subtract 1 for packet type byte.
+
+    const char* s = (const char*) &data[5]; // TODO: Are there symbolic constants somewhere?
+
+    QC_SQLITE_INFO* info = this_unit.fast_path ? fast_path_classify(s, len) : NULL;
+    uint64_t hash = 0;
+    int canonical_len = -1;
 
     if (info)
     {
-        this_thread.info = info;
+        this_thread.stats->fast_path++;
+    }
+    else if (this_thread.canonical)
+    {
+        canonical_len = cache_key(data[4], s, len, &hash);
+
+        if (canonical_len >= 0)
+        {
+            info = cache_get(hash, canonical_len);
+        }
+    }
 
-        // TODO: Somewhere it needs to be ensured that this buffer is contiguous.
-        // TODO: Where is it checked that the GWBUF really contains a query?
-        uint8_t* data = (uint8_t*) GWBUF_DATA(query);
-        size_t len = MYSQL_GET_PACKET_LEN(data) - 1; // Subtract 1 for packet type byte.
+    if (!info && (info = info_alloc()))
+    {
+        this_thread.info = info;
 
-        const char* s = (const char*) &data[5]; // TODO: Are there symbolic constants somewhere?
+        uint64_t start = time_ns();
 
         this_thread.info->query = s;
         this_thread.info->query_len = len;
@@ -451,13 +1406,24 @@ static bool parse_query(GWBUF* query)
         this_thread.info->query = NULL;
         this_thread.info->query_len = 0;
 
+        uint64_t parse_ns = time_ns() - start;
+        this_thread.stats->parse_ns += parse_ns;
+
+        if (canonical_len >= 0)
+        {
+            cache_put(hash, canonical_len, info, parse_ns);
+        }
+
+        this_thread.info = NULL;
+    }
+
+    if (info)
+    {
         // TODO: Add return value to gwbuf_add_buffer_object.
         // Always added; also when it was not recognized. If it was not recognized now,
         // it won't be if we try a second time.
         gwbuf_add_buffer_object(query, GWBUF_PARSING_INFO, info, buffer_object_free);
         parsed = true;
-
-        this_thread.info = NULL;
     }
     else
     {
@@ -2326,6 +3292,8 @@ static bool get_key_and_value(char* arg, const char** pkey, const char** pvalue)
 }
 
 static char ARG_LOG_UNRECOGNIZED_STATEMENTS[] = "log_unrecognized_statements";
+static char ARG_CACHE_SIZE[] = "cache_size";
+static char ARG_FAST_PATH[] = "fast_path";
 
 static bool qc_sqlite_init(const char* args)
 {
@@ -2333,44 +3301,90 @@ static bool qc_sqlite_init(const char* args)
     assert(!this_unit.initialized);
 
     qc_log_level_t log_level = QC_LOG_NOTHING;
+    long cache_size = QC_DEFAULT_CACHE_SIZE;
+    bool fast_path = true;
 
     if (args)
     {
-        char arg[strlen(args) + 1];
-        strcpy(arg, args);
+        char copy[strlen(args) + 1];
+        strcpy(copy, args);
 
-        const char* key;
-        const char* value;
+        char* saveptr;
+        char* arg = strtok_r(copy, ",", &saveptr);
 
-        if (get_key_and_value(arg, &key, &value))
+        while (arg)
         {
-            if (strcmp(key, ARG_LOG_UNRECOGNIZED_STATEMENTS) == 0)
+            const char* key;
+            const char* value;
+
+            if (get_key_and_value(arg, &key, &value))
             {
-                char *end;
+                if (strcmp(key, ARG_LOG_UNRECOGNIZED_STATEMENTS) == 0)
+                {
+                    char *end;
+
+                    long l = strtol(value, &end, 0);
+
+                    if ((*end == 0) && (l >= QC_LOG_NOTHING) && (l <= QC_LOG_NON_TOKENIZED))
+                    {
+                        log_level = l;
+                    }
+                    else
+                    {
+                        MXS_WARNING("qc_sqlite: '%s' is not a number between %d and %d.",
+                                    value, QC_LOG_NOTHING, QC_LOG_NON_TOKENIZED);
+                    }
+                }
+                else if (strcmp(key, ARG_CACHE_SIZE) == 0)
+                {
+                    char *end;
 
-                long l = strtol(value, &end, 0);
+                    long l = strtol(value, &end, 0);
 
-                if ((*end == 0) && (l >= QC_LOG_NOTHING) && (l <= QC_LOG_NON_TOKENIZED))
+                    if ((*end == 0) && (l >= 0))
+                    {
+                        cache_size = l;
+                    }
+                    else
+                    {
+                        MXS_WARNING("qc_sqlite: '%s' is not a non-negative number.", value);
+                    }
+                }
+                else if (strcmp(key, ARG_FAST_PATH) == 0)
                 {
-                    log_level = l;
+                    char *end;
+
+                    long l = strtol(value, &end, 0);
+
+                    if ((*end == 0) && ((l == 0) || (l == 1)))
+                    {
+                        fast_path = l;
+                    }
+                    else
+                    {
+                        MXS_WARNING("qc_sqlite: '%s' is not 0 or 1.", value);
+                    }
                 }
                 else
                 {
-                    MXS_WARNING("qc_sqlite: '%s' is not a number between %d and %d.",
-                                value, QC_LOG_NOTHING, QC_LOG_NON_TOKENIZED);
+                    MXS_WARNING("qc_sqlite: '%s' is not a recognized argument.", key);
                 }
             }
             else
             {
-                MXS_WARNING("qc_sqlite: '%s' is not a recognized argument.", key);
+                MXS_WARNING("qc_sqlite: '%s' is not a recognized argument string.", arg);
             }
-        }
-        else
-        {
-            MXS_WARNING("qc_sqlite: '%s' is not a recognized argument string.", args);
+
+            arg = strtok_r(NULL, ",", &saveptr);
         }
     }
 
+    this_unit.cache_size = cache_size;
+    this_unit.fast_path = fast_path;
+
+    spinlock_init(&this_unit.stats_lock);
+    this_unit.stats = NULL;
+
     if (sqlite3_initialize() == 0)
     {
         this_unit.initialized = true;
@@ -2431,6 +3445,18 @@ static void qc_sqlite_end(void)
     qc_sqlite_thread_end();
 
     sqlite3_shutdown();
+
+    QC_SQLITE_STATS* stats = this_unit.stats;
+
+    while (stats)
+    {
+        QC_SQLITE_STATS* next = stats->next;
+        MXS_FREE(stats);
+        stats = next;
+    }
+
+    this_unit.stats = NULL;
+    this_thread.stats = NULL;
     this_unit.initialized = false;
 }
 
@@ -2440,14 +3466,39 @@ static bool qc_sqlite_thread_init(void)
     ss_dassert(this_unit.initialized);
     ss_dassert(!this_thread.initialized);
 
+    if (!this_thread.stats)
+    {
+        QC_SQLITE_STATS* stats = (QC_SQLITE_STATS*) MXS_CALLOC(1, sizeof(QC_SQLITE_STATS));
+
+        if (!stats)
+        {
+            return false;
+        }
+
+        spinlock_acquire(&this_unit.stats_lock);
+        stats->next = this_unit.stats;
+        this_unit.stats = stats;
+        spinlock_release(&this_unit.stats_lock);
+
+        this_thread.stats = stats;
+    }
+
     // TODO: It may be sufficient to have a single in-memory database for all threads.
     int rc = sqlite3_open(":memory:", &this_thread.db);
     if (rc == SQLITE_OK)
     {
-        this_thread.initialized = true;
+        if (cache_alloc())
+        {
+            this_thread.initialized = true;
 
-        MXS_INFO("qc_sqlite: In-memory sqlite database successfully opened for thread %lu.",
-                 (unsigned long) pthread_self());
+            MXS_INFO("qc_sqlite: In-memory sqlite database successfully opened for thread %lu.",
+                     (unsigned long) pthread_self());
+        }
+        else
+        {
+            sqlite3_close(this_thread.db);
+            this_thread.db = NULL;
+        }
     }
     else
     {
@@ -2474,6 +3525,29 @@ static void qc_sqlite_thread_end(void)
     }
 
     this_thread.db = NULL;
+
+    QC_SQLITE_STATS* stats = this_thread.stats;
+
+    if (this_unit.fast_path)
+    {
+        MXS_NOTICE("qc_sqlite: %lu statements were classified without parsing by thread %lu.",
+                   stats->fast_path, (unsigned long) pthread_self());
+    }
+
+    if (this_unit.cache_size != 0)
+    {
+        uint64_t lookups = stats->hits + stats->misses;
+
+        MXS_NOTICE("qc_sqlite: Classification cache of thread %lu: %lu hits, %lu misses "
+                   "(hit rate %.1f%%), %lu evictions, %lu uncacheable, %.3f ms spent parsing, "
+                   "%.3f ms of parsing saved.", (unsigned long) pthread_self(),
+                   stats->hits, stats->misses, lookups ? 100.0 * stats->hits / lookups : 0.0,
+                   stats->evictions, stats->uncacheable,
+                   stats->parse_ns / 1000000.0, stats->saved_ns / 1000000.0);
+    }
+
+    cache_free();
+
     this_thread.initialized = false;
 }
 
@@ -2782,6 +3856,32 @@ static char** qc_sqlite_get_database_names(GWBUF* query, int* sizep)
     return database_names;
 }
 
+static bool qc_sqlite_get_cache_stats(QC_CACHE_STATS* stats)
+{
+    QC_TRACE();
+    ss_dassert(this_unit.initialized);
+
+    memset(stats, 0, sizeof(*stats));
+
+    spinlock_acquire(&this_unit.stats_lock);
+
+    for (QC_SQLITE_STATS* s = this_unit.stats; s; s = s->next)
+    {
+        stats->fast_path += s->fast_path;
+        stats->hits += s->hits;
+        stats->misses += s->misses;
+        stats->evictions += s->evictions;
+        stats->uncacheable += s->uncacheable;
+        stats->entries += s->entries;
+        stats->parse_ns += s->parse_ns;
+        stats->saved_ns += s->saved_ns;
+    }
+
+    spinlock_release(&this_unit.stats_lock);
+
+    return true;
+}
+
 /**
  * EXPORTS
  */
@@ -2805,6 +3905,7 @@ static QUERY_CLASSIFIER qc =
     qc_sqlite_query_has_clause,
     qc_sqlite_get_affected_fields,
     qc_sqlite_get_database_names,
+    qc_sqlite_get_cache_stats,
 };
 
 
@@ -163,6 +163,11 @@ int exposed_sqlite3Dequote(char *z)
   return sqlite3Dequote(z);
 }
 
+int exposed_sqlite3KeywordCode(const unsigned char *z, int n)
+{
+  return sqlite3KeywordCode(z, n);
+}
+
 void exposed_sqlite3EndTable(Parse* pParse, Token* pCons, Token* pEnd, u8 tabOpts, Select* pSelect)
 {
   sqlite3EndTable(pParse, pCons, pEnd, tabOpts, pSelect);
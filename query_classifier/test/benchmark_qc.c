@@ -0,0 +1,658 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file benchmark_qc.c - Throughput, latency and memory benchmark of a query classifier
+ *
+ * Classifies a corpus of statements on a number of threads, each of which is
+ * initialized with qc_thread_init() as a worker thread of MaxScale is. The
+ * corpus consists of the statements of the given mysqltest files, e.g. the
+ * .test files of this directory, and of generated statements:
+ * - selects with long IN-lists
+ * - selects with deep joins
+ * - multi-row inserts
+ *
+ * The statements are divided into buckets by their length and the buckets are
+ * classified one after another, smallest first. Each thread classifies every
+ * statement of the bucket the given number of rounds, each time in a fresh
+ * buffer. For every bucket the following are reported, one "bucket.metric: value"
+ * per line
+ * - statements:                 the number of statements in the bucket
+ * - statements/s:               the classification throughput of all threads
+ * - p50_us, p99_us and max_us:  the time qc_parse() took for one statement
+ * - peak_rss_kb:                the peak resident set size of the process
+ *                               while the bucket was classified
+ * - rss_growth_kb/thread:       how much the peak exceeded the resident set size
+ *                               before the bucket, per thread, i.e. the memory
+ *                               a thread needs for parsing such statements
+ *
+ * The statements, statements/s and parse times of the whole corpus are reported
+ * as those of the bucket "all".
+ *
+ * The peak resident set size is reset before each bucket through
+ * /proc/self/clear_refs. If that is not possible, the peak is that of the
+ * whole run so far.
+ *
+ * Usage: benchmark_qc [-m module] [-a args] [-t threads] [-r rounds] [-g count] [file...]
+ *
+ * -m  the query classifier, qc_sqlite by default
+ * -a  the query classifier arguments, cache_size=0 by default so that every
+ *     statement is parsed
+ * -t  the number of threads, the number of processors by default
+ * -r  how many times each thread classifies each statement, 10 by default
+ * -g  how many statements of each kind and size are generated, 10 by default
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <query_classifier.h>
+#include <buffer.h>
+#include <gwdirs.h>
+#include <log_manager.h>
+#include <maxscale/alloc.h>
+
+#define DEFAULT_ARGS      "cache_size=0"
+#define DEFAULT_ROUNDS    10
+#define DEFAULT_GENERATED 10
+
+typedef struct statement
+{
+    char   *sql;
+    size_t len;
+} STATEMENT;
+
+typedef struct corpus
+{
+    STATEMENT *statements;
+    size_t    n;
+    size_t    size;
+} CORPUS;
+
+typedef struct bucket
+{
+    const char *name;
+    size_t     limit; /**< Statements shorter than this belong to the bucket */
+    CORPUS     corpus;
+} BUCKET;
+
+typedef struct worker
+{
+    const CORPUS      *corpus;
+    int               rounds;
+    uint64_t          *latencies; /**< The parse times in nanoseconds */
+    pthread_barrier_t *barrier;
+    double            start;
+    double            end;
+    bool              ok;
+} WORKER;
+
+static BUCKET buckets[] =
+{
+    { "lt64",    64 },
+    { "lt256",   256 },
+    { "lt1024",  1024 },
+    { "lt4096",  4096 },
+    { "lt16384", 16384 },
+    { "ge16384", SIZE_MAX }
+};
+
+#define N_BUCKETS (sizeof(buckets) / sizeof(buckets[0]))
+
+/** The sizes of the generated statements */
+static const int in_list_sizes[] = { 10, 100, 1000, 10000 };
+static const int join_depths[] = { 2, 8, 32 };
+static const int insert_rows[] = { 10, 100, 1000 };
+
+#define N_ELEMS(a) (sizeof(a) / sizeof(a[0]))
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static GWBUF *
+create_query(const char *sql, size_t len)
+{
+    GWBUF *query = gwbuf_alloc(len + 5);
+    MXS_ABORT_IF_NULL(query);
+
+    uint8_t *data = GWBUF_DATA(query);
+    data[0] = (len + 1);
+    data[1] = (len + 1) >> 8;
+    data[2] = (len + 1) >> 16;
+    data[3] = 0;
+    data[4] = 0x03;
+    memcpy(data + 5, sql, len);
+
+    return query;
+}
+
+/**
+ * Add a statement to a corpus. The corpus takes the ownership of the statement.
+ */
+static void
+corpus_add(CORPUS *corpus, char *sql)
+{
+    if (corpus->n == corpus->size)
+    {
+        corpus->size = corpus->size ? corpus->size * 2 : 256;
+        corpus->statements = MXS_REALLOC(corpus->statements, corpus->size * sizeof(STATEMENT));
+        MXS_ABORT_IF_NULL(corpus->statements);
+    }
+
+    corpus->statements[corpus->n].sql = sql;
+    corpus->statements[corpus->n].len = strlen(sql);
+    corpus->n++;
+}
+
+static void
+corpus_free(CORPUS *corpus)
+{
+    for (size_t i = 0; i < corpus->n; i++)
+    {
+        MXS_FREE(corpus->statements[i].sql);
+    }
+
+    MXS_FREE(corpus->statements);
+    memset(corpus, 0, sizeof(*corpus));
+}
+
+static char *
+trim_line(char *line)
+{
+    char *end = line + strlen(line);
+
+    while (end > line && strchr(" \t\r\n", end[-1]))
+    {
+        *--end = '\0';
+    }
+
+    return line + strspn(line, " \t");
+}
+
+/**
+ * Read the statements of a mysqltest file. Comments are skipped, the
+ * delimiter command is obeyed and the lines of a statement are joined
+ * with spaces.
+ *
+ * @param filename The file to read
+ * @param corpus   The corpus the statements are added to
+ * @return True if the file could be read
+ */
+static bool
+read_statements(const char *filename, CORPUS *corpus)
+{
+    FILE *file = fopen(filename, "r");
+
+    if (file == NULL)
+    {
+        perror(filename);
+        return false;
+    }
+
+    char delimiter = ';';
+    char *line = NULL;
+    size_t line_size = 0;
+    char *statement = NULL;
+    size_t len = 0;
+
+    while (getline(&line, &line_size, file) != -1)
+    {
+        char *s = trim_line(line);
+        size_t n = strlen(s);
+
+        if (n == 0 || *s == '#' || strncmp(s, "--", 2) == 0)
+        {
+            continue;
+        }
+
+        if (strncasecmp(s, "delimiter ", 10) == 0)
+        {
+            char *d = trim_line(s + 10);
+            delimiter = *d ? *d : ';';
+            continue;
+        }
+
+        statement = MXS_REALLOC(statement, len + n + 2);
+        MXS_ABORT_IF_NULL(statement);
+
+        if (len != 0)
+        {
+            statement[len++] = ' ';
+        }
+
+        memcpy(statement + len, s, n);
+        len += n;
+        statement[len] = '\0';
+
+        if (s[n - 1] == delimiter)
+        {
+            if (delimiter != ';')
+            {
+                statement[--len] = '\0';
+            }
+
+            corpus_add(corpus, statement);
+            statement = NULL;
+            len = 0;
+        }
+    }
+
+    free(line);
+    MXS_FREE(statement);
+    fclose(file);
+
+    return true;
+}
+
+/**
+ * Generate statements that stress the parser: long IN-lists, deep joins and
+ * multi-row inserts. The literals are random so that no two statements are
+ * identical.
+ *
+ * @param count  How many statements of each kind and size to generate
+ * @param corpus The corpus the statements are added to
+ */
+static void
+generate_statements(int count, CORPUS *corpus)
+{
+    for (int i = 0; i < count; i++)
+    {
+        for (size_t j = 0; j < N_ELEMS(in_list_sizes); j++)
+        {
+            char *sql;
+            size_t len;
+            FILE *out = open_memstream(&sql, &len);
+            MXS_ABORT_IF_NULL(out);
+
+            fprintf(out, "SELECT id, name, value FROM t%d WHERE id IN (", rand() % 10);
+
+            for (int k = 0; k < in_list_sizes[j]; k++)
+            {
+                fprintf(out, k == 0 ? "%d" : ", %d", rand());
+            }
+
+            fprintf(out, ") ORDER BY name");
+            fclose(out);
+            corpus_add(corpus, sql);
+        }
+
+        for (size_t j = 0; j < N_ELEMS(join_depths); j++)
+        {
+            char *sql;
+            size_t len;
+            FILE *out = open_memstream(&sql, &len);
+            MXS_ABORT_IF_NULL(out);
+
+            fprintf(out, "SELECT t0.id, t%d.value FROM t0", join_depths[j]);
+
+            for (int k = 1; k <= join_depths[j]; k++)
+            {
+                fprintf(out, " JOIN t%d ON t%d.id = t%d.parent_id", k, k - 1, k);
+            }
+
+            fprintf(out, " WHERE t0.id > %d", rand());
+            fclose(out);
+            corpus_add(corpus, sql);
+        }
+
+        for (size_t j = 0; j < N_ELEMS(insert_rows); j++)
+        {
+            char *sql;
+            size_t len;
+            FILE *out = open_memstream(&sql, &len);
+            MXS_ABORT_IF_NULL(out);
+
+            fprintf(out, "INSERT INTO t%d (id, name, value) VALUES ", rand() % 10);
+
+            for (int k = 0; k < insert_rows[j]; k++)
+            {
+                fprintf(out, "%s(%d, 'name-%d', %d.%02d)", k == 0 ? "" : ", ",
+                        rand(), rand(), rand() % 1000, rand() % 100);
+            }
+
+            fclose(out);
+            corpus_add(corpus, sql);
+        }
+    }
+}
+
+/**
+ * Read a value of /proc/self/status.
+ *
+ * @param field The field, e.g. "VmHWM:"
+ * @return The value in kilobytes or -1 if it could not be read
+ */
+static long
+proc_status_kb(const char *field)
+{
+    FILE *file = fopen("/proc/self/status", "r");
+    long rval = -1;
+
+    if (file)
+    {
+        char line[256];
+        size_t len = strlen(field);
+
+        while (fgets(line, sizeof(line), file))
+        {
+            if (strncmp(line, field, len) == 0)
+            {
+                rval = strtol(line + len, NULL, 10);
+                break;
+            }
+        }
+
+        fclose(file);
+    }
+
+    return rval;
+}
+
+/** Reset the peak resident set size to the current one */
+static bool
+reset_peak_rss()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    bool rval = fd != -1 && write(fd, "5", 1) == 1;
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    return rval;
+}
+
+static void *
+worker_main(void *arg)
+{
+    WORKER *worker = arg;
+    const CORPUS *corpus = worker->corpus;
+
+    worker->ok = qc_thread_init();
+    pthread_barrier_wait(worker->barrier);
+    worker->start = now();
+
+    if (worker->ok)
+    {
+        uint64_t *latency = worker->latencies;
+
+        for (int i = 0; i < worker->rounds; i++)
+        {
+            for (size_t j = 0; j < corpus->n; j++)
+            {
+                GWBUF *query = create_query(corpus->statements[j].sql, corpus->statements[j].len);
+                double t = now();
+
+                qc_parse(query);
+
+                *latency++ = (now() - t) * 1000000000.0;
+                gwbuf_free(query);
+            }
+        }
+
+        qc_thread_end();
+    }
+
+    worker->end = now();
+
+    return NULL;
+}
+
+static int
+compare_latencies(const void *a, const void *b)
+{
+    uint64_t l = *(const uint64_t *)a;
+    uint64_t r = *(const uint64_t *)b;
+
+    return l < r ? -1 : (l > r ? 1 : 0);
+}
+
+static void
+report_latencies(const char *name, uint64_t *latencies, size_t n)
+{
+    qsort(latencies, n, sizeof(uint64_t), compare_latencies);
+
+    printf("%s.p50_us: %.2f\n", name, n ? latencies[n / 2] / 1000.0 : 0);
+    printf("%s.p99_us: %.2f\n", name, n ? latencies[n * 99 / 100] / 1000.0 : 0);
+    printf("%s.max_us: %.2f\n", name, n ? latencies[n - 1] / 1000.0 : 0);
+}
+
+/**
+ * Classify the statements of a bucket and report the results.
+ *
+ * @param bucket    The bucket
+ * @param n_threads The number of threads
+ * @param rounds    How many times each thread classifies each statement
+ * @param latencies Array of n_threads * rounds * bucket statements elements
+ *                  where the parse times are stored
+ * @param elapsedp  The time it took is stored here
+ * @return True if all threads could classify the statements
+ */
+static bool
+run_bucket(BUCKET *bucket, int n_threads, int rounds, uint64_t *latencies, double *elapsedp)
+{
+    size_t per_thread = bucket->corpus.n * rounds;
+    pthread_t threads[n_threads];
+    WORKER workers[n_threads];
+    pthread_barrier_t barrier;
+    bool rval = true;
+
+    /** The latency array must not count as memory used for parsing */
+    memset(latencies, 0, n_threads * per_thread * sizeof(uint64_t));
+
+    pthread_barrier_init(&barrier, NULL, n_threads);
+
+    long rss = proc_status_kb("VmRSS:");
+    reset_peak_rss();
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        workers[i].corpus = &bucket->corpus;
+        workers[i].rounds = rounds;
+        workers[i].latencies = latencies + i * per_thread;
+        workers[i].barrier = &barrier;
+
+        if (pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0)
+        {
+            fprintf(stderr, "Could not create thread.\n");
+            exit(1);
+        }
+    }
+
+    double start = 0;
+    double end = 0;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+
+        start = i == 0 || workers[i].start < start ? workers[i].start : start;
+        end = workers[i].end > end ? workers[i].end : end;
+        rval = rval && workers[i].ok;
+    }
+
+    pthread_barrier_destroy(&barrier);
+
+    long peak = proc_status_kb("VmHWM:");
+    double elapsed = end - start;
+    size_t total = n_threads * per_thread;
+
+    printf("%s.statements: %lu\n", bucket->name, bucket->corpus.n);
+    printf("%s.statements/s: %.0f\n", bucket->name, total / elapsed);
+    report_latencies(bucket->name, latencies, total);
+    printf("%s.peak_rss_kb: %ld\n", bucket->name, peak);
+    printf("%s.rss_growth_kb/thread: %ld\n", bucket->name,
+           peak > rss ? (peak - rss) / n_threads : 0);
+
+    *elapsedp = elapsed;
+    return rval;
+}
+
+int main(int argc, char **argv)
+{
+    const char *module = "qc_sqlite";
+    const char *args = DEFAULT_ARGS;
+    int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int rounds = DEFAULT_ROUNDS;
+    int generated = DEFAULT_GENERATED;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:a:t:r:g:")) != -1)
+    {
+        switch (c)
+        {
+        case 'm':
+            module = optarg;
+            break;
+
+        case 'a':
+            args = optarg;
+            break;
+
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+
+        case 'g':
+            generated = atoi(optarg);
+            break;
+
+        default:
+            n_threads = 0;
+            break;
+        }
+    }
+
+    if (n_threads < 1 || rounds < 1 || generated < 0)
+    {
+        fprintf(stderr, "Usage: %s [-m module] [-a args] [-t threads] [-r rounds] [-g count] [file...]\n",
+                argv[0]);
+        return 1;
+    }
+
+    CORPUS corpus = { NULL, 0, 0 };
+
+    for (int i = optind; i < argc; i++)
+    {
+        if (!read_statements(argv[i], &corpus))
+        {
+            corpus_free(&corpus);
+            return 1;
+        }
+    }
+
+    srand(1);
+    generate_statements(generated, &corpus);
+
+    /** The buckets refer to the statements of the corpus */
+    for (size_t i = 0; i < corpus.n; i++)
+    {
+        size_t j = 0;
+
+        while (corpus.statements[i].len >= buckets[j].limit)
+        {
+            j++;
+        }
+
+        CORPUS *bucket = &buckets[j].corpus;
+
+        if (bucket->n == bucket->size)
+        {
+            bucket->size = bucket->size ? bucket->size * 2 : 256;
+            bucket->statements = MXS_REALLOC(bucket->statements, bucket->size * sizeof(STATEMENT));
+            MXS_ABORT_IF_NULL(bucket->statements);
+        }
+
+        bucket->statements[bucket->n++] = corpus.statements[i];
+    }
+
+    uint64_t *latencies = MXS_MALLOC(n_threads * rounds * corpus.n * sizeof(uint64_t));
+    MXS_ABORT_IF_NULL(latencies);
+
+    set_libdir(MXS_STRDUP_A("../qc_sqlite"));
+    set_datadir(MXS_STRDUP_A("/tmp"));
+    set_langdir(MXS_STRDUP_A("."));
+    set_process_datadir(MXS_STRDUP_A("/tmp"));
+
+    int rval = 1;
+
+    if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+    {
+        if (qc_init(module, args))
+        {
+            size_t offset = 0;
+            double elapsed = 0;
+
+            printf("module: %s\n", module);
+            printf("threads: %d\n", n_threads);
+            printf("rounds: %d\n", rounds);
+            rval = 0;
+
+            for (size_t i = 0; i < N_BUCKETS && rval == 0; i++)
+            {
+                double t;
+
+                if (buckets[i].corpus.n == 0)
+                {
+                    continue;
+                }
+
+                if (!run_bucket(&buckets[i], n_threads, rounds, latencies + offset, &t))
+                {
+                    fprintf(stderr, "Could not initialize the classifier for a thread.\n");
+                    rval = 1;
+                }
+
+                offset += n_threads * rounds * buckets[i].corpus.n;
+                elapsed += t;
+            }
+
+            printf("all.statements: %lu\n", corpus.n);
+            printf("all.statements/s: %.0f\n", elapsed ? offset / elapsed : 0);
+            report_latencies("all", latencies, offset);
+
+            qc_end();
+        }
+        else
+        {
+            fprintf(stderr, "Could not initialize %s.\n", module);
+        }
+
+        mxs_log_finish();
+    }
+
+    for (size_t i = 0; i < N_BUCKETS; i++)
+    {
+        MXS_FREE(buckets[i].corpus.statements);
+    }
+
+    MXS_FREE(latencies);
+    corpus_free(&corpus);
+
+    return rval;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file benchmark_qc_cache.c - Benchmark of the qc_sqlite classification cache
+ *
+ * Replays a file of statements, each terminated by a ';', through the query
+ * classifier first with the classification cache disabled and then with it
+ * enabled. Every statement is classified into a fresh buffer, as when it arrives
+ * from a client, and its type, operation and table names are asked for.
+ * For both runs the following are reported
+ * - statements/s and ns/statement: the classification throughput
+ * - parse.ns/statement:            the classification time during the first
+ *                                  round, when nothing has been cached yet
+ * - tables:                        the number of table names reported, which
+ *                                  should be the same for both runs
+ *
+ * - hits, misses, evictions:       the cache statistics of qc_sqlite
+ *
+ * Finally the speedup of the cached run is reported.
+ *
+ * Usage: benchmark_qc_cache [statements [iterations [cache size]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <query_classifier.h>
+#include <buffer.h>
+#include <gwdirs.h>
+#include <log_manager.h>
+#include <maxscale/alloc.h>
+
+#define DEFAULT_ITERATIONS 20000
+#define DEFAULT_CACHE_SIZE 1024
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static GWBUF *
+create_query(const char *sql, size_t len)
+{
+    GWBUF *query = gwbuf_alloc(len + 5);
+    MXS_ABORT_IF_NULL(query);
+
+    uint8_t *data = GWBUF_DATA(query);
+    data[0] = (len + 1);
+    data[1] = (len + 1) >> 8;
+    data[2] = (len + 1) >> 16;
+    data[3] = 0;
+    data[4] = 0x03;
+    memcpy(data + 5, sql, len);
+
+    return query;
+}
+
+/**
+ * Read the statements of a file. Newlines are replaced with spaces and every
+ * ';' ends a statement.
+ *
+ * @param filename The file to read
+ * @param n        The number of statements is stored here
+ * @return The statements or NULL on error
+ */
+static char **
+read_statements(const char *filename, int *n)
+{
+    FILE *file = fopen(filename, "r");
+
+    if (file == NULL)
+    {
+        perror(filename);
+        return NULL;
+    }
+
+    int size = 16;
+    char **statements = MXS_MALLOC(size * sizeof(char *));
+    char *line = NULL;
+    size_t line_size = 0;
+    char *statement = NULL;
+    size_t len = 0;
+    ssize_t rd;
+
+    MXS_ABORT_IF_NULL(statements);
+    *n = 0;
+
+    while ((rd = getline(&line, &line_size, file)) != -1)
+    {
+        statement = MXS_REALLOC(statement, len + rd + 1);
+        MXS_ABORT_IF_NULL(statement);
+
+        for (ssize_t i = 0; i < rd; i++)
+        {
+            char c = line[i];
+
+            if (c == ';')
+            {
+                statement[len] = '\0';
+
+                if (*n == size)
+                {
+                    size *= 2;
+                    statements = MXS_REALLOC(statements, size * sizeof(char *));
+                    MXS_ABORT_IF_NULL(statements);
+                }
+
+                statements[(*n)++] = MXS_STRDUP_A(statement);
+                len = 0;
+            }
+            else if (len != 0 || (c != ' ' && c != '\n'))
+            {
+                statement[len++] = c == '\n' ? ' ' : c;
+            }
+        }
+    }
+
+    free(line);
+    MXS_FREE(statement);
+    fclose(file);
+
+    return statements;
+}
+
+static bool
+replay(const char *name, char **statements, int n, int iterations, int cache_size, double *elapsedp)
+{
+    char args[64];
+    snprintf(args, sizeof(args), "cache_size=%d", cache_size);
+
+    if (!qc_init("qc_sqlite", args))
+    {
+        fprintf(stderr, "Could not initialize qc_sqlite.\n");
+        return false;
+    }
+
+    size_t lens[n];
+
+    for (int i = 0; i < n; i++)
+    {
+        lens[i] = strlen(statements[i]);
+    }
+
+    long tables = 0;
+    double start = now();
+    double parse_time = 0;
+    long parsed = 0;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            GWBUF *query = create_query(statements[j], lens[j]);
+            double t = now();
+
+            qc_get_type(query);
+            qc_get_operation(query);
+
+            int n_tables = 0;
+            char **names = qc_get_table_names(query, &n_tables, true);
+
+            for (int k = 0; k < n_tables; k++)
+            {
+                MXS_FREE(names[k]);
+            }
+
+            MXS_FREE(names);
+            tables += n_tables;
+
+            t = now() - t;
+
+            if (i == 0)
+            {
+                /** Nothing is cached during the first round */
+                parse_time += t;
+                parsed++;
+            }
+
+            gwbuf_free(query);
+        }
+    }
+
+    double elapsed = now() - start;
+    long total = (long)iterations * n;
+
+    QC_CACHE_STATS stats;
+    bool have_stats = qc_get_cache_stats(&stats);
+
+    qc_end();
+
+    printf("%s.statements/s: %.0f\n", name, total / elapsed);
+    printf("%s.ns/statement: %.1f\n", name, elapsed * 1000000000.0 / total);
+    printf("%s.parse.ns/statement: %.1f\n", name, parsed ? parse_time * 1000000000.0 / parsed : 0);
+    printf("%s.tables: %ld\n", name, tables);
+
+    if (have_stats)
+    {
+        printf("%s.hits: %lu\n", name, stats.hits);
+        printf("%s.misses: %lu\n", name, stats.misses);
+        printf("%s.evictions: %lu\n", name, stats.evictions);
+    }
+
+    *elapsedp = elapsed;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *filename = argc > 1 ? argv[1] : "input.sql";
+    int iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+    int cache_size = argc > 3 ? atoi(argv[3]) : DEFAULT_CACHE_SIZE;
+
+    if (iterations < 1 || cache_size < 1)
+    {
+        fprintf(stderr, "Usage: %s [statements [iterations [cache size]]]\n", argv[0]);
+        return 1;
+    }
+
+    int n;
+    char **statements = read_statements(filename, &n);
+
+    if (statements == NULL)
+    {
+        return 1;
+    }
+
+    set_libdir(MXS_STRDUP_A("../qc_sqlite"));
+    set_datadir(MXS_STRDUP_A("/tmp"));
+    set_langdir(MXS_STRDUP_A("."));
+    set_process_datadir(MXS_STRDUP_A("/tmp"));
+
+    int rval = 1;
+
+    if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+    {
+        double nocache;
+        double cache;
+
+        printf("statements: %d\n", n);
+
+        if (replay("nocache", statements, n, iterations, 0, &nocache) &&
+            replay("cache", statements, n, iterations, cache_size, &cache))
+        {
+            printf("speedup: %.2f\n", nocache / cache);
+            rval = 0;
+        }
+
+        mxs_log_finish();
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        MXS_FREE(statements[i]);
+    }
+
+    MXS_FREE(statements);
+
+    return rval;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file benchmark_qc_fastpath.c - Benchmark of the qc_sqlite fast path
+ *
+ * Classifies a set of statements, first with the fast path of qc_sqlite
+ * disabled and then with it enabled, and reports for both runs
+ * - statements/s and ns/statement: the classification throughput of a
+ *                                  single thread, i.e. per core
+ *
+ * The classification cache is disabled so that every statement is classified
+ * afresh. By default the statements are typical statements of an OLTP
+ * application, most of which the fast path recognizes. If a file is given, its
+ * statements, each terminated by a ';', are used instead.
+ *
+ * Usage: benchmark_qc_fastpath [iterations [statements]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <query_classifier.h>
+#include <buffer.h>
+#include <gwdirs.h>
+#include <log_manager.h>
+#include <maxscale/alloc.h>
+
+#define DEFAULT_ITERATIONS 100000
+
+static const char *default_statements[] =
+{
+    "SELECT 1",
+    "BEGIN",
+    "COMMIT",
+    "ROLLBACK",
+    "SET autocommit=1",
+    "SET autocommit=0",
+    "USE test",
+    "SELECT c FROM sbtest1 WHERE id=5012",
+    "SELECT k, c, pad FROM sbtest1 WHERE id=?",
+    "SELECT name FROM customers WHERE id = 17 AND status = 'active'",
+    "SELECT SUM(k) FROM sbtest1 WHERE id BETWEEN 5012 AND 5111",
+    "UPDATE sbtest1 SET k=k+1 WHERE id=5012",
+};
+
+#define N_DEFAULT_STATEMENTS (sizeof(default_statements) / sizeof(default_statements[0]))
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static GWBUF *
+create_query(const char *sql, size_t len)
+{
+    GWBUF *query = gwbuf_alloc(len + 5);
+    MXS_ABORT_IF_NULL(query);
+
+    uint8_t *data = GWBUF_DATA(query);
+    data[0] = (len + 1);
+    data[1] = (len + 1) >> 8;
+    data[2] = (len + 1) >> 16;
+    data[3] = 0;
+    data[4] = 0x03;
+    memcpy(data + 5, sql, len);
+
+    return query;
+}
+
+/**
+ * Read the statements of a file. Newlines are replaced with spaces and every
+ * ';' ends a statement.
+ *
+ * @param filename The file to read
+ * @param n        The number of statements is stored here
+ * @return The statements or NULL on error
+ */
+static char **
+read_statements(const char *filename, int *n)
+{
+    FILE *file = fopen(filename, "r");
+
+    if (file == NULL)
+    {
+        perror(filename);
+        return NULL;
+    }
+
+    int size = 16;
+    char **statements = MXS_MALLOC(size * sizeof(char *));
+    char *line = NULL;
+    size_t line_size = 0;
+    char *statement = NULL;
+    size_t len = 0;
+    ssize_t rd;
+
+    MXS_ABORT_IF_NULL(statements);
+    *n = 0;
+
+    while ((rd = getline(&line, &line_size, file)) != -1)
+    {
+        statement = MXS_REALLOC(statement, len + rd + 1);
+        MXS_ABORT_IF_NULL(statement);
+
+        for (ssize_t i = 0; i < rd; i++)
+        {
+            char c = line[i];
+
+            if (c == ';')
+            {
+                statement[len] = '\0';
+
+                if (*n == size)
+                {
+                    size *= 2;
+                    statements = MXS_REALLOC(statements, size * sizeof(char *));
+                    MXS_ABORT_IF_NULL(statements);
+                }
+
+                statements[(*n)++] = MXS_STRDUP_A(statement);
+                len = 0;
+            }
+            else if (len != 0 || (c != ' ' && c != '\n'))
+            {
+                statement[len++] = c == '\n' ? ' ' : c;
+            }
+        }
+    }
+
+    free(line);
+    MXS_FREE(statement);
+    fclose(file);
+
+    return statements;
+}
+
+static bool
+replay(const char *name, const char *args, char **statements, int n, int iterations, double *elapsedp)
+{
+    if (!qc_init("qc_sqlite", args))
+    {
+        fprintf(stderr, "Could not initialize qc_sqlite.\n");
+        return false;
+    }
+
+    size_t lens[n];
+
+    for (int i = 0; i < n; i++)
+    {
+        lens[i] = strlen(statements[i]);
+    }
+
+    double start = now();
+
+    for (int i = 0; i < iterations; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            GWBUF *query = create_query(statements[j], lens[j]);
+
+            qc_get_type(query);
+            qc_get_operation(query);
+
+            gwbuf_free(query);
+        }
+    }
+
+    double elapsed = now() - start;
+    long total = (long)iterations * n;
+
+    qc_end();
+
+    printf("%s.statements/s: %.0f\n", name, total / elapsed);
+    printf("%s.ns/statement: %.1f\n", name, elapsed * 1000000000.0 / total);
+
+    *elapsedp = elapsed;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+
+    if (iterations < 1)
+    {
+        fprintf(stderr, "Usage: %s [iterations [statements]]\n", argv[0]);
+        return 1;
+    }
+
+    int n = N_DEFAULT_STATEMENTS;
+    char **statements = (char **)default_statements;
+
+    if (argc > 2 && (statements = read_statements(argv[2], &n)) == NULL)
+    {
+        return 1;
+    }
+
+    set_libdir(MXS_STRDUP_A("../qc_sqlite"));
+    set_datadir(MXS_STRDUP_A("/tmp"));
+    set_langdir(MXS_STRDUP_A("."));
+    set_process_datadir(MXS_STRDUP_A("/tmp"));
+
+    int rval = 1;
+
+    if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+    {
+        double parser;
+        double fast_path;
+
+        printf("statements: %d\n", n);
+
+        if (replay("parser", "cache_size=0,fast_path=0", statements, n, iterations, &parser) &&
+            replay("fast_path", "cache_size=0,fast_path=1", statements, n, iterations, &fast_path))
+        {
+            printf("speedup: %.2f\n", parser / fast_path);
+            rval = 0;
+        }
+
+        mxs_log_finish();
+    }
+
+    if (argc > 2)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            MXS_FREE(statements[i]);
+        }
+
+        MXS_FREE(statements);
+    }
+
+    return rval;
+}
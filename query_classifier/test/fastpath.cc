@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file fastpath.cc - Checks the qc_sqlite fast path against the parser
+ *
+ * Classifies the statements of the given files first with the fast path of
+ * qc_sqlite disabled and then with it enabled, and reports every statement
+ * whose classification differs. The classification cache is disabled in
+ * both runs so that every statement is classified afresh.
+ *
+ * The statements are read as compare does, but mysqltest commands are not
+ * recognized. As the fast path must never classify a statement differently
+ * from the parser, whatever a command turns into must also be classified
+ * identically.
+ *
+ * In addition to the statements of the files, statements that begin like
+ * the ones the fast path recognizes but are something else are checked.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gwdirs.h>
+#include <log_manager.h>
+#include <mysql_client_server_protocol.h>
+#include <query_classifier.h>
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::istream;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+namespace
+{
+
+char USAGE[] = "usage: fastpath file...\n";
+
+const char ARGS_PARSER[] = "cache_size=0,fast_path=0";
+const char ARGS_FAST_PATH[] = "cache_size=0,fast_path=1";
+
+struct Statement
+{
+    string file;
+    size_t line;
+    string sql;
+};
+
+/**
+ * Statements whose first keywords match one alternative of the fast path
+ * and the rest another one, or that are cut short. They must not be
+ * classified as any of the statements the fast path recognizes.
+ */
+const char* NEAR_MISSES[] =
+{
+    "START COMMIT",
+    "START ROLLBACK",
+    "START BEGIN",
+    "START",
+    "SET COMMIT",
+    "SET autocommit",
+    "SET autocommit ROLLBACK",
+    "USE COMMIT",
+    "BEGIN COMMIT",
+    "COMMIT ROLLBACK",
+};
+
+GWBUF* create_gwbuf(const string& s)
+{
+    size_t len = s.length() + 1;
+    size_t gwbuf_len = len + MYSQL_HEADER_LEN;
+
+    GWBUF* gwbuf = gwbuf_alloc(gwbuf_len);
+
+    *((unsigned char*)((char*)GWBUF_DATA(gwbuf))) = len;
+    *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 1)) = (len >> 8);
+    *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 2)) = (len >> 16);
+    *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 3)) = 0x00;
+    *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 4)) = 0x03;
+    memcpy((char*)GWBUF_DATA(gwbuf) + 5, s.c_str(), s.length());
+
+    return gwbuf;
+}
+
+inline void trim(string& s)
+{
+    s.erase(0, s.find_first_not_of(" \t\r\n"));
+    s.erase(s.find_last_not_of(" \t\r\n") + 1);
+}
+
+void read_statements(const char* zFile, istream& in, vector<Statement>* pStatements)
+{
+    char delimiter = ';';
+    string line;
+    Statement statement = { zFile, 0, "" };
+    size_t n = 0;
+
+    while (std::getline(in, line))
+    {
+        trim(line);
+        ++n;
+
+        if (line.empty() || (line.at(0) == '#') || (line.substr(0, 2) == "--"))
+        {
+            continue;
+        }
+
+        if (strncasecmp(line.c_str(), "delimiter ", 10) == 0)
+        {
+            string d = line.substr(10);
+            trim(d);
+            delimiter = d.empty() ? ';' : d.at(0);
+            continue;
+        }
+
+        if (statement.sql.empty())
+        {
+            statement.line = n;
+        }
+        else
+        {
+            statement.sql += " ";
+        }
+
+        statement.sql += line;
+
+        if (line.at(line.length() - 1) == delimiter)
+        {
+            if (delimiter != ';')
+            {
+                statement.sql.erase(statement.sql.length() - 1);
+            }
+
+            pStatements->push_back(statement);
+            statement.sql.clear();
+        }
+    }
+}
+
+void append_names(stringstream& out, char** pzNames, int n)
+{
+    out << "[";
+
+    for (int i = 0; i < n; ++i)
+    {
+        out << (i == 0 ? "" : ", ") << pzNames[i];
+        free(pzNames[i]);
+    }
+
+    free(pzNames);
+
+    out << "]";
+}
+
+/**
+ * Returns everything the classifier reports about a statement as a string.
+ */
+string classify(QUERY_CLASSIFIER* pClassifier, const string& sql)
+{
+    stringstream out;
+    GWBUF* pBuf = create_gwbuf(sql);
+    char** pzNames;
+    int n;
+
+    out << "parse: " << pClassifier->qc_parse(pBuf)
+        << ", type: " << std::hex << pClassifier->qc_get_type(pBuf) << std::dec
+        << ", operation: " << pClassifier->qc_get_operation(pBuf)
+        << ", real: " << pClassifier->qc_is_real_query(pBuf)
+        << ", clause: " << pClassifier->qc_query_has_clause(pBuf)
+        << ", drop table: " << pClassifier->qc_is_drop_table_query(pBuf);
+
+    char* zName = pClassifier->qc_get_created_table_name(pBuf);
+    out << ", created table: " << (zName ? zName : "");
+    free(zName);
+
+    n = 0;
+    pzNames = pClassifier->qc_get_table_names(pBuf, &n, false);
+    out << ", tables: ";
+    append_names(out, pzNames, n);
+
+    n = 0;
+    pzNames = pClassifier->qc_get_table_names(pBuf, &n, true);
+    out << ", full table names: ";
+    append_names(out, pzNames, n);
+
+    n = 0;
+    pzNames = pClassifier->qc_get_database_names(pBuf, &n);
+    out << ", databases: ";
+    append_names(out, pzNames, n);
+
+    char* zFields = pClassifier->qc_get_affected_fields(pBuf);
+    out << ", fields: " << zFields;
+    free(zFields);
+
+    gwbuf_free(pBuf);
+
+    return out.str();
+}
+
+bool classify_all(QUERY_CLASSIFIER* pClassifier, const char* zArgs,
+                  const vector<Statement>& statements, vector<string>* pResults)
+{
+    if (!pClassifier->qc_init(zArgs))
+    {
+        cerr << "error: Could not init qc_sqlite with " << zArgs << "." << endl;
+        return false;
+    }
+
+    for (vector<Statement>::const_iterator i = statements.begin(); i != statements.end(); ++i)
+    {
+        pResults->push_back(classify(pClassifier, i->sql));
+    }
+
+    pClassifier->qc_end();
+
+    return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = EXIT_FAILURE;
+
+    if (argc < 2)
+    {
+        cerr << USAGE;
+        return rc;
+    }
+
+    vector<Statement> statements;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        ifstream in(argv[i]);
+
+        if (!in)
+        {
+            cerr << "error: Could not open " << argv[i] << "." << endl;
+            return rc;
+        }
+
+        read_statements(argv[i], in, &statements);
+    }
+
+    for (size_t i = 0; i < sizeof(NEAR_MISSES) / sizeof(NEAR_MISSES[0]); ++i)
+    {
+        Statement statement = { "near misses", i + 1, NEAR_MISSES[i] };
+        statements.push_back(statement);
+    }
+
+    set_libdir(strdup("../qc_sqlite"));
+    set_datadir(strdup("/tmp"));
+    set_langdir(strdup("."));
+    set_process_datadir(strdup("/tmp"));
+
+    if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+    {
+        QUERY_CLASSIFIER* pClassifier = qc_load("qc_sqlite");
+        vector<string> parsed;
+        vector<string> fast;
+
+        if (pClassifier &&
+            classify_all(pClassifier, ARGS_PARSER, statements, &parsed) &&
+            classify_all(pClassifier, ARGS_FAST_PATH, statements, &fast))
+        {
+            size_t n_errors = 0;
+
+            for (size_t i = 0; i < statements.size(); ++i)
+            {
+                if (parsed[i] != fast[i])
+                {
+                    cout << statements[i].file << "(" << statements[i].line << "): "
+                         << statements[i].sql << endl
+                         << "Parser   : " << parsed[i] << endl
+                         << "Fast path: " << fast[i] << endl << endl;
+                    ++n_errors;
+                }
+            }
+
+            cout << "Statements: " << statements.size() << endl
+                 << "Errors    : " << n_errors << endl;
+
+            rc = n_errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (pClassifier)
+        {
+            qc_unload(pClassifier);
+        }
+
+        mxs_log_finish();
+    }
+    else
+    {
+        cerr << "error: Could not initialize log." << endl;
+    }
+
+    return rc;
+}
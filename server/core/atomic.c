@@ -23,6 +23,8 @@
  * @endverbatim
  */
 
+#include <atomic.h>
+
 /**
  * Implementation of an atomic add operation for the GCC environment, or the
  * X86 processor.  If we are working within GNU C then we can use the GCC
@@ -53,3 +55,25 @@ atomic_add(int *variable, int value)
     return value;
 #endif
 }
+
+/**
+ * Atomic add of a 64-bit unsigned value, see atomic_add()
+ *
+ * @param variable      Pointer the the variable to add to
+ * @param value         Value to be added
+ * @return              The value of variable before the add occurred
+ */
+uint64_t
+atomic_add_uint64(uint64_t *variable, int64_t value)
+{
+#ifdef __GNUC__
+    return (uint64_t) __sync_fetch_and_add (variable, value);
+#else
+    asm volatile(
+        "lock; xaddq %%rax, %2;"
+        :"=a" (value)
+        : "a" (value), "m" (*variable)
+        : "memory" );
+    return value;
+#endif
+}
@@ -38,6 +38,7 @@
  * @endverbatim
  */
 #include <buffer.h>
+#include <dcb.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <maxscale/alloc.h>
@@ -47,6 +48,7 @@
 #include <spinlock.h>
 #include <hint.h>
 #include <log_manager.h>
+#include <platform.h>
 
 #if defined(BUFFER_TRACE)
 #include <hashtable.h>
@@ -66,12 +68,258 @@ static int bcmpfn (void *key1, void *key2);
 static void gwbuf_remove_from_hashtable(GWBUF *buf);
 #endif
 
+/**
+ * The buffer pool
+ *
+ * A buffer returned by gwbuf_alloc is a single block of memory that holds the
+ * GWBUF, the SHARED_BUF and the data. The blocks for small buffers come in a
+ * number of size classes and freed blocks are kept on thread-local free lists,
+ * one per size class, from which later allocations of the same class are made.
+ * The GWBUF structures created by the clone functions are recycled the same way.
+ *
+ * A block is put on the free list of the thread that frees it. The number of
+ * blocks kept on each list is limited and blocks exceeding the limit are
+ * returned to the system. Buffers larger than the largest size class are
+ * allocated and freed directly.
+ */
+#define GWBUF_POOL_N_CLASSES    9                 /*< Number of data size classes */
+#define GWBUF_POOL_HEADERS      GWBUF_POOL_N_CLASSES /*< The class of cloned GWBUFs */
+#define GWBUF_POOL_MAX_BYTES    (256 * 1024)      /*< Bytes cached per class and thread */
+#define GWBUF_POOL_MIN_BLOCKS   16                /*< Blocks that can always be cached */
+
+/** The data sizes of the size classes */
+static const size_t gwbuf_pool_sizes[GWBUF_POOL_N_CLASSES] =
+{
+    64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384
+};
+
+/** The free list and statistics of one size class */
+typedef struct
+{
+    void *free;             /*< Free blocks, linked through their first word */
+    int  n_free;            /*< Number of blocks on the free list */
+    int  max_free;          /*< Maximum number of blocks on the free list */
+    int  hits;              /*< Allocations served from the free list */
+    int  misses;            /*< Allocations that had to use malloc */
+    int  releases;          /*< Blocks freed because the list was full */
+} GWBUF_POOL_CLASS;
+
+/** The buffer pool of a thread */
+typedef struct gwbuf_pool
+{
+    GWBUF_POOL_CLASS  classes[GWBUF_POOL_N_CLASSES + 1]; /*< The size classes and the clones */
+    struct gwbuf_pool *next;  /*< Next pool in the list of all pools */
+} GWBUF_POOL;
+
+static thread_local GWBUF_POOL *thread_pool = NULL; /*< Pool of the current thread */
+static GWBUF_POOL *all_pools = NULL;                /*< Pools of all threads */
+static SPINLOCK pools_lock = SPINLOCK_INIT;         /*< Protects all_pools */
+
+/**
+ * Return the size of the blocks of a size class
+ *
+ * @param cls   The size class
+ * @return      The block size in bytes
+ */
+static inline size_t
+gwbuf_pool_block_size(int cls)
+{
+    return cls == GWBUF_POOL_HEADERS ? sizeof(GWBUF) :
+           sizeof(GWBUF) + sizeof(SHARED_BUF) + gwbuf_pool_sizes[cls];
+}
+
+/**
+ * Return the smallest size class that can hold a buffer of the given size
+ *
+ * @param size  The size of the data area
+ * @return      The size class or -1 if the buffer is too large to be pooled
+ */
+static inline int
+gwbuf_pool_class(size_t size)
+{
+    int cls;
+
+    for (cls = 0; cls < GWBUF_POOL_N_CLASSES; cls++)
+    {
+        if (size <= gwbuf_pool_sizes[cls])
+        {
+            return cls;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Return the buffer pool of the calling thread, creating it on first use
+ *
+ * @return The pool of the thread or NULL if it could not be created
+ */
+static GWBUF_POOL *
+gwbuf_thread_pool()
+{
+    if (thread_pool == NULL)
+    {
+        GWBUF_POOL *pool = (GWBUF_POOL *)MXS_CALLOC(1, sizeof(GWBUF_POOL));
+
+        if (pool)
+        {
+            for (int i = 0; i <= GWBUF_POOL_N_CLASSES; i++)
+            {
+                int max_free = GWBUF_POOL_MAX_BYTES / gwbuf_pool_block_size(i);
+                pool->classes[i].max_free = MAX(max_free, GWBUF_POOL_MIN_BLOCKS);
+            }
+
+            spinlock_acquire(&pools_lock);
+            pool->next = all_pools;
+            all_pools = pool;
+            spinlock_release(&pools_lock);
+            thread_pool = pool;
+        }
+    }
+    return thread_pool;
+}
+
+/**
+ * Get a block of a size class from the pool of the calling thread
+ *
+ * @param cls   The size class
+ * @return      The block or NULL if memory could not be allocated
+ */
+static void *
+gwbuf_pool_get(int cls)
+{
+    GWBUF_POOL *pool = gwbuf_thread_pool();
+    void *block;
+
+    if (pool && (block = pool->classes[cls].free))
+    {
+        pool->classes[cls].free = *(void **)block;
+        pool->classes[cls].n_free--;
+        pool->classes[cls].hits++;
+    }
+    else
+    {
+        if (pool)
+        {
+            pool->classes[cls].misses++;
+        }
+        block = MXS_MALLOC(gwbuf_pool_block_size(cls));
+    }
+    return block;
+}
+
+/**
+ * Return a block of a size class to the pool of the calling thread
+ *
+ * @param cls   The size class
+ * @param block The block to return
+ */
+static void
+gwbuf_pool_put(int cls, void *block)
+{
+    GWBUF_POOL *pool = gwbuf_thread_pool();
+
+    if (pool && pool->classes[cls].n_free < pool->classes[cls].max_free)
+    {
+        *(void **)block = pool->classes[cls].free;
+        pool->classes[cls].free = block;
+        pool->classes[cls].n_free++;
+    }
+    else
+    {
+        if (pool)
+        {
+            pool->classes[cls].releases++;
+        }
+        MXS_FREE(block);
+    }
+}
+
+/**
+ * Release the memory block of a shared buffer once the last reference to
+ * it is gone. The block also contains the GWBUF it was allocated with.
+ *
+ * @param sbuf  The shared buffer
+ */
+static inline void
+gwbuf_release_shared(SHARED_BUF *sbuf)
+{
+    void *block = (GWBUF *)sbuf - 1;
+
+    if (sbuf->pool_class >= 0)
+    {
+        gwbuf_pool_put(sbuf->pool_class, block);
+    }
+    else
+    {
+        MXS_FREE(block);
+    }
+}
+
+/**
+ * Check whether a GWBUF was allocated in the same block as its shared buffer
+ *
+ * @param buf   The buffer to check
+ * @return      True if the GWBUF is part of the shared buffer's memory block
+ */
+static inline bool
+gwbuf_is_inline(GWBUF *buf)
+{
+    return (void *)(buf + 1) == (void *)buf->sbuf;
+}
+
+/**
+ * Print the statistics of the buffer pools of all threads
+ *
+ * @param pdcb  Print DCB for output
+ */
+void
+dprintBufferPools(void *pdcb)
+{
+    DCB *dcb = (DCB *)pdcb;
+    GWBUF_POOL *pool;
+    int n_pools = 0;
+
+    spinlock_acquire(&pools_lock);
+    for (pool = all_pools; pool; pool = pool->next)
+    {
+        n_pools++;
+    }
+    dcb_printf(dcb, "Buffer pools of %d threads.\n\n", n_pools);
+    dcb_printf(dcb, "Size class | Hits         | Misses       | Released     | Cached | Bytes cached\n");
+    dcb_printf(dcb, "-----------+--------------+--------------+--------------+--------+-------------\n");
+    for (int i = 0; i <= GWBUF_POOL_N_CLASSES; i++)
+    {
+        unsigned long hits = 0, misses = 0, releases = 0, n_free = 0;
+
+        for (pool = all_pools; pool; pool = pool->next)
+        {
+            hits += pool->classes[i].hits;
+            misses += pool->classes[i].misses;
+            releases += pool->classes[i].releases;
+            n_free += pool->classes[i].n_free;
+        }
+
+        if (i == GWBUF_POOL_HEADERS)
+        {
+            dcb_printf(dcb, "%-10s", "clones");
+        }
+        else
+        {
+            dcb_printf(dcb, "%-10lu", (unsigned long)gwbuf_pool_sizes[i]);
+        }
+        dcb_printf(dcb, " | %-12lu | %-12lu | %-12lu | %-6lu | %lu\n",
+                   hits, misses, releases, n_free, n_free * gwbuf_pool_block_size(i));
+    }
+    spinlock_release(&pools_lock);
+}
+
 /**
  * Allocate a new gateway buffer structure of size bytes.
  *
- * For now we allocate memory directly from malloc for buffer the management
- * structure and the actual data buffer itself. We may swap at a future date
- * to a more efficient mechanism.
+ * The buffer structure, the shared buffer and the data area are allocated
+ * as one block of memory. Small buffers are allocated from the buffer pool
+ * of the calling thread.
  *
  * @param       size The size in bytes of the data area required
  * @return      Pointer to the buffer structure or NULL if memory could not
@@ -82,30 +330,26 @@ gwbuf_alloc(unsigned int size)
 {
     GWBUF      *rval;
     SHARED_BUF *sbuf;
+    int        cls = gwbuf_pool_class(size);
 
-    /* Allocate the buffer header */
-    if ((rval = (GWBUF *)MXS_MALLOC(sizeof(GWBUF))) == NULL)
+    if (cls >= 0)
     {
-        goto retblock;
+        rval = (GWBUF *)gwbuf_pool_get(cls);
     }
-
-    /* Allocate the shared data buffer */
-    if ((sbuf = (SHARED_BUF *)MXS_MALLOC(sizeof(SHARED_BUF))) == NULL)
+    else
     {
-        MXS_FREE(rval);
-        rval = NULL;
-        goto retblock;
+        rval = (GWBUF *)MXS_MALLOC(sizeof(GWBUF) + sizeof(SHARED_BUF) + size);
     }
 
-    /* Allocate the space for the actual data */
-    if ((sbuf->data = (unsigned char *)MXS_MALLOC(size)) == NULL)
+    if (rval == NULL)
     {
-        MXS_FREE(rval);
-        MXS_FREE(sbuf);
-        rval = NULL;
         goto retblock;
     }
-    spinlock_init(&rval->gwbuf_lock);
+
+    sbuf = (SHARED_BUF *)(rval + 1);
+    sbuf->data = (unsigned char *)(sbuf + 1);
+    sbuf->pool_class = cls;
+    sbuf->properties = NULL;
     rval->start = sbuf->data;
     rval->end = (void *)((char *)rval->start + size);
     sbuf->refcount = 1;
@@ -113,7 +357,6 @@ gwbuf_alloc(unsigned int size)
     rval->next = NULL;
     rval->tail = rval;
     rval->hint = NULL;
-    rval->properties = NULL;
     rval->gwbuf_type = GWBUF_TYPE_UNDEFINED;
     rval->gwbuf_info = GWBUF_INFO_NONE;
     rval->gwbuf_bufobj = NULL;
@@ -280,11 +523,26 @@ gwbuf_free_one(GWBUF *buf)
 {
     BUF_PROPERTY    *prop;
     buffer_object_t *bo;
+    SHARED_BUF      *sbuf = buf->sbuf;
+    bool            is_inline = gwbuf_is_inline(buf);
 
-    if (atomic_add(&buf->sbuf->refcount, -1) == 1)
+    /** Release the hint */
+    while (buf->hint)
+    {
+        HINT* h = buf->hint;
+        buf->hint = buf->hint->next;
+        hint_free(h);
+    }
+#if defined(BUFFER_TRACE)
+    gwbuf_remove_from_hashtable(buf);
+#endif
+
+    /**
+     * If this is the only reference, no other thread can be modifying the
+     * reference count and the locked decrement can be skipped.
+     */
+    if (sbuf->refcount == 1 || atomic_add(&sbuf->refcount, -1) == 1)
     {
-        MXS_FREE(buf->sbuf->data);
-        MXS_FREE(buf->sbuf);
         bo = buf->gwbuf_bufobj;
 
         while (bo != NULL)
@@ -292,26 +550,23 @@ gwbuf_free_one(GWBUF *buf)
             bo = gwbuf_remove_buffer_object(buf, bo);
         }
 
+        while (sbuf->properties)
+        {
+            prop = sbuf->properties;
+            sbuf->properties = prop->next;
+            MXS_FREE(prop->name);
+            MXS_FREE(prop->value);
+            MXS_FREE(prop);
+        }
+
+        /** This also frees the GWBUF if it was allocated with the data */
+        gwbuf_release_shared(sbuf);
     }
-    while (buf->properties)
-    {
-        prop = buf->properties;
-        buf->properties = prop->next;
-        MXS_FREE(prop->name);
-        MXS_FREE(prop->value);
-        MXS_FREE(prop);
-    }
-    /** Release the hint */
-    while (buf->hint)
+
+    if (!is_inline)
     {
-        HINT* h = buf->hint;
-        buf->hint = buf->hint->next;
-        hint_free(h);
+        gwbuf_pool_put(GWBUF_POOL_HEADERS, buf);
     }
-#if defined(BUFFER_TRACE)
-    gwbuf_remove_from_hashtable(buf);
-#endif
-    MXS_FREE(buf);
 }
 
 /**
@@ -329,11 +584,12 @@ gwbuf_clone(GWBUF *buf)
 {
     GWBUF *rval;
 
-    if ((rval = (GWBUF *)MXS_CALLOC(1, sizeof(GWBUF))) == NULL)
+    if ((rval = (GWBUF *)gwbuf_pool_get(GWBUF_POOL_HEADERS)) == NULL)
     {
         return NULL;
     }
 
+    memset(rval, 0, sizeof(GWBUF));
     atomic_add(&buf->sbuf->refcount, 1);
     rval->sbuf = buf->sbuf;
     rval->start = buf->start;
@@ -389,7 +645,7 @@ GWBUF *gwbuf_clone_portion(GWBUF *buf,
     CHK_GWBUF(buf);
     ss_dassert(start_offset + length <= GWBUF_LENGTH(buf));
 
-    if ((clonebuf = (GWBUF *)MXS_MALLOC(sizeof(GWBUF))) == NULL)
+    if ((clonebuf = (GWBUF *)gwbuf_pool_get(GWBUF_POOL_HEADERS)) == NULL)
     {
         return NULL;
     }
@@ -399,7 +655,6 @@ GWBUF *gwbuf_clone_portion(GWBUF *buf,
     clonebuf->start = (void *)((char*)buf->start + start_offset);
     clonebuf->end = (void *)((char *)clonebuf->start + length);
     clonebuf->gwbuf_type = buf->gwbuf_type; /*< clone the type for now */
-    clonebuf->properties = NULL;
     clonebuf->hint = NULL;
     clonebuf->gwbuf_info = buf->gwbuf_info;
     clonebuf->gwbuf_bufobj = buf->gwbuf_bufobj;
@@ -728,8 +983,6 @@ void gwbuf_add_buffer_object(GWBUF* buf,
     newb->bo_data = data;
     newb->bo_donefun_fp = donefun_fp;
     newb->bo_next = NULL;
-    /** Lock */
-    spinlock_acquire(&buf->gwbuf_lock);
     p_b = &buf->gwbuf_bufobj;
     /** Search the end of the list and add there */
     while (*p_b != NULL)
@@ -739,8 +992,6 @@ void gwbuf_add_buffer_object(GWBUF* buf,
     *p_b = newb;
     /** Set flag */
     buf->gwbuf_info |= GWBUF_INFO_PARSED;
-    /** Unlock */
-    spinlock_release(&buf->gwbuf_lock);
 }
 
 /**
@@ -756,16 +1007,13 @@ void* gwbuf_get_buffer_object_data(GWBUF* buf, bufobj_id_t id)
     buffer_object_t* bo;
 
     CHK_GWBUF(buf);
-    /** Lock */
-    spinlock_acquire(&buf->gwbuf_lock);
     bo = buf->gwbuf_bufobj;
 
     while (bo != NULL && bo->bo_id != id)
     {
         bo = bo->bo_next;
     }
-    /** Unlock */
-    spinlock_release(&buf->gwbuf_lock);
+
     if (bo)
     {
         return bo->bo_data;
@@ -788,7 +1036,8 @@ static buffer_object_t* gwbuf_remove_buffer_object(GWBUF* buf, buffer_object_t*
 }
 
 /**
- * Add a property to a buffer.
+ * Add a property to a buffer. The property is stored in the shared buffer
+ * and is thus also visible to all clones of the buffer.
  *
  * @param buf   The buffer to add the property to
  * @param name  The property name
@@ -813,10 +1062,14 @@ gwbuf_add_property(GWBUF *buf, char *name, char *value)
 
     prop->name = name;
     prop->value = value;
-    spinlock_acquire(&buf->gwbuf_lock);
-    prop->next = buf->properties;
-    buf->properties = prop;
-    spinlock_release(&buf->gwbuf_lock);
+
+    /** Clones of the buffer may be used by other threads */
+    do
+    {
+        prop->next = buf->sbuf->properties;
+    }
+    while (!__sync_bool_compare_and_swap(&buf->sbuf->properties, prop->next, prop));
+
     return 1;
 }
 
@@ -831,13 +1084,11 @@ gwbuf_get_property(GWBUF *buf, char *name)
 {
     BUF_PROPERTY *prop;
 
-    spinlock_acquire(&buf->gwbuf_lock);
-    prop = buf->properties;
+    prop = buf->sbuf->properties;
     while (prop && strcmp(prop->name, name) != 0)
     {
         prop = prop->next;
     }
-    spinlock_release(&buf->gwbuf_lock);
     if (prop)
     {
         return prop->value;
@@ -897,7 +1148,6 @@ gwbuf_add_hint(GWBUF *buf, HINT *hint)
 {
     HINT *ptr;
 
-    spinlock_acquire(&buf->gwbuf_lock);
     if (buf->hint)
     {
         ptr = buf->hint;
@@ -911,7 +1161,6 @@ gwbuf_add_hint(GWBUF *buf, HINT *hint)
     {
         buf->hint = hint;
     }
-    spinlock_release(&buf->gwbuf_lock);
     return 1;
 }
 
@@ -96,6 +96,7 @@ static SSL_LISTENER *make_ssl_structure(CONFIG_CONTEXT *obj, bool require_cert,
 int config_truth_value(char *str);
 int config_get_ifaddr(unsigned char *output);
 static int config_get_release_string(char* release);
+static bool config_parse_seconds(const char *value, int *seconds);
 FEEDBACK_CONF *config_get_feedback_data();
 void config_add_param(CONFIG_CONTEXT*, char*, char*);
 bool config_has_duplicate_sections(const char* config);
@@ -138,6 +139,8 @@ static char *service_params[] =
     "ignore_databases",
     "ignore_databases_regex",
     "log_auth_warnings",
+    "auth_cache_ttl",
+    "users_refresh_time",
     "source", /**< Avrorouter only */
     NULL
 };
@@ -839,6 +842,18 @@ config_pollsleep()
     return gateway.pollsleep;
 }
 
+/**
+ * Return whether each polling thread should have its own event queue
+ * instead of all threads sharing a single queue.
+ *
+ * @return True if per-thread event queues are used
+ */
+bool
+config_per_thread_queues()
+{
+    return gateway.per_thread_queues;
+}
+
 /**
  * Return the feedback config data pointer
  *
@@ -924,6 +939,23 @@ handle_global_item(const char *name, const char *value)
     {
         gateway.pollsleep = atoi(value);
     }
+    else if (strcmp(name, "event_queues") == 0)
+    {
+        if (strcmp(value, "per_thread") == 0)
+        {
+            gateway.per_thread_queues = true;
+        }
+        else if (strcmp(value, "shared") == 0)
+        {
+            gateway.per_thread_queues = false;
+        }
+        else
+        {
+            MXS_WARNING("Invalid value for 'event_queues': %s. "
+                        "Valid values are 'shared' and 'per_thread'.", value);
+            return 0;
+        }
+    }
     else if (strcmp(name, "ms_timestamp") == 0)
     {
         mxs_log_set_highprecision_enabled(config_truth_value((char*)value));
@@ -1269,6 +1301,7 @@ global_defaults()
     gateway.n_threads = DEFAULT_NTHREADS;
     gateway.n_nbpoll = DEFAULT_NBPOLLS;
     gateway.pollsleep = DEFAULT_POLLSLEEP;
+    gateway.per_thread_queues = false;
     gateway.auth_conn_timeout = DEFAULT_AUTH_CONNECT_TIMEOUT;
     gateway.auth_read_timeout = DEFAULT_AUTH_READ_TIMEOUT;
     gateway.auth_write_timeout = DEFAULT_AUTH_WRITE_TIMEOUT;
@@ -1401,6 +1434,22 @@ process_config_update(CONFIG_CONTEXT *context)
                         service->log_auth_warnings = (bool)truthval;
                     }
 
+                    char *auth_cache_ttl = config_get_value(obj->parameters, "auth_cache_ttl");
+                    int seconds;
+
+                    if (auth_cache_ttl && config_parse_seconds(auth_cache_ttl, &seconds))
+                    {
+                        service->auth_cache_ttl = seconds;
+                    }
+
+                    char *users_refresh_time = config_get_value(obj->parameters, "users_refresh_time");
+
+                    if (users_refresh_time && config_parse_seconds(users_refresh_time, &seconds) &&
+                        seconds != service->users_refresh_time)
+                    {
+                        serviceSetUsersRefreshTime(service, seconds);
+                    }
+
                     CONFIG_PARAMETER* param;
 
                     if ((param = config_get_param(obj->parameters, "ignore_databases")))
@@ -2183,6 +2232,27 @@ int maxscale_getline(char** dest, int* size, FILE* file)
     return 1;
 }
 
+/**
+ * Parse a non-negative number of seconds
+ *
+ * @param value   The value of the parameter
+ * @param seconds Where the number of seconds is stored on success
+ * @return True if the value is a valid number of seconds
+ */
+static bool config_parse_seconds(const char *value, int *seconds)
+{
+    char *endptr;
+    long val = strtol(value, &endptr, 10);
+
+    if (*value && *endptr == '\0' && val >= 0 && val <= INT_MAX)
+    {
+        *seconds = val;
+        return true;
+    }
+
+    return false;
+}
+
 /**
  * Validate the SSL parameters for a service
  * @param ssl_cert SSL certificate (private key)
@@ -2360,6 +2430,20 @@ int create_new_service(CONFIG_CONTEXT *obj)
         }
     }
 
+    char *auth_cache_ttl = config_get_value(obj->parameters, "auth_cache_ttl");
+    if (auth_cache_ttl && !config_parse_seconds(auth_cache_ttl, &service->auth_cache_ttl))
+    {
+        MXS_ERROR("Invalid value for 'auth_cache_ttl': %s", auth_cache_ttl);
+        error_count++;
+    }
+
+    char *users_refresh_time = config_get_value(obj->parameters, "users_refresh_time");
+    if (users_refresh_time && !config_parse_seconds(users_refresh_time, &service->users_refresh_time))
+    {
+        MXS_ERROR("Invalid value for 'users_refresh_time': %s", users_refresh_time);
+        error_count++;
+    }
+
     if ((param = config_get_param(obj->parameters, "ignore_databases")))
     {
         service_set_param_value(obj->element, param, param->value, 0, STRING_TYPE);
@@ -51,6 +51,7 @@
 #include <regex.h>
 #include <mysql_utils.h>
 #include <maxscale/alloc.h>
+#include <thread.h>
 
 /** Don't include the root user */
 #define USERS_QUERY_NO_ROOT " AND user.user NOT IN ('root')"
@@ -122,7 +123,92 @@
 MaxScale authentication will proceed without including database permissions. \
 See earlier error messages for user '%s' for more information."
 
-static int add_databases(SERV_LISTENER *listener, MYSQL *con);
+/** Number of buckets in the per-user index of a MySQL users table */
+#define MYSQL_USERS_INDEX_SIZE 4096
+
+/**
+ * A grant of a user from one host: the database it allows and the
+ * SHA1(SHA1(password)) of the user.
+ */
+typedef struct mysql_user_grant
+{
+    char *resource;                 /**< NULL for no database grants, empty for any database */
+    char *password;                 /**< The hex encoded SHA1(SHA1(password)) */
+    struct mysql_user_grant *next;
+} MYSQL_USER_GRANT;
+
+/**
+ * A node in the path compressed binary trie of the networks a user has grants from.
+ * A child is always a longer prefix of its parent.
+ */
+typedef struct mysql_host_node
+{
+    uint32_t prefix;                /**< The network address in host byte order */
+    int len;                        /**< Length of the network prefix in bits */
+    MYSQL_USER_GRANT *grants;       /**< Grants from the network, NULL for a branching node */
+    struct mysql_host_node *child[2];
+} MYSQL_HOST_NODE;
+
+/**
+ * A host pattern with % and _ wildcards that is matched against the client address
+ */
+typedef struct mysql_host_pattern
+{
+    char *pattern;
+    size_t prefix_len;              /**< Length of the literal prefix before the first wildcard */
+    MYSQL_USER_GRANT *grants;
+    struct mysql_host_pattern *next;
+} MYSQL_HOST_PATTERN;
+
+/**
+ * All the grants of one user, the value of the index of a MySQL users table
+ */
+typedef struct mysql_user_grants
+{
+    MYSQL_HOST_NODE *networks;      /**< Root of the trie of networks */
+    MYSQL_HOST_PATTERN *patterns;   /**< Host patterns, longest literal prefix first */
+} MYSQL_USER_GRANTS;
+
+/** Number of entries in the lookup cache of a MySQL users table */
+#define MYSQL_USERS_CACHE_SIZE 1024
+
+/**
+ * A cached user lookup: the user, client address and database, and the
+ * SHA1(SHA1(password)) of the user or that the user was not found.
+ */
+typedef struct mysql_users_cache_entry
+{
+    SPINLOCK lock;
+    time_t expires;                         /**< When the entry expires, 0 for an unused entry */
+    bool found;                             /**< Whether a grant matched */
+    in_addr_t addr;                         /**< The client address */
+    char user[MYSQL_USER_MAXLEN + 1];
+    char db[MYSQL_DATABASE_MAXLEN + 1];
+    uint8_t password[SHA_DIGEST_LENGTH];    /**< SHA1(SHA1(password)) if found */
+} MYSQL_USERS_CACHE_ENTRY;
+
+/**
+ * The lookup cache of a MySQL users table. The cache is direct-mapped: a
+ * lookup replaces the entry that has the same hash.
+ */
+typedef struct mysql_users_cache
+{
+    MYSQL_USERS_CACHE_ENTRY entries[MYSQL_USERS_CACHE_SIZE];
+} MYSQL_USERS_CACHE;
+
+/** The netmask of a network prefix of len bits, in host byte order */
+static inline uint32_t prefix_mask(int len)
+{
+    return len > 0 ? 0xFFFFFFFFu << (32 - len) : 0;
+}
+
+/** The bit of the address at position pos, counting from the most significant bit */
+static inline int prefix_bit(uint32_t addr, int pos)
+{
+    return (addr >> (31 - pos)) & 1;
+}
+
+static MYSQL_RES *fetch_databases(SERVICE *service, MYSQL *con);
 static int add_wildcard_users(USERS *users, char* name, char* host,
                               char* password, char* anydb, char* db, HASHTABLE* hash);
 static void *dbusers_keyread(int fd);
@@ -130,20 +216,25 @@ static int dbusers_keywrite(int fd, void *key);
 static void *dbusers_valueread(int fd);
 static int dbusers_valuewrite(int fd, void *value);
 static int get_all_users(SERV_LISTENER *listener, USERS *users);
-static int get_databases(SERV_LISTENER *listener, MYSQL *users);
+static int get_databases(SERV_LISTENER *listener, USERS *users, MYSQL *con);
 static int get_users(SERV_LISTENER *listener, USERS *users);
 static MYSQL *gw_mysql_init(void);
 static int gw_mysql_set_timeouts(MYSQL* handle);
 static bool host_has_singlechar_wildcard(const char *host);
+static bool host_has_inner_wildcard(const char *host);
+static bool host_matches_pattern(const char *host, const char *pattern);
 static bool host_matches_singlechar_wildcard(const char* user, const char* wild);
 static bool is_ipaddress(const char* host);
+static void mysql_users_index_add(USERS *users, const MYSQL_USER_HOST *key, const char *auth);
+static void mysql_user_grants_free(void *data);
 static char *mysql_format_user_entry(void *data);
 static char *mysql_format_user_entry(void *data);
 static int normalize_hostname(const char *input_host, char *output_host);
+static int parse_host_netmask(const char *host, char *output_host);
+static bool resource_matches(const char *requested, const char *granted);
 static int resource_add(HASHTABLE *, char *, char *);
 static HASHTABLE *resource_alloc();
 static void *resource_fetch(HASHTABLE *, char *);
-static void resource_free(HASHTABLE *resource);
 static int uh_cmpfun(const void* v1, const void* v2);
 static int uh_hfun(const void* key);
 static MYSQL_USER_HOST *uh_keydup(const MYSQL_USER_HOST* key);
@@ -269,9 +360,6 @@ replace_mysql_users(SERV_LISTENER *listener)
 
     spinlock_acquire(&listener->lock);
 
-    /** TODO: Make the listener resource a part of the USERS struct */
-    HASHTABLE *oldresources = listener->resources;
-
     /* load users and grants from the backend database */
     int i = get_users(listener, newusers);
 
@@ -280,14 +368,13 @@ replace_mysql_users(SERV_LISTENER *listener)
         /** Failed to load users */
         if (listener->users)
         {
-            /* Restore old users and resources */
+            /* Keep the old users and resources */
             users_free(newusers);
-            listener->resources = oldresources;
         }
         else
         {
             /* No users allocated, use the empty new one */
-            listener->users = newusers;
+            listener_users_set(listener, newusers);
         }
         spinlock_release(&listener->lock);
         return i;
@@ -310,12 +397,12 @@ replace_mysql_users(SERV_LISTENER *listener)
     if (oldusers != NULL && memcmp(oldusers->cksum, newusers->cksum,
                                    SHA_DIGEST_LENGTH) == 0)
     {
-        /* same data, nothing to do */
-        MXS_DEBUG("%lu [replace_mysql_users] users' tables not switched, checksum is the same",
+        /**
+         * Same users, but the database names are not part of the checksum and
+         * they are published with the users. The new table is taken into use.
+         */
+        MXS_DEBUG("%lu [replace_mysql_users] users' tables replaced, checksum is the same",
                   pthread_self());
-
-        /* free the new table */
-        users_free(newusers);
         i = 0;
     }
     else
@@ -323,19 +410,16 @@ replace_mysql_users(SERV_LISTENER *listener)
         /* replace the service with effective new data */
         MXS_DEBUG("%lu [replace_mysql_users] users' tables replaced, checksum differs",
                   pthread_self());
-        listener->users = newusers;
     }
 
-    spinlock_release(&listener->lock);
-
-    /* free old resources */
-    resource_free(oldresources);
+    /**
+     * The worker threads hold a reference to the users while they look them
+     * up, the old table and its resources are freed when the last lookup that
+     * uses them is done.
+     */
+    listener_users_set(listener, newusers);
 
-    if (i && oldusers)
-    {
-        /* free the old table */
-        users_free(oldusers);
-    }
+    spinlock_release(&listener->lock);
 
     return i;
 }
@@ -388,12 +472,95 @@ static bool host_has_singlechar_wildcard(const char *host)
     return retval;
 }
 
+/**
+ * Check if an IP address has % wildcards that do not make up whole trailing
+ * bytes of the address, e.g. 192.168.%.1 or 192.168.1%. These cannot be
+ * expressed as a network and netmask.
+ * @param host Hostname to check
+ * @return True if the hostname has a % wildcard inside the address
+ */
+static bool host_has_inner_wildcard(const char *host)
+{
+    bool wildcard_byte = false;
+
+    while (*host != '\0')
+    {
+        size_t len = strcspn(host, ".");
+
+        if (len == 1 && *host == '%')
+        {
+            wildcard_byte = true;
+        }
+        else if (wildcard_byte || memchr(host, '%', len))
+        {
+            return true;
+        }
+
+        host += len;
+        if (*host == '.')
+        {
+            host++;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Check if a host matches a MySQL host pattern. A % matches any number of
+ * characters and a _ matches exactly one character.
+ * @param host The client host
+ * @param pattern Host in the grant
+ * @return True if the host matches the pattern
+ */
+static bool host_matches_pattern(const char *host, const char *pattern)
+{
+    while (*pattern != '\0')
+    {
+        if (*pattern == '%')
+        {
+            while (*pattern == '%')
+            {
+                pattern++;
+            }
+
+            if (*pattern == '\0')
+            {
+                return true;
+            }
+
+            for (; *host != '\0'; host++)
+            {
+                if (host_matches_pattern(host, pattern))
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        if (*host == '\0' || (*pattern != '_' && *pattern != *host))
+        {
+            return false;
+        }
+
+        host++;
+        pattern++;
+    }
+
+    return *host == '\0';
+}
+
 /**
  * Add a new MySQL user with host, password and netmask into the service users table
  *
  * The netmask values are:
  * 0 for any, 32 for single IPv4
  * 24 for a class C from a.b.c.%, 16 for a Class B from a.b.%.% and 8 for a Class A from a.%.%.%
+ * and the length of the netmask for a.b.c.d/m.m.m.m
+ *
+ * Addresses with other wildcards, e.g. a.b.%.d or a.b.c._, are stored as host patterns.
  *
  * @param users         The users table
  * @param user          The user name
@@ -463,12 +630,23 @@ int add_mysql_users_with_host_ipv4(USERS *users, const char *user, const char *h
     }
     else if (strnlen(host, MYSQL_HOST_MAXLEN + 1) <= MYSQL_HOST_MAXLEN &&
              is_ipaddress(host) &&
-             host_has_singlechar_wildcard(host))
+             (host_has_singlechar_wildcard(host) || host_has_inner_wildcard(host)))
     {
         strcpy(key.hostname, host);
         strcpy(ret_ip, "0.0.0.0");
         key.netmask = 0;
     }
+    else if (strchr(host, '/'))
+    {
+        /* network address and netmask: a.b.c.d/m.m.m.m */
+        key.netmask = parse_host_netmask(host, ret_ip);
+
+        if (key.netmask == -1)
+        {
+            MXS_ERROR("Invalid network address or netmask in %s@%s", user, host);
+            ret_ip[0] = '\0';
+        }
+    }
     else
     {
         /* hostname without % wildcards has netmask = 32 */
@@ -487,11 +665,11 @@ int add_mysql_users_with_host_ipv4(USERS *users, const char *user, const char *h
         /* copy IPv4 data into key.ipv4 */
         memcpy(&key.ipv4, &serv_addr, sizeof(serv_addr));
 
-        /* if netmask < 32 there are % wildcards */
+        /* if netmask < 32 there are % wildcards or a netmask */
         if (key.netmask < 32)
         {
-            /* let's zero the last IP byte: a.b.c.0 we may have set above to 1*/
-            key.ipv4.sin_addr.s_addr &= 0x00FFFFFF;
+            /* let's zero the host part: a.b.c.0 we may have set above to 1*/
+            key.ipv4.sin_addr.s_addr &= htonl(prefix_mask(key.netmask));
         }
 
         /* add user@host as key and passwd as value in the MySQL users hash table */
@@ -512,17 +690,17 @@ int add_mysql_users_with_host_ipv4(USERS *users, const char *user, const char *h
 }
 
 /**
- * Add the database specific grants from mysql.db table into the service resources hashtable
- * environment.
+ * Fetch the database names of a server for the service resources hashtable.
+ * The names are added to the resources by get_all_users().
  *
  * @param service   The current service
- * @param users     The users table into which to load the users
- * @return          -1 on any error or the number of users inserted (0 means no users at all)
+ * @param con       Connection to the server
+ * @return          The result of SHOW DATABASES or NULL if there are no databases
+ *                  or on error
  */
-static int
-add_databases(SERV_LISTENER *listener, MYSQL *con)
+static MYSQL_RES *
+fetch_databases(SERVICE *service, MYSQL *con)
 {
-    SERVICE *service = listener->service;
     MYSQL_ROW row;
     MYSQL_RES *result = NULL;
     char *service_user = NULL;
@@ -535,7 +713,7 @@ add_databases(SERV_LISTENER *listener, MYSQL *con)
 
     if (service_user == NULL || service_passwd == NULL)
     {
-        return -1;
+        return NULL;
     }
 
     if (mysql_query(con, get_showdbs_priv_query))
@@ -544,7 +722,7 @@ add_databases(SERV_LISTENER *listener, MYSQL *con)
                   "error: %s.",
                   service->name,
                   mysql_error(con));
-        return -1;
+        return NULL;
     }
 
     result = mysql_store_result(con);
@@ -555,7 +733,7 @@ add_databases(SERV_LISTENER *listener, MYSQL *con)
                   "error: %s.",
                   service->name,
                   mysql_error(con));
-        return -1;
+        return NULL;
     }
 
     /* Result has only one row */
@@ -579,7 +757,7 @@ add_databases(SERV_LISTENER *listener, MYSQL *con)
     if (!ndbs)
     {
         /* return if no db names are available */
-        return 0;
+        return NULL;
     }
 
     if (mysql_query(con, "SHOW DATABASES"))
@@ -589,7 +767,7 @@ add_databases(SERV_LISTENER *listener, MYSQL *con)
                   service->name,
                   mysql_error(con));
 
-        return -1;
+        return NULL;
     }
 
     result = mysql_store_result(con);
@@ -600,34 +778,22 @@ add_databases(SERV_LISTENER *listener, MYSQL *con)
                   "error: %s.",
                   service->name,
                   mysql_error(con));
-
-        return -1;
-    }
-
-    /* insert key and value "" */
-    while ((row = mysql_fetch_row(result)))
-    {
-        if (resource_add(listener->resources, row[0], ""))
-        {
-            MXS_DEBUG("%s: Adding database %s to the resouce hash.", service->name, row[0]);
-        }
     }
 
-    mysql_free_result(result);
-
-    return ndbs;
+    return result;
 }
 
 /**
- * Load the database specific grants from mysql.db table into the service resources hashtable
- * environment.
+ * Load the database specific grants from mysql.db table into the resources
+ * hashtable of a users table.
  *
  * @param service   The current service
- * @param users     The users table into which to load the users
+ * @param users     The users table into which to load the database names
+ * @param con       Connection to the server
  * @return          -1 on any error or the number of users inserted (0 means no users at all)
  */
 static int
-get_databases(SERV_LISTENER *listener, MYSQL *con)
+get_databases(SERV_LISTENER *listener, USERS *users, MYSQL *con)
 {
     SERVICE *service = listener->service;
     MYSQL_ROW row;
@@ -711,14 +877,14 @@ get_databases(SERV_LISTENER *listener, MYSQL *con)
         return -1;
     }
 
-    /* Now populate service->resources hashatable with db names */
-    listener->resources = resource_alloc();
+    /* Now populate users->resources hashatable with db names */
+    users->resources = resource_alloc();
 
     /* insert key and value "" */
     while ((row = mysql_fetch_row(result)))
     {
         MXS_DEBUG("%s: Adding database %s to the resouce hash.", service->name, row[0]);
-        resource_add(listener->resources, row[0], "");
+        resource_add(users->resources, row[0], "");
     }
 
     mysql_free_result(result);
@@ -727,448 +893,507 @@ get_databases(SERV_LISTENER *listener, MYSQL *con)
 }
 
 /**
- * Load the user/passwd from mysql.user table into the service users' hashtable
- * environment from all the backend servers.
- *
- * @param service   The current service
- * @param users     The users table into which to load the users
- * @return          -1 on any error or the number of users inserted
+ * The users and database names loaded from one server by get_all_users()
  */
-static int
-get_all_users(SERV_LISTENER *listener, USERS *users)
+typedef struct
 {
-    SERVICE *service = listener->service;
-    MYSQL *con = NULL;
-    MYSQL_ROW row;
-    MYSQL_RES *result = NULL;
-    char *service_user = NULL;
-    char *service_passwd = NULL;
-    char *dpwd = NULL;
-    int total_users = 0;
-    SERVER_REF *server;
-    const char *userquery;
-    char *tmp;
-    unsigned char hash[SHA_DIGEST_LENGTH] = "";
-    char *users_data = NULL;
-    char *final_data = NULL;
-    char dbnm[MYSQL_DATABASE_MAXLEN + 1];
-    int nusers = -1;
-    int users_data_row_len = MYSQL_USER_MAXLEN + MYSQL_HOST_MAXLEN +
-                             MYSQL_PASSWORD_LEN + sizeof(char) + MYSQL_DATABASE_MAXLEN;
-    int dbnames = 0;
-    int db_grants = 0;
-    bool anon_user = false;
+    SERVICE *service;           /**< The service whose users are loaded */
+    SERVER *server;             /**< The server the users are loaded from */
+    const char *user;           /**< The service user */
+    const char *password;       /**< The decrypted password of the service user */
+    MYSQL *con;                 /**< Connection to the server, NULL if the load failed */
+    MYSQL_RES *databases;       /**< The database names of the server or NULL */
+    MYSQL_RES *users;           /**< The users of the server, NULL if the load failed */
+    int nusers;                 /**< The number of users the server reported */
+    bool db_grants;             /**< Whether the users have their database grants */
+} SERVER_USERS;
 
-    if (serviceGetUser(service, &service_user, &service_passwd) == 0)
+/**
+ * Close the connection of a server users load and free its results
+ *
+ * @param load The server users load
+ */
+static void
+server_users_free(SERVER_USERS *load)
+{
+    if (load->databases)
     {
-        ss_dassert(service_passwd == NULL || service_user == NULL);
-        return -1;
+        mysql_free_result(load->databases);
+        load->databases = NULL;
     }
-
-    if (service->svc_do_shutdown)
+    if (load->users)
     {
-        return -1;
+        mysql_free_result(load->users);
+        load->users = NULL;
     }
+    if (load->con)
+    {
+        mysql_close(load->con);
+        load->con = NULL;
+    }
+}
 
-    dpwd = decryptPassword(service_passwd);
-    final_data = (char*) MXS_MALLOC(sizeof(char));
-    MXS_ABORT_IF_NULL(final_data);
-    *final_data = '\0';
-
-    /**
-     * Attempt to connect to one of the databases database or until we run
-     * out of databases
-     * to try
-     */
-    server = service->dbref;
+/**
+ * Load the users and the database names of one server. The results are left
+ * in the SERVER_USERS structure and added to the users of the listener by
+ * get_all_users().
+ *
+ * @param load The server users load
+ */
+static void
+load_server_users(SERVER_USERS *load)
+{
+    SERVICE *service = load->service;
+    SERVER *server = load->server;
+    MYSQL *con;
+    MYSQL_RES *result;
+    MYSQL_ROW row;
 
-    if (server == NULL)
+    if (service->svc_do_shutdown || (con = gw_mysql_init()) == NULL)
     {
-        goto cleanup;
+        return;
     }
 
-    listener->resources = resource_alloc();
+    load->con = con;
 
-    while (server != NULL)
+    if (mxs_mysql_real_connect(con, server, load->user, load->password) == NULL)
     {
-        while (!service->svc_do_shutdown && server != NULL)
-        {
-            con = gw_mysql_init();
-            if (con)
-            {
-                if (mxs_mysql_real_connect(con, server->server, service_user, dpwd) == NULL)
-                {
-                    MXS_ERROR("Failure loading users data from backend "
-                              "[%s:%i] for service [%s]. MySQL error %i, %s",
-                              server->server->name, server->server->port,
-                              service->name, mysql_errno(con), mysql_error(con));
-                    mysql_close(con);
-                }
-                else
-                {
-                    /** Successfully connected to a server */
-                    break;
-                }
-            }
-            else
-            {
-                server = NULL;
-                break;
-            }
+        MXS_ERROR("Failure loading users data from backend "
+                  "[%s:%i] for service [%s]. MySQL error %i, %s",
+                  server->name, server->port,
+                  service->name, mysql_errno(con), mysql_error(con));
+        server_users_free(load);
+        return;
+    }
 
-            server = server->next;
+    if (server->server_string == NULL)
+    {
+        const char *server_string = mysql_get_server_info(con);
+        if (!server_set_version_string(server, server_string))
+        {
+            server_users_free(load);
+            return;
         }
+    }
+
+    load->databases = fetch_databases(service, con);
 
-        if (server == NULL)
+    char querybuffer[MAX_QUERY_STR_LEN];
+    /** Count users. Start with users and db grants for users */
+    const char *usercount = get_usercount_query(server->server_string,
+                                                service->enable_root, querybuffer);
+    if (mysql_query(con, usercount))
+    {
+        /*
+         * If we have got ER_TABLEACCESS_DENIED_ERROR try counting
+         * users from mysql.user without DB names.
+         */
+        if (mysql_errno(con) != ER_TABLEACCESS_DENIED_ERROR ||
+            mysql_query(con, MYSQL_USERS_COUNT))
         {
-            MXS_ERROR("Unable to get user data from backend database "
-                      "for service [%s]. Missing server information.",
-                      service->name);
-            goto cleanup;
+            MXS_ERROR("Loading users for service [%s] encountered error: [%s].",
+                      service->name,
+                      mysql_error(con));
+            server_users_free(load);
+            return;
         }
+    }
 
-        add_databases(listener, con);
-        mysql_close(con);
-        server = server->next;
+    result = mysql_store_result(con);
+
+    if (result == NULL)
+    {
+        MXS_ERROR("Loading users for service [%s] encountered error: [%s].",
+                  service->name,
+                  mysql_error(con));
+        server_users_free(load);
+        return;
     }
 
-    server = service->dbref;
+    row = mysql_fetch_row(result);
+    load->nusers = row ? atoi(row[0]) : 0;
+    mysql_free_result(result);
 
-    while (server != NULL)
+    if (!load->nusers)
     {
-        while (!service->svc_do_shutdown && server != NULL)
+        MXS_ERROR("Counting users for service %s returned 0.", service->name);
+        server_users_free(load);
+        return;
+    }
+
+    const char *userquery = get_users_db_query(server->server_string,
+                                               service->enable_root, querybuffer);
+
+    /* send first the query that fetches users and db grants */
+    if (mysql_query(con, userquery))
+    {
+        /*
+         * An error occurred executing the query
+         *
+         * Check mysql_errno() against ER_TABLEACCESS_DENIED_ERROR)
+         */
+
+        if (1142 != mysql_errno(con))
         {
-            con = gw_mysql_init();
-            if (con)
-            {
-                if (mxs_mysql_real_connect(con, server->server, service_user, dpwd) == NULL)
-                {
-                    MXS_ERROR("Failure loading users data from backend "
-                              "[%s:%i] for service [%s]. MySQL error %i, %s",
-                              server->server->name, server->server->port,
-                              service->name, mysql_errno(con), mysql_error(con));
-                    mysql_close(con);
-                }
-                else
-                {
-                    /** Successfully connected to a server */
-                    break;
-                }
-            }
-            else
-            {
-                server = NULL;
-                break;
-            }
+            /* This is an error we cannot handle, return */
 
-            server = server->next;
-        }
+            MXS_ERROR("Loading users with dbnames for service [%s] encountered "
+                      "error: [%s], MySQL errno %i",
+                      service->name,
+                      mysql_error(con),
+                      mysql_errno(con));
 
-        if (server == NULL)
-        {
-            MXS_ERROR("Unable to get user data from backend database "
-                      "for service [%s]. Missing server information.",
-                      service->name);
-            goto cleanup;
+            server_users_free(load);
+            return;
         }
 
-        if (server->server->server_string == NULL)
-        {
-            const char *server_string = mysql_get_server_info(con);
-            if (!server_set_version_string(server->server, server_string))
-            {
-                mysql_close(con);
-                goto cleanup;
-            }
-        }
+        /*
+         * We have got ER_TABLEACCESS_DENIED_ERROR
+         * try loading users from mysql.user without DB names.
+         */
 
-        char querybuffer[MAX_QUERY_STR_LEN];
-        /** Count users. Start with users and db grants for users */
-        const char *usercount = get_usercount_query(server->server->server_string,
-                                                    service->enable_root, querybuffer);
-        if (mysql_query(con, usercount))
-        {
-            if (mysql_errno(con) != ER_TABLEACCESS_DENIED_ERROR)
-            {
-                /* This is an error we cannot handle, return */
-                MXS_ERROR("Loading users for service [%s] encountered error: [%s].",
-                          service->name,
-                          mysql_error(con));
-                mysql_close(con);
-                goto cleanup;
-            }
-            else
-            {
-                /*
-                 * We have got ER_TABLEACCESS_DENIED_ERROR
-                 * try counting users from mysql.user without DB names.
-                 */
-                if (mysql_query(con, MYSQL_USERS_COUNT))
-                {
-                    MXS_ERROR("Loading users for service [%s] encountered error: [%s].",
-                              service->name,
-                              mysql_error(con));
-                    mysql_close(con);
-                    goto cleanup;
-                }
-            }
-        }
+        MXS_ERROR("Failed to retrieve users: %s", mysql_error(con));
+        MXS_ERROR(ERROR_NO_SHOW_DATABASES, service->name, load->user);
 
-        result = mysql_store_result(con);
+        userquery = get_users_query(server->server_string,
+                                    service->enable_root, querybuffer);
 
-        if (result == NULL)
+        if (mysql_query(con, userquery))
         {
-            MXS_ERROR("Loading users for service [%s] encountered error: [%s].",
+            MXS_ERROR("Loading users for service [%s] encountered "
+                      "error: [%s], code %i",
                       service->name,
-                      mysql_error(con));
-            mysql_close(con);
-            goto cleanup;
+                      mysql_error(con),
+                      mysql_errno(con));
+
+            server_users_free(load);
+            return;
         }
 
-        row = mysql_fetch_row(result);
+        /* users successfully loaded but without db grants */
 
-        nusers = atoi(row[0]);
+        MXS_NOTICE("Loading users from [mysql.user] without access to [mysql.db] for "
+                   "service [%s]. MaxScale Authentication with DBname on connect "
+                   "will not consider database grants.",
+                   service->name);
+    }
+    else
+    {
+        /*
+         * users successfully loaded with db grants.
+         */
+        MXS_DEBUG("[%s] Loading users with db grants.", service->name);
+        load->db_grants = true;
+    }
 
-        mysql_free_result(result);
+    if ((load->users = mysql_store_result(con)) == NULL)
+    {
+        MXS_ERROR("Loading users for service %s encountered error: %s.",
+                  service->name,
+                  mysql_error(con));
 
-        if (!nusers)
-        {
-            MXS_ERROR("Counting users for service %s returned 0.", service->name);
-            mysql_close(con);
-            goto cleanup;
-        }
+        server_users_free(load);
+    }
+}
 
-        userquery = get_users_db_query(server->server->server_string,
-                                       service->enable_root, querybuffer);
+/**
+ * Thread entry point that loads the users of one server
+ *
+ * @param data The server users load
+ */
+static void
+load_server_users_thread(void *data)
+{
+    if (mysql_thread_init())
+    {
+        MXS_ERROR("mysql_thread_init failed when loading the users of a server.");
+        return;
+    }
 
-        /* send first the query that fetches users and db grants */
-        if (mysql_query(con, userquery))
+    load_server_users((SERVER_USERS *) data);
+    mysql_thread_end();
+}
+
+/**
+ * Add the users loaded from one server to a users table
+ *
+ * @param load       The server users load
+ * @param users      The users table into which to add the users
+ * @param users_data The memory area for the SHA1 digest the users are appended to
+ * @param row_len    The maximum length of one user in the memory area
+ * @param anon_user  Set to true if the server has an anonymous user
+ * @return           The number of users added
+ */
+static int
+add_server_users(SERVER_USERS *load, USERS *users, char *users_data,
+                 int row_len, bool *anon_user)
+{
+    SERVICE *service = load->service;
+    char dbnm[MYSQL_DATABASE_MAXLEN + 1];
+    int total_users = 0;
+    MYSQL_ROW row;
+
+    while ((row = mysql_fetch_row(load->users)))
+    {
+
+        /**
+         * Up to six fields could be returned.
+         * user,host,passwd,concat(),anydb,db
+         * passwd+1 (escaping the first byte that is '*')
+         */
+
+        int rc = 0;
+        char *password = NULL;
+
+        /** If the username is empty, the backend server still has anonymous
+         * user in it. This will mean that localhost addresses do not match
+         * the wildcard host '%' */
+        if (strlen(row[0]) == 0)
         {
-            /*
-             * An error occurred executing the query
-             *
-             * Check mysql_errno() against ER_TABLEACCESS_DENIED_ERROR)
-             */
+            *anon_user = true;
+            continue;
+        }
 
-            if (1142 != mysql_errno(con))
+        if (row[2] != NULL)
+        {
+            /* detect mysql_old_password (pre 4.1 protocol) */
+            if (strlen(row[2]) == 16)
             {
-                /* This is an error we cannot handle, return */
-
-                MXS_ERROR("Loading users with dbnames for service [%s] encountered "
-                          "error: [%s], MySQL errno %i",
+                MXS_ERROR("%s: The user %s@%s has on old password in the "
+                          "backend database. MaxScale does not support these "
+                          "old passwords. This user will not be able to connect "
+                          "via MaxScale. Update the users password to correct "
+                          "this.",
                           service->name,
-                          mysql_error(con),
-                          mysql_errno(con));
-
-                mysql_close(con);
+                          row[0],
+                          row[1]);
+                continue;
+            }
 
-                goto cleanup;
+            if (strlen(row[2]) > 1)
+            {
+                password = row[2] + 1;
             }
             else
             {
-                /*
-                 * We have got ER_TABLEACCESS_DENIED_ERROR
-                 * try loading users from mysql.user without DB names.
-                 */
-
-                MXS_ERROR("Failed to retrieve users: %s", mysql_error(con));
-                MXS_ERROR(ERROR_NO_SHOW_DATABASES, service->name, service_user);
+                password = row[2];
+            }
+        }
 
-                userquery = get_users_query(server->server->server_string,
-                                            service->enable_root, querybuffer);
+        /*
+         * add user@host and DB global priv and specificsa grant (if possible)
+         */
+        bool havedb = false;
 
-                if (mysql_query(con, userquery))
+        if (load->db_grants)
+        {
+            /* we have dbgrants, store them */
+            if (row[5])
+            {
+                unsigned long *rowlen = mysql_fetch_lengths(load->users);
+                memcpy(dbnm, row[5], rowlen[5]);
+                memset(dbnm + rowlen[5], 0, 1);
+                havedb = true;
+                if (service->strip_db_esc)
                 {
-                    MXS_ERROR("Loading users for service [%s] encountered "
-                              "error: [%s], code %i",
+                    strip_escape_chars(dbnm);
+                    MXS_DEBUG("[%s]: %s -> %s",
                               service->name,
-                              mysql_error(con),
-                              mysql_errno(con));
-
-                    mysql_close(con);
-
-                    goto cleanup;
+                              row[5],
+                              dbnm);
                 }
+            }
 
-                /* users successfully loaded but without db grants */
+            rc = add_mysql_users_with_host_ipv4(users, row[0], row[1],
+                                                password, row[4],
+                                                havedb ? dbnm : NULL);
 
-                MXS_NOTICE("Loading users from [mysql.user] without access to [mysql.db] for "
-                           "service [%s]. MaxScale Authentication with DBname on connect "
-                           "will not consider database grants.",
-                           service->name);
-            }
+            MXS_DEBUG("%s: Adding user:%s host:%s anydb:%s db:%s.",
+                      service->name, row[0], row[1], row[4],
+                      havedb ? dbnm : NULL);
         }
         else
         {
-            /*
-             * users successfully loaded with db grants.
-             */
-            MXS_DEBUG("[%s] Loading users with db grants.", service->name);
-            db_grants = 1;
+            /* we don't have dbgrants, simply set ANY DB for the user */
+            rc = add_mysql_users_with_host_ipv4(users, row[0], row[1],
+                                                password, "Y", NULL);
         }
 
-        result = mysql_store_result(con);
-
-        if (result == NULL)
+        if (rc == 1)
         {
-            MXS_ERROR("Loading users for service %s encountered error: %s.",
-                      service->name,
-                      mysql_error(con));
-
-            mysql_free_result(result);
-            mysql_close(con);
+            if (load->db_grants)
+            {
+                char dbgrant[MYSQL_DATABASE_MAXLEN + 1] = "";
+                if (row[4] != NULL)
+                {
+                    if (strcmp(row[4], "Y") == 0)
+                    {
+                        strcpy(dbgrant, "ANY");
+                    }
+                    else if (row[5])
+                    {
+                        strncpy(dbgrant, row[5], MYSQL_DATABASE_MAXLEN);
+                        dbgrant[MYSQL_DATABASE_MAXLEN] = 0;
+                    }
+                }
 
-            goto cleanup;
-        }
+                if (!strlen(dbgrant))
+                {
+                    strcpy(dbgrant, "no db");
+                }
 
-        users_data = (char *) MXS_CALLOC(nusers, (users_data_row_len * sizeof(char)) + 1);
+                /* Log the user being added with its db grants */
+                MXS_INFO("%s: User %s@%s for database %s added to service user table.",
+                         service->name, row[0], row[1], dbgrant);
+            }
+            else
+            {
+                /* Log the user being added (without db grants) */
+                MXS_INFO("%s: User %s@%s added to service user table.",
+                         service->name, row[0], row[1]);
+            }
 
-        if (users_data == NULL)
+            /* Append data in the memory area for SHA1 digest */
+            strncat(users_data, row[3], row_len);
+            total_users++;
+        }
+        else
         {
-            mysql_free_result(result);
-            mysql_close(con);
-
-            goto cleanup;
+            /** Log errors and not the duplicate user */
+            if (service->log_auth_warnings && rc != -1)
+            {
+                MXS_WARNING("Failed to add user %s@%s for service [%s]."
+                            " This user will be unavailable via MaxScale.",
+                            row[0], row[1], service->name);
+            }
         }
+    }
 
-        while ((row = mysql_fetch_row(result)))
-        {
+    return total_users;
+}
 
-            /**
-             * Up to six fields could be returned.
-             * user,host,passwd,concat(),anydb,db
-             * passwd+1 (escaping the first byte that is '*')
-             */
+/**
+ * Load the user/passwd from mysql.user table into the service users' hashtable
+ * environment from all the backend servers.
+ *
+ * The servers are queried in parallel, each by a thread of its own. The users
+ * and database names are added to the tables in the order of the servers once
+ * all the servers have replied, which keeps the checksum of the users stable.
+ * Servers that cannot be loaded from are skipped.
+ *
+ * @param service   The current service
+ * @param users     The users table into which to load the users
+ * @return          -1 on any error or the number of users inserted
+ */
+static int
+get_all_users(SERV_LISTENER *listener, USERS *users)
+{
+    SERVICE *service = listener->service;
+    char *service_user = NULL;
+    char *service_passwd = NULL;
+    char *dpwd = NULL;
+    int total_users = 0;
+    SERVER_REF *server;
+    unsigned char hash[SHA_DIGEST_LENGTH] = "";
+    char *final_data = NULL;
+    char *tmp;
+    int users_data_row_len = MYSQL_USER_MAXLEN + MYSQL_HOST_MAXLEN +
+                             MYSQL_PASSWORD_LEN + sizeof(char) + MYSQL_DATABASE_MAXLEN;
+    bool anon_user = false;
+    bool loaded = false;
+    int n_servers = 0;
 
-            int rc = 0;
-            char *password = NULL;
+    if (serviceGetUser(service, &service_user, &service_passwd) == 0)
+    {
+        ss_dassert(service_passwd == NULL || service_user == NULL);
+        return -1;
+    }
 
-            /** If the username is empty, the backend server still has anonymous
-             * user in it. This will mean that localhost addresses do not match
-             * the wildcard host '%' */
-            if (strlen(row[0]) == 0)
-            {
-                anon_user = true;
-                continue;
-            }
+    if (service->svc_do_shutdown)
+    {
+        return -1;
+    }
 
-            if (row[2] != NULL)
-            {
-                /* detect mysql_old_password (pre 4.1 protocol) */
-                if (strlen(row[2]) == 16)
-                {
-                    MXS_ERROR("%s: The user %s@%s has on old password in the "
-                              "backend database. MaxScale does not support these "
-                              "old passwords. This user will not be able to connect "
-                              "via MaxScale. Update the users password to correct "
-                              "this.",
-                              service->name,
-                              row[0],
-                              row[1]);
-                    continue;
-                }
+    for (server = service->dbref; server; server = server->next)
+    {
+        n_servers++;
+    }
 
-                if (strlen(row[2]) > 1)
-                {
-                    password = row[2] + 1;
-                }
-                else
-                {
-                    password = row[2];
-                }
-            }
+    if (n_servers == 0)
+    {
+        return 0;
+    }
 
-            /*
-             * add user@host and DB global priv and specificsa grant (if possible)
-             */
-            bool havedb = false;
+    SERVER_USERS *loads = MXS_CALLOC(n_servers, sizeof(SERVER_USERS));
+    THREAD *threads = MXS_CALLOC(n_servers, sizeof(THREAD));
+    bool *started = MXS_CALLOC(n_servers, sizeof(bool));
+    dpwd = decryptPassword(service_passwd);
+    final_data = (char*) MXS_CALLOC(1, sizeof(char));
 
-            if (db_grants)
-            {
-                /* we have dbgrants, store them */
-                if (row[5])
-                {
-                    unsigned long *rowlen = mysql_fetch_lengths(result);
-                    memcpy(dbnm, row[5], rowlen[5]);
-                    memset(dbnm + rowlen[5], 0, 1);
-                    havedb = true;
-                    if (service->strip_db_esc)
-                    {
-                        strip_escape_chars(dbnm);
-                        MXS_DEBUG("[%s]: %s -> %s",
-                                  service->name,
-                                  row[5],
-                                  dbnm);
-                    }
-                }
+    if (!loads || !threads || !started || !final_data)
+    {
+        goto cleanup;
+    }
 
-                rc = add_mysql_users_with_host_ipv4(users, row[0], row[1],
-                                                    password, row[4],
-                                                    havedb ? dbnm : NULL);
+    server = service->dbref;
 
-                MXS_DEBUG("%s: Adding user:%s host:%s anydb:%s db:%s.",
-                          service->name, row[0], row[1], row[4],
-                          havedb ? dbnm : NULL);
-            }
-            else
-            {
-                /* we don't have dbgrants, simply set ANY DB for the user */
-                rc = add_mysql_users_with_host_ipv4(users, row[0], row[1],
-                                                    password, "Y", NULL);
-            }
+    for (int i = 0; i < n_servers; i++, server = server->next)
+    {
+        loads[i].service = service;
+        loads[i].server = server->server;
+        loads[i].user = service_user;
+        loads[i].password = dpwd;
+
+        started[i] = thread_start(&threads[i], load_server_users_thread, &loads[i]) != NULL;
+
+        if (!started[i])
+        {
+            /** Load the users of this server in this thread */
+            load_server_users(&loads[i]);
+        }
+    }
 
-            if (rc == 1)
-            {
-                if (db_grants)
-                {
-                    char dbgrant[MYSQL_DATABASE_MAXLEN + 1] = "";
-                    if (row[4] != NULL)
-                    {
-                        if (strcmp(row[4], "Y") == 0)
-                        {
-                            strcpy(dbgrant, "ANY");
-                        }
-                        else if (row[5])
-                        {
-                            strncpy(dbgrant, row[5], MYSQL_DATABASE_MAXLEN);
-                            dbgrant[MYSQL_DATABASE_MAXLEN] = 0;
-                        }
-                    }
+    for (int i = 0; i < n_servers; i++)
+    {
+        if (started[i])
+        {
+            thread_wait(threads[i]);
+        }
+    }
 
-                    if (!strlen(dbgrant))
-                    {
-                        strcpy(dbgrant, "no db");
-                    }
+    users->resources = resource_alloc();
 
-                    /* Log the user being added with its db grants */
-                    MXS_INFO("%s: User %s@%s for database %s added to service user table.",
-                             service->name, row[0], row[1], dbgrant);
-                }
-                else
-                {
-                    /* Log the user being added (without db grants) */
-                    MXS_INFO("%s: User %s@%s added to service user table.",
-                             service->name, row[0], row[1]);
-                }
+    for (int i = 0; i < n_servers; i++)
+    {
+        MYSQL_ROW row;
 
-                /* Append data in the memory area for SHA1 digest */
-                strncat(users_data, row[3], users_data_row_len);
-                total_users++;
-            }
-            else
+        /* insert key and value "" */
+        while (loads[i].databases && (row = mysql_fetch_row(loads[i].databases)))
+        {
+            if (resource_add(users->resources, row[0], ""))
             {
-                /** Log errors and not the duplicate user */
-                if (service->log_auth_warnings && rc != -1)
-                {
-                    MXS_WARNING("Failed to add user %s@%s for service [%s]."
-                                " This user will be unavailable via MaxScale.",
-                                row[0], row[1], service->name);
-                }
+                MXS_DEBUG("%s: Adding database %s to the resouce hash.", service->name, row[0]);
             }
         }
+    }
 
-        mysql_free_result(result);
-        mysql_close(con);
+    for (int i = 0; i < n_servers; i++)
+    {
+        if (loads[i].users == NULL)
+        {
+            continue;
+        }
+
+        char *users_data = (char *) MXS_CALLOC(loads[i].nusers,
+                                               (users_data_row_len * sizeof(char)) + 1);
+
+        if (users_data == NULL)
+        {
+            goto cleanup;
+        }
+
+        total_users += add_server_users(&loads[i], users, users_data,
+                                        users_data_row_len, &anon_user);
 
         if ((tmp = MXS_REALLOC(final_data, (strlen(final_data) + strlen(users_data)
                                             + 1) * sizeof(char))) == NULL)
@@ -1181,15 +1406,15 @@ get_all_users(SERV_LISTENER *listener, USERS *users)
 
         strcat(final_data, users_data);
         MXS_FREE(users_data);
+        loaded = true;
+    }
 
-        if (service->users_from_all)
-        {
-            server = server->next;
-        }
-        else
-        {
-            server = NULL;
-        }
+    if (!loaded)
+    {
+        MXS_ERROR("Unable to get user data from backend database "
+                  "for service [%s]. Failed to load the users from any of the "
+                  "backend databases.", service->name);
+        goto cleanup;
     }
 
     /* compute SHA1 digest for users' data */
@@ -1204,6 +1429,17 @@ get_all_users(SERV_LISTENER *listener, USERS *users)
     }
 cleanup:
 
+    if (loads)
+    {
+        for (int i = 0; i < n_servers; i++)
+        {
+            server_users_free(&loads[i]);
+        }
+    }
+
+    MXS_FREE(loads);
+    MXS_FREE(threads);
+    MXS_FREE(started);
     MXS_FREE(dpwd);
     MXS_FREE(final_data);
 
@@ -1494,14 +1730,10 @@ get_users(SERV_LISTENER *listener, USERS *users)
     if (db_grants)
     {
         /* load all mysql database names */
-        dbnames = get_databases(listener, con);
+        dbnames = get_databases(listener, users, con);
         MXS_DEBUG("Loaded %d MySQL Database Names for service [%s]",
                   dbnames, service->name);
     }
-    else
-    {
-        listener->resources = NULL;
-    }
 
     while ((row = mysql_fetch_row(result)))
     {
@@ -1634,109 +1866,603 @@ get_users(SERV_LISTENER *listener, USERS *users)
         }
         else
         {
-            /** Log errors and not the duplicate user */
-            if (service->log_auth_warnings && rc != -1)
+            /** Log errors and not the duplicate user */
+            if (service->log_auth_warnings && rc != -1)
+            {
+                MXS_WARNING("Failed to add user %s@%s for"
+                            " service [%s]. This user will be unavailable"
+                            " via MaxScale.", row[0], row[1], service->name);
+            }
+        }
+    }
+
+    /* compute SHA1 digest for users' data */
+    SHA1((const unsigned char *) users_data, strlen(users_data), hash);
+
+    memcpy(users->cksum, hash, SHA_DIGEST_LENGTH);
+
+    /** Set the parameter if it is not configured by the user */
+    if (service->localhost_match_wildcard_host == SERVICE_PARAM_UNINIT)
+    {
+        service->localhost_match_wildcard_host = anon_user ? 0 : 1;
+    }
+
+    MXS_FREE(users_data);
+    mysql_free_result(result);
+    mysql_close(con);
+
+    return total_users;
+}
+
+/**
+ * Allocate a new MySQL users table for mysql specific users@host as key
+ *
+ *  @return The users table
+ */
+USERS *
+mysql_users_alloc()
+{
+    USERS *rval;
+
+    if ((rval = MXS_CALLOC(1, sizeof(USERS))) == NULL)
+    {
+        return NULL;
+    }
+
+    rval->refcount = 1;
+
+    if ((rval->data = hashtable_alloc(USERS_HASHTABLE_DEFAULT_SIZE, uh_hfun,
+                                      uh_cmpfun)) == NULL)
+    {
+        MXS_FREE(rval);
+        return NULL;
+    }
+
+    if ((rval->index = hashtable_alloc(MYSQL_USERS_INDEX_SIZE, hashtable_item_strhash,
+                                       hashtable_item_strcmp)) == NULL)
+    {
+        hashtable_free(rval->data);
+        MXS_FREE(rval);
+        return NULL;
+    }
+
+    hashtable_memory_fns(rval->index, hashtable_item_strdup, NULL,
+                         hashtable_item_free, mysql_user_grants_free);
+
+    /* set the MySQL user@host print routine for the debug interface */
+    rval->usersCustomUserFormat = mysql_format_user_entry;
+
+    /* the key is handled by uh_keydup/uh_keyfree.
+     * the value is a (char *): it's handled by strdup/free
+     */
+    hashtable_memory_fns(rval->data,
+                         (HASHCOPYFN) uh_keydup, hashtable_item_strdup,
+                         (HASHFREEFN) uh_keyfree, hashtable_item_free);
+
+    return rval;
+}
+
+/**
+ * Add a new MySQL user to the user table. The user name must be unique
+ *
+ * @param users     The users table
+ * @param user      The user name
+ * @param auth      The authentication data
+ * @return          The number of users added to the table
+ */
+int
+mysql_users_add(USERS *users, MYSQL_USER_HOST *key, char *auth)
+{
+    int add;
+
+    if (key == NULL || key->user == NULL)
+    {
+        return 0;
+    }
+
+    atomic_add(&users->stats.n_adds, 1);
+    add = hashtable_add(users->data, key, auth);
+    atomic_add(&users->stats.n_entries, add);
+
+    if (add)
+    {
+        mysql_users_index_add(users, key, auth);
+    }
+
+    return add;
+}
+
+/**
+ * Fetch the authentication data for a particular user from the users table
+ *
+ * @param users The MySQL users table
+ * @param key   The key with user@host
+ * @return  The authentication data or NULL on error
+ */
+char *mysql_users_fetch(USERS *users, MYSQL_USER_HOST *key)
+{
+    if (key == NULL)
+    {
+        return NULL;
+    }
+    atomic_add(&users->stats.n_fetches, 1);
+    return hashtable_fetch(users->data, key);
+}
+
+/**
+ * Add a grant to a list of grants unless the list already has a grant to
+ * the same database
+ *
+ * @param list     The list
+ * @param resource The database grant
+ * @param auth     The authentication data
+ */
+static void mysql_user_grant_add(MYSQL_USER_GRANT **list, const char *resource, const char *auth)
+{
+    for (; *list; list = &(*list)->next)
+    {
+        const char *granted = (*list)->resource;
+
+        if (granted == resource || (granted && resource && strcmp(granted, resource) == 0))
+        {
+            return;
+        }
+    }
+
+    MYSQL_USER_GRANT *grant = (MYSQL_USER_GRANT *) MXS_CALLOC(1, sizeof(MYSQL_USER_GRANT));
+    MXS_ABORT_IF_NULL(grant);
+
+    if (resource)
+    {
+        grant->resource = MXS_STRDUP_A(resource);
+    }
+    grant->password = MXS_STRDUP_A(auth ? auth : "");
+
+    *list = grant;
+}
+
+/**
+ * Find the first grant of a list that allows access to a database
+ *
+ * @param grant    The list of grants
+ * @param resource The requested database
+ * @return The grant or NULL if none of the grants allow the access
+ */
+static MYSQL_USER_GRANT *mysql_user_grant_find(MYSQL_USER_GRANT *grant, const char *resource)
+{
+    while (grant && !resource_matches(resource, grant->resource))
+    {
+        grant = grant->next;
+    }
+    return grant;
+}
+
+static void mysql_user_grant_free(MYSQL_USER_GRANT *grant)
+{
+    while (grant)
+    {
+        MYSQL_USER_GRANT *next = grant->next;
+        MXS_FREE(grant->resource);
+        MXS_FREE(grant->password);
+        MXS_FREE(grant);
+        grant = next;
+    }
+}
+
+static MYSQL_HOST_NODE *host_node_alloc(uint32_t prefix, int len)
+{
+    MYSQL_HOST_NODE *node = (MYSQL_HOST_NODE *) MXS_CALLOC(1, sizeof(MYSQL_HOST_NODE));
+    MXS_ABORT_IF_NULL(node);
+    node->prefix = prefix;
+    node->len = len;
+    return node;
+}
+
+static void host_node_free(MYSQL_HOST_NODE *node)
+{
+    if (node)
+    {
+        host_node_free(node->child[0]);
+        host_node_free(node->child[1]);
+        mysql_user_grant_free(node->grants);
+        MXS_FREE(node);
+    }
+}
+
+/**
+ * Find or insert the node of a network in a trie of networks
+ *
+ * Only networks with grants and the points where two networks diverge have
+ * a node, so the depth of the trie is bounded by the number of networks
+ * instead of the 32 bits of an address.
+ *
+ * @param slot   The root of the trie
+ * @param prefix The network address in host byte order
+ * @param len    Length of the network prefix in bits
+ * @return The node of the network
+ */
+static MYSQL_HOST_NODE *host_trie_insert(MYSQL_HOST_NODE **slot, uint32_t prefix, int len)
+{
+    prefix &= prefix_mask(len);
+
+    while (*slot)
+    {
+        MYSQL_HOST_NODE *node = *slot;
+        int max = MIN(node->len, len);
+        uint32_t diff = node->prefix ^ prefix;
+        int common = diff ? MIN(__builtin_clz(diff), max) : max;
+
+        if (common < node->len)
+        {
+            /** The network is not inside the network of the node, split the path */
+            MYSQL_HOST_NODE *parent = host_node_alloc(prefix & prefix_mask(common), common);
+            parent->child[prefix_bit(node->prefix, common)] = node;
+            *slot = parent;
+
+            if (common == len)
+            {
+                return parent;
+            }
+
+            MYSQL_HOST_NODE *leaf = host_node_alloc(prefix, len);
+            parent->child[prefix_bit(prefix, common)] = leaf;
+            return leaf;
+        }
+
+        if (node->len == len)
+        {
+            return node;
+        }
+
+        slot = &node->child[prefix_bit(prefix, node->len)];
+    }
+
+    *slot = host_node_alloc(prefix, len);
+    return *slot;
+}
+
+/**
+ * Find the grant of the longest network prefix that contains an address
+ *
+ * @param node     The root of the trie
+ * @param addr     The client address in host byte order
+ * @param resource The requested database
+ * @param len      Length of the prefix of the found grant
+ * @return The grant or NULL if no network with a matching grant contains the address
+ */
+static MYSQL_USER_GRANT *host_trie_find(MYSQL_HOST_NODE *node, uint32_t addr,
+                                        const char *resource, int *len)
+{
+    MYSQL_USER_GRANT *rval = NULL;
+
+    while (node && (addr & prefix_mask(node->len)) == node->prefix)
+    {
+        MYSQL_USER_GRANT *grant = mysql_user_grant_find(node->grants, resource);
+
+        if (grant)
+        {
+            rval = grant;
+            *len = node->len;
+        }
+
+        if (node->len == 32)
+        {
+            break;
+        }
+
+        node = node->child[prefix_bit(addr, node->len)];
+    }
+
+    return rval;
+}
+
+/**
+ * Find or add a host pattern in the patterns of a user. Patterns with a longer
+ * literal prefix are more specific and are kept first.
+ *
+ * @param list    The patterns of the user
+ * @param pattern The host pattern
+ * @return The host pattern
+ */
+static MYSQL_HOST_PATTERN *host_pattern_add(MYSQL_HOST_PATTERN **list, const char *pattern)
+{
+    size_t prefix_len = strcspn(pattern, "%_");
+
+    for (; *list && (*list)->prefix_len >= prefix_len; list = &(*list)->next)
+    {
+        if (strcmp((*list)->pattern, pattern) == 0)
+        {
+            return *list;
+        }
+    }
+
+    MYSQL_HOST_PATTERN *hp = (MYSQL_HOST_PATTERN *) MXS_CALLOC(1, sizeof(MYSQL_HOST_PATTERN));
+    MXS_ABORT_IF_NULL(hp);
+    hp->pattern = MXS_STRDUP_A(pattern);
+    hp->prefix_len = prefix_len;
+    hp->next = *list;
+    *list = hp;
+
+    return hp;
+}
+
+/**
+ * Find the grant of the most specific host pattern that matches a host
+ *
+ * @param hp       The patterns of the user
+ * @param host     The client address as a string
+ * @param resource The requested database
+ * @return The grant or NULL if no pattern with a matching grant matches
+ */
+static MYSQL_USER_GRANT *host_pattern_find(MYSQL_HOST_PATTERN *hp, const char *host,
+                                           const char *resource)
+{
+    for (; hp; hp = hp->next)
+    {
+        if (strncmp(host, hp->pattern, hp->prefix_len) == 0 &&
+            host_matches_pattern(host + hp->prefix_len, hp->pattern + hp->prefix_len))
+        {
+            MYSQL_USER_GRANT *grant = mysql_user_grant_find(hp->grants, resource);
+
+            if (grant)
             {
-                MXS_WARNING("Failed to add user %s@%s for"
-                            " service [%s]. This user will be unavailable"
-                            " via MaxScale.", row[0], row[1], service->name);
+                return grant;
             }
         }
     }
 
-    /* compute SHA1 digest for users' data */
-    SHA1((const unsigned char *) users_data, strlen(users_data), hash);
+    return NULL;
+}
 
-    memcpy(users->cksum, hash, SHA_DIGEST_LENGTH);
+/**
+ * Free the grants of a user, the value free function of the users index
+ *
+ * @param data The grants
+ */
+static void mysql_user_grants_free(void *data)
+{
+    MYSQL_USER_GRANTS *grants = (MYSQL_USER_GRANTS *) data;
 
-    /** Set the parameter if it is not configured by the user */
-    if (service->localhost_match_wildcard_host == SERVICE_PARAM_UNINIT)
+    if (grants)
     {
-        service->localhost_match_wildcard_host = anon_user ? 0 : 1;
-    }
+        host_node_free(grants->networks);
 
-    MXS_FREE(users_data);
-    mysql_free_result(result);
-    mysql_close(con);
+        while (grants->patterns)
+        {
+            MYSQL_HOST_PATTERN *next = grants->patterns->next;
+            mysql_user_grant_free(grants->patterns->grants);
+            MXS_FREE(grants->patterns->pattern);
+            MXS_FREE(grants->patterns);
+            grants->patterns = next;
+        }
 
-    return total_users;
+        MXS_FREE(grants);
+    }
 }
 
 /**
- * Allocate a new MySQL users table for mysql specific users@host as key
+ * Add a user@host entry to the index of the users table
  *
- *  @return The users table
+ * The index maps a user name to all of the hosts the user has grants from,
+ * so that mysql_users_find() resolves the most specific grant with a single
+ * walk instead of a hashtable lookup per network class.
+ *
+ * @param users The MySQL users table
+ * @param key   The user@host
+ * @param auth  The authentication data
  */
-USERS *
-mysql_users_alloc()
+static void mysql_users_index_add(USERS *users, const MYSQL_USER_HOST *key, const char *auth)
 {
-    USERS *rval;
+    if (users->index == NULL || key->netmask < 0 || key->netmask > 32)
+    {
+        return;
+    }
 
-    if ((rval = MXS_CALLOC(1, sizeof(USERS))) == NULL)
+    MYSQL_USER_GRANTS *grants = hashtable_fetch(users->index, key->user);
+
+    if (grants == NULL)
+    {
+        grants = (MYSQL_USER_GRANTS *) MXS_CALLOC(1, sizeof(MYSQL_USER_GRANTS));
+        MXS_ABORT_IF_NULL(grants);
+        hashtable_add(users->index, key->user, grants);
+    }
+
+    if (*key->hostname)
+    {
+        MYSQL_HOST_PATTERN *hp = host_pattern_add(&grants->patterns, key->hostname);
+        mysql_user_grant_add(&hp->grants, key->resource, auth);
+    }
+    else
+    {
+        MYSQL_HOST_NODE *node = host_trie_insert(&grants->networks,
+                                                 ntohl(key->ipv4.sin_addr.s_addr),
+                                                 key->netmask);
+        mysql_user_grant_add(&node->grants, key->resource, auth);
+    }
+}
+
+/**
+ * Find the authentication data of the most specific grant that matches a client
+ *
+ * The grants from the longest network prefix that contains the client address
+ * come first, then the host patterns, and the grants from any host (user@%)
+ * are used last.
+ *
+ * @param users          The MySQL users table
+ * @param key            The user, the client address and hostname and the requested database
+ * @param match_wildcard If false, only grants from the exact client address are used
+ * @return The authentication data or NULL if no grant matches
+ */
+char *mysql_users_find(USERS *users, MYSQL_USER_HOST *key, bool match_wildcard)
+{
+    if (key == NULL || key->user == NULL || users->index == NULL)
     {
         return NULL;
     }
 
-    if ((rval->data = hashtable_alloc(USERS_HASHTABLE_DEFAULT_SIZE, uh_hfun,
-                                      uh_cmpfun)) == NULL)
+    atomic_add(&users->stats.n_fetches, 1);
+
+    MYSQL_USER_GRANTS *grants = hashtable_fetch(users->index, key->user);
+
+    if (grants == NULL)
     {
-        MXS_FREE(rval);
         return NULL;
     }
 
-    /* set the MySQL user@host print routine for the debug interface */
-    rval->usersCustomUserFormat = mysql_format_user_entry;
+    int len = 0;
+    MYSQL_USER_GRANT *grant = host_trie_find(grants->networks, ntohl(key->ipv4.sin_addr.s_addr),
+                                             key->resource, &len);
 
-    /* the key is handled by uh_keydup/uh_keyfree.
-     * the value is a (char *): it's handled by strdup/free
-     */
-    hashtable_memory_fns(rval->data,
-                         (HASHCOPYFN) uh_keydup, hashtable_item_strdup,
-                         (HASHFREEFN) uh_keyfree, hashtable_item_free);
+    if (!match_wildcard)
+    {
+        return grant && len == 32 ? grant->password : NULL;
+    }
 
-    return rval;
+    if (grant == NULL || len == 0)
+    {
+        MYSQL_USER_GRANT *pattern_grant = host_pattern_find(grants->patterns, key->hostname,
+                                                            key->resource);
+        if (pattern_grant)
+        {
+            grant = pattern_grant;
+        }
+    }
+
+    return grant ? grant->password : NULL;
 }
 
 /**
- * Add a new MySQL user to the user table. The user name must be unique
+ * The cache entry of a user lookup
  *
- * @param users     The users table
- * @param user      The user name
- * @param auth      The authentication data
- * @return          The number of users added to the table
+ * @param cache The cache
+ * @param key   The user, the client address and the requested database
+ * @return The entry the lookup maps to
  */
-int
-mysql_users_add(USERS *users, MYSQL_USER_HOST *key, char *auth)
+static MYSQL_USERS_CACHE_ENTRY *mysql_users_cache_entry(MYSQL_USERS_CACHE *cache,
+                                                        const MYSQL_USER_HOST *key)
 {
-    int add;
+    /** FNV-1a over the user, the database and the address */
+    uint32_t hash = 2166136261u;
+    const char *db = key->resource ? key->resource : "";
+    in_addr_t addr = key->ipv4.sin_addr.s_addr;
 
-    if (key == NULL || key->user == NULL)
+    for (const char *p = key->user; *p; p++)
     {
-        return 0;
+        hash = (hash ^ (uint8_t) *p) * 16777619u;
     }
 
-    atomic_add(&users->stats.n_adds, 1);
-    add = hashtable_add(users->data, key, auth);
-    atomic_add(&users->stats.n_entries, add);
+    for (const char *p = db; *p; p++)
+    {
+        hash = (hash ^ (uint8_t) *p) * 16777619u;
+    }
 
-    return add;
+    for (int i = 0; i < 4; i++)
+    {
+        hash = (hash ^ ((addr >> (8 * i)) & 0xff)) * 16777619u;
+    }
+
+    return &cache->entries[hash % MYSQL_USERS_CACHE_SIZE];
 }
 
 /**
- * Fetch the authentication data for a particular user from the users table
+ * Fetch the result of a user lookup from the lookup cache of the users table
  *
- * @param users The MySQL users table
- * @param key   The key with user@host
- * @return  The authentication data or NULL on error
+ * @param users    The MySQL users table
+ * @param key      The user, the client address and the requested database
+ * @param password Where the SHA1(SHA1(password)) is copied if the user was
+ *                 found, may be NULL
+ * @return 1 if the user was found, 0 if the user was not found and -1 if the
+ *         lookup is not cached or has expired
  */
-char *mysql_users_fetch(USERS *users, MYSQL_USER_HOST *key)
+int mysql_users_cache_get(USERS *users, const MYSQL_USER_HOST *key, uint8_t *password)
 {
-    if (key == NULL)
+    MYSQL_USERS_CACHE *cache = (MYSQL_USERS_CACHE *) users->cache;
+    int rval = -1;
+
+    if (cache && key->user)
     {
-        return NULL;
+        MYSQL_USERS_CACHE_ENTRY *entry = mysql_users_cache_entry(cache, key);
+        const char *db = key->resource ? key->resource : "";
+
+        spinlock_acquire(&entry->lock);
+
+        if (entry->expires > time(NULL) &&
+            entry->addr == key->ipv4.sin_addr.s_addr &&
+            strcmp(entry->user, key->user) == 0 &&
+            strcmp(entry->db, db) == 0)
+        {
+            rval = entry->found ? 1 : 0;
+
+            if (entry->found && password)
+            {
+                memcpy(password, entry->password, SHA_DIGEST_LENGTH);
+            }
+        }
+
+        spinlock_release(&entry->lock);
     }
-    atomic_add(&users->stats.n_fetches, 1);
-    return hashtable_fetch(users->data, key);
+
+    return rval;
+}
+
+/**
+ * Store the result of a user lookup in the lookup cache of the users table
+ *
+ * The cache is allocated by the first call. As the cache is a part of the
+ * users table, the cached lookups are dropped when the table is replaced.
+ *
+ * @param users    The MySQL users table
+ * @param key      The user, the client address and the requested database
+ * @param password The SHA1(SHA1(password)) of the user or NULL if the user
+ *                 was not found
+ * @param ttl      How many seconds the result is used
+ */
+void mysql_users_cache_add(USERS *users, const MYSQL_USER_HOST *key,
+                           const uint8_t *password, int ttl)
+{
+    const char *db = key->resource ? key->resource : "";
+
+    if (key->user == NULL || strlen(key->user) > MYSQL_USER_MAXLEN ||
+        strlen(db) > MYSQL_DATABASE_MAXLEN)
+    {
+        return;
+    }
+
+    if (users->cache == NULL)
+    {
+        MYSQL_USERS_CACHE *cache = (MYSQL_USERS_CACHE *) MXS_CALLOC(1, sizeof(MYSQL_USERS_CACHE));
+
+        if (cache == NULL)
+        {
+            return;
+        }
+
+        for (int i = 0; i < MYSQL_USERS_CACHE_SIZE; i++)
+        {
+            spinlock_init(&cache->entries[i].lock);
+        }
+
+        if (!__sync_bool_compare_and_swap(&users->cache, NULL, cache))
+        {
+            /** Another thread allocated the cache first */
+            MXS_FREE(cache);
+        }
+    }
+
+    MYSQL_USERS_CACHE_ENTRY *entry = mysql_users_cache_entry(users->cache, key);
+
+    spinlock_acquire(&entry->lock);
+    entry->expires = time(NULL) + ttl;
+    entry->found = password != NULL;
+    entry->addr = key->ipv4.sin_addr.s_addr;
+    strcpy(entry->user, key->user);
+    strcpy(entry->db, db);
+
+    if (password)
+    {
+        memcpy(entry->password, password, SHA_DIGEST_LENGTH);
+    }
+    spinlock_release(&entry->lock);
 }
 
 /**
@@ -1799,73 +2525,74 @@ static int uh_cmpfun(const void* v1, const void* v2)
          (!wildcard_host && (hu1->ipv4.sin_addr.s_addr == hu2->ipv4.sin_addr.s_addr) &&
           (hu1->netmask >= hu2->netmask))))
     {
-        /* if no database name was passed, auth is ok */
-        if (hu1->resource == NULL || (hu1->resource && !strlen(hu1->resource)))
-        {
-            return 0;
-        }
-        else
-        {
-            /* (1) check for no database grants at all and deny auth */
-            if (hu2->resource == NULL)
-            {
-                return 1;
-            }
-            /* (2) check for ANY database grant and allow auth */
-            if (!strlen(hu2->resource))
-            {
-                return 0;
-            }
-            /* (3) check for database name specific grant and allow auth */
-            if (hu1->resource && hu2->resource && strcmp(hu1->resource,
-                                                         hu2->resource) == 0)
-            {
-                return 0;
-            }
-
-            if (hu2->resource && strlen(hu2->resource) && strchr(hu2->resource, '%') != NULL)
-            {
-                regex_t re;
-                char db[MYSQL_DATABASE_MAXLEN * 2 + 1];
-                strcpy(db, hu2->resource);
-                int len = strlen(db);
-                char* ptr = strrchr(db, '%');
+        return resource_matches(hu1->resource, hu2->resource) ? 0 : 1;
+    }
+    else
+    {
+        return 1;
+    }
+}
 
-                if (ptr == NULL)
-                {
-                    return 1;
-                }
+/**
+ * Check whether a database grant allows access to the requested database
+ *
+ * @param requested The database the client wants to use, NULL or empty for none
+ * @param granted   The database grant, NULL for no grants and empty for any database
+ * @return True if access to the requested database is allowed
+ */
+static bool resource_matches(const char *requested, const char *granted)
+{
+    /* if no database name was passed, auth is ok */
+    if (requested == NULL || *requested == '\0')
+    {
+        return true;
+    }
 
-                while (ptr)
-                {
-                    memmove(ptr + 1, ptr, (len - (ptr - db)) + 1);
-                    *ptr = '.';
-                    *(ptr + 1) = '*';
-                    len = strlen(db);
-                    ptr = strrchr(db, '%');
-                }
+    /* (1) check for no database grants at all and deny auth */
+    if (granted == NULL)
+    {
+        return false;
+    }
+    /* (2) check for ANY database grant and allow auth */
+    if (*granted == '\0')
+    {
+        return true;
+    }
+    /* (3) check for database name specific grant and allow auth */
+    if (strcmp(requested, granted) == 0)
+    {
+        return true;
+    }
 
-                if ((regcomp(&re, db, REG_ICASE | REG_NOSUB)))
-                {
-                    return 1;
-                }
+    if (strchr(granted, '%') != NULL)
+    {
+        regex_t re;
+        char db[MYSQL_DATABASE_MAXLEN * 2 + 1];
+        strcpy(db, granted);
+        int len = strlen(db);
+        char* ptr = strrchr(db, '%');
 
-                if (regexec(&re, hu1->resource, 0, NULL, 0) == 0)
-                {
-                    regfree(&re);
-                    return 0;
-                }
-                regfree(&re);
-            }
+        while (ptr)
+        {
+            memmove(ptr + 1, ptr, (len - (ptr - db)) + 1);
+            *ptr = '.';
+            *(ptr + 1) = '*';
+            len = strlen(db);
+            ptr = strrchr(db, '%');
+        }
 
-            /* no matches, deny auth */
-            return 1;
+        if ((regcomp(&re, db, REG_ICASE | REG_NOSUB)))
+        {
+            return false;
         }
+
+        bool rval = regexec(&re, requested, 0, NULL, 0) == 0;
+        regfree(&re);
+        return rval;
     }
-    else
-    {
-        return 1;
-    }
+
+    /* no matches, deny auth */
+    return false;
 }
 
 /**
@@ -1948,7 +2675,11 @@ static char *mysql_format_user_entry(void *data)
 
     /* format user@host based on wildcards */
 
-    if (entry->ipv4.sin_addr.s_addr == INADDR_ANY && entry->netmask == 0)
+    if (*entry->hostname)
+    {
+        snprintf(mysql_user, mysql_user_len - 1, "%s@%s", entry->user, entry->hostname);
+    }
+    else if (entry->ipv4.sin_addr.s_addr == INADDR_ANY && entry->netmask == 0)
     {
         snprintf(mysql_user, mysql_user_len - 1, "%s@%%", entry->user);
     }
@@ -1977,6 +2708,14 @@ static char *mysql_format_user_entry(void *data)
         inet_ntop(AF_INET, &(entry->ipv4).sin_addr, mysql_user + strlen(mysql_user),
                   INET_ADDRSTRLEN);
     }
+    else if (entry->netmask > 0 && entry->netmask < 32)
+    {
+        strcpy(mysql_user, entry->user);
+        strcat(mysql_user, "@");
+        inet_ntop(AF_INET, &(entry->ipv4).sin_addr, mysql_user + strlen(mysql_user),
+                  INET_ADDRSTRLEN);
+        sprintf(mysql_user + strlen(mysql_user), "/%d", entry->netmask);
+    }
     else
     {
         snprintf(mysql_user, MYSQL_USER_MAXLEN - 5, "Err: %s", entry->user);
@@ -1988,20 +2727,6 @@ static char *mysql_format_user_entry(void *data)
     return mysql_user;
 }
 
-/**
- * Remove the resources table
- *
- * @param resources The resources table to remove
- */
-static void
-resource_free(HASHTABLE *resources)
-{
-    if (resources)
-    {
-        hashtable_free(resources);
-    }
-}
-
 /**
  * Allocate a MySQL database names table
  *
@@ -2143,6 +2868,49 @@ static int normalize_hostname(const char *input_host, char *output_host)
     return netmask;
 }
 
+/**
+ * Parse a network address with a netmask, a.b.c.d/m.m.m.m, to the network
+ * address string.
+ *
+ * @param host          The address and the netmask
+ * @param output_host   The network address (buffer must be preallocated)
+ * @return              The length of the netmask or -1 if the address or the
+ *                      netmask is invalid
+ */
+static int parse_host_netmask(const char *host, char *output_host)
+{
+    char addr[MYSQL_HOST_MAXLEN + 1];
+    const char *mask = strchr(host, '/');
+    struct in_addr ip;
+    struct in_addr netmask;
+
+    if (mask == NULL || mask - host > MYSQL_HOST_MAXLEN)
+    {
+        return -1;
+    }
+
+    memcpy(addr, host, mask - host);
+    addr[mask - host] = '\0';
+
+    if (inet_pton(AF_INET, addr, &ip) != 1 || inet_pton(AF_INET, mask + 1, &netmask) != 1)
+    {
+        return -1;
+    }
+
+    uint32_t hostbits = ~ntohl(netmask.s_addr);
+
+    /** The netmask must be contiguous, i.e. the host bits must be 0...01...1 */
+    if (hostbits & (hostbits + 1))
+    {
+        return -1;
+    }
+
+    ip.s_addr &= netmask.s_addr;
+    inet_ntop(AF_INET, &ip, output_host, INET_ADDRSTRLEN);
+
+    return 32 - __builtin_popcount(hostbits);
+}
+
 /**
  * Returns a MYSQL object suitably configured.
  *
@@ -2434,7 +3202,39 @@ dbusers_save(USERS *users, const char *filename)
 int
 dbusers_load(USERS *users, const char *filename)
 {
-    return hashtable_load(users->data, filename, dbusers_keyread, dbusers_valueread);
+    int rval = hashtable_load(users->data, filename, dbusers_keyread, dbusers_valueread);
+
+    if (rval > 0 && users->index)
+    {
+        /** The loaded entries were added directly to the hashtable, index them.
+         * Entries that were already in the table are indexed only once. */
+        HASHITERATOR *iter = hashtable_iterator(users->data);
+        MYSQL_USER_HOST *key;
+
+        MXS_ABORT_IF_NULL(iter);
+
+        while ((key = hashtable_next(iter)))
+        {
+            mysql_users_index_add(users, key, hashtable_fetch(users->data, key));
+        }
+
+        hashtable_iterator_free(iter);
+    }
+
+    if (rval > 0 && users->cache)
+    {
+        /** The table changed, drop the cached lookups */
+        MYSQL_USERS_CACHE *cache = (MYSQL_USERS_CACHE *) users->cache;
+
+        for (int i = 0; i < MYSQL_USERS_CACHE_SIZE; i++)
+        {
+            spinlock_acquire(&cache->entries[i].lock);
+            cache->entries[i].expires = 0;
+            spinlock_release(&cache->entries[i].lock);
+        }
+    }
+
+    return rval;
 }
 
 /**
@@ -90,8 +90,24 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <platform.h>
 #include <maxscale/alloc.h>
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/**
+ * Maximum number of bytes in an SSL record. Small buffers are batched into
+ * records of this size so that each SSL_write produces one full record.
+ */
+#define DCB_SSL_BATCH_SIZE 16384
+
+/** The buffer used for batching small buffers into one SSL_write call */
+static thread_local unsigned char *ssl_batch = NULL;
+
 /* The list of all DCBs */
 static LIST_CONFIG DCBlist =
 {LIST_TYPE_RECYCLABLE, sizeof(DCB), SPINLOCK_INIT};
@@ -99,10 +115,44 @@ static LIST_CONFIG DCBlist =
 /* A DCB with null values, used for initialization */
 static DCB dcb_initialized = DCB_INIT;
 
-static  DCB             *zombies = NULL;
+/**
+ * A list of zombie DCBs, ordered by the epoch at which they can be freed.
+ *
+ * Each polling thread adds the DCBs it closes to its own list and is the only
+ * thread that processes it, so the lists of the polling threads need no
+ * locking. DCBs closed by other threads are placed on a shared list that is
+ * protected by a spinlock and processed by all polling threads.
+ */
+typedef struct
+{
+    SPINLOCK lock;   /*< Lock for the shared list */
+    DCB      *head;  /*< The oldest zombie */
+    DCB      *tail;  /*< The newest zombie */
+} ZOMBIE_LIST;
+
+/** Index of the shared zombie list */
+#define ZOMBIE_LIST_SHARED MXS_MAX_THREADS
+
+static ZOMBIE_LIST zombie_lists[MXS_MAX_THREADS + 1];
+
+/** The zombie list of the calling thread */
+static thread_local ZOMBIE_LIST *thread_zombies = NULL;
+
+/** The global epoch counter, incremented for each new zombie */
+static long zombie_epoch = 1;
+
+/**
+ * The latest epoch seen by each polling thread at a point where it holds no
+ * references to DCBs. Zero for threads that have not yet started polling.
+ */
+static long thread_epochs[MXS_MAX_THREADS];
+
+/** One more than the largest thread ID that has published an epoch */
+static int n_epoch_threads = 0;
+
 static  int             nzombies = 0;
 static  int             maxzombies = 0;
-static  SPINLOCK        zombiespin = SPINLOCK_INIT;
+static  int             nreclaimed = 0;
 
 static void dcb_initialize(void *dcb);
 static void dcb_final_free(DCB *dcb);
@@ -127,6 +177,7 @@ static void dcb_log_write_failure(DCB *dcb, GWBUF *queue, int eno);
 static inline void dcb_write_tidy_up(DCB *dcb, bool below_water);
 static int gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing);
 static int gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing);
+static void dcb_add_write_stats(DCB *dcb, GWBUF *writeq, int written);
 static int dcb_log_errors_SSL (DCB *dcb, const char *called_by, int ret);
 static int dcb_accept_one_connection(DCB *listener, struct sockaddr *client_conn);
 static int dcb_listen_create_socket_inet(const char *config_bind);
@@ -169,14 +220,15 @@ bool dcb_get_ses_log_info(
 }
 
 /**
- * Return the pointer to the list of zombie DCB's
+ * Return the newest zombie DCB added by the calling thread
  *
- * @return Zombies DCB list
+ * @return The newest zombie DCB of the zombie list of the calling thread
  */
 DCB *
 dcb_get_zombies(void)
 {
-    return zombies;
+    ZOMBIE_LIST *list = thread_zombies ? thread_zombies : &zombie_lists[ZOMBIE_LIST_SHARED];
+    return list->tail;
 }
 
 /*
@@ -198,8 +250,8 @@ dcb_pre_alloc(int number)
  * function can be called by the generic list manager, which does not know
  * the actual type of the list entries it handles.
  *
- * Most fields can be initialized by the assignment of the static
- * initialized DCB. The exception is the bitmask.
+ * All fields can be initialized by the assignment of the static
+ * initialized DCB.
  *
  * @param *dcb    Pointer to the DCB to be initialized
  */
@@ -207,7 +259,6 @@ static void
 dcb_initialize(void *dcb)
 {
     *(DCB *)dcb = dcb_initialized;
-    bitmask_init(&((DCB *)dcb)->memdata.bitmask);
 }
 
 /**
@@ -429,7 +480,6 @@ dcb_free_all_memory(DCB *dcb)
     {
         SSL_free(dcb->ssl);
     }
-    bitmask_free(&dcb->memdata.bitmask);
 
     /* We never free the actual DCB, it is available for reuse*/
     list_free_entry(&DCBlist, (list_entry_t *)dcb);
@@ -437,120 +487,203 @@ dcb_free_all_memory(DCB *dcb)
 }
 
 /**
- * Process the DCB zombie queue
+ * Add a DCB to the zombie list of the calling thread
  *
- * This routine is called by each of the polling threads with
- * the thread id of the polling thread. It must clear the bit in
- * the memdata bitmask for the polling thread that calls it. If the
- * operation of clearing this bit means that no bits are set in
- * the memdata.bitmask then the DCB is no longer able to be
- * referenced and it can be finally removed.
+ * The DCB is stamped with a new value of the global epoch counter. The stamps
+ * of the DCBs on a list are thus in increasing order.
  *
- * @param       threadid        The thread ID of the caller
+ * @param dcb           The DCB to add
+ * @param wait_threads  If false, the DCB can be freed at once when the list is
+ *                      next processed, otherwise only after every polling
+ *                      thread has passed the end of its polling loop
  */
-DCB *
-dcb_process_zombies(int threadid)
+static void
+dcb_add_to_zombies(DCB *dcb, bool wait_threads)
 {
-    DCB *zombiedcb;
-    DCB *previousdcb = NULL, *nextdcb;
-    DCB *listofdcb = NULL;
+    ZOMBIE_LIST *list = thread_zombies;
+    bool shared = (list == NULL);
 
-    /**
-     * Perform a dirty read to see if there is anything in the queue.
-     * This avoids threads hitting the queue spinlock when the queue
-     * is empty. This will really help when the only entry is being
-     * freed, since the queue is updated before the expensive call to
-     * dcb_final_free.
-     */
-    if (!zombies)
+    if (shared)
     {
-        return NULL;
+        list = &zombie_lists[ZOMBIE_LIST_SHARED];
+        spinlock_acquire(&list->lock);
     }
 
-    /*
-     * Process the zombie queue and create a list of DCB's that can be
-     * finally freed. This processing is down under a spinlock that
-     * will prevent new entries being added to the zombie queue. Therefore
-     * we do not want to do any expensive operations under this spinlock
-     * as it will block other threads. The expensive operations will be
-     * performed on the victim queue within holding the zombie queue
-     * spinlock.
-     */
-    spinlock_acquire(&zombiespin);
-    zombiedcb = zombies;
-    while (zombiedcb)
+    dcb->memdata.epoch = wait_threads ? __sync_add_and_fetch(&zombie_epoch, 1) : 0;
+    dcb->memdata.next = NULL;
+
+    if (list->tail)
+    {
+        list->tail->memdata.next = dcb;
+    }
+    else
+    {
+        list->head = dcb;
+    }
+    list->tail = dcb;
+
+    if (shared)
+    {
+        spinlock_release(&list->lock);
+    }
+
+    int n = atomic_add(&nzombies, 1) + 1;
+    if (n > maxzombies)
+    {
+        maxzombies = n;
+    }
+}
+
+/**
+ * Publish a quiescent state of a polling thread and return the epoch up to
+ * which zombies can be freed.
+ *
+ * @param threadid      The ID of the calling thread
+ * @return The smallest epoch published by the running polling threads
+ */
+static long
+dcb_publish_epoch(int threadid)
+{
+    /** All references to DCBs held by this thread are gone */
+    __sync_synchronize();
+    thread_epochs[threadid] = zombie_epoch;
+
+    while (n_epoch_threads <= threadid)
+    {
+        __sync_bool_compare_and_swap(&n_epoch_threads, n_epoch_threads, threadid + 1);
+    }
+
+    __sync_synchronize();
+    long safe_epoch = thread_epochs[threadid];
+
+    for (int i = 0; i < n_epoch_threads; i++)
+    {
+        long epoch = thread_epochs[i];
+
+        if (epoch && epoch < safe_epoch)
+        {
+            safe_epoch = epoch;
+        }
+    }
+
+    return safe_epoch;
+}
+
+/**
+ * Move the zombies that can be freed from a zombie list to a list of victims
+ *
+ * As the list is ordered by the epoch, only the head of the list needs to be
+ * checked. DCBs that are still in the event queue are moved to the end of the
+ * list with a new epoch.
+ *
+ * @param list          The zombie list
+ * @param safe_epoch    The epoch up to which zombies can be freed
+ * @param victims       The list of victims to add the DCBs to
+ * @return The new head of the list of victims
+ */
+static DCB *
+dcb_reclaim_zombies(ZOMBIE_LIST *list, long safe_epoch, DCB *victims)
+{
+    DCB *zombiedcb;
+
+    while ((zombiedcb = list->head) && zombiedcb->memdata.epoch <= safe_epoch)
     {
         CHK_DCB(zombiedcb);
-        nextdcb = zombiedcb->memdata.next;
+        list->head = zombiedcb->memdata.next;
+
+        if (list->head == NULL)
+        {
+            list->tail = NULL;
+        }
+
         /*
          * Skip processing of DCB's that are
          * in the event queue waiting to be processed.
          */
         if (zombiedcb->evq.next || zombiedcb->evq.prev)
         {
-            previousdcb = zombiedcb;
-        }
-        else
-        {
+            zombiedcb->memdata.epoch = __sync_add_and_fetch(&zombie_epoch, 1);
+            zombiedcb->memdata.next = NULL;
 
-            if (bitmask_clear_without_spinlock(&zombiedcb->memdata.bitmask, threadid))
+            if (list->tail)
             {
-                /**
-                 * Remove the DCB from the zombie queue
-                 * and call the final free routine for the
-                 * DCB
-                 *
-                 * zombiedcb is the DCB we are processing
-                 * previousdcb is the previous DCB on the zombie
-                 * queue or NULL if the DCB is at the head of the
-                 * queue.  Remove zombiedcb from the zombies list.
-                 */
-                if (NULL == previousdcb)
-                {
-                    zombies = zombiedcb->memdata.next;
-                }
-                else
-                {
-                    previousdcb->memdata.next = zombiedcb->memdata.next;
-                }
-
-                MXS_DEBUG("%lu [%s] Remove dcb "
-                          "%p fd %d in state %s from the "
-                          "list of zombies.",
-                          pthread_self(),
-                          __func__,
-                          zombiedcb,
-                          zombiedcb->fd,
-                          STRDCBSTATE(zombiedcb->state));
-                /*<
-                 * Move zombie dcb to linked list of victim dcbs.
-                 * The variable dcb is used to hold the last DCB
-                 * to have been added to the linked list, or NULL
-                 * if none has yet been added.  If the list
-                 * (listofdcb) is not NULL, then it follows that
-                 * dcb will also not be null.
-                 */
-                nzombies--;
-                zombiedcb->memdata.next = listofdcb;
-                listofdcb = zombiedcb;
+                list->tail->memdata.next = zombiedcb;
             }
             else
             {
-                /* Since we didn't remove this dcb from the zombies
-                   list, we need to advance the previous pointer */
-                previousdcb = zombiedcb;
+                list->head = zombiedcb;
             }
+            list->tail = zombiedcb;
+            continue;
         }
-        zombiedcb = nextdcb;
+
+        MXS_DEBUG("%lu [%s] Remove dcb "
+                  "%p fd %d in state %s from the "
+                  "list of zombies.",
+                  pthread_self(),
+                  __func__,
+                  zombiedcb,
+                  zombiedcb->fd,
+                  STRDCBSTATE(zombiedcb->state));
+
+        atomic_add(&nzombies, -1);
+        atomic_add(&nreclaimed, 1);
+        zombiedcb->memdata.next = victims;
+        victims = zombiedcb;
+    }
+
+    return victims;
+}
+
+/**
+ * Process the DCB zombie queue
+ *
+ * This routine is called by each of the polling threads with
+ * the thread id of the polling thread at a point where the thread
+ * holds no references to DCBs. The thread publishes the current
+ * epoch and frees the zombies on its own list, and on the shared
+ * list, whose epoch has been passed by all polling threads.
+ *
+ * @param       threadid        The thread ID of the caller
+ */
+DCB *
+dcb_process_zombies(int threadid)
+{
+    ZOMBIE_LIST *shared = &zombie_lists[ZOMBIE_LIST_SHARED];
+    DCB *listofdcb = NULL;
+    long safe_epoch;
+
+    ss_dassert(threadid >= 0 && threadid < MXS_MAX_THREADS);
+
+    if (thread_zombies == NULL)
+    {
+        thread_zombies = &zombie_lists[threadid];
+    }
+
+    safe_epoch = dcb_publish_epoch(threadid);
+
+    /**
+     * Perform a dirty read to see if there is anything in the lists.
+     * This avoids threads hitting the shared list spinlock when the
+     * list is empty.
+     */
+    if (thread_zombies->head)
+    {
+        listofdcb = dcb_reclaim_zombies(thread_zombies, safe_epoch, listofdcb);
+    }
+
+    if (shared->head && spinlock_acquire_nowait(&shared->lock))
+    {
+        listofdcb = dcb_reclaim_zombies(shared, safe_epoch, listofdcb);
+        spinlock_release(&shared->lock);
     }
-    spinlock_release(&zombiespin);
 
     if (listofdcb)
     {
         dcb_process_victim_queue(listofdcb);
     }
 
-    return zombies;
+    return thread_zombies->head;
 }
 
 /**
@@ -600,17 +733,8 @@ dcb_process_victim_queue(DCB *listofdcb)
                 {
                     DCB *next2dcb;
                     dcb_stop_polling_and_shutdown(dcb);
-                    spinlock_acquire(&zombiespin);
-                    bitmask_copy(&dcb->memdata.bitmask, poll_bitmask());
                     next2dcb = dcb->memdata.next;
-                    dcb->memdata.next = zombies;
-                    zombies = dcb;
-                    nzombies++;
-                    if (nzombies > maxzombies)
-                    {
-                        maxzombies = nzombies;
-                    }
-                    spinlock_release(&zombiespin);
+                    dcb_add_to_zombies(dcb, true);
                     dcb = next2dcb;
                     continue;
                 }
@@ -1723,8 +1847,7 @@ dcb_close(DCB *dcb)
         return;
     }
 
-    spinlock_acquire(&zombiespin);
-    if (!dcb->dcb_is_zombie)
+    if (__sync_bool_compare_and_swap(&dcb->dcb_is_zombie, false, true))
     {
         if (DCB_ROLE_BACKEND_HANDLER == dcb->dcb_role && 0 == dcb->persistentstart
             && dcb->server && DCB_STATE_POLLING == dcb->state)
@@ -1738,25 +1861,13 @@ dcb_close(DCB *dcb)
             }
         }
         /*<
-         * Add closing dcb to the top of the list, setting zombie marker
+         * Add closing dcb to the end of the zombie list. Backend DCBs
+         * are only freed once all polling threads have passed the end
+         * of their polling loop, so as to protect the DCB from premature
+         * destruction.
          */
-        dcb->dcb_is_zombie = true;
-        dcb->memdata.next = zombies;
-        zombies = dcb;
-        nzombies++;
-        if (nzombies > maxzombies)
-        {
-            maxzombies = nzombies;
-        }
-        /*< Set bit for each maxscale thread. This should be done before
-         * the state is changed, so as to protect the DCB from premature
-         * destruction. */
-        if (dcb->server)
-        {
-            bitmask_copy(&dcb->memdata.bitmask, poll_bitmask());
-        }
+        dcb_add_to_zombies(dcb, dcb->server != NULL);
     }
-    spinlock_release(&zombiespin);
 }
 
 /**
@@ -1874,6 +1985,8 @@ printDCB(DCB *dcb)
            dcb->stats.n_reads);
     printf("\t\tNo. of Writes:                      %d\n",
            dcb->stats.n_writes);
+    printf("\t\tNo. of Buffers Written:             %d\n",
+           dcb->stats.n_buffers_written);
     printf("\t\tNo. of Buffered Writes:             %d\n",
            dcb->stats.n_buffered);
     printf("\t\tNo. of Accepts:                     %d\n",
@@ -1980,18 +2093,19 @@ dprintOneDCB(DCB *pdcb, DCB *dcb)
         dcb_printf(pdcb, "\tRole:                     %s\n", rolename);
         MXS_FREE(rolename);
     }
-    if (!bitmask_isallclear(&dcb->memdata.bitmask))
+    if (dcb->dcb_is_zombie)
     {
-        char *bitmasktext = bitmask_render_readable(&dcb->memdata.bitmask);
-        if (bitmasktext)
-        {
-            dcb_printf(pdcb, "\tBitMask:                %s\n", bitmasktext);
-            MXS_FREE(bitmasktext);
-        }
+        dcb_printf(pdcb, "\tZombie Epoch:           %ld\n", dcb->memdata.epoch);
     }
     dcb_printf(pdcb, "\tStatistics:\n");
     dcb_printf(pdcb, "\t\tNo. of Reads:             %d\n", dcb->stats.n_reads);
     dcb_printf(pdcb, "\t\tNo. of Writes:            %d\n", dcb->stats.n_writes);
+    dcb_printf(pdcb, "\t\tNo. of Buffers Written:   %d\n", dcb->stats.n_buffers_written);
+    if (dcb->stats.n_buffers_written > 0)
+    {
+        dcb_printf(pdcb, "\t\tWrites per Buffer:        %.3f\n",
+                   (double)dcb->stats.n_writes / dcb->stats.n_buffers_written);
+    }
     dcb_printf(pdcb, "\t\tNo. of Buffered Writes:   %d\n", dcb->stats.n_buffered);
     dcb_printf(pdcb, "\t\tNo. of Accepts:           %d\n", dcb->stats.n_accepts);
     dcb_printf(pdcb, "\t\tNo. of High Water Events: %d\n", dcb->stats.n_high_water);
@@ -2019,6 +2133,12 @@ void
 dprintDCBList(DCB *pdcb)
 {
     dprintListStats(pdcb, &DCBlist, "All DCBs");
+    dcb_printf(pdcb, "\nZombie DCBs\n");
+    dcb_printf(pdcb, "-----------\n");
+    dcb_printf(pdcb, "Current zombies:              %d\n", nzombies);
+    dcb_printf(pdcb, "Maximum zombies at once:      %d\n", maxzombies);
+    dcb_printf(pdcb, "Zombies reclaimed:            %d\n", nreclaimed);
+    dcb_printf(pdcb, "Current epoch:                %ld\n", zombie_epoch);
 }
 
 /**
@@ -2036,7 +2156,7 @@ dprintAllDCBs(DCB *pdcb)
     dcb_printf(pdcb, "DCB List Spinlock Statistics:\n");
     spinlock_stats(&DCBlist->list_lock, spin_reporter, pdcb);
     dcb_printf(pdcb, "Zombie Queue Lock Statistics:\n");
-    spinlock_stats(&zombiespin, spin_reporter, pdcb);
+    spinlock_stats(&zombie_lists[ZOMBIE_LIST_SHARED].lock, spin_reporter, pdcb);
 #endif
     while (current)
     {
@@ -2165,6 +2285,13 @@ dprintDCB(DCB *pdcb, DCB *dcb)
                dcb->stats.n_reads);
     dcb_printf(pdcb, "\t\tNo. of Writes:                    %d\n",
                dcb->stats.n_writes);
+    dcb_printf(pdcb, "\t\tNo. of Buffers Written:           %d\n",
+               dcb->stats.n_buffers_written);
+    if (dcb->stats.n_buffers_written > 0)
+    {
+        dcb_printf(pdcb, "\t\tWrites per Buffer:                %.3f\n",
+                   (double)dcb->stats.n_writes / dcb->stats.n_buffers_written);
+    }
     dcb_printf(pdcb, "\t\tNo. of Buffered Writes:           %d\n",
                dcb->stats.n_buffered);
     dcb_printf(pdcb, "\t\tNo. of Accepts:                   %d\n",
@@ -2299,6 +2426,11 @@ void dcb_hashtable_stats(
  * linked from the DCB. All communication is encrypted and done via the SSL
  * structure. Data is written from the DCB write queue.
  *
+ * If the first buffer in the write queue is smaller than an SSL record, the
+ * following buffers are copied after it so that one SSL_write call sends up
+ * to a full record. As the write queue is only ever appended to, a write that
+ * has to be retried is always rebuilt with the same data at its start.
+ *
  * @param dcb           The DCB having an SSL connection
  * @param writeq        A buffer list containing the data to be written
  * @param stop_writing  Set to true if the caller should stop writing, false otherwise
@@ -2308,8 +2440,25 @@ static int
 gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 {
     int written;
+    void *buf = GWBUF_DATA(writeq);
+    int nbytes = GWBUF_LENGTH(writeq);
 
-    written = SSL_write(dcb->ssl, GWBUF_DATA(writeq), GWBUF_LENGTH(writeq));
+    if (writeq->next && nbytes < DCB_SSL_BATCH_SIZE)
+    {
+        if (ssl_batch == NULL)
+        {
+            ssl_batch = (unsigned char *)MXS_MALLOC(DCB_SSL_BATCH_SIZE);
+        }
+
+        if (ssl_batch)
+        {
+            nbytes = gwbuf_copy_data(writeq, 0, DCB_SSL_BATCH_SIZE, ssl_batch);
+            buf = ssl_batch;
+        }
+    }
+
+    written = SSL_write(dcb->ssl, buf, nbytes);
+    dcb_add_write_stats(dcb, writeq, written);
 
     *stop_writing = false;
     switch ((SSL_get_error(dcb->ssl, written)))
@@ -2364,6 +2513,10 @@ gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 /**
  * Write data to a DCB. The data is taken from the DCB's write queue.
  *
+ * Up to IOV_MAX buffers of the write queue are written with one writev call.
+ * If only a part of the data is written, the caller consumes the written
+ * bytes from the write queue and calls this function again.
+ *
  * @param dcb           The DCB to write buffer
  * @param writeq        A buffer list containing the data to be written
  * @param stop_writing  Set to true if the caller should stop writing, false otherwise
@@ -2374,17 +2527,24 @@ gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 {
     int written = 0;
     int fd = dcb->fd;
-    size_t nbytes = GWBUF_LENGTH(writeq);
-    void *buf = GWBUF_DATA(writeq);
+    struct iovec iov[IOV_MAX];
+    int iovcnt = 0;
     int saved_errno;
 
+    for (GWBUF *ptr = writeq; ptr && iovcnt < IOV_MAX; ptr = ptr->next)
+    {
+        iov[iovcnt].iov_base = GWBUF_DATA(ptr);
+        iov[iovcnt].iov_len = GWBUF_LENGTH(ptr);
+        iovcnt++;
+    }
+
     errno = 0;
 
 #if defined(FAKE_CODE)
     if (fd > 0 && dcb_fake_write_errno[fd] != 0)
     {
         ss_dassert(dcb_fake_write_ev[fd] != 0);
-        written = write(fd, buf, nbytes / 2); /*< leave peer to read missing bytes */
+        written = write(fd, iov[0].iov_base, iov[0].iov_len / 2); /*< leave peer to read missing bytes */
 
         if (written > 0)
         {
@@ -2394,19 +2554,25 @@ gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing)
     }
     else if (fd > 0)
     {
-        written = write(fd, buf, nbytes);
+        written = writev(fd, iov, iovcnt);
     }
 #else
     if (fd > 0)
     {
-        written = write(fd, buf, nbytes);
+        written = writev(fd, iov, iovcnt);
     }
 #endif /* FAKE_CODE */
 
+    if (fd > 0)
+    {
+        dcb_add_write_stats(dcb, writeq, written);
+    }
+
 #if defined(SS_DEBUG_MYSQL)
     {
         size_t   len;
-        uint8_t* packet = (uint8_t *)buf;
+        size_t   nbytes = iov[0].iov_len;
+        uint8_t* packet = (uint8_t *)iov[0].iov_base;
         char*    str;
 
         /** Print only MySQL packets */
@@ -2485,6 +2651,25 @@ gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing)
     return written > 0 ? written : 0;
 }
 
+/**
+ * Update the write statistics of a DCB after a write system call
+ *
+ * @param dcb           The DCB that was written to
+ * @param writeq        The write queue the data was taken from
+ * @param written       The return value of the write call
+ */
+static void
+dcb_add_write_stats(DCB *dcb, GWBUF *writeq, int written)
+{
+    dcb->stats.n_writes++;
+
+    for (GWBUF *ptr = writeq; ptr && written > 0 && GWBUF_LENGTH(ptr) <= written; ptr = ptr->next)
+    {
+        written -= GWBUF_LENGTH(ptr);
+        dcb->stats.n_buffers_written++;
+    }
+}
+
 /**
  * Add a callback
  *
@@ -2911,6 +3096,12 @@ dcb_create_SSL(DCB* dcb, SSL_LISTENER *ssl)
         return -1;
     }
 
+    /**
+     * A write that must be retried is rebuilt from the write queue, possibly
+     * by another thread, so the buffer passed to SSL_write can move.
+     */
+    SSL_set_mode(dcb->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
     return 0;
 }
 
@@ -32,6 +32,7 @@
 #include <spinlock.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
+#include <resultset.h>
 #include <maxscale/alloc.h>
 
 static SPINLOCK filter_spin = SPINLOCK_INIT;    /**< Protects the list of all filters */
@@ -242,6 +243,39 @@ dprintFilter(DCB *dcb, FILTER_DEF *filter)
     }
 }
 
+/**
+ * Get the statistics of a filter as a result set
+ *
+ * @param filter The filter
+ * @return The result set or NULL if the filter has no statistics
+ */
+RESULTSET *
+filterGetStatistics(FILTER_DEF *filter)
+{
+    if (filter->obj && filter->filter && filter->obj->statistics)
+    {
+        return filter->obj->statistics(filter->filter);
+    }
+    return NULL;
+}
+
+/**
+ * Clear the statistics of a filter
+ *
+ * @param filter The filter
+ * @return True if the filter has statistics that were cleared
+ */
+bool
+filterResetStatistics(FILTER_DEF *filter)
+{
+    if (filter->obj && filter->filter && filter->obj->resetStatistics)
+    {
+        filter->obj->resetStatistics(filter->filter);
+        return true;
+    }
+    return false;
+}
+
 /**
  * List all filters in a tabular form to a DCB
  *
@@ -36,6 +36,7 @@
 #include <log_manager.h>
 #include <maxscale/alloc.h>
 #include <users.h>
+#include <atomic.h>
 
 static RSA *rsa_512 = NULL;
 static RSA *rsa_1024 = NULL;
@@ -96,9 +97,11 @@ listener_alloc(struct service* service, char* name, char *protocol, char *addres
     proto->authenticator = authenticator;
     proto->ssl = ssl;
     proto->users = NULL;
-    proto->resources = NULL;
+    memset(&proto->auth_stats, 0, sizeof(proto->auth_stats));
+    memset(&proto->load_stats, 0, sizeof(proto->load_stats));
     proto->next = NULL;
     spinlock_init(&proto->lock);
+    spinlock_init(&proto->users_lock);
 
     return proto;
 }
@@ -112,14 +115,7 @@ void listener_free(SERV_LISTENER* listener)
 {
     if (listener)
     {
-        if (listener->resources)
-        {
-            hashtable_free(listener->resources);
-        }
-        if (listener->users)
-        {
-            users_free(listener->users);
-        }
+        listener_users_put(listener->users);
 
         MXS_FREE(listener->address);
         MXS_FREE(listener->authenticator);
@@ -128,6 +124,62 @@ void listener_free(SERV_LISTENER* listener)
     }
 }
 
+/**
+ * Take a reference to the users of a listener
+ *
+ * The users of a listener can be replaced while they are used. The table
+ * stays valid until the reference is returned with listener_users_put().
+ *
+ * @param listener The listener
+ * @return The users of the listener or NULL if it has none
+ */
+USERS *listener_users_get(SERV_LISTENER *listener)
+{
+    spinlock_acquire(&listener->users_lock);
+    USERS *users = listener->users;
+
+    if (users)
+    {
+        atomic_add(&users->refcount, 1);
+    }
+
+    spinlock_release(&listener->users_lock);
+    return users;
+}
+
+/**
+ * Return a reference to a users table, the table is freed when the last
+ * reference is returned
+ *
+ * @param users The users table or NULL
+ */
+void listener_users_put(USERS *users)
+{
+    if (users && atomic_add(&users->refcount, -1) == 1)
+    {
+        users_free(users);
+    }
+}
+
+/**
+ * Replace the users of a listener
+ *
+ * The listener takes over the reference of the caller to the new users. The
+ * old users are freed once the lookups that use them have completed.
+ *
+ * @param listener The listener
+ * @param users    The new users
+ */
+void listener_users_set(SERV_LISTENER *listener, USERS *users)
+{
+    spinlock_acquire(&listener->users_lock);
+    USERS *old = listener->users;
+    listener->users = users;
+    spinlock_release(&listener->users_lock);
+
+    listener_users_put(old);
+}
+
 /**
  * Set the maximum SSL/TLS version the listener will support
  * @param ssl_listener Listener data to configure
@@ -22,11 +22,13 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <syslog.h>
+#include <time.h>
 #include <atomic.h>
 
 #include <hashtable.h>
-#include <mlist.h>
 #include <spinlock.h>
 #include <skygw_debug.h>
 #include <skygw_types.h>
@@ -36,7 +38,15 @@
 #define MAX_PREFIXLEN 250
 #define MAX_SUFFIXLEN 250
 #define MAX_PATHLEN   512
-#define MAXNBLOCKBUFS 10
+
+/** Size of the log buffer of a thread, must be a power of two */
+#define LOGBUF_SIZE    (64 * 1024)
+/** The file writer is woken up when a log buffer gets this full */
+#define LOGBUF_WAKEUP  (LOGBUF_SIZE / 4)
+/** How many times a message that must be flushed is tried if the log buffer is full */
+#define LOGBUF_RETRIES 1000
+/** Length of the record that tells that the rest of the buffer is unused */
+#define LOGBUF_WRAP    UINT32_MAX
 
 /** for procname */
 #if !defined(_GNU_SOURCE)
@@ -49,13 +59,6 @@ static const char LOGFILE_NAME_SUFFIX[] = ".log";
 extern char *program_invocation_name;
 extern char *program_invocation_short_name;
 
-typedef enum
-{
-    BB_READY = 0x00,
-    BB_FULL,
-    BB_CLEARED
-} blockbuf_state_t;
-
 typedef enum
 {
     FILEWRITER_INIT,
@@ -90,7 +93,6 @@ enum log_flush
 
 #if defined(SS_DEBUG)
 static int write_index;
-static int block_start_index;
 static int prevval;
 static simple_mutex_t msg_mutex;
 #endif
@@ -187,6 +189,9 @@ struct filewriter
     /** fwr_clientmes is for messages to log clients */
     skygw_message_t*   fwr_clientmes;
     skygw_thread_t*    fwr_thread;
+    /** Messages collected from the log buffers for writing */
+    size_t             fwr_buf_used;
+    char               fwr_buf[LOGBUF_SIZE];
 #if defined(SS_DEBUG)
     skygw_chk_t        fwr_chk_tail;
 #endif
@@ -330,27 +335,65 @@ static void* lm_message_stats_clone(const void* v)
     return dst;
 }
 
+/** Length of a record rounded up so that the next record header is aligned */
+#define LOGBUF_ALIGN(n) (((n) + sizeof(logbuf_record_t) - 1) & ~(sizeof(logbuf_record_t) - 1))
+
 /**
- * Log client's string is copied to block-sized log buffer, which is passed
- * to file writer thread.
+ * The header of a message in a log buffer, followed by the message.
  */
-typedef struct blockbuf
+typedef struct logbuf_record
 {
-#if defined(SS_DEBUG)
-    skygw_chk_t    bb_chk_top;
-#endif
-    blockbuf_state_t bb_state; /**State of the block buffer*/
-    simple_mutex_t bb_mutex;    /**< bb_buf_used, bb_isfull */
-    int            bb_refcount; /**< protected by list mutex. #of clients */
-//        int            bb_blankcount; /**< # of blanks used btw strings */
-    size_t         bb_buf_size;
-    size_t         bb_buf_left;
-    size_t         bb_buf_used;
-    char           bb_buf[MAX_LOGSTRLEN];
-#if defined(SS_DEBUG)
-    skygw_chk_t    bb_chk_tail;
-#endif
-} blockbuf_t;
+    uint64_t lr_time; /**< Time of the message in nanoseconds, the order of messages in the file */
+    uint32_t lr_len;  /**< Length of the message or LOGBUF_WRAP */
+    uint32_t lr_pad;
+} logbuf_record_t;
+
+/**
+ * Each thread copies its log messages to a ring buffer of its own, from where
+ * the file writer thread writes them to the log file. The thread only moves
+ * the head and the file writer only moves the tail, so neither of them locks
+ * the buffer. The positions only grow, the offset in lb_buf is the position
+ * modulo LOGBUF_SIZE.
+ */
+typedef struct logbuf
+{
+    volatile size_t lb_head;     /**< End of the committed messages, moved by the thread */
+    size_t          lb_reserved; /**< End of the message being written, used by the thread */
+    volatile int    lb_dropped;  /**< Number of dropped messages, incremented by the thread */
+    volatile bool   lb_orphaned; /**< Set when the thread exits */
+    volatile size_t lb_tail;     /**< Start of the unwritten messages, moved by the file writer */
+    size_t          lb_limit;    /**< lb_head when the file writer started writing */
+    int             lb_reported; /**< Number of dropped messages reported by the file writer */
+    struct logbuf*  lb_next;
+    char            lb_buf[LOGBUF_SIZE];
+} logbuf_t;
+
+/**
+ * The log buffers of all threads that have logged. The buffers are not freed
+ * when the log manager is, so that threads can keep using them if the log
+ * manager is initialized again. logbufs_lock protects adding and removing
+ * buffers, the file writer reads the list without it.
+ */
+static logbuf_t* logbufs;
+static int logbufs_lock;
+static __thread logbuf_t* thread_logbuf;
+static pthread_key_t logbuf_key;
+static pthread_once_t logbuf_key_once = PTHREAD_ONCE_INIT;
+/** Total number of dropped messages */
+static int log_dropped;
+
+/** Length of the date and time of the timestamp, "YYYY-MM-DD HH:MM:SS" */
+#define TIMESTAMP_DATETIME_LEN 19
+
+/**
+ * The date and time part of the timestamp formatted by a thread, it is only
+ * formatted again when the second changes.
+ */
+static __thread struct
+{
+    time_t sec;
+    char   text[TIMESTAMP_DATETIME_LEN + 1];
+} thread_timestamp;
 
 /**
  * logfile object corresponds to physical file(s) where
@@ -372,8 +415,6 @@ struct logfile
     const char*      lf_name_suffix;
     char*            lf_full_file_name; /**< complete log file name */
     char*            lf_full_link_name; /**< complete symlink name */
-    /** list of block-sized log buffers */
-    mlist_t          lf_blockbuf_list;
     size_t           lf_buf_size;
     bool             lf_flushflag;
     bool             lf_rotateflag;
@@ -464,14 +505,11 @@ static int logmanager_write_log(int            priority,
                                 size_t         len,
                                 const char*    str);
 
-static blockbuf_t* blockbuf_init();
-static void blockbuf_node_done(void* bb_data);
-static char* blockbuf_get_writepos(blockbuf_t** p_bb,
-                                   size_t       str_len,
-                                   bool         flush);
-
-static void blockbuf_register(blockbuf_t* bb);
-static void blockbuf_unregister(blockbuf_t* bb);
+static logbuf_t* logbuf_get(void);
+static char* logbuf_reserve(logbuf_t* lb, size_t len, uint64_t time);
+static void logbuf_commit(logbuf_t* lb, logfile_t* lf, bool flush);
+static bool logbufs_write(filewriter_t* fwr, logfile_t* lf, bool flush);
+static size_t log_timestamp_print(char* dest, const struct timespec* now, bool highprecision);
 static char* add_slash(char* str);
 
 static bool check_file_and_path(const char* filename, bool* writable);
@@ -503,7 +541,6 @@ static bool logmanager_init_nomutex(const char* ident,
     lm->lm_chk_top   = CHK_NUM_LOGMANAGER;
     lm->lm_chk_tail  = CHK_NUM_LOGMANAGER;
     write_index = 0;
-    block_start_index = 0;
     prevval = -1;
     simple_mutex_init(&msg_mutex, "Message mutex");
 #endif
@@ -743,7 +780,7 @@ static logfile_t* logmanager_get_logfile(logmanager_t* lmgr)
 }
 
 /**
- * Finds write position from block buffer for log string and writes there.
+ * Writes the log string to the log buffer of the calling thread.
  *
  * Parameters:
  *
@@ -764,12 +801,11 @@ static int logmanager_write_log(int            priority,
                                 const char*    str)
 {
     logfile_t*   lf;
-    char*        wp;
+    char*        wp = NULL;
     int          err = 0;
-    blockbuf_t*  bb;
-    blockbuf_t*  bb_c;
+    logbuf_t*    lb = NULL;
     size_t       timestamp_len;
-    int          i;
+    struct timespec now;
 
     // The config parameters are copied to local variables, because the values in
     // log_config may change during the course of the function, with would have
@@ -815,7 +851,7 @@ static int logmanager_write_log(int            priority,
     cmplen = sesid_str_len > 0 ? sesid_str_len - sizeof(char) : 0;
 
     bool overflow = false;
-    /** Find out how much can be safely written with current block size */
+    /** Find out how much can be safely written with the maximum message length */
     if (timestamp_len - sizeof(char) + cmplen + str_len > lf->lf_buf_size)
     {
         safe_str_len = lf->lf_buf_size;
@@ -826,7 +862,7 @@ static int logmanager_write_log(int            priority,
         safe_str_len = timestamp_len - sizeof(char) + cmplen + str_len;
     }
     /**
-     * Seek write position and register to block buffer.
+     * Reserve room from the log buffer of the thread.
      * Then print formatted string to write position.
      */
 
@@ -854,13 +890,43 @@ static int logmanager_write_log(int            priority,
         simple_mutex_unlock(&msg_mutex);
     }
 #endif
+    clock_gettime(CLOCK_REALTIME, &now);
+
     /** Book space for log string from buffer */
-    if (do_maxlog)
+    if (do_maxlog && (lb = logbuf_get()) != NULL)
     {
+        uint64_t time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
         // All messages are now logged to the error log file.
-        wp = blockbuf_get_writepos(&bb, safe_str_len, flush);
+        wp = logbuf_reserve(lb, safe_str_len, time);
+
+        /**
+         * Messages that must be flushed are worth waiting for a while,
+         * the others are dropped right away when the buffer is full.
+         */
+        for (int i = 0; wp == NULL && flush && i < LOGBUF_RETRIES; i++)
+        {
+            skygw_message_send(lf->lf_logmes);
+            sched_yield();
+            wp = logbuf_reserve(lb, safe_str_len, time);
+        }
+
+        if (wp == NULL)
+        {
+            /** The file writer reports the dropped messages */
+            lb->lb_dropped++;
+            atomic_add(&log_dropped, 1);
+            skygw_message_send(lf->lf_logmes);
+            lb = NULL;
+
+            if (!do_syslog)
+            {
+                return -1;
+            }
+        }
     }
-    else
+
+    if (lb == NULL)
     {
         wp = (char*)MXS_MALLOC(sizeof(char) * (timestamp_len - sizeof(char) + cmplen + str_len + 1));
     }
@@ -878,18 +944,11 @@ static int logmanager_write_log(int            priority,
     }
 #endif
     /**
-     * Write timestamp with at most <timestamp_len> characters
-     * to wp.
+     * Write timestamp to wp.
      * Returned timestamp_len doesn't include terminating null.
      */
-    if (do_highprecision)
-    {
-        timestamp_len = snprint_timestamp_hp(wp, timestamp_len);
-    }
-    else
-    {
-        timestamp_len = snprint_timestamp(wp, timestamp_len);
-    }
+    timestamp_len = log_timestamp_print(wp, &now, do_highprecision);
+
     if (sesid_str_len != 0)
     {
         /**
@@ -941,9 +1000,9 @@ static int logmanager_write_log(int            priority,
     }
     wp[safe_str_len - 1] = '\n';
 
-    if (do_maxlog)
+    if (lb)
     {
-        blockbuf_unregister(bb);
+        logbuf_commit(lb, lf, flush);
     }
     else
     {
@@ -954,345 +1013,344 @@ static int logmanager_write_log(int            priority,
 }
 
 /**
- * Register writer to a block buffer. When reference counter is non-zero the
- * flusher thread doesn't write the block to disk.
+ * Print the timestamp of a log line, in the format of snprint_timestamp()
+ * or snprint_timestamp_hp(). The date and time are only formatted when the
+ * second changes.
+ *
+ * @param dest          Where the timestamp is printed, not null terminated
+ * @param now           The current time
+ * @param highprecision Whether milliseconds are printed
  *
- * @param bb    block buffer
+ * @return Length of the timestamp
  */
-static void blockbuf_register(blockbuf_t* bb)
+static size_t log_timestamp_print(char* dest, const struct timespec* now, bool highprecision)
 {
-    CHK_BLOCKBUF(bb);
-    ss_dassert(bb->bb_refcount >= 0);
-    atomic_add(&bb->bb_refcount, 1);
+    if (thread_timestamp.sec != now->tv_sec)
+    {
+        struct tm tm;
+        localtime_r(&now->tv_sec, &tm);
+        snprintf(thread_timestamp.text, sizeof(thread_timestamp.text),
+                 "%04d-%02d-%02d %02d:%02d:%02d",
+                 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        thread_timestamp.sec = now->tv_sec;
+    }
+
+    size_t len = TIMESTAMP_DATETIME_LEN;
+    memcpy(dest, thread_timestamp.text, len);
+
+    if (highprecision)
+    {
+        int ms = now->tv_nsec / 1000000;
+        dest[len++] = '.';
+        dest[len++] = '0' + ms / 100;
+        dest[len++] = '0' + ms / 10 % 10;
+        dest[len++] = '0' + ms % 10;
+    }
+
+    memcpy(dest + len, "   ", 3);
+
+    return len + 3;
 }
 
 /**
- * Unregister writer from block buffer. If the buffer got filled up and there
- * are no other registered writers anymore, notify the flusher thread.
+ * Mark the log buffer of an exiting thread orphaned. The file writer frees
+ * the buffer once it has written the messages in it. The thread forgets the
+ * buffer, so anything it logs after this, e.g. from another thread-specific
+ * data destructor, goes to a new buffer instead of one that may be freed.
  *
- * @param bb    block buffer
+ * @param data The log buffer of the thread
  */
-static void blockbuf_unregister(blockbuf_t* bb)
+static void logbuf_orphan(void* data)
 {
-    logfile_t* lf;
+    logbuf_t* lb = (logbuf_t*)data;
 
-    CHK_BLOCKBUF(bb);
-    ss_dassert(bb->bb_refcount >= 1);
-    lf = &lm->lm_logfile;
-    CHK_LOGFILE(lf);
-    /**
-     * if this is the last client in a full buffer, send write request.
-     */
-    if (atomic_add(&bb->bb_refcount, -1) == 1 && bb->bb_state == BB_FULL)
-    {
-        skygw_message_send(lf->lf_logmes);
-    }
-    ss_dassert(bb->bb_refcount >= 0);
+    thread_logbuf = NULL;
+    __sync_synchronize();
+    lb->lb_orphaned = true;
 }
 
+static void logbuf_key_create(void)
+{
+    pthread_key_create(&logbuf_key, logbuf_orphan);
+}
 
 /**
- * @node (write brief function description here)
- *
- * Parameters:
- * @param id - <usage>
- *          <description>
- *
- * @param str_len - <usage>
- *          <description>
- *
- * @return
- *
- *
- * @details List mutex now protects both the list and the contents of it.
- * TODO : It should be so that adding and removing nodes of the list is protected
- * by the list mutex. Buffer modifications should be protected by buffer
- * mutex.
+ * Get the log buffer of the calling thread. The buffer is created when the
+ * thread logs for the first time.
  *
+ * @return The log buffer or NULL if memory allocation failed
  */
-static char* blockbuf_get_writepos(blockbuf_t** p_bb,
-                                   size_t       str_len,
-                                   bool         flush)
-{
-    logfile_t*     lf;
-    mlist_t*       bb_list;
-    char*          pos = NULL;
-    mlist_node_t*  node;
-    blockbuf_t*    bb;
-#if defined(SS_DEBUG)
-    bool           succ;
-#endif
+static logbuf_t* logbuf_get(void)
+{
+    logbuf_t* lb = thread_logbuf;
 
-    CHK_LOGMANAGER(lm);
-    lf = &lm->lm_logfile;
-    CHK_LOGFILE(lf);
-    bb_list = &lf->lf_blockbuf_list;
+    /** Not MXS_CALLOC, a failure would be logged which would lead back here. */
+    if (lb == NULL && (lb = (logbuf_t*)calloc(1, sizeof(logbuf_t))) != NULL)
+    {
+        pthread_once(&logbuf_key_once, logbuf_key_create);
+        pthread_setspecific(logbuf_key, lb);
 
-    /** Lock list */
-    simple_mutex_lock(&bb_list->mlist_mutex, true);
-    CHK_MLIST(bb_list);
+        acquire_lock(&logbufs_lock);
+        lb->lb_next = logbufs;
+        __sync_synchronize();
+        logbufs = lb;
+        release_lock(&logbufs_lock);
 
-    if (bb_list->mlist_nodecount > 0)
-    {
-        /**
-         * At least block buffer exists on the list.
-         */
-        node = bb_list->mlist_first;
+        thread_logbuf = lb;
+    }
 
-        /** Loop over blockbuf list to find write position */
-        while (true)
-        {
-            CHK_MLIST_NODE(node);
+    return lb;
+}
 
-            /** Unlock list */
-            simple_mutex_unlock(&bb_list->mlist_mutex);
+/**
+ * Reserve room for a message from the log buffer of the calling thread.
+ * The message is not visible to the file writer before logbuf_commit()
+ * is called.
+ *
+ * @param lb   The log buffer of the calling thread
+ * @param len  Length of the message
+ * @param time The time of the message, in nanoseconds
+ *
+ * @return Write position of the message or NULL if the buffer is full
+ */
+static char* logbuf_reserve(logbuf_t* lb, size_t len, uint64_t time)
+{
+    size_t head = lb->lb_head;
+    size_t offset = head % LOGBUF_SIZE;
+    size_t needed = LOGBUF_ALIGN(sizeof(logbuf_record_t) + len);
+    size_t wrap = 0;
 
-            bb = (blockbuf_t *)node->mlnode_data;
-            CHK_BLOCKBUF(bb);
+    if (needed > LOGBUF_SIZE - offset)
+    {
+        /** The message doesn't fit to the end of the buffer, it goes to the start */
+        wrap = LOGBUF_SIZE - offset;
+    }
 
-            /** Lock buffer */
-            simple_mutex_lock(&bb->bb_mutex, true);
+    if (head + wrap + needed - lb->lb_tail > LOGBUF_SIZE)
+    {
+        return NULL;
+    }
 
-            if (bb->bb_state == BB_FULL || bb->bb_buf_left < str_len)
-            {
-                /**
-                 * This block buffer is too full.
-                 * Send flush request to file writer thread. This causes
-                 * flushing all buffers, and (eventually) frees buffer space.
-                 */
-                blockbuf_register(bb);
+    if (wrap)
+    {
+        ((logbuf_record_t*)&lb->lb_buf[offset])->lr_len = LOGBUF_WRAP;
+        offset = 0;
+    }
 
-                bb->bb_state = BB_FULL;
+    logbuf_record_t* rec = (logbuf_record_t*)&lb->lb_buf[offset];
+    rec->lr_time = time;
+    rec->lr_len = len;
+    lb->lb_reserved = head + wrap + needed;
 
-                blockbuf_unregister(bb);
+    return (char*)(rec + 1);
+}
 
-                /** Unlock buffer */
-                simple_mutex_unlock(&bb->bb_mutex);
+/**
+ * Make the message reserved with logbuf_reserve() visible to the file
+ * writer. The file writer is woken up if the message must be flushed or
+ * if the buffer got a quarter full.
+ *
+ * @param lb    The log buffer of the calling thread
+ * @param lf    The log file
+ * @param flush Whether the message must be written to disk immediately
+ */
+static void logbuf_commit(logbuf_t* lb, logfile_t* lf, bool flush)
+{
+    size_t used = lb->lb_head - lb->lb_tail;
 
-                /** Lock list */
-                simple_mutex_lock(&bb_list->mlist_mutex, true);
+    __sync_synchronize();
+    lb->lb_head = lb->lb_reserved;
 
+    if (flush || (used < LOGBUF_WAKEUP && lb->lb_head - lb->lb_tail >= LOGBUF_WAKEUP))
+    {
+        skygw_message_send(lf->lf_logmes);
+    }
+}
 
-                /**
-                 * If next node exists move forward. Else check if there is
-                 * space for a new block buffer on the list.
-                 */
-                if (node != bb_list->mlist_last)
-                {
-                    node = node->mlnode_next;
-                    continue;
-                }
-                /**
-                 * All buffers on the list are full.
-                 */
-                if (bb_list->mlist_nodecount < bb_list->mlist_nodecount_max)
-                {
-                    /**
-                     * New node is created
-                     */
-                    if ((bb = blockbuf_init()) == NULL)
-                    {
-                        simple_mutex_unlock(&bb_list->mlist_mutex);
-                        return NULL;
-                    }
+/**
+ * Get the oldest message of a log buffer that the file writer hasn't
+ * written yet.
+ *
+ * @param lb The log buffer
+ *
+ * @return The message or NULL if all messages up to lb_limit have been written
+ */
+static logbuf_record_t* logbuf_peek(logbuf_t* lb)
+{
+    while (lb->lb_tail < lb->lb_limit)
+    {
+        logbuf_record_t* rec = (logbuf_record_t*)&lb->lb_buf[lb->lb_tail % LOGBUF_SIZE];
 
-                    CHK_BLOCKBUF(bb);
+        if (rec->lr_len != LOGBUF_WRAP)
+        {
+            return rec;
+        }
 
-                    /**
-                     * Increase version to odd to mark list update active
-                     * update.
-                     */
-                    bb_list->mlist_versno += 1;
-                    ss_dassert(bb_list->mlist_versno % 2 == 1);
+        lb->lb_tail += LOGBUF_SIZE - lb->lb_tail % LOGBUF_SIZE;
+    }
 
-                    ss_debug(succ = ) mlist_add_data_nomutex(bb_list, bb);
-                    ss_dassert(succ);
+    return NULL;
+}
 
-                    /**
-                     * Increase version to even to mark completion of update.
-                     */
-                    bb_list->mlist_versno += 1;
-                    ss_dassert(bb_list->mlist_versno % 2 == 0);
-                }
-                else
-                {
-                    /**
-                     * List and buffers are full.
-                     * Reset to the beginning of the list, and wait until
-                     * there is a block buffer with enough space.
-                     */
-                    simple_mutex_unlock(&bb_list->mlist_mutex);
-                    simple_mutex_lock(&bb_list->mlist_mutex, true);
-
-                    node = bb_list->mlist_first;
-                    continue;
-                }
+/**
+ * Write the staged messages of the file writer to the log file.
+ *
+ * @param fwr   The file writer
+ * @param lf    The log file
+ * @param flush Whether the file is fsync'd
+ *
+ * @return True if the messages were written
+ */
+static bool logbufs_write_staged(filewriter_t* fwr, logfile_t* lf, bool flush)
+{
+    int err = skygw_file_write(fwr->fwr_file, fwr->fwr_buf, fwr->fwr_buf_used, flush);
 
-            }
-            else if (bb->bb_state == BB_CLEARED)
-            {
+    fwr->fwr_buf_used = 0;
 
-                /**
-                 *Move the cleared buffer to the end of the list if it is the first one in the list
-                 */
+    if (err)
+    {
+        // TODO: Log this to syslog.
+        char errbuf[STRERROR_BUFLEN];
+        LOG_ERROR("MaxScale Log: Error, writing to the log-file %s failed due to %d, %s. "
+                  "Disabling writing to the log.\n",
+                  lf->lf_full_file_name, err, strerror_r(err, errbuf, sizeof(errbuf)));
 
-                simple_mutex_unlock(&bb->bb_mutex);
-                simple_mutex_lock(&bb_list->mlist_mutex, true);
+        mxs_log_set_maxlog_enabled(false);
+    }
 
-                if (node == bb_list->mlist_first)
-                {
+    return err == 0;
+}
 
-                    if ((bb_list->mlist_nodecount > 1) && (node != bb_list->mlist_last))
-                    {
-                        bb_list->mlist_last->mlnode_next = bb_list->mlist_first;
-                        bb_list->mlist_first = bb_list->mlist_first->mlnode_next;
-                        bb_list->mlist_last->mlnode_next->mlnode_next = NULL;
-                        bb_list->mlist_last = bb_list->mlist_last->mlnode_next;
-                    }
+/**
+ * Stage a message for writing to the log file.
+ *
+ * @param fwr   The file writer
+ * @param lf    The log file
+ * @param str   The message
+ * @param len   Length of the message
+ * @param write Whether the messages are written, false after a write error
+ *
+ * @return False if the messages could not be written
+ */
+static bool logbufs_stage(filewriter_t* fwr, logfile_t* lf, const char* str, size_t len, bool write)
+{
+    if (write && fwr->fwr_buf_used + len > sizeof(fwr->fwr_buf))
+    {
+        write = logbufs_write_staged(fwr, lf, false);
+    }
 
-                    ss_dassert(node == bb_list->mlist_last);
+    if (write)
+    {
+        ss_dassert(fwr->fwr_buf_used + len <= sizeof(fwr->fwr_buf));
+        memcpy(fwr->fwr_buf + fwr->fwr_buf_used, str, len);
+        fwr->fwr_buf_used += len;
+    }
 
-                    simple_mutex_unlock(&bb_list->mlist_mutex);
-                    simple_mutex_lock(&bb->bb_mutex, true);
+    return write;
+}
 
-                    bb->bb_state = BB_READY;
+/**
+ * Write the messages in the log buffers of the threads to the log file in
+ * timestamp order. The messages that are logged while the buffers are being
+ * written are left to the next round so that the threads that keep logging
+ * can't keep the file writer from handling flushes. The buffers of exited
+ * threads are freed once they are empty.
+ *
+ * @param fwr   The file writer
+ * @param lf    The log file
+ * @param flush Whether the file is fsync'd
+ *
+ * @return True if a log buffer was left at least a quarter full
+ */
+static bool logbufs_write(filewriter_t* fwr, logfile_t* lf, bool flush)
+{
+    bool write = true;
+    bool more = false;
+    logbuf_t* lb;
 
-                    simple_mutex_unlock(&bb->bb_mutex);
-                    simple_mutex_lock(&bb_list->mlist_mutex, true);
-                    node = bb_list->mlist_first;
-                }
-                else
-                {
-                    if (node->mlnode_next)
-                    {
-                        node = node->mlnode_next;
-                    }
-                    else
-                    {
-                        node = bb_list->mlist_first;
-                    }
-                    continue;
-                }
+    __sync_synchronize();
 
-            }
-            else if (bb->bb_state == BB_READY)
-            {
-                /**
-                 * There is space for new log string.
-                 */
-                break;
-            }
-        } /** while (true) */
-    }
-    else
+    for (lb = logbufs; lb; lb = lb->lb_next)
     {
+        lb->lb_limit = lb->lb_head;
 
-        /**
-         * Create the first block buffer to logfile's blockbuf list.
-         */
-
-        if ((bb = blockbuf_init()) == NULL)
+        if (lb->lb_dropped != lb->lb_reported)
         {
-            return NULL;
+            int dropped = lb->lb_dropped;
+            char line[MAX_LOGSTRLEN];
+            size_t len = snprint_timestamp(line, sizeof(line));
+
+            len += snprintf(line + len, sizeof(line) - len,
+                            "warning: %d messages were dropped because the log buffer "
+                            "of a thread was full.\n", dropped - lb->lb_reported);
+            lb->lb_reported = dropped;
+            write = logbufs_stage(fwr, lf, line, len, write);
         }
+    }
 
-        CHK_BLOCKBUF(bb);
-
-        /** Lock buffer */
-        simple_mutex_lock(&bb->bb_mutex, true);
-        /**
-         * Increase version to odd to mark list update active update.
-         */
-        bb_list->mlist_versno += 1;
-        ss_dassert(bb_list->mlist_versno % 2 == 1);
-
-        ss_debug(succ = ) mlist_add_data_nomutex(bb_list, bb);
-        ss_dassert(succ);
+    /** The messages must be read only after the write positions */
+    __sync_synchronize();
 
-        /**
-         * Increase version to even to mark completion of update.
-         */
-        bb_list->mlist_versno += 1;
-        ss_dassert(bb_list->mlist_versno % 2 == 0);
+    while (true)
+    {
+        logbuf_t* oldest = NULL;
+        logbuf_record_t* oldest_rec = NULL;
 
-        /** Unlock list */
-        simple_mutex_unlock(&bb_list->mlist_mutex);
-    } /* if (bb_list->mlist_nodecount > 0) */
+        for (lb = logbufs; lb; lb = lb->lb_next)
+        {
+            logbuf_record_t* rec = logbuf_peek(lb);
 
-    ss_dassert(pos == NULL);
-    ss_dassert(!(bb->bb_state == BB_FULL || bb->bb_buf_left < str_len));
-    ss_dassert(bb_list->mlist_nodecount <= bb_list->mlist_nodecount_max);
+            if (rec && (oldest_rec == NULL || rec->lr_time < oldest_rec->lr_time))
+            {
+                oldest = lb;
+                oldest_rec = rec;
+            }
+        }
 
-    /**
-     * Registration to blockbuf adds reference for the write operation.
-     * It indicates that client has allocated space from the buffer,
-     * but not written yet. As long as refcount > 0 buffer can't be
-     * written to disk.
-     */
-    blockbuf_register(bb);
-    *p_bb = bb;
-    /**
-     * At this point list mutex is held and bb points to a node with
-     * enough space available. pos is not yet set.
-     */
-    pos = &bb->bb_buf[bb->bb_buf_used];
-    bb->bb_buf_used += str_len;
-    bb->bb_buf_left -= str_len;
+        if (oldest == NULL)
+        {
+            break;
+        }
 
-    ss_dassert((pos >= &bb->bb_buf[0]) && (pos <= &bb->bb_buf[MAX_LOGSTRLEN - str_len]));
+        write = logbufs_stage(fwr, lf, (char*)(oldest_rec + 1), oldest_rec->lr_len, write);
 
-    /** read checkmark */
-    /** TODO: add buffer overflow checkmark
-        chk_val = (int)bb->bb_buf[bb->bb_buf_used-count_len];
-        ss_dassert(chk_val == bb->bb_strcount);
-    */
+        /** The message must be copied before the room is given back to the thread */
+        __sync_synchronize();
+        oldest->lb_tail += LOGBUF_ALIGN(sizeof(logbuf_record_t) + oldest_rec->lr_len);
+    }
 
-    /** TODO : write next checkmark
-        bb->bb_strcount += 1;
-        memcpy(&bb->bb_buf[bb->bb_buf_used], &bb->bb_strcount, count_len);
-        bb->bb_buf_used += count_len;
-        bb->bb_buf_left -= count_len;
-    */
+    if (write && fwr->fwr_buf_used > 0)
+    {
+        logbufs_write_staged(fwr, lf, flush);
+    }
 
-    /**
-     * If flush flag is set, set buffer full. As a consequence, no-one
-     * can write to it before it is flushed to disk.
-     */
-    bb->bb_state = (flush == true ? BB_FULL : bb->bb_state);
+    fwr->fwr_buf_used = 0;
 
-    /** Unlock buffer */
-    simple_mutex_unlock(&bb->bb_mutex);
-    return pos;
-}
+    acquire_lock(&logbufs_lock);
+    logbuf_t** prev = &logbufs;
 
-static void blockbuf_node_done(void* bb_data)
-{
-    blockbuf_t* bb = (blockbuf_t *)bb_data;
-    simple_mutex_done(&bb->bb_mutex);
-}
+    while ((lb = *prev) != NULL)
+    {
+        if (lb->lb_orphaned)
+        {
+            __sync_synchronize();
+        }
 
+        if (lb->lb_orphaned && lb->lb_tail == lb->lb_head)
+        {
+            *prev = lb->lb_next;
+            free(lb);
+        }
+        else
+        {
+            more = more || lb->lb_head - lb->lb_tail >= LOGBUF_WAKEUP;
+            prev = &lb->lb_next;
+        }
+    }
 
-static blockbuf_t* blockbuf_init()
-{
-    blockbuf_t* bb;
+    release_lock(&logbufs_lock);
 
-    if ((bb = (blockbuf_t *) MXS_CALLOC(1, sizeof (blockbuf_t))))
-    {
-#if defined(SS_DEBUG)
-        bb->bb_chk_top = CHK_NUM_BLOCKBUF;
-        bb->bb_chk_tail = CHK_NUM_BLOCKBUF;
-#endif
-        simple_mutex_init(&bb->bb_mutex, "Blockbuf mutex");
-        bb->bb_buf_left = MAX_LOGSTRLEN;
-        bb->bb_buf_size = MAX_LOGSTRLEN;
-#if defined(SS_LOG_DEBUG)
-        sprintf(bb->bb_buf, "[block:%d]", atomic_add(&block_start_index, 1));
-        bb->bb_buf_used += strlen(bb->bb_buf);
-        bb->bb_buf_left -= strlen(bb->bb_buf);
-#endif
-        CHK_BLOCKBUF(bb);
-    }
-    return bb;
+    return more;
 }
 
 /**
@@ -1874,7 +1932,7 @@ static bool file_is_symlink(const char* filename)
 
 /**
  * @node Initialize logfile structure. Form log file name, and optionally
- * link name. Create block buffer for logfile.
+ * link name.
  *
  * Parameters:
  * @param logfile       log file
@@ -1945,21 +2003,6 @@ static bool logfile_init(logfile_t*    logfile,
     {
         goto return_with_succ;
     }
-    /**
-     * Create a block buffer list for log file. Clients' writes go to buffers
-     * from where separate log flusher thread writes them to disk.
-     */
-    if (mlist_init(&logfile->lf_blockbuf_list,
-                   NULL,
-                   MXS_STRDUP_A("logfile block buffer list"),
-                   blockbuf_node_done,
-                   MAXNBLOCKBUFS) == NULL)
-    {
-        LOG_ERROR("MaxScale Log: Error, Initializing buffers for log files failed.\n");
-        logfile_free_memory(logfile);
-        goto return_with_succ;
-    }
-
     succ = true;
     logfile->lf_state = RUN;
     CHK_LOGFILE(logfile);
@@ -2000,11 +2043,6 @@ static void logfile_done(logfile_t* lf)
             CHK_LOGFILE(lf);
         /** fallthrough */
         case INIT:
-            /** Test if list is initialized before freeing it */
-            if (lf->lf_blockbuf_list.mlist_versno != 0)
-            {
-                mlist_done(&lf->lf_blockbuf_list);
-            }
             logfile_free_memory(lf);
             lf->lf_state = DONE;
         /** fallthrough */
@@ -2193,90 +2231,11 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
         return true;
     }
 
-    skygw_file_t *file = fwr->fwr_file;
-    /**
-     * get logfile's block buffer list
-     */
-    mlist_t *bb_list = &lf->lf_blockbuf_list;
-#if defined(SS_DEBUG)
-    simple_mutex_lock(&bb_list->mlist_mutex, true);
-    CHK_MLIST(bb_list);
-    simple_mutex_unlock(&bb_list->mlist_mutex);
-#endif
-    mlist_node_t *node = bb_list->mlist_first;
-
-    while (node != NULL)
+    if (logbufs_write(fwr, lf, flush_logfile || do_flushall))
     {
-        int err = 0;
-
-        CHK_MLIST_NODE(node);
-        blockbuf_t *bb = (blockbuf_t *)node->mlnode_data;
-        CHK_BLOCKBUF(bb);
-
-        /** Lock block buffer */
-        simple_mutex_lock(&bb->bb_mutex, true);
-
-        blockbuf_state_t flush_blockbuf = bb->bb_state;
-
-        if (bb->bb_buf_used != 0 &&
-            ((flush_blockbuf == BB_FULL) || flush_logfile || do_flushall))
-        {
-            /**
-             * buffer is at least half-full
-             * -> write to disk
-             */
-            while (bb->bb_refcount > 0)
-            {
-                simple_mutex_unlock(&bb->bb_mutex);
-                simple_mutex_lock(&bb->bb_mutex, true);
-            }
-            err = skygw_file_write(file,
-                                   (void *)bb->bb_buf,
-                                   bb->bb_buf_used,
-                                   (flush_logfile || do_flushall));
-            if (err)
-            {
-                // TODO: Log this to syslog.
-                char errbuf[STRERROR_BUFLEN];
-                LOG_ERROR("MaxScale Log: Error, writing to the log-file %s failed due to %d, %s. "
-                          "Disabling writing to the log.\n",
-                          lf->lf_full_file_name, err, strerror_r(err, errbuf, sizeof(errbuf)));
-
-                mxs_log_set_maxlog_enabled(false);
-            }
-            /**
-             * Reset buffer's counters and mark
-             * not full.
-             */
-            bb->bb_buf_left = bb->bb_buf_size;
-            bb->bb_buf_used = 0;
-            memset(bb->bb_buf, 0, bb->bb_buf_size);
-            bb->bb_state = BB_CLEARED;
-#if defined(SS_LOG_DEBUG)
-            sprintf(bb->bb_buf, "[block:%d]", atomic_add(&block_start_index, 1));
-            bb->bb_buf_used += strlen(bb->bb_buf);
-            bb->bb_buf_left -= strlen(bb->bb_buf);
-#endif
-
-        }
-        /** Release lock to block buffer */
-        simple_mutex_unlock(&bb->bb_mutex);
-
-        size_t vn1;
-        size_t vn2;
-        /** Consistent lock-free read on the list */
-        do
-        {
-            while ((vn1 = bb_list->mlist_versno) % 2 != 0)
-            {
-                continue;
-            }
-            node = node->mlnode_next;
-            vn2 = bb_list->mlist_versno;
-        }
-        while (vn1 != vn2 && node);
-
-    } /* while (node != NULL) */
+        /** Some thread keeps logging, make the next wait return immediately */
+        skygw_message_send(fwr->fwr_logmes);
+    }
 
     /**
      * Writer's exit flag was set after checking it.
@@ -2297,7 +2256,7 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
 }
 
 /**
- * @node Writes block buffers of logfiles to physical log files on disk.
+ * @node Writes the log buffers of the threads to the log file on disk.
  *
  * Parameters:
  * @param data - thread context, skygw_thread_t
@@ -2306,38 +2265,21 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
  * @return
  *
  *
- * @details Waits until receives wake-up message. Scans through block buffer
- * lists of each logfile object.
- *
- * Block buffer is written to log file if
- * 1. bb_state == true,
- * 2. logfile object's lf_flushflag == true, or
- * 3. skygw_thread_must_exit returns true.
- *
- * Log file is flushed (fsync'd) in cases #2 and #3.
- *
- * Concurrency control : block buffer is accessed by file writer (this) and
- * log clients. File writer reads and sets each logfile object's flushflag
- * with spinlock. Another protected section is when block buffer's metadata is
- * read, and optionally the write operation.
- *
- * When block buffer is marked full, logfile's flushflag is set, other
- * log clients don't try to access buffer(s). There may, however, be
- * active writes, on the block in parallel with file writer operations.
- * Each active write corresponds to bb_refcounter values.
- * On the other hand, file writer doesn't process the block buffer before
- * its refcount is zero.
- *
- * Every log file obj. has its own block buffer (linked) list.
- * List is accessed by log clients, which add nodes if necessary, and
- * by file writer which traverses the list and accesses block buffers
- * included in list nodes.
- * List modifications are protected with version numbers.
- * Before
- modification, version is increased by one to be odd. After the
- * completion, it is increased again to even. List can be read only when
- * version is even and read is consistent only if version hasn't changed
- * during the read.
+ * @details Waits until receives wake-up message. Writes the messages in the
+ * log buffers of the threads to the log file in timestamp order.
+ *
+ * A thread wakes the file writer up when its log buffer gets a quarter full,
+ * when it logs a message that must be flushed and when it has to drop a
+ * message because its buffer is full. The log file is flushed (fsync'd) if
+ * logfile object's lf_flushflag is set or if skygw_thread_must_exit returns
+ * true.
+ *
+ * Concurrency control : each log buffer has exactly one writer, the thread
+ * that owns it, and one reader, the file writer. The owner only moves the
+ * head and the file writer only moves the tail of the buffer, so neither
+ * of them takes a lock. The list of buffers is only locked when a thread
+ * adds its buffer to it and when the file writer removes the buffer of an
+ * exited thread.
  */
 static void* thr_filewriter_fun(void* data)
 {
@@ -2511,6 +2453,17 @@ void mxs_log_get_throttling(MXS_LOG_THROTTLING* throttling)
     *throttling = log_config.throttling;
 }
 
+/**
+ * Get the number of messages dropped because the log buffer of the logging
+ * thread was full.
+ *
+ * @return Number of dropped messages
+ */
+int mxs_log_get_dropped(void)
+{
+    return log_dropped;
+}
+
 /**
  * Explicitly ensure that all pending log messages are flushed.
  *
@@ -25,6 +25,7 @@
  * @endverbatim
  */
 #include <buffer.h>
+#include <ctype.h>
 #include <string.h>
 #include <mysql_client_server_protocol.h>
 #include <maxscale/alloc.h>
@@ -1238,3 +1239,304 @@ char* modutil_get_canonical(GWBUF* querybuf)
 
     return querystr;
 }
+
+/** FNV-1a 64-bit offset basis and prime */
+#define DIGEST_FNV_OFFSET 14695981039346656037ULL
+#define DIGEST_FNV_PRIME  1099511628211ULL
+
+typedef struct
+{
+    uint64_t hash;
+    char     *dest;
+    size_t   size;
+    size_t   used;
+    size_t   len;  /*< The length of the whole digest */
+    char     prev; /*< The previous character of the digest */
+} DIGEST;
+
+static inline void digest_add(DIGEST *digest, char c)
+{
+    digest->hash = (digest->hash ^ (unsigned char)c) * DIGEST_FNV_PRIME;
+
+    if (digest->used + 1 < digest->size)
+    {
+        digest->dest[digest->used++] = c;
+    }
+
+    digest->len++;
+    digest->prev = c;
+}
+
+static inline bool digest_is_ident(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
+
+/**
+ * Find the end of a number. Decimal numbers with an optional fraction and
+ * exponent and hexadecimal and binary numbers are recognized.
+ *
+ * @param ptr The start of the number
+ * @param end The end of the statement
+ * @return The end of the number or NULL if the token is not a number but
+ *         e.g. an identifier that begins with a digit
+ */
+static const char* digest_number_end(const char *ptr, const char *end)
+{
+    if (end - ptr > 2 && ptr[0] == '0' && (ptr[1] == 'x' || ptr[1] == 'b'))
+    {
+        const char *p = ptr + 2;
+
+        while (p < end && (ptr[1] == 'x' ? isxdigit((unsigned char)*p) : (*p == '0' || *p == '1')))
+        {
+            p++;
+        }
+
+        if (p > ptr + 2 && (p == end || !digest_is_ident(*p)))
+        {
+            return p;
+        }
+    }
+
+    while (ptr < end && isdigit((unsigned char)*ptr))
+    {
+        ptr++;
+    }
+
+    if (ptr < end && *ptr == '.')
+    {
+        for (ptr++; ptr < end && isdigit((unsigned char)*ptr); ptr++)
+        {
+            ;
+        }
+    }
+
+    if (ptr < end && (*ptr == 'e' || *ptr == 'E'))
+    {
+        const char *p = ptr + 1;
+
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            p++;
+        }
+
+        if (p < end && isdigit((unsigned char)*p))
+        {
+            for (ptr = p; ptr < end && isdigit((unsigned char)*ptr); ptr++)
+            {
+                ;
+            }
+        }
+    }
+
+    return ptr < end && digest_is_ident(*ptr) ? NULL : ptr;
+}
+
+/**
+ * Calculate the digest of an SQL statement. The digest is the statement with
+ * the comments removed, the string and number literals replaced with question
+ * marks, runs of whitespace replaced with a single space and the letters
+ * outside quotes in lower case. Statements that only differ in their literal
+ * values have the same digest.
+ *
+ * The statement is read once and nothing is allocated, which makes this much
+ * cheaper than modutil_get_canonical().
+ *
+ * The flags select a digest that keeps more of the statement:
+ * - MODUTIL_DIGEST_KEEP_CASE keeps the case of the letters
+ * - MODUTIL_DIGEST_KEEP_HINTS keeps executable comments and optimizer hints,
+ *   the comments that begin with an exclamation mark or a plus sign
+ * - MODUTIL_DIGEST_KEEP_DQUOTED keeps double quoted strings, which are
+ *   identifiers if ANSI_QUOTES is in the SQL mode
+ * - MODUTIL_DIGEST_EXACT fails instead of truncating the digest and on an
+ *   unterminated quote or comment, so that the digest can identify the
+ *   statement up to its literal values
+ *
+ * @param sql   The SQL statement, not null terminated
+ * @param len   Length of the statement
+ * @param flags Bitmask of the MODUTIL_DIGEST flags, 0 for the default digest
+ * @param dest  Where the null terminated digest is written, truncated to fit.
+ *              May be NULL if only the hash is needed.
+ * @param size  Size of @c dest
+ * @param hash  The 64-bit FNV-1a hash of the whole digest is stored here
+ * @return The length of the whole digest or -1 if MODUTIL_DIGEST_EXACT is
+ *         given and the digest could not be calculated
+ */
+int modutil_digest(const char *sql, size_t len, int flags, char *dest, size_t size, uint64_t *hash)
+{
+    DIGEST digest = {DIGEST_FNV_OFFSET, dest, dest ? size : 0, 0, 0, ' '};
+    const char *ptr = sql;
+    const char *end = sql + len;
+    bool exact = flags & MODUTIL_DIGEST_EXACT;
+    bool space = false;
+
+    while (ptr < end)
+    {
+        char c = *ptr;
+
+        if (isspace((unsigned char)c))
+        {
+            space = true;
+            ptr++;
+            continue;
+        }
+
+        if (c == '#' || (c == '-' && end - ptr >= 2 && ptr[1] == '-' &&
+                         (end - ptr == 2 || isspace((unsigned char)ptr[2]))))
+        {
+            while (ptr < end && *ptr != '\n')
+            {
+                ptr++;
+            }
+            space = true;
+            continue;
+        }
+
+        if (c == '/' && end - ptr >= 2 && ptr[1] == '*' &&
+            !((flags & MODUTIL_DIGEST_KEEP_HINTS) && end - ptr >= 3 && (ptr[2] == '!' || ptr[2] == '+')))
+        {
+            for (ptr += 2; ptr < end && !(*ptr == '*' && end - ptr >= 2 && ptr[1] == '/'); ptr++)
+            {
+                ;
+            }
+
+            if (ptr == end && exact)
+            {
+                return -1;
+            }
+
+            ptr = ptr < end ? ptr + 2 : end;
+            space = true;
+            continue;
+        }
+
+        if (space && digest.prev != ' ')
+        {
+            digest_add(&digest, ' ');
+        }
+        space = false;
+
+        const char *number_end;
+
+        if (c == '\'' || (c == '"' && !(flags & MODUTIL_DIGEST_KEEP_DQUOTED)))
+        {
+            /** A string literal, a doubled quote or a backslash escapes the quote */
+            for (ptr++; ptr < end; ptr++)
+            {
+                if (*ptr == '\\')
+                {
+                    ptr++;
+                }
+                else if (*ptr == c)
+                {
+                    if (end - ptr >= 2 && ptr[1] == c)
+                    {
+                        ptr++;
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+            }
+
+            if (ptr >= end && exact)
+            {
+                return -1;
+            }
+
+            ptr = ptr < end ? ptr + 1 : end;
+            digest_add(&digest, '?');
+        }
+        else if (c == '`' || c == '"')
+        {
+            /** A quoted identifier is kept as it is */
+            do
+            {
+                digest_add(&digest, *ptr++);
+            }
+            while (ptr < end && *ptr != c);
+
+            if (ptr < end)
+            {
+                digest_add(&digest, *ptr++);
+            }
+            else if (exact)
+            {
+                return -1;
+            }
+        }
+        else if (c == '/' && end - ptr >= 2 && ptr[1] == '*')
+        {
+            /** An executable comment or an optimizer hint that is kept as it is */
+            digest_add(&digest, *ptr++);
+            digest_add(&digest, *ptr++);
+
+            while (ptr < end && !(*ptr == '*' && end - ptr >= 2 && ptr[1] == '/'))
+            {
+                digest_add(&digest, *ptr++);
+            }
+
+            if (ptr < end)
+            {
+                digest_add(&digest, *ptr++);
+                digest_add(&digest, *ptr++);
+            }
+            else if (exact)
+            {
+                return -1;
+            }
+        }
+        else if ((isdigit((unsigned char)c) ||
+                  (c == '.' && end - ptr >= 2 && isdigit((unsigned char)ptr[1]))) &&
+                 !digest_is_ident(digest.prev) && digest.prev != '.' &&
+                 (number_end = digest_number_end(ptr, end)))
+        {
+            ptr = number_end;
+            digest_add(&digest, '?');
+        }
+        else if (digest_is_ident(c))
+        {
+            /** A keyword or an identifier, including one that begins with a digit */
+            for (; ptr < end && digest_is_ident(*ptr); ptr++)
+            {
+                digest_add(&digest, (flags & MODUTIL_DIGEST_KEEP_CASE) ? *ptr : tolower((unsigned char)*ptr));
+            }
+        }
+        else
+        {
+            digest_add(&digest, (flags & MODUTIL_DIGEST_KEEP_CASE) ? c : tolower((unsigned char)c));
+            ptr++;
+        }
+    }
+
+    if (exact && digest.len != digest.used)
+    {
+        return -1;
+    }
+
+    if (digest.size > 0)
+    {
+        dest[digest.used] = '\0';
+    }
+
+    *hash = digest.hash;
+    return digest.len;
+}
+
+/**
+ * Calculate the default digest of an SQL statement, see modutil_digest().
+ *
+ * @param sql  The SQL statement, not null terminated
+ * @param len  Length of the statement
+ * @param dest Where the null terminated digest is written, truncated to fit.
+ *             May be NULL if only the hash is needed.
+ * @param size Size of @c dest
+ * @return 64-bit FNV-1a hash of the whole digest
+ */
+uint64_t modutil_get_digest(const char *sql, size_t len, char *dest, size_t size)
+{
+    uint64_t hash;
+    modutil_digest(sql, len, 0, dest, size, &hash);
+    return hash;
+}
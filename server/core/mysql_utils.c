@@ -22,6 +22,7 @@
 
 #include <mysql_utils.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
 #include <maxscale/alloc.h>
 #include <log_manager.h>
@@ -147,7 +148,116 @@ char* lestr_consume(uint8_t** c, size_t *size)
     return start;
 }
 
+/** The status flag of an OK packet that reports session state changes */
+#define SERVER_STATUS_SESSION_STATE_CHANGED (1 << 14)
 
+/** The session state change type of system variables */
+#define SESSION_TRACK_SYSTEM_VARIABLES 0
+
+/**
+ * Consume a length-encoded integer if it ends before @c end.
+ *
+ * @param c     Pointer to the first byte of the integer
+ * @param end   The end of the data
+ * @param value The value is stored here
+ * @return True if the integer was valid and ended before @c end
+ */
+static bool leint_consume_bounded(uint8_t** c, uint8_t* end, uint64_t* value)
+{
+    if (*c >= end || **c == 0xfb || **c == 0xff || *c + leint_bytes(*c) > end)
+    {
+        return false;
+    }
+
+    *value = leint_consume(c);
+    return true;
+}
+
+/**
+ * @brief Get the new value of a tracked system variable from an OK packet
+ *
+ * If the connection was made with session state tracking, the server reports
+ * the new values of the system variables listed in session_track_system_variables
+ * in the OK packet of the statement that changed them.
+ *
+ * @param packet The OK packet, including the header
+ * @param len    Length of the packet
+ * @param name   The name of the variable
+ * @param dest   Where the value is copied as a null-terminated string
+ * @param size   Size of @c dest
+ * @return True if the packet reported a new value for the variable
+ */
+bool mxs_mysql_get_tracked_variable(uint8_t* packet, size_t len, const char* name,
+                                    char* dest, size_t size)
+{
+    uint8_t* end = packet + len;
+    uint8_t* ptr = packet + 4;
+    uint64_t affected_rows;
+    uint64_t insert_id;
+    uint64_t n;
+
+    if (len < 5 || *ptr++ != 0x00 ||
+        !leint_consume_bounded(&ptr, end, &affected_rows) ||
+        !leint_consume_bounded(&ptr, end, &insert_id) ||
+        ptr + 4 > end || !((ptr[0] | (ptr[1] << 8)) & SERVER_STATUS_SESSION_STATE_CHANGED))
+    {
+        return false;
+    }
+
+    ptr += 4;
+
+    /** Skip the info string */
+    if (!leint_consume_bounded(&ptr, end, &n) || n > (uint64_t)(end - ptr))
+    {
+        return false;
+    }
+
+    ptr += n;
+
+    if (!leint_consume_bounded(&ptr, end, &n) || n > (uint64_t)(end - ptr))
+    {
+        return false;
+    }
+
+    uint8_t* state_end = ptr + n;
+    size_t name_len = strlen(name);
+    bool rval = false;
+
+    while (ptr < state_end)
+    {
+        uint8_t type = *ptr++;
+
+        if (!leint_consume_bounded(&ptr, state_end, &n) || n > (uint64_t)(state_end - ptr))
+        {
+            break;
+        }
+
+        uint8_t* data = ptr;
+        uint8_t* data_end = ptr + n;
+        uint64_t var_len;
+        uint64_t value_len;
+
+        ptr = data_end;
+
+        if (type == SESSION_TRACK_SYSTEM_VARIABLES &&
+            leint_consume_bounded(&data, data_end, &var_len) && var_len <= (uint64_t)(data_end - data))
+        {
+            uint8_t* var = data;
+            data += var_len;
+
+            if (var_len == name_len && strncasecmp((char*)var, name, name_len) == 0 &&
+                leint_consume_bounded(&data, data_end, &value_len) &&
+                value_len <= (uint64_t)(data_end - data) && value_len < size)
+            {
+                memcpy(dest, data, value_len);
+                dest[value_len] = '\0';
+                rval = true;
+            }
+        }
+    }
+
+    return rval;
+}
 
 /**
  * Creates a connection to a MySQL database engine. If necessary, initializes SSL.
@@ -18,6 +18,7 @@
 #include <signal.h>
 #include <sys/epoll.h>
 #include <errno.h>
+#include <limits.h>
 #include <maxscale/alloc.h>
 #include <maxscale/poll.h>
 #include <dcb.h>
@@ -82,7 +83,6 @@ int max_poll_sleep;
  */
 #define MUTEX_EPOLL     0
 
-static int epoll_fd = -1;    /*< The epoll file descriptor */
 static int do_shutdown = 0;  /*< Flag the shutdown of the poll subsystem */
 static GWBITMASK poll_mask;
 #if MUTEX_EPOLL
@@ -94,8 +94,35 @@ static int process_pollq(int thread_id);
 static void poll_add_event_to_dcb(DCB* dcb, GWBUF* buf, __uint32_t ev);
 static bool poll_dcb_session_check(DCB *dcb, const char *);
 
-DCB *eventq = NULL;
-SPINLOCK pollqlock = SPINLOCK_INIT;
+/**
+ * A queue of DCBs that have events pending processing, together with the
+ * epoll instance that feeds it.
+ *
+ * By default there is a single queue which is shared by all polling threads.
+ * When per-thread event queues are enabled, each polling thread waits on its
+ * own epoll instance and places the events on its own queue. A thread that
+ * finds its own queue empty will steal DCBs from the queues of the other
+ * threads.
+ *
+ * A DCB is only ever placed on the queue identified by dcb->evq.queue and the
+ * event queue fields of the DCB are protected by the lock of that queue. This
+ * guarantees that a DCB is never processed by two threads at the same time,
+ * regardless of which thread picks it up.
+ */
+typedef struct
+{
+    SPINLOCK lock;      /*< Protects the queue and the event data of its DCBs */
+    DCB      *head;     /*< The first DCB in the queue */
+    int      epoll_fd;  /*< The epoll instance of the queue */
+    int      length;    /*< Event queue length */
+    int      pending;   /*< Number of pending descriptors in event queue */
+    int      max;       /*< Maximum event queue length */
+    int      n_stolen;  /*< Number of DCBs processed by other threads */
+} EVENT_QUEUE;
+
+static EVENT_QUEUE *event_queues = NULL; /*< The event queues */
+static int n_queues = 0;                 /*< No. of event queues */
+static int next_queue = 0;               /*< Next queue to assign a DCB to */
 
 /**
  * Thread load average, this is the average number of descriptors in each
@@ -135,6 +162,7 @@ typedef struct
     int n_fds;          /*< No. of descriptors thread is processing */
     DCB *cur_dcb;       /*< Current DCB being processed */
     uint32_t event;     /*< Current event being processed */
+    int n_steals;       /*< No. of DCBs taken from the queues of other threads */
 } THREAD_DATA;
 
 static THREAD_DATA *thread_data = NULL;    /*< Status of each thread */
@@ -165,9 +193,6 @@ static struct
     ts_stats_t *n_nbpollev;     /*< Number of polls returning events */
     ts_stats_t *n_nothreads;    /*< Number of times no threads are polling */
     int n_fds[MAXNFDS];         /*< Number of wakeups with particular n_fds value */
-    int evq_length;             /*< Event queue length */
-    int evq_pending;            /*< Number of pending descriptors in event queue */
-    int evq_max;                /*< Maximum event queue length */
     int wake_evqpending;        /*< Woken from epoll_wait with pending events in queue */
     ts_stats_t *blockingpolls;  /*< Number of epoll_waits with a timeout specified */
 } pollStats;
@@ -199,6 +224,15 @@ static void poll_loadav(void *);
  */
 static int poll_resolve_error(DCB *, int, bool);
 
+static void poll_assign_queue(DCB *dcb);
+static EVENT_QUEUE *poll_lock_queue(DCB *dcb);
+static DCB *poll_next_dcb(EVENT_QUEUE *queue);
+static void poll_queue_dcb(EVENT_QUEUE *queue, DCB *dcb, uint32_t ev);
+static int poll_evq_length();
+static int poll_evq_pending();
+static int poll_evq_max();
+static void dShowThreadQueues(DCB *dcb);
+
 /**
  * Initialise the polling system we are using for the gateway.
  *
@@ -209,29 +243,42 @@ poll_init()
 {
     int i;
 
-    if (epoll_fd != -1)
+    if (event_queues)
     {
         return;
     }
-    if ((epoll_fd = epoll_create(MAX_EVENTS)) == -1)
-    {
-        char errbuf[STRERROR_BUFLEN];
-        MXS_ERROR("FATAL: Could not create epoll instance: %s", strerror_r(errno, errbuf, sizeof(errbuf)));
-        exit(-1);
-    }
     memset(&pollStats, 0, sizeof(pollStats));
     memset(&queueStats, 0, sizeof(queueStats));
     bitmask_init(&poll_mask);
     n_threads = config_threadcount();
     thread_data = (THREAD_DATA *)MXS_MALLOC(n_threads * sizeof(THREAD_DATA));
-    if (thread_data);
+    if (thread_data)
     {
         for (i = 0; i < n_threads; i++)
         {
             thread_data[i].state = THREAD_STOPPED;
+            thread_data[i].n_steals = 0;
         }
     }
 
+    n_queues = (config_per_thread_queues() && n_threads > 1) ? n_threads : 1;
+    event_queues = (EVENT_QUEUE *)MXS_CALLOC(n_queues, sizeof(EVENT_QUEUE));
+    MXS_ABORT_IF_NULL(event_queues);
+    for (i = 0; i < n_queues; i++)
+    {
+        spinlock_init(&event_queues[i].lock);
+        if ((event_queues[i].epoll_fd = epoll_create(MAX_EVENTS)) == -1)
+        {
+            char errbuf[STRERROR_BUFLEN];
+            MXS_ERROR("FATAL: Could not create epoll instance: %s", strerror_r(errno, errbuf, sizeof(errbuf)));
+            exit(-1);
+        }
+    }
+    if (n_queues > 1)
+    {
+        MXS_NOTICE("Using %d per-thread event queues.", n_queues);
+    }
+
     if ((pollStats.n_read = ts_stats_alloc()) == NULL ||
         (pollStats.n_write = ts_stats_alloc()) == NULL ||
         (pollStats.n_error = ts_stats_alloc()) == NULL ||
@@ -336,11 +383,17 @@ poll_add_dcb(DCB *dcb)
     }
     dcb->state = new_state;
     spinlock_release(&dcb->dcb_initlock);
+
+    if (old_state != DCB_STATE_POLLING && old_state != DCB_STATE_LISTENING)
+    {
+        poll_assign_queue(dcb);
+    }
+
     /*
      * The only possible failure that will not cause a crash is
      * running out of system resources.
      */
-    rc = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dcb->fd, &ev);
+    rc = epoll_ctl(event_queues[dcb->evq.queue].epoll_fd, EPOLL_CTL_ADD, dcb->fd, &ev);
     if (rc)
     {
         /* Some errors are actually considered acceptable */
@@ -407,7 +460,7 @@ poll_remove_dcb(DCB *dcb)
     spinlock_release(&dcb->dcb_initlock);
     if (dcbfd > 0)
     {
-        rc = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, dcbfd, &ev);
+        rc = epoll_ctl(event_queues[dcb->evq.queue].epoll_fd, EPOLL_CTL_DEL, dcbfd, &ev);
         /**
          * The poll_resolve_error function will always
          * return 0 or crash.  So if it returns non-zero result,
@@ -425,6 +478,119 @@ poll_remove_dcb(DCB *dcb)
     return rc;
 }
 
+/**
+ * Choose the event queue, and thus the polling thread, that will handle the
+ * events of a DCB that is being added to the poll set.
+ *
+ * Backend DCBs are placed on the queue of the client DCB of their session so
+ * that all events of a session are normally handled by the same thread. Other
+ * DCBs are spread over the queues in a round-robin fashion. The queue of a DCB
+ * is only changed when the DCB is not on any event queue.
+ *
+ * @param dcb   The DCB being added to the poll set
+ */
+static void
+poll_assign_queue(DCB *dcb)
+{
+    EVENT_QUEUE *queue;
+    int target;
+
+    if (n_queues == 1)
+    {
+        return;
+    }
+
+    if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER && dcb->session &&
+        dcb->session->client_dcb && dcb->session->client_dcb != dcb)
+    {
+        target = dcb->session->client_dcb->evq.queue;
+    }
+    else
+    {
+        target = (atomic_add(&next_queue, 1) & INT_MAX) % n_queues;
+    }
+
+    queue = poll_lock_queue(dcb);
+    if (!DCB_POLL_BUSY(dcb))
+    {
+        dcb->evq.queue = target;
+    }
+    spinlock_release(&queue->lock);
+}
+
+/**
+ * Lock the event queue that a DCB belongs to
+ *
+ * The queue of a DCB may be changed by poll_assign_queue, so the queue index is
+ * checked again once the lock has been acquired.
+ *
+ * @param dcb   The DCB whose queue should be locked
+ * @return      The locked queue
+ */
+static EVENT_QUEUE *
+poll_lock_queue(DCB *dcb)
+{
+    EVENT_QUEUE *queue;
+
+    while (1)
+    {
+        int index = dcb->evq.queue;
+        queue = &event_queues[index];
+        spinlock_acquire(&queue->lock);
+        if (dcb->evq.queue == index)
+        {
+            return queue;
+        }
+        spinlock_release(&queue->lock);
+    }
+}
+
+/**
+ * Add events to a DCB and place it at the end of the event queue if it is
+ * not already in the queue. The caller must hold the lock of the queue.
+ *
+ * @param queue The event queue of the DCB
+ * @param dcb   The DCB that has new events
+ * @param ev    The new events
+ */
+static void
+poll_queue_dcb(EVENT_QUEUE *queue, DCB *dcb, uint32_t ev)
+{
+    if (DCB_POLL_BUSY(dcb))
+    {
+        if (dcb->evq.pending_events == 0)
+        {
+            queue->pending++;
+            dcb->evq.inserted = hkheartbeat;
+        }
+        dcb->evq.pending_events |= ev;
+    }
+    else
+    {
+        dcb->evq.pending_events = ev;
+        if (queue->head)
+        {
+            dcb->evq.prev = queue->head->evq.prev;
+            queue->head->evq.prev->evq.next = dcb;
+            queue->head->evq.prev = dcb;
+            dcb->evq.next = queue->head;
+        }
+        else
+        {
+            queue->head = dcb;
+            dcb->evq.prev = dcb;
+            dcb->evq.next = dcb;
+        }
+        queue->length++;
+        queue->pending++;
+        dcb->evq.inserted = hkheartbeat;
+        if (queue->length > queue->max)
+        {
+            queue->max = queue->length;
+        }
+    }
+}
+
 /**
  * Check error returns from epoll_ctl. Most result in a crash since they
  * are "impossible". Adding when already present is assumed non-fatal.
@@ -561,9 +727,13 @@ poll_waitevents(void *arg)
     int i, nfds, timeout_bias = 1;
     intptr_t thread_id = (intptr_t)arg;
     int poll_spins = 0;
+    int epoll_fd = event_queues[thread_id % n_queues].epoll_fd;
 
     /** Add this thread to the bitmask of running polling threads */
     bitmask_set(&poll_mask, thread_id);
+
+    /** Take part in the reclamation of zombie DCBs before any DCBs are used */
+    dcb_process_zombies(thread_id);
     if (thread_data)
     {
         thread_data[thread_id].state = THREAD_IDLE;
@@ -571,7 +741,7 @@ poll_waitevents(void *arg)
 
     while (1)
     {
-        if (pollStats.evq_pending == 0 && timeout_bias < 10)
+        if (poll_evq_pending() == 0 && timeout_bias < 10)
         {
             timeout_bias++;
         }
@@ -610,14 +780,14 @@ poll_waitevents(void *arg)
          * We calculate a timeout bias to alter the length of the blocking
          * call based on the time since we last received an event to process
          */
-        else if (nfds == 0 && pollStats.evq_pending == 0 && poll_spins++ > number_poll_spins)
+        else if (nfds == 0 && poll_evq_pending() == 0 && poll_spins++ > number_poll_spins)
         {
             ts_stats_increment(pollStats.blockingpolls, thread_id);
             nfds = epoll_wait(epoll_fd,
                               events,
                               MAX_EVENTS,
                               (max_poll_sleep * timeout_bias) / 10);
-            if (nfds == 0 && pollStats.evq_pending)
+            if (nfds == 0 && poll_evq_pending())
             {
                 atomic_add(&pollStats.wake_evqpending, 1);
                 poll_spins = 0;
@@ -677,41 +847,9 @@ poll_waitevents(void *arg)
                 DCB *dcb = (DCB *)events[i].data.ptr;
                 __uint32_t ev = events[i].events;
 
-                spinlock_acquire(&pollqlock);
-                if (DCB_POLL_BUSY(dcb))
-                {
-                    if (dcb->evq.pending_events == 0)
-                    {
-                        pollStats.evq_pending++;
-                        dcb->evq.inserted = hkheartbeat;
-                    }
-                    dcb->evq.pending_events |= ev;
-                }
-                else
-                {
-                    dcb->evq.pending_events = ev;
-                    if (eventq)
-                    {
-                        dcb->evq.prev = eventq->evq.prev;
-                        eventq->evq.prev->evq.next = dcb;
-                        eventq->evq.prev = dcb;
-                        dcb->evq.next = eventq;
-                    }
-                    else
-                    {
-                        eventq = dcb;
-                        dcb->evq.prev = dcb;
-                        dcb->evq.next = dcb;
-                    }
-                    pollStats.evq_length++;
-                    pollStats.evq_pending++;
-                    dcb->evq.inserted = hkheartbeat;
-                    if (pollStats.evq_length > pollStats.evq_max)
-                    {
-                        pollStats.evq_max = pollStats.evq_length;
-                    }
-                }
-                spinlock_release(&pollqlock);
+                EVENT_QUEUE *queue = poll_lock_queue(dcb);
+                poll_queue_dcb(queue, dcb, ev);
+                spinlock_release(&queue->lock);
             }
         }
 
@@ -814,56 +952,43 @@ poll_set_maxwait(unsigned int maxwait)
 static int
 process_pollq(int thread_id)
 {
-    DCB *dcb;
-    int found = 0;
+    EVENT_QUEUE *queue;
+    DCB *dcb = NULL;
     uint32_t ev;
     unsigned long qtime;
+    int own_queue = thread_id % n_queues;
+    int i;
 
-    spinlock_acquire(&pollqlock);
-    if (eventq == NULL)
-    {
-        /* Nothing to process */
-        spinlock_release(&pollqlock);
-        return 0;
-    }
-    dcb = eventq;
-    if (dcb->evq.next == dcb->evq.prev && dcb->evq.processing == 0)
-    {
-        found = 1;
-        dcb->evq.processing = 1;
-    }
-    else if (dcb->evq.next == dcb->evq.prev)
-    {
-        /* Only item in queue is being processed */
-        spinlock_release(&pollqlock);
-        return 0;
-    }
-    else
+    /*
+     * Look at the queue of this thread first. If it has nothing that can be
+     * processed, try to steal a DCB from the queues of the other threads. The
+     * pending counts are read without the lock so that the queues of idle
+     * threads are not locked needlessly.
+     */
+    for (i = 0; i < n_queues && dcb == NULL; i++)
     {
-        do
+        queue = &event_queues[(own_queue + i) % n_queues];
+        if (i > 0 && queue->pending == 0)
         {
-            dcb = dcb->evq.next;
+            continue;
         }
-        while (dcb != eventq && dcb->evq.processing == 1);
-
-        if (dcb->evq.processing == 0)
+        spinlock_acquire(&queue->lock);
+        if ((dcb = poll_next_dcb(queue)) != NULL)
         {
-            /* Found DCB to process */
-            dcb->evq.processing = 1;
-            found = 1;
+            ev = dcb->evq.processing_events;
+            if (i > 0)
+            {
+                queue->n_stolen++;
+                if (thread_data)
+                {
+                    thread_data[thread_id].n_steals++;
+                }
+            }
         }
+        spinlock_release(&queue->lock);
     }
-    if (found)
-    {
-        ev = dcb->evq.pending_events;
-        dcb->evq.processing_events = ev;
-        dcb->evq.pending_events = 0;
-        pollStats.evq_pending--;
-        ss_dassert(pollStats.evq_pending >= 0);
-    }
-    spinlock_release(&pollqlock);
 
-    if (found == 0)
+    if (dcb == NULL)
     {
         return 0;
     }
@@ -1129,7 +1254,7 @@ process_pollq(int thread_id)
         queueStats.maxexectime = qtime;
     }
 
-    spinlock_acquire(&pollqlock);
+    queue = poll_lock_queue(dcb);
     dcb->evq.processing_events = 0;
 
     if (dcb->evq.pending_events == 0)
@@ -1139,18 +1264,18 @@ process_pollq(int thread_id)
         {
             dcb->evq.prev->evq.next = dcb->evq.next;
             dcb->evq.next->evq.prev = dcb->evq.prev;
-            if (eventq == dcb)
+            if (queue->head == dcb)
             {
-                eventq = dcb->evq.next;
+                queue->head = dcb->evq.next;
             }
         }
         else
         {
-            eventq = NULL;
+            queue->head = NULL;
         }
         dcb->evq.next = NULL;
         dcb->evq.prev = NULL;
-        pollStats.evq_length--;
+        queue->length--;
     }
     else
     {
@@ -1159,21 +1284,21 @@ process_pollq(int thread_id)
          * if there are any other DCB's in the queue.
          *
          * If we are the first item on the queue this is easy, we
-         * just bump the eventq pointer.
+         * just bump the queue head pointer.
          */
         if (dcb->evq.prev != dcb)
         {
-            if (eventq == dcb)
+            if (queue->head == dcb)
             {
-                eventq = dcb->evq.next;
+                queue->head = dcb->evq.next;
             }
             else
             {
                 dcb->evq.prev->evq.next = dcb->evq.next;
                 dcb->evq.next->evq.prev = dcb->evq.prev;
-                dcb->evq.prev = eventq->evq.prev;
-                dcb->evq.next = eventq;
-                eventq->evq.prev = dcb;
+                dcb->evq.prev = queue->head->evq.prev;
+                dcb->evq.next = queue->head;
+                queue->head->evq.prev = dcb;
                 dcb->evq.prev->evq.next = dcb;
             }
         }
@@ -1181,11 +1306,59 @@ process_pollq(int thread_id)
     dcb->evq.processing = 0;
     /** Reset session id from thread's local storage */
     mxs_log_tls.li_sesid = 0;
-    spinlock_release(&pollqlock);
+    spinlock_release(&queue->lock);
 
     return 1;
 }
 
+/**
+ * Find the first DCB in an event queue that is not being processed by another
+ * thread and mark it as being processed. The caller must hold the queue lock.
+ *
+ * @param queue The event queue
+ * @return      The DCB to process or NULL if there is nothing to process
+ */
+static DCB *
+poll_next_dcb(EVENT_QUEUE *queue)
+{
+    DCB *dcb = queue->head;
+
+    if (dcb == NULL)
+    {
+        /* Nothing to process */
+        return NULL;
+    }
+
+    if (dcb->evq.next == dcb->evq.prev && dcb->evq.processing == 1)
+    {
+        /* Only item in queue is being processed */
+        return NULL;
+    }
+
+    if (dcb->evq.next != dcb->evq.prev)
+    {
+        do
+        {
+            dcb = dcb->evq.next;
+        }
+        while (dcb != queue->head && dcb->evq.processing == 1);
+
+        if (dcb->evq.processing == 1)
+        {
+            return NULL;
+        }
+    }
+
+    /* Found DCB to process */
+    dcb->evq.processing = 1;
+    dcb->evq.processing_events = dcb->evq.pending_events;
+    dcb->evq.pending_events = 0;
+    queue->pending--;
+    ss_dassert(queue->pending >= 0);
+
+    return dcb;
+}
+
 /**
  *
  * Check that the DCB has a session link before processing.
@@ -1279,11 +1452,11 @@ dprintPollStats(DCB *dcb)
     dcb_printf(dcb, "No. of times no threads polling:               %d\n",
                ts_stats_sum(pollStats.n_nothreads));
     dcb_printf(dcb, "Current event queue length:                    %d\n",
-               pollStats.evq_length);
+               poll_evq_length());
     dcb_printf(dcb, "Maximum event queue length:                    %d\n",
-               pollStats.evq_max);
+               poll_evq_max());
     dcb_printf(dcb, "No. of DCBs with pending events:               %d\n",
-               pollStats.evq_pending);
+               poll_evq_pending());
     dcb_printf(dcb, "No. of wakeups with pending queue:             %d\n",
                pollStats.wake_evqpending);
 
@@ -1297,8 +1470,11 @@ dprintPollStats(DCB *dcb)
                pollStats.n_fds[MAXNFDS - 1]);
 
 #if SPINLOCK_PROFILE
-    dcb_printf(dcb, "Event queue lock statistics:\n");
-    spinlock_stats(&pollqlock, spin_reporter, dcb);
+    for (i = 0; i < n_queues; i++)
+    {
+        dcb_printf(dcb, "Event queue %d lock statistics:\n", i);
+        spinlock_stats(&event_queues[i].lock, spin_reporter, dcb);
+    }
 #endif
 }
 
@@ -1361,6 +1537,35 @@ event_to_string(uint32_t event)
     return str;
 }
 
+/**
+ * Print the depth and work stealing counters of the per-thread event queues.
+ * Nothing is printed if a single shared event queue is used.
+ *
+ * @param dcb   The DCB to print to
+ */
+static void
+dShowThreadQueues(DCB *dcb)
+{
+    int i;
+
+    if (n_queues == 1)
+    {
+        return;
+    }
+
+    dcb_printf(dcb, "Per-thread event queues.\n\n");
+    dcb_printf(dcb, " ID | Length | Pending | Max length | Stolen     | Steals\n");
+    dcb_printf(dcb, "----+--------+---------+------------+------------+-----------\n");
+    for (i = 0; i < n_queues; i++)
+    {
+        dcb_printf(dcb, " %2d | %6d | %7d | %10d | %-10d | %-10d\n", i,
+                   event_queues[i].length, event_queues[i].pending,
+                   event_queues[i].max, event_queues[i].n_stolen,
+                   thread_data && i < n_threads ? thread_data[i].n_steals : 0);
+    }
+    dcb_printf(dcb, "\n");
+}
+
 /**
  * Print the thread status for all the polling threads
  *
@@ -1487,6 +1692,8 @@ dShowThreads(DCB *dcb)
             }
         }
     }
+    dcb_printf(dcb, "\n");
+    dShowThreadQueues(dcb);
 }
 
 /**
@@ -1516,7 +1723,7 @@ poll_loadav(void *data)
         current_avg = 0.0;
     }
     avg_samples[next_sample] = current_avg;
-    evqp_samples[next_sample] = pollStats.evq_pending;
+    evqp_samples[next_sample] = poll_evq_pending();
     next_sample++;
     if (next_sample >= n_avg_samples)
     {
@@ -1553,43 +1760,10 @@ static void poll_add_event_to_dcb(DCB*       dcb,
     dcb->dcb_readqueue = gwbuf_append(dcb->dcb_readqueue, buf);
     spinlock_release(&dcb->authlock);
 
-    spinlock_acquire(&pollqlock);
-
-    /** Set event to DCB */
-    if (DCB_POLL_BUSY(dcb))
-    {
-        if (dcb->evq.pending_events == 0)
-        {
-            pollStats.evq_pending++;
-        }
-        dcb->evq.pending_events |= ev;
-    }
-    else
-    {
-        dcb->evq.pending_events = ev;
-        /** Add DCB to eventqueue if it isn't already there */
-        if (eventq)
-        {
-            dcb->evq.prev = eventq->evq.prev;
-            eventq->evq.prev->evq.next = dcb;
-            eventq->evq.prev = dcb;
-            dcb->evq.next = eventq;
-        }
-        else
-        {
-            eventq = dcb;
-            dcb->evq.prev = dcb;
-            dcb->evq.next = dcb;
-        }
-        pollStats.evq_length++;
-        pollStats.evq_pending++;
-
-        if (pollStats.evq_length > pollStats.evq_max)
-        {
-            pollStats.evq_max = pollStats.evq_length;
-        }
-    }
-    spinlock_release(&pollqlock);
+    /** Set event to DCB and add it to the event queue if it isn't already there */
+    EVENT_QUEUE *queue = poll_lock_queue(dcb);
+    poll_queue_dcb(queue, dcb, ev);
+    spinlock_release(&queue->lock);
 }
 
 /*
@@ -1646,8 +1820,7 @@ poll_fake_read_event(DCB *dcb)
 void
 poll_fake_event(DCB *dcb, enum EPOLL_EVENTS ev)
 {
-
-    spinlock_acquire(&pollqlock);
+    EVENT_QUEUE *queue = poll_lock_queue(dcb);
     /*
      * If the DCB is already on the queue, there are no pending events and
      * there are other events on the queue, then
@@ -1657,49 +1830,17 @@ poll_fake_event(DCB *dcb, enum EPOLL_EVENTS ev)
     {
         dcb->evq.prev->evq.next = dcb->evq.next;
         dcb->evq.next->evq.prev = dcb->evq.prev;
-        if (eventq == dcb)
+        if (queue->head == dcb)
         {
-            eventq = dcb->evq.next;
+            queue->head = dcb->evq.next;
         }
         dcb->evq.next = NULL;
         dcb->evq.prev = NULL;
-        pollStats.evq_length--;
+        queue->length--;
     }
 
-    if (DCB_POLL_BUSY(dcb))
-    {
-        if (dcb->evq.pending_events == 0)
-        {
-            pollStats.evq_pending++;
-        }
-        dcb->evq.pending_events |= ev;
-    }
-    else
-    {
-        dcb->evq.pending_events = ev;
-        dcb->evq.inserted = hkheartbeat;
-        if (eventq)
-        {
-            dcb->evq.prev = eventq->evq.prev;
-            eventq->evq.prev->evq.next = dcb;
-            eventq->evq.prev = dcb;
-            dcb->evq.next = eventq;
-        }
-        else
-        {
-            eventq = dcb;
-            dcb->evq.prev = dcb;
-            dcb->evq.next = dcb;
-        }
-        pollStats.evq_length++;
-        pollStats.evq_pending++;
-        dcb->evq.inserted = hkheartbeat;
-        if (pollStats.evq_length > pollStats.evq_max)
-        {
-            pollStats.evq_max = pollStats.evq_length;
-        }
-    }
-    spinlock_release(&pollqlock);
+    poll_queue_dcb(queue, dcb, ev);
+    spinlock_release(&queue->lock);
 }
 
 /*
@@ -1718,41 +1859,9 @@ poll_fake_hangup_event(DCB *dcb)
     uint32_t ev = EPOLLHUP;
 #endif
 
-    spinlock_acquire(&pollqlock);
-    if (DCB_POLL_BUSY(dcb))
-    {
-        if (dcb->evq.pending_events == 0)
-        {
-            pollStats.evq_pending++;
-        }
-        dcb->evq.pending_events |= ev;
-    }
-    else
-    {
-        dcb->evq.pending_events = ev;
-        dcb->evq.inserted = hkheartbeat;
-        if (eventq)
-        {
-            dcb->evq.prev = eventq->evq.prev;
-            eventq->evq.prev->evq.next = dcb;
-            eventq->evq.prev = dcb;
-            dcb->evq.next = eventq;
-        }
-        else
-        {
-            eventq = dcb;
-            dcb->evq.prev = dcb;
-            dcb->evq.next = dcb;
-        }
-        pollStats.evq_length++;
-        pollStats.evq_pending++;
-        dcb->evq.inserted = hkheartbeat;
-        if (pollStats.evq_length > pollStats.evq_max)
-        {
-            pollStats.evq_max = pollStats.evq_length;
-        }
-    }
-    spinlock_release(&pollqlock);
+    EVENT_QUEUE *queue = poll_lock_queue(dcb);
+    poll_queue_dcb(queue, dcb, ev);
+    spinlock_release(&queue->lock);
 }
 
 /**
@@ -1765,31 +1874,44 @@ dShowEventQ(DCB *pdcb)
 {
     DCB *dcb;
     char *tmp1, *tmp2;
+    int i;
 
-    spinlock_acquire(&pollqlock);
-    if (eventq == NULL)
+    for (i = 0; i < n_queues; i++)
     {
-        /* Nothing to process */
-        spinlock_release(&pollqlock);
-        return;
+        EVENT_QUEUE *queue = &event_queues[i];
+
+        spinlock_acquire(&queue->lock);
+        if (queue->head == NULL)
+        {
+            /* Nothing to process */
+            spinlock_release(&queue->lock);
+            continue;
+        }
+        dcb = queue->head;
+        if (n_queues > 1)
+        {
+            dcb_printf(pdcb, "\nEvent Queue of thread %d.\n", i);
+        }
+        else
+        {
+            dcb_printf(pdcb, "\nEvent Queue.\n");
+        }
+        dcb_printf(pdcb, "%-16s | %-10s | %-18s | %s\n", "DCB", "Status", "Processing Events",
+                   "Pending Events");
+        dcb_printf(pdcb, "-----------------+------------+--------------------+-------------------\n");
+        do
+        {
+            dcb_printf(pdcb, "%-16p | %-10s | %-18s | %-18s\n", dcb,
+                       dcb->evq.processing ? "Processing" : "Pending",
+                       (tmp1 = event_to_string(dcb->evq.processing_events)),
+                       (tmp2 = event_to_string(dcb->evq.pending_events)));
+            MXS_FREE(tmp1);
+            MXS_FREE(tmp2);
+            dcb = dcb->evq.next;
+        }
+        while (dcb != queue->head);
+        spinlock_release(&queue->lock);
     }
-    dcb = eventq;
-    dcb_printf(pdcb, "\nEvent Queue.\n");
-    dcb_printf(pdcb, "%-16s | %-10s | %-18s | %s\n", "DCB", "Status", "Processing Events",
-               "Pending Events");
-    dcb_printf(pdcb, "-----------------+------------+--------------------+-------------------\n");
-    do
-    {
-        dcb_printf(pdcb, "%-16p | %-10s | %-18s | %-18s\n", dcb,
-                   dcb->evq.processing ? "Processing" : "Pending",
-                   (tmp1 = event_to_string(dcb->evq.processing_events)),
-                   (tmp2 = event_to_string(dcb->evq.pending_events)));
-        MXS_FREE(tmp1);
-        MXS_FREE(tmp2);
-        dcb = dcb->evq.next;
-    }
-    while (dcb != eventq);
-    spinlock_release(&pollqlock);
 }
 
 
@@ -1806,9 +1928,10 @@ dShowEventStats(DCB *pdcb)
     dcb_printf(pdcb, "\nEvent statistics.\n");
     dcb_printf(pdcb, "Maximum queue time:           %3lu00ms\n", queueStats.maxqtime);
     dcb_printf(pdcb, "Maximum execution time:       %3lu00ms\n", queueStats.maxexectime);
-    dcb_printf(pdcb, "Maximum event queue length:   %3d\n", pollStats.evq_max);
-    dcb_printf(pdcb, "Current event queue length:   %3d\n", pollStats.evq_length);
+    dcb_printf(pdcb, "Maximum event queue length:   %3d\n", poll_evq_max());
+    dcb_printf(pdcb, "Current event queue length:   %3d\n", poll_evq_length());
     dcb_printf(pdcb, "\n");
+    dShowThreadQueues(pdcb);
     dcb_printf(pdcb, "               |    Number of events\n");
     dcb_printf(pdcb, "Duration       | Queued     | Executed\n");
     dcb_printf(pdcb, "---------------+------------+-----------\n");
@@ -1845,11 +1968,11 @@ poll_get_stat(POLL_STAT stat)
     case POLL_STAT_ACCEPT:
         return ts_stats_sum(pollStats.n_accept);
     case POLL_STAT_EVQ_LEN:
-        return pollStats.evq_length;
+        return poll_evq_length();
     case POLL_STAT_EVQ_PENDING:
-        return pollStats.evq_pending;
+        return poll_evq_pending();
     case POLL_STAT_EVQ_MAX:
-        return pollStats.evq_max;
+        return poll_evq_max();
     case POLL_STAT_MAX_QTIME:
         return (int)queueStats.maxqtime;
     case POLL_STAT_MAX_EXECTIME:
@@ -1858,6 +1981,60 @@ poll_get_stat(POLL_STAT stat)
     return 0;
 }
 
+/**
+ * Return the combined length of the event queues
+ *
+ * @return The number of DCBs in the event queues
+ */
+static int
+poll_evq_length()
+{
+    int i, rval = 0;
+
+    for (i = 0; i < n_queues; i++)
+    {
+        rval += event_queues[i].length;
+    }
+    return rval;
+}
+
+/**
+ * Return the number of DCBs with pending events in all the event queues
+ *
+ * @return The number of DCBs with pending events
+ */
+static int
+poll_evq_pending()
+{
+    int i, rval = 0;
+
+    for (i = 0; i < n_queues; i++)
+    {
+        rval += event_queues[i].pending;
+    }
+    return rval;
+}
+
+/**
+ * Return the maximum length any of the event queues has reached
+ *
+ * @return The maximum event queue length
+ */
+static int
+poll_evq_max()
+{
+    int i, rval = 0;
+
+    for (i = 0; i < n_queues; i++)
+    {
+        if (event_queues[i].max > rval)
+        {
+            rval = event_queues[i].max;
+        }
+    }
+    return rval;
+}
+
 /**
  * Provide a row to the result set that defines the event queue statistics
  *
@@ -267,6 +267,14 @@ char** qc_get_database_names(GWBUF* query, int* sizep)
     return classifier->qc_get_database_names(query, sizep);
 }
 
+bool qc_get_cache_stats(QC_CACHE_STATS* stats)
+{
+    QC_TRACE();
+    ss_dassert(classifier);
+
+    return classifier->qc_get_cache_stats ? classifier->qc_get_cache_stats(stats) : false;
+}
+
 /**
  * Returns the string representation of a query operation.
  *
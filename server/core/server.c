@@ -508,6 +508,10 @@ dprintServer(DCB *dcb, SERVER *server)
     dcb_printf(dcb, "\tNumber of connections:               %d\n", server->stats.n_connections);
     dcb_printf(dcb, "\tCurrent no. of conns:                %d\n", server->stats.n_current);
     dcb_printf(dcb, "\tCurrent no. of operations:           %d\n", server->stats.n_current_ops);
+    if (server->stats.response_time)
+    {
+        dcb_printf(dcb, "\tAverage response time (us):          %d\n", server->stats.response_time);
+    }
     if (server->persistpoolmax)
     {
         dcb_printf(dcb, "\tPersistent pool size:                %d\n", server->stats.n_persistent);
@@ -42,6 +42,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <mysql.h>
 #include <session.h>
 #include <service.h>
 #include <gw_protocol.h>
@@ -67,6 +68,8 @@
 #include <version.h>
 #include <queuemanager.h>
 #include <maxscale/alloc.h>
+#include <atomic.h>
+#include <thread.h>
 
 /** To be used with configuration type checks */
 typedef struct typelib_st
@@ -98,6 +101,8 @@ static void service_add_qualified_param(SERVICE*          svc,
                                         CONFIG_PARAMETER* param);
 static void service_internal_restart(void *data);
 static void service_queue_check(void *data);
+static int service_load_listener_users(SERV_LISTENER *port);
+static void service_users_refresh_task(void *data);
 
 /**
  * Allocate a new service for the gateway to support
@@ -300,7 +305,7 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
     /** Load the authentication users before before starting the listener */
     if (port->listener->authfunc.loadusers &&
         (service->router->getCapabilities() & RCAP_TYPE_NO_USERS_INIT) == 0 &&
-        port->listener->authfunc.loadusers(port) != AUTH_LOADUSERS_OK)
+        service_load_listener_users(port) != AUTH_LOADUSERS_OK)
     {
         MXS_ERROR("[%s] Failed to load users for listener '%s', authentication might not work.",
                   service->name, port->name);
@@ -459,6 +464,7 @@ serviceStart(SERVICE *service)
                                             service, router_options)))
         {
             listeners += serviceStartAllPorts(service);
+            serviceSetUsersRefreshTime(service, service->users_refresh_time);
         }
         else
         {
@@ -610,6 +616,18 @@ service_free(SERVICE *service)
     {
         return 0;
     }
+
+    serviceSetUsersRefreshTime(service, 0);
+
+    /**
+     * Wait for a background users load to complete. The flag is taken and
+     * never released so that no new load of the users of this service starts.
+     */
+    while (__sync_lock_test_and_set(&service->users_loading, 1))
+    {
+        thread_millisleep(10);
+    }
+
     /* First of all remove from the linked list */
     spinlock_acquire(&service_spin);
     if (allServices == service)
@@ -1285,7 +1303,25 @@ void dprintService(DCB *dcb, SERVICE *service)
     SERV_LISTENER *port = service->ports;
     while (port)
     {
+        LISTENER_AUTH_STATS *stats = &port->auth_stats;
+
+        dcb_printf(dcb, "\tListener:                            %s\n", port->name);
         dcb_printf(dcb, "\tUsers data:                          %p\n", port->users);
+        dcb_printf(dcb, "\tAuthentications:                     %d\n", stats->n_authentications);
+        dcb_printf(dcb, "\tFailed authentications:              %d\n", stats->n_failed);
+        dcb_printf(dcb, "\tAuthentication cache hits:           %d\n", stats->n_cache_hits);
+        dcb_printf(dcb, "\tAuthentication cache misses:         %d\n", stats->n_cache_misses);
+        dcb_printf(dcb, "\tTime spent in authentication:        %.3f ms\n", stats->auth_time / 1000.0);
+        dcb_printf(dcb, "\tUsers loads:                         %d\n", port->load_stats.n_loads);
+        dcb_printf(dcb, "\tFailed users loads:                  %d\n", port->load_stats.n_failed);
+        dcb_printf(dcb, "\tUsers loaded:                        %d\n", port->load_stats.n_users);
+        dcb_printf(dcb, "\tLast users load took:                %.3f ms\n",
+                   port->load_stats.load_time / 1000.0);
+        if (port->load_stats.last_load)
+        {
+            dcb_printf(dcb, "\tSeconds since last users load:       %ld\n",
+                       (long)(time(NULL) - port->load_stats.last_load));
+        }
         port = port->next;
     }
 
@@ -1417,11 +1453,212 @@ service_update(SERVICE *service, char *router, char *user, char *auth)
     }
 }
 
+/**
+ * Load the users of a listener and update its load statistics
+ *
+ * @param port The listener
+ * @return AUTH_LOADUSERS_OK on success, AUTH_LOADUSERS_ERROR on error
+ */
+static int service_load_listener_users(SERV_LISTENER *port)
+{
+    if (port->listener == NULL || port->listener->authfunc.loadusers == NULL)
+    {
+        return AUTH_LOADUSERS_OK;
+    }
+
+    LISTENER_LOAD_STATS *stats = &port->load_stats;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int rc = port->listener->authfunc.loadusers(port);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    atomic_add(&stats->n_loads, 1);
+    stats->load_time = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+                       (end.tv_nsec - start.tv_nsec) / 1000;
+
+    if (rc == AUTH_LOADUSERS_OK)
+    {
+        USERS *users = listener_users_get(port);
+        stats->n_users = users ? users->stats.n_entries : 0;
+        listener_users_put(users);
+        stats->last_load = time(NULL);
+    }
+    else
+    {
+        atomic_add(&stats->n_failed, 1);
+    }
+
+    return rc;
+}
+
+/**
+ * Check the users refresh rate limit of a service and count the refresh if
+ * it is allowed. The caller must hold the users_table_spin of the service.
+ *
+ * @param service The service
+ * @return True if the users can be refreshed
+ */
+static bool service_users_refresh_allowed(SERVICE *service)
+{
+    time_t now = time(NULL);
+
+    /* Check if refresh rate limit has been exceeded */
+    if ((now < service->rate_limit.last + USERS_REFRESH_TIME) ||
+        (service->rate_limit.nloads > USERS_REFRESH_MAX_PER_TIME))
+    {
+        MXS_ERROR("[%s] Refresh rate limit exceeded for load of users' table.", service->name);
+        return false;
+    }
+
+    service->rate_limit.nloads++;
+
+    /** If we have reached the limit on users refreshes, reset refresh time and count */
+    if (service->rate_limit.nloads > USERS_REFRESH_MAX_PER_TIME)
+    {
+        service->rate_limit.nloads = 1;
+        service->rate_limit.last = now;
+    }
+
+    return true;
+}
+
+/**
+ * Load the users of one listener and log a failure
+ *
+ * @param port The listener
+ */
+static void service_listener_users_load(SERV_LISTENER *port)
+{
+    if (service_load_listener_users(port) != AUTH_LOADUSERS_OK)
+    {
+        MXS_ERROR("[%s] Failed to load users for listener '%s', authentication might not work.",
+                  port->service->name, port->name);
+    }
+}
+
+/**
+ * Thread entry point that loads the users of one listener
+ *
+ * @param data The listener
+ */
+static void service_listener_users_loader(void *data)
+{
+    if (mysql_thread_init())
+    {
+        MXS_ERROR("mysql_thread_init failed when loading the users of a listener.");
+        return;
+    }
+
+    service_listener_users_load((SERV_LISTENER *)data);
+    mysql_thread_end();
+}
+
+/**
+ * Thread entry point of the background users load of a service
+ *
+ * The users of each listener are loaded in parallel, each by a thread of its
+ * own. With auth_all_servers the servers of a listener are also queried in
+ * parallel. A listener builds the new users table while the old one is in use
+ * and swaps the new table in when it is complete.
+ *
+ * @param data The service
+ */
+static void service_users_loader(void *data)
+{
+    SERVICE *service = (SERVICE *)data;
+    int n_ports = 0;
+
+    if (mysql_thread_init())
+    {
+        MXS_ERROR("[%s] mysql_thread_init failed when loading the users.", service->name);
+        __sync_lock_release(&service->users_loading);
+        return;
+    }
+
+    for (SERV_LISTENER *port = service->ports; port; port = port->next)
+    {
+        n_ports++;
+    }
+
+    THREAD threads[n_ports];
+    bool started[n_ports];
+    int i = 0;
+
+    for (SERV_LISTENER *port = service->ports; port; port = port->next, i++)
+    {
+        started[i] = thread_start(&threads[i], service_listener_users_loader, port) != NULL;
+
+        if (!started[i])
+        {
+            /** Load the users of this listener in this thread */
+            service_listener_users_load(port);
+        }
+    }
+
+    for (i = 0; i < n_ports; i++)
+    {
+        if (started[i])
+        {
+            thread_wait(threads[i]);
+        }
+    }
+
+    mysql_thread_end();
+    __sync_lock_release(&service->users_loading);
+}
+
+/**
+ * Start the background users load of a service unless one is in progress
+ *
+ * @param service The service
+ * @return True if a load was started or is already in progress
+ */
+static bool service_start_users_load(SERVICE *service)
+{
+    THREAD thread;
+
+    if (__sync_lock_test_and_set(&service->users_loading, 1))
+    {
+        return true;
+    }
+
+    if (thread_start(&thread, service_users_loader, service) == NULL)
+    {
+        MXS_ERROR("[%s] Failed to start the thread that loads the users.", service->name);
+        __sync_lock_release(&service->users_loading);
+        return false;
+    }
+
+    thread_detach(thread);
+    return true;
+}
+
+/**
+ * The housekeeper task of the periodic users refresh of a service
+ *
+ * @param data The service
+ */
+static void service_users_refresh_task(void *data)
+{
+    SERVICE *service = (SERVICE *)data;
+
+    if (!service->svc_do_shutdown)
+    {
+        service_start_users_load(service);
+    }
+}
+
 /**
  * Refresh the database users for the service
  * This function replaces the MySQL users used by the service with the latest
  * version found on the backend servers. There is a limit on how often the users
  * can be reloaded and if this limit is exceeded, the reload will fail.
+ *
+ * The caller waits for the load, which makes this the refresh to use when an
+ * authentication is retried with the new users. A background load that is in
+ * progress is waited for first so that the loads of a listener do not overlap.
+ *
  * @param service Service to reload
  * @return 0 on success and 1 on error
  */
@@ -1431,36 +1668,26 @@ int service_refresh_users(SERVICE *service)
 
     if (spinlock_acquire_nowait(&service->users_table_spin))
     {
-        time_t now = time(NULL);
-
-        /* Check if refresh rate limit has been exceeded */
-        if ((now < service->rate_limit.last + USERS_REFRESH_TIME) ||
-            (service->rate_limit.nloads > USERS_REFRESH_MAX_PER_TIME))
+        if (service_users_refresh_allowed(service))
         {
-            MXS_ERROR("[%s] Refresh rate limit exceeded for load of users' table.", service->name);
-        }
-        else
-        {
-            service->rate_limit.nloads++;
-
-            /** If we have reached the limit on users refreshes, reset refresh time and count */
-            if (service->rate_limit.nloads > USERS_REFRESH_MAX_PER_TIME)
+            while (__sync_lock_test_and_set(&service->users_loading, 1))
             {
-                service->rate_limit.nloads = 1;
-                service->rate_limit.last = now;
+                thread_millisleep(10);
             }
 
             ret = 0;
 
             for (SERV_LISTENER *port = service->ports; port; port = port->next)
             {
-                if (port->listener->authfunc.loadusers(port) != AUTH_LOADUSERS_OK)
+                if (service_load_listener_users(port) != AUTH_LOADUSERS_OK)
                 {
                     MXS_ERROR("[%s] Failed to load users for listener '%s', authentication might not work.",
                               service->name, port->name);
                     ret = 1;
                 }
             }
+
+            __sync_lock_release(&service->users_loading);
         }
 
         spinlock_release(&service->users_table_spin);
@@ -1469,6 +1696,62 @@ int service_refresh_users(SERVICE *service)
     return ret;
 }
 
+/**
+ * Refresh the users of a service in the background
+ *
+ * The users are loaded by a thread of their own and the caller does not
+ * wait for the load to complete, which makes this the refresh to use in the
+ * worker threads when nothing is retried with the new users. The refreshes
+ * are rate limited like those done by service_refresh_users().
+ *
+ * @param service The service
+ * @return 0 if a refresh was started or is already in progress, 1 if the
+ *         refresh was not started
+ */
+int service_refresh_users_async(SERVICE *service)
+{
+    int ret = 1;
+
+    if (service->users_loading)
+    {
+        ret = 0;
+    }
+    else if (spinlock_acquire_nowait(&service->users_table_spin))
+    {
+        if (service_users_refresh_allowed(service) && service_start_users_load(service))
+        {
+            ret = 0;
+        }
+
+        spinlock_release(&service->users_table_spin);
+    }
+
+    return ret;
+}
+
+/**
+ * Set how often the users of a service are refreshed in the background
+ *
+ * The periodic refreshes are not rate limited. If the service is not
+ * started, the refreshes begin when it is.
+ *
+ * @param service The service
+ * @param seconds Seconds between the refreshes, 0 for no periodic refreshes
+ */
+void serviceSetUsersRefreshTime(SERVICE *service, int seconds)
+{
+    char task_name[strlen(service->name) + sizeof("Refresh users of ")];
+    sprintf(task_name, "Refresh users of %s", service->name);
+
+    service->users_refresh_time = seconds;
+    hktask_remove(task_name);
+
+    if (seconds > 0 && service->router_instance)
+    {
+        hktask_add(task_name, service_users_refresh_task, service, seconds);
+    }
+}
+
 bool service_set_param_value(SERVICE*            service,
                              CONFIG_PARAMETER*   param,
                              char*               valstr,
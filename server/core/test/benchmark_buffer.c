@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file benchmark_buffer.c Throughput benchmark of the buffer functions
+ *
+ * The lifecycle benchmark runs a loop that mimics the life of a packet inside
+ * MaxScale: a buffer is allocated and filled, cloned as a router would do when
+ * sending it to several backends, partially consumed and finally freed. Every
+ * other buffer is handed to the next thread and freed there, so that buffers
+ * also move between the threads as they do between a client and backend thread.
+ *
+ * The routing benchmark follows the buffers of a client request along the
+ * dcb_read -> routeQuery -> dcb_write path: a read containing several
+ * pipelined packets is split into packets, each packet gets the parsing
+ * information of the query classifier and possibly a routing hint, and
+ * the packets are appended to a write queue that is then drained.
+ *
+ * Usage: benchmark_buffer [threads] [packets per thread]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <maxscale/alloc.h>
+#include <buffer.h>
+#include <hint.h>
+#include <thread.h>
+
+#define DEFAULT_THREADS     4
+#define DEFAULT_ITERATIONS  1000000
+#define MAX_THREADS         64
+#define HANDOFF_SIZE        1024
+
+/** The routing benchmark reads this many packets of PACKET_SIZE bytes at a time */
+#define READ_PACKETS        4
+#define PACKET_SIZE         64
+
+/** Typical packet sizes; a small OK packet, rows of a resultset and a larger query */
+static const unsigned int packet_sizes[] = { 11, 48, 96, 300, 1200, 4000, 9000 };
+#define N_PACKET_SIZES (sizeof(packet_sizes) / sizeof(packet_sizes[0]))
+
+/** Buffers passed from one thread to the next one to be freed there */
+typedef struct
+{
+    pthread_mutex_t lock;
+    GWBUF    *bufs[HANDOFF_SIZE];
+    int      count;
+} HANDOFF;
+
+typedef struct
+{
+    int     id;
+    int     iterations;
+    HANDOFF *in;
+    HANDOFF *out;
+    long    n_ops;
+} BENCH_THREAD;
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void
+handoff_free_all(HANDOFF *handoff)
+{
+    pthread_mutex_lock(&handoff->lock);
+    for (int i = 0; i < handoff->count; i++)
+    {
+        gwbuf_free(handoff->bufs[i]);
+    }
+    handoff->count = 0;
+    pthread_mutex_unlock(&handoff->lock);
+}
+
+static void
+bench_thread(void *data)
+{
+    BENCH_THREAD *bt = (BENCH_THREAD *)data;
+    unsigned char payload[9000];
+
+    memset(payload, 'x', sizeof(payload));
+
+    for (int i = 0; i < bt->iterations; i++)
+    {
+        unsigned int size = packet_sizes[(i + bt->id) % N_PACKET_SIZES];
+        GWBUF *buf = gwbuf_alloc_and_load(size, payload);
+        GWBUF *clone1 = gwbuf_clone(buf);
+        GWBUF *clone2 = gwbuf_clone(buf);
+        MXS_ABORT_IF_NULL(buf);
+        MXS_ABORT_IF_NULL(clone1);
+        MXS_ABORT_IF_NULL(clone2);
+
+        clone1 = gwbuf_consume(clone1, size / 2);
+        gwbuf_free(clone1);
+        gwbuf_free(clone2);
+
+        if (i % 2 && bt->out)
+        {
+            pthread_mutex_lock(&bt->out->lock);
+            if (bt->out->count < HANDOFF_SIZE)
+            {
+                bt->out->bufs[bt->out->count++] = buf;
+                buf = NULL;
+            }
+            pthread_mutex_unlock(&bt->out->lock);
+        }
+
+        gwbuf_free(buf);
+
+        if (i % (HANDOFF_SIZE / 2) == 0 && bt->in)
+        {
+            handoff_free_all(bt->in);
+        }
+
+        /** Allocation, two clones, one consume and three frees */
+        bt->n_ops += 6;
+    }
+}
+
+static void
+noop_free(void *data)
+{
+}
+
+static void
+route_thread(void *data)
+{
+    BENCH_THREAD *bt = (BENCH_THREAD *)data;
+    unsigned char payload[READ_PACKETS * PACKET_SIZE];
+    int parsing_info = 0;
+
+    memset(payload, 'x', sizeof(payload));
+
+    for (int i = 0; i < bt->iterations; i++)
+    {
+        /** dcb_read */
+        GWBUF *readq = gwbuf_alloc_and_load(sizeof(payload), payload);
+        GWBUF *writeq = NULL;
+        MXS_ABORT_IF_NULL(readq);
+        bt->n_ops++;
+
+        while (readq)
+        {
+            GWBUF *packet = gwbuf_split(&readq, PACKET_SIZE);
+            MXS_ABORT_IF_NULL(packet);
+
+            /** routeQuery: classify the query and pick a target for it */
+            gwbuf_add_buffer_object(packet, GWBUF_PARSING_INFO, &parsing_info, noop_free);
+
+            for (int j = 0; j < 4; j++)
+            {
+                if (gwbuf_get_buffer_object_data(packet, GWBUF_PARSING_INFO) != &parsing_info)
+                {
+                    abort();
+                }
+            }
+
+            if (i % 4 == 0)
+            {
+                gwbuf_add_hint(packet, hint_create_route(NULL, HINT_ROUTE_TO_MASTER, NULL));
+            }
+
+            /** dcb_write */
+            writeq = gwbuf_append(writeq, packet);
+
+            /** Split, add and four lookups of the parsing information and append */
+            bt->n_ops += 7;
+        }
+
+        /** dcb_drain_writeq, the socket accepts the data in two writes */
+        writeq = gwbuf_consume(writeq, gwbuf_length(writeq) / 2);
+        writeq = gwbuf_consume(writeq, gwbuf_length(writeq));
+        bt->n_ops += 2;
+    }
+}
+
+static void
+run_benchmark(const char *name, void (*fn)(void *), int n_threads, int iterations,
+              int packets_per_iteration)
+{
+    THREAD threads[MAX_THREADS];
+    BENCH_THREAD data[MAX_THREADS];
+    HANDOFF handoff[MAX_THREADS];
+    long total_ops = 0;
+    long n_packets = (long)n_threads * iterations * packets_per_iteration;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        pthread_mutex_init(&handoff[i].lock, NULL);
+        handoff[i].count = 0;
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        data[i].id = i;
+        data[i].iterations = iterations;
+        data[i].n_ops = 0;
+        data[i].out = n_threads > 1 ? &handoff[i] : NULL;
+        data[i].in = n_threads > 1 ? &handoff[(i + n_threads - 1) % n_threads] : NULL;
+    }
+
+    double start = now();
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        thread_start(&threads[i], fn, &data[i]);
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        thread_wait(threads[i]);
+        total_ops += data[i].n_ops;
+    }
+
+    double elapsed = now() - start;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        handoff_free_all(&handoff[i]);
+    }
+
+    printf("%s.threads: %d\n", name, n_threads);
+    printf("%s.packets: %ld\n", name, n_packets);
+    printf("%s.seconds: %.3f\n", name, elapsed);
+    printf("%s.operations/s: %.0f\n", name, total_ops / elapsed);
+    printf("%s.packets/s: %.0f\n", name, n_packets / elapsed);
+    printf("%s.ns/packet/thread: %.1f\n", name, elapsed * 1000000000.0 * n_threads / n_packets);
+}
+
+int main(int argc, char **argv)
+{
+    int n_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+    int iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+
+    if (n_threads < 1 || n_threads > MAX_THREADS || iterations < 1)
+    {
+        fprintf(stderr, "Usage: %s [threads (1-%d)] [packets]\n", argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    printf("sizeof(GWBUF): %lu\n", (unsigned long)sizeof(GWBUF));
+    printf("sizeof(SHARED_BUF): %lu\n", (unsigned long)sizeof(SHARED_BUF));
+
+    run_benchmark("lifecycle", bench_thread, n_threads, iterations, 1);
+    run_benchmark("routing", route_thread, n_threads, iterations / READ_PACKETS, READ_PACKETS);
+
+    return 0;
+}
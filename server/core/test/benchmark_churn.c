@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file benchmark_churn.c Connection churn benchmark
+ *
+ * Each client thread connects to a MaxScale service, authenticates and quits
+ * in a loop, as the clients of a service with short-lived connections do. A
+ * local database server is used as the backend of the service. Once a second
+ * the number of connections made is printed together with the number of
+ * zombie DCBs, which is read from the output of a maxadmin command.
+ *
+ * Usage: benchmark_churn [-h host] [-P port] [-u user] [-p password]
+ *                        [-t threads] [-d seconds] [-a maxadmin command]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <mysql.h>
+
+#include <atomic.h>
+#include <thread.h>
+
+#define MAX_THREADS 256
+#define ZOMBIE_LINE "Current zombies:"
+
+static const char *host = "127.0.0.1";
+static int port = 4006;
+static const char *user = "maxuser";
+static const char *password = "maxpwd";
+static const char *maxadmin = "maxadmin show dcblist";
+
+static int n_connections = 0;
+static int n_failures = 0;
+static volatile bool running = true;
+
+static void
+churn_thread(void *data)
+{
+    mysql_thread_init();
+
+    while (running)
+    {
+        MYSQL *mysql = mysql_init(NULL);
+
+        if (mysql && mysql_real_connect(mysql, host, user, password, NULL, port, NULL, 0))
+        {
+            atomic_add(&n_connections, 1);
+        }
+        else
+        {
+            atomic_add(&n_failures, 1);
+        }
+
+        /** Sends COM_QUIT if the connection was made */
+        mysql_close(mysql);
+    }
+
+    mysql_thread_end();
+}
+
+/**
+ * Read the number of zombie DCBs from the output of the maxadmin command
+ *
+ * @return The number of zombies or -1 if it could not be read
+ */
+static int
+read_zombies()
+{
+    int zombies = -1;
+    FILE *out;
+
+    if (*maxadmin && (out = popen(maxadmin, "r")))
+    {
+        char line[256];
+
+        while (fgets(line, sizeof(line), out))
+        {
+            if (strncmp(line, ZOMBIE_LINE, strlen(ZOMBIE_LINE)) == 0)
+            {
+                zombies = atoi(line + strlen(ZOMBIE_LINE));
+            }
+        }
+
+        pclose(out);
+    }
+
+    return zombies;
+}
+
+int main(int argc, char **argv)
+{
+    int n_threads = 16;
+    int duration = 30;
+    int c;
+
+    while ((c = getopt(argc, argv, "h:P:u:p:t:d:a:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h':
+            host = optarg;
+            break;
+
+        case 'P':
+            port = atoi(optarg);
+            break;
+
+        case 'u':
+            user = optarg;
+            break;
+
+        case 'p':
+            password = optarg;
+            break;
+
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+
+        case 'd':
+            duration = atoi(optarg);
+            break;
+
+        case 'a':
+            maxadmin = optarg;
+            break;
+
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-P port] [-u user] [-p password] "
+                    "[-t threads] [-d seconds] [-a maxadmin command]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (n_threads < 1 || n_threads > MAX_THREADS || duration < 1)
+    {
+        fprintf(stderr, "The number of threads must be between 1 and %d "
+                "and the duration at least one second.\n", MAX_THREADS);
+        return 1;
+    }
+
+    THREAD threads[MAX_THREADS];
+    int max_zombies = 0;
+    int prev = 0;
+
+    mysql_library_init(0, NULL, NULL);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        thread_start(&threads[i], churn_thread, NULL);
+    }
+
+    printf("second\tconnections/s\tfailures\tzombies\n");
+
+    for (int i = 1; i <= duration; i++)
+    {
+        sleep(1);
+        int total = n_connections;
+        int zombies = read_zombies();
+
+        if (zombies > max_zombies)
+        {
+            max_zombies = zombies;
+        }
+
+        printf("%d\t%d\t%d\t%d\n", i, total - prev, n_failures, zombies);
+        fflush(stdout);
+        prev = total;
+    }
+
+    running = false;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        thread_wait(threads[i]);
+    }
+
+    printf("threads: %d\n", n_threads);
+    printf("connections: %d\n", n_connections);
+    printf("failures: %d\n", n_failures);
+    printf("connections/s: %.1f\n", (double)n_connections / duration);
+    printf("max zombies: %d\n", max_zombies);
+
+    mysql_library_end();
+
+    return n_failures > 0 && n_connections == 0 ? 1 : 0;
+}
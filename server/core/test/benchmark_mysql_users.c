@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file benchmark_mysql_users.c Throughput benchmark of the MySQL user lookups
+ *
+ * The benchmark loads a users table with the given number of user@host
+ * entries, five hosts per user: an exact address, a class C network, a
+ * network with a 28 bit netmask, an address pattern and any host. Then
+ * the threads look up random users from client addresses that match each
+ * of the hosts, and from unknown users, as the authentication of a storm
+ * of reconnecting clients would.
+ *
+ * The lookups are done with mysql_users_find() and, for comparison, with
+ * the sequence of mysql_users_fetch() calls that the MySQL authenticator
+ * used to do: the exact address, the class C, B and A networks and any host.
+ *
+ * Usage: benchmark_mysql_users [entries] [threads] [lookups per thread]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include <maxscale/alloc.h>
+#include <users.h>
+#include <dbusers.h>
+#include <thread.h>
+
+#define DEFAULT_ENTRIES     50000
+#define DEFAULT_THREADS     4
+#define DEFAULT_LOOKUPS     1000000
+#define MAX_THREADS         64
+
+/** The number of hosts each user has grants from */
+#define HOSTS_PER_USER      5
+
+/** The client addresses used by the lookups, one for each host of a user and an unknown user */
+#define N_CLIENT_KINDS      (HOSTS_PER_USER + 1)
+
+typedef char *(*LOOKUP_FN)(USERS *users, MYSQL_USER_HOST *key);
+
+typedef struct
+{
+    USERS     *users;
+    int       n_users;
+    int       lookups;
+    LOOKUP_FN fn;
+    unsigned  seed;
+    long      n_found;
+} BENCH_THREAD;
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/**
+ * The host of the grant of a user, the kind selects one of the five hosts
+ */
+static void
+grant_host(int user, int kind, char *host)
+{
+    int b = (user >> 8) & 0xff;
+    int c = user & 0xff;
+
+    switch (kind)
+    {
+    case 0:
+        sprintf(host, "10.%d.%d.10", b, c);
+        break;
+
+    case 1:
+        sprintf(host, "10.%d.%d.%%", b, c);
+        break;
+
+    case 2:
+        sprintf(host, "172.%d.%d.16/255.255.255.240", 16 + b % 16, c);
+        break;
+
+    case 3:
+        sprintf(host, "192.168.%%.%d", c);
+        break;
+
+    default:
+        strcpy(host, "%");
+        break;
+    }
+}
+
+/**
+ * The address of a client that matches the host of the grant of the given kind
+ */
+static void
+client_host(int user, int kind, char *host)
+{
+    int b = (user >> 8) & 0xff;
+    int c = user & 0xff;
+
+    switch (kind)
+    {
+    case 0:
+        sprintf(host, "10.%d.%d.10", b, c);
+        break;
+
+    case 1:
+        sprintf(host, "10.%d.%d.200", b, c);
+        break;
+
+    case 2:
+        sprintf(host, "172.%d.%d.20", 16 + b % 16, c);
+        break;
+
+    case 3:
+        sprintf(host, "192.168.%d.%d", b, c);
+        break;
+
+    default:
+        strcpy(host, "203.0.113.7");
+        break;
+    }
+}
+
+static char *
+find_lookup(USERS *users, MYSQL_USER_HOST *key)
+{
+    return mysql_users_find(users, key, true);
+}
+
+/**
+ * The lookups the MySQL authenticator did before mysql_users_find()
+ */
+static char *
+fetch_lookup(USERS *users, MYSQL_USER_HOST *key)
+{
+    char *rval = mysql_users_fetch(users, key);
+
+    for (int i = 0; rval == NULL && i < 3; i++)
+    {
+        key->ipv4.sin_addr.s_addr &= 0x00FFFFFF >> (8 * i);
+        key->netmask -= 8;
+        rval = mysql_users_fetch(users, key);
+    }
+
+    if (rval == NULL)
+    {
+        memset(&key->ipv4, 0, sizeof(key->ipv4));
+        key->netmask = 0;
+        rval = mysql_users_fetch(users, key);
+    }
+
+    return rval;
+}
+
+static void
+bench_thread(void *data)
+{
+    BENCH_THREAD *bt = (BENCH_THREAD *)data;
+
+    for (int i = 0; i < bt->lookups; i++)
+    {
+        char user[MYSQL_USER_MAXLEN];
+        int u = rand_r(&bt->seed) % bt->n_users;
+        int kind = rand_r(&bt->seed) % N_CLIENT_KINDS;
+        MYSQL_USER_HOST key = {};
+
+        sprintf(user, kind == HOSTS_PER_USER ? "nouser_%d" : "user_%d", u);
+        client_host(u, kind, key.hostname);
+        inet_pton(AF_INET, key.hostname, &key.ipv4.sin_addr);
+        key.ipv4.sin_family = AF_INET;
+        key.user = user;
+        key.netmask = 32;
+        key.resource = "";
+
+        if (bt->fn(bt->users, &key))
+        {
+            bt->n_found++;
+        }
+    }
+}
+
+static void
+run_benchmark(const char *name, LOOKUP_FN fn, USERS *users, int n_users, int n_threads, int lookups)
+{
+    THREAD threads[MAX_THREADS];
+    BENCH_THREAD data[MAX_THREADS];
+    long n_found = 0;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        data[i].users = users;
+        data[i].n_users = n_users;
+        data[i].lookups = lookups;
+        data[i].fn = fn;
+        data[i].seed = i + 1;
+        data[i].n_found = 0;
+    }
+
+    double start = now();
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        thread_start(&threads[i], bench_thread, &data[i]);
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        thread_wait(threads[i]);
+        n_found += data[i].n_found;
+    }
+
+    double elapsed = now() - start;
+    long n_lookups = (long)n_threads * lookups;
+
+    printf("%s.threads: %d\n", name, n_threads);
+    printf("%s.lookups: %ld\n", name, n_lookups);
+    printf("%s.found: %ld\n", name, n_found);
+    printf("%s.seconds: %.3f\n", name, elapsed);
+    printf("%s.lookups/s: %.0f\n", name, n_lookups / elapsed);
+    printf("%s.ns/lookup/thread: %.1f\n", name, elapsed * 1000000000.0 * n_threads / n_lookups);
+}
+
+int main(int argc, char **argv)
+{
+    int n_entries = argc > 1 ? atoi(argv[1]) : DEFAULT_ENTRIES;
+    int n_threads = argc > 2 ? atoi(argv[2]) : DEFAULT_THREADS;
+    int lookups = argc > 3 ? atoi(argv[3]) : DEFAULT_LOOKUPS;
+    int n_users = n_entries / HOSTS_PER_USER;
+
+    if (n_users < 1 || n_threads < 1 || n_threads > MAX_THREADS || lookups < 1)
+    {
+        fprintf(stderr, "Usage: %s [entries (>= %d)] [threads (1-%d)] [lookups per thread]\n",
+                argv[0], HOSTS_PER_USER, MAX_THREADS);
+        return 1;
+    }
+
+    USERS *users = mysql_users_alloc();
+    MXS_ABORT_IF_NULL(users);
+
+    double start = now();
+    int added = 0;
+
+    for (int u = 0; u < n_users; u++)
+    {
+        char user[MYSQL_USER_MAXLEN];
+        sprintf(user, "user_%d", u);
+
+        for (int kind = 0; kind < HOSTS_PER_USER; kind++)
+        {
+            char host[MYSQL_HOST_MAXLEN + 1];
+            grant_host(u, kind, host);
+
+            if (add_mysql_users_with_host_ipv4(users, user, host,
+                                               "0123456789ABCDEF0123456789ABCDEF01234567",
+                                               "Y", NULL) == 1)
+            {
+                added++;
+            }
+        }
+    }
+
+    printf("load.entries: %d\n", added);
+    printf("load.seconds: %.3f\n", now() - start);
+
+    run_benchmark("find", find_lookup, users, n_users, n_threads, lookups);
+    run_benchmark("fetch", fetch_lookup, users, n_users, n_threads, lookups / 10 + 1);
+
+    users_free(users);
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file benchmark_zombies.c Throughput benchmark of the reclamation of closed DCBs
+ *
+ * Each thread acts as a polling thread that closes backend DCBs: it allocates
+ * and closes a few DCBs and then calls dcb_process_zombies(), as the polling
+ * loop does at the end of each cycle. No sockets or servers are involved, so
+ * the benchmark measures only the cost of dcb_close() and of the reclamation
+ * of the zombies. Unlike benchmark_churn, it needs neither a running MaxScale
+ * nor a database server.
+ *
+ * Usage: benchmark_zombies [threads] [seconds] [closes per cycle]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <maxscale/alloc.h>
+#include <dcb.h>
+#include <server.h>
+#include <thread.h>
+
+#define DEFAULT_THREADS     4
+#define DEFAULT_SECONDS     5
+#define DEFAULT_CLOSES      4
+#define MAX_THREADS         64
+
+typedef struct
+{
+    int     id;
+    int     closes;
+    long    n_closes;
+} BENCH_THREAD;
+
+static SERVER server;
+static volatile bool running = true;
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void
+bench_thread(void *data)
+{
+    BENCH_THREAD *bt = (BENCH_THREAD *)data;
+
+    while (running)
+    {
+        for (int i = 0; i < bt->closes; i++)
+        {
+            DCB *dcb = dcb_alloc(DCB_ROLE_BACKEND_HANDLER, NULL);
+            MXS_ABORT_IF_NULL(dcb);
+
+            /** A backend DCB that is no longer polled, so that it becomes a zombie */
+            dcb->state = DCB_STATE_NOPOLLING;
+            dcb->server = &server;
+            dcb_close(dcb);
+        }
+
+        dcb_process_zombies(bt->id);
+        bt->n_closes += bt->closes;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int n_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+    int seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+    int closes = argc > 3 ? atoi(argv[3]) : DEFAULT_CLOSES;
+
+    if (n_threads < 1 || n_threads > MAX_THREADS || seconds < 1 || closes < 1)
+    {
+        fprintf(stderr, "Usage: %s [threads (1-%d)] [seconds] [closes per cycle]\n",
+                argv[0], MAX_THREADS);
+        return 1;
+    }
+
+    THREAD threads[MAX_THREADS];
+    BENCH_THREAD data[MAX_THREADS];
+
+    memset(data, 0, sizeof(data));
+    double start = now();
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        data[i].id = i;
+        data[i].closes = closes;
+        thread_start(&threads[i], bench_thread, &data[i]);
+    }
+
+    thread_millisleep(seconds * 1000);
+    running = false;
+
+    long total = 0;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        thread_wait(threads[i]);
+        total += data[i].n_closes;
+    }
+
+    double elapsed = now() - start;
+
+    printf("threads: %d\n", n_threads);
+    printf("closes/s: %.0f\n", total / elapsed);
+    printf("ns/close: %.1f\n", elapsed * 1000000000.0 * n_threads / total);
+
+    return 0;
+}
@@ -308,6 +308,73 @@ int set_and_get_mysql_users_wildcards(char *username, char *hostname, char *pass
     return ret;
 }
 
+/**
+ * Check the lookup cache of a MySQL users table
+ *
+ * @return 0 on success, 1 on failure
+ */
+int check_mysql_users_cache()
+{
+    USERS *mysql_users = mysql_users_alloc();
+    MYSQL_USER_HOST key = {};
+    uint8_t password[SHA_DIGEST_LENGTH] = "";
+    uint8_t cached[SHA_DIGEST_LENGTH] = "";
+    int ret = 0;
+
+    key.user = "pippo";
+    key.resource = "test";
+    key.netmask = 32;
+    key.ipv4.sin_family = AF_INET;
+    inet_pton(AF_INET, "192.168.1.1", &key.ipv4.sin_addr);
+    memset(password, 0xab, sizeof(password));
+
+    if (mysql_users_cache_get(mysql_users, &key, cached) != -1)
+    {
+        fprintf(stderr, "\t-- Expecting nothing cached\n");
+        ret = 1;
+    }
+
+    mysql_users_cache_add(mysql_users, &key, password, 60);
+
+    if (mysql_users_cache_get(mysql_users, &key, cached) != 1 ||
+        memcmp(cached, password, sizeof(password)) != 0)
+    {
+        fprintf(stderr, "\t-- Expecting the cached password\n");
+        ret = 1;
+    }
+
+    /** Another client address is not a cached lookup */
+    inet_pton(AF_INET, "192.168.1.2", &key.ipv4.sin_addr);
+
+    if (mysql_users_cache_get(mysql_users, &key, NULL) != -1)
+    {
+        fprintf(stderr, "\t-- Expecting nothing cached for another address\n");
+        ret = 1;
+    }
+
+    mysql_users_cache_add(mysql_users, &key, NULL, 60);
+
+    if (mysql_users_cache_get(mysql_users, &key, NULL) != 0)
+    {
+        fprintf(stderr, "\t-- Expecting a cached missing user\n");
+        ret = 1;
+    }
+
+    /** An expired lookup is not used */
+    key.user = "pluto";
+    mysql_users_cache_add(mysql_users, &key, password, 0);
+
+    if (mysql_users_cache_get(mysql_users, &key, NULL) != -1)
+    {
+        fprintf(stderr, "\t-- Expecting an expired lookup\n");
+        ret = 1;
+    }
+
+    users_free(mysql_users);
+
+    return ret;
+}
+
 int main()
 {
     int ret;
@@ -536,6 +603,46 @@ int main()
     }
     assert(ret == 0);
 
+    ret = set_and_get_mysql_users_wildcards("pippo", "192.168.2.0/255.255.255.0", "foo", "192.168.2.200",
+                                            NULL, NULL, NULL);
+    if (!ret)
+    {
+        fprintf(stderr, "\t-- Expecting ok\n");
+    }
+    assert(ret == 0);
+
+    ret = set_and_get_mysql_users_wildcards("pippo", "192.168.2.128/255.255.255.128", "foo", "192.168.2.100",
+                                            NULL, NULL, NULL);
+    if (ret)
+    {
+        fprintf(stderr, "\t-- Expecting no match\n");
+    }
+    assert(ret == 1);
+
+    ret = set_and_get_mysql_users_wildcards("pippo", "192.168.%.2", "foo", "192.168.5.2", NULL, NULL, NULL);
+    if (!ret)
+    {
+        fprintf(stderr, "\t-- Expecting ok\n");
+    }
+    assert(ret == 0);
+
+    ret = set_and_get_mysql_users_wildcards("pippo", "192.168.%.2", "foo", "192.168.5.3", NULL, NULL, NULL);
+    if (ret)
+    {
+        fprintf(stderr, "\t-- Expecting no match\n");
+    }
+    assert(ret == 1);
+
+    ret = set_and_get_mysql_users_wildcards("pippo", "192.168.1._", "foo", "192.168.1.15", NULL, NULL, NULL);
+    if (ret)
+    {
+        fprintf(stderr, "\t-- Expecting no match\n");
+    }
+    assert(ret == 1);
+
+    ret = check_mysql_users_cache();
+    assert(ret == 0);
+
     fprintf(stderr, "----------------\n");
     fprintf(stderr, "<<< Test completed\n");
 
@@ -316,6 +316,38 @@ void test_consume()
     consume_buffer(n_buffers - 1, -1);
 }
 
+static int n_bufobj_freed = 0;
+
+static void free_bufobj(void *data)
+{
+    n_bufobj_freed++;
+}
+
+void test_shared_data()
+{
+    int data = 1;
+    GWBUF* buffer = gwbuf_alloc(10);
+
+    gwbuf_add_buffer_object(buffer, GWBUF_PARSING_INFO, &data, free_bufobj);
+    ss_info_dassert(GWBUF_IS_PARSED(buffer), "Buffer should be marked as parsed");
+
+    GWBUF* clone = gwbuf_clone(buffer);
+    ss_info_dassert(GWBUF_IS_PARSED(clone), "Clone should be marked as parsed");
+    ss_info_dassert(gwbuf_get_buffer_object_data(clone, GWBUF_PARSING_INFO) == &data,
+                    "Buffer object should be found from the clone");
+
+    gwbuf_add_property(clone, "name", "value");
+    ss_info_dassert(strcmp(gwbuf_get_property(buffer, "name"), "value") == 0,
+                    "Property should be shared by the clones of the buffer");
+
+    gwbuf_free(buffer);
+    ss_info_dassert(n_bufobj_freed == 0, "Buffer object should not be freed while the data is in use");
+    ss_info_dassert(strcmp(gwbuf_get_property(clone, "name"), "value") == 0,
+                    "Property should remain after the original buffer is freed");
+    gwbuf_free(clone);
+    ss_info_dassert(n_bufobj_freed == 1, "Buffer object should be freed with the last buffer");
+}
+
 /**
  * test1    Allocate a buffer and do lots of things
  *
@@ -452,6 +484,7 @@ test1()
     test_split();
     test_load_and_copy();
     test_consume();
+    test_shared_data();
 
     return 0;
 }
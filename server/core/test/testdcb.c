@@ -32,7 +32,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include <listener.h>
+#include <buffer.h>
 #include <dcb.h>
 
 /**
@@ -77,11 +81,187 @@ test1()
     return 0;
 }
 
+/**
+ * Create a DCB that writes to one end of a socket pair
+ *
+ * @param sv Where the descriptors of the socket pair are stored
+ * @return A DCB whose descriptor is the non-blocking sv[0]
+ */
+static DCB *
+socket_dcb(int sv[2])
+{
+    ss_info_dassert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "Socket pair must be created");
+    ss_info_dassert(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0, "Socket must be made non-blocking");
+
+    DCB *dcb = dcb_alloc(DCB_ROLE_BACKEND_HANDLER, NULL);
+    ss_info_dassert(dcb, "DCB must be allocated");
+    dcb->fd = sv[0];
+
+    return dcb;
+}
+
+/**
+ * Close a DCB created with socket_dcb and the socket pair
+ */
+static void
+socket_dcb_close(DCB *dcb, int sv[2])
+{
+    dcb->fd = DCBFD_CLOSED;
+    dcb_close(dcb);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/**
+ * Create a chain of buffers whose bytes are numbered from 0 onwards
+ *
+ * @param n_buffers The number of buffers
+ * @param size      The size of each buffer
+ * @return The buffer chain
+ */
+static GWBUF *
+numbered_chain(int n_buffers, int size)
+{
+    GWBUF *chain = NULL;
+
+    for (int i = 0; i < n_buffers; i++)
+    {
+        GWBUF *buf = gwbuf_alloc(size);
+        ss_info_dassert(buf, "Buffer must be allocated");
+
+        for (int j = 0; j < size; j++)
+        {
+            ((uint8_t *)GWBUF_DATA(buf))[j] = (uint8_t)(i * size + j);
+        }
+
+        chain = gwbuf_append(chain, buf);
+    }
+
+    return chain;
+}
+
+/**
+ * Read bytes from a socket and check that they continue the numbering
+ *
+ * @param fd     The socket to read from
+ * @param offset The number of bytes read so far
+ * @return The number of bytes read
+ */
+static int
+read_numbered(int fd, int offset)
+{
+    uint8_t data[65536];
+    int n = read(fd, data, sizeof(data));
+    ss_info_dassert(n > 0, "Data must be readable");
+
+    for (int i = 0; i < n; i++)
+    {
+        ss_info_dassert(data[i] == (uint8_t)(offset + i), "Bytes must arrive in order");
+    }
+
+    return n;
+}
+
+/**
+ * test2    Write a chain of buffers to a socket with one writev call
+ *
+ */
+static int
+test2()
+{
+    const int n_buffers = 5;
+    const int size = 100;
+    int sv[2];
+
+    ss_dfprintf(stderr, "testdcb : write a chain of %d buffers", n_buffers);
+    DCB *dcb = socket_dcb(sv);
+
+    ss_info_dassert(dcb_write(dcb, numbered_chain(n_buffers, size)), "Write must succeed");
+    ss_info_dassert(dcb->writeq == NULL, "Write queue must be empty");
+    ss_info_dassert(dcb->writeqlen == 0, "Write queue length must be zero");
+    ss_info_dassert(dcb->stats.n_writes == 1, "The chain must be written with one system call");
+    ss_info_dassert(dcb->stats.n_buffers_written == n_buffers, "All buffers must be written");
+
+    int received = 0;
+
+    while (received < n_buffers * size)
+    {
+        received += read_numbered(sv[1], received);
+    }
+
+    ss_info_dassert(received == n_buffers * size, "All bytes must be received");
+
+    socket_dcb_close(dcb, sv);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+/**
+ * test3    Write more than the socket can take, so that a write is short,
+ *          the next one fails with EAGAIN and a partly written buffer is
+ *          left at the head of the write queue
+ *
+ */
+static int
+test3()
+{
+    const int n_buffers = 8;
+    const int size = 100003;
+    const int total = n_buffers * size;
+    int sndbuf = 4096;
+    int sv[2];
+
+    ss_dfprintf(stderr, "testdcb : write %d bytes to a socket with a small send buffer", total);
+    DCB *dcb = socket_dcb(sv);
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    ss_info_dassert(dcb_write(dcb, numbered_chain(n_buffers, size)), "Write must succeed");
+
+    int written = total - dcb->writeqlen;
+    ss_info_dassert(written > 0 && written < total, "Only a part of the data must be written");
+    ss_info_dassert(dcb->writeq, "The rest must be left in the write queue");
+    ss_info_dassert(gwbuf_length(dcb->writeq) == dcb->writeqlen,
+                    "Write queue length must match the queued data");
+    ss_info_dassert(GWBUF_LENGTH(dcb->writeq) == size - written % size,
+                    "The head of the write queue must be the unwritten part of a buffer");
+    ss_info_dassert(((uint8_t *)GWBUF_DATA(dcb->writeq))[0] == (uint8_t)written,
+                    "The head of the write queue must start with the first unwritten byte");
+
+    ss_dfprintf(stderr, "\t..done\nDrain a full socket");
+    int writes = dcb->stats.n_writes;
+    ss_info_dassert(dcb_drain_writeq(dcb) == 0, "Nothing must be written to a full socket");
+    ss_info_dassert(dcb->stats.n_writes == writes + 1, "The write must be attempted");
+    ss_info_dassert(total - dcb->writeqlen == written, "Write queue must be left as it was");
+    ss_info_dassert(gwbuf_length(dcb->writeq) == dcb->writeqlen,
+                    "Write queue length must match the queued data");
+
+    ss_dfprintf(stderr, "\t..done\nRead and drain until all data is received");
+    int received = 0;
+
+    while (received < total)
+    {
+        received += read_numbered(sv[1], received);
+        dcb_drain_writeq(dcb);
+    }
+
+    ss_info_dassert(received == total, "All bytes must be received");
+    ss_info_dassert(dcb->writeq == NULL, "Write queue must be empty");
+    ss_info_dassert(dcb->writeqlen == 0, "Write queue length must be zero");
+
+    socket_dcb_close(dcb, sv);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
 
     result += test1();
+    result += test2();
+    result += test3();
 
     exit(result);
 }
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <libgen.h>
+#include <time.h>
 #include <maxscale/alloc.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
@@ -34,6 +35,8 @@ typedef struct thread_st
 
 static void* thr_run(void* data);
 static void* thr_run_morelog(void* data);
+static void* thr_run_bench(void* data);
+static double bench_now();
 
 #define MAX_NTHR 256
 #define NITER 100
@@ -48,12 +51,21 @@ static void* thr_run_morelog(void* data);
 
 #define TEST3
 #define TEST4
+#define TEST5
 
 const char USAGE[] =
-    "usage: %s [-t <#threads>]\n"
+    "usage: %s [-t <#threads>] [-m <#messages>]\n"
     "\n"
-    "-t: Number of threads. Default is %d.\n";
+    "-t: Number of threads. Default is %d.\n"
+    "-m: Number of messages each thread logs in the throughput test. Default is %d.\n";
 const int N_THR = 4;
+const int N_MSG = 20000;
+
+typedef struct bench_st
+{
+    int    nmsg;
+    double seconds; /**< How long logging the messages took */
+} bench_t;
 
 #define TEST_ERROR(msg)\
     do { fprintf(stderr, "[%s:%d]: %s\n", basename(__FILE__), __LINE__, msg); } while (false)
@@ -83,8 +95,9 @@ int main(int argc, char* argv[])
     struct tm        tm;
     char             c;
     int              nthr = N_THR;
+    int              nmsg = N_MSG;
 
-    while ((c = getopt(argc, argv, "t:")) != -1)
+    while ((c = getopt(argc, argv, "t:m:")) != -1)
     {
         switch (c)
         {
@@ -96,6 +109,14 @@ int main(int argc, char* argv[])
                 }
                 break;
 
+            case 'm':
+                nmsg = atoi(optarg);
+                if (nmsg <= 0)
+                {
+                    err = 1;
+                }
+                break;
+
             default:
                 err = 1;
                 break;
@@ -104,7 +125,7 @@ int main(int argc, char* argv[])
 
     if (err != 0)
     {
-        fprintf(stderr, USAGE, argv[0], N_THR);
+        fprintf(stderr, USAGE, argv[0], N_THR, N_MSG);
         err = 1;
         goto return_err;
     }
@@ -496,6 +517,58 @@ int main(int argc, char* argv[])
     mxs_log_finish();
 
 #endif /* TEST 4 */
+
+#if defined(TEST5)
+    {
+        /** Throughput of info logging from several threads */
+        pthread_t* tids = (pthread_t*)MXS_CALLOC(nthr, sizeof(pthread_t));
+        bench_t*   bench = (bench_t*)MXS_CALLOC(nthr, sizeof(bench_t));
+        MXS_ABORT_IF_NULL(tids);
+        MXS_ABORT_IF_NULL(bench);
+
+        fprintf(stderr, "\nStarting test #5 \n");
+
+        succp = mxs_log_init(NULL, "/tmp", MXS_LOG_TARGET_FS);
+        ss_dassert(succp);
+        mxs_log_set_syslog_enabled(false);
+        skygw_log_enable(LOG_INFO);
+
+        int dropped = mxs_log_get_dropped();
+        double start = bench_now();
+
+        for (i = 0; i < nthr; i++)
+        {
+            bench[i].nmsg = nmsg;
+            pthread_create(&tids[i], NULL, thr_run_bench, &bench[i]);
+        }
+
+        double seconds = 0;
+
+        for (i = 0; i < nthr; i++)
+        {
+            pthread_join(tids[i], NULL);
+            seconds += bench[i].seconds;
+        }
+
+        mxs_log_flush_sync();
+
+        double elapsed = bench_now() - start;
+        long total = (long)nthr * nmsg;
+
+        printf("log.threads: %d\n", nthr);
+        printf("log.messages: %ld\n", total);
+        printf("log.dropped: %d\n", mxs_log_get_dropped() - dropped);
+        printf("log.seconds: %.3f\n", elapsed);
+        printf("log.messages/s: %.0f\n", total / elapsed);
+        printf("log.ns/message/thread: %.1f\n", seconds * 1000000000.0 / total);
+
+        skygw_log_disable(LOG_INFO);
+        mxs_log_set_syslog_enabled(true);
+        mxs_log_finish();
+        MXS_FREE(bench);
+        MXS_FREE(tids);
+    }
+#endif /* TEST 5 */
     fprintf(stderr, ".. done.\n");
 return_err:
     if (thr != NULL)
@@ -506,6 +579,28 @@ return_err:
 }
 
 
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void* thr_run_bench(void* data)
+{
+    bench_t* bench = (bench_t *)data;
+    double   start = bench_now();
+
+    for (int i = 0; i < bench->nmsg; i++)
+    {
+        MXS_INFO("Throughput test message %d of %d, routing a query to a server "
+                 "with a session command history of %d entries.", i, bench->nmsg, i % 50);
+    }
+
+    bench->seconds = bench_now() - start;
+    return NULL;
+}
+
 static void* thr_run(void* data)
 {
     thread_t* td = (thread_t *)data;
@@ -384,6 +384,79 @@ void test_large_packets()
     }
 }
 
+static void test_digest_one(const char *sql, const char *expected)
+{
+    char digest[256];
+    uint64_t hash = modutil_get_digest(sql, strlen(sql), digest, sizeof(digest));
+
+    ss_info_dassert(strcmp(digest, expected) == 0, "Digest should be as expected");
+    ss_info_dassert(hash == modutil_get_digest(expected, strlen(expected), NULL, 0),
+                    "The hash of a digest should be the hash of the statement");
+}
+
+void test_digest()
+{
+    test_digest_one("SELECT * FROM t1 WHERE id = 42", "select * from t1 where id = ?");
+    test_digest_one("  select  *\n\tfrom t1   where id=7  ", "select * from t1 where id=?");
+    test_digest_one("INSERT INTO t VALUES ('it''s', \"a\\\"b\", -1.5e-3, 0xff)",
+                    "insert into t values (?, ?, -?, ?)");
+    test_digest_one("SELECT /* comment */ a -- comment\nFROM `My Table` # comment",
+                    "select a from `My Table`");
+    test_digest_one("SELECT col2, .5 FROM t", "select col2, ? from t");
+    test_digest_one("SELECT 'unterminated", "select ?");
+
+    char digest[8];
+    const char sql[] = "SELECT * FROM t WHERE a = 1";
+    uint64_t hash = modutil_get_digest(sql, strlen(sql), digest, sizeof(digest));
+    ss_info_dassert(strcmp(digest, "select ") == 0, "Digest should be truncated");
+    ss_info_dassert(hash == modutil_get_digest("select * from t where a = 2", strlen(sql), NULL, 0),
+                    "Truncation should not affect the hash");
+}
+
+static void test_digest_flags_one(const char *sql, int flags, const char *expected)
+{
+    char digest[256];
+    uint64_t hash;
+    int len = modutil_digest(sql, strlen(sql), flags, digest, sizeof(digest), &hash);
+
+    if (expected)
+    {
+        ss_info_dassert(len == (int)strlen(expected) && strcmp(digest, expected) == 0,
+                        "Digest should be as expected");
+    }
+    else
+    {
+        ss_info_dassert(len == -1, "Digest should fail");
+    }
+}
+
+void test_digest_flags()
+{
+    const int exact = MODUTIL_DIGEST_KEEP_CASE | MODUTIL_DIGEST_KEEP_HINTS |
+        MODUTIL_DIGEST_KEEP_DQUOTED | MODUTIL_DIGEST_EXACT;
+
+    test_digest_flags_one("SELECT A FROM T", MODUTIL_DIGEST_KEEP_CASE, "SELECT A FROM T");
+    test_digest_flags_one("SELECT /*!50000 SQL_NO_CACHE */ 1 /*+ hint */", MODUTIL_DIGEST_KEEP_HINTS,
+                          "select /*!50000 SQL_NO_CACHE */ ? /*+ hint */");
+    test_digest_flags_one("SELECT \"a\" FROM t", MODUTIL_DIGEST_KEEP_DQUOTED, "select \"a\" from t");
+    test_digest_flags_one("SELECT 1abc, t1.2e5, 1e, 0x1g, 0b10, 1.5E+3 FROM t", 0,
+                          "select 1abc, t1.2e5, 1e, 0x1g, ?, ? from t");
+    test_digest_flags_one("SELECT a /* x */ FROM `t` WHERE b = 'c'", exact, "SELECT a FROM `t` WHERE b = ?");
+    test_digest_flags_one("SELECT 'unterminated", exact, NULL);
+    test_digest_flags_one("SELECT \"unterminated", exact, NULL);
+    test_digest_flags_one("SELECT `unterminated", exact, NULL);
+    test_digest_flags_one("SELECT 1 /* unterminated", exact, NULL);
+    test_digest_flags_one("SELECT /*! unterminated", exact, NULL);
+
+    char digest[8];
+    uint64_t hash;
+    const char sql[] = "SELECT * FROM t WHERE a = 1";
+    ss_info_dassert(modutil_digest(sql, strlen(sql), MODUTIL_DIGEST_EXACT, digest, sizeof(digest), &hash) == -1,
+                    "An exact digest should not be truncated");
+    ss_info_dassert(modutil_digest(sql, strlen(sql), 0, digest, sizeof(digest), &hash) ==
+                    strlen("select * from t where a = ?"), "The length of the whole digest should be returned");
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
@@ -395,5 +468,7 @@ int main(int argc, char **argv)
     test_strnchr_esc();
     test_strnchr_esc_mysql();
     test_large_packets();
+    test_digest();
+    test_digest_flags();
     exit(result);
 }
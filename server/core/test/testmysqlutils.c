@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testmysqlutils.c Tests of reading the session state of OK packets
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mysql_utils.h>
+#include <skygw_debug.h>
+
+/** Session state change types */
+#define TRACK_SYSTEM_VARIABLES 0
+#define TRACK_SCHEMA 1
+
+/** The status flag that tells the OK packet has session state changes */
+#define STATE_CHANGED 0x40
+
+static uint8_t* add_string(uint8_t* ptr, const char* str)
+{
+    size_t len = strlen(str);
+    *ptr++ = len;
+    memcpy(ptr, str, len);
+    return ptr + len;
+}
+
+/**
+ * Add a session state change to a buffer
+ *
+ * @param ptr   Where the change is written
+ * @param type  Type of the change
+ * @param name  Name of the variable or NULL for a change with one value
+ * @param value The value
+ * @return The end of the change
+ */
+static uint8_t* add_change(uint8_t* ptr, uint8_t type, const char* name, const char* value)
+{
+    uint8_t data[256];
+    uint8_t* end = data;
+
+    if (name)
+    {
+        end = add_string(end, name);
+    }
+
+    end = add_string(end, value);
+
+    *ptr++ = type;
+    *ptr++ = end - data;
+    memcpy(ptr, data, end - data);
+    return ptr + (end - data);
+}
+
+/**
+ * Create an OK packet
+ *
+ * @param dest    Where the packet is written
+ * @param status  The high byte of the status flags
+ * @param changes The session state changes
+ * @param len     Length of the changes
+ * @return Length of the packet
+ */
+static size_t create_ok(uint8_t* dest, uint8_t status, const uint8_t* changes, size_t len)
+{
+    uint8_t* ptr = dest + 4;
+
+    *ptr++ = 0x00; // OK
+    *ptr++ = 1;    // Affected rows
+    *ptr++ = 0;    // Last insert ID
+    *ptr++ = 0x02; // Status flags: autocommit
+    *ptr++ = status;
+    *ptr++ = 0;    // Warnings
+    *ptr++ = 0;
+    ptr = add_string(ptr, "");
+
+    if (changes)
+    {
+        *ptr++ = len;
+        memcpy(ptr, changes, len);
+        ptr += len;
+    }
+
+    size_t payload = ptr - dest - 4;
+    dest[0] = payload;
+    dest[1] = payload >> 8;
+    dest[2] = payload >> 16;
+    dest[3] = 1;
+
+    return ptr - dest;
+}
+
+static void test_tracked_variable()
+{
+    uint8_t changes[512];
+    uint8_t packet[1024];
+    uint8_t* end = changes;
+    char value[64];
+    size_t len;
+
+    end = add_change(end, TRACK_SCHEMA, NULL, "test");
+    end = add_change(end, TRACK_SYSTEM_VARIABLES, "autocommit", "ON");
+    end = add_change(end, TRACK_SYSTEM_VARIABLES, "last_gtid", "0-1-42");
+    len = create_ok(packet, STATE_CHANGED, changes, end - changes);
+
+    ss_info_dassert(mxs_mysql_get_tracked_variable(packet, len, "last_gtid", value, sizeof(value)),
+                    "The variable should be found");
+    ss_info_dassert(strcmp(value, "0-1-42") == 0, "The value should be the tracked one");
+    ss_info_dassert(mxs_mysql_get_tracked_variable(packet, len, "LAST_GTID", value, sizeof(value)),
+                    "The name should be case-insensitive");
+    ss_info_dassert(mxs_mysql_get_tracked_variable(packet, len, "autocommit", value, sizeof(value)) &&
+                    strcmp(value, "ON") == 0, "Other variables should be found");
+    ss_info_dassert(!mxs_mysql_get_tracked_variable(packet, len, "last_gtid", value, 6),
+                    "A value that does not fit should not be returned");
+    ss_info_dassert(!mxs_mysql_get_tracked_variable(packet, len, "test", value, sizeof(value)),
+                    "Changes that are not variables should be ignored");
+    ss_info_dassert(!mxs_mysql_get_tracked_variable(packet, len, "last", value, sizeof(value)),
+                    "The whole name should match");
+
+    for (size_t i = 0; i < len; i++)
+    {
+        ss_info_dassert(!mxs_mysql_get_tracked_variable(packet, i, "last_gtid", value, sizeof(value)),
+                        "A truncated packet should not be read");
+    }
+
+    len = create_ok(packet, 0, changes, end - changes);
+    ss_info_dassert(!mxs_mysql_get_tracked_variable(packet, len, "last_gtid", value, sizeof(value)),
+                    "Without the status flag there are no changes");
+
+    len = create_ok(packet, 0, NULL, 0);
+    ss_info_dassert(!mxs_mysql_get_tracked_variable(packet, len, "last_gtid", value, sizeof(value)),
+                    "An OK packet without session state should be handled");
+
+    len = create_ok(packet, STATE_CHANGED, changes, end - changes);
+    packet[4] = 0xff;
+    ss_info_dassert(!mxs_mysql_get_tracked_variable(packet, len, "last_gtid", value, sizeof(value)),
+                    "Only OK packets should be read");
+}
+
+int main(int argc, char **argv)
+{
+    test_tracked_variable();
+    return 0;
+}
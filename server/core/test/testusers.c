@@ -92,11 +92,55 @@ test1()
 
 }
 
+/**
+ * test2    Replace the users of a listener while a lookup holds a reference
+ *
+ */
+static int
+test2()
+{
+    SERV_LISTENER listener = {};
+    USERS *users, *newusers, *ref;
+
+    spinlock_init(&listener.users_lock);
+    ss_info_dassert(NULL == listener_users_get(&listener), "A listener without users should return NULL");
+
+    users = users_alloc();
+    users_add(users, "username", "authorisation");
+    users->resources = hashtable_alloc(10, hashtable_item_strhash, hashtable_item_strcmp);
+    hashtable_memory_fns(users->resources, hashtable_item_strdup, hashtable_item_strdup,
+                         hashtable_item_free, hashtable_item_free);
+    hashtable_add(users->resources, "test", "");
+    listener_users_set(&listener, users);
+    ref = listener_users_get(&listener);
+    ss_info_dassert(users == ref, "The reference should be to the users of the listener");
+    ss_info_dassert(2 == users->refcount, "Both the listener and the lookup should hold a reference");
+
+    newusers = users_alloc();
+    listener_users_set(&listener, newusers);
+    ss_info_dassert(newusers == listener.users, "The users should be replaced");
+    ss_info_dassert(1 == ref->refcount, "The replaced users should be kept for the lookup");
+    ss_info_dassert(NULL != users_fetch(ref, "username"), "The replaced users should still be usable");
+    ss_info_dassert(NULL != hashtable_fetch(ref->resources, "test"),
+                    "The database names of the replaced users should still be usable");
+    listener_users_put(ref);
+
+    ref = listener_users_get(&listener);
+    listener_users_put(ref);
+    ss_info_dassert(1 == newusers->refcount, "Returning a reference should not free the users");
+
+    listener_users_set(&listener, NULL);
+    ss_info_dassert(NULL == listener.users, "The users should be removed");
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
 
     result += test1();
+    result += test2();
 
     exit(result);
 }
@@ -55,6 +55,17 @@ thread_wait(THREAD thd)
     pthread_join((pthread_t)thd, &rval);
 }
 
+/**
+ * Detach a running thread, its resources are released when it completes
+ *
+ * @param thd   The thread handle
+ */
+void
+thread_detach(THREAD thd)
+{
+    pthread_detach((pthread_t)thd);
+}
+
 /**
  * Put the thread to sleep for a number of milliseconds
  *
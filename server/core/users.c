@@ -48,6 +48,8 @@ users_alloc()
         return NULL;
     }
 
+    rval->refcount = 1;
+
     if ((rval->data = hashtable_alloc(USERS_HASHTABLE_DEFAULT_SIZE,
                                       hashtable_item_strhash, hashtable_item_strcmp)) == NULL)
     {
@@ -74,6 +76,15 @@ users_free(USERS *users)
     if (users)
     {
         hashtable_free(users->data);
+        if (users->index)
+        {
+            hashtable_free(users->index);
+        }
+        if (users->resources)
+        {
+            hashtable_free(users->resources);
+        }
+        MXS_FREE(users->cache);
         MXS_FREE(users);
     }
 }
@@ -26,9 +26,13 @@
  * @endverbatim
  */
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" int atomic_add(int *variable, int value);
+extern "C" uint64_t atomic_add_uint64(uint64_t *variable, int64_t value);
 #else
 extern int atomic_add(int *variable, int value);
+extern uint64_t atomic_add_uint64(uint64_t *variable, int64_t value);
 #endif
 #endif
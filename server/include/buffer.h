@@ -86,11 +86,18 @@ typedef enum
  * A structure to encapsulate the data in a form that the data itself can be
  * shared between multiple GWBUF's without the need to make multiple copies
  * but still maintain separate data pointers.
+ *
+ * The shared buffer and its data are allocated in the same block of memory
+ * as the GWBUF returned by gwbuf_alloc. The block is released once the last
+ * GWBUF referring to the data has been freed. The properties describe the
+ * data and are thus shared by all the GWBUFs that refer to it.
  */
 typedef struct
 {
     unsigned char   *data;                  /*< Physical memory that was allocated */
-    int             refcount;               /*< Reference count on the buffer */
+    BUF_PROPERTY    *properties;            /*< Buffer properties */
+    int             refcount;               /*< Reference count on the buffer, modified atomically */
+    int             pool_class;             /*< Buffer pool size class, -1 if not pooled */
 } SHARED_BUF;
 
 typedef enum
@@ -130,10 +137,13 @@ struct buffer_object_st
  * or written to a descriptor. The use of linked lists of buffers with
  * flexible data pointers is designed to minimise the need for data to
  * be copied within the gateway.
+ *
+ * A chain of buffers is owned by one thread at a time and is not locked.
+ * Only the shared buffer can be modified concurrently. The structure fits
+ * into one cache line on 64-bit platforms.
  */
 typedef struct gwbuf
 {
-    SPINLOCK        gwbuf_lock;
     struct gwbuf    *next;  /*< Next buffer in a linked chain of buffers */
     struct gwbuf    *tail;  /*< Last buffer in a linked chain of buffers */
     void            *start; /*< Start of the valid data */
@@ -143,7 +153,6 @@ typedef struct gwbuf
     gwbuf_info_t    gwbuf_info; /*< Info bits */
     gwbuf_type_t    gwbuf_type; /*< buffer's data type information */
     HINT            *hint;  /*< Hint data for this buffer */
-    BUF_PROPERTY    *properties; /*< Buffer properties */
 } GWBUF;
 
 /*<
@@ -209,6 +218,7 @@ void                    gwbuf_add_buffer_object(GWBUF* buf,
                                                 void*  data,
                                                 void (*donefun_fp)(void *));
 void*                   gwbuf_get_buffer_object_data(GWBUF* buf, bufobj_id_t id);
+extern void             dprintBufferPools(void *pdcb);
 #if defined(BUFFER_TRACE)
 extern void             dprintAllBuffers(void *pdcb);
 #endif
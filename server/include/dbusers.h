@@ -74,6 +74,10 @@ extern int load_mysql_users(SERV_LISTENER *listener);
 extern int mysql_users_add(USERS *users, MYSQL_USER_HOST *key, char *auth);
 extern USERS *mysql_users_alloc();
 extern char *mysql_users_fetch(USERS *users, MYSQL_USER_HOST *key);
+extern char *mysql_users_find(USERS *users, MYSQL_USER_HOST *key, bool match_wildcard);
+extern int mysql_users_cache_get(USERS *users, const MYSQL_USER_HOST *key, uint8_t *password);
+extern void mysql_users_cache_add(USERS *users, const MYSQL_USER_HOST *key,
+                                  const uint8_t *password, int ttl);
 extern int reload_mysql_users(SERV_LISTENER *listener);
 extern int replace_mysql_users(SERV_LISTENER *listener);
 
@@ -77,6 +77,7 @@ struct dcb;
  *      eventqlock              Spinlock to protect this structure
  *      inserted                Insertion time for logging purposes
  *      started                 Time that the processign started
+ *      queue                   Index of the poll event queue the DCB is placed on
  */
 typedef struct
 {
@@ -88,9 +89,10 @@ typedef struct
     SPINLOCK        eventqlock;
     unsigned long   inserted;
     unsigned long   started;
+    int             queue;
 } DCBEVENTQ;
 
-#define DCBEVENTQ_INIT {NULL, NULL, 0, 0, 0, SPINLOCK_INIT, 0, 0}
+#define DCBEVENTQ_INIT {NULL, NULL, 0, 0, 0, SPINLOCK_INIT, 0, 0, 0}
 
 #define DCBFD_CLOSED -1
 
@@ -100,7 +102,8 @@ typedef struct
 typedef struct dcbstats
 {
     int     n_reads;        /*< Number of reads on this descriptor */
-    int     n_writes;       /*< Number of writes on this descriptor */
+    int     n_writes;       /*< Number of write system calls on this descriptor */
+    int     n_buffers_written; /*< Number of buffers completely written */
     int     n_accepts;      /*< Number of accepts on this descriptor */
     int     n_buffered;     /*< Number of buffered writes */
     int     n_high_water;   /*< Number of crosses of high water mark */
@@ -121,19 +124,19 @@ typedef struct dcbstats
  * processing an event that will access the DCB.
  *
  * We solve this issue by making the dcb_free routine merely mark a DCB as a zombie and
- * place it on a special zombie list. Before placing the DCB on the zombie list we create
- * a bitmask with a bit set in it for each active polling thread. Each thread will call
- * a routine to process the zombie list at the end of the polling loop. This routine
- * will clear the bit value that corresponds to the calling thread. Once the bitmask
- * is completely cleared the DCB can finally be freed and removed from the zombie list.
+ * place it on the zombie list of the calling thread. The DCB is stamped with the value of
+ * a global epoch counter that is incremented for each new zombie. At the end of the polling
+ * loop, where a thread holds no references to DCBs, each thread publishes the latest epoch
+ * it has seen. Once every running polling thread has published an epoch at least as large
+ * as the stamp of the DCB, the DCB can finally be freed and removed from the zombie list.
  */
 typedef struct
 {
-    GWBITMASK       bitmask;        /*< The bitmask of threads */
+    long            epoch;          /*< The epoch after which the DCB can be freed */
     struct dcb      *next;          /*< Next pointer for the zombie list */
 } DCBMM;
 
-#define DCBMM_INIT {GWBITMASK_INIT}
+#define DCBMM_INIT {0, NULL}
 
 /* DCB states */
 typedef enum
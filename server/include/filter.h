@@ -60,6 +60,10 @@ typedef struct
  *      clientReply             Called for each reply packet
  *      diagnostics             Called to force the filter to print
  *                              diagnostic output
+ *      statistics              Optional, called to get the statistics
+ *                              of the filter as a result set
+ *      resetStatistics         Optional, called to clear the statistics
+ *                              of the filter
  *
  * @endverbatim
  *
@@ -78,6 +82,8 @@ typedef struct filter_object
     int    (*routeQuery)(FILTER *instance, void *fsession, GWBUF *queue);
     int    (*clientReply)(FILTER *instance, void *fsession, GWBUF *queue);
     void   (*diagnostics)(FILTER *instance, void *fsession, DCB *dcb);
+    struct resultset *(*statistics)(FILTER *instance);
+    void   (*resetStatistics)(FILTER *instance);
 } FILTER_OBJECT;
 
 /**
@@ -85,7 +91,7 @@ typedef struct filter_object
  * is changed these values must be updated in line with the rules in the
  * file modinfo.h.
  */
-#define FILTER_VERSION  {2, 1, 0}
+#define FILTER_VERSION  {2, 2, 0}
 /**
  * The definition of a filter from the configuration file.
  * This is basically the link between a plugin to load and the
@@ -115,5 +121,7 @@ int filter_standard_parameter(char *);
 void dprintAllFilters(DCB *);
 void dprintFilter(DCB *, FILTER_DEF *);
 void dListFilters(DCB *);
+struct resultset *filterGetStatistics(FILTER_DEF *);
+bool filterResetStatistics(FILTER_DEF *);
 
 #endif
@@ -27,6 +27,8 @@
  * @endverbatim
  */
 
+#include <stdint.h>
+#include <time.h>
 #include <gw_protocol.h>
 #include <gw_ssl.h>
 #include <hashtable.h>
@@ -34,6 +36,30 @@
 struct dcb;
 struct service;
 
+/**
+ * The authentication statistics of a listener
+ */
+typedef struct
+{
+    int n_authentications;      /**< Number of client authentications */
+    int n_failed;               /**< Number of failed authentications */
+    int n_cache_hits;           /**< User lookups served from the authentication cache */
+    int n_cache_misses;         /**< User lookups not found in the authentication cache */
+    uint64_t auth_time;         /**< Microseconds spent in authentication */
+} LISTENER_AUTH_STATS;
+
+/**
+ * The statistics of the user data loads of a listener
+ */
+typedef struct
+{
+    int n_loads;                /**< Number of user data loads */
+    int n_failed;               /**< Number of failed loads */
+    int n_users;                /**< Number of users after the last successful load */
+    time_t last_load;           /**< When the users were last loaded, 0 if never */
+    uint64_t load_time;         /**< Microseconds the last load took */
+} LISTENER_LOAD_STATS;
+
 /**
  * The servlistener structure is used to link a service to the protocols that
  * are used to support that service. It defines the name of the protocol module
@@ -50,9 +76,11 @@ typedef struct servlistener
     SSL_LISTENER *ssl;          /**< Structure of SSL data or NULL */
     struct dcb *listener;       /**< The DCB for the listener */
     struct users *users;        /**< The user data for this listener */
-    HASHTABLE *resources;       /**< hastable for listener resources, i.e. database names */
     struct service* service;    /**< The service which used by this listener */
+    LISTENER_AUTH_STATS auth_stats; /**< Authentication statistics */
+    LISTENER_LOAD_STATS load_stats; /**< User data load statistics */
     SPINLOCK lock;
+    SPINLOCK users_lock;        /**< Protects the users pointer while a reference is taken */
     struct  servlistener *next; /**< Next service protocol */
 } SERV_LISTENER;
 
@@ -60,6 +88,9 @@ SERV_LISTENER *listener_alloc(struct service* service, char *name, char *protoco
                               char *address, unsigned short port, char *authenticator,
                               SSL_LISTENER *ssl);
 void listener_free(SERV_LISTENER* listener);
+struct users *listener_users_get(SERV_LISTENER *listener);
+void listener_users_put(struct users *users);
+void listener_users_set(SERV_LISTENER *listener, struct users *users);
 int listener_set_ssl_version(SSL_LISTENER *ssl_listener, char* version);
 void listener_set_certificates(SSL_LISTENER *ssl_listener, char* cert, char* key, char* ca_cert);
 int listener_init_SSL(SSL_LISTENER *ssl_listener);
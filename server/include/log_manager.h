@@ -130,6 +130,7 @@ void mxs_log_set_augmentation(int bits);
 void mxs_log_set_throttling(const MXS_LOG_THROTTLING* throttling);
 
 void mxs_log_get_throttling(MXS_LOG_THROTTLING* throttling);
+int  mxs_log_get_dropped(void);
 
 int mxs_log_message(int priority,
                     const char* modname,
@@ -115,6 +115,7 @@ typedef struct
     unsigned long id;                                  /**< MaxScale ID */
     unsigned int  n_nbpoll;                            /**< Tune number of non-blocking polls */
     unsigned int  pollsleep;                           /**< Wait time in blocking polls */
+    bool          per_thread_queues;                   /**< Use an event queue per polling thread */
     int           syslog;                              /**< Log to syslog */
     int           maxlog;                              /**< Log to MaxScale's own logs */
     int           log_to_shm;                          /**< Write log-file to shared memory */
@@ -150,6 +151,7 @@ bool                config_load(char *);
 unsigned int        config_nbpolls();
 double              config_percentage_value(char *str);
 unsigned int        config_pollsleep();
+bool                config_per_thread_queues();
 int                 config_reload();
 bool                config_set_qualified_param(CONFIG_PARAMETER* param,
                                                void* val,
@@ -39,6 +39,12 @@
 #define IS_FULL_RESPONSE(buf) (modutil_count_signal_packets(buf,0,0) == 2)
 #define PTR_EOF_MORE_RESULTS(b) ((PTR_IS_EOF(b) && ptr[7] & 0x08))
 
+/** Flags of modutil_digest() */
+#define MODUTIL_DIGEST_KEEP_CASE    0x01 /*< Keep the case of the letters */
+#define MODUTIL_DIGEST_KEEP_HINTS   0x02 /*< Keep executable comments and optimizer hints */
+#define MODUTIL_DIGEST_KEEP_DQUOTED 0x04 /*< Keep double quoted strings */
+#define MODUTIL_DIGEST_EXACT        0x08 /*< Fail instead of truncating the digest */
+
 
 extern int      modutil_is_SQL(GWBUF *);
 extern int      modutil_is_SQL_prepare(GWBUF *);
@@ -69,5 +75,7 @@ char* strnchr_esc_mysql(char* ptr, char c, int len);
 bool is_mysql_statement_end(const char* start, int len);
 bool is_mysql_sp_end(const char* start, int len);
 char* modutil_get_canonical(GWBUF* querybuf);
+uint64_t modutil_get_digest(const char *sql, size_t len, char *dest, size_t size);
+int modutil_digest(const char *sql, size_t len, int flags, char *dest, size_t size, uint64_t *hash);
 
 #endif
@@ -15,6 +15,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <mysql.h>
 #include <server.h>
 
@@ -27,6 +28,9 @@ uint64_t leint_consume(uint8_t ** c);
 char* lestr_consume_dup(uint8_t** c);
 char* lestr_consume(uint8_t** c, size_t *size);
 
+/** Session state tracking */
+bool mxs_mysql_get_tracked_variable(uint8_t* packet, size_t len, const char* name,
+                                    char* dest, size_t size);
 
 MYSQL *mxs_mysql_real_connect(MYSQL *mysql, SERVER *server, const char *user, const char *passwd);
 
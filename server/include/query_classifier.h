@@ -75,6 +75,22 @@ typedef enum qc_parse_result
 
 #define QUERY_IS_TYPE(mask,type) ((mask & type) == type)
 
+/**
+ * Statistics of the classification cache of a query classifier, summed over
+ * all threads that have used it.
+ */
+typedef struct qc_cache_stats
+{
+    uint64_t fast_path;   /*< Statements classified without parsing them. */
+    uint64_t hits;        /*< Statements whose classification was found in the cache. */
+    uint64_t misses;      /*< Statements that had to be parsed. */
+    uint64_t evictions;   /*< Classifications removed to make room for new ones. */
+    uint64_t uncacheable; /*< Parsed statements that could not be cached. */
+    uint64_t entries;     /*< Classifications currently in the caches. */
+    uint64_t parse_ns;    /*< Time spent parsing statements, in nanoseconds. */
+    uint64_t saved_ns;    /*< Parsing time the cache hits saved, in nanoseconds. */
+} QC_CACHE_STATS;
+
 bool qc_init(const char* plugin_name, const char* plugin_args);
 void qc_end(void);
 
@@ -100,6 +116,7 @@ bool qc_query_has_clause(GWBUF* buf);
 char* qc_get_qtype_str(qc_query_type_t qtype);
 char* qc_get_affected_fields(GWBUF* buf);
 char** qc_get_database_names(GWBUF* querybuf, int* size);
+bool qc_get_cache_stats(QC_CACHE_STATS* stats);
 
 const char* qc_op_to_string(qc_query_op_t op);
 const char* qc_type_to_string(qc_query_type_t type);
@@ -126,9 +143,10 @@ struct query_classifier
     bool (*qc_query_has_clause)(GWBUF* buf);
     char* (*qc_get_affected_fields)(GWBUF* buf);
     char** (*qc_get_database_names)(GWBUF* querybuf, int* size);
+    bool (*qc_get_cache_stats)(QC_CACHE_STATS* stats);
 };
 
-#define QUERY_CLASSIFIER_VERSION {1, 0, 0}
+#define QUERY_CLASSIFIER_VERSION {1, 1, 0}
 
 EXTERN_C_BLOCK_END
 
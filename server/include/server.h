@@ -67,6 +67,8 @@ typedef struct
     int n_current;     /**< Current connections */
     int n_current_ops; /**< Current active operations */
     int n_persistent;  /**< Current persistent pool */
+    int response_time; /**< Decaying average of the response time in microseconds */
+    int64_t response_time_scaled; /**< The average in fixed point, used to update it */
 } SERVER_STATS;
 
 /**
@@ -152,6 +152,10 @@ typedef struct service
     struct service *next;              /**< The next service in the linked list */
     bool retry_start;                  /*< If starting of the service should be retried later */
     bool log_auth_warnings;            /*< Log authentication failures and warnings */
+    int auth_cache_ttl;                /*< Seconds user lookups are cached, 0 for no caching */
+    int users_refresh_time;            /*< Seconds between periodic users refreshes, 0 for none */
+    int users_loading;                 /*< Whether a background users load is in progress */
+    bool session_track;                /*< Offer session state tracking to clients */
 } SERVICE;
 
 typedef enum count_spec_t
@@ -203,6 +207,8 @@ extern int serviceStripDbEsc(SERVICE* service, int action);
 extern int serviceAuthAllServers(SERVICE *service, int action);
 extern void service_update(SERVICE *, char *, char *, char *);
 extern int service_refresh_users(SERVICE *);
+extern int service_refresh_users_async(SERVICE *);
+extern void serviceSetUsersRefreshTime(SERVICE *, int);
 extern void printService(SERVICE *);
 extern void printAllServices();
 extern void dprintAllServices(DCB *);
@@ -144,6 +144,7 @@ typedef struct session
     SESSION_FILTER  *filters;         /*< The filters in use within this session */
     DOWNSTREAM      head;             /*< Head of the filter chain */
     UPSTREAM        tail;             /*< The tail of the filter chain */
+    struct server   *reply_server;    /*< The server of the reply being routed, NULL if not known */
     int             refcount;         /*< Reference count on the session */
     bool            ses_is_child;     /*< this is a child session */
     skygw_chk_t     ses_chk_tail;
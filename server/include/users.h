@@ -53,8 +53,12 @@ typedef struct
 typedef struct users
 {
     HASHTABLE *data;                        /**< The hashtable containing the actual data */
+    HASHTABLE *index;                       /**< Optional lookup index built from the data */
+    HASHTABLE *resources;                   /**< Optional database names of the servers */
+    void *cache;                            /**< Optional cache of lookup results, a single allocation */
     char *(*usersCustomUserFormat)(void *); /**< Optional username format routine */
     USERS_STATS stats;                      /**< The statistics for the users table */
+    int refcount;                           /**< References to the table, modified atomically */
     unsigned char cksum[SHA_DIGEST_LENGTH]; /**< The users' table ckecksum */
 } USERS;
 
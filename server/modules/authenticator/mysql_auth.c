@@ -29,6 +29,7 @@
 #include <mysql_client_server_protocol.h>
 #include <gw_authenticator.h>
 #include <maxscale/alloc.h>
+#include <atomic.h>
 #include <maxscale/poll.h>
 #include <dbusers.h>
 #include <gwdirs.h>
@@ -56,6 +57,7 @@ static bool mysql_auth_is_client_ssl_capable(DCB *dcb);
 static int mysql_auth_authenticate(DCB *dcb);
 static void mysql_auth_free_client_data(DCB *dcb);
 static int mysql_auth_load_users(SERV_LISTENER *port);
+static void mysql_auth_user_key(char *username, DCB *dcb, MYSQL_USER_HOST *key);
 
 /*
  * The "module object" for mysql client authenticator module.
@@ -172,18 +174,51 @@ mysql_auth_authenticate(DCB *dcb)
 
     else
     {
+        LISTENER_AUTH_STATS *stats = &dcb->listener->auth_stats;
+        struct timespec start, end;
+        bool known_missing = false;
+
         MXS_DEBUG("Receiving connection from '%s' to database '%s'.",
                   client_data->user, client_data->db);
 
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (dcb->service->auth_cache_ttl > 0)
+        {
+            MYSQL_USER_HOST key;
+            mysql_auth_user_key(client_data->user, dcb, &key);
+            USERS *users = listener_users_get(dcb->listener);
+            known_missing = mysql_users_cache_get(users, &key, NULL) == 0;
+            listener_users_put(users);
+        }
+
         auth_ret = combined_auth_check(dcb, client_data->auth_token, client_data->auth_token_len,
                                        protocol, client_data->user, client_data->client_sha1, client_data->db);
 
-        /* On failed authentication try to load user table from backend database */
-        /* Success for service_refresh_users returns 0 */
-        if (MYSQL_AUTH_SUCCEEDED != auth_ret && 0 == service_refresh_users(dcb->service))
+        /**
+         * On failed authentication reload the users from the backend databases
+         * and try again, the user may have been created or its password changed
+         * after the users were loaded. A user that is cached as not found was
+         * missing from the users that were loaded last, a reload is not done for
+         * each of its connection attempts. Success for service_refresh_users
+         * returns 0.
+         */
+        if (MYSQL_AUTH_SUCCEEDED != auth_ret && !known_missing &&
+            0 == service_refresh_users(dcb->service))
+        {
+            auth_ret = combined_auth_check(dcb, client_data->auth_token, client_data->auth_token_len,
+                                           protocol, client_data->user, client_data->client_sha1,
+                                           client_data->db);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        __sync_fetch_and_add(&stats->auth_time, (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+                             (end.tv_nsec - start.tv_nsec) / 1000);
+        atomic_add(&stats->n_authentications, 1);
+
+        if (MYSQL_AUTH_SUCCEEDED != auth_ret)
         {
-            auth_ret = combined_auth_check(dcb, client_data->auth_token, client_data->auth_token_len, protocol,
-                                           client_data->user, client_data->client_sha1, client_data->db);
+            atomic_add(&stats->n_failed, 1);
         }
 
         /* on successful authentication, set user into dcb field */
@@ -418,12 +453,37 @@ mysql_auth_is_client_ssl_capable(DCB *dcb)
     return (protocol->client_capabilities & (int)GW_MYSQL_CAPABILITIES_SSL) ? true : false;
 }
 
+/**
+ * Build the key of the user lookup of a client
+ *
+ * @param username The user to look for
+ * @param dcb      Request handler DCB connected to the client
+ * @param key      The key to fill
+ */
+static void
+mysql_auth_user_key(char *username, DCB *dcb, MYSQL_USER_HOST *key)
+{
+    MYSQL_session *client_data = (MYSQL_session *) dcb->data;
+
+    memset(key, 0, sizeof(*key));
+    key->user = username;
+    memcpy(&key->ipv4, &dcb->ipv4, sizeof(struct sockaddr_in));
+    key->netmask = 32;
+    key->resource = client_data->db;
+
+    if (strlen(dcb->remote) < MYSQL_HOST_MAXLEN)
+    {
+        strcpy(key->hostname, dcb->remote);
+    }
+}
+
 /**
  * gw_find_mysql_user_password_sha1
  *
  * The routine fetches an user from the MaxScale users' table
  * The users' table is dcb->listener->users or a different one specified with void *repository
  * The user lookup uses username,host and db name (if passed in connection or change user)
+ * and resolves the most specific grant of the user that matches the client
  *
  * If found the HEX password, representing sha1(sha1(password)), is converted in binary data and
  * copied into gateway_password
@@ -436,21 +496,11 @@ mysql_auth_is_client_ssl_capable(DCB *dcb)
  */
 int gw_find_mysql_user_password_sha1(char *username, uint8_t *gateway_password, DCB *dcb)
 {
-    MYSQL_session *client_data = (MYSQL_session *) dcb->data;
     SERVICE *service = (SERVICE *) dcb->service;
     SERV_LISTENER *listener = dcb->listener;
-    struct sockaddr_in *client = (struct sockaddr_in *) &dcb->ipv4;
-
-    MYSQL_USER_HOST key = {};
-    key.user = username;
-    memcpy(&key.ipv4, client, sizeof(struct sockaddr_in));
-    key.netmask = 32;
-    key.resource = client_data->db;
+    MYSQL_USER_HOST key;
 
-    if (strlen(dcb->remote) < MYSQL_HOST_MAXLEN)
-    {
-        strcpy(key.hostname, dcb->remote);
-    }
+    mysql_auth_user_key(username, dcb, &key);
 
     MXS_DEBUG("%lu [MySQL Client Auth], checking user [%s@%s]%s%s",
               pthread_self(),
@@ -459,101 +509,43 @@ int gw_find_mysql_user_password_sha1(char *username, uint8_t *gateway_password,
               key.resource != NULL ? " db: " : "",
               key.resource != NULL ? key.resource : "");
 
-    /* look for user@current_ipv4 now */
-    char *user_password = mysql_users_fetch(listener->users, &key);
+    /*
+     * Clients from localhost (127.0.0.1, IPv4 only) only match the grants
+     * from their exact address unless localhost_match_wildcard_host is set.
+     */
+    bool match_wildcard = key.ipv4.sin_addr.s_addr != 0x0100007F ||
+                          service->localhost_match_wildcard_host;
 
-    if (!user_password)
+    /** The users can be replaced by a reload while the lookup is in progress */
+    USERS *users = listener_users_get(listener);
+
+    if (service->auth_cache_ttl > 0)
     {
-        /* The user is not authenticated @ current IPv4 */
+        int cached = mysql_users_cache_get(users, &key, gateway_password);
 
-        while (1)
+        if (cached >= 0)
         {
-            /*
-             * (1) Check for localhost first: 127.0.0.1 (IPv4 only)
-             */
-
-            if ((key.ipv4.sin_addr.s_addr == 0x0100007F) &&
-                !dcb->service->localhost_match_wildcard_host)
-            {
-                /* Skip the wildcard check and return 1 */
-                break;
-            }
-
-            /*
-             * (2) check for possible IPv4 class C,B,A networks
-             */
-
-            /* Class C check */
-            key.ipv4.sin_addr.s_addr &= 0x00FFFFFF;
-            key.netmask -= 8;
-
-            user_password = mysql_users_fetch(listener->users, &key);
-
-            if (user_password)
-            {
-                break;
-            }
-
-            /* Class B check */
-            key.ipv4.sin_addr.s_addr &= 0x0000FFFF;
-            key.netmask -= 8;
-
-            user_password = mysql_users_fetch(listener->users, &key);
-
-            if (user_password)
-            {
-                break;
-            }
-
-            /* Class A check */
-            key.ipv4.sin_addr.s_addr &= 0x000000FF;
-            key.netmask -= 8;
-
-            user_password = mysql_users_fetch(listener->users, &key);
-
-            if (user_password)
-            {
-                break;
-            }
-
-            /*
-             * (3) Continue check for wildcard host, user@%
-             */
-
-            memset(&key.ipv4, 0, sizeof(struct sockaddr_in));
-            key.netmask = 0;
-
-            MXS_DEBUG("%lu [MySQL Client Auth], checking user [%s@%s] with "
-                      "wildcard host [%%]",
-                      pthread_self(),
-                      key.user,
-                      dcb->remote);
-
-            user_password = mysql_users_fetch(listener->users, &key);
+            atomic_add(&listener->auth_stats.n_cache_hits, 1);
+            listener_users_put(users);
+            return cached ? 0 : 1;
+        }
 
-            if (user_password)
-            {
-                break;
-            }
+        atomic_add(&listener->auth_stats.n_cache_misses, 1);
+    }
 
-            if (!user_password)
-            {
-                /*
-                 * user@% not found.
-                 */
-
-                MXS_DEBUG("%lu [MySQL Client Auth], user [%s@%s] not existent",
-                          pthread_self(),
-                          key.user,
-                          dcb->remote);
-
-                MXS_INFO("Authentication Failed: user [%s@%s] not found.",
-                         key.user,
-                         dcb->remote);
-                break;
-            }
+    /* look for the most specific grant of the user that matches the client */
+    char *user_password = mysql_users_find(users, &key, match_wildcard);
 
-        }
+    if (!user_password)
+    {
+        MXS_DEBUG("%lu [MySQL Client Auth], user [%s@%s] not existent",
+                  pthread_self(),
+                  key.user,
+                  dcb->remote);
+
+        MXS_INFO("Authentication Failed: user [%s@%s] not found.",
+                 key.user,
+                 dcb->remote);
     }
 
     /* If user@host has been found we get the the password in binary format*/
@@ -570,13 +562,18 @@ int gw_find_mysql_user_password_sha1(char *username, uint8_t *gateway_password,
             passwd_len = (passwd_len <= (SHA_DIGEST_LENGTH * 2)) ? passwd_len : (SHA_DIGEST_LENGTH * 2);
             gw_hex2bin(gateway_password, user_password, passwd_len);
         }
-
-        return 0;
     }
-    else
+
+    if (service->auth_cache_ttl > 0)
     {
-        return 1;
+        mysql_users_cache_add(users, &key, user_password ? gateway_password : NULL,
+                              service->auth_cache_ttl);
     }
+
+    int rval = user_password ? 0 : 1;
+    listener_users_put(users);
+
+    return rval;
 }
 
 /**
@@ -727,10 +724,15 @@ check_db_name_after_auth(DCB *dcb, char *database, int auth_ret)
     /* check for database name and possible match in resource hashtable */
     if (database && strlen(database))
     {
-        /* if database names are loaded we can check if db name exists */
-        if (dcb->listener->resources != NULL)
+        /**
+         * If database names are loaded we can check if db name exists. They are
+         * replaced along with the users, a reference keeps them valid.
+         */
+        USERS *users = listener_users_get(dcb->listener);
+
+        if (users && users->resources != NULL)
         {
-            if (hashtable_fetch(dcb->listener->resources, database))
+            if (hashtable_fetch(users->resources, database))
             {
                 db_exists = 1;
             }
@@ -745,6 +747,8 @@ check_db_name_after_auth(DCB *dcb, char *database, int auth_ret)
             db_exists = -1;
         }
 
+        listener_users_put(users);
+
         if (db_exists == 0 && auth_ret == MYSQL_AUTH_SUCCEEDED)
         {
             auth_ret = MYSQL_FAILED_AUTH_DB;
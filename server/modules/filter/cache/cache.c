@@ -18,11 +18,13 @@
 #include <modinfo.h>
 #include <modutil.h>
 #include <query_classifier.h>
+#include <skygw_utils.h>
 #include "storage.h"
 
 static char VERSION_STRING[] = "V1.0.0";
 
 static const int DEFAULT_TTL = 10;
+static const char DEFAULT_STORAGE[] = "storage_inmemory";
 
 static FILTER *createInstance(const char *name, char **options, FILTER_PARAMETER **);
 static void   *newSession(FILTER *instance, SESSION *session);
@@ -93,6 +95,9 @@ typedef struct cache_instance
     const char           *name;
     const char           *storage_name;
     const char           *storage_args;
+    char                 *storage_args_copy; // Copy of storage_args, split into storage_argv.
+    char                **storage_argv;
+    int                   storage_argc;
     uint32_t              ttl;             // Time to live in seconds.
     CACHE_STORAGE_MODULE *module;
     CACHE_STORAGE        *storage;
@@ -114,6 +119,7 @@ static bool route_using_cache(CACHE_INSTANCE *instance,
                               CACHE_SESSION_DATA *sdata,
                               const GWBUF *key,
                               GWBUF **value);
+static bool split_storage_args(CACHE_INSTANCE *cinstance, const char *storage_args);
 
 //
 // API BEGIN
@@ -131,7 +137,7 @@ static bool route_using_cache(CACHE_INSTANCE *instance,
  */
 static FILTER *createInstance(const char *name, char **options, FILTER_PARAMETER **params)
 {
-    const char *storage_name = NULL;
+    const char *storage_name = DEFAULT_STORAGE;
     const char *storage_args = NULL;
     uint32_t ttl = DEFAULT_TTL;
 
@@ -141,7 +147,8 @@ static FILTER *createInstance(const char *name, char **options, FILTER_PARAMETER
     {
         const FILTER_PARAMETER *param = params[i];
 
-        if (strcmp(param->name, "storage_name") == 0)
+        if (strcmp(param->name, "storage") == 0 ||
+            strcmp(param->name, "storage_name") == 0)
         {
             storage_name = param->value;
         }
@@ -177,11 +184,20 @@ static FILTER *createInstance(const char *name, char **options, FILTER_PARAMETER
     {
         if ((cinstance = MXS_CALLOC(1, sizeof(CACHE_INSTANCE))) != NULL)
         {
-            CACHE_STORAGE_MODULE *module = cache_storage_open(storage_name);
+            CACHE_STORAGE_MODULE *module = NULL;
 
-            if (module)
+            if (!split_storage_args(cinstance, storage_args))
             {
-                CACHE_STORAGE *storage = module->api->createInstance(name, ttl, 0, NULL);
+                MXS_FREE(cinstance->storage_argv);
+                MXS_FREE(cinstance->storage_args_copy);
+                MXS_FREE(cinstance);
+                cinstance = NULL;
+            }
+            else if ((module = cache_storage_open(storage_name)))
+            {
+                CACHE_STORAGE *storage = module->api->createInstance(name, ttl,
+                                                                     cinstance->storage_argc,
+                                                                     cinstance->storage_argv);
 
                 if (storage)
                 {
@@ -198,13 +214,17 @@ static FILTER *createInstance(const char *name, char **options, FILTER_PARAMETER
                 {
                     MXS_ERROR("Could not create storage instance for %s.", name);
                     cache_storage_close(module);
+                    MXS_FREE(cinstance->storage_argv);
+                    MXS_FREE(cinstance->storage_args_copy);
                     MXS_FREE(cinstance);
                     cinstance = NULL;
                 }
             }
             else
             {
-                MXS_ERROR("Could not load cache storage module %s.", name);
+                MXS_ERROR("Could not load cache storage module %s.", storage_name);
+                MXS_FREE(cinstance->storage_argv);
+                MXS_FREE(cinstance->storage_args_copy);
                 MXS_FREE(cinstance);
                 cinstance = NULL;
             }
@@ -350,7 +370,9 @@ static int routeQuery(FILTER *instance, void *sdata, GWBUF *packets)
                 // happen is that caching is not used, even though it would be
                 // possible.
 
-                if (qc_get_operation(packet) == QUERY_OP_SELECT)
+                // A result from the cache is written to the client DCB, so
+                // without one the query is always routed.
+                if (qc_get_operation(packet) == QUERY_OP_SELECT && csdata->session->client_dcb)
                 {
                     C_DEBUG("Is a SELECT");
 
@@ -446,7 +468,15 @@ static void diagnostics(FILTER *instance, void *sdata, DCB *dcb)
     CACHE_INSTANCE *cinstance = (CACHE_INSTANCE*)instance;
     CACHE_SESSION_DATA *csdata = (CACHE_SESSION_DATA*)sdata;
 
-    dcb_printf(dcb, "Hello World from Cache!\n");
+    dcb_printf(dcb, "\t\tStorage module:         %s\n", cinstance->storage_name);
+    dcb_printf(dcb, "\t\tStorage arguments:      %s\n",
+               cinstance->storage_args ? cinstance->storage_args : "");
+    dcb_printf(dcb, "\t\tTTL:                    %u\n", cinstance->ttl);
+
+    if (cinstance->module->api->diagnostics)
+    {
+        cinstance->module->api->diagnostics(cinstance->storage, dcb);
+    }
 }
 
 //
@@ -470,7 +500,14 @@ static bool route_using_cache(CACHE_INSTANCE *instance,
     // TODO: This works *only* if only one request/response is handled at a time.
     // TODO: Is that the case, or is it not?
 
-    cache_result_t result = csdata->api->getKey(csdata->storage, query, csdata->key);
+    DCB *dcb = csdata->session->client_dcb;
+    MYSQL_session *mysql_session = dcb ? (MYSQL_session*)dcb->data : NULL;
+    const char *default_db = mysql_session && *mysql_session->db ? mysql_session->db : NULL;
+    const char *user = dcb ? dcb->user : NULL;
+    const char *host = dcb ? dcb->remote : NULL;
+
+    cache_result_t result = csdata->api->getKey(csdata->storage, user, host, default_db,
+                                                query, csdata->key);
 
     if (result == CACHE_RESULT_OK)
     {
@@ -497,3 +534,73 @@ static bool route_using_cache(CACHE_INSTANCE *instance,
 
     return result == CACHE_RESULT_OK;
 }
+
+/**
+ * Split the comma separated storage arguments into an argv array.
+ *
+ * @param cinstance    The cache instance where the arguments are stored.
+ * @param storage_args The value of the storage_args parameter, may be NULL.
+ * @return True if the arguments could be split, false if the value is
+ *         malformed or memory could not be allocated.
+ */
+static bool split_storage_args(CACHE_INSTANCE *cinstance, const char *storage_args)
+{
+    if (storage_args == NULL)
+    {
+        return true;
+    }
+
+    cinstance->storage_args_copy = MXS_STRDUP(storage_args);
+
+    if (cinstance->storage_args_copy == NULL)
+    {
+        return false;
+    }
+
+    char *args = trim(cinstance->storage_args_copy);
+
+    int n = 1;
+
+    for (const char *p = storage_args; *p; p++)
+    {
+        if (*p == ',')
+        {
+            n++;
+        }
+    }
+
+    cinstance->storage_argv = (char **)MXS_MALLOC((n + 1) * sizeof(char *));
+
+    if (cinstance->storage_argv == NULL)
+    {
+        return false;
+    }
+
+    char *arg = *args ? args : NULL;
+
+    while (arg)
+    {
+        char *comma = strchr(arg, ',');
+
+        if (comma)
+        {
+            *comma = '\0';
+        }
+
+        arg = trim(arg);
+
+        if (*arg == '\0')
+        {
+            MXS_ERROR("The value of the configuration entry 'storage_args' is malformed, "
+                      "it contains an empty argument: '%s'.", storage_args);
+            return false;
+        }
+
+        cinstance->storage_argv[cinstance->storage_argc++] = arg;
+        arg = comma ? comma + 1 : NULL;
+    }
+
+    cinstance->storage_argv[cinstance->storage_argc] = NULL;
+
+    return true;
+}
@@ -0,0 +1,666 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file cache_key.c Creation of cache keys
+ *
+ * The statement is canonicalized and hashed in one pass over the buffer
+ * chain. Unlike modutil_get_canonical, the canonicalization does not replace
+ * the literals, as statements with different values must not share a result,
+ * and it does not allocate memory. The canonical statement is collected into
+ * a small block that is fed to a 128-bit MurmurHash3 (x64 variant) whenever
+ * it fills up.
+ */
+
+#include "cache_key.h"
+#include <string.h>
+#include <mysql_client_server_protocol.h>
+
+/** Size of the block of canonical data hashed at a time, a multiple of 16 */
+#define KEY_BLOCK_SIZE   256
+/** The length of the longest reserved word that is lower-cased */
+#define KEYWORD_MAXLEN   19
+/** Number of slots in the reserved word hash table, a power of two */
+#define KEYWORD_SLOTS    256
+
+/**
+ * Reserved words that are lower-cased. Only reserved words are included,
+ * as an unquoted identifier, e.g. a table name, may be case sensitive.
+ */
+static const char *keywords[] =
+{
+    "all", "and", "as", "asc", "between", "binary", "by", "case", "collate",
+    "cross", "desc", "distinct", "div", "else", "exists", "false", "for", "from",
+    "group", "having", "high_priority", "in", "inner", "interval", "into", "is",
+    "join", "left", "like", "limit", "lock", "mod", "natural", "not", "null", "on",
+    "or", "order", "outer", "regexp", "right", "rlike", "select", "sql_big_result",
+    "sql_calc_found_rows", "sql_small_result", "straight_join", "then", "true",
+    "union", "update", "using", "when", "where", "with", "xor"
+};
+
+#define N_KEYWORDS (sizeof(keywords) / sizeof(keywords[0]))
+
+/** Character classes */
+#define CC_OTHER   0
+#define CC_WORD    1
+#define CC_SPACE   2
+#define CC_SPECIAL 3 /*< Quotes and characters that may start a comment */
+
+static uint8_t char_class[256];
+static uint8_t char_lower[256];
+static const char *keyword_table[KEYWORD_SLOTS];
+
+typedef struct
+{
+    const GWBUF   *buf;       /*< The current buffer */
+    const uint8_t *ptr;       /*< The next byte in the current buffer */
+    const uint8_t *end;       /*< The end of the current buffer */
+    size_t         remaining; /*< Bytes left in the statement */
+} KEY_ITER;
+
+typedef struct
+{
+    uint64_t h1;
+    uint64_t h2;
+    uint64_t len;
+} KEY_HASH;
+
+typedef struct
+{
+    uint8_t  block[KEY_BLOCK_SIZE]; /*< Output not yet hashed or copied */
+    size_t   pos;                   /*< Bytes in block */
+    size_t   flushed;               /*< Bytes output before the ones in block */
+    KEY_HASH hash;                  /*< The hash state */
+    char    *dest;                  /*< If not NULL, the output is copied here */
+    size_t   dest_size;             /*< Size of dest */
+    bool     space;                 /*< Whitespace skipped after the last byte */
+    uint8_t  last;                  /*< The last byte of the output */
+} KEY_STATE;
+
+static inline uint32_t keyword_hash(uint32_t h, uint8_t c)
+{
+    return h * 31 + c;
+}
+
+void cache_key_init()
+{
+    for (int c = 0; c < 256; c++)
+    {
+        char_lower[c] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            c == '_' || c == '$' || c >= 0x80)
+        {
+            char_class[c] = CC_WORD;
+        }
+        else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v')
+        {
+            char_class[c] = CC_SPACE;
+        }
+        else if (c == '\'' || c == '"' || c == '`' || c == '#' || c == '-' || c == '/')
+        {
+            char_class[c] = CC_SPECIAL;
+        }
+        else
+        {
+            char_class[c] = CC_OTHER;
+        }
+    }
+
+    memset(keyword_table, 0, sizeof(keyword_table));
+
+    for (size_t i = 0; i < N_KEYWORDS; i++)
+    {
+        uint32_t h = 0;
+
+        for (const char *p = keywords[i]; *p; p++)
+        {
+            h = keyword_hash(h, *p);
+        }
+
+        while (keyword_table[h & (KEYWORD_SLOTS - 1)])
+        {
+            h++;
+        }
+
+        keyword_table[h & (KEYWORD_SLOTS - 1)] = keywords[i];
+    }
+}
+
+#define C1 0x87c37b91114253d5ULL
+#define C2 0x4cf5ad432745937fULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/**
+ * Hash full blocks of data.
+ *
+ * @param h    The hash state
+ * @param data The data
+ * @param len  Length of the data, a multiple of 16
+ */
+static void hash_blocks(KEY_HASH *h, const uint8_t *data, size_t len)
+{
+    uint64_t h1 = h->h1;
+    uint64_t h2 = h->h2;
+
+    for (const uint8_t *end = data + len; data < end; data += 16)
+    {
+        uint64_t k1;
+        uint64_t k2;
+        memcpy(&k1, data, sizeof(k1));
+        memcpy(&k2, data + 8, sizeof(k2));
+
+        k1 *= C1;
+        k1 = rotl64(k1, 31);
+        k1 *= C2;
+        h1 ^= k1;
+        h1 = rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= C2;
+        k2 = rotl64(k2, 33);
+        k2 *= C1;
+        h2 ^= k2;
+        h2 = rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    h->h1 = h1;
+    h->h2 = h2;
+    h->len += len;
+}
+
+/**
+ * Hash the remaining data and write the final hash.
+ *
+ * @param h    The hash state
+ * @param tail The remaining data
+ * @param len  Length of the remaining data
+ * @param out  Where the 16 bytes of the hash are written
+ */
+static void hash_final(KEY_HASH *h, const uint8_t *tail, size_t len, char *out)
+{
+    hash_blocks(h, tail, len & ~(size_t)15);
+    tail += len & ~(size_t)15;
+    len &= 15;
+
+    uint64_t h1 = h->h1;
+    uint64_t h2 = h->h2;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+
+    switch (len)
+    {
+    case 15: k2 ^= (uint64_t)tail[14] << 48;
+    case 14: k2 ^= (uint64_t)tail[13] << 40;
+    case 13: k2 ^= (uint64_t)tail[12] << 32;
+    case 12: k2 ^= (uint64_t)tail[11] << 24;
+    case 11: k2 ^= (uint64_t)tail[10] << 16;
+    case 10: k2 ^= (uint64_t)tail[9] << 8;
+    case 9:
+        k2 ^= (uint64_t)tail[8];
+        k2 *= C2;
+        k2 = rotl64(k2, 33);
+        k2 *= C1;
+        h2 ^= k2;
+
+    case 8: k1 ^= (uint64_t)tail[7] << 56;
+    case 7: k1 ^= (uint64_t)tail[6] << 48;
+    case 6: k1 ^= (uint64_t)tail[5] << 40;
+    case 5: k1 ^= (uint64_t)tail[4] << 32;
+    case 4: k1 ^= (uint64_t)tail[3] << 24;
+    case 3: k1 ^= (uint64_t)tail[2] << 16;
+    case 2: k1 ^= (uint64_t)tail[1] << 8;
+    case 1:
+        k1 ^= (uint64_t)tail[0];
+        k1 *= C1;
+        k1 = rotl64(k1, 31);
+        k1 *= C2;
+        h1 ^= k1;
+    }
+
+    uint64_t total = h->len + len;
+    h1 ^= total;
+    h2 ^= total;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    memcpy(out, &h1, sizeof(h1));
+    memcpy(out + sizeof(h1), &h2, sizeof(h2));
+}
+
+/**
+ * Position an iterator at the start of the statement of a COM_QUERY packet.
+ *
+ * @return True if the packet is a COM_QUERY
+ */
+static bool iter_init(KEY_ITER *it, const GWBUF *query)
+{
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+
+    if (gwbuf_copy_data((GWBUF *)query, 0, sizeof(header), header) != sizeof(header) ||
+        header[MYSQL_HEADER_LEN] != MYSQL_COM_QUERY)
+    {
+        return false;
+    }
+
+    size_t skip = sizeof(header);
+
+    it->buf = query;
+    it->remaining = gw_mysql_get_byte3(header) - 1;
+
+    while (it->buf && GWBUF_LENGTH(it->buf) <= skip)
+    {
+        skip -= GWBUF_LENGTH(it->buf);
+        it->buf = it->buf->next;
+    }
+
+    if (it->buf)
+    {
+        it->ptr = (const uint8_t *)GWBUF_DATA(it->buf) + skip;
+        it->end = (const uint8_t *)it->buf->end;
+    }
+    else
+    {
+        it->ptr = it->end = NULL;
+        it->remaining = 0;
+    }
+
+    return true;
+}
+
+/**
+ * @return The next byte of the statement or -1 at the end of the statement
+ */
+static inline int iter_next(KEY_ITER *it)
+{
+    if (it->remaining == 0)
+    {
+        return -1;
+    }
+
+    while (it->ptr == it->end)
+    {
+        if ((it->buf = it->buf->next) == NULL)
+        {
+            it->remaining = 0;
+            return -1;
+        }
+
+        it->ptr = (const uint8_t *)GWBUF_DATA(it->buf);
+        it->end = (const uint8_t *)it->buf->end;
+    }
+
+    it->remaining--;
+    return *it->ptr++;
+}
+
+/**
+ * Look ahead in the statement without advancing the iterator.
+ *
+ * @param n Offset of the byte, 0 is the byte iter_next would return
+ * @return The byte or -1 if the statement ends before it
+ */
+static int iter_peek(const KEY_ITER *it, size_t n)
+{
+    if (n >= it->remaining)
+    {
+        return -1;
+    }
+
+    const GWBUF *buf = it->buf;
+    const uint8_t *ptr = it->ptr;
+    const uint8_t *end = it->end;
+
+    while ((size_t)(end - ptr) <= n)
+    {
+        n -= end - ptr;
+
+        if ((buf = buf->next) == NULL)
+        {
+            return -1;
+        }
+
+        ptr = (const uint8_t *)GWBUF_DATA(buf);
+        end = (const uint8_t *)buf->end;
+    }
+
+    return ptr[n];
+}
+
+static void flush_block(KEY_STATE *st)
+{
+    if (st->dest)
+    {
+        if (st->flushed < st->dest_size - 1)
+        {
+            size_t n = st->dest_size - 1 - st->flushed;
+            memcpy(st->dest + st->flushed, st->block, n < st->pos ? n : st->pos);
+        }
+    }
+    else
+    {
+        hash_blocks(&st->hash, st->block, st->pos);
+    }
+
+    st->flushed += st->pos;
+    st->pos = 0;
+}
+
+static inline void out_byte(KEY_STATE *st, uint8_t c)
+{
+    if (st->pos == KEY_BLOCK_SIZE)
+    {
+        flush_block(st);
+    }
+
+    st->block[st->pos++] = c;
+    st->last = c;
+}
+
+/**
+ * Output a single space in place of any skipped whitespace and comments,
+ * unless the space would be at the start of the statement or next to a
+ * comma or a parenthesis.
+ *
+ * @param next The byte that will be output next
+ */
+static inline void out_space(KEY_STATE *st, uint8_t next)
+{
+    if (st->space)
+    {
+        st->space = false;
+
+        if (st->last != '\0' && st->last != '(' && st->last != ',' && next != ')' && next != ',')
+        {
+            out_byte(st, ' ');
+        }
+    }
+}
+
+static inline void out_bytes(KEY_STATE *st, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        out_byte(st, data[i]);
+    }
+}
+
+/**
+ * @return True if the lower-cased word is a reserved word
+ */
+static inline bool is_keyword(const uint8_t *lower, size_t len, uint32_t h)
+{
+    const char *keyword;
+
+    while ((keyword = keyword_table[h & (KEYWORD_SLOTS - 1)]))
+    {
+        if (memcmp(keyword, lower, len) == 0 && keyword[len] == '\0')
+        {
+            return true;
+        }
+
+        h++;
+    }
+
+    return false;
+}
+
+/**
+ * Copy a quoted string or identifier as it is.
+ *
+ * @param quote The opening quote, already consumed from the iterator
+ */
+static void out_quoted(KEY_STATE *st, KEY_ITER *it, int quote)
+{
+    int c;
+
+    out_space(st, quote);
+    out_byte(st, quote);
+
+    while ((c = iter_next(it)) != -1)
+    {
+        out_byte(st, c);
+
+        if (c == quote)
+        {
+            break;
+        }
+        else if (c == '\\' && quote != '`' && (c = iter_next(it)) != -1)
+        {
+            out_byte(st, c);
+        }
+    }
+}
+
+static void skip_line_comment(KEY_ITER *it)
+{
+    int c;
+
+    while ((c = iter_next(it)) != -1 && c != '\n')
+    {
+        ;
+    }
+}
+
+static void skip_block_comment(KEY_ITER *it)
+{
+    int c;
+    int prev = 0;
+
+    while ((c = iter_next(it)) != -1 && !(prev == '*' && c == '/'))
+    {
+        prev = c;
+    }
+}
+
+/**
+ * Handle a byte that may start a quoted string or a comment.
+ */
+static void key_special(KEY_STATE *st, KEY_ITER *it, int c)
+{
+    if (c == '\'' || c == '"' || c == '`')
+    {
+        out_quoted(st, it, c);
+    }
+    else if (c == '#')
+    {
+        skip_line_comment(it);
+        st->space = true;
+    }
+    else if (c == '-' && iter_peek(it, 0) == '-' &&
+             (iter_peek(it, 1) == -1 || iter_peek(it, 1) <= ' '))
+    {
+        skip_line_comment(it);
+        st->space = true;
+    }
+    else if (c == '/' && iter_peek(it, 0) == '*' && iter_peek(it, 1) != '!' &&
+             iter_peek(it, 1) != '+' && !(iter_peek(it, 1) == 'M' && iter_peek(it, 2) == '!'))
+    {
+        /** Executable comments and optimizer hints are kept as they are */
+        iter_next(it);
+        skip_block_comment(it);
+        st->space = true;
+    }
+    else
+    {
+        out_space(st, c);
+        out_byte(st, c);
+    }
+}
+
+/**
+ * Canonicalize the statement and output it.
+ */
+static void key_canonicalize(KEY_STATE *st, KEY_ITER *it)
+{
+    uint8_t word[KEYWORD_MAXLEN];
+    uint8_t lower[KEYWORD_MAXLEN];
+    int c = iter_next(it);
+
+    while (c != -1)
+    {
+        switch (char_class[c])
+        {
+        case CC_WORD:
+            {
+                /** A word following a dot is a part of a qualified name */
+                bool qualified = st->last == '.' && !st->space;
+                bool number = c >= '0' && c <= '9';
+                size_t len = 0;
+                uint32_t h = 0;
+
+                out_space(st, c);
+
+                do
+                {
+                    if (len == KEYWORD_MAXLEN)
+                    {
+                        /** Too long to be a reserved word, output as it is */
+                        out_bytes(st, word, len);
+
+                        do
+                        {
+                            out_byte(st, c);
+                        }
+                        while ((c = iter_next(it)) != -1 && char_class[c] == CC_WORD);
+
+                        len = 0;
+                        break;
+                    }
+
+                    word[len] = c;
+                    lower[len] = char_lower[c];
+                    h = keyword_hash(h, lower[len]);
+                    len++;
+                }
+                while ((c = iter_next(it)) != -1 && char_class[c] == CC_WORD);
+
+                if (len > 0)
+                {
+                    bool keyword = !qualified && !number && is_keyword(lower, len, h);
+                    out_bytes(st, keyword ? lower : word, len);
+                }
+            }
+            /** c is the byte after the word */
+            continue;
+
+        case CC_SPACE:
+            st->space = true;
+            break;
+
+        case CC_SPECIAL:
+            key_special(st, it, c);
+            break;
+
+        default:
+            out_space(st, c);
+            out_byte(st, c);
+            break;
+        }
+
+        c = iter_next(it);
+    }
+}
+
+/**
+ * Output a string and the null byte that terminates it, so that the
+ * boundary between two strings is part of the key.
+ */
+static void out_string(KEY_STATE *st, const char *s)
+{
+    for (const char *p = s ? s : ""; *p; p++)
+    {
+        out_byte(st, *p);
+    }
+
+    out_byte(st, '\0');
+}
+
+bool cache_key_create(const char *user, const char *host, const char *default_db,
+                      const GWBUF *query, char *key)
+{
+    KEY_ITER it;
+
+    if (!iter_init(&it, query))
+    {
+        return false;
+    }
+
+    KEY_STATE st;
+    st.pos = 0;
+    st.flushed = 0;
+    st.hash.h1 = 0;
+    st.hash.h2 = 0;
+    st.hash.len = 0;
+    st.dest = NULL;
+    st.dest_size = 0;
+    st.space = false;
+
+    /**
+     * The user and the host decide which rows the statement can see, so a
+     * result must not be shared between different accounts.
+     */
+    out_string(&st, user);
+    out_string(&st, host);
+    out_string(&st, default_db);
+
+    key_canonicalize(&st, &it);
+    hash_final(&st.hash, st.block, st.pos, key);
+
+    return true;
+}
+
+int cache_key_canonical(const GWBUF *query, char *dest, int size)
+{
+    KEY_ITER it;
+
+    if (size < 1 || !iter_init(&it, query))
+    {
+        return -1;
+    }
+
+    KEY_STATE st;
+    st.pos = 0;
+    st.flushed = 0;
+    st.dest = dest;
+    st.dest_size = size;
+    st.space = false;
+    st.last = '\0';
+
+    key_canonicalize(&st, &it);
+    flush_block(&st);
+    dest[st.flushed < st.dest_size ? st.flushed : st.dest_size - 1] = '\0';
+
+    return st.flushed;
+}
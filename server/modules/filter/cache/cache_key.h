@@ -0,0 +1,70 @@
+#ifndef _MAXSCALE_FILTER_CACHE_CACHE_KEY_H
+#define _MAXSCALE_FILTER_CACHE_CACHE_KEY_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdbool.h>
+#include <buffer.h>
+#include <skygw_debug.h>
+
+EXTERN_C_BLOCK_BEGIN
+
+enum
+{
+    CACHE_KEY_LENGTH = 16 /*< The length of a key created with cache_key_create */
+};
+
+/**
+ * Initialize the tables used when creating keys. Must be called once before
+ * the other functions are used.
+ */
+void cache_key_init();
+
+/**
+ * Create a cache key for a COM_QUERY packet.
+ *
+ * The key is a 128-bit hash of the user, the host, the default database and
+ * the statement in a canonical form, where comments are removed, runs of
+ * whitespace are squeezed into one space and reserved words are in lower
+ * case. Literals and identifiers are left as they are. The packet may
+ * consist of several buffers, it does not need to be contiguous.
+ *
+ * Other session state, such as sql_mode, time_zone or character_set_results,
+ * is not part of the key.
+ *
+ * @param user       The user of the session, may be NULL.
+ * @param host       The host the user connected from, may be NULL.
+ * @param default_db The default database of the session, may be NULL.
+ * @param query      A COM_QUERY packet.
+ * @param key        Pointer to an array of at least CACHE_KEY_LENGTH bytes
+ *                   where the key will be written.
+ * @return True if a key was created, false if the packet is not a COM_QUERY.
+ */
+bool cache_key_create(const char *user, const char *host, const char *default_db,
+                      const GWBUF *query, char *key);
+
+/**
+ * Write the canonical form of a COM_QUERY packet, as used by cache_key_create.
+ * The output is truncated if the buffer is too small.
+ *
+ * @param query  A COM_QUERY packet.
+ * @param dest   Where the null terminated canonical statement is written.
+ * @param size   The size of @c dest.
+ * @return The length of the complete canonical statement or -1 if the packet
+ *         is not a COM_QUERY.
+ */
+int cache_key_canonical(const GWBUF *query, char *dest, int size);
+
+EXTERN_C_BLOCK_END
+
+#endif
@@ -16,6 +16,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <buffer.h>
+#include <dcb.h>
 #include <mysql_client_server_protocol.h>
 #include <skygw_debug.h>
 
@@ -73,12 +74,18 @@ typedef struct cache_storage_api
      * Create a key for a GWBUF.
      *
      * @param storage    Pointer to a CACHE_STORAGE.
-     * @param query      An SQL query. Must be one contiguous buffer.
+     * @param user       The user of the session, may be NULL.
+     * @param host       The host the user connected from, may be NULL.
+     * @param default_db The default database of the session, may be NULL.
+     * @param query      An SQL query. May consist of several buffers.
      * @param key        Pointer to array of CACHE_KEY_MAXLEN size where
      *                   the key will be written.
      * @return CACHE_RESULT_OK if a key was created, otherwise some error code.
      */
     cache_result_t (*getKey)(CACHE_STORAGE* storage,
+                             const char* user,
+                             const char* host,
+                             const char* default_db,
                              const GWBUF* query,
                              char* key);
     /**
@@ -110,6 +117,14 @@ typedef struct cache_storage_api
     cache_result_t (*putValue)(CACHE_STORAGE* storage,
                                const char* key,
                                const GWBUF* value);
+
+    /**
+     * Print diagnostics of the storage. Optional, may be NULL.
+     *
+     * @param storage    Pointer to a CACHE_STORAGE.
+     * @param dcb        The DCB where the diagnostics should be printed.
+     */
+    void (*diagnostics)(CACHE_STORAGE* storage, DCB* dcb);
 } CACHE_STORAGE_API;
 
 #define CACHE_STORAGE_ENTRY_POINT "CacheGetStorageAPI"
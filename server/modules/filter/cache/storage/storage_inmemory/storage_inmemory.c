@@ -0,0 +1,632 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file storage_inmemory.c In-process storage for the cache filter
+ *
+ * The items are kept in a hash table that is split into a number of shards,
+ * each with a lock, a hash table and an LRU list of its own. A key always
+ * maps to the same shard, so all operations on an item only lock the shard
+ * of the item. The size and count limits are divided evenly between the
+ * shards and when a shard is full, its least recently used items are evicted.
+ * Expired items are removed when they are accessed or reach the end of the
+ * LRU list.
+ */
+
+#define MXS_MODULE_NAME "storage_inmemory"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <maxscale/alloc.h>
+#include <log_manager.h>
+#include <dcb.h>
+#include <spinlock.h>
+#include "../../cache_key.h"
+#include "../../cache_storage_api.h"
+
+/** The number of shards the items are divided into */
+#define INMEMORY_SHARDS           16
+/** The initial number of hash buckets of a shard, must be a power of two */
+#define INMEMORY_INITIAL_BUCKETS  64
+/** The length of a key, see cache_key_create */
+#define INMEMORY_KEY_LENGTH       CACHE_KEY_LENGTH
+
+typedef struct inmemory_item
+{
+    char                 key[INMEMORY_KEY_LENGTH]; /*< The key of the item */
+    uint64_t             hash;       /*< Hash value calculated from the key */
+    GWBUF               *value;      /*< The cached value */
+    size_t               size;       /*< Size of the cached value */
+    time_t               time;       /*< When the item was stored */
+    struct inmemory_item *next;      /*< Next item in the same hash bucket */
+    struct inmemory_item *lru_prev;  /*< More recently used item */
+    struct inmemory_item *lru_next;  /*< Less recently used item */
+} INMEMORY_ITEM;
+
+typedef struct inmemory_stats
+{
+    uint64_t hits;      /*< Number of successful lookups */
+    uint64_t misses;    /*< Number of lookups of missing items */
+    uint64_t expired;   /*< Number of items removed due to the ttl */
+    uint64_t evictions; /*< Number of items evicted due to the limits */
+    uint64_t puts;      /*< Number of stored items */
+    uint64_t too_large; /*< Number of items too large to be stored */
+} INMEMORY_STATS;
+
+typedef struct inmemory_shard
+{
+    SPINLOCK        lock;        /*< Lock protecting the shard */
+    INMEMORY_ITEM **buckets;     /*< The hash buckets */
+    size_t          n_buckets;   /*< Number of hash buckets */
+    INMEMORY_ITEM  *lru_head;    /*< The most recently used item */
+    INMEMORY_ITEM  *lru_tail;    /*< The least recently used item */
+    size_t          count;       /*< Number of items */
+    size_t          size;        /*< Total size of the items */
+    INMEMORY_STATS  stats;       /*< Statistics of the shard */
+} INMEMORY_SHARD;
+
+typedef struct inmemory_storage
+{
+    char           *name;        /*< The name of the cache instance */
+    uint32_t        ttl;         /*< Time to live in seconds */
+    size_t          max_size;    /*< Maximum total size of the values, 0 for no limit */
+    size_t          max_count;   /*< Maximum number of items, 0 for no limit */
+    size_t          shard_max_size;  /*< Maximum size of the values of one shard */
+    size_t          shard_max_count; /*< Maximum number of items of one shard */
+    INMEMORY_SHARD  shards[INMEMORY_SHARDS];
+} INMEMORY_STORAGE;
+
+/**
+ * Parse a non-negative integer.
+ *
+ * @param value The value to parse
+ * @param end   Pointer where the position after the integer is stored
+ * @param count Pointer where the integer is stored
+ * @return True if the value starts with an integer that fits in a size_t
+ */
+static bool parse_integer(const char *value, char **end, size_t *count)
+{
+    errno = 0;
+    long long v = strtoll(value, end, 10);
+
+    if (*end == value || v < 0 || errno == ERANGE || (unsigned long long)v > SIZE_MAX)
+    {
+        return false;
+    }
+
+    *count = v;
+    return true;
+}
+
+/**
+ * Parse a non-negative integer.
+ *
+ * @param value The value to parse
+ * @param count Pointer where the integer is stored
+ * @return True if the value was valid
+ */
+static bool parse_count(const char *value, size_t *count)
+{
+    char *end;
+    return parse_integer(value, &end, count) && *end == '\0';
+}
+
+/**
+ * Parse a size with an optional K, M or G suffix.
+ *
+ * @param value The value to parse
+ * @param size  Pointer where the size is stored
+ * @return True if the value was valid and the size fits in a size_t
+ */
+static bool parse_size(const char *value, size_t *size)
+{
+    char *end;
+    size_t v;
+
+    if (!parse_integer(value, &end, &v))
+    {
+        return false;
+    }
+
+    int shifts = 0;
+
+    switch (*end)
+    {
+    case 'G':
+    case 'g':
+        shifts = 3;
+        end++;
+        break;
+
+    case 'M':
+    case 'm':
+        shifts = 2;
+        end++;
+        break;
+
+    case 'K':
+    case 'k':
+        shifts = 1;
+        end++;
+        break;
+
+    default:
+        break;
+    }
+
+    for (int i = 0; i < shifts; i++)
+    {
+        if (v > SIZE_MAX / 1024)
+        {
+            return false;
+        }
+
+        v *= 1024;
+    }
+
+    *size = v;
+    return *end == '\0';
+}
+
+static uint64_t key_hash(const char *key)
+{
+    uint64_t hash;
+    memcpy(&hash, key, sizeof(hash));
+    return hash;
+}
+
+static inline INMEMORY_SHARD *get_shard(INMEMORY_STORAGE *storage, uint64_t hash)
+{
+    return &storage->shards[hash % INMEMORY_SHARDS];
+}
+
+static inline INMEMORY_ITEM **get_bucket(INMEMORY_SHARD *shard, uint64_t hash)
+{
+    return &shard->buckets[(hash / INMEMORY_SHARDS) & (shard->n_buckets - 1)];
+}
+
+static void lru_unlink(INMEMORY_SHARD *shard, INMEMORY_ITEM *item)
+{
+    if (item->lru_prev)
+    {
+        item->lru_prev->lru_next = item->lru_next;
+    }
+    else
+    {
+        shard->lru_head = item->lru_next;
+    }
+
+    if (item->lru_next)
+    {
+        item->lru_next->lru_prev = item->lru_prev;
+    }
+    else
+    {
+        shard->lru_tail = item->lru_prev;
+    }
+
+    item->lru_prev = NULL;
+    item->lru_next = NULL;
+}
+
+static void lru_push_front(INMEMORY_SHARD *shard, INMEMORY_ITEM *item)
+{
+    item->lru_prev = NULL;
+    item->lru_next = shard->lru_head;
+
+    if (shard->lru_head)
+    {
+        shard->lru_head->lru_prev = item;
+    }
+    else
+    {
+        shard->lru_tail = item;
+    }
+
+    shard->lru_head = item;
+}
+
+/**
+ * Find an item from a shard. The shard must be locked.
+ *
+ * @return The item or NULL if it was not found
+ */
+static INMEMORY_ITEM *shard_find(INMEMORY_SHARD *shard, const char *key, uint64_t hash)
+{
+    INMEMORY_ITEM *item = *get_bucket(shard, hash);
+
+    while (item && (item->hash != hash || memcmp(item->key, key, INMEMORY_KEY_LENGTH) != 0))
+    {
+        item = item->next;
+    }
+
+    return item;
+}
+
+/**
+ * Remove an item from a shard and free it. The shard must be locked.
+ */
+static void shard_remove(INMEMORY_SHARD *shard, INMEMORY_ITEM *item)
+{
+    INMEMORY_ITEM **prev = get_bucket(shard, item->hash);
+
+    while (*prev != item)
+    {
+        prev = &(*prev)->next;
+    }
+
+    *prev = item->next;
+    lru_unlink(shard, item);
+    shard->count--;
+    shard->size -= item->size;
+    gwbuf_free(item->value);
+    MXS_FREE(item);
+}
+
+/**
+ * Double the number of hash buckets of a shard. The shard must be locked.
+ * If the memory cannot be allocated, the shard keeps its buckets.
+ */
+static void shard_grow(INMEMORY_SHARD *shard)
+{
+    size_t n_buckets = shard->n_buckets * 2;
+    INMEMORY_ITEM **buckets = (INMEMORY_ITEM **)MXS_CALLOC(n_buckets, sizeof(INMEMORY_ITEM *));
+
+    if (buckets)
+    {
+        INMEMORY_ITEM **old_buckets = shard->buckets;
+        size_t old_n_buckets = shard->n_buckets;
+
+        shard->buckets = buckets;
+        shard->n_buckets = n_buckets;
+
+        for (size_t i = 0; i < old_n_buckets; i++)
+        {
+            INMEMORY_ITEM *item = old_buckets[i];
+
+            while (item)
+            {
+                INMEMORY_ITEM *next = item->next;
+                INMEMORY_ITEM **bucket = get_bucket(shard, item->hash);
+                item->next = *bucket;
+                *bucket = item;
+                item = next;
+            }
+        }
+
+        MXS_FREE(old_buckets);
+    }
+}
+
+/**
+ * Remove items from the end of the LRU list of a shard until there is room
+ * for an item of the given size. The shard must be locked.
+ */
+static void shard_make_room(INMEMORY_STORAGE *storage, INMEMORY_SHARD *shard, size_t size, time_t now)
+{
+    while (shard->lru_tail &&
+           ((storage->shard_max_count && shard->count + 1 > storage->shard_max_count) ||
+            (storage->shard_max_size && shard->size + size > storage->shard_max_size) ||
+            shard->lru_tail->time + storage->ttl <= now))
+    {
+        if (shard->lru_tail->time + storage->ttl <= now)
+        {
+            shard->stats.expired++;
+        }
+        else
+        {
+            shard->stats.evictions++;
+        }
+
+        shard_remove(shard, shard->lru_tail);
+    }
+}
+
+static void freeInstance(CACHE_STORAGE *instance);
+
+static bool initialize()
+{
+    cache_key_init();
+    return true;
+}
+
+static CACHE_STORAGE *createInstance(const char *name, uint32_t ttl, int argc, char *argv[])
+{
+    size_t max_size = 0;
+    size_t max_count = 0;
+    bool error = false;
+
+    for (int i = 0; i < argc; i++)
+    {
+        char *value = strchr(argv[i], '=');
+
+        if (value)
+        {
+            size_t len = value - argv[i];
+            value++;
+
+            if (len == strlen("max_size") && strncmp(argv[i], "max_size", len) == 0)
+            {
+                if (!parse_size(value, &max_size))
+                {
+                    MXS_ERROR("The value of the storage argument 'max_size' must be "
+                              "a non-negative integer, optionally followed by K, M or G.");
+                    error = true;
+                }
+            }
+            else if (len == strlen("max_count") && strncmp(argv[i], "max_count", len) == 0)
+            {
+                if (!parse_count(value, &max_count))
+                {
+                    MXS_ERROR("The value of the storage argument 'max_count' must be "
+                              "a non-negative integer.");
+                    error = true;
+                }
+            }
+            else
+            {
+                MXS_ERROR("Unknown storage argument '%s'.", argv[i]);
+                error = true;
+            }
+        }
+        else
+        {
+            MXS_ERROR("Storage argument '%s' is not of the form name=value.", argv[i]);
+            error = true;
+        }
+    }
+
+    if (error)
+    {
+        return NULL;
+    }
+
+    INMEMORY_STORAGE *storage = (INMEMORY_STORAGE *)MXS_CALLOC(1, sizeof(INMEMORY_STORAGE));
+
+    if (storage)
+    {
+        storage->name = MXS_STRDUP(name);
+        storage->ttl = ttl;
+        storage->max_size = max_size;
+        storage->max_count = max_count;
+        storage->shard_max_size = (max_size + INMEMORY_SHARDS - 1) / INMEMORY_SHARDS;
+        storage->shard_max_count = (max_count + INMEMORY_SHARDS - 1) / INMEMORY_SHARDS;
+
+        error = (storage->name == NULL);
+
+        for (int i = 0; i < INMEMORY_SHARDS; i++)
+        {
+            INMEMORY_SHARD *shard = &storage->shards[i];
+            spinlock_init(&shard->lock);
+            shard->n_buckets = INMEMORY_INITIAL_BUCKETS;
+            shard->buckets = (INMEMORY_ITEM **)MXS_CALLOC(shard->n_buckets, sizeof(INMEMORY_ITEM *));
+
+            if (shard->buckets == NULL)
+            {
+                error = true;
+            }
+        }
+
+        if (error)
+        {
+            freeInstance((CACHE_STORAGE *)storage);
+            storage = NULL;
+        }
+        else
+        {
+            MXS_NOTICE("Created in-memory cache storage for %s, max_size %lu bytes, "
+                       "max_count %lu items (0 means no limit).",
+                       name, (unsigned long)max_size, (unsigned long)max_count);
+        }
+    }
+
+    return (CACHE_STORAGE *)storage;
+}
+
+static void freeInstance(CACHE_STORAGE *instance)
+{
+    INMEMORY_STORAGE *storage = (INMEMORY_STORAGE *)instance;
+
+    if (storage)
+    {
+        for (int i = 0; i < INMEMORY_SHARDS; i++)
+        {
+            INMEMORY_SHARD *shard = &storage->shards[i];
+
+            while (shard->lru_head)
+            {
+                shard_remove(shard, shard->lru_head);
+            }
+
+            MXS_FREE(shard->buckets);
+        }
+
+        MXS_FREE(storage->name);
+        MXS_FREE(storage);
+    }
+}
+
+static cache_result_t getKey(CACHE_STORAGE *storage, const char *user, const char *host,
+                             const char *default_db, const GWBUF *query, char *key)
+{
+    ss_dassert(INMEMORY_KEY_LENGTH <= CACHE_KEY_MAXLEN);
+
+    return cache_key_create(user, host, default_db, query, key) ? CACHE_RESULT_OK : CACHE_RESULT_ERROR;
+}
+
+static cache_result_t getValue(CACHE_STORAGE *instance, const char *key, GWBUF **result)
+{
+    INMEMORY_STORAGE *storage = (INMEMORY_STORAGE *)instance;
+    uint64_t hash = key_hash(key);
+    INMEMORY_SHARD *shard = get_shard(storage, hash);
+    cache_result_t rv = CACHE_RESULT_NOT_FOUND;
+
+    spinlock_acquire(&shard->lock);
+
+    INMEMORY_ITEM *item = shard_find(shard, key, hash);
+
+    if (item && item->time + storage->ttl <= time(NULL))
+    {
+        shard->stats.expired++;
+        shard_remove(shard, item);
+        item = NULL;
+    }
+
+    if (item)
+    {
+        /** The data is never modified so the clone can be used after the item is gone */
+        if ((*result = gwbuf_clone(item->value)))
+        {
+            lru_unlink(shard, item);
+            lru_push_front(shard, item);
+            shard->stats.hits++;
+            rv = CACHE_RESULT_OK;
+        }
+        else
+        {
+            rv = CACHE_RESULT_OUT_OF_RESOURCES;
+        }
+    }
+    else
+    {
+        shard->stats.misses++;
+    }
+
+    spinlock_release(&shard->lock);
+
+    return rv;
+}
+
+static cache_result_t putValue(CACHE_STORAGE *instance, const char *key, const GWBUF *value)
+{
+    INMEMORY_STORAGE *storage = (INMEMORY_STORAGE *)instance;
+    uint64_t hash = key_hash(key);
+    INMEMORY_SHARD *shard = get_shard(storage, hash);
+    size_t size = gwbuf_length((GWBUF *)value);
+
+    if (storage->shard_max_size && size > storage->shard_max_size)
+    {
+        spinlock_acquire(&shard->lock);
+        shard->stats.too_large++;
+        spinlock_release(&shard->lock);
+        return CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    /** Copy the value outside the lock, the caller still owns the original */
+    GWBUF *copy = gwbuf_alloc(size);
+    INMEMORY_ITEM *new_item = (INMEMORY_ITEM *)MXS_MALLOC(sizeof(INMEMORY_ITEM));
+
+    if (copy == NULL || new_item == NULL)
+    {
+        gwbuf_free(copy);
+        MXS_FREE(new_item);
+        return CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    gwbuf_copy_data((GWBUF *)value, 0, size, GWBUF_DATA(copy));
+    time_t now = time(NULL);
+
+    memcpy(new_item->key, key, INMEMORY_KEY_LENGTH);
+    new_item->hash = hash;
+    new_item->value = copy;
+    new_item->size = size;
+    new_item->time = now;
+
+    spinlock_acquire(&shard->lock);
+
+    INMEMORY_ITEM *item = shard_find(shard, key, hash);
+
+    if (item)
+    {
+        shard_remove(shard, item);
+    }
+
+    shard_make_room(storage, shard, size, now);
+
+    if (shard->count >= shard->n_buckets * 2)
+    {
+        shard_grow(shard);
+    }
+
+    INMEMORY_ITEM **bucket = get_bucket(shard, hash);
+    new_item->next = *bucket;
+    *bucket = new_item;
+    lru_push_front(shard, new_item);
+    shard->count++;
+    shard->size += size;
+    shard->stats.puts++;
+
+    spinlock_release(&shard->lock);
+
+    return CACHE_RESULT_OK;
+}
+
+static void diagnostics(CACHE_STORAGE *instance, DCB *dcb)
+{
+    INMEMORY_STORAGE *storage = (INMEMORY_STORAGE *)instance;
+    INMEMORY_STATS stats = {0};
+    size_t count = 0;
+    size_t size = 0;
+
+    for (int i = 0; i < INMEMORY_SHARDS; i++)
+    {
+        INMEMORY_SHARD *shard = &storage->shards[i];
+
+        spinlock_acquire(&shard->lock);
+        count += shard->count;
+        size += shard->size;
+        stats.hits += shard->stats.hits;
+        stats.misses += shard->stats.misses;
+        stats.expired += shard->stats.expired;
+        stats.evictions += shard->stats.evictions;
+        stats.puts += shard->stats.puts;
+        stats.too_large += shard->stats.too_large;
+        spinlock_release(&shard->lock);
+    }
+
+    uint64_t lookups = stats.hits + stats.misses;
+
+    dcb_printf(dcb, "\t\tStorage:                storage_inmemory\n");
+    dcb_printf(dcb, "\t\tShards:                 %d\n", INMEMORY_SHARDS);
+    dcb_printf(dcb, "\t\tItems:                  %lu (max %lu)\n",
+               (unsigned long)count, (unsigned long)storage->max_count);
+    dcb_printf(dcb, "\t\tBytes:                  %lu (max %lu)\n",
+               (unsigned long)size, (unsigned long)storage->max_size);
+    dcb_printf(dcb, "\t\tHits:                   %lu\n", (unsigned long)stats.hits);
+    dcb_printf(dcb, "\t\tMisses:                 %lu\n", (unsigned long)stats.misses);
+    dcb_printf(dcb, "\t\tHit ratio:              %.1f%%\n",
+               lookups ? 100.0 * stats.hits / lookups : 0.0);
+    dcb_printf(dcb, "\t\tStored items:           %lu\n", (unsigned long)stats.puts);
+    dcb_printf(dcb, "\t\tEvictions:              %lu\n", (unsigned long)stats.evictions);
+    dcb_printf(dcb, "\t\tExpired items:          %lu\n", (unsigned long)stats.expired);
+    dcb_printf(dcb, "\t\tItems too large:        %lu\n", (unsigned long)stats.too_large);
+}
+
+static CACHE_STORAGE_API api =
+{
+    initialize,
+    createInstance,
+    freeInstance,
+    getKey,
+    getValue,
+    putValue,
+    diagnostics
+};
+
+CACHE_STORAGE_API *CacheGetStorageAPI()
+{
+    return &api;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file benchmark_cache_key.c Benchmark of the cache key creation
+ *
+ * The speed benchmark creates keys for a set of typical OLTP statements and
+ * reports the time per statement for
+ * - sha512:         a SHA512 digest of the statement text, the earlier key
+ * - key:            cache_key_create on a contiguous packet
+ * - key_split:      cache_key_create on a packet split into three buffers
+ * - modutil:        modutil_get_canonical, for reference
+ *
+ * If a file is given, it is read as a query log with one statement per line
+ * and the hit rate of an unbounded cache without expiration is reported for
+ * keys created from the statement text and from the canonical statement.
+ *
+ * Usage: benchmark_cache_key [iterations] [query log]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/sha.h>
+
+#include <maxscale/alloc.h>
+#include <buffer.h>
+#include <modutil.h>
+#include "../cache_key.h"
+
+#define DEFAULT_ITERATIONS 200000
+
+static const char *statements[] =
+{
+    "SELECT c FROM sbtest1 WHERE id=5012",
+    "SELECT c FROM sbtest1 WHERE id BETWEEN 5012 AND 5111",
+    "SELECT SUM(k) FROM sbtest1 WHERE id BETWEEN 5012 AND 5111",
+    "SELECT c FROM sbtest1 WHERE id BETWEEN 5012 AND 5111 ORDER BY c",
+    "SELECT DISTINCT c FROM sbtest1 WHERE id BETWEEN 5012 AND 5111 ORDER BY c",
+    "select o.id, o.status, c.name\n  from orders o\n  join customers c on c.id = o.customer_id\n"
+    " where o.created > '2016-10-01' /* dashboard */ and o.status in (1, 2, 3)\n"
+    " order by o.created desc limit 20",
+};
+
+#define N_STATEMENTS (sizeof(statements) / sizeof(statements[0]))
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static GWBUF *
+create_query(const char *sql, int n_parts)
+{
+    size_t len = strlen(sql);
+    GWBUF *query = gwbuf_alloc(len + 5);
+    MXS_ABORT_IF_NULL(query);
+
+    uint8_t *data = GWBUF_DATA(query);
+    data[0] = (len + 1);
+    data[1] = (len + 1) >> 8;
+    data[2] = (len + 1) >> 16;
+    data[3] = 0;
+    data[4] = 0x03;
+    memcpy(data + 5, sql, len);
+
+    GWBUF *chain = NULL;
+
+    for (int i = n_parts; i > 1; i--)
+    {
+        chain = gwbuf_append(chain, gwbuf_split(&query, gwbuf_length(query) / i));
+    }
+
+    return gwbuf_append(chain, query);
+}
+
+static void
+sha512_key(GWBUF *query, char *key)
+{
+    char *sql;
+    int len;
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+
+    modutil_extract_SQL(query, &sql, &len);
+    SHA512((unsigned char *)sql, len, digest);
+    memcpy(key, digest, CACHE_KEY_LENGTH);
+}
+
+static void
+bench_key(const char *name, GWBUF **queries, int iterations, int method)
+{
+    char key[CACHE_KEY_LENGTH];
+    int sink = 0;
+    double start = now();
+
+    for (int i = 0; i < iterations; i++)
+    {
+        GWBUF *query = queries[i % N_STATEMENTS];
+
+        switch (method)
+        {
+        case 0:
+            sha512_key(query, key);
+            break;
+
+        case 1:
+            cache_key_create("maxuser", "127.0.0.1", "test", query, key);
+            break;
+
+        case 2:
+            {
+                char *canonical = modutil_get_canonical(query);
+                key[0] = canonical ? canonical[0] : 0;
+                MXS_FREE(canonical);
+            }
+            break;
+        }
+
+        sink += key[0];
+    }
+
+    double elapsed = now() - start;
+
+    printf("%s.ns/query: %.1f\n", name, elapsed * 1000000000.0 / iterations);
+    printf("%s.queries/s: %.0f\n", name, iterations / elapsed);
+
+    if (sink == 1)
+    {
+        /** Prevents the loop from being optimized away */
+        printf("\n");
+    }
+}
+
+static int
+key_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, CACHE_KEY_LENGTH);
+}
+
+/**
+ * @return The number of lookups that would have hit an unbounded cache
+ */
+static long
+count_hits(char *keys, long n)
+{
+    long distinct = n > 0 ? 1 : 0;
+
+    qsort(keys, n, CACHE_KEY_LENGTH, key_cmp);
+
+    for (long i = 1; i < n; i++)
+    {
+        if (memcmp(keys + (i - 1) * CACHE_KEY_LENGTH, keys + i * CACHE_KEY_LENGTH, CACHE_KEY_LENGTH) != 0)
+        {
+            distinct++;
+        }
+    }
+
+    return n - distinct;
+}
+
+static int
+hit_rate(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+
+    if (file == NULL)
+    {
+        perror(filename);
+        return 1;
+    }
+
+    long n = 0;
+    long size = 1024;
+    char *raw_keys = MXS_MALLOC(size * CACHE_KEY_LENGTH);
+    char *canonical_keys = MXS_MALLOC(size * CACHE_KEY_LENGTH);
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+
+    MXS_ABORT_IF_NULL(raw_keys);
+    MXS_ABORT_IF_NULL(canonical_keys);
+
+    while ((len = getline(&line, &line_size, file)) != -1)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        {
+            line[--len] = '\0';
+        }
+
+        if (len == 0)
+        {
+            continue;
+        }
+
+        if (n == size)
+        {
+            size *= 2;
+            raw_keys = MXS_REALLOC(raw_keys, size * CACHE_KEY_LENGTH);
+            canonical_keys = MXS_REALLOC(canonical_keys, size * CACHE_KEY_LENGTH);
+            MXS_ABORT_IF_NULL(raw_keys);
+            MXS_ABORT_IF_NULL(canonical_keys);
+        }
+
+        GWBUF *query = create_query(line, 1);
+        sha512_key(query, raw_keys + n * CACHE_KEY_LENGTH);
+        cache_key_create("maxuser", "127.0.0.1", NULL, query, canonical_keys + n * CACHE_KEY_LENGTH);
+        gwbuf_free(query);
+        n++;
+    }
+
+    long raw_hits = count_hits(raw_keys, n);
+    long canonical_hits = count_hits(canonical_keys, n);
+
+    printf("log.statements: %ld\n", n);
+    printf("log.sha512.hits: %ld\n", raw_hits);
+    printf("log.sha512.hit_rate: %.2f%%\n", n ? 100.0 * raw_hits / n : 0.0);
+    printf("log.key.hits: %ld\n", canonical_hits);
+    printf("log.key.hit_rate: %.2f%%\n", n ? 100.0 * canonical_hits / n : 0.0);
+
+    free(line);
+    MXS_FREE(raw_keys);
+    MXS_FREE(canonical_keys);
+    fclose(file);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+
+    if (iterations < 1)
+    {
+        fprintf(stderr, "Usage: %s [iterations] [query log]\n", argv[0]);
+        return 1;
+    }
+
+    cache_key_init();
+
+    GWBUF *queries[N_STATEMENTS];
+    GWBUF *split_queries[N_STATEMENTS];
+
+    for (size_t i = 0; i < N_STATEMENTS; i++)
+    {
+        queries[i] = create_query(statements[i], 1);
+        split_queries[i] = create_query(statements[i], 3);
+    }
+
+    bench_key("sha512", queries, iterations, 0);
+    bench_key("key", queries, iterations, 1);
+    bench_key("key_split", split_queries, iterations, 1);
+    bench_key("modutil", queries, iterations, 2);
+
+    for (size_t i = 0; i < N_STATEMENTS; i++)
+    {
+        gwbuf_free(queries[i]);
+        gwbuf_free(split_queries[i]);
+    }
+
+    return argc > 2 ? hit_rate(argv[2]) : 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testcachekey.c Tests of the cache key creation
+ */
+
+// To ensure that ss_info_assert asserts also when building in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <maxscale/alloc.h>
+#include <buffer.h>
+#include "../cache_key.h"
+
+/**
+ * Create a COM_QUERY packet.
+ *
+ * @param sql     The statement
+ * @param n_parts Number of buffers the packet is split into
+ * @return The packet
+ */
+static GWBUF *create_query(const char *sql, int n_parts)
+{
+    size_t len = strlen(sql);
+    GWBUF *query = gwbuf_alloc(len + 5);
+    MXS_ABORT_IF_NULL(query);
+
+    uint8_t *data = GWBUF_DATA(query);
+    data[0] = (len + 1);
+    data[1] = (len + 1) >> 8;
+    data[2] = (len + 1) >> 16;
+    data[3] = 0;
+    data[4] = 0x03;
+    memcpy(data + 5, sql, len);
+
+    GWBUF *chain = NULL;
+
+    for (int i = n_parts; i > 1; i--)
+    {
+        GWBUF *part = gwbuf_split(&query, gwbuf_length(query) / i);
+        chain = gwbuf_append(chain, part);
+    }
+
+    return gwbuf_append(chain, query);
+}
+
+static void get_key(const char *db, const char *sql, int n_parts, char *key)
+{
+    GWBUF *query = create_query(sql, n_parts);
+    ss_info_dassert(cache_key_create("maxuser", "127.0.0.1", db, query, key), "A key should be created");
+    gwbuf_free(query);
+}
+
+static bool same_key(const char *db1, const char *sql1, const char *db2, const char *sql2)
+{
+    char key1[CACHE_KEY_LENGTH];
+    char key2[CACHE_KEY_LENGTH];
+
+    get_key(db1, sql1, 1, key1);
+    get_key(db2, sql2, 1, key2);
+
+    return memcmp(key1, key2, sizeof(key1)) == 0;
+}
+
+static const char *same[][2] =
+{
+    { "SELECT a FROM t WHERE id = 1", "select a from t where id = 1" },
+    { "  select  a\n from\tt  ", "select a from t" },
+    { "select a /* comment */ from t", "select a from t" },
+    { "select a from t -- comment\n", "select a from t" },
+    { "select a from t # comment", "select a from t" },
+    { "select count( * ) , b from t", "select count(*),b from t" },
+    { "select a from t where b In (1, 2)", "select a from t where b in (1,2)" },
+    { "select a/**/from t", "select a from t" },
+};
+
+static const char *different[][2] =
+{
+    { "select a from t where id = 1", "select a from t where id = 2" },
+    { "select 'A'", "select 'a'" },
+    { "select 'a  b'", "select 'a b'" },
+    { "select 'it\\'s  x'", "select 'it\\'s x'" },
+    { "select a from T", "select a from t" },
+    { "select a from db.Select", "select a from db.select" },
+    { "select a--1 from t", "select a from t" },
+    { "select /*!40001 SQL_NO_CACHE */ a from t", "select a from t" },
+    { "select a from t", "select a from t1" },
+};
+
+static const char *canonical[][2] =
+{
+    { "SELECT  a ,b FROM t WHERE x IN ( 1, 2 ) -- c", "select a,b from t where x in (1,2)" },
+    { "Select `A  b` From\n\n\"T\"", "select `A  b` from \"T\"" },
+    { "SELECT /*+ BKA(t) */ A FROM t", "select /*+ BKA(t) */ A from t" },
+    { "SELECT VeryLongIdentifierName_1234567890 FROM t",
+      "select VeryLongIdentifierName_1234567890 from t" },
+};
+
+#define N_ELEMS(a) (sizeof(a) / sizeof(a[0]))
+
+static int test_keys()
+{
+    for (size_t i = 0; i < N_ELEMS(same); i++)
+    {
+        ss_dfprintf(stderr, "testcachekey : \"%s\" == \"%s\"\n", same[i][0], same[i][1]);
+        ss_info_dassert(same_key(NULL, same[i][0], NULL, same[i][1]), "Keys should be equal");
+    }
+
+    for (size_t i = 0; i < N_ELEMS(different); i++)
+    {
+        ss_dfprintf(stderr, "testcachekey : \"%s\" != \"%s\"\n", different[i][0], different[i][1]);
+        ss_info_dassert(!same_key(NULL, different[i][0], NULL, different[i][1]),
+                        "Keys should be different");
+    }
+
+    ss_dfprintf(stderr, "testcachekey : default database\n");
+    ss_info_dassert(!same_key("test", "select 1", NULL, "select 1"), "Keys should be different");
+    ss_info_dassert(!same_key("test", "select 1", "test2", "select 1"), "Keys should be different");
+    ss_info_dassert(!same_key("a", "bselect 1", "ab", "select 1"), "Keys should be different");
+    ss_info_dassert(same_key("test", "select 1", "test", "SELECT 1"), "Keys should be equal");
+
+    ss_dfprintf(stderr, "testcachekey : user and host\n");
+
+    char key1[CACHE_KEY_LENGTH];
+    char key2[CACHE_KEY_LENGTH];
+    GWBUF *query = create_query("select a from db.t", 1);
+
+    ss_info_dassert(cache_key_create("alice", "127.0.0.1", "db", query, key1), "A key should be created");
+    ss_info_dassert(cache_key_create("bob", "127.0.0.1", "db", query, key2), "A key should be created");
+    ss_info_dassert(memcmp(key1, key2, sizeof(key1)) != 0, "Keys of different users should be different");
+
+    ss_info_dassert(cache_key_create("alice", "10.0.0.1", "db", query, key2), "A key should be created");
+    ss_info_dassert(memcmp(key1, key2, sizeof(key1)) != 0, "Keys of different hosts should be different");
+
+    ss_info_dassert(cache_key_create("alice1", "27.0.0.1", "db", query, key2), "A key should be created");
+    ss_info_dassert(memcmp(key1, key2, sizeof(key1)) != 0, "The user should be separated from the host");
+
+    ss_info_dassert(cache_key_create("alice", "127.0.0.1", "db", query, key2), "A key should be created");
+    ss_info_dassert(memcmp(key1, key2, sizeof(key1)) == 0, "Keys of the same account should be equal");
+
+    gwbuf_free(query);
+
+    return 0;
+}
+
+static int test_chains()
+{
+    const char *sql = "SELECT c FROM sbtest1 WHERE id BETWEEN 5012 AND 5111 /* range */ "
+                      "ORDER BY c -- a comment that is long enough to span several buffers\n"
+                      "LIMIT 10";
+
+    ss_dfprintf(stderr, "testcachekey : keys of split packets\n");
+
+    char key[CACHE_KEY_LENGTH];
+    get_key("test", sql, 1, key);
+
+    for (int i = 2; i < 40; i++)
+    {
+        char split_key[CACHE_KEY_LENGTH];
+        get_key("test", sql, i, split_key);
+        ss_info_dassert(memcmp(key, split_key, sizeof(key)) == 0,
+                        "The key of a split packet should be equal to the key of the whole packet");
+    }
+
+    ss_dfprintf(stderr, "testcachekey : only the statement of the first packet is used\n");
+
+    char key2[CACHE_KEY_LENGTH];
+    GWBUF *query = create_query("select 1", 1);
+    query = gwbuf_append(query, create_query("select 2", 1));
+    ss_info_dassert(cache_key_create("maxuser", "127.0.0.1", NULL, query, key2), "A key should be created");
+    gwbuf_free(query);
+    get_key(NULL, "select 1", 1, key);
+    ss_info_dassert(memcmp(key, key2, sizeof(key)) == 0, "Only the first packet should be used");
+
+    ss_dfprintf(stderr, "testcachekey : non-COM_QUERY packets\n");
+
+    query = create_query("select 1", 1);
+    ((uint8_t *)GWBUF_DATA(query))[4] = 0x16;
+    ss_info_dassert(!cache_key_create("maxuser", "127.0.0.1", NULL, query, key),
+                    "Only COM_QUERY packets have keys");
+    gwbuf_free(query);
+
+    return 0;
+}
+
+static int test_canonical()
+{
+    char buf[256];
+
+    for (size_t i = 0; i < N_ELEMS(canonical); i++)
+    {
+        GWBUF *query = create_query(canonical[i][0], 3);
+        int len = cache_key_canonical(query, buf, sizeof(buf));
+        gwbuf_free(query);
+
+        ss_dfprintf(stderr, "testcachekey : \"%s\" -> \"%s\"\n", canonical[i][0], buf);
+        ss_info_dassert(strcmp(buf, canonical[i][1]) == 0, "Unexpected canonical form");
+        ss_info_dassert(len == strlen(canonical[i][1]), "Unexpected canonical length");
+    }
+
+    GWBUF *query = create_query(canonical[0][0], 1);
+    int len = cache_key_canonical(query, buf, 7);
+    gwbuf_free(query);
+    ss_info_dassert(len == strlen(canonical[0][1]), "The full length should be returned");
+    ss_info_dassert(strcmp(buf, "select") == 0, "The output should be truncated");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rval = 0;
+
+    cache_key_init();
+
+    rval += test_keys();
+    rval += test_chains();
+    rval += test_canonical();
+
+    return rval;
+}
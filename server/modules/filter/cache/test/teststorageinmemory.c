@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file teststorageinmemory.c Tests of the sharded in-memory cache storage
+ */
+
+// To ensure that ss_info_assert asserts also when building in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <maxscale/alloc.h>
+#include <buffer.h>
+#include "../cache_key.h"
+#include "../cache_storage_api.h"
+
+/** The number of shards of the storage, see storage_inmemory.c */
+#define TEST_SHARDS 16
+
+CACHE_STORAGE_API *CacheGetStorageAPI();
+
+static CACHE_STORAGE_API *api;
+
+/**
+ * Create a COM_QUERY packet.
+ *
+ * @param sql The statement
+ * @return The packet
+ */
+static GWBUF *create_query(const char *sql)
+{
+    size_t len = strlen(sql);
+    GWBUF *query = gwbuf_alloc(len + 5);
+    MXS_ABORT_IF_NULL(query);
+
+    uint8_t *data = GWBUF_DATA(query);
+    data[0] = (len + 1);
+    data[1] = (len + 1) >> 8;
+    data[2] = (len + 1) >> 16;
+    data[3] = 0;
+    data[4] = 0x03;
+    memcpy(data + 5, sql, len);
+
+    return query;
+}
+
+/**
+ * Create a value to store.
+ *
+ * @param text The contents of the value
+ * @param size The size of the value, the text is repeated to fill it
+ * @return The value
+ */
+static GWBUF *create_value(const char *text, size_t size)
+{
+    GWBUF *value = gwbuf_alloc(size);
+    MXS_ABORT_IF_NULL(value);
+
+    size_t len = strlen(text);
+    uint8_t *data = GWBUF_DATA(value);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        data[i] = text[i % len];
+    }
+
+    return value;
+}
+
+static CACHE_STORAGE *create_storage(uint32_t ttl, const char *arg)
+{
+    char buf[64];
+    char *argv[] = { buf, NULL };
+
+    if (arg)
+    {
+        strcpy(buf, arg);
+    }
+
+    return api->createInstance("test", ttl, arg ? 1 : 0, argv);
+}
+
+static void get_key(CACHE_STORAGE *storage, int n, char *key)
+{
+    char sql[64];
+    sprintf(sql, "select %d", n);
+
+    GWBUF *query = create_query(sql);
+    ss_info_dassert(api->getKey(storage, "maxuser", "127.0.0.1", NULL, query, key) == CACHE_RESULT_OK,
+                    "A key should be created");
+    gwbuf_free(query);
+}
+
+/** The shard of a key, as the storage computes it */
+static int get_shard(const char *key)
+{
+    uint64_t hash;
+    memcpy(&hash, key, sizeof(hash));
+    return hash % TEST_SHARDS;
+}
+
+static cache_result_t put(CACHE_STORAGE *storage, const char *key, const char *text, size_t size)
+{
+    GWBUF *value = create_value(text, size);
+    cache_result_t rv = api->putValue(storage, key, value);
+    gwbuf_free(value);
+    return rv;
+}
+
+/**
+ * Check whether a key has a value.
+ *
+ * @param storage The storage
+ * @param key     The key
+ * @param text    The expected contents of the value or NULL if any value will do
+ * @return True if the key had the expected value
+ */
+static bool has_value(CACHE_STORAGE *storage, const char *key, const char *text)
+{
+    GWBUF *value = NULL;
+
+    if (api->getValue(storage, key, &value) != CACHE_RESULT_OK)
+    {
+        return false;
+    }
+
+    size_t len = text ? strlen(text) : 0;
+    bool rv = !text || (GWBUF_LENGTH(value) >= len && memcmp(GWBUF_DATA(value), text, len) == 0);
+    gwbuf_free(value);
+    return rv;
+}
+
+static int test_args()
+{
+    static const char *invalid[] =
+    {
+        "max_size=abc",
+        "max_size=-1",
+        "max_size=1X",
+        "max_size=17179869184G",
+        "max_size=99999999999999999999",
+        "max_count=",
+        "max_count=10K",
+        "max_count=-1",
+        "max_items=10",
+        "max_count",
+    };
+
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        ss_dfprintf(stderr, "teststorageinmemory : invalid argument %s\n", invalid[i]);
+        ss_info_dassert(create_storage(60, invalid[i]) == NULL, "The storage should not be created");
+    }
+
+    static const char *valid[] =
+    {
+        "max_size=1M",
+        "max_size=16777215G",
+        "max_count=10000",
+    };
+
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++)
+    {
+        ss_dfprintf(stderr, "teststorageinmemory : valid argument %s\n", valid[i]);
+        CACHE_STORAGE *storage = create_storage(60, valid[i]);
+        ss_info_dassert(storage, "The storage should be created");
+        api->freeInstance(storage);
+    }
+
+    CACHE_STORAGE *storage;
+
+    storage = create_storage(60, NULL);
+    ss_info_dassert(storage, "The storage should be created without arguments");
+    api->freeInstance(storage);
+
+    return 0;
+}
+
+static int test_put_get()
+{
+    ss_dfprintf(stderr, "teststorageinmemory : values of many keys in all shards\n");
+
+    /** Enough items for the hash tables of the shards to grow */
+    const int n_items = 10000;
+    CACHE_STORAGE *storage = create_storage(60, NULL);
+    ss_info_dassert(storage, "The storage should be created");
+
+    char key[CACHE_KEY_MAXLEN];
+    char text[32];
+    bool shard_used[TEST_SHARDS] = {};
+
+    for (int i = 0; i < n_items; i++)
+    {
+        get_key(storage, i, key);
+        sprintf(text, "value %d;", i);
+        ss_info_dassert(put(storage, key, text, strlen(text) + i % 100) == CACHE_RESULT_OK,
+                        "The value should be stored");
+        shard_used[get_shard(key)] = true;
+    }
+
+    for (int i = 0; i < TEST_SHARDS; i++)
+    {
+        ss_info_dassert(shard_used[i], "Every shard should have items");
+    }
+
+    for (int i = 0; i < n_items; i++)
+    {
+        get_key(storage, i, key);
+        sprintf(text, "value %d;", i);
+        ss_info_dassert(has_value(storage, key, text), "The stored value should be returned");
+    }
+
+    get_key(storage, n_items, key);
+    ss_info_dassert(!has_value(storage, key, NULL), "A missing key should not have a value");
+
+    ss_dfprintf(stderr, "teststorageinmemory : replacing a value\n");
+
+    get_key(storage, 1, key);
+    ss_info_dassert(put(storage, key, "new value;", 10) == CACHE_RESULT_OK, "The value should be stored");
+    ss_info_dassert(has_value(storage, key, "new value;"), "The new value should be returned");
+
+    api->freeInstance(storage);
+
+    return 0;
+}
+
+/**
+ * Find keys that are in the same shard.
+ *
+ * @param storage The storage
+ * @param keys    Where the keys are stored
+ * @param n_keys  The number of keys to find
+ */
+static void same_shard_keys(CACHE_STORAGE *storage, char keys[][CACHE_KEY_MAXLEN], int n_keys)
+{
+    get_key(storage, 0, keys[0]);
+    int shard = get_shard(keys[0]);
+
+    for (int i = 1, n = 1; n < n_keys; i++)
+    {
+        get_key(storage, i, keys[n]);
+
+        if (get_shard(keys[n]) == shard)
+        {
+            n++;
+        }
+    }
+}
+
+static int test_limits()
+{
+    char keys[3][CACHE_KEY_MAXLEN];
+
+    ss_dfprintf(stderr, "teststorageinmemory : least recently used item is evicted\n");
+
+    /** Two items per shard */
+    CACHE_STORAGE *storage = create_storage(60, "max_count=32");
+    ss_info_dassert(storage, "The storage should be created");
+    same_shard_keys(storage, keys, 3);
+
+    ss_info_dassert(put(storage, keys[0], "a", 10) == CACHE_RESULT_OK, "The value should be stored");
+    ss_info_dassert(put(storage, keys[1], "b", 10) == CACHE_RESULT_OK, "The value should be stored");
+    ss_info_dassert(has_value(storage, keys[0], "a"), "The first value should be returned");
+    ss_info_dassert(put(storage, keys[2], "c", 10) == CACHE_RESULT_OK, "The value should be stored");
+    ss_info_dassert(has_value(storage, keys[0], "a"), "The recently used value should be kept");
+    ss_info_dassert(!has_value(storage, keys[1], NULL), "The least recently used value should be evicted");
+    ss_info_dassert(has_value(storage, keys[2], "c"), "The new value should be returned");
+    api->freeInstance(storage);
+
+    ss_dfprintf(stderr, "teststorageinmemory : count limit of all shards\n");
+
+    storage = create_storage(60, "max_count=160");
+    ss_info_dassert(storage, "The storage should be created");
+
+    for (int i = 0; i < 1000; i++)
+    {
+        get_key(storage, i, keys[0]);
+        ss_info_dassert(put(storage, keys[0], "x", 10) == CACHE_RESULT_OK, "The value should be stored");
+    }
+
+    int n_found = 0;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        get_key(storage, i, keys[0]);
+        n_found += has_value(storage, keys[0], NULL) ? 1 : 0;
+    }
+
+    ss_info_dassert(n_found > 0 && n_found <= 160, "The number of items should be limited");
+    api->freeInstance(storage);
+
+    ss_dfprintf(stderr, "teststorageinmemory : size limit\n");
+
+    /** 1024 bytes per shard */
+    storage = create_storage(60, "max_size=16K");
+    ss_info_dassert(storage, "The storage should be created");
+    same_shard_keys(storage, keys, 3);
+
+    ss_info_dassert(put(storage, keys[0], "a", 2048) == CACHE_RESULT_OUT_OF_RESOURCES,
+                    "A value larger than a shard should not be stored");
+    ss_info_dassert(!has_value(storage, keys[0], NULL), "The too large value should not be returned");
+    ss_info_dassert(put(storage, keys[0], "a", 400) == CACHE_RESULT_OK, "The value should be stored");
+    ss_info_dassert(put(storage, keys[1], "b", 400) == CACHE_RESULT_OK, "The value should be stored");
+    ss_info_dassert(put(storage, keys[2], "c", 400) == CACHE_RESULT_OK, "The value should be stored");
+    ss_info_dassert(!has_value(storage, keys[0], NULL), "The oldest value should be evicted");
+    ss_info_dassert(has_value(storage, keys[1], "b"), "The value should be kept");
+    ss_info_dassert(has_value(storage, keys[2], "c"), "The value should be kept");
+    api->freeInstance(storage);
+
+    return 0;
+}
+
+static int test_ttl()
+{
+    char key[CACHE_KEY_MAXLEN];
+
+    ss_dfprintf(stderr, "teststorageinmemory : expired values\n");
+
+    CACHE_STORAGE *storage = create_storage(1, NULL);
+    ss_info_dassert(storage, "The storage should be created");
+
+    get_key(storage, 1, key);
+    ss_info_dassert(put(storage, key, "a", 10) == CACHE_RESULT_OK, "The value should be stored");
+    ss_info_dassert(has_value(storage, key, "a"), "The value should be returned");
+    sleep(2);
+    ss_info_dassert(!has_value(storage, key, NULL), "An expired value should not be returned");
+    api->freeInstance(storage);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rval = 0;
+
+    api = CacheGetStorageAPI();
+    ss_info_dassert(api && api->initialize(), "The storage should be initialized");
+
+    rval += test_args();
+    rval += test_put_get();
+    rval += test_limits();
+    rval += test_ttl();
+
+    return rval;
+}
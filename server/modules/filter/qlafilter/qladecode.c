@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file qladecode.c - The binary query log decoder
+ *
+ * This utility converts the binary query logs of the QLA filter to CSV or
+ * to JSON with one object per line. Compressed logs are decoded as is.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "qlalog.h"
+
+static void printVersion(const char *progname);
+static void printUsage(const char *progname);
+
+static struct option long_options[] =
+{
+    {"format",  required_argument, 0, 'f'},
+    {"version", no_argument, 0, 'V'},
+    {"help",    no_argument, 0, '?'},
+    {0, 0, 0, 0}
+};
+
+static char *qla_decode_version = "1.0.0";
+
+typedef enum
+{
+    FORMAT_CSV,
+    FORMAT_JSON
+} decode_format_t;
+
+int
+maxscale_uptime()
+{
+    return 1;
+}
+
+/**
+ * Print a string as a quoted CSV field
+ */
+static void
+print_csv_string(const char *str, size_t len)
+{
+    putchar('"');
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (str[i] == '"')
+        {
+            putchar('"');
+        }
+        putchar(str[i]);
+    }
+
+    putchar('"');
+}
+
+/**
+ * Print a string as a JSON string
+ */
+static void
+print_json_string(const char *str, size_t len)
+{
+    putchar('"');
+
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = str[i];
+
+        switch (c)
+        {
+        case '"':
+            fputs("\\\"", stdout);
+            break;
+        case '\\':
+            fputs("\\\\", stdout);
+            break;
+        case '\n':
+            fputs("\\n", stdout);
+            break;
+        case '\r':
+            fputs("\\r", stdout);
+            break;
+        case '\t':
+            fputs("\\t", stdout);
+            break;
+        default:
+            if (c < 0x20)
+            {
+                printf("\\u%04x", c);
+            }
+            else
+            {
+                putchar(c);
+            }
+            break;
+        }
+    }
+
+    putchar('"');
+}
+
+/**
+ * Print the time of a record as YYYY-MM-DD HH:MM:SS.uuuuuu in local time
+ */
+static void
+print_time(uint64_t time_us)
+{
+    time_t sec = time_us / 1000000;
+    struct tm tm;
+    char buf[32];
+
+    localtime_r(&sec, &tm);
+    strftime(buf, sizeof(buf), "%F %T", &tm);
+    printf("%s.%06u", buf, (unsigned)(time_us % 1000000));
+}
+
+static void
+print_csv(const QLA_RECORD *record)
+{
+    print_time(record->time_us);
+    printf(",%lu,", record->session_id);
+    print_csv_string(record->user, record->user_len);
+    putchar(',');
+    print_csv_string(record->host, record->host_len);
+    putchar(',');
+    print_csv_string(record->server, record->server_len);
+    putchar(',');
+
+    if (record->response_us != QLA_NO_RESPONSE)
+    {
+        printf("%u", record->response_us);
+    }
+
+    printf(",%016lx,", record->hash);
+    print_csv_string(record->sql, record->sql_len);
+    putchar('\n');
+}
+
+static void
+print_json(const QLA_RECORD *record)
+{
+    fputs("{\"time\": \"", stdout);
+    print_time(record->time_us);
+    printf("\", \"time_us\": %lu, \"session\": %lu, \"user\": ",
+           record->time_us, record->session_id);
+    print_json_string(record->user, record->user_len);
+    fputs(", \"host\": ", stdout);
+    print_json_string(record->host, record->host_len);
+    fputs(", \"server\": ", stdout);
+
+    if (record->server_len)
+    {
+        print_json_string(record->server, record->server_len);
+    }
+    else
+    {
+        fputs("null", stdout);
+    }
+
+    fputs(", \"response_us\": ", stdout);
+
+    if (record->response_us != QLA_NO_RESPONSE)
+    {
+        printf("%u", record->response_us);
+    }
+    else
+    {
+        fputs("null", stdout);
+    }
+
+    printf(", \"hash\": \"%016lx\", \"query\": ", record->hash);
+    print_json_string(record->sql, record->sql_len);
+    fputs("}\n", stdout);
+}
+
+/**
+ * Decode one file
+ *
+ * @param filename The binary query log
+ * @param format   The output format
+ * @return True if the whole file was decoded
+ */
+static bool
+decode_file(const char *filename, decode_format_t format)
+{
+    QLA_READER *reader = qla_reader_open(filename);
+
+    if (reader == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open %s or it is not a binary query log.\n",
+                filename);
+        return false;
+    }
+
+    QLA_RECORD record;
+    int rc;
+
+    while ((rc = qla_reader_next(reader, &record)) == 1)
+    {
+        if (format == FORMAT_JSON)
+        {
+            print_json(&record);
+        }
+        else
+        {
+            print_csv(&record);
+        }
+    }
+
+    if (rc == -1)
+    {
+        fprintf(stderr, "ERROR: %s is truncated or malformed, the rest of it is skipped.\n",
+                filename);
+    }
+
+    qla_reader_close(reader);
+
+    return rc == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int option_index = 0;
+    decode_format_t format = FORMAT_CSV;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "f:V?", long_options, &option_index)) >= 0)
+    {
+        switch (c)
+        {
+        case 'f':
+            if (strcasecmp(optarg, "csv") == 0)
+            {
+                format = FORMAT_CSV;
+            }
+            else if (strcasecmp(optarg, "json") == 0)
+            {
+                format = FORMAT_JSON;
+            }
+            else
+            {
+                printf("ERROR: Unknown format '%s', expected 'csv' or 'json'.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'V':
+            printVersion(*argv);
+            exit(EXIT_SUCCESS);
+            break;
+        case '?':
+            printUsage(*argv);
+            exit(optopt ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+    }
+
+    if (optind >= argc)
+    {
+        printf("ERROR: No binary query log was specified.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (format == FORMAT_CSV)
+    {
+        printf("time,session,user,host,server,response_us,hash,query\n");
+    }
+
+    int rval = EXIT_SUCCESS;
+
+    for (int i = optind; i < argc; i++)
+    {
+        if (!decode_file(argv[i], format))
+        {
+            rval = EXIT_FAILURE;
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Print version information
+ */
+static void
+printVersion(const char *progname)
+{
+    printf("%s Version %s\n", progname, qla_decode_version);
+}
+
+/**
+ * Display the --help text.
+ */
+static void
+printUsage(const char *progname)
+{
+    printVersion(progname);
+
+    printf("The MaxScale binary query log decoder\n\n");
+    printf("Usage: %s [-f csv|json] [-V] [-?] <file> ...\n\n", progname);
+    printf("  -f|--format   Output format, csv (default) or json\n");
+    printf("  -V|--version  Print version information and exit\n");
+    printf("  -?|--help     Print this help text\n");
+}
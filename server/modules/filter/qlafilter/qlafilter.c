@@ -26,6 +26,11 @@
  * file to which the queries are logged. A serial number is appended to this
  * name in order that each session logs to a different file.
  *
+ * With format=binary the queries of all sessions are logged to a binary
+ * query log, see qlalog.h, along with the session, the server that replied
+ * and the response time. The log can be converted to CSV or JSON with
+ * maxqladecode.
+ *
  * Date         Who             Description
  * 03/06/2014   Mark Riddoch    Initial implementation
  * 11/06/2014   Mark Riddoch    Addition of source and match parameters
@@ -47,7 +52,11 @@
 #include <regex.h>
 #include <string.h>
 #include <atomic.h>
+#include <housekeeper.h>
+#include <maxconfig.h>
+#include <server.h>
 #include <maxscale/alloc.h>
+#include "qlalog.h"
 
 MODULE_INFO info =
 {
@@ -57,11 +66,14 @@ MODULE_INFO info =
     "A simple query logging filter"
 };
 
-static char *version_str = "V1.1.1";
+static char *version_str = "V1.2.0";
 
 /** Formatting buffer size */
 #define QLA_STRING_BUFFER_SIZE 1024
 
+/** How often the buffered records of the binary format are written, in seconds */
+#define QLA_FLUSH_INTERVAL 1
+
 /*
  * The filter entry points
  */
@@ -70,7 +82,9 @@ static void *newSession(FILTER *instance, SESSION *session);
 static void closeSession(FILTER *instance, void *session);
 static void freeSession(FILTER *instance, void *session);
 static void setDownstream(FILTER *instance, void *fsession, DOWNSTREAM *downstream);
+static void setUpstream(FILTER *instance, void *fsession, UPSTREAM *upstream);
 static int routeQuery(FILTER *instance, void *fsession, GWBUF *queue);
+static int clientReply(FILTER *instance, void *fsession, GWBUF *queue);
 static void diagnostic(FILTER *instance, void *fsession, DCB *dcb);
 
 
@@ -81,9 +95,9 @@ static FILTER_OBJECT MyObject =
     closeSession,
     freeSession,
     setDownstream,
-    NULL, // No Upstream requirement
+    setUpstream,
     routeQuery,
-    NULL, // No client reply
+    clientReply,
     diagnostic,
 };
 
@@ -93,7 +107,8 @@ static FILTER_OBJECT MyObject =
  * are logged.
  *
  * To this base a session number is attached such that each session will
- * have a unique name.
+ * have a unique name. In the binary format all sessions log to the files
+ * of the writer.
  */
 typedef struct
 {
@@ -105,6 +120,11 @@ typedef struct
     regex_t re; /* Compiled regex text */
     char *nomatch; /* Optional text to match against for exclusion */
     regex_t nore; /* Compiled regex nomatch text */
+    bool binary; /* Whether the binary format is used */
+    bool compress; /* Whether the binary log is compressed */
+    size_t rotate_size; /* Size after which a new binary log is started */
+    int rotate_time; /* Seconds after which a new binary log is started */
+    QLA_WRITER *writer; /* The writer of the binary log */
 } QLA_INSTANCE;
 
 /**
@@ -113,18 +133,128 @@ typedef struct
  * filter is able to pass the query on to the next filter (or router)
  * in the chain.
  *
- * It also holds the file descriptor to which queries are written.
+ * It also holds the file descriptor to which queries are written. In the
+ * binary format the query is kept until the reply to it arrives so that the
+ * response time and the server can be logged with it.
  */
 typedef struct
 {
     DOWNSTREAM down;
+    UPSTREAM up;
     char *filename;
     FILE *fp;
     int active;
     char *user;
     char *remote;
+    SESSION *session;
+    SPINLOCK lock; /* Protects the pending query */
+    bool pending; /* Whether a query is waiting for a reply */
+    uint64_t pending_time; /* When the pending query was received */
+    uint64_t pending_hash; /* Digest hash of the pending query */
+    char *pending_sql; /* The pending query, not null terminated */
+    size_t pending_len;
+    size_t pending_size; /* Size of the pending_sql buffer */
 } QLA_SESSION;
 
+/**
+ * Current time in microseconds
+ */
+static uint64_t
+qla_now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * Housekeeper task that writes the buffered records of the binary log
+ *
+ * @param data The filter instance
+ */
+static void
+qla_flush_task(void *data)
+{
+    QLA_INSTANCE *my_instance = (QLA_INSTANCE *) data;
+    qla_writer_flush(my_instance->writer);
+}
+
+/**
+ * Write the pending query of a session to the binary log. The caller must
+ * hold the lock of the session.
+ *
+ * @param my_instance The filter instance
+ * @param my_session  The filter session
+ * @param response    The response time of the query or QLA_NO_RESPONSE
+ */
+static void
+qla_log_pending(QLA_INSTANCE *my_instance, QLA_SESSION *my_session, uint32_t response)
+{
+    if (my_session->pending)
+    {
+        SERVER *server = response != QLA_NO_RESPONSE ? my_session->session->reply_server : NULL;
+        QLA_RECORD record;
+
+        record.time_us = my_session->pending_time;
+        record.session_id = my_session->session->ses_id;
+        record.hash = my_session->pending_hash;
+        record.response_us = response;
+        record.user = my_session->user ? my_session->user : "";
+        record.user_len = strlen(record.user);
+        record.host = my_session->remote ? my_session->remote : "";
+        record.host_len = strlen(record.host);
+        record.server = server ? server->unique_name : NULL;
+        record.server_len = server ? strlen(server->unique_name) : 0;
+        record.sql = my_session->pending_sql;
+        record.sql_len = my_session->pending_len;
+
+        qla_writer_add(my_instance->writer, &record);
+        my_session->pending = false;
+    }
+}
+
+/**
+ * Store a query of a session until its reply arrives. A query that is still
+ * waiting for a reply is logged without a response time.
+ *
+ * @param my_instance The filter instance
+ * @param my_session  The filter session
+ * @param sql         The query
+ * @param len         Length of the query
+ */
+static void
+qla_store_pending(QLA_INSTANCE *my_instance, QLA_SESSION *my_session,
+                  const char *sql, size_t len)
+{
+    uint64_t hash = modutil_get_digest(sql, len, NULL, 0);
+    uint64_t now = qla_now();
+
+    spinlock_acquire(&my_session->lock);
+    qla_log_pending(my_instance, my_session, QLA_NO_RESPONSE);
+
+    if (len > my_session->pending_size)
+    {
+        char *sql_buf = MXS_REALLOC(my_session->pending_sql, len);
+
+        if (sql_buf)
+        {
+            my_session->pending_sql = sql_buf;
+            my_session->pending_size = len;
+        }
+    }
+
+    if (len <= my_session->pending_size)
+    {
+        memcpy(my_session->pending_sql, sql, len);
+        my_session->pending_len = len;
+        my_session->pending_time = now;
+        my_session->pending_hash = hash;
+        my_session->pending = true;
+    }
+
+    spinlock_release(&my_session->lock);
+}
+
 /**
  * Implementation of the mandatory version entry point
  *
@@ -184,6 +314,11 @@ createInstance(const char *name, char **options, FILTER_PARAMETER **params)
         my_instance->match = NULL;
         my_instance->nomatch = NULL;
         my_instance->filebase = NULL;
+        my_instance->binary = false;
+        my_instance->compress = false;
+        my_instance->rotate_size = 0;
+        my_instance->rotate_time = 0;
+        my_instance->writer = NULL;
         bool error = false;
 
         if (params)
@@ -210,6 +345,31 @@ createInstance(const char *name, char **options, FILTER_PARAMETER **params)
                 {
                     my_instance->filebase = MXS_STRDUP_A(params[i]->value);
                 }
+                else if (!strcmp(params[i]->name, "format"))
+                {
+                    if (!strcasecmp(params[i]->value, "binary"))
+                    {
+                        my_instance->binary = true;
+                    }
+                    else if (strcasecmp(params[i]->value, "text"))
+                    {
+                        MXS_ERROR("qlafilter: Unknown format '%s', expected "
+                                  "'text' or 'binary'.", params[i]->value);
+                        error = true;
+                    }
+                }
+                else if (!strcmp(params[i]->name, "compress"))
+                {
+                    my_instance->compress = config_truth_value(params[i]->value);
+                }
+                else if (!strcmp(params[i]->name, "rotate_size"))
+                {
+                    my_instance->rotate_size = strtoul(params[i]->value, NULL, 10);
+                }
+                else if (!strcmp(params[i]->name, "rotate_time"))
+                {
+                    my_instance->rotate_time = atoi(params[i]->value);
+                }
                 else if (!filter_standard_parameter(params[i]->name))
                 {
                     MXS_ERROR("qlafilter: Unexpected parameter '%s'.",
@@ -274,6 +434,30 @@ createInstance(const char *name, char **options, FILTER_PARAMETER **params)
             error = true;
         }
 
+        if (!error && my_instance->binary)
+        {
+            my_instance->writer = qla_writer_alloc(my_instance->filebase,
+                                                   config_threadcount(),
+                                                   my_instance->compress,
+                                                   my_instance->rotate_size,
+                                                   my_instance->rotate_time);
+            if (my_instance->writer)
+            {
+                char taskname[strlen(name) + 20];
+                sprintf(taskname, "qlafilter flush %s", name);
+                hktask_add(taskname, qla_flush_task, my_instance, QLA_FLUSH_INTERVAL);
+            }
+            else
+            {
+                error = true;
+            }
+        }
+        else if (my_instance->compress || my_instance->rotate_size || my_instance->rotate_time)
+        {
+            MXS_WARNING("qlafilter: The 'compress', 'rotate_size' and 'rotate_time' "
+                        "parameters are only used with 'format=binary'.");
+        }
+
         if (error)
         {
             if (my_instance->match)
@@ -336,6 +520,8 @@ newSession(FILTER *instance, SESSION *session)
 
         my_session->user = userName;
         my_session->remote = remote;
+        my_session->session = session;
+        spinlock_init(&my_session->lock);
 
         sprintf(my_session->filename, "%s.%d",
                 my_instance->filebase,
@@ -344,7 +530,7 @@ newSession(FILTER *instance, SESSION *session)
         // Multiple sessions can try to update my_instance->sessions simultaneously
         atomic_add(&(my_instance->sessions), 1);
 
-        if (my_session->active)
+        if (my_session->active && !my_instance->binary)
         {
             my_session->fp = fopen(my_session->filename, "w");
 
@@ -383,12 +569,20 @@ newSession(FILTER *instance, SESSION *session)
 static void
 closeSession(FILTER *instance, void *session)
 {
+    QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
     QLA_SESSION *my_session = (QLA_SESSION *) session;
 
     if (my_session->active && my_session->fp)
     {
         fclose(my_session->fp);
     }
+
+    if (my_instance->binary)
+    {
+        spinlock_acquire(&my_session->lock);
+        qla_log_pending(my_instance, my_session, QLA_NO_RESPONSE);
+        spinlock_release(&my_session->lock);
+    }
 }
 
 /**
@@ -403,6 +597,7 @@ freeSession(FILTER *instance, void *session)
     QLA_SESSION *my_session = (QLA_SESSION *) session;
 
     MXS_FREE(my_session->filename);
+    MXS_FREE(my_session->pending_sql);
     MXS_FREE(session);
     return;
 }
@@ -423,6 +618,22 @@ setDownstream(FILTER *instance, void *session, DOWNSTREAM *downstream)
     my_session->down = *downstream;
 }
 
+/**
+ * Set the upstream filter or session to which results will be
+ * passed from this filter.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param upstream  The upstream filter or session.
+ */
+static void
+setUpstream(FILTER *instance, void *session, UPSTREAM *upstream)
+{
+    QLA_SESSION *my_session = (QLA_SESSION *) session;
+
+    my_session->up = *upstream;
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
@@ -449,19 +660,35 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
         {
             queue = gwbuf_make_contiguous(queue);
         }
-        if ((ptr = modutil_get_SQL(queue)) != NULL)
+
+        if (my_instance->binary && my_instance->match == NULL && my_instance->nomatch == NULL)
+        {
+            /** No need to copy the query if it's not matched against */
+            if (modutil_extract_SQL(queue, &ptr, &length))
+            {
+                qla_store_pending(my_instance, my_session, ptr, length);
+            }
+        }
+        else if ((ptr = modutil_get_SQL(queue)) != NULL)
         {
             if ((my_instance->match == NULL ||
                  regexec(&my_instance->re, ptr, 0, NULL, 0) == 0) &&
                 (my_instance->nomatch == NULL ||
                  regexec(&my_instance->nore, ptr, 0, NULL, 0) != 0))
             {
-                char buffer[QLA_STRING_BUFFER_SIZE];
-                gettimeofday(&tv, NULL);
-                localtime_r(&tv.tv_sec, &t);
-                strftime(buffer, sizeof(buffer), "%F %T", &t);
-                fprintf(my_session->fp, "%s,%s@%s,%s\n", buffer, my_session->user,
-                        my_session->remote, trim(squeeze_whitespace(ptr)));
+                if (my_instance->binary)
+                {
+                    qla_store_pending(my_instance, my_session, ptr, strlen(ptr));
+                }
+                else
+                {
+                    char buffer[QLA_STRING_BUFFER_SIZE];
+                    gettimeofday(&tv, NULL);
+                    localtime_r(&tv.tv_sec, &t);
+                    strftime(buffer, sizeof(buffer), "%F %T", &t);
+                    fprintf(my_session->fp, "%s,%s@%s,%s\n", buffer, my_session->user,
+                            my_session->remote, trim(squeeze_whitespace(ptr)));
+                }
             }
             MXS_FREE(ptr);
         }
@@ -471,6 +698,39 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
                                        my_session->down.session, queue);
 }
 
+/**
+ * The clientReply entry point. In the binary format the first reply to a
+ * query logs the query with its response time and the server that replied.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param reply     The reply data
+ */
+static int
+clientReply(FILTER *instance, void *session, GWBUF *reply)
+{
+    QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
+    QLA_SESSION *my_session = (QLA_SESSION *) session;
+
+    if (my_instance->binary && my_session->pending)
+    {
+        spinlock_acquire(&my_session->lock);
+
+        if (my_session->pending)
+        {
+            uint64_t elapsed = qla_now() - my_session->pending_time;
+            qla_log_pending(my_instance, my_session,
+                            elapsed < QLA_NO_RESPONSE ? elapsed : QLA_NO_RESPONSE - 1);
+        }
+
+        spinlock_release(&my_session->lock);
+    }
+
+    /* Pass the result upstream */
+    return my_session->up.clientReply(my_session->up.instance,
+                                      my_session->up.session, reply);
+}
+
 /**
  * Diagnostics routine
  *
@@ -488,7 +748,21 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
     QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
     QLA_SESSION *my_session = (QLA_SESSION *) fsession;
 
-    if (my_session)
+    if (my_instance->writer)
+    {
+        QLA_WRITER *writer = my_instance->writer;
+
+        spinlock_acquire(&writer->file_lock);
+        dcb_printf(dcb, "\t\tLogging to binary file     %s\n",
+                   writer->filename ? writer->filename : "none");
+        dcb_printf(dcb, "\t\tRecords written            %lu\n", writer->n_records);
+        dcb_printf(dcb, "\t\tBytes written              %lu\n", writer->n_bytes);
+        dcb_printf(dcb, "\t\tFiles opened               %d\n", writer->n_files);
+        dcb_printf(dcb, "\t\tFailed writes              %d\n", writer->n_errors);
+        dcb_printf(dcb, "\t\tDropped records            %lu\n", writer->n_dropped);
+        spinlock_release(&writer->file_lock);
+    }
+    else if (my_session)
     {
         dcb_printf(dcb, "\t\tLogging to file            %s.\n",
                    my_session->filename);
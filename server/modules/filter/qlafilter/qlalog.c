@@ -0,0 +1,767 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file qlalog.c The binary query log of the QLA filter
+ */
+
+#include "qlalog.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <atomic.h>
+#include <thread.h>
+#include <log_manager.h>
+#include <skygw_utils.h>
+#include <maxscale/alloc.h>
+
+/** The buffer of a thread is selected with this, each thread gets the next number */
+static __thread int qla_thread_slot = -1;
+static int qla_thread_count;
+
+static void put_le(uint8_t *dest, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        dest[i] = value >> (8 * i);
+    }
+}
+
+static uint64_t get_le(const uint8_t *src, int bytes)
+{
+    uint64_t value = 0;
+
+    for (int i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t)src[i] << (8 * i);
+    }
+
+    return value;
+}
+
+size_t qla_record_len(const QLA_RECORD *record)
+{
+    return QLA_RECORD_HEADER_LEN + record->user_len + record->host_len +
+           record->server_len + record->sql_len;
+}
+
+void qla_record_encode(const QLA_RECORD *record, uint8_t *dest)
+{
+    put_le(dest, qla_record_len(record) - 4, 4);
+    put_le(dest + 4, record->time_us, 8);
+    put_le(dest + 12, record->session_id, 8);
+    put_le(dest + 20, record->hash, 8);
+    put_le(dest + 28, record->response_us, 4);
+    put_le(dest + 32, record->user_len, 2);
+    put_le(dest + 34, record->host_len, 2);
+    put_le(dest + 36, record->server_len, 2);
+    put_le(dest + 38, record->sql_len, 4);
+    dest += QLA_RECORD_HEADER_LEN;
+
+    memcpy(dest, record->user, record->user_len);
+    dest += record->user_len;
+    memcpy(dest, record->host, record->host_len);
+    dest += record->host_len;
+    if (record->server_len)
+    {
+        memcpy(dest, record->server, record->server_len);
+        dest += record->server_len;
+    }
+    memcpy(dest, record->sql, record->sql_len);
+}
+
+int qla_record_decode(const uint8_t *data, size_t len, QLA_RECORD *record)
+{
+    if (len < QLA_RECORD_HEADER_LEN)
+    {
+        return 0;
+    }
+
+    size_t reclen = get_le(data, 4) + 4;
+
+    record->time_us = get_le(data + 4, 8);
+    record->session_id = get_le(data + 12, 8);
+    record->hash = get_le(data + 20, 8);
+    record->response_us = get_le(data + 28, 4);
+    record->user_len = get_le(data + 32, 2);
+    record->host_len = get_le(data + 34, 2);
+    record->server_len = get_le(data + 36, 2);
+    record->sql_len = get_le(data + 38, 4);
+
+    if (qla_record_len(record) != reclen)
+    {
+        return -1;
+    }
+    else if (len < reclen)
+    {
+        return 0;
+    }
+
+    const char *ptr = (const char*)data + QLA_RECORD_HEADER_LEN;
+    record->user = ptr;
+    ptr += record->user_len;
+    record->host = ptr;
+    ptr += record->host_len;
+    record->server = record->server_len ? ptr : NULL;
+    ptr += record->server_len;
+    record->sql = ptr;
+
+    return reclen;
+}
+
+/**
+ * Compress data into one gzip member
+ *
+ * @param zstream The compression stream
+ * @param data    Data to compress
+ * @param len     Length of the data
+ * @param dest    Where the compressed data is written
+ * @param size    Size of @c dest, at least deflateBound() of @c len
+ * @return Length of the compressed data, 0 on error
+ */
+static size_t qla_compress(z_stream *zstream, const uint8_t *data, size_t len,
+                           uint8_t *dest, size_t size)
+{
+    size_t rval = 0;
+
+    if (deflateReset(zstream) == Z_OK)
+    {
+        zstream->next_in = (Bytef*)data;
+        zstream->avail_in = len;
+        zstream->next_out = dest;
+        zstream->avail_out = size;
+
+        if (deflate(zstream, Z_FINISH) == Z_STREAM_END)
+        {
+            rval = size - zstream->avail_out;
+        }
+    }
+
+    return rval;
+}
+
+static z_stream *qla_zstream_alloc()
+{
+    z_stream *zstream = (z_stream*)MXS_CALLOC(1, sizeof(z_stream));
+
+    /** A window of 15 bits plus 16 for a gzip header and trailer */
+    if (zstream && deflateInit2(zstream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+                                Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        MXS_ERROR("qlafilter: Failed to initialize compression.");
+        MXS_FREE(zstream);
+        zstream = NULL;
+    }
+
+    return zstream;
+}
+
+static void qla_zstream_free(z_stream *zstream)
+{
+    if (zstream)
+    {
+        deflateEnd(zstream);
+        MXS_FREE(zstream);
+    }
+}
+
+static bool qla_write_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        data += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/**
+ * Open the next file of the writer and write the header to it. Only called
+ * by the writer thread, or before it is started.
+ *
+ * @param writer The writer
+ * @return True if the file was opened
+ */
+static bool qla_writer_open(QLA_WRITER *writer)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    char datetime[20];
+
+    localtime_r(&now, &tm);
+    strftime(datetime, sizeof(datetime), "%Y%m%d-%H%M%S", &tm);
+
+    size_t len = strlen(writer->filebase) + strlen(datetime) + 40;
+    char *filename = (char*)MXS_MALLOC(len);
+
+    if (filename == NULL)
+    {
+        return false;
+    }
+
+    snprintf(filename, len, "%s.%s.%06d.qlb%s", writer->filebase, datetime,
+             writer->file_seq++, writer->compress ? ".gz" : "");
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    if (fd == -1)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("qlafilter: Failed to open query log file '%s': %d, %s",
+                  filename, errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        MXS_FREE(filename);
+        return false;
+    }
+
+    uint8_t header[QLA_LOG_MAGIC_LEN + 64];
+    size_t header_len = QLA_LOG_MAGIC_LEN;
+    memcpy(header, QLA_LOG_MAGIC, QLA_LOG_MAGIC_LEN);
+
+    if (writer->compress)
+    {
+        /** The header is a gzip member of its own */
+        uint8_t zheader[sizeof(header)];
+
+        header_len = qla_compress((z_stream*)writer->zstream, header, QLA_LOG_MAGIC_LEN,
+                                  zheader, sizeof(zheader));
+        memcpy(header, zheader, header_len);
+    }
+
+    if (header_len == 0 || !qla_write_all(fd, header, header_len))
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("qlafilter: Failed to write to query log file '%s': %d, %s",
+                  filename, errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        close(fd);
+        MXS_FREE(filename);
+        return false;
+    }
+
+    int old_fd = writer->fd;
+    char *old_filename = writer->filename;
+
+    spinlock_acquire(&writer->file_lock);
+    writer->fd = fd;
+    writer->filename = filename;
+    writer->file_size = header_len;
+    writer->file_empty = true;
+    writer->file_opened = now;
+    writer->n_files++;
+    spinlock_release(&writer->file_lock);
+
+    if (old_fd != -1)
+    {
+        close(old_fd);
+    }
+
+    MXS_FREE(old_filename);
+
+    return true;
+}
+
+/**
+ * Start a new file if the current one is too old or could not be opened
+ *
+ * @param writer The writer
+ */
+static void qla_writer_check_time(QLA_WRITER *writer)
+{
+    if (writer->fd == -1 ||
+        (!writer->file_empty && writer->rotate_time &&
+         time(NULL) - writer->file_opened >= writer->rotate_time))
+    {
+        qla_writer_open(writer);
+    }
+}
+
+/**
+ * Write data to the current file, starting a new file first if the current
+ * one is full or too old. Only called by the writer thread.
+ *
+ * @param writer    The writer
+ * @param data      The data
+ * @param len       Length of the data
+ * @param n_records Number of records in the data
+ */
+static void qla_writer_write(QLA_WRITER *writer, const uint8_t *data, size_t len, int n_records)
+{
+    if (!writer->file_empty && writer->rotate_size &&
+        writer->file_size + len > writer->rotate_size)
+    {
+        qla_writer_open(writer);
+    }
+    else
+    {
+        qla_writer_check_time(writer);
+    }
+
+    if (writer->fd != -1 && qla_write_all(writer->fd, data, len))
+    {
+        spinlock_acquire(&writer->file_lock);
+        writer->file_size += len;
+        writer->file_empty = false;
+        writer->n_bytes += len;
+        writer->n_records += n_records;
+        spinlock_release(&writer->file_lock);
+    }
+    else
+    {
+        /** Only the first failure is logged to avoid flooding the log */
+        if (atomic_add(&writer->n_errors, 1) == 0 && writer->fd != -1)
+        {
+            char errbuf[STRERROR_BUFLEN];
+            MXS_ERROR("qlafilter: Failed to write to query log file '%s': %d, %s",
+                      writer->filename, errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        }
+    }
+}
+
+/**
+ * Compress and write the records of a block. Only called by the writer thread.
+ *
+ * @param writer The writer
+ * @param block  The block
+ */
+static void qla_block_write(QLA_WRITER *writer, QLA_BLOCK *block)
+{
+    if (writer->zstream)
+    {
+        size_t zlen = qla_compress((z_stream*)writer->zstream, block->data, block->used,
+                                   writer->zdata, writer->zsize);
+
+        if (zlen > 0)
+        {
+            qla_writer_write(writer, writer->zdata, zlen, block->n_records);
+        }
+        else
+        {
+            atomic_add(&writer->n_errors, 1);
+        }
+    }
+    else
+    {
+        qla_writer_write(writer, block->data, block->used, block->n_records);
+    }
+}
+
+/**
+ * The writer thread. Writes the queued blocks in the order they were queued
+ * and rotates the file by time when there is nothing to write.
+ *
+ * @param data The writer
+ */
+static void qla_writer_main(void *data)
+{
+    QLA_WRITER *writer = (QLA_WRITER*)data;
+
+    pthread_mutex_lock(&writer->queue_lock);
+
+    while (!writer->stop || writer->queue_head)
+    {
+        QLA_BLOCK *block = writer->queue_head;
+
+        if (block)
+        {
+            writer->queue_head = block->next;
+            writer->n_queued--;
+
+            if (writer->queue_head == NULL)
+            {
+                writer->queue_tail = NULL;
+            }
+
+            writer->writing = true;
+            pthread_mutex_unlock(&writer->queue_lock);
+
+            qla_block_write(writer, block);
+
+            pthread_mutex_lock(&writer->queue_lock);
+            block->next = writer->free_blocks;
+            writer->free_blocks = block;
+            writer->writing = false;
+        }
+        else
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+
+            pthread_cond_broadcast(&writer->idle_cond);
+            pthread_cond_timedwait(&writer->queue_cond, &writer->queue_lock, &ts);
+
+            if (writer->queue_head == NULL && !writer->stop)
+            {
+                pthread_mutex_unlock(&writer->queue_lock);
+                qla_writer_check_time(writer);
+                pthread_mutex_lock(&writer->queue_lock);
+            }
+        }
+    }
+
+    pthread_cond_broadcast(&writer->idle_cond);
+    pthread_mutex_unlock(&writer->queue_lock);
+}
+
+/**
+ * Hand the records of a buffer to the writer thread. Must be called with the
+ * lock of the buffer held so that the blocks of a buffer are queued in the
+ * order they were filled. If too many blocks are already queued, the records
+ * are dropped rather than waiting for the file writes.
+ *
+ * @param writer The writer
+ * @param buffer The buffer
+ */
+static void qla_buffer_flush(QLA_WRITER *writer, QLA_BUFFER *buffer)
+{
+    QLA_BLOCK *block = buffer->block;
+
+    if (block->used == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&writer->queue_lock);
+
+    QLA_BLOCK *next = writer->free_blocks;
+
+    if (next)
+    {
+        writer->free_blocks = next->next;
+    }
+
+    if (writer->n_queued < QLA_MAX_QUEUED &&
+        (next || (next = (QLA_BLOCK*)MXS_MALLOC(sizeof(QLA_BLOCK)))))
+    {
+        block->next = NULL;
+
+        if (writer->queue_tail)
+        {
+            writer->queue_tail->next = block;
+        }
+        else
+        {
+            writer->queue_head = block;
+        }
+
+        writer->queue_tail = block;
+        writer->n_queued++;
+        pthread_cond_signal(&writer->queue_cond);
+
+        next->used = 0;
+        next->n_records = 0;
+        buffer->block = next;
+    }
+    else
+    {
+        if (next)
+        {
+            next->next = writer->free_blocks;
+            writer->free_blocks = next;
+        }
+
+        /** Only the first drop is logged to avoid flooding the log */
+        if (writer->n_dropped == 0)
+        {
+            MXS_WARNING("qlafilter: Query log file writes can't keep up with the queries, "
+                        "records are dropped.");
+        }
+
+        writer->n_dropped += block->n_records;
+        block->used = 0;
+        block->n_records = 0;
+    }
+
+    pthread_mutex_unlock(&writer->queue_lock);
+}
+
+QLA_WRITER *qla_writer_alloc(const char *filebase, int n_buffers, bool compress,
+                             size_t rotate_size, int rotate_time)
+{
+    QLA_WRITER *writer = (QLA_WRITER*)MXS_CALLOC(1, sizeof(QLA_WRITER));
+
+    if (writer == NULL)
+    {
+        return NULL;
+    }
+
+    spinlock_init(&writer->file_lock);
+    pthread_mutex_init(&writer->queue_lock, NULL);
+    pthread_cond_init(&writer->queue_cond, NULL);
+    pthread_cond_init(&writer->idle_cond, NULL);
+    writer->fd = -1;
+    writer->compress = compress;
+    writer->rotate_size = rotate_size;
+    writer->rotate_time = rotate_time;
+    writer->n_buffers = n_buffers > 0 ? n_buffers : 1;
+    writer->filebase = MXS_STRDUP(filebase);
+    writer->buffers = (QLA_BUFFER*)MXS_CALLOC(writer->n_buffers, sizeof(QLA_BUFFER));
+    bool error = writer->filebase == NULL || writer->buffers == NULL;
+
+    for (int i = 0; !error && i < writer->n_buffers; i++)
+    {
+        QLA_BUFFER *buffer = &writer->buffers[i];
+        spinlock_init(&buffer->lock);
+
+        if ((buffer->block = (QLA_BLOCK*)MXS_CALLOC(1, sizeof(QLA_BLOCK))) == NULL)
+        {
+            error = true;
+        }
+    }
+
+    if (!error && compress)
+    {
+        writer->zstream = qla_zstream_alloc();
+        writer->zsize = writer->zstream ?
+                        deflateBound((z_stream*)writer->zstream, QLA_BUFFER_SIZE) : 0;
+
+        if (writer->zstream == NULL ||
+            (writer->zdata = (uint8_t*)MXS_MALLOC(writer->zsize)) == NULL)
+        {
+            error = true;
+        }
+    }
+
+    if (!error)
+    {
+        error = !qla_writer_open(writer);
+    }
+
+    if (!error)
+    {
+        if (thread_start(&writer->thread, qla_writer_main, writer) != NULL)
+        {
+            writer->running = true;
+        }
+        else
+        {
+            MXS_ERROR("qlafilter: Failed to start the query log writer thread.");
+            error = true;
+        }
+    }
+
+    if (error)
+    {
+        qla_writer_free(writer);
+        writer = NULL;
+    }
+
+    return writer;
+}
+
+void qla_writer_free(QLA_WRITER *writer)
+{
+    if (writer)
+    {
+        if (writer->running)
+        {
+            qla_writer_flush(writer);
+
+            pthread_mutex_lock(&writer->queue_lock);
+            writer->stop = true;
+            pthread_cond_signal(&writer->queue_cond);
+            pthread_mutex_unlock(&writer->queue_lock);
+
+            thread_wait(writer->thread);
+        }
+
+        for (int i = 0; writer->buffers && i < writer->n_buffers; i++)
+        {
+            MXS_FREE(writer->buffers[i].block);
+        }
+
+        while (writer->free_blocks)
+        {
+            QLA_BLOCK *block = writer->free_blocks;
+            writer->free_blocks = block->next;
+            MXS_FREE(block);
+        }
+
+        if (writer->fd != -1)
+        {
+            close(writer->fd);
+        }
+
+        qla_zstream_free((z_stream*)writer->zstream);
+        pthread_cond_destroy(&writer->idle_cond);
+        pthread_cond_destroy(&writer->queue_cond);
+        pthread_mutex_destroy(&writer->queue_lock);
+        MXS_FREE(writer->zdata);
+        MXS_FREE(writer->buffers);
+        MXS_FREE(writer->filename);
+        MXS_FREE(writer->filebase);
+        MXS_FREE(writer);
+    }
+}
+
+bool qla_writer_add(QLA_WRITER *writer, const QLA_RECORD *record)
+{
+    size_t len = qla_record_len(record);
+
+    if (record->user_len > UINT16_MAX || record->host_len > UINT16_MAX ||
+        record->server_len > UINT16_MAX || len > QLA_BUFFER_SIZE)
+    {
+        /** A query that doesn't fit into a buffer is logged truncated */
+        QLA_RECORD truncated = *record;
+        truncated.user_len = MIN(record->user_len, 256);
+        truncated.host_len = MIN(record->host_len, 256);
+        truncated.server_len = MIN(record->server_len, 256);
+        truncated.sql_len = QLA_BUFFER_SIZE - qla_record_len(&truncated) + truncated.sql_len;
+        return qla_writer_add(writer, &truncated);
+    }
+
+    if (qla_thread_slot == -1)
+    {
+        qla_thread_slot = atomic_add(&qla_thread_count, 1);
+    }
+
+    QLA_BUFFER *buffer = &writer->buffers[qla_thread_slot % writer->n_buffers];
+
+    spinlock_acquire(&buffer->lock);
+
+    if (buffer->block->used + len > QLA_BUFFER_SIZE)
+    {
+        qla_buffer_flush(writer, buffer);
+    }
+
+    QLA_BLOCK *block = buffer->block;
+    qla_record_encode(record, block->data + block->used);
+    block->used += len;
+    block->n_records++;
+
+    spinlock_release(&buffer->lock);
+
+    return true;
+}
+
+void qla_writer_flush(QLA_WRITER *writer)
+{
+    for (int i = 0; i < writer->n_buffers; i++)
+    {
+        QLA_BUFFER *buffer = &writer->buffers[i];
+
+        spinlock_acquire(&buffer->lock);
+        qla_buffer_flush(writer, buffer);
+        spinlock_release(&buffer->lock);
+    }
+}
+
+void qla_writer_wait(QLA_WRITER *writer)
+{
+    pthread_mutex_lock(&writer->queue_lock);
+
+    while (writer->running && !writer->stop && (writer->queue_head || writer->writing))
+    {
+        pthread_cond_wait(&writer->idle_cond, &writer->queue_lock);
+    }
+
+    pthread_mutex_unlock(&writer->queue_lock);
+}
+
+QLA_READER *qla_reader_open(const char *filename)
+{
+    QLA_READER *reader = (QLA_READER*)MXS_CALLOC(1, sizeof(QLA_READER));
+
+    if (reader)
+    {
+        gzFile file = gzopen(filename, "rb");
+        char magic[QLA_LOG_MAGIC_LEN];
+
+        if (file == NULL ||
+            gzread(file, magic, QLA_LOG_MAGIC_LEN) != QLA_LOG_MAGIC_LEN ||
+            memcmp(magic, QLA_LOG_MAGIC, QLA_LOG_MAGIC_LEN) != 0)
+        {
+            if (file)
+            {
+                gzclose(file);
+            }
+            MXS_FREE(reader);
+            reader = NULL;
+        }
+        else
+        {
+            reader->file = file;
+        }
+    }
+
+    return reader;
+}
+
+int qla_reader_next(QLA_READER *reader, QLA_RECORD *record)
+{
+    uint8_t header[QLA_RECORD_HEADER_LEN];
+    int n = gzread((gzFile)reader->file, header, sizeof(header));
+
+    if (n == 0)
+    {
+        return 0;
+    }
+    else if (n != sizeof(header))
+    {
+        return -1;
+    }
+
+    size_t len = get_le(header, 4) + 4;
+
+    if (len < QLA_RECORD_HEADER_LEN)
+    {
+        return -1;
+    }
+
+    if (len > reader->size)
+    {
+        uint8_t *data = (uint8_t*)MXS_REALLOC(reader->data, len);
+
+        if (data == NULL)
+        {
+            return -1;
+        }
+
+        reader->data = data;
+        reader->size = len;
+    }
+
+    memcpy(reader->data, header, sizeof(header));
+    size_t rest = len - sizeof(header);
+
+    if (rest > 0 && gzread((gzFile)reader->file, reader->data + sizeof(header), rest) != (int)rest)
+    {
+        return -1;
+    }
+
+    return qla_record_decode(reader->data, len, record) > 0 ? 1 : -1;
+}
+
+void qla_reader_close(QLA_READER *reader)
+{
+    if (reader)
+    {
+        gzclose((gzFile)reader->file);
+        MXS_FREE(reader->data);
+        MXS_FREE(reader);
+    }
+}
@@ -0,0 +1,263 @@
+#ifndef _MAXSCALE_FILTER_QLAFILTER_QLALOG_H
+#define _MAXSCALE_FILTER_QLAFILTER_QLALOG_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file qlalog.h The binary query log of the QLA filter
+ *
+ * A binary query log file starts with the eight bytes of QLA_LOG_MAGIC,
+ * which is followed by the records of the queries. A record is
+ *
+ *   4 bytes  Length of the rest of the record
+ *   8 bytes  Time when the query was received, in microseconds since the epoch
+ *   8 bytes  Session id
+ *   8 bytes  Hash of the digest of the query, see modutil_get_digest()
+ *   4 bytes  Response time in microseconds or QLA_NO_RESPONSE
+ *   2 bytes  Length of the user name
+ *   2 bytes  Length of the client host
+ *   2 bytes  Length of the server name, zero if the server is not known
+ *   4 bytes  Length of the query
+ *   The user name, client host, server name and query, not null terminated
+ *
+ * All integers are little-endian. A compressed file is a sequence of gzip
+ * members that together decompress to the same content, so gzip -d and
+ * zcat can be used on it.
+ *
+ * The records are collected into a buffer of each thread. Full buffers are
+ * handed to a writer thread that compresses and writes them, so the worker
+ * threads never wait for the file. The buffers are written as whole, so the
+ * records of different threads are not in time order in the file.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <skygw_debug.h>
+
+EXTERN_C_BLOCK_BEGIN
+
+/** The first bytes of a binary query log file, the last two are the version */
+#define QLA_LOG_MAGIC       "MXSQLA01"
+#define QLA_LOG_MAGIC_LEN   8
+
+/** The response time of a query that got no reply */
+#define QLA_NO_RESPONSE     UINT32_MAX
+
+/** Length of a record without the strings */
+#define QLA_RECORD_HEADER_LEN 42
+
+/** Size of the buffer of a thread */
+#define QLA_BUFFER_SIZE     (64 * 1024)
+
+/** Maximum number of full buffers waiting for the writer thread */
+#define QLA_MAX_QUEUED      256
+
+/**
+ * A query of the log. The strings are not null terminated.
+ */
+typedef struct qla_record
+{
+    uint64_t    time_us;     /*< Time when the query was received */
+    uint64_t    session_id;  /*< The session of the query */
+    uint64_t    hash;        /*< Hash of the digest of the query */
+    uint32_t    response_us; /*< Response time or QLA_NO_RESPONSE */
+    const char  *user;
+    size_t      user_len;
+    const char  *host;
+    size_t      host_len;
+    const char  *server;     /*< The server that replied, may be NULL if server_len is 0 */
+    size_t      server_len;
+    const char  *sql;
+    size_t      sql_len;
+} QLA_RECORD;
+
+/**
+ * A block of encoded records
+ */
+typedef struct qla_block
+{
+    struct qla_block *next;
+    size_t      used;
+    int         n_records;  /*< Number of records in the block */
+    uint8_t     data[QLA_BUFFER_SIZE];
+} QLA_BLOCK;
+
+/**
+ * The buffer of a thread
+ */
+typedef struct qla_buffer
+{
+    SPINLOCK    lock;
+    QLA_BLOCK   *block;     /*< The block the records are added to */
+} QLA_BUFFER;
+
+/**
+ * A writer of binary query log files
+ */
+typedef struct qla_writer
+{
+    char        *filebase;     /*< The base of the file names */
+    bool        compress;      /*< Whether the files are gzip compressed */
+    size_t      rotate_size;   /*< Size after which a new file is started, 0 for none */
+    int         rotate_time;   /*< Seconds after which a new file is started, 0 for none */
+    SPINLOCK    file_lock;     /*< Protects the file name and the statistics */
+    int         fd;            /*< The current file, -1 if it could not be opened */
+    char        *filename;     /*< Name of the current file */
+    size_t      file_size;     /*< Bytes written to the current file */
+    bool        file_empty;    /*< Whether the current file has only the header */
+    time_t      file_opened;   /*< When the current file was opened */
+    int         file_seq;      /*< Sequence number of the file */
+    int         n_buffers;
+    QLA_BUFFER  *buffers;      /*< One for each worker thread */
+    void        *zstream;      /*< Compression state, NULL if not compressed */
+    uint8_t     *zdata;        /*< The compressed records */
+    size_t      zsize;
+    THREAD      thread;        /*< The writer thread */
+    bool        running;       /*< Whether the writer thread was started */
+    pthread_mutex_t queue_lock; /*< Protects the queue and the free blocks */
+    pthread_cond_t queue_cond; /*< Signaled when a block is queued */
+    pthread_cond_t idle_cond;  /*< Signaled when the queue has been written */
+    QLA_BLOCK   *queue_head;   /*< Full blocks waiting to be written */
+    QLA_BLOCK   *queue_tail;
+    int         n_queued;
+    QLA_BLOCK   *free_blocks;  /*< Written blocks for reuse */
+    bool        writing;       /*< Whether the writer thread is writing a block */
+    bool        stop;          /*< Tells the writer thread to stop once the queue is empty */
+    uint64_t    n_dropped;     /*< Records dropped because too many blocks were queued */
+    uint64_t    n_records;     /*< Number of records written */
+    uint64_t    n_bytes;       /*< Number of bytes written */
+    int         n_files;       /*< Number of files opened */
+    int         n_errors;      /*< Number of failed writes */
+} QLA_WRITER;
+
+/**
+ * A reader of a binary query log file
+ */
+typedef struct qla_reader
+{
+    void        *file;         /*< The gzFile of the log */
+    uint8_t     *data;         /*< The current record */
+    size_t      size;
+} QLA_READER;
+
+/**
+ * Length of an encoded record
+ *
+ * @param record The record
+ * @return Length of the record in the file
+ */
+size_t qla_record_len(const QLA_RECORD *record);
+
+/**
+ * Encode a record
+ *
+ * @param record The record
+ * @param dest   Where the record is encoded, qla_record_len() bytes
+ */
+void qla_record_encode(const QLA_RECORD *record, uint8_t *dest);
+
+/**
+ * Decode a record
+ *
+ * @param data   The encoded record
+ * @param len    Length of the data
+ * @param record The record to fill, the strings point into @c data
+ * @return Length of the record, 0 if @c data does not contain the whole record
+ *         or -1 if the record is malformed
+ */
+int qla_record_decode(const uint8_t *data, size_t len, QLA_RECORD *record);
+
+/**
+ * Create a writer, open its first file and start its writer thread
+ *
+ * The files are named <filebase>.<date>-<time>.<sequence>.qlb, with .gz
+ * appended if the files are compressed. The sequence is zero padded so that
+ * the files of a writer sort in the order they were written.
+ *
+ * @param filebase    The base of the file names
+ * @param n_buffers   Number of thread buffers, normally the number of worker threads
+ * @param compress    Whether the files are gzip compressed
+ * @param rotate_size The size after which a new file is started, 0 for none
+ * @param rotate_time Seconds after which a new file is started, 0 for none
+ * @return New writer or NULL if the file could not be opened or memory
+ *         allocation failed
+ */
+QLA_WRITER *qla_writer_alloc(const char *filebase, int n_buffers, bool compress,
+                             size_t rotate_size, int rotate_time);
+
+/**
+ * Write the buffered records, stop the writer thread and free the writer
+ *
+ * @param writer The writer
+ */
+void qla_writer_free(QLA_WRITER *writer);
+
+/**
+ * Add a record to the buffer of the calling thread. The buffer is handed to
+ * the writer thread when it gets full.
+ *
+ * @param writer The writer
+ * @param record The record
+ * @return True if the record was added
+ */
+bool qla_writer_add(QLA_WRITER *writer, const QLA_RECORD *record);
+
+/**
+ * Hand the buffers of all threads to the writer thread. This should be called
+ * periodically so that the records of idle threads get written.
+ *
+ * @param writer The writer
+ */
+void qla_writer_flush(QLA_WRITER *writer);
+
+/**
+ * Wait until the writer thread has written the buffers handed to it
+ *
+ * @param writer The writer
+ */
+void qla_writer_wait(QLA_WRITER *writer);
+
+/**
+ * Open a binary query log file, compressed or not
+ *
+ * @param filename The file
+ * @return New reader or NULL if the file could not be opened or is not
+ *         a binary query log
+ */
+QLA_READER *qla_reader_open(const char *filename);
+
+/**
+ * Read the next record
+ *
+ * @param reader The reader
+ * @param record The record to fill, valid until the next call
+ * @return 1 if a record was read, 0 at the end of the file and -1 if the
+ *         file is truncated or malformed
+ */
+int qla_reader_next(QLA_READER *reader, QLA_RECORD *record);
+
+/**
+ * Close a reader
+ *
+ * @param reader The reader
+ */
+void qla_reader_close(QLA_READER *reader);
+
+EXTERN_C_BLOCK_END
+
+#endif
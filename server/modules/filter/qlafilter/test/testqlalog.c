@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testqlalog.c Tests of the binary query log of the QLA filter
+ */
+
+// To ensure that ss_info_assert asserts also when building in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <maxscale/alloc.h>
+#include "../qlalog.h"
+
+#define N_THREADS 4
+#define N_RECORDS 5000
+
+typedef struct
+{
+    QLA_WRITER *writer;
+    int         id;
+} test_thread_t;
+
+static void make_record(QLA_RECORD *record, char *sql, int thread, int i)
+{
+    sprintf(sql, "SELECT %d FROM t%d", i, thread);
+    record->time_us = i;
+    record->session_id = thread;
+    record->hash = (uint64_t)thread << 32 | i;
+    record->response_us = i % 10 ? i : QLA_NO_RESPONSE;
+    record->user = "maxuser";
+    record->user_len = strlen(record->user);
+    record->host = "127.0.0.1";
+    record->host_len = strlen(record->host);
+    record->server = i % 10 ? "server1" : NULL;
+    record->server_len = i % 10 ? strlen(record->server) : 0;
+    record->sql = sql;
+    record->sql_len = strlen(sql);
+}
+
+static void *thr_add(void *data)
+{
+    test_thread_t *thr = (test_thread_t*)data;
+    char sql[100];
+
+    for (int i = 0; i < N_RECORDS; i++)
+    {
+        QLA_RECORD record;
+        make_record(&record, sql, thr->id, i);
+        ss_info_dassert(qla_writer_add(thr->writer, &record), "Adding a record should succeed");
+
+        if (i % 1000 == 0)
+        {
+            qla_writer_flush(thr->writer);
+        }
+    }
+
+    return NULL;
+}
+
+static int test_record()
+{
+    char sql[100];
+    uint8_t data[200];
+    QLA_RECORD record, decoded;
+
+    make_record(&record, sql, 1, 123);
+    size_t len = qla_record_len(&record);
+    ss_info_dassert(len == QLA_RECORD_HEADER_LEN + 7 + 9 + 7 + strlen(sql), "Wrong record length");
+
+    qla_record_encode(&record, data);
+    ss_info_dassert(qla_record_decode(data, len, &decoded) == (int)len, "Decoding should succeed");
+    ss_info_dassert(decoded.time_us == 123 && decoded.session_id == 1 &&
+                    decoded.hash == record.hash && decoded.response_us == 123,
+                    "Decoded numbers should match");
+    ss_info_dassert(decoded.server_len == 7 && memcmp(decoded.server, "server1", 7) == 0 &&
+                    decoded.sql_len == strlen(sql) && memcmp(decoded.sql, sql, strlen(sql)) == 0,
+                    "Decoded strings should match");
+    ss_info_dassert(qla_record_decode(data, len - 1, &decoded) == 0,
+                    "A partial record should not be decoded");
+
+    data[0] = 1;
+    ss_info_dassert(qla_record_decode(data, len, &decoded) == -1,
+                    "A record with a bad length should be malformed");
+
+    return 0;
+}
+
+/**
+ * Write records from several threads and read all the files back
+ */
+static int test_writer(bool compress, size_t rotate_size)
+{
+    char dir[] = "/tmp/testqlalog.XXXXXX";
+    ss_info_dassert(mkdtemp(dir), "Creating a directory should succeed");
+
+    char filebase[sizeof(dir) + 10];
+    sprintf(filebase, "%s/qla", dir);
+
+    QLA_WRITER *writer = qla_writer_alloc(filebase, N_THREADS, compress, rotate_size, 0);
+    ss_info_dassert(writer, "Creating a writer should succeed");
+
+    pthread_t threads[N_THREADS];
+    test_thread_t thr[N_THREADS];
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        thr[i].writer = writer;
+        thr[i].id = i;
+        pthread_create(&threads[i], NULL, thr_add, &thr[i]);
+    }
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    qla_writer_flush(writer);
+    qla_writer_wait(writer);
+
+    int n_files = writer->n_files;
+    ss_info_dassert(writer->n_dropped == 0, "Records should not be dropped");
+    ss_info_dassert(writer->n_errors == 0, "Writes should succeed");
+    qla_writer_free(writer);
+
+    if (rotate_size)
+    {
+        ss_info_dassert(n_files > 1, "Files should be rotated");
+    }
+
+    int next[N_THREADS] = {0};
+    int total = 0;
+    int files = 0;
+    struct dirent **names;
+    int n_names = scandir(dir, &names, NULL, alphasort);
+
+    for (int n = 0; n < n_names; n++)
+    {
+        if (names[n]->d_name[0] == '.')
+        {
+            free(names[n]);
+            continue;
+        }
+
+        char path[sizeof(dir) + 256];
+        sprintf(path, "%s/%s", dir, names[n]->d_name);
+        free(names[n]);
+        ss_info_dassert(strstr(path, compress ? ".qlb.gz" : ".qlb") != NULL,
+                        "File should have the right suffix");
+
+        QLA_READER *reader = qla_reader_open(path);
+        ss_info_dassert(reader, "Opening the file should succeed");
+
+        QLA_RECORD record;
+        int rc;
+
+        while ((rc = qla_reader_next(reader, &record)) == 1)
+        {
+            char sql[100];
+            QLA_RECORD expected;
+            int id = record.session_id;
+
+            ss_info_dassert(id >= 0 && id < N_THREADS, "Session should be valid");
+            make_record(&expected, sql, id, next[id]);
+            ss_info_dassert(record.time_us == expected.time_us,
+                            "Records of a thread should be in order");
+            ss_info_dassert(record.sql_len == expected.sql_len &&
+                            memcmp(record.sql, sql, expected.sql_len) == 0,
+                            "Query should match");
+            ss_info_dassert(record.response_us == expected.response_us &&
+                            record.server_len == expected.server_len,
+                            "Response should match");
+            next[id]++;
+            total++;
+        }
+
+        ss_info_dassert(rc == 0, "File should not be malformed");
+        qla_reader_close(reader);
+        unlink(path);
+        files++;
+    }
+
+    free(names);
+    rmdir(dir);
+
+    ss_info_dassert(files == n_files, "All opened files should exist");
+    ss_info_dassert(total == N_THREADS * N_RECORDS, "All records should be read back");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rval = 0;
+
+    rval += test_record();
+    rval += test_writer(false, 0);
+    rval += test_writer(false, 100000);
+    rval += test_writer(true, 0);
+    rval += test_writer(true, 20000);
+
+    return rval;
+}
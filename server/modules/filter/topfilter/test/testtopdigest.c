@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testtopdigest.c Tests of the statement digests of the top filter
+ */
+
+// To ensure that ss_info_assert asserts also when building in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <maxscale/alloc.h>
+#include "../topdigest.h"
+
+#define N_THREADS 4
+#define N_DIGESTS 10
+#define N_ADDS    10000
+
+static TOPN_DIGESTS *digests;
+
+static void *thr_add(void *data)
+{
+    char sql[100];
+
+    for (int i = 0; i < N_ADDS; i++)
+    {
+        int d = i % N_DIGESTS;
+        sprintf(sql, "SELECT ? FROM t%d", d);
+        topn_digests_add(digests, d + 1, sql, (d + 1) * 1000, 2);
+    }
+
+    return NULL;
+}
+
+/**
+ * Add from more threads than there are shards of their own
+ */
+static int test_threads()
+{
+    digests = topn_digests_alloc(N_THREADS - 1, 100);
+    ss_info_dassert(digests, "Allocating the table should succeed");
+
+    pthread_t threads[N_THREADS];
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, thr_add, NULL);
+    }
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    int n;
+    TOPN_DIGEST *top = topn_digests_get(digests, &n);
+    ss_info_dassert(top && n == N_DIGESTS, "All digests should be returned");
+
+    for (int i = 0; i < n; i++)
+    {
+        /** The longest statements are first */
+        int d = N_DIGESTS - 1 - i;
+        char sql[100];
+        sprintf(sql, "SELECT ? FROM t%d", d);
+        uint64_t count = N_THREADS * N_ADDS / N_DIGESTS;
+
+        ss_info_dassert(top[i].hash == (uint64_t)d + 1 && strcmp(top[i].sql, sql) == 0,
+                        "Digests should be sorted by total time");
+        ss_info_dassert(top[i].count == count && top[i].rows == 2 * count,
+                        "Counts should be merged");
+        ss_info_dassert(top[i].total_us == count * (d + 1) * 1000 &&
+                        top[i].min_us == (uint64_t)(d + 1) * 1000 &&
+                        top[i].max_us == (uint64_t)(d + 1) * 1000,
+                        "Times should be merged");
+        ss_info_dassert(top[i].histogram[topn_histogram_bucket((d + 1) * 1000)] == count,
+                        "Histogram should be merged");
+    }
+
+    MXS_FREE(top);
+    topn_digests_free(digests);
+
+    return 0;
+}
+
+static int test_overflow()
+{
+    TOPN_DIGESTS *d = topn_digests_alloc(1, 2);
+    ss_info_dassert(d, "Allocating the table should succeed");
+
+    topn_digests_add(d, 1, "a", 10, 0);
+    topn_digests_add(d, 2, "b", 20, 0);
+    topn_digests_add(d, 3, "c", 5000, 0);
+    topn_digests_add(d, 4, "d", 7000, 0);
+    topn_digests_add(d, 1, "a", 30, 1);
+
+    int n;
+    TOPN_DIGEST *top = topn_digests_get(d, &n);
+    ss_info_dassert(top && n == 3, "Two digests and the rest should be returned");
+    ss_info_dassert(top[0].hash == 0 && strcmp(top[0].sql, "(other)") == 0 &&
+                    top[0].count == 2 && top[0].total_us == 12000,
+                    "The digests that did not fit should be combined");
+    ss_info_dassert(top[1].hash == 1 && top[1].count == 2 && top[1].min_us == 10 &&
+                    top[1].max_us == 30 && top[1].rows == 1,
+                    "Existing digests should still be updated");
+    MXS_FREE(top);
+
+    topn_digests_reset(d);
+    top = topn_digests_get(d, &n);
+    ss_info_dassert(top == NULL && n == 0, "A reset should clear the table");
+
+    topn_digests_add(d, 5, "e", 10, 0);
+    top = topn_digests_get(d, &n);
+    ss_info_dassert(top && n == 1 && top[0].hash == 5 && top[0].count == 1,
+                    "Only digests added after the reset should be returned");
+    MXS_FREE(top);
+    topn_digests_free(d);
+
+    ss_info_dassert(topn_histogram_bucket(99) == 0 && topn_histogram_bucket(100) == 1 &&
+                    topn_histogram_bucket(20000000) == TOPN_HISTOGRAM_SIZE - 1,
+                    "Times should map to the right buckets");
+
+    return 0;
+}
+
+/**
+ * Feed a reply to the parser one byte at a time
+ *
+ * @return True if the reply was complete after the last byte and not before
+ */
+static bool process_bytes(TOPN_REPLY *reply, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        GWBUF *buf = gwbuf_alloc_and_load(1, (void*)(data + i));
+        bool done = topn_reply_process(reply, buf);
+        gwbuf_free(buf);
+
+        if (done)
+        {
+            return i == len - 1;
+        }
+    }
+
+    return false;
+}
+
+static int test_reply()
+{
+    static const uint8_t ok[] = {7, 0, 0, 1, 0x00, 0, 0, 2, 0, 0, 0};
+    static const uint8_t ok_more[] = {7, 0, 0, 1, 0x00, 0, 0, 0x0a, 0, 0, 0};
+    static const uint8_t err[] = {9, 0, 0, 1, 0xff, 0x15, 0x04, '#', '2', '8', '0', '0', '0'};
+    static const uint8_t resultset[] =
+    {
+        1, 0, 0, 1, 1,                              // One column
+        5, 0, 0, 2, 3, 'd', 'e', 'f', 0,            // Column definition
+        5, 0, 0, 3, 0xfe, 0, 0, 2, 0,               // EOF
+        2, 0, 0, 4, 1, 'a',                         // Row
+        2, 0, 0, 5, 1, 'b',                         // Row
+        5, 0, 0, 6, 0xfe, 0, 0, 2, 0                // EOF
+    };
+    TOPN_REPLY reply;
+
+    topn_reply_init(&reply);
+    ss_info_dassert(process_bytes(&reply, ok, sizeof(ok)), "OK should end the reply");
+
+    topn_reply_init(&reply);
+    ss_info_dassert(process_bytes(&reply, err, sizeof(err)), "ERR should end the reply");
+
+    topn_reply_init(&reply);
+    ss_info_dassert(process_bytes(&reply, resultset, sizeof(resultset)),
+                    "The last EOF should end the reply");
+    ss_info_dassert(reply.rows == 2, "Rows should be counted");
+
+    /** An OK with more results followed by a result set in one buffer */
+    uint8_t multi[sizeof(ok_more) + sizeof(resultset)];
+    memcpy(multi, ok_more, sizeof(ok_more));
+    memcpy(multi + sizeof(ok_more), resultset, sizeof(resultset));
+
+    topn_reply_init(&reply);
+    GWBUF *buf = gwbuf_alloc_and_load(sizeof(ok_more), multi);
+    ss_info_dassert(!topn_reply_process(&reply, buf), "More results should follow the OK");
+    gwbuf_free(buf);
+    buf = gwbuf_alloc_and_load(sizeof(resultset), multi + sizeof(ok_more));
+    ss_info_dassert(topn_reply_process(&reply, buf), "The result set should end the reply");
+    ss_info_dassert(reply.rows == 2, "Rows should be counted");
+    gwbuf_free(buf);
+
+    topn_reply_init(&reply);
+    ss_info_dassert(process_bytes(&reply, multi, sizeof(multi)),
+                    "Split multi-results should end after the result set");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rval = 0;
+
+    rval += test_threads();
+    rval += test_overflow();
+    rval += test_reply();
+
+    return rval;
+}
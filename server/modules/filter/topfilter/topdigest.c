@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file topdigest.c The statement digest table of the top filter
+ */
+
+#include "topdigest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <atomic.h>
+#include <platform.h>
+#include <skygw_utils.h>
+#include <maxscale/alloc.h>
+
+/** The shard of the calling thread, -1 if not yet assigned */
+static thread_local int topn_thread_slot = -1;
+
+/** Number of threads that have been assigned a shard */
+static int topn_thread_count = 0;
+
+/** The upper limits of the histogram buckets, the last bucket has no limit */
+static const uint64_t topn_histogram_limits[TOPN_HISTOGRAM_SIZE - 1] =
+{
+    100, 1000, 10000, 100000, 1000000, 10000000
+};
+
+static const char *topn_histogram_names[TOPN_HISTOGRAM_SIZE] =
+{
+    "<100us", "<1ms", "<10ms", "<100ms", "<1s", "<10s", ">=10s"
+};
+
+int topn_histogram_bucket(uint64_t time_us)
+{
+    int i = 0;
+
+    while (i < TOPN_HISTOGRAM_SIZE - 1 && time_us >= topn_histogram_limits[i])
+    {
+        i++;
+    }
+
+    return i;
+}
+
+const char *topn_histogram_name(int bucket)
+{
+    return topn_histogram_names[bucket];
+}
+
+TOPN_DIGESTS *topn_digests_alloc(int n_threads, int max_digests)
+{
+    TOPN_DIGESTS *digests = (TOPN_DIGESTS*)MXS_CALLOC(1, sizeof(TOPN_DIGESTS));
+
+    if (digests)
+    {
+        digests->max_digests = max_digests > 0 ? max_digests : 1;
+        digests->n_shards = (n_threads > 0 ? n_threads : 1) + 1;
+
+        /** Twice the number of digests keeps the probe sequences short */
+        digests->size = 1;
+        while (digests->size < 2 * digests->max_digests)
+        {
+            digests->size *= 2;
+        }
+
+        if ((digests->shards = (TOPN_SHARD*)MXS_CALLOC(digests->n_shards,
+                                                       sizeof(TOPN_SHARD))) == NULL)
+        {
+            MXS_FREE(digests);
+            return NULL;
+        }
+
+        for (int i = 0; i < digests->n_shards; i++)
+        {
+            spinlock_init(&digests->shards[i].lock);
+        }
+    }
+
+    return digests;
+}
+
+void topn_digests_free(TOPN_DIGESTS *digests)
+{
+    if (digests)
+    {
+        for (int i = 0; i < digests->n_shards; i++)
+        {
+            MXS_FREE(digests->shards[i].digests);
+        }
+
+        MXS_FREE(digests->shards);
+        MXS_FREE(digests);
+    }
+}
+
+/**
+ * Clear a shard. Only the thread that adds to the shard may call this.
+ */
+static void topn_shard_clear(TOPN_DIGESTS *digests, TOPN_SHARD *shard)
+{
+    if (shard->digests)
+    {
+        memset(shard->digests, 0, digests->size * sizeof(TOPN_DIGEST));
+    }
+
+    memset(&shard->other, 0, sizeof(shard->other));
+    shard->n_digests = 0;
+}
+
+/**
+ * Find the digest of a statement in a shard, adding it if it is new. If the
+ * shard is full, the statistics of the statements that did not fit are used.
+ */
+static TOPN_DIGEST *topn_shard_find(TOPN_DIGESTS *digests, TOPN_SHARD *shard,
+                                    uint64_t hash, const char *sql)
+{
+    if (shard->digests == NULL)
+    {
+        TOPN_DIGEST *table = (TOPN_DIGEST*)MXS_CALLOC(digests->size, sizeof(TOPN_DIGEST));
+
+        if (table == NULL)
+        {
+            return &shard->other;
+        }
+
+        /** The table must be cleared before readers can see it */
+        __sync_synchronize();
+        shard->digests = table;
+    }
+
+    /** Zero marks an empty slot */
+    if (hash == 0)
+    {
+        hash = 1;
+    }
+
+    size_t mask = digests->size - 1;
+    size_t i = hash & mask;
+
+    while (shard->digests[i].hash)
+    {
+        if (shard->digests[i].hash == hash)
+        {
+            return &shard->digests[i];
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    if (shard->n_digests >= digests->max_digests)
+    {
+        return &shard->other;
+    }
+
+    TOPN_DIGEST *digest = &shard->digests[i];
+    strncpy(digest->sql, sql, TOPN_DIGEST_LEN - 1);
+    shard->n_digests++;
+
+    /** The digest must be written before the slot is seen as used */
+    __sync_synchronize();
+    digest->hash = hash;
+
+    return digest;
+}
+
+static void topn_shard_add(TOPN_DIGESTS *digests, TOPN_SHARD *shard, uint64_t hash,
+                           const char *sql, uint64_t time_us, uint64_t rows)
+{
+    int generation = digests->generation;
+
+    if (shard->generation != generation)
+    {
+        topn_shard_clear(digests, shard);
+        __sync_synchronize();
+        shard->generation = generation;
+    }
+
+    TOPN_DIGEST *digest = topn_shard_find(digests, shard, hash, sql);
+
+    if (digest->count == 0 || time_us < digest->min_us)
+    {
+        digest->min_us = time_us;
+    }
+
+    if (time_us > digest->max_us)
+    {
+        digest->max_us = time_us;
+    }
+
+    digest->total_us += time_us;
+    digest->rows += rows;
+    digest->histogram[topn_histogram_bucket(time_us)]++;
+    digest->count++;
+}
+
+void topn_digests_add(TOPN_DIGESTS *digests, uint64_t hash, const char *sql,
+                      uint64_t time_us, uint64_t rows)
+{
+    if (topn_thread_slot == -1)
+    {
+        topn_thread_slot = atomic_add(&topn_thread_count, 1);
+    }
+
+    int shared = digests->n_shards - 1;
+
+    if (topn_thread_slot < shared)
+    {
+        topn_shard_add(digests, &digests->shards[topn_thread_slot], hash, sql, time_us, rows);
+    }
+    else
+    {
+        TOPN_SHARD *shard = &digests->shards[shared];
+        spinlock_acquire(&shard->lock);
+        topn_shard_add(digests, shard, hash, sql, time_us, rows);
+        spinlock_release(&shard->lock);
+    }
+}
+
+void topn_digests_reset(TOPN_DIGESTS *digests)
+{
+    TOPN_SHARD *shard = &digests->shards[digests->n_shards - 1];
+
+    spinlock_acquire(&shard->lock);
+    int generation = atomic_add(&digests->generation, 1) + 1;
+    topn_shard_clear(digests, shard);
+    shard->generation = generation;
+    spinlock_release(&shard->lock);
+}
+
+/**
+ * Copy a digest for merging, skipping the ones that haven't been used yet
+ */
+static int topn_digest_copy(TOPN_DIGEST *dest, const TOPN_DIGEST *src, uint64_t hash)
+{
+    if (src->count == 0)
+    {
+        return 0;
+    }
+
+    *dest = *src;
+    dest->hash = hash;
+    dest->sql[TOPN_DIGEST_LEN - 1] = '\0';
+
+    if (hash == 0)
+    {
+        strcpy(dest->sql, "(other)");
+    }
+
+    return 1;
+}
+
+/**
+ * Copy the digests of a shard
+ *
+ * @return Number of copied digests
+ */
+static int topn_shard_copy(TOPN_DIGESTS *digests, TOPN_SHARD *shard,
+                           int generation, TOPN_DIGEST *dest)
+{
+    int n = 0;
+
+    if (shard->generation == generation)
+    {
+        /** The contents must be read only after the generation */
+        __sync_synchronize();
+        TOPN_DIGEST *table = shard->digests;
+
+        for (int i = 0; table && i < digests->size; i++)
+        {
+            uint64_t hash = table[i].hash;
+
+            if (hash)
+            {
+                __sync_synchronize();
+                n += topn_digest_copy(&dest[n], &table[i], hash);
+            }
+        }
+
+        n += topn_digest_copy(&dest[n], &shard->other, 0);
+
+        /** The owner started to clear the shard while it was being read */
+        __sync_synchronize();
+        if (shard->generation != generation)
+        {
+            n = 0;
+        }
+    }
+
+    return n;
+}
+
+static int topn_cmp_hash(const void *va, const void *vb)
+{
+    const TOPN_DIGEST *a = (const TOPN_DIGEST*)va;
+    const TOPN_DIGEST *b = (const TOPN_DIGEST*)vb;
+
+    return a->hash < b->hash ? -1 : a->hash > b->hash ? 1 : 0;
+}
+
+static int topn_cmp_total(const void *va, const void *vb)
+{
+    const TOPN_DIGEST *a = (const TOPN_DIGEST*)va;
+    const TOPN_DIGEST *b = (const TOPN_DIGEST*)vb;
+
+    return a->total_us > b->total_us ? -1 : a->total_us < b->total_us ? 1 : 0;
+}
+
+TOPN_DIGEST *topn_digests_get(TOPN_DIGESTS *digests, int *n)
+{
+    TOPN_DIGEST *rval = (TOPN_DIGEST*)MXS_MALLOC(digests->n_shards * (digests->max_digests + 1) *
+                                                 sizeof(TOPN_DIGEST));
+    *n = 0;
+
+    if (rval == NULL)
+    {
+        return NULL;
+    }
+
+    int generation = digests->generation;
+    int shared = digests->n_shards - 1;
+    int total = 0;
+
+    for (int i = 0; i < shared; i++)
+    {
+        total += topn_shard_copy(digests, &digests->shards[i], generation, &rval[total]);
+    }
+
+    spinlock_acquire(&digests->shards[shared].lock);
+    total += topn_shard_copy(digests, &digests->shards[shared], generation, &rval[total]);
+    spinlock_release(&digests->shards[shared].lock);
+
+    /** Merge the digests of the threads */
+    qsort(rval, total, sizeof(TOPN_DIGEST), topn_cmp_hash);
+    int merged = 0;
+
+    for (int i = 0; i < total; i++)
+    {
+        TOPN_DIGEST *dest = &rval[merged - 1];
+
+        if (merged > 0 && dest->hash == rval[i].hash)
+        {
+            dest->min_us = MIN(dest->min_us, rval[i].min_us);
+            dest->max_us = dest->max_us > rval[i].max_us ? dest->max_us : rval[i].max_us;
+            dest->total_us += rval[i].total_us;
+            dest->rows += rval[i].rows;
+            dest->count += rval[i].count;
+
+            for (int j = 0; j < TOPN_HISTOGRAM_SIZE; j++)
+            {
+                dest->histogram[j] += rval[i].histogram[j];
+            }
+        }
+        else
+        {
+            if (merged != i)
+            {
+                rval[merged] = rval[i];
+            }
+            merged++;
+        }
+    }
+
+    if (merged == 0)
+    {
+        MXS_FREE(rval);
+        return NULL;
+    }
+
+    qsort(rval, merged, sizeof(TOPN_DIGEST), topn_cmp_total);
+    *n = merged;
+
+    return rval;
+}
+
+/** The parts of a reply */
+enum
+{
+    TOPN_REPLY_FIRST,   /*< OK, ERR, LOCAL INFILE request or column count */
+    TOPN_REPLY_COLUMNS, /*< Column definitions up to an EOF */
+    TOPN_REPLY_ROWS,    /*< Rows up to an EOF or ERR */
+    TOPN_REPLY_DONE
+};
+
+/** The status flag that tells that another result follows */
+#define TOPN_MORE_RESULTS 0x0008
+
+void topn_reply_init(TOPN_REPLY *reply)
+{
+    memset(reply, 0, sizeof(*reply));
+    reply->state = TOPN_REPLY_FIRST;
+}
+
+/**
+ * Length of a length-encoded integer from its first byte
+ */
+static int topn_lenenc_len(uint8_t byte)
+{
+    return byte < 0xfb ? 1 : byte == 0xfc ? 3 : byte == 0xfd ? 4 : 9;
+}
+
+/**
+ * Handle the start of a packet collected into reply->hdr
+ *
+ * @param reply The reply state
+ * @param len   Length of the payload of the packet
+ */
+static void topn_reply_packet(TOPN_REPLY *reply, uint32_t len)
+{
+    const uint8_t *payload = reply->hdr + 4;
+    int avail = reply->hdr_len - 4;
+    bool eof = avail > 0 && payload[0] == 0xfe && len < 9;
+
+    if (avail == 0)
+    {
+        return;
+    }
+
+    switch (reply->state)
+    {
+    case TOPN_REPLY_FIRST:
+        if (payload[0] == 0x00)
+        {
+            /** OK packet, the status follows the affected rows and insert id */
+            int offset = 1;
+            offset += offset < avail ? topn_lenenc_len(payload[offset]) : avail;
+            offset += offset < avail ? topn_lenenc_len(payload[offset]) : avail;
+            int status = offset + 2 <= avail ? payload[offset] | payload[offset + 1] << 8 : 0;
+            reply->state = status & TOPN_MORE_RESULTS ? TOPN_REPLY_FIRST : TOPN_REPLY_DONE;
+        }
+        else if (payload[0] == 0xff)
+        {
+            reply->state = TOPN_REPLY_DONE;
+        }
+        else if (payload[0] != 0xfb)
+        {
+            /** The OK after the file of a LOAD DATA LOCAL INFILE is still to come for 0xfb */
+            reply->state = TOPN_REPLY_COLUMNS;
+        }
+        break;
+
+    case TOPN_REPLY_COLUMNS:
+        if (eof)
+        {
+            reply->state = TOPN_REPLY_ROWS;
+        }
+        break;
+
+    case TOPN_REPLY_ROWS:
+        if (eof)
+        {
+            int status = avail >= 5 ? payload[3] | payload[4] << 8 : 0;
+            reply->state = status & TOPN_MORE_RESULTS ? TOPN_REPLY_FIRST : TOPN_REPLY_DONE;
+        }
+        else if (payload[0] == 0xff)
+        {
+            reply->state = TOPN_REPLY_DONE;
+        }
+        else
+        {
+            reply->rows++;
+        }
+        break;
+    }
+}
+
+bool topn_reply_process(TOPN_REPLY *reply, GWBUF *buffer)
+{
+    for (; buffer && reply->state != TOPN_REPLY_DONE; buffer = buffer->next)
+    {
+        const uint8_t *ptr = (const uint8_t*)GWBUF_DATA(buffer);
+        size_t n = GWBUF_LENGTH(buffer);
+
+        while (n > 0 && reply->state != TOPN_REPLY_DONE)
+        {
+            if (reply->skip > 0)
+            {
+                size_t skip = MIN(reply->skip, n);
+                reply->skip -= skip;
+                ptr += skip;
+                n -= skip;
+                continue;
+            }
+
+            uint32_t len = 0;
+            int want = 4;
+
+            if (reply->hdr_len >= 4)
+            {
+                len = reply->hdr[0] | reply->hdr[1] << 8 | reply->hdr[2] << 16;
+                want = 4 + MIN(len, TOPN_REPLY_PEEK);
+            }
+
+            size_t copy = MIN((size_t)(want - reply->hdr_len), n);
+            memcpy(reply->hdr + reply->hdr_len, ptr, copy);
+            reply->hdr_len += copy;
+            ptr += copy;
+            n -= copy;
+
+            if (reply->hdr_len >= 4)
+            {
+                len = reply->hdr[0] | reply->hdr[1] << 8 | reply->hdr[2] << 16;
+                want = 4 + MIN(len, TOPN_REPLY_PEEK);
+
+                if (reply->hdr_len == want)
+                {
+                    /** A packet of 0xffffff bytes is continued by the next one */
+                    if (!reply->continued)
+                    {
+                        topn_reply_packet(reply, len);
+                    }
+
+                    reply->continued = len == 0xffffff;
+                    reply->skip = len - (want - 4);
+                    reply->hdr_len = 0;
+                }
+            }
+        }
+    }
+
+    return reply->state == TOPN_REPLY_DONE;
+}
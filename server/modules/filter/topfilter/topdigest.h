@@ -0,0 +1,182 @@
+#ifndef _MAXSCALE_FILTER_TOPFILTER_TOPDIGEST_H
+#define _MAXSCALE_FILTER_TOPFILTER_TOPDIGEST_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file topdigest.h The statement digest table of the top filter
+ *
+ * The statistics of the statements are collected per digest, see
+ * modutil_get_digest(). Each worker thread adds to a shard of its own
+ * without locking, threads that don't get a shard of their own share one
+ * that is protected by a spinlock. The shards are merged when the table
+ * is read.
+ *
+ * A reset only bumps the generation of the table, each thread clears its
+ * shard when it next adds to it. The shards of older generations are
+ * ignored when the table is read.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <spinlock.h>
+#include <buffer.h>
+#include <skygw_debug.h>
+
+EXTERN_C_BLOCK_BEGIN
+
+/** Length of the stored digest text, longer digests are truncated */
+#define TOPN_DIGEST_LEN     256
+
+/** Number of buckets in the latency histogram, see topn_histogram_name() */
+#define TOPN_HISTOGRAM_SIZE 7
+
+/**
+ * The statistics of one statement digest
+ */
+typedef struct topn_digest
+{
+    uint64_t    hash;                  /*< Hash of the digest, 0 for an empty slot */
+    char        sql[TOPN_DIGEST_LEN];  /*< The digest */
+    uint64_t    count;                 /*< Number of statements */
+    uint64_t    total_us;              /*< Total time of the statements */
+    uint64_t    min_us;
+    uint64_t    max_us;
+    uint64_t    rows;                  /*< Rows returned by the statements */
+    uint64_t    histogram[TOPN_HISTOGRAM_SIZE];
+} TOPN_DIGEST;
+
+/**
+ * The digests of one thread
+ */
+typedef struct topn_shard
+{
+    TOPN_DIGEST *digests;      /*< Hash table of the digests, allocated on first use */
+    int         n_digests;     /*< Number of used slots */
+    TOPN_DIGEST other;         /*< Statements that did not fit into the table */
+    int         generation;    /*< The generation of the contents */
+    SPINLOCK    lock;          /*< Only used with the shared shard */
+} TOPN_SHARD;
+
+/**
+ * The digest table of a filter instance
+ */
+typedef struct topn_digests
+{
+    int         max_digests;   /*< Maximum number of digests in a shard */
+    int         size;          /*< Size of the hash table of a shard */
+    int         n_shards;      /*< Number of shards, the last one is shared */
+    TOPN_SHARD  *shards;
+    int         generation;    /*< Incremented by a reset */
+} TOPN_DIGESTS;
+
+/**
+ * Allocate a digest table
+ *
+ * @param n_threads   Number of threads that get a shard of their own
+ * @param max_digests Maximum number of distinct digests a shard holds
+ * @return New digest table or NULL if memory allocation failed
+ */
+TOPN_DIGESTS *topn_digests_alloc(int n_threads, int max_digests);
+
+/**
+ * Free a digest table
+ *
+ * @param digests The digest table
+ */
+void topn_digests_free(TOPN_DIGESTS *digests);
+
+/**
+ * Add a statement to the shard of the calling thread
+ *
+ * @param digests The digest table
+ * @param hash    Hash of the digest
+ * @param sql     The digest, null terminated
+ * @param time_us Time of the statement in microseconds
+ * @param rows    Number of rows the statement returned
+ */
+void topn_digests_add(TOPN_DIGESTS *digests, uint64_t hash, const char *sql,
+                      uint64_t time_us, uint64_t rows);
+
+/**
+ * Get the merged statistics of all threads
+ *
+ * The statements that did not fit into the table of a thread are returned
+ * as one digest with a zero hash.
+ *
+ * @param digests The digest table
+ * @param n       Number of returned digests
+ * @return The digests sorted by total time, longest first, or NULL if there
+ *         are none or memory allocation failed. The caller must free the array.
+ */
+TOPN_DIGEST *topn_digests_get(TOPN_DIGESTS *digests, int *n);
+
+/**
+ * Clear the statistics of all threads
+ *
+ * @param digests The digest table
+ */
+void topn_digests_reset(TOPN_DIGESTS *digests);
+
+/**
+ * Get the histogram bucket of a statement time
+ *
+ * @param time_us Time in microseconds
+ * @return Index of the bucket
+ */
+int topn_histogram_bucket(uint64_t time_us);
+
+/**
+ * Get the name of a histogram bucket
+ *
+ * @param bucket Index of the bucket
+ * @return Name of the bucket, e.g. "<1ms"
+ */
+const char *topn_histogram_name(int bucket);
+
+/** How many bytes of the start of a reply packet are inspected */
+#define TOPN_REPLY_PEEK 21
+
+/**
+ * The state of a reply to a statement. The reply can arrive in any number
+ * of buffers that need not contain whole packets.
+ */
+typedef struct topn_reply
+{
+    int         state;         /*< Which part of the reply is expected next */
+    bool        continued;     /*< Whether the next packet continues a large packet */
+    uint32_t    skip;          /*< Bytes of the current packet left to skip */
+    int         hdr_len;       /*< Bytes collected into hdr */
+    uint8_t     hdr[4 + TOPN_REPLY_PEEK]; /*< Start of the current packet */
+    uint64_t    rows;          /*< Rows in the reply so far */
+} TOPN_REPLY;
+
+/**
+ * Start tracking the reply to a new statement
+ *
+ * @param reply The reply state
+ */
+void topn_reply_init(TOPN_REPLY *reply);
+
+/**
+ * Process a part of a reply
+ *
+ * @param reply  The reply state
+ * @param buffer The part of the reply
+ * @return True if the reply is complete
+ */
+bool topn_reply_process(TOPN_REPLY *reply, GWBUF *buffer);
+
+EXTERN_C_BLOCK_END
+
+#endif
@@ -26,6 +26,10 @@
  * file to which the queries are logged. A serial number is appended to this
  * name in order that each session logs to a different file.
  *
+ * The statistics of all statements are also collected per statement digest
+ * for the whole filter instance, see topdigest.h. The digests that take the
+ * most time can be seen with maxadmin and maxinfo at any time.
+ *
  * Date         Who             Description
  * 18/06/2014   Mark Riddoch    Addition of source and user filters
  *
@@ -44,7 +48,10 @@
 #include <sys/time.h>
 #include <regex.h>
 #include <atomic.h>
+#include <maxconfig.h>
+#include <resultset.h>
 #include <maxscale/alloc.h>
+#include "topdigest.h"
 
 MODULE_INFO info =
 {
@@ -54,7 +61,10 @@ MODULE_INFO info =
     "A top N query logging filter"
 };
 
-static char *version_str = "V1.0.1";
+static char *version_str = "V1.1.0";
+
+/** The default maximum number of distinct digests per thread */
+#define TOPN_DEFAULT_DIGESTS 500
 
 /*
  * The filter entry points
@@ -68,6 +78,8 @@ static void setUpstream(FILTER *instance, void *fsession, UPSTREAM *upstream);
 static int routeQuery(FILTER *instance, void *fsession, GWBUF *queue);
 static int clientReply(FILTER *instance, void *fsession, GWBUF *queue);
 static void diagnostic(FILTER *instance, void *fsession, DCB *dcb);
+static RESULTSET *statistics(FILTER *instance);
+static void resetStatistics(FILTER *instance);
 
 
 static FILTER_OBJECT MyObject =
@@ -81,6 +93,8 @@ static FILTER_OBJECT MyObject =
     routeQuery,
     clientReply,
     diagnostic,
+    statistics,
+    resetStatistics
 };
 
 /**
@@ -89,7 +103,8 @@ static FILTER_OBJECT MyObject =
  * are logged.
  *
  * To this base a session number is attached such that each session will
- * have a unique name.
+ * have a unique name. Without a filebase no per session reports are written
+ * and only the statement digests of the instance are collected.
  */
 typedef struct
 {
@@ -102,6 +117,7 @@ typedef struct
     regex_t re; /* Compiled regex text */
     char *exclude; /* Optional text to match against for exclusion */
     regex_t exre; /* Compiled regex nomatch text */
+    TOPN_DIGESTS *digests; /* The statistics of the statement digests */
 } TOPN_INSTANCE;
 
 /**
@@ -137,6 +153,11 @@ typedef struct
     struct timeval total;
     struct timeval connect;
     struct timeval disconnect;
+    bool digest_pending; /* Whether a statement is waiting for its reply */
+    struct timeval digest_start;
+    uint64_t digest_hash;
+    char digest_sql[TOPN_DIGEST_LEN];
+    TOPN_REPLY reply; /* The reply to the statement */
 } TOPN_SESSION;
 
 /**
@@ -198,6 +219,8 @@ createInstance(const char *name, char **options, FILTER_PARAMETER **params)
         my_instance->source = NULL;
         my_instance->user = NULL;
         my_instance->filebase = NULL;
+        my_instance->digests = NULL;
+        int max_digests = TOPN_DEFAULT_DIGESTS;
         bool error = false;
 
         for (int i = 0; params && params[i]; i++)
@@ -206,6 +229,10 @@ createInstance(const char *name, char **options, FILTER_PARAMETER **params)
             {
                 my_instance->topN = atoi(params[i]->value);
             }
+            else if (!strcmp(params[i]->name, "digests"))
+            {
+                max_digests = atoi(params[i]->value);
+            }
             else if (!strcmp(params[i]->name, "filebase"))
             {
                 my_instance->filebase = MXS_STRDUP_A(params[i]->value);
@@ -261,9 +288,14 @@ createInstance(const char *name, char **options, FILTER_PARAMETER **params)
             }
         }
 
-        if (my_instance->filebase == NULL)
+        if (max_digests <= 0)
+        {
+            MXS_ERROR("topfilter: The 'digests' parameter must be a positive number.");
+            error = true;
+        }
+        else if ((my_instance->digests = topn_digests_alloc(config_threadcount(),
+                                                             max_digests)) == NULL)
         {
-            MXS_ERROR("topfilter: No 'filebase' parameter defined.");
             error = true;
         }
 
@@ -303,6 +335,7 @@ createInstance(const char *name, char **options, FILTER_PARAMETER **params)
                 regfree(&my_instance->re);
                 MXS_FREE(my_instance->match);
             }
+            topn_digests_free(my_instance->digests);
             MXS_FREE(my_instance->filebase);
             MXS_FREE(my_instance->source);
             MXS_FREE(my_instance->user);
@@ -332,15 +365,14 @@ newSession(FILTER *instance, SESSION *session)
 
     if ((my_session = MXS_CALLOC(1, sizeof(TOPN_SESSION))) != NULL)
     {
-        if ((my_session->filename =
+        if (my_instance->filebase &&
+            (my_session->filename =
                  (char *) MXS_MALLOC(strlen(my_instance->filebase) + 20))
             == NULL)
         {
             MXS_FREE(my_session);
             return NULL;
         }
-        sprintf(my_session->filename, "%s.%d", my_instance->filebase,
-                my_instance->sessions);
         atomic_add(&my_instance->sessions, 1);
         my_session->top = (TOPNQ **) MXS_CALLOC(my_instance->topN + 1, sizeof(TOPNQ *));
         MXS_ABORT_IF_NULL(my_session->top);
@@ -382,8 +414,12 @@ newSession(FILTER *instance, SESSION *session)
             my_session->active = 0;
         }
 
-        sprintf(my_session->filename, "%s.%d", my_instance->filebase,
-                my_instance->sessions);
+        if (my_session->filename)
+        {
+            sprintf(my_session->filename, "%s.%d", my_instance->filebase,
+                    my_instance->sessions);
+        }
+        my_session->digest_pending = false;
         gettimeofday(&my_session->connect, NULL);
     }
 
@@ -410,7 +446,7 @@ closeSession(FILTER *instance, void *session)
 
     gettimeofday(&my_session->disconnect, NULL);
     timersub((&my_session->disconnect), &(my_session->connect), &diff);
-    if ((fp = fopen(my_session->filename, "w")) != NULL)
+    if (my_session->filename && (fp = fopen(my_session->filename, "w")) != NULL)
     {
         statements = my_session->n_statements != 0 ? my_session->n_statements : 1;
 
@@ -508,6 +544,23 @@ setUpstream(FILTER *instance, void *session, UPSTREAM *upstream)
     my_session->up = *upstream;
 }
 
+/**
+ * Start measuring a statement for the digest statistics
+ *
+ * @param my_session The filter session
+ * @param sql        The statement, need not be null terminated
+ * @param len        Length of the statement
+ */
+static void
+start_digest(TOPN_SESSION *my_session, const char *sql, int len)
+{
+    my_session->digest_hash = modutil_get_digest(sql, len, my_session->digest_sql,
+                                                 sizeof(my_session->digest_sql));
+    topn_reply_init(&my_session->reply);
+    gettimeofday(&my_session->digest_start, NULL);
+    my_session->digest_pending = true;
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
@@ -524,6 +577,7 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
     TOPN_INSTANCE *my_instance = (TOPN_INSTANCE *) instance;
     TOPN_SESSION *my_session = (TOPN_SESSION *) session;
     char *ptr;
+    int len;
 
     if (my_session->active)
     {
@@ -531,43 +585,70 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
         {
             queue = gwbuf_make_contiguous(queue);
         }
-        if ((ptr = modutil_get_SQL(queue)) != NULL)
+        if (my_instance->filebase || my_instance->match || my_instance->exclude)
         {
-            if ((my_instance->match == NULL ||
-                 regexec(&my_instance->re, ptr, 0, NULL, 0) == 0) &&
-                (my_instance->exclude == NULL ||
-                 regexec(&my_instance->exre, ptr, 0, NULL, 0) != 0))
+            if ((ptr = modutil_get_SQL(queue)) != NULL)
             {
-                my_session->n_statements++;
-                if (my_session->current)
+                if ((my_instance->match == NULL ||
+                     regexec(&my_instance->re, ptr, 0, NULL, 0) == 0) &&
+                    (my_instance->exclude == NULL ||
+                     regexec(&my_instance->exre, ptr, 0, NULL, 0) != 0))
                 {
-                    MXS_FREE(my_session->current);
+                    start_digest(my_session, ptr, strlen(ptr));
+                    my_session->n_statements++;
+                    if (my_session->current)
+                    {
+                        MXS_FREE(my_session->current);
+                        my_session->current = NULL;
+                    }
+                    if (my_instance->filebase)
+                    {
+                        gettimeofday(&my_session->start, NULL);
+                        my_session->current = ptr;
+                    }
+                    else
+                    {
+                        MXS_FREE(ptr);
+                    }
+                }
+                else
+                {
+                    MXS_FREE(ptr);
                 }
-                gettimeofday(&my_session->start, NULL);
-                my_session->current = ptr;
-            }
-            else
-            {
-                MXS_FREE(ptr);
             }
         }
+        else if (modutil_extract_SQL(queue, &ptr, &len))
+        {
+            /** Only the first packet of a very large statement is used */
+            len = MIN(len, (int)GWBUF_LENGTH(queue) - 5);
+            start_digest(my_session, ptr, len);
+            my_session->n_statements++;
+        }
     }
     /* Pass the query downstream */
     return my_session->down.routeQuery(my_session->down.instance,
                                        my_session->down.session, queue);
 }
 
-static int
-cmp_topn(const void *va, const void *vb)
+/**
+ * Move the query at the given position towards the start of the list
+ * until the list is again sorted by duration, longest first
+ *
+ * @param top  The top N list
+ * @param pos  Position of the new query
+ */
+static void
+shift_topn(TOPNQ **top, int pos)
 {
-    TOPNQ **a = (TOPNQ **) va;
-    TOPNQ **b = (TOPNQ **) vb;
+    TOPNQ *entry = top[pos];
 
-    if ((*b)->duration.tv_sec == (*a)->duration.tv_sec)
+    while (pos > 0 && timercmp(&top[pos - 1]->duration, &entry->duration, <))
     {
-        return (*b)->duration.tv_usec - (*a)->duration.tv_usec;
+        top[pos] = top[pos - 1];
+        pos--;
     }
-    return (*b)->duration.tv_sec - (*a)->duration.tv_sec;
+
+    top[pos] = entry;
 }
 
 static int
@@ -578,6 +659,17 @@ clientReply(FILTER *instance, void *session, GWBUF *reply)
     struct timeval tv, diff;
     int i, inserted;
 
+    if (my_session->digest_pending && topn_reply_process(&my_session->reply, reply))
+    {
+        gettimeofday(&tv, NULL);
+        timersub(&tv, &my_session->digest_start, &diff);
+        topn_digests_add(my_instance->digests, my_session->digest_hash,
+                         my_session->digest_sql,
+                         (uint64_t)diff.tv_sec * 1000000 + diff.tv_usec,
+                         my_session->reply.rows);
+        my_session->digest_pending = false;
+    }
+
     if (my_session->current)
     {
         gettimeofday(&tv, NULL);
@@ -585,32 +677,32 @@ clientReply(FILTER *instance, void *session, GWBUF *reply)
 
         timeradd(&(my_session->total), &diff, &(my_session->total));
 
-        inserted = 0;
+        inserted = -1;
         for (i = 0; i < my_instance->topN; i++)
         {
             if (my_session->top[i]->sql == NULL)
             {
                 my_session->top[i]->sql = my_session->current;
                 my_session->top[i]->duration = diff;
-                inserted = 1;
+                inserted = i;
                 break;
             }
         }
 
-        if (inserted == 0 && ((diff.tv_sec > my_session->top[my_instance->topN - 1]->duration.tv_sec) ||
-                              (diff.tv_sec == my_session->top[my_instance->topN - 1]->duration.tv_sec &&
-                               diff.tv_usec > my_session->top[my_instance->topN - 1]->duration.tv_usec)))
+        if (inserted == -1 && ((diff.tv_sec > my_session->top[my_instance->topN - 1]->duration.tv_sec) ||
+                               (diff.tv_sec == my_session->top[my_instance->topN - 1]->duration.tv_sec &&
+                                diff.tv_usec > my_session->top[my_instance->topN - 1]->duration.tv_usec)))
         {
             MXS_FREE(my_session->top[my_instance->topN - 1]->sql);
             my_session->top[my_instance->topN - 1]->sql = my_session->current;
             my_session->top[my_instance->topN - 1]->duration = diff;
-            inserted = 1;
+            inserted = my_instance->topN - 1;
         }
 
-        if (inserted)
+        if (inserted != -1)
         {
-            qsort(my_session->top, my_instance->topN,
-                  sizeof(TOPNQ *), cmp_topn);
+            /** The rest of the list is already sorted */
+            shift_topn(my_session->top, inserted);
         }
         else
         {
@@ -664,7 +756,7 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match     %s\n",
                    my_instance->exclude);
     }
-    if (my_session)
+    if (my_session && my_session->filename)
     {
         dcb_printf(dcb, "\t\tLogging to file %s.\n",
                    my_session->filename);
@@ -682,4 +774,145 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
             }
         }
     }
+    if (my_session == NULL)
+    {
+        int n;
+        TOPN_DIGEST *top = topn_digests_get(my_instance->digests, &n);
+
+        dcb_printf(dcb, "\t\tTop %d statement digests:\n", my_instance->topN);
+        for (i = 0; i < n && i < my_instance->topN; i++)
+        {
+            dcb_printf(dcb, "\t\t%d place:\n", i + 1);
+            dcb_printf(dcb, "\t\t\tDigest:         %s\n", top[i].sql);
+            dcb_printf(dcb, "\t\t\tCount:          %lu\n", top[i].count);
+            dcb_printf(dcb, "\t\t\tTotal time:     %.3f seconds\n",
+                       (double)top[i].total_us / 1000000);
+            dcb_printf(dcb, "\t\t\tAverage time:   %.3f seconds\n",
+                       (double)top[i].total_us / top[i].count / 1000000);
+            dcb_printf(dcb, "\t\t\tMinimum time:   %.3f seconds\n",
+                       (double)top[i].min_us / 1000000);
+            dcb_printf(dcb, "\t\t\tMaximum time:   %.3f seconds\n",
+                       (double)top[i].max_us / 1000000);
+            dcb_printf(dcb, "\t\t\tRows:           %lu\n", top[i].rows);
+            dcb_printf(dcb, "\t\t\tHistogram:     ");
+            for (int j = 0; j < TOPN_HISTOGRAM_SIZE; j++)
+            {
+                dcb_printf(dcb, " %s: %lu", topn_histogram_name(j), top[i].histogram[j]);
+            }
+            dcb_printf(dcb, "\n");
+        }
+        MXS_FREE(top);
+    }
+}
+
+/**
+ * The state of a statistics result set
+ */
+typedef struct
+{
+    TOPN_DIGEST *digests; /* The merged digests */
+    int n_digests; /* Number of rows to return */
+    int index; /* The next row */
+} TOPN_RESULT;
+
+/**
+ * Provide a row to the result set of the statement digests
+ *
+ * @param set   The result set
+ * @param data  The state of the result set
+ * @return The next row or NULL if there are no more rows
+ */
+static RESULT_ROW *
+statistics_row(RESULTSET *set, void *data)
+{
+    TOPN_RESULT *result = (TOPN_RESULT *) data;
+    char buf[40];
+
+    if (result->index >= result->n_digests)
+    {
+        MXS_FREE(result->digests);
+        MXS_FREE(result);
+        return NULL;
+    }
+
+    TOPN_DIGEST *digest = &result->digests[result->index++];
+    RESULT_ROW *row = resultset_make_row(set);
+    int col = 0;
+
+    resultset_row_set(row, col++, digest->sql);
+    snprintf(buf, sizeof(buf), "%lu", digest->count);
+    resultset_row_set(row, col++, buf);
+    snprintf(buf, sizeof(buf), "%.3f", (double)digest->total_us / 1000);
+    resultset_row_set(row, col++, buf);
+    snprintf(buf, sizeof(buf), "%.3f", (double)digest->total_us / digest->count / 1000);
+    resultset_row_set(row, col++, buf);
+    snprintf(buf, sizeof(buf), "%.3f", (double)digest->min_us / 1000);
+    resultset_row_set(row, col++, buf);
+    snprintf(buf, sizeof(buf), "%.3f", (double)digest->max_us / 1000);
+    resultset_row_set(row, col++, buf);
+    snprintf(buf, sizeof(buf), "%lu", digest->rows);
+    resultset_row_set(row, col++, buf);
+    for (int i = 0; i < TOPN_HISTOGRAM_SIZE; i++)
+    {
+        snprintf(buf, sizeof(buf), "%lu", digest->histogram[i]);
+        resultset_row_set(row, col++, buf);
+    }
+
+    return row;
+}
+
+/**
+ * Return the top N statement digests of the instance as a result set
+ *
+ * @param instance  The filter instance
+ * @return A result set or NULL on error
+ */
+static RESULTSET *
+statistics(FILTER *instance)
+{
+    TOPN_INSTANCE *my_instance = (TOPN_INSTANCE *) instance;
+    TOPN_RESULT *result = (TOPN_RESULT *) MXS_CALLOC(1, sizeof(TOPN_RESULT));
+    RESULTSET *set;
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    result->digests = topn_digests_get(my_instance->digests, &result->n_digests);
+    result->n_digests = MIN(result->n_digests, my_instance->topN);
+
+    if ((set = resultset_create(statistics_row, result)) == NULL)
+    {
+        MXS_FREE(result->digests);
+        MXS_FREE(result);
+        return NULL;
+    }
+
+    resultset_add_column(set, "Digest", TOPN_DIGEST_LEN, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Count", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Total_ms", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Avg_ms", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Min_ms", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Max_ms", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Rows", 20, COL_TYPE_VARCHAR);
+    for (int i = 0; i < TOPN_HISTOGRAM_SIZE; i++)
+    {
+        resultset_add_column(set, topn_histogram_name(i), 20, COL_TYPE_VARCHAR);
+    }
+
+    return set;
+}
+
+/**
+ * Clear the statement digests of the instance
+ *
+ * @param instance  The filter instance
+ */
+static void
+resetStatistics(FILTER *instance)
+{
+    TOPN_INSTANCE *my_instance = (TOPN_INSTANCE *) instance;
+
+    topn_digests_reset(my_instance->digests);
 }
@@ -46,6 +46,7 @@
 #define MEMORY_DATABASE_NAME   "memory"
 #define MEMORY_TABLE_NAME      MEMORY_DATABASE_NAME".mem_used_tables"
 #define INDEX_TABLE_NAME       "indexing_progress"
+#define BLOCK_TABLE_NAME       "blocks"
 
 /** Name of the file where the binlog to Avro conversion progress is stored */
 #define AVRO_PROGRESS_FILE "avro-conversion.ini"
@@ -148,6 +148,20 @@
 #define DEF_LONG_BURST          500
 #define DEF_BURST_SIZE          1024000 /* 1 Mb */
 
+/**
+ * Default size of the binlog event cache and the average event size used
+ * to size the record ring
+ */
+#define DEF_EVENT_CACHE_SIZE    (8 * 1024 * 1024) /* 8 Mb */
+#define BLCACHE_AVG_EVENT_SIZE  256
+#define BLCACHE_MIN_RECORDS     64
+
+/**
+ * Default size of the buffer where the events of a transaction are collected
+ * before they are written to the binlog file
+ */
+#define DEF_BINLOG_WRITE_BUFFER (64 * 1024) /* 64 Kb */
+
 /**
  * master reconnect backoff constants
  * BLR_MASTER_BACKOFF_TIME      The increments of the back off time (seconds)
@@ -276,25 +290,35 @@ typedef struct rep_header
 } REP_HEADER;
 
 /**
- * The binlog record structure. This contains the actual packet read from the binlog
- * file.
+ * The binlog record structure. This contains an event that has been written
+ * to a binlog file and distributed to the slaves.
  */
 typedef struct
 {
+    uint32_t        file;           /*< Sequence number of the binlog file of the record */
     unsigned long   position;       /*< binlog record position for this cache entry */
-    GWBUF           *pkt;           /*< The packet received from the master */
+    GWBUF           *pkt;           /*< The binlog event, shared with the slaves reading it */
     REP_HEADER      hdr;            /*< The packet header */
 } BLCACHE_RECORD;
 
+/** The number of binlog files that may have records in the cache */
+#define BLCACHE_FILES           4
+
 /**
- * The binlog cache. A cache exists for each file that hold cached bin log records.
- * Caches will be used for all files being read by more than 1 slave.
+ * The binlog cache. A bounded ring of the most recent binlog events, shared by
+ * all the slaves of a router instance. The records are ordered by the binlog
+ * file sequence number and position, oldest first.
  */
 typedef struct
 {
-    BLCACHE_RECORD  **records;      /*< The actual binlog records */
-    int             current;        /*< The next record that will be inserted */
+    BLCACHE_RECORD  *records;       /*< The ring of records, NULL if the cache is disabled */
+    int             size;           /*< The number of slots in the ring */
+    int             first;          /*< The oldest record in the ring */
     int             cnt;            /*< The number of records in the cache */
+    unsigned long   bytes;          /*< The size of the cached events */
+    unsigned long   max_bytes;      /*< The maximum size of the cached events */
+    char            files[BLCACHE_FILES][BINLOG_FNAMELEN + 1]; /*< Names of the cached files */
+    uint32_t        file_seq;       /*< Sequence number of the newest file, 0 if none */
     SPINLOCK        lock;           /*< The spinlock for the cache */
 } BLCACHE;
 
@@ -303,7 +327,6 @@ typedef struct blfile
     char            binlogname[BINLOG_FNAMELEN + 1]; /*< Name of the binlog file */
     int             fd;                             /*< Actual file descriptor */
     int             refcnt;                         /*< Reference count for file */
-    BLCACHE         *cache;                         /*< Record cache for this file */
     SPINLOCK        lock;                           /*< The file lock */
     struct blfile   *next;                          /*< Next file in list */
 } BLFILE;
@@ -333,6 +356,27 @@ typedef struct
     int             minavgs[BLR_NSTATS_MINUTES];
 } SLAVE_STATS;
 
+/**
+ * When the binlog file is synced to disk, set with the binlog_sync option
+ */
+typedef enum blr_sync_policy
+{
+    BLR_SYNC_EVENT,         /*< After every event */
+    BLR_SYNC_TRANSACTION,   /*< When a transaction has been written */
+    BLR_SYNC_PERIODIC,      /*< At most once per binlog_sync_period milliseconds */
+    BLR_SYNC_OS             /*< Never, the operating system writes the data */
+} blr_sync_policy_t;
+
+/**
+ * How the binlog file is synced, set with the binlog_sync_method option
+ */
+typedef enum blr_sync_method
+{
+    BLR_SYNC_METHOD_FSYNC,
+    BLR_SYNC_METHOD_FDATASYNC,
+    BLR_SYNC_METHOD_SYNC_FILE_RANGE
+} blr_sync_method_t;
+
 typedef enum blr_thread_role
 {
     BLR_THREAD_ROLE_MASTER_LARGE_NOTRX,
@@ -411,6 +455,8 @@ typedef struct
     uint64_t        n_rotates;      /*< Number of binlog rotate events */
     uint64_t        n_cachehits;    /*< Number of hits on the binlog cache */
     uint64_t        n_cachemisses;  /*< Number of misses on the binlog cache */
+    uint64_t        n_binlog_writes;/*< Number of writes to the binlog file */
+    uint64_t        n_binlog_syncs; /*< Number of syncs of the binlog file */
     int             n_registered;   /*< Number of registered slaves */
     int             n_masterstarts; /*< Number of times connection restarted */
     int             n_delayedreconnects;
@@ -511,6 +557,16 @@ typedef struct router_instance
     unsigned int      long_burst;   /*< Long burst for slave catchup */
     unsigned long     burst_size;   /*< Maximum size of burst to send */
     unsigned long     heartbeat;    /*< Configured heartbeat value */
+    unsigned long     event_cache_size; /*< Maximum size of the binlog event cache */
+    BLCACHE           cache;        /*< Cache of the latest binlog events */
+    blr_sync_policy_t binlog_sync;  /*< When the binlog file is synced */
+    unsigned long     binlog_sync_period; /*< Sync period in milliseconds */
+    blr_sync_method_t binlog_sync_method; /*< How the binlog file is synced */
+    unsigned long     write_buffer_size; /*< Size of the binlog write buffer */
+    uint8_t           *write_buffer; /*< Events not yet written to the binlog file */
+    unsigned long     write_buffer_len; /*< Bytes in the write buffer */
+    uint64_t          last_synced;  /*< Binlog file position of the last sync */
+    uint64_t          last_sync_time; /*< Time of the last sync in milliseconds */
     ROUTER_STATS      stats;        /*< Statistics for this router */
     int               active_logs;
     int               reconnect_pending;
@@ -646,11 +702,17 @@ extern int blr_slave_request(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern void blr_slave_rotate(ROUTER_INSTANCE *, ROUTER_SLAVE *, uint8_t *);
 extern int blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large);
 extern void blr_init_cache(ROUTER_INSTANCE *);
+extern void blr_cache_add(ROUTER_INSTANCE *, const char *, REP_HEADER *, uint8_t *);
+extern GWBUF *blr_cache_read(ROUTER_INSTANCE *, const char *, unsigned long, REP_HEADER *);
+extern int blr_cache_lag(ROUTER_INSTANCE *, const char *, unsigned long);
+extern void blr_cache_invalidate(ROUTER_INSTANCE *, const char *);
 
 extern int  blr_file_init(ROUTER_INSTANCE *);
 extern int  blr_write_binlog_record(ROUTER_INSTANCE *, REP_HEADER *, uint32_t pos, uint8_t *);
 extern int  blr_file_rotate(ROUTER_INSTANCE *, char *, uint64_t);
 extern void blr_file_flush(ROUTER_INSTANCE *);
+extern bool blr_file_commit(ROUTER_INSTANCE *);
+extern bool blr_file_write_buffered(ROUTER_INSTANCE *);
 extern BLFILE *blr_open_binlog(ROUTER_INSTANCE *, char *);
 extern GWBUF *blr_read_binlog(ROUTER_INSTANCE *, BLFILE *, unsigned long, REP_HEADER *, char *);
 extern void blr_close_binlog(ROUTER_INSTANCE *, BLFILE *);
@@ -213,6 +213,7 @@ typedef enum
     GW_MYSQL_CAPABILITIES_MULTI_RESULTS =          (1 << 17),
     GW_MYSQL_CAPABILITIES_PS_MULTI_RESULTS =       (1 << 18),
     GW_MYSQL_CAPABILITIES_PLUGIN_AUTH =            (1 << 19),
+    GW_MYSQL_CAPABILITIES_SESSION_TRACK =          (1 << 23),
     GW_MYSQL_CAPABILITIES_SSL_VERIFY_SERVER_CERT = (1 << 30),
     GW_MYSQL_CAPABILITIES_REMEMBER_OPTIONS =       (1 << 31),
     GW_MYSQL_CAPABILITIES_CLIENT = (GW_MYSQL_CAPABILITIES_LONG_PASSWORD |
@@ -288,6 +289,8 @@ typedef struct
     unsigned        long tid;                         /*< MySQL Thread ID, in
         * handshake */
     unsigned int    charset;                          /*< MySQL character set at connect time */
+    bool            pipelined;                        /*< Queries may be written behind session
+        * commands whose replies have not arrived */
 #if defined(SS_DEBUG)
     skygw_chk_t     protocol_chk_tail;
 #endif
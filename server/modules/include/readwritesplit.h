@@ -54,7 +54,8 @@ typedef enum bref_state
     BREF_WAITING_RESULT   = 0x02, /*< for session commands only */
     BREF_QUERY_ACTIVE     = 0x04, /*< for other queries */
     BREF_CLOSED           = 0x08,
-    BREF_SESCMD_FAILED    = 0x10 /*< Backend references that should be dropped */
+    BREF_SESCMD_FAILED    = 0x10, /*< Backend references that should be dropped */
+    BREF_WAITING_GTID     = 0x20  /*< waiting for the GTID of a causal read */
 } bref_state_t;
 
 #define BREF_IS_NOT_USED(s)         ((s)->bref_state & ~BREF_IN_USE)
@@ -63,6 +64,7 @@ typedef enum bref_state
 #define BREF_IS_QUERY_ACTIVE(s)     ((s)->bref_state & BREF_QUERY_ACTIVE)
 #define BREF_IS_CLOSED(s)           ((s)->bref_state & BREF_CLOSED)
 #define BREF_HAS_FAILED(s)          ((s)->bref_state & BREF_SESCMD_FAILED)
+#define BREF_IS_WAITING_GTID(s)     ((s)->bref_state & BREF_WAITING_GTID)
 
 typedef enum backend_type_t
 {
@@ -116,8 +118,9 @@ typedef enum select_criteria
     LEAST_ROUTER_CONNECTIONS,   /*< connections established by this router */
     LEAST_BEHIND_MASTER,
     LEAST_CURRENT_OPERATIONS,
-    DEFAULT_CRITERIA   = LEAST_CURRENT_OPERATIONS,
-    LAST_CRITERIA               /*< not used except for an index */
+    ADAPTIVE_ROUTING,           /*< shortest response time, two random choices */
+    LAST_CRITERIA,              /*< not used except for an index */
+    DEFAULT_CRITERIA   = LEAST_CURRENT_OPERATIONS
 } select_criteria_t;
 
 
@@ -125,6 +128,29 @@ typedef enum select_criteria
 #define CONFIG_MAX_SLAVE_CONN 1
 #define CONFIG_MAX_SLAVE_RLAG -1 /*< not used */
 #define CONFIG_SQL_VARIABLES_IN TYPE_ALL
+#define CONFIG_CAUSAL_READS_TIMEOUT 10
+
+/**
+ * The weight of a new response time sample in the average response time of
+ * a server is 1/RWSPLIT_RESPONSE_TIME_DECAY
+ */
+#define RWSPLIT_RESPONSE_TIME_DECAY 8
+
+/**
+ * The average response time is kept in fixed point with this many fractional
+ * bits so that samples close to the average still move it
+ */
+#define RWSPLIT_RESPONSE_TIME_FRACTION_BITS 8
+
+/**
+ * Response times are counted in buckets whose width is a quarter of the
+ * power of two below them, covering all response times up to INT_MAX
+ * microseconds with a relative error of at most 25%.
+ */
+#define RWSPLIT_RESPONSE_TIME_BUCKETS 120
+
+/** Maximum length of a GTID, domain-server_id-sequence */
+#define RWSPLIT_GTID_MAX_LEN 64
 
 #define GET_SELECT_CRITERIA(s)                                                                  \
         (strncmp(s,"LEAST_GLOBAL_CONNECTIONS", strlen("LEAST_GLOBAL_CONNECTIONS")) == 0 ?       \
@@ -134,7 +160,26 @@ typedef enum select_criteria
         strncmp(s,"LEAST_ROUTER_CONNECTIONS", strlen("LEAST_ROUTER_CONNECTIONS")) == 0 ?        \
         LEAST_ROUTER_CONNECTIONS : (                                                            \
         strncmp(s,"LEAST_CURRENT_OPERATIONS", strlen("LEAST_CURRENT_OPERATIONS")) == 0 ?        \
-        LEAST_CURRENT_OPERATIONS : UNDEFINED_CRITERIA))))
+        LEAST_CURRENT_OPERATIONS : (                                                            \
+        strncmp(s,"ADAPTIVE_ROUTING", strlen("ADAPTIVE_ROUTING")) == 0 ?                        \
+        ADAPTIVE_ROUTING : UNDEFINED_CRITERIA)))))
+
+/**
+ * What a session command does, as far as compacting the session command
+ * history is concerned
+ */
+typedef enum sescmd_kind
+{
+    SESCMD_OTHER,       /*< Anything else, may depend on earlier commands */
+    SESCMD_INDEPENDENT, /*< Doesn't depend on earlier commands but can't be superseded */
+    SESCMD_VARIABLE,    /*< Assigns a literal to one variable */
+    SESCMD_DATABASE,    /*< Changes the default database */
+    SESCMD_PREPARE,     /*< Prepares a named statement */
+    SESCMD_DEALLOCATE   /*< Deallocates a named statement */
+} sescmd_kind_t;
+
+/** Maximum length of the variable or statement name of a session command */
+#define RWSPLIT_SESCMD_KEY_LEN 68
 
 /**
  * Session variable command
@@ -152,6 +197,11 @@ typedef struct mysql_sescmd_st
                                    *  LOCAL_INFILE. Slave servers are compared to this
                                    *  when they return session command replies.*/
     int      position; /*< Position of this command */
+    sescmd_kind_t      my_sescmd_kind; /*< What the command does */
+    char               my_sescmd_key[RWSPLIT_SESCMD_KEY_LEN]; /*< Variable or statement name */
+    bool               my_sescmd_superseded; /*< A later command makes this one redundant */
+    bool               my_sescmd_deallocated; /*< A later command deallocates this statement */
+    struct mysql_sescmd_st *my_sescmd_prepare; /*< The preparation this deallocation pairs with */
 #if defined(SS_DEBUG)
     skygw_chk_t        my_sescmd_chk_tail;
 #endif
@@ -190,6 +240,7 @@ typedef struct sescmd_cursor_st
     mysql_sescmd_t*    scmd_cur_cmd;          /*< pointer to current session command */
     bool               scmd_cur_active;       /*< true if command is being executed */
     int                position; /*< Position of this cursor */
+    int                scmd_cur_sent; /*< Position of the last command written to the backend */
 #if defined(SS_DEBUG)
     skygw_chk_t        scmd_cur_chk_tail;
 #endif
@@ -211,6 +262,7 @@ typedef struct backend_st
     int             backend_conn_count;  /*< Number of connections to the server */
     bool            be_valid; /*< Valid when belongs to the router's configuration */
     int             weight; /*< Desired weighting on the load. Expressed in .1% increments */
+    uint64_t        be_response_times[RWSPLIT_RESPONSE_TIME_BUCKETS]; /*< Response time histogram */
 #if defined(SS_DEBUG)
     skygw_chk_t     be_chk_tail;
 #endif
@@ -234,6 +286,10 @@ typedef struct backend_ref_st
     GWBUF*          bref_pending_cmd; /**< For stmt which can't be routed due active sescmd execution */
     unsigned char   reply_cmd;  /**< The reply the backend server sent to a session command.
                                  * Used to detect slaves that fail to execute session command. */
+    GWBUF*          bref_gtid_reply; /**< The reply to the GTID wait collected so far */
+    int             bref_gtid_version; /**< The last write of the session the server is
+                                        * known to have replicated */
+    long            bref_query_started; /**< When the active query was sent, in microseconds */
 #if defined(SS_DEBUG)
     skygw_chk_t     bref_chk_tail;
 #endif
@@ -265,6 +321,11 @@ typedef struct rwsplit_config_st
                                              * to the master after a multistatement query. */
     enum failure_mode rw_master_failure_mode; /**< Master server failure handling mode.
                                                * @see enum failure_mode */
+    bool              rw_causal_reads; /**< Make slaves wait for the session's writes
+                                        * before reading from them */
+    int               rw_causal_reads_timeout; /**< Seconds a slave may wait for a write */
+    bool              rw_pipeline_sescmd; /**< Write session commands and queries to backends
+                                           * without waiting for earlier session commands */
 } rwsplit_config_t;
 
 #if defined(PREP_STMT_CACHING)
@@ -306,6 +367,8 @@ struct router_client_session
     rwsplit_config_t rses_config;    /*< copied config info from router instance */
     int              rses_nbackends;
     int              rses_nsescmd;  /*< Number of executed session commands */
+    int              rses_sescmd_hist_len;   /*< Number of commands in the history */
+    size_t           rses_sescmd_hist_bytes; /*< Size of the commands in the history */
     bool             rses_autocommit_enabled;
     bool             rses_transaction_active;
     bool             rses_load_active; /*< If LOAD DATA LOCAL INFILE is being currently executed */
@@ -314,6 +377,9 @@ struct router_client_session
     DCB*             client_dcb;
     int              pos_generator;
     backend_ref_t    *forced_node; /*< Current server where all queries should be sent */
+    char             rses_last_gtid[RWSPLIT_GTID_MAX_LEN]; /*< GTID of the latest write */
+    int              rses_gtid_version; /*< Number of writes with a GTID */
+    bool             rses_gtid_unknown; /*< A write was done after the latest known GTID */
 #if defined(PREP_STMT_CACHING)
     HASHTABLE*       rses_prep_stmt[2];
 #endif
@@ -334,6 +400,10 @@ typedef struct
     int     n_master;   /*< Number of stmts sent to master */
     int     n_slave;    /*< Number of stmts sent to slave */
     int     n_all;      /*< Number of stmts sent to all */
+    int     n_causal_slave;  /*< Number of causal reads served by a slave */
+    int     n_causal_master; /*< Number of causal reads routed to master after a timeout */
+    int     n_sescmd_compacted; /*< Number of session commands removed from histories */
+    int     n_pipelined; /*< Number of commands written behind unfinished session commands */
 } ROUTER_STATS;
 
 /**
@@ -351,6 +421,7 @@ typedef struct router_instance
     ROUTER_STATS            stats;       /*< Statistics for this router */
     struct router_instance* next;        /*< Next router on the list */
     bool                    available_slaves; /*< The router has some slaves avialable */
+    int                     causal_reads_warned; /*< Warned that GTIDs can't be tracked */
 } ROUTER_INSTANCE;
 
 #define BACKEND_TYPE(b) (SERVER_IS_MASTER((b)->backend_server) ? BE_MASTER :    \
@@ -59,6 +59,15 @@ enum shard_map_state
     SHMAP_STALE /*< The shard map has old data or has not been updated recently */
 };
 
+/**
+ * The servers of a table whose database is on more than one server
+ */
+typedef struct shard_table
+{
+    int n_servers;
+    char **servers; /*< Unique names of the servers that have the table */
+} shard_table_t;
+
 /**
  * A map of the shards tied to a single user.
  */
@@ -66,9 +75,16 @@ typedef struct shard_map
 {
     HASHTABLE *hash; /*< A hashtable of database names and the servers which
                        * have these databases. */
+    HASHTABLE *tables; /*< A hashtable of db.table names and the shard_table_t
+                        * of the table. Only the tables of databases that are
+                        * found on more than one server are mapped. */
     SPINLOCK lock;
     time_t last_updated;
     enum shard_map_state state; /*< State of the shard map */
+    bool shared; /*< Whether this is the router-wide shard map. A shared shard
+                  * map is not modified after it has been published. */
+    int refcount; /*< Number of references to a shared shard map, protected
+                   * by the lock of the router instance */
 } shard_map_t;
 
 /**
@@ -286,6 +302,8 @@ typedef struct schemarouter_config_st
     double refresh_min_interval; /*< Minimum required interval between refreshes of databases */
     bool refresh_databases; /*< Are databases refreshed when they are not found in the hashtable */
     bool debug; /*< Enable verbose debug messages to clients */
+    bool scatter_gather; /*< Send SELECTs of tables on several servers to all of them */
+    size_t scatter_gather_max_size; /*< Maximum size of buffered scatter-gather results, 0 for no limit */
 } schemarouter_config_t;
 
 /**
@@ -304,6 +322,7 @@ typedef struct
     double          ses_average; /*< Average session length */
     int             shmap_cache_hit; /*< Shard map was found from the cache */
     int             shmap_cache_miss;/*< No shard map found from the cache */
+    int             n_scatter;       /*< Number of scatter-gather queries */
 } ROUTER_STATS;
 
 /**
@@ -331,6 +350,7 @@ struct router_client_session
     struct router_client_session* next; /*< List of router sessions */
     shard_map_t*
     shardmap; /*< Database hash containing names of the databases mapped to the servers that contain them */
+    int             shardmap_version; /*< Version of the router-wide shard map in use */
     char            connect_db[MYSQL_DATABASE_MAXLEN + 1]; /*< Database the user was trying to connect to */
     char            current_db[MYSQL_DATABASE_MAXLEN + 1]; /*< Current active database */
     init_mask_t    init; /*< Initialization state bitmask */
@@ -340,6 +360,7 @@ struct router_client_session
     ROUTER_STATS    stats;     /*< Statistics for this router         */
     int             n_sescmd;
     int             pos_generator;
+    struct scatter_query* scatter; /*< The scatter-gather query being executed or NULL */
 #if defined(SS_DEBUG)
     skygw_chk_t      rses_chk_tail;
 #endif
@@ -351,7 +372,17 @@ struct router_client_session
  */
 typedef struct router_instance
 {
-    HASHTABLE*              shard_maps;  /*< Shard maps hashed by user name */
+    shard_map_t*            shard_map;   /*< The router-wide shard map, NULL until
+                                          * the first one has been built */
+    int                     shard_map_version; /*< Incremented when the shard map is replaced */
+    int                     shard_map_building; /*< Whether a shard map is being built */
+    bool                    shard_map_requested; /*< Whether a rebuild has been requested */
+    bool*                   shard_map_running; /*< Which servers were running when the
+                                                * shard map was last built */
+    time_t                  shard_map_attempt; /*< When the last build was started */
+    double                  shard_map_build_time; /*< Seconds the last build took */
+    int                     shard_map_builds; /*< Number of shard map builds */
+    int                     shard_map_changes; /*< Number of builds that replaced the map */
     SERVICE*                service;     /*< Pointer to service                 */
     ROUTER_CLIENT_SES*      connections; /*< List of client connections         */
     SPINLOCK                lock;        /*< Lock for the instance data         */
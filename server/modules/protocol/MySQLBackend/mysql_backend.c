@@ -946,7 +946,7 @@ gw_read_reply_or_error(DCB *dcb, MYSQL_session local_session)
             if (backend_protocol->protocol_auth_state == MYSQL_AUTH_FAILED &&
                 dcb->session->state != SESSION_STATE_STOPPING)
             {
-                service_refresh_users(dcb->session->service);
+                service_refresh_users_async(dcb->session->service);
             }
 #if defined(SS_DEBUG)
             MXS_DEBUG("%lu [gw_read_backend_event] "
@@ -1142,6 +1142,8 @@ gw_read_and_write(DCB *dcb, MYSQL_session local_session)
                 {
                     gwbuf_set_type(read_buffer, GWBUF_TYPE_MYSQL);
 
+                    /** Lets the filters on the reply path know the server */
+                    session->reply_server = dcb->server;
                     session->service->router->clientReply(
                         session->service->router_instance,
                                         session->router_session,
@@ -1153,6 +1155,7 @@ gw_read_and_write(DCB *dcb, MYSQL_session local_session)
             else if (dcb->session->client_dcb->dcb_role == DCB_ROLE_INTERNAL)
             {
                 gwbuf_set_type(read_buffer, GWBUF_TYPE_MYSQL);
+                session->reply_server = dcb->server;
                 session->service->router->clientReply(
                     session->service->router_instance,
                     session->router_session,
@@ -1984,6 +1987,18 @@ static GWBUF* process_response_data(DCB* dcb,
                   STRPACKETTYPE(srvcmd),
                   dcb,
                   dcb->fd);
+
+        if (npackets_left == 0 && srvcmd == MYSQL_COM_UNDEFINED && p->pipelined)
+        {
+            /**
+             * All session command responses have been read. The rest is the
+             * response to a query that the router pipelined behind them.
+             */
+            outbuf = gwbuf_append(outbuf, readbuf);
+            readbuf = NULL;
+            break;
+        }
+
         /**
          * Read values from protocol structure, fails if values are
          * uninitialized.
@@ -2404,6 +2419,16 @@ create_capabilities(MySQLProtocol *conn, bool db_specified, bool compress)
 
     final_capabilities |= (int)GW_MYSQL_CAPABILITIES_PLUGIN_AUTH;
 
+    /**
+     * Session state tracking changes the format of the OK packets which are
+     * forwarded as such to the client, so it is only requested if the client
+     * requested it too.
+     */
+    if (conn->owner_dcb->session && conn->owner_dcb->session->service->session_track)
+    {
+        final_capabilities |= conn->client_capabilities & (uint32_t)GW_MYSQL_CAPABILITIES_SESSION_TRACK;
+    }
+
     return final_capabilities;
 }
 
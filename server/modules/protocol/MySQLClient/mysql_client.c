@@ -387,6 +387,11 @@ int MySQLSendHandshake(DCB* dcb)
     mysql_server_capabilities_two[0] = 15;
     mysql_server_capabilities_two[1] = 128;
 
+    if (dcb->service->session_track)
+    {
+        mysql_server_capabilities_two[0] |= (int)(GW_MYSQL_CAPABILITIES_SESSION_TRACK >> 16);
+    }
+
     memcpy(mysql_handshake_payload, mysql_server_capabilities_two, sizeof(mysql_server_capabilities_two));
     mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_server_capabilities_two);
 
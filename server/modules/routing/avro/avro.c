@@ -198,6 +198,22 @@ bool create_tables(sqlite3* handle)
         return false;
     }
 
+    rc = sqlite3_exec(handle, "CREATE TABLE IF NOT EXISTS "
+                      BLOCK_TABLE_NAME"(avrofile varchar(255), position bigint, "
+                      "records bigint, first_domain int, first_server_id int, "
+                      "first_sequence bigint, last_domain int, last_server_id int, "
+                      "last_sequence bigint, primary key(avrofile, position));"
+                      "CREATE INDEX IF NOT EXISTS "BLOCK_TABLE_NAME"_last_gtid ON "
+                      BLOCK_TABLE_NAME"(avrofile, last_domain, last_server_id, last_sequence);",
+                      NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK)
+    {
+        MXS_ERROR("Failed to create block index table '"BLOCK_TABLE_NAME"': %s",
+                  sqlite3_errmsg(handle));
+        sqlite3_free(errmsg);
+        return false;
+    }
+
     rc = sqlite3_exec(handle, "ATTACH DATABASE ':memory:' AS "MEMORY_DATABASE_NAME,
                       NULL, NULL, &errmsg);
     if (rc != SQLITE_OK)
@@ -661,24 +661,49 @@ static int sqlite_cb(void* data, int rows, char** values, char** names)
     return 0;
 }
 
+static const char block_select_template[] = "SELECT position FROM "BLOCK_TABLE_NAME
+                                            " WHERE avrofile=\"%s\" AND last_domain=%lu "
+                                            "AND last_server_id=%lu AND last_sequence >= %lu "
+                                            "ORDER BY last_sequence LIMIT 1;";
+
 static const char select_template[] = "SELECT max(position) FROM gtid WHERE domain=%lu "
                                       "AND server_id=%lu AND sequence <= %lu AND avrofile=\"%s\";";
 
+/**
+ * @brief Seek to the data block that contains the client's GTID
+ *
+ * The block index gives the first block whose last GTID is not smaller than
+ * the requested one. If the GTID isn't in the block index, the file is
+ * positioned at the last block that starts with a smaller GTID.
+ *
+ * @param client Client whose GTID is searched
+ * @param file File to seek
+ * @return True if the file was positioned, false if an error occurred
+ */
 static bool seek_to_index_pos(AVRO_CLIENT *client, MAXAVRO_FILE* file)
 {
     char *name = strrchr(client->file_handle->filename, '/');
     ss_dassert(name);
     name++;
 
-    char sql[sizeof(select_template) + NAME_MAX + 80];
-    snprintf(sql, sizeof(sql), select_template, client->gtid.domain,
-             client->gtid.server_id, client->gtid.seq, name);
+    char sql[sizeof(block_select_template) + NAME_MAX + 80];
+    snprintf(sql, sizeof(sql), block_select_template, name, client->gtid.domain,
+             client->gtid.server_id, client->gtid.seq);
 
     long offset = -1;
     char *errmsg = NULL;
     bool rval = false;
 
-    if (sqlite3_exec(client->sqlite_handle, sql, sqlite_cb, &offset, &errmsg) == SQLITE_OK)
+    int rc = sqlite3_exec(client->sqlite_handle, sql, sqlite_cb, &offset, &errmsg);
+
+    if (rc == SQLITE_OK && offset <= 0)
+    {
+        snprintf(sql, sizeof(sql), select_template, client->gtid.domain,
+                 client->gtid.server_id, client->gtid.seq, name);
+        rc = sqlite3_exec(client->sqlite_handle, sql, sqlite_cb, &offset, &errmsg);
+    }
+
+    if (rc == SQLITE_OK)
     {
         rval = true;
         if (offset > 0 && !maxavro_record_set_pos(file, offset))
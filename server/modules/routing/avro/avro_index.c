@@ -21,7 +21,10 @@
  * seeking to the offset of the file and reading the record instead of iterating
  * through all the records and looking for a matching record.
  *
- * The index is stored as an SQLite3 database.
+ * The index is stored as an SQLite3 database. In addition to the GTIDs, the
+ * position, record count and the first and last GTID of each data block are
+ * stored so that a client can find the block that contains a GTID with one
+ * index lookup and only needs to decode that block.
  *
  * @verbatim
  * Revision History
@@ -41,6 +44,9 @@ void* safe_key_free(void *data);
 static const char insert_template[] = "INSERT INTO gtid(domain, server_id, "
                                       "sequence, avrofile, position) values (%lu, %lu, %lu, \"%s\", %ld);";
 
+static const char block_insert_template[] = "INSERT OR REPLACE INTO "BLOCK_TABLE_NAME
+                                            " values (\"%s\", %ld, %lu, %lu, %lu, %lu, %lu, %lu, %lu);";
+
 static void set_gtid(gtid_pos_t *gtid, json_t *row)
 {
     json_t *obj = json_object_get(row, avro_sequence);
@@ -56,6 +62,48 @@ static void set_gtid(gtid_pos_t *gtid, json_t *row)
     gtid->domain = json_integer_value(obj);
 }
 
+/**
+ * @brief Store the position, size and GTID range of a data block
+ *
+ * The last record of the block is found with the block index of the file so
+ * only the first and the last record of the block are decoded.
+ *
+ * @param router Router instance
+ * @param file File whose first record of the current block has been read
+ * @param name Name of the file
+ * @param first GTID of the first record of the block
+ */
+static void index_block(AVRO_INSTANCE *router, MAXAVRO_FILE *file, const char *name,
+                        gtid_pos_t *first)
+{
+    long position = file->block_start_pos;
+    uint64_t records = file->records_in_block;
+    gtid_pos_t last = *first;
+    json_t *row;
+
+    if (file->records_read_from_block < records &&
+        maxavro_record_seek(file, records - file->records_read_from_block - 1) &&
+        (row = maxavro_record_read_json(file)))
+    {
+        set_gtid(&last, row);
+        json_decref(row);
+    }
+
+    char sql[AVRO_SQL_BUFFER_SIZE];
+    char *errmsg = NULL;
+
+    snprintf(sql, sizeof(sql), block_insert_template, name, position, records,
+             first->domain, first->server_id, first->seq,
+             last.domain, last.server_id, last.seq);
+
+    if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+    {
+        MXS_ERROR("Failed to insert block at position %ld of %s into index database: %s",
+                  position, name, errmsg);
+    }
+    sqlite3_free(errmsg);
+}
+
 int index_query_cb(void *data, int rows, char** values, char** names)
 {
     for (int i = 0; i < rows; i++)
@@ -115,6 +163,7 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
                 {
                     gtid_pos_t gtid;
                     set_gtid(&gtid, row);
+                    json_decref(row);
 
                     if (prev_gtid.domain != gtid.domain ||
                         prev_gtid.server_id != gtid.server_id ||
@@ -134,6 +183,8 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
                         errmsg = NULL;
                         prev_gtid = gtid;
                     }
+
+                    index_block(router, file, name, &gtid);
                 }
                 else
                 {
@@ -257,6 +257,10 @@ createInstance(SERVICE *service, char **options)
     inst->short_burst = DEF_SHORT_BURST;
     inst->long_burst = DEF_LONG_BURST;
     inst->burst_size = DEF_BURST_SIZE;
+    inst->event_cache_size = DEF_EVENT_CACHE_SIZE;
+    inst->binlog_sync = BLR_SYNC_TRANSACTION;
+    inst->binlog_sync_method = BLR_SYNC_METHOD_FSYNC;
+    inst->write_buffer_size = DEF_BINLOG_WRITE_BUFFER;
     inst->retry_backoff = 1;
     inst->binlogdir = NULL;
     inst->heartbeat = BLR_HEARTBEAT_DEFAULT_INTERVAL;
@@ -469,6 +473,105 @@ createInstance(SERVICE *service, char **options)
                     inst->burst_size = size;
 
                 }
+                else if (strcmp(options[i], "event_cache_size") == 0)
+                {
+                    unsigned long size = strtoul(value, NULL, 10);
+                    char    *ptr = value;
+                    while (*ptr && isdigit(*ptr))
+                    {
+                        ptr++;
+                    }
+                    switch (*ptr)
+                    {
+                    case 'G':
+                    case 'g':
+                        size = size * 1024 * 1024 * 1024;
+                        break;
+                    case 'M':
+                    case 'm':
+                        size = size * 1024 * 1024;
+                        break;
+                    case 'K':
+                    case 'k':
+                        size = size * 1024;
+                        break;
+                    }
+                    inst->event_cache_size = size;
+                }
+                else if (strcmp(options[i], "binlog_sync") == 0)
+                {
+                    if (strcasecmp(value, "event") == 0)
+                    {
+                        inst->binlog_sync = BLR_SYNC_EVENT;
+                    }
+                    else if (strcasecmp(value, "transaction") == 0)
+                    {
+                        inst->binlog_sync = BLR_SYNC_TRANSACTION;
+                    }
+                    else if (strcasecmp(value, "os") == 0)
+                    {
+                        inst->binlog_sync = BLR_SYNC_OS;
+                    }
+                    else
+                    {
+                        char *ptr;
+                        long period = strtol(value, &ptr, 10);
+
+                        if (ptr != value && period > 0 &&
+                            (*ptr == '\0' || strcasecmp(ptr, "ms") == 0))
+                        {
+                            inst->binlog_sync = BLR_SYNC_PERIODIC;
+                            inst->binlog_sync_period = period;
+                        }
+                        else
+                        {
+                            MXS_WARNING("Invalid binlog_sync value %s, expected event, "
+                                        "transaction, os or a period in milliseconds.",
+                                        value);
+                        }
+                    }
+                }
+                else if (strcmp(options[i], "binlog_sync_method") == 0)
+                {
+                    if (strcasecmp(value, "fsync") == 0)
+                    {
+                        inst->binlog_sync_method = BLR_SYNC_METHOD_FSYNC;
+                    }
+                    else if (strcasecmp(value, "fdatasync") == 0)
+                    {
+                        inst->binlog_sync_method = BLR_SYNC_METHOD_FDATASYNC;
+                    }
+                    else if (strcasecmp(value, "sync_file_range") == 0)
+                    {
+                        inst->binlog_sync_method = BLR_SYNC_METHOD_SYNC_FILE_RANGE;
+                    }
+                    else
+                    {
+                        MXS_WARNING("Invalid binlog_sync_method value %s, expected fsync, "
+                                    "fdatasync or sync_file_range.", value);
+                    }
+                }
+                else if (strcmp(options[i], "binlog_write_buffer") == 0)
+                {
+                    unsigned long size = strtoul(value, NULL, 10);
+                    char    *ptr = value;
+                    while (*ptr && isdigit(*ptr))
+                    {
+                        ptr++;
+                    }
+                    switch (*ptr)
+                    {
+                    case 'M':
+                    case 'm':
+                        size = size * 1024 * 1024;
+                        break;
+                    case 'K':
+                    case 'k':
+                        size = size * 1024;
+                        break;
+                    }
+                    inst->write_buffer_size = size;
+                }
                 else if (strcmp(options[i], "heartbeat") == 0)
                 {
                     int h_val = (int)strtol(value, NULL, 10);
@@ -525,6 +628,13 @@ createInstance(SERVICE *service, char **options)
     {
         inst->fileroot = MXS_STRDUP_A(BINLOG_NAME_ROOT);
     }
+
+    if (inst->write_buffer_size &&
+        (inst->write_buffer = MXS_MALLOC(inst->write_buffer_size)) == NULL)
+    {
+        inst->write_buffer_size = 0;
+    }
+
     inst->active_logs = 0;
     inst->reconnect_pending = 0;
     inst->handling_threads = 0;
@@ -846,6 +956,7 @@ free_instance(ROUTER_INSTANCE *instance)
     MXS_FREE(instance->set_master_hostname);
     MXS_FREE(instance->fileroot);
     MXS_FREE(instance->binlogdir);
+    MXS_FREE(instance->write_buffer);
     /* SSL options */
     MXS_FREE(instance->ssl_ca);
     MXS_FREE(instance->ssl_cert);
@@ -1279,6 +1390,51 @@ diagnostics(ROUTER *router, DCB *dcb)
                router_inst->stats.n_reads != 0 ?
                ((double)router_inst->stats.n_binlogs / router_inst->stats.n_reads) : 0);
 
+    if (router_inst->binlog_sync == BLR_SYNC_PERIODIC)
+    {
+        dcb_printf(dcb, "\tBinlog sync policy:                          every %lu ms\n",
+                   router_inst->binlog_sync_period);
+    }
+    else
+    {
+        dcb_printf(dcb, "\tBinlog sync policy:                          %s\n",
+                   router_inst->binlog_sync == BLR_SYNC_EVENT ? "event" :
+                   router_inst->binlog_sync == BLR_SYNC_TRANSACTION ? "transaction" : "os");
+    }
+    dcb_printf(dcb, "\tBinlog sync method:                          %s\n",
+               router_inst->binlog_sync_method == BLR_SYNC_METHOD_FDATASYNC ? "fdatasync" :
+               router_inst->binlog_sync_method == BLR_SYNC_METHOD_SYNC_FILE_RANGE ?
+               "sync_file_range" : "fsync");
+    dcb_printf(dcb, "\tBinlog write buffer size:                    %lu\n",
+               router_inst->write_buffer_size);
+    dcb_printf(dcb, "\tNumber of binlog file writes:                %lu\n",
+               router_inst->stats.n_binlog_writes);
+    dcb_printf(dcb, "\tNumber of binlog file syncs:                 %lu\n",
+               router_inst->stats.n_binlog_syncs);
+    dcb_printf(dcb, "\tAverage events per binlog file write:        %.1f\n",
+               router_inst->stats.n_binlog_writes != 0 ?
+               ((double)router_inst->stats.n_binlogs / router_inst->stats.n_binlog_writes) : 0);
+
+    if (router_inst->cache.records)
+    {
+        spinlock_acquire(&router_inst->cache.lock);
+        int cache_events = router_inst->cache.cnt;
+        unsigned long cache_bytes = router_inst->cache.bytes;
+        uint64_t cache_hits = router_inst->stats.n_cachehits;
+        uint64_t cache_misses = router_inst->stats.n_cachemisses;
+        spinlock_release(&router_inst->cache.lock);
+
+        dcb_printf(dcb, "\tBinlog event cache size:                     %lu\n",
+                   router_inst->event_cache_size);
+        dcb_printf(dcb, "\tEvents in binlog event cache:                %d\n", cache_events);
+        dcb_printf(dcb, "\tBytes in binlog event cache:                 %lu\n", cache_bytes);
+        dcb_printf(dcb, "\tNo. of binlog event cache hits:              %lu\n", cache_hits);
+        dcb_printf(dcb, "\tNo. of binlog event cache misses:            %lu\n", cache_misses);
+        dcb_printf(dcb, "\tBinlog event cache hit ratio:                %.1f%%\n",
+                   cache_hits + cache_misses != 0 ?
+                   (100.0 * cache_hits / (cache_hits + cache_misses)) : 0);
+    }
+
     spinlock_acquire(&router_inst->lock);
     if (router_inst->stats.lastReply)
     {
@@ -1493,6 +1649,20 @@ diagnostics(ROUTER *router, DCB *dcb)
                        session->stats.n_dcb);
             dcb_printf(dcb, "\t\tNo. of failed reads                      %u\n",
                        session->stats.n_failed_read);
+            if (router_inst->cache.records)
+            {
+                int lag = blr_cache_lag(router_inst, session->binlogfile, session->binlog_pos);
+
+                if (lag >= 0)
+                {
+                    dcb_printf(dcb, "\t\tEvents behind in binlog event cache:     %d\n", lag);
+                }
+                else
+                {
+                    dcb_printf(dcb, "\t\tEvents behind in binlog event cache:     "
+                               "not in cache\n");
+                }
+            }
 
 #ifdef DETAILED_DIAG
             dcb_printf(dcb, "\t\tNo. of nested distribute events          %u\n",
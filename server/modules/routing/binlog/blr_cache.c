@@ -46,16 +46,360 @@
 #include <skygw_types.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
+#include <maxscale/alloc.h>
 
 
+static uint32_t cache_file_seq(BLCACHE *cache, const char *binlog);
+static int cache_find(BLCACHE *cache, uint32_t file, unsigned long pos);
+static void cache_drop_oldest(BLCACHE *cache);
+static void cache_drop_newest(BLCACHE *cache);
+
 /**
- * Initialise the cache for this instanceof the binlog router. As a side
- * effect also determine the binlog file to read and the position to read
- * from.
+ * Initialise the binlog event cache for this instance of the binlog router.
+ *
+ * The cache is a ring of the latest events distributed to the slaves. Slaves
+ * in catchup mode that are only slightly behind the master read the events
+ * from the cache instead of the binlog file. The size of the ring is derived
+ * from the event_cache_size option, a size of zero disables the cache.
+ * The events of an already initialised cache are freed.
  *
  * @param   router      The router instance
  */
 void
 blr_init_cache(ROUTER_INSTANCE *router)
 {
+    BLCACHE *cache = &router->cache;
+
+    /** Release the events of a previous cache */
+    if (cache->records)
+    {
+        while (cache->cnt > 0)
+        {
+            cache_drop_oldest(cache);
+        }
+
+        MXS_FREE(cache->records);
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    spinlock_init(&cache->lock);
+
+    if (router->event_cache_size == 0)
+    {
+        return;
+    }
+
+    unsigned long size = router->event_cache_size / BLCACHE_AVG_EVENT_SIZE;
+
+    if (size < BLCACHE_MIN_RECORDS)
+    {
+        size = BLCACHE_MIN_RECORDS;
+    }
+
+    if ((cache->records = MXS_CALLOC(size, sizeof(BLCACHE_RECORD))) == NULL)
+    {
+        MXS_ERROR("%s: Failed to allocate the binlog event cache, "
+                  "slaves will read all events from the binlog files.",
+                  router->service->name);
+        return;
+    }
+
+    cache->size = size;
+    cache->max_bytes = router->event_cache_size;
+}
+
+/**
+ * Add an event that has been written to the binlog file to the cache.
+ *
+ * The event is copied into a buffer of its own that is shared with the slaves
+ * that later read it. The oldest events are dropped when the cache is full.
+ * Rotate events are not cached, the slaves read them from the binlog file.
+ *
+ * @param router    The router instance
+ * @param binlog    The binlog file the event was written to
+ * @param hdr       The replication event header
+ * @param ptr       The raw replication event data
+ */
+void
+blr_cache_add(ROUTER_INSTANCE *router, const char *binlog, REP_HEADER *hdr, uint8_t *ptr)
+{
+    BLCACHE *cache = &router->cache;
+
+    if (cache->records == NULL ||
+        hdr->event_type == ROTATE_EVENT ||
+        hdr->event_size > cache->max_bytes ||
+        hdr->next_pos < hdr->event_size)
+    {
+        return;
+    }
+
+    unsigned long pos = hdr->next_pos - hdr->event_size;
+    GWBUF *pkt = gwbuf_alloc_and_load(hdr->event_size, ptr);
+
+    if (pkt == NULL)
+    {
+        return;
+    }
+
+    spinlock_acquire(&cache->lock);
+
+    if (cache->file_seq == 0 ||
+        strcmp(cache->files[cache->file_seq % BLCACHE_FILES], binlog) != 0)
+    {
+        /** A new binlog file, its name replaces the oldest one */
+        cache->file_seq++;
+        strcpy(cache->files[cache->file_seq % BLCACHE_FILES], binlog);
+
+        while (cache->cnt > 0 &&
+               cache->records[cache->first].file + BLCACHE_FILES <= cache->file_seq)
+        {
+            cache_drop_oldest(cache);
+        }
+    }
+
+    /** Keep the ring ordered if an event is added again */
+    while (cache->cnt > 0)
+    {
+        BLCACHE_RECORD *last = &cache->records[(cache->first + cache->cnt - 1) % cache->size];
+
+        if (last->file != cache->file_seq || last->position < pos)
+        {
+            break;
+        }
+
+        cache_drop_newest(cache);
+    }
+
+    while (cache->cnt > 0 &&
+           (cache->cnt == cache->size || cache->bytes + hdr->event_size > cache->max_bytes))
+    {
+        cache_drop_oldest(cache);
+    }
+
+    BLCACHE_RECORD *record = &cache->records[(cache->first + cache->cnt) % cache->size];
+    record->file = cache->file_seq;
+    record->position = pos;
+    record->pkt = pkt;
+    record->hdr = *hdr;
+    record->hdr.ok = SLAVE_POS_READ_OK;
+
+    cache->cnt++;
+    cache->bytes += hdr->event_size;
+
+    spinlock_release(&cache->lock);
+}
+
+/**
+ * Read an event from the cache.
+ *
+ * The returned buffer is a clone of the cached one, the event data is not
+ * copied. The caller must not modify the data and must free the buffer.
+ *
+ * @param router    The router instance
+ * @param binlog    The binlog file name
+ * @param pos       The position of the event
+ * @param hdr       Binlog header to populate
+ * @return The event or NULL if it is not in the cache
+ */
+GWBUF *
+blr_cache_read(ROUTER_INSTANCE *router, const char *binlog, unsigned long pos, REP_HEADER *hdr)
+{
+    BLCACHE *cache = &router->cache;
+    GWBUF *rval = NULL;
+
+    if (cache->records == NULL)
+    {
+        return NULL;
+    }
+
+    spinlock_acquire(&cache->lock);
+
+    uint32_t file = cache_file_seq(cache, binlog);
+    int i = file ? cache_find(cache, file, pos) : -1;
+
+    if (i >= 0)
+    {
+        BLCACHE_RECORD *record = &cache->records[(cache->first + i) % cache->size];
+
+        if ((rval = gwbuf_clone(record->pkt)) != NULL)
+        {
+            *hdr = record->hdr;
+        }
+    }
+
+    if (rval)
+    {
+        router->stats.n_cachehits++;
+    }
+    else
+    {
+        router->stats.n_cachemisses++;
+    }
+
+    spinlock_release(&cache->lock);
+
+    return rval;
+}
+
+/**
+ * Return how many events a slave is behind the latest cached event, if the
+ * position of the slave is in the cache.
+ *
+ * @param router    The router instance
+ * @param binlog    The binlog file of the slave
+ * @param pos       The binlog position of the slave
+ * @return The number of cached events the slave has not read or -1 if the
+ *         position is not in the cache
+ */
+int
+blr_cache_lag(ROUTER_INSTANCE *router, const char *binlog, unsigned long pos)
+{
+    BLCACHE *cache = &router->cache;
+    int rval = -1;
+
+    if (cache->records == NULL)
+    {
+        return -1;
+    }
+
+    spinlock_acquire(&cache->lock);
+
+    uint32_t file = cache_file_seq(cache, binlog);
+
+    if (file && cache->cnt > 0)
+    {
+        BLCACHE_RECORD *last = &cache->records[(cache->first + cache->cnt - 1) % cache->size];
+
+        if (last->file == file && last->hdr.next_pos == pos)
+        {
+            rval = 0;
+        }
+        else
+        {
+            int i = cache_find(cache, file, pos);
+
+            if (i >= 0)
+            {
+                rval = cache->cnt - i;
+            }
+        }
+    }
+
+    spinlock_release(&cache->lock);
+
+    return rval;
+}
+
+/**
+ * Remove all events from the cache if it contains events of a binlog file.
+ * Used when a binlog file is created again and the cached events are stale.
+ *
+ * @param router    The router instance
+ * @param binlog    The binlog file name
+ */
+void
+blr_cache_invalidate(ROUTER_INSTANCE *router, const char *binlog)
+{
+    BLCACHE *cache = &router->cache;
+
+    if (cache->records == NULL)
+    {
+        return;
+    }
+
+    spinlock_acquire(&cache->lock);
+
+    if (cache_file_seq(cache, binlog))
+    {
+        while (cache->cnt > 0)
+        {
+            cache_drop_oldest(cache);
+        }
+
+        /** Forget the names so that the file gets a new sequence number */
+        memset(cache->files, 0, sizeof(cache->files));
+    }
+
+    spinlock_release(&cache->lock);
+}
+
+/**
+ * Find the sequence number of a binlog file in the cache.
+ *
+ * @param cache     The binlog cache
+ * @param binlog    The binlog file name
+ * @return The sequence number or 0 if the file is not in the cache
+ */
+static uint32_t
+cache_file_seq(BLCACHE *cache, const char *binlog)
+{
+    for (uint32_t seq = cache->file_seq; seq > 0 && cache->file_seq - seq < BLCACHE_FILES; seq--)
+    {
+        if (strcmp(cache->files[seq % BLCACHE_FILES], binlog) == 0)
+        {
+            return seq;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Binary search for a record in the ring.
+ *
+ * @param cache     The binlog cache
+ * @param file      The sequence number of the binlog file
+ * @param pos       The position of the event
+ * @return The index of the record counted from the oldest one or -1 if the
+ *         record is not found
+ */
+static int
+cache_find(BLCACHE *cache, uint32_t file, unsigned long pos)
+{
+    int low = 0;
+    int high = cache->cnt - 1;
+
+    while (low <= high)
+    {
+        int mid = low + (high - low) / 2;
+        BLCACHE_RECORD *record = &cache->records[(cache->first + mid) % cache->size];
+
+        if (record->file < file || (record->file == file && record->position < pos))
+        {
+            low = mid + 1;
+        }
+        else if (record->file == file && record->position == pos)
+        {
+            return mid;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+
+    return -1;
+}
+
+static void
+cache_drop_oldest(BLCACHE *cache)
+{
+    BLCACHE_RECORD *record = &cache->records[cache->first];
+
+    cache->bytes -= record->hdr.event_size;
+    gwbuf_free(record->pkt);
+    record->pkt = NULL;
+    cache->first = (cache->first + 1) % cache->size;
+    cache->cnt--;
+}
+
+static void
+cache_drop_newest(BLCACHE *cache)
+{
+    BLCACHE_RECORD *record = &cache->records[(cache->first + cache->cnt - 1) % cache->size];
+
+    cache->bytes -= record->hdr.event_size;
+    gwbuf_free(record->pkt);
+    record->pkt = NULL;
+    cache->cnt--;
 }
@@ -259,6 +259,8 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
     {
         if (blr_file_add_magic(fd))
         {
+            /* Write the buffered events of the previous file */
+            blr_file_commit(router);
             close(router->binlog_fd);
             spinlock_acquire(&router->binlog_lock);
             strcpy(router->binlog_name, file);
@@ -267,8 +269,12 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
             router->binlog_position = BINLOG_MAGIC_SIZE;
             router->current_safe_event = BINLOG_MAGIC_SIZE;
             router->last_written = BINLOG_MAGIC_SIZE;
+            router->last_synced = 0;
             spinlock_release(&router->binlog_lock);
 
+            /** Cached events of an earlier file with the same name are stale */
+            blr_cache_invalidate(router, file);
+
             created = 1;
         }
         else
@@ -316,10 +322,13 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
         return;
     }
     fsync(fd);
+    blr_file_commit(router);
     close(router->binlog_fd);
     spinlock_acquire(&router->binlog_lock);
     memmove(router->binlog_name, file, BINLOG_FNAMELEN);
     router->current_pos = lseek(fd, 0L, SEEK_END);
+    router->last_written = router->current_pos;
+    router->last_synced = router->current_pos;
     if (router->current_pos < 4)
     {
         if (router->current_pos == 0)
@@ -354,6 +363,10 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
 /**
  * Write a binlog entry to disk.
  *
+ * If the router has a write buffer, the event is only copied to it and the
+ * buffered events are written with one write when the buffer is full or when
+ * blr_file_commit is called at a transaction boundary.
+ *
  * @param router The router instance
  * @param buf    The binlog record
  * @param len    The length of the binlog record
@@ -364,42 +377,230 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
 {
     int n;
 
-    if ((n = pwrite(router->binlog_fd, buf, size,
-                    router->last_written)) != size)
+    if (router->write_buffer && size <= router->write_buffer_size)
     {
-        char err_msg[STRERROR_BUFLEN];
-        MXS_ERROR("%s: Failed to write binlog record at %lu of %s, %s. "
-                  "Truncating to previous record.",
-                  router->service->name, router->last_written,
-                  router->binlog_name,
-                  strerror_r(errno, err_msg, sizeof(err_msg)));
-        /* Remove any partial event that was written */
-        if (ftruncate(router->binlog_fd, router->last_written))
+        if (router->write_buffer_len + size > router->write_buffer_size &&
+            !blr_file_write_buffered(router))
         {
-            MXS_ERROR("%s: Failed to truncate binlog record at %lu of %s, %s. ",
+            return 0;
+        }
+
+        memcpy(router->write_buffer + router->write_buffer_len, buf, size);
+        router->write_buffer_len += size;
+        n = size;
+    }
+    else
+    {
+        if (!blr_file_write_buffered(router))
+        {
+            return 0;
+        }
+
+        if ((n = pwrite(router->binlog_fd, buf, size,
+                        router->last_written)) != size)
+        {
+            char err_msg[STRERROR_BUFLEN];
+            MXS_ERROR("%s: Failed to write binlog record at %lu of %s, %s. "
+                      "Truncating to previous record.",
                       router->service->name, router->last_written,
                       router->binlog_name,
                       strerror_r(errno, err_msg, sizeof(err_msg)));
+            /* Remove any partial event that was written */
+            if (ftruncate(router->binlog_fd, router->last_written))
+            {
+                MXS_ERROR("%s: Failed to truncate binlog record at %lu of %s, %s. ",
+                          router->service->name, router->last_written,
+                          router->binlog_name,
+                          strerror_r(errno, err_msg, sizeof(err_msg)));
+            }
+            return 0;
         }
-        return 0;
+        router->stats.n_binlog_writes++;
     }
     spinlock_acquire(&router->binlog_lock);
     router->current_pos = hdr->next_pos;
     router->last_written += size;
     router->last_event_pos = hdr->next_pos - hdr->event_size;
     spinlock_release(&router->binlog_lock);
+
+    if (router->binlog_sync == BLR_SYNC_EVENT && !blr_file_commit(router))
+    {
+        return 0;
+    }
+
     return n;
 }
 
 /**
- * Flush the content of the binlog file to disk.
+ * Write the events in the write buffer to the binlog file.
+ *
+ * If the write fails, the partially written data is removed and the binlog
+ * position is moved back to the end of the previously written events.
+ *
+ * @param router    The router instance
+ * @return          True if the buffer is empty or was written
+ */
+bool
+blr_file_write_buffered(ROUTER_INSTANCE *router)
+{
+    if (router->write_buffer_len == 0)
+    {
+        return true;
+    }
+
+    uint64_t offset = router->last_written - router->write_buffer_len;
+    ssize_t n = pwrite(router->binlog_fd, router->write_buffer, router->write_buffer_len, offset);
+
+    if (n != router->write_buffer_len)
+    {
+        char err_msg[STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to write %lu bytes of binlog records at %lu of %s, %s. "
+                  "Truncating to previous record.",
+                  router->service->name, router->write_buffer_len, offset,
+                  router->binlog_name,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        /* Remove any partial event that was written */
+        if (ftruncate(router->binlog_fd, offset))
+        {
+            MXS_ERROR("%s: Failed to truncate binlog record at %lu of %s, %s. ",
+                      router->service->name, offset,
+                      router->binlog_name,
+                      strerror_r(errno, err_msg, sizeof(err_msg)));
+        }
+
+        spinlock_acquire(&router->binlog_lock);
+        router->current_pos = offset;
+        router->last_written = offset;
+        spinlock_release(&router->binlog_lock);
+
+        router->write_buffer_len = 0;
+        return false;
+    }
+
+    router->write_buffer_len = 0;
+    router->stats.n_binlog_writes++;
+    return true;
+}
+
+/**
+ * Return the time in milliseconds from a monotonic clock
+ */
+static uint64_t
+blr_file_time_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Sync the written part of the binlog file to disk with the configured method.
+ *
+ * @param router    The router instance
+ */
+static void
+blr_file_sync(ROUTER_INSTANCE *router)
+{
+    uint64_t written = router->last_written - router->write_buffer_len;
+    int rc;
+
+    switch (router->binlog_sync_method)
+    {
+    case BLR_SYNC_METHOD_FDATASYNC:
+        rc = fdatasync(router->binlog_fd);
+        break;
+
+    case BLR_SYNC_METHOD_SYNC_FILE_RANGE:
+        rc = sync_file_range(router->binlog_fd, router->last_synced,
+                             written > router->last_synced ? written - router->last_synced : 0,
+                             SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                             SYNC_FILE_RANGE_WAIT_AFTER);
+        break;
+
+    default:
+        rc = fsync(router->binlog_fd);
+        break;
+    }
+
+    if (rc == -1)
+    {
+        char err_msg[STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to sync binlog file %s, %s.",
+                  router->service->name, router->binlog_name,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+    }
+
+    router->last_synced = written;
+    router->last_sync_time = blr_file_time_ms();
+    router->stats.n_binlog_syncs++;
+}
+
+/**
+ * Check whether the sync policy requires a sync now.
+ *
+ * @param router    The router instance
+ * @param boundary  Whether a transaction has been written
+ * @return          True if the binlog file should be synced
+ */
+static bool
+blr_file_sync_due(ROUTER_INSTANCE *router, bool boundary)
+{
+    switch (router->binlog_sync)
+    {
+    case BLR_SYNC_EVENT:
+        return true;
+
+    case BLR_SYNC_TRANSACTION:
+        return boundary;
+
+    case BLR_SYNC_PERIODIC:
+        return blr_file_time_ms() - router->last_sync_time >= router->binlog_sync_period;
+
+    default:
+        return false;
+    }
+}
+
+/**
+ * Write the buffered events to the binlog file and sync it if the sync
+ * policy requires it. This is called at transaction boundaries, before the
+ * written events are made available to the slaves.
+ *
+ * @param router    The router instance
+ * @return          True if the events were written
+ */
+bool
+blr_file_commit(ROUTER_INSTANCE *router)
+{
+    if (!blr_file_write_buffered(router))
+    {
+        return false;
+    }
+
+    if (router->last_written > router->last_synced && blr_file_sync_due(router, true))
+    {
+        blr_file_sync(router);
+    }
+
+    return true;
+}
+
+/**
+ * Flush the content of the binlog file to disk if the sync policy requires
+ * it. Events of an open transaction are written only if the sync period has
+ * passed.
  *
  * @param   router  The binlog router
  */
 void
 blr_file_flush(ROUTER_INSTANCE *router)
 {
-    fsync(router->binlog_fd);
+    if (router->binlog_sync != BLR_SYNC_TRANSACTION &&
+        router->last_written > router->last_synced &&
+        blr_file_sync_due(router, false))
+    {
+        blr_file_commit(router);
+    }
 }
 
 /**
@@ -452,7 +653,6 @@ blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
     }
     strcpy(file->binlogname, binlog);
     file->refcnt = 1;
-    file->cache = 0;
     spinlock_init(&file->lock);
 
     strcpy(path, router->binlogdir);
@@ -580,6 +780,12 @@ blr_read_binlog(ROUTER_INSTANCE *router, BLFILE *file, unsigned long pos, REP_HE
     spinlock_release(&file->lock);
     spinlock_release(&router->binlog_lock);
 
+    /* Recently distributed events are read from the cache */
+    if ((result = blr_cache_read(router, file->binlogname, pos, hdr)) != NULL)
+    {
+        return result;
+    }
+
     /* Read the header information from the file */
     if ((n = pread(file->fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
     {
@@ -1635,6 +1635,25 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                             }
                         }
 
+                        /*
+                         * The buffered events are written to the binlog file when
+                         * they become visible to the slaves or are acknowledged
+                         * to the master
+                         */
+                        if ((router->trx_safe == 0 ||
+                             router->pending_transaction != BLRM_TRANSACTION_START ||
+                             semi_sync_send_ack == BLR_MASTER_SEMI_SYNC_ACK_REQ) &&
+                            !blr_file_commit(router))
+                        {
+                            while ((pkt = gwbuf_consume(pkt, GWBUF_LENGTH(pkt))) != NULL)
+                            {
+                                ;
+                            }
+                            blr_master_close(router);
+                            blr_master_delayed_connect(router);
+                            return;
+                        }
+
                         /* Handle semi-sync request fom master */
                         if (router->master_semi_sync != MASTER_SEMISYNC_NOT_AVAILABLE &&
                             semi_sync_send_ack == BLR_MASTER_SEMI_SYNC_ACK_REQ &&
@@ -2048,6 +2067,9 @@ blr_distribute_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint8_t *
     int action;
     unsigned int cstate;
 
+    /** Slaves in catchup mode read the latest events from the cache */
+    blr_cache_add(router, router->binlog_name, hdr, ptr);
+
     spinlock_acquire(&router->lock);
     slave = router->slaves;
     while (slave)
@@ -2804,6 +2826,12 @@ blr_write_data_into_binlog(ROUTER_INSTANCE *router, uint32_t data_len, uint8_t *
 {
     int n;
 
+    /** The buffered events precede this data in the file */
+    if (!blr_file_write_buffered(router))
+    {
+        return 0;
+    }
+
     if ((n = pwrite(router->binlog_fd, buf, data_len,
                     router->last_written)) != data_len)
     {
@@ -2825,6 +2853,7 @@ blr_write_data_into_binlog(ROUTER_INSTANCE *router, uint32_t data_len, uint8_t *
         return 0;
     }
     router->last_written += data_len;
+    router->stats.n_binlog_writes++;
     return n;
 }
 
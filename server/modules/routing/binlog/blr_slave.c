@@ -2829,7 +2829,7 @@ blr_slave_send_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     BLFILE *file;
     REP_HEADER hdr;
     GWBUF *record, *head;
-    uint8_t *ptr;
+    uint8_t *ptr, *event;
     uint32_t chksum;
     char err_msg[BINLOG_ERROR_MSG_LEN + 1];
 
@@ -2857,14 +2857,24 @@ blr_slave_send_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
         return;
     }
     blr_close_binlog(router, file);
-    head = gwbuf_alloc(5);
+
+    /**
+     * The record may be shared with the binlog event cache, the event is
+     * modified in a copy of its own.
+     */
+    if ((head = gwbuf_alloc(5 + hdr.event_size)) == NULL)
+    {
+        gwbuf_free(record);
+        return;
+    }
     ptr = GWBUF_DATA(head);
     encode_value(ptr, hdr.event_size + 1, 24); // Payload length
     ptr += 3;
     *ptr++ = slave->seqno++;
     *ptr++ = 0;     // OK
-    head = gwbuf_append(head, record);
-    ptr = GWBUF_DATA(record);
+    memcpy(ptr, GWBUF_DATA(record), hdr.event_size);
+    gwbuf_free(record);
+    event = ptr;
     encode_value(ptr, time(0), 32);     // Overwrite timestamp
     ptr += 13;
     encode_value(ptr, 0, 32);       // Set next position to 0
@@ -2875,9 +2885,9 @@ blr_slave_send_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
      * calculate a new checksum
      * and write it into the header
      */
-    ptr = GWBUF_DATA(record) + hdr.event_size - 4;
+    ptr = event + hdr.event_size - 4;
     chksum = crc32(0L, NULL, 0);
-    chksum = crc32(chksum, GWBUF_DATA(record), hdr.event_size - 4);
+    chksum = crc32(chksum, event, hdr.event_size - 4);
     encode_value(ptr, chksum, 32);
 
     slave->dcb->func.write(slave->dcb, head);
@@ -3864,6 +3874,9 @@ int blr_handle_change_master(ROUTER_INSTANCE* router, char *command, char *error
         }
         else
         {
+            /* write any buffered events to the current binlog file */
+            blr_file_commit(router);
+
             /* set new filename at pos 4 */
             strcpy(router->binlog_name, master_logfile);
 
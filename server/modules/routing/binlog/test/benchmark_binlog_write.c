@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file benchmark_binlog_write.c - Benchmark of the binlog write and sync policies
+ *
+ * Replays a recorded binlog file through the write path of the binlog router
+ * with a set of binlog_sync policies and reports for each policy
+ * - events/s and MB/s:  the replay throughput
+ * - writes and syncs:   the number of write and sync calls
+ * - window.max_ms and window.avg_ms: how long written events waited for a sync,
+ *                       the durability window of the policy
+ * - unsynced.max_bytes: the most data that was not synced at any time
+ * - unsynced.end_bytes: the data left for the operating system to write when
+ *                       the replay ended
+ *
+ * The events are fed to the router as the master connection does: a transaction
+ * is committed when its COMMIT or XID event has been written and the sync policy
+ * is applied after every read of read_size bytes of events.
+ *
+ * Usage: benchmark_binlog_write binlog [directory [policy[/method] ...]]
+ *
+ * The policy is one of event, transaction, os or a period in milliseconds and
+ * the method one of fsync, fdatasync or sync_file_range. The replayed file is
+ * written to the directory, /tmp by default.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <service.h>
+#include <spinlock.h>
+#include <blr.h>
+#include <log_manager.h>
+#include <maxscale/alloc.h>
+
+#define READ_SIZE 16384
+
+/** The transaction states of the master connection, see blr_master.c */
+enum
+{
+    NO_TRANSACTION,
+    TRANSACTION_START,
+    COMMIT_SEEN
+};
+
+static const char *default_policies[] =
+{
+    "event", "transaction", "transaction/fdatasync", "10", "100", "os"
+};
+
+#define N_DEFAULT_POLICIES (sizeof(default_policies) / sizeof(default_policies[0]))
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static bool
+set_policy(ROUTER_INSTANCE *router, const char *policy)
+{
+    const char *method = strchr(policy, '/');
+    size_t len = method ? method - policy : strlen(policy);
+
+    if (strncasecmp(policy, "event", len) == 0)
+    {
+        router->binlog_sync = BLR_SYNC_EVENT;
+    }
+    else if (strncasecmp(policy, "transaction", len) == 0)
+    {
+        router->binlog_sync = BLR_SYNC_TRANSACTION;
+    }
+    else if (strncasecmp(policy, "os", len) == 0)
+    {
+        router->binlog_sync = BLR_SYNC_OS;
+    }
+    else if (atoi(policy) > 0)
+    {
+        router->binlog_sync = BLR_SYNC_PERIODIC;
+        router->binlog_sync_period = atoi(policy);
+    }
+    else
+    {
+        return false;
+    }
+
+    router->binlog_sync_method = BLR_SYNC_METHOD_FSYNC;
+
+    if (method)
+    {
+        if (strcasecmp(method + 1, "fdatasync") == 0)
+        {
+            router->binlog_sync_method = BLR_SYNC_METHOD_FDATASYNC;
+        }
+        else if (strcasecmp(method + 1, "sync_file_range") == 0)
+        {
+            router->binlog_sync_method = BLR_SYNC_METHOD_SYNC_FILE_RANGE;
+        }
+        else if (strcasecmp(method + 1, "fsync") != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Check whether a query event starts or ends a transaction.
+ */
+static int
+query_state(uint8_t *event, uint32_t size, int state)
+{
+    /** Fixed part of the query event, then the status variables and the database */
+    uint32_t offset = BINLOG_EVENT_HDR_LEN + 13 + extract_field(event + BINLOG_EVENT_HDR_LEN + 11, 16) +
+                      event[BINLOG_EVENT_HDR_LEN + 8] + 1;
+
+    if (offset + 5 <= size && strncasecmp((char *)event + offset, "BEGIN", 5) == 0)
+    {
+        return TRANSACTION_START;
+    }
+    else if (offset + 6 <= size && strncasecmp((char *)event + offset, "COMMIT", 6) == 0)
+    {
+        return COMMIT_SEEN;
+    }
+
+    return state == TRANSACTION_START ? TRANSACTION_START : NO_TRANSACTION;
+}
+
+static int
+replay(const char *name, uint8_t *data, size_t size, const char *directory)
+{
+    static SERVICE service;
+    ROUTER_INSTANCE *router = MXS_CALLOC(1, sizeof(ROUTER_INSTANCE));
+    char path[PATH_MAX + 1];
+    uint8_t magic[] = BINLOG_MAGIC;
+
+    MXS_ABORT_IF_NULL(router);
+    service.name = (char *)name;
+    router->service = &service;
+    spinlock_init(&router->binlog_lock);
+    strcpy(router->binlog_name, "benchmark.000001");
+
+    if (!set_policy(router, name))
+    {
+        fprintf(stderr, "Invalid policy: %s\n", name);
+        MXS_FREE(router);
+        return 1;
+    }
+
+    router->write_buffer_size = DEF_BINLOG_WRITE_BUFFER;
+    router->write_buffer = MXS_MALLOC(router->write_buffer_size);
+    MXS_ABORT_IF_NULL(router->write_buffer);
+
+    snprintf(path, sizeof(path), "%s/%s", directory, router->binlog_name);
+
+    if ((router->binlog_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666)) == -1 ||
+        write(router->binlog_fd, magic, BINLOG_MAGIC_SIZE) != BINLOG_MAGIC_SIZE)
+    {
+        perror(path);
+        MXS_FREE(router->write_buffer);
+        MXS_FREE(router);
+        return 1;
+    }
+
+    router->current_pos = BINLOG_MAGIC_SIZE;
+    router->last_written = BINLOG_MAGIC_SIZE;
+
+    int state = NO_TRANSACTION;
+    uint64_t events = 0;
+    uint64_t syncs = 0;
+    uint64_t windows = 0;
+    uint64_t unsynced_max = 0;
+    double window_sum = 0;
+    double window_max = 0;
+    double unsynced_since = 0;
+    size_t read_end = READ_SIZE;
+    size_t pos = BINLOG_MAGIC_SIZE;
+    int rval = 0;
+    double start = now();
+
+    while (pos + BINLOG_EVENT_HDR_LEN <= size)
+    {
+        uint8_t *event = data + pos;
+        REP_HEADER hdr;
+
+        hdr.timestamp = EXTRACT32(event);
+        hdr.event_type = event[4];
+        hdr.serverid = EXTRACT32(event + 5);
+        hdr.event_size = extract_field(event + 9, 32);
+        hdr.next_pos = EXTRACT32(event + 13);
+        hdr.flags = EXTRACT16(event + 17);
+
+        if (hdr.event_size < BINLOG_EVENT_HDR_LEN || pos + hdr.event_size > size)
+        {
+            fprintf(stderr, "Invalid event at position %lu\n", pos);
+            rval = 1;
+            break;
+        }
+
+        if (hdr.event_type == QUERY_EVENT)
+        {
+            state = query_state(event, hdr.event_size, state);
+        }
+        else if (hdr.event_type == XID_EVENT)
+        {
+            state = COMMIT_SEEN;
+        }
+
+        /** The event is not durable until the next sync */
+        if (unsynced_since == 0)
+        {
+            unsynced_since = now();
+        }
+
+        if (blr_write_binlog_record(router, &hdr, hdr.event_size, event) == 0 ||
+            (state != TRANSACTION_START && !blr_file_commit(router)))
+        {
+            rval = 1;
+            break;
+        }
+
+        if (state == COMMIT_SEEN)
+        {
+            state = NO_TRANSACTION;
+        }
+
+        events++;
+        pos += hdr.event_size;
+
+        if (pos >= read_end)
+        {
+            blr_file_flush(router);
+            read_end = pos + READ_SIZE;
+        }
+
+        unsynced_max = MAX(unsynced_max, router->last_written - router->last_synced);
+
+        if (router->stats.n_binlog_syncs != syncs)
+        {
+            double t = now();
+
+            syncs = router->stats.n_binlog_syncs;
+            window_sum += t - unsynced_since;
+            window_max = MAX(window_max, t - unsynced_since);
+            windows++;
+            unsynced_since = router->last_written > router->last_synced ? t : 0;
+        }
+    }
+
+    blr_file_commit(router);
+
+    double elapsed = now() - start;
+
+    printf("%s.events: %lu\n", name, events);
+    printf("%s.events/s: %.0f\n", name, events / elapsed);
+    printf("%s.MB/s: %.1f\n", name, pos / elapsed / (1024 * 1024));
+    printf("%s.writes: %lu\n", name, router->stats.n_binlog_writes);
+    printf("%s.syncs: %lu\n", name, router->stats.n_binlog_syncs);
+
+    printf("%s.window.max_ms: %.3f\n", name, window_max * 1000);
+    printf("%s.window.avg_ms: %.3f\n", name, windows ? window_sum * 1000 / windows : 0);
+    printf("%s.unsynced.max_bytes: %lu\n", name, unsynced_max);
+    printf("%s.unsynced.end_bytes: %lu\n", name, router->last_written - router->last_synced);
+
+    close(router->binlog_fd);
+    unlink(path);
+    MXS_FREE(router->write_buffer);
+    MXS_FREE(router);
+
+    return rval;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s binlog [directory [policy[/method] ...]]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    uint8_t magic[] = BINLOG_MAGIC;
+
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    uint8_t *data = MXS_MALLOC(st.st_size);
+    MXS_ABORT_IF_NULL(data);
+
+    if (read(fd, data, st.st_size) != st.st_size ||
+        st.st_size < BINLOG_MAGIC_SIZE || memcmp(data, magic, BINLOG_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "%s is not a binlog file\n", argv[1]);
+        close(fd);
+        MXS_FREE(data);
+        return 1;
+    }
+
+    close(fd);
+
+    mxs_log_init(NULL, NULL, MXS_LOG_TARGET_DEFAULT);
+
+    const char *directory = argc > 2 ? argv[2] : "/tmp";
+    int rval = 0;
+
+    if (argc > 3)
+    {
+        for (int i = 3; i < argc; i++)
+        {
+            rval += replay(argv[i], data, st.st_size, directory);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < N_DEFAULT_POLICIES; i++)
+        {
+            rval += replay(default_policies[i], data, st.st_size, directory);
+        }
+    }
+
+    mxs_log_finish();
+    MXS_FREE(data);
+
+    return rval;
+}
@@ -78,6 +78,11 @@ int main(int argc, char **argv) {
 	SERVICE	*service;
 	char *roptions;
 	int tests = 1;
+	REP_HEADER hdr;
+	GWBUF *record;
+	uint8_t event[BLCACHE_AVG_EVENT_SIZE];
+	unsigned long pos;
+	int i;
 
 	roptions = MXS_STRDUP_A("server-id=3,heartbeat=200,binlogdir=/not_exists/my_dir,"
                                 "transaction_safety=1,master_version=5.6.99-common,"
@@ -566,6 +571,90 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
+	/********************************************
+	 *
+	 * Second test suite is about the event cache
+	 *
+	 ********************************************/
+
+	printf("--------- Binlog event cache tests ---------\n");
+
+	tests++;
+
+	/**
+	 * Test 24: the latest events are read from the cache
+	 *
+	 * Expected: the event at the position and its header
+	 */
+	inst->event_cache_size = BLCACHE_MIN_RECORDS * BLCACHE_AVG_EVENT_SIZE;
+	blr_init_cache(inst);
+
+	memset(event, 0, sizeof(event));
+	pos = 4;
+	for (i = 0; i < 2 * BLCACHE_MIN_RECORDS; i++) {
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.event_type = QUERY_EVENT;
+		hdr.event_size = BLCACHE_AVG_EVENT_SIZE;
+		hdr.next_pos = pos + BLCACHE_AVG_EVENT_SIZE;
+		event[0] = i;
+		blr_cache_add(inst, "file.100507", &hdr, event);
+		pos = hdr.next_pos;
+	}
+
+	pos -= BLCACHE_AVG_EVENT_SIZE;
+	record = blr_cache_read(inst, "file.100507", pos, &hdr);
+
+	if (record && hdr.next_pos == pos + BLCACHE_AVG_EVENT_SIZE && hdr.ok == SLAVE_POS_READ_OK &&
+	    GWBUF_LENGTH(record) == BLCACHE_AVG_EVENT_SIZE &&
+	    ((uint8_t *)GWBUF_DATA(record))[0] == (uint8_t)(i - 1)) {
+		printf("Test %d PASSED, event at %lu read from the cache\n", tests, pos);
+	} else {
+		printf("Test %d: reading event at %lu from the cache FAILED\n", tests, pos);
+		return 1;
+	}
+	gwbuf_free(record);
+
+	tests++;
+
+	/**
+	 * Test 25: the oldest events are dropped from a full cache
+	 *
+	 * Expected: a cache miss for the first event, the lag of the oldest cached event
+	 * is the number of cached events
+	 */
+	record = blr_cache_read(inst, "file.100507", 4, &hdr);
+
+	if (record == NULL && inst->stats.n_cachemisses == 1 &&
+	    inst->cache.cnt == BLCACHE_MIN_RECORDS &&
+	    blr_cache_lag(inst, "file.100507", pos + BLCACHE_AVG_EVENT_SIZE) == 0 &&
+	    blr_cache_lag(inst, "file.100507",
+	                  pos - (BLCACHE_MIN_RECORDS - 1) * BLCACHE_AVG_EVENT_SIZE) == BLCACHE_MIN_RECORDS &&
+	    blr_cache_lag(inst, "file.100507", 4) == -1) {
+		printf("Test %d PASSED, oldest events dropped from the cache\n", tests);
+	} else {
+		printf("Test %d: dropping events from the cache FAILED\n", tests);
+		return 1;
+	}
+
+	tests++;
+
+	/**
+	 * Test 26: events of a binlog file that is created again are dropped
+	 *
+	 * Expected: no events in the cache
+	 */
+	blr_cache_invalidate(inst, "file.100507");
+
+	if (inst->cache.cnt == 0 && inst->cache.bytes == 0 &&
+	    blr_cache_read(inst, "file.100507", pos, &hdr) == NULL) {
+		printf("Test %d PASSED, cache invalidated\n", tests);
+	} else {
+		printf("Test %d: cache invalidation FAILED\n", tests);
+		return 1;
+	}
+
+	MXS_FREE(inst->cache.records);
+
 	mxs_log_flush_sync();
 	mxs_log_finish();
 
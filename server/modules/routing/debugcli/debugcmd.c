@@ -71,6 +71,7 @@
 #include <debugcli.h>
 #include <housekeeper.h>
 #include <listmanager.h>
+#include <query_classifier.h>
 
 #include <skygw_utils.h>
 #include <log_manager.h>
@@ -107,6 +108,7 @@ struct subcommand {
 
 static void telnetdShowUsers(DCB *);
 static void show_log_throttling(DCB *);
+static void show_qc_cache(DCB *);
 
 /**
  * The subcommands of the show command
@@ -118,6 +120,10 @@ struct subcommand showoptions[] = {
       "Show all buffers with backtrace",
       {0, 0, 0} },
 #endif
+    { "bufferpools", 0, dprintBufferPools,
+      "Show the buffer pool statistics of all threads",
+      "Show the buffer pool statistics of all threads",
+      {0, 0, 0} },
     { "dcblist", 0, dprintDCBList,
       "Show statistics for the list of all descriptor control blocks",    
       "Show statistics for the list of all descriptor control blocks",    
@@ -181,6 +187,10 @@ struct subcommand showoptions[] = {
       "Show persistent pool for a server, e.g. show persistent 0x485390. "
       "The address may also be replaced with the server name from the configuration file",
       {ARG_TYPE_SERVER, 0, 0} },
+    { "qc_cache", 0, show_qc_cache,
+      "Show the statistics of the query classification cache",
+      "Show the statistics of the query classification cache",
+      {0, 0, 0} },
     { "server", 1, dprintServer,
       "Show details for a named server, e.g. show server dbnode1",
       "Show details for a server, e.g. show server 0x485390. The address may also be "
@@ -786,6 +796,21 @@ flushlogs(DCB *pdcb)
 }
 
 
+/**
+ * User command to clear the statistics of a filter
+ *
+ * @param pdcb          The stream to write output to
+ * @param filter        The filter
+ */
+static void
+flushfilter(DCB *pdcb, FILTER_DEF *filter)
+{
+    if (!filterResetStatistics(filter))
+    {
+        dcb_printf(pdcb, "Filter '%s' has no statistics to clear.\n", filter->name);
+    }
+}
+
 /**
  * The subcommands of the flush command
  */
@@ -798,6 +823,14 @@ struct subcommand flushoptions[] = {
         "Flush the content of a log file, close that log, rename it and open a new log file",
         {ARG_TYPE_STRING, 0, 0}
     },
+    {
+        "filter",
+        1,
+        flushfilter,
+        "Clear the statistics of a filter, called with a filter name",
+        "Clear the statistics of a filter, called with the address of a filter",
+        {ARG_TYPE_FILTER, 0, 0}
+    },
     {
         "logs",
         0,
@@ -1385,6 +1418,36 @@ show_log_throttling(DCB *dcb)
     dcb_printf(dcb, "%lu %lu %lu\n", t.count, t.window_ms, t.suppress_ms);
 }
 
+/**
+ * Print the statistics of the query classification cache
+ *
+ * @param dcb The DCB to print the statistics to.
+ */
+static void
+show_qc_cache(DCB *dcb)
+{
+    QC_CACHE_STATS stats;
+
+    if (!qc_get_cache_stats(&stats))
+    {
+        dcb_printf(dcb, "The query classifier does not have a cache.\n");
+        return;
+    }
+
+    uint64_t lookups = stats.hits + stats.misses;
+
+    dcb_printf(dcb, "Classified without parsing:  %lu\n", stats.fast_path);
+    dcb_printf(dcb, "Cache hits:                  %lu\n", stats.hits);
+    dcb_printf(dcb, "Cache misses:                %lu\n", stats.misses);
+    dcb_printf(dcb, "Hit rate:                    %.1f%%\n",
+               lookups ? 100.0 * stats.hits / lookups : 0.0);
+    dcb_printf(dcb, "Evictions:                   %lu\n", stats.evictions);
+    dcb_printf(dcb, "Uncacheable statements:      %lu\n", stats.uncacheable);
+    dcb_printf(dcb, "Cached classifications:      %lu\n", stats.entries);
+    dcb_printf(dcb, "Time spent parsing:          %.3f ms\n", stats.parse_ns / 1000000.0);
+    dcb_printf(dcb, "Parsing time saved by cache: %.3f ms\n", stats.saved_ns / 1000000.0);
+}
+
 /**
  * Command to shutdown a running monitor
  *
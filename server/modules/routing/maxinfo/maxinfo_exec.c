@@ -41,6 +41,7 @@
 #include <maxscale.h>
 #include <maxscale/poll.h>
 #include <maxinfo.h>
+#include <filter.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <resultset.h>
@@ -262,6 +263,36 @@ exec_show_eventTimes(DCB *dcb, MAXINFO_TREE *tree)
     resultset_free(set);
 }
 
+/**
+ * Fetch the statistics of a filter and stream them as a result set
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  The name of the filter
+ */
+static void
+exec_show_filter(DCB *dcb, MAXINFO_TREE *tree)
+{
+    FILTER_DEF *filter = tree ? filter_find(tree->value) : NULL;
+    RESULTSET *set;
+    char errmsg[120];
+
+    if (filter == NULL)
+    {
+        maxinfo_send_error(dcb, 0, "Expected the name of a filter");
+        return;
+    }
+
+    if ((set = filterGetStatistics(filter)) == NULL)
+    {
+        snprintf(errmsg, sizeof(errmsg), "Filter '%.80s' has no statistics", filter->name);
+        maxinfo_send_error(dcb, 0, errmsg);
+        return;
+    }
+
+    resultset_stream_mysql(set, dcb);
+    resultset_free(set);
+}
+
 /**
  * The table of show commands that are supported
  */
@@ -281,6 +312,7 @@ static struct
     { "modules", exec_show_modules },
     { "monitors", exec_show_monitors },
     { "eventTimes", exec_show_eventTimes },
+    { "filter", exec_show_filter },
     { NULL, NULL }
 };
 
@@ -324,6 +356,31 @@ void exec_flush_logs(DCB *dcb, MAXINFO_TREE *tree)
     maxinfo_send_ok(dcb);
 }
 
+/**
+ * Clear the statistics of a filter.
+ * @param dcb   The DCB that connects to the client
+ * @param tree  The name of the filter
+ */
+void exec_flush_filter(DCB *dcb, MAXINFO_TREE *tree)
+{
+    FILTER_DEF *filter = tree ? filter_find(tree->value) : NULL;
+    char errmsg[120];
+
+    if (filter == NULL)
+    {
+        maxinfo_send_error(dcb, 0, "Expected the name of a filter");
+    }
+    else if (!filterResetStatistics(filter))
+    {
+        snprintf(errmsg, sizeof(errmsg), "Filter '%.80s' has no statistics", filter->name);
+        maxinfo_send_error(dcb, 0, errmsg);
+    }
+    else
+    {
+        maxinfo_send_ok(dcb);
+    }
+}
+
 /**
  * The table of flush commands that are supported
  */
@@ -334,6 +391,7 @@ static struct
 } flush_commands[] =
 {
     { "logs", exec_flush_logs},
+    { "filter", exec_flush_filter},
     { NULL, NULL}
 };
 
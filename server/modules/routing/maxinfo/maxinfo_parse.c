@@ -98,6 +98,16 @@ maxinfo_parse(char *sql, PARSE_ERROR *parse_error)
                         return NULL;
                     }
                 }
+                else if (token == LT_STRING)
+                {
+                    /** SHOW FILTER <name> */
+                    tree->right = make_tree_node(MAXOP_LITERAL, text, NULL, NULL);
+
+                    if ((ptr = fetch_token(ptr, &token, &text)) == NULL)
+                    {
+                        return tree;
+                    }
+                }
                 // Malformed show
                 MXS_FREE(text);
                 free_tree(tree);
@@ -113,7 +123,24 @@ maxinfo_parse(char *sql, PARSE_ERROR *parse_error)
             case LT_FLUSH:
                 MXS_FREE(text); // not needed
                 ptr = fetch_token(ptr, &token, &text);
-                return make_tree_node(MAXOP_FLUSH, text, NULL, NULL);
+                tree = make_tree_node(MAXOP_FLUSH, text, NULL, NULL);
+
+                if (ptr == NULL || (ptr = fetch_token(ptr, &token, &text)) == NULL)
+                {
+                    /** FLUSH LOGS */
+                    return tree;
+                }
+                tree->right = make_tree_node(MAXOP_LITERAL, text, NULL, NULL);
+
+                if ((ptr = fetch_token(ptr, &token, &text)) != NULL)
+                {
+                    /** Unknown token after FLUSH FILTER <name> */
+                    *parse_error = PARSE_SYNTAX_ERROR;
+                    MXS_FREE(text);
+                    free_tree(tree);
+                    return NULL;
+                }
+                return tree;
 
             case LT_SHUTDOWN:
                 MXS_FREE(text);
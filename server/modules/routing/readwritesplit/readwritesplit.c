@@ -16,6 +16,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
 
 #include <router.h>
 #include <readwritesplit.h>
@@ -30,6 +33,8 @@
 #include <modutil.h>
 #include <mysql_client_server_protocol.h>
 #include <mysqld_error.h>
+#include <mysql_utils.h>
+#include <random_jkiss.h>
 #include <maxscale/alloc.h>
 
 MODULE_INFO info =
@@ -127,6 +132,8 @@ int bref_cmp_behind_master(const void *bref1, const void *bref2);
 
 int bref_cmp_current_load(const void *bref1, const void *bref2);
 
+int bref_cmp_response_time(const void *bref1, const void *bref2);
+
 /**
  * The order of functions _must_ match with the order the select criteria are
  * listed in select_criteria_t definition in readwritesplit.h
@@ -137,7 +144,8 @@ int (*criteria_cmpfun[LAST_CRITERIA])(const void *, const void *) =
     bref_cmp_global_conn,
     bref_cmp_router_conn,
     bref_cmp_behind_master,
-    bref_cmp_current_load
+    bref_cmp_current_load,
+    bref_cmp_response_time
 };
 
 static bool select_connect_backend_servers(backend_ref_t **p_master_ref,
@@ -150,6 +158,10 @@ static bool select_connect_backend_servers(backend_ref_t **p_master_ref,
 
 static bool get_dcb(DCB **dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
                     char *name, int max_rlag);
+static backend_ref_t *get_adaptive_slave(ROUTER_CLIENT_SES *rses, backend_ref_t *master_bref,
+                                         int max_rlag);
+static void bref_record_response_time(backend_ref_t *bref);
+static int response_time_percentile(BACKEND *backend, double percentile);
 
 static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
                                            char **options);
@@ -191,6 +203,11 @@ static void rses_property_done(rses_property_t *prop);
 static mysql_sescmd_t *rses_property_get_sescmd(rses_property_t *prop);
 
 static bool execute_sescmd_history(backend_ref_t *bref);
+static bool sescmd_write(backend_ref_t *backend_ref, mysql_sescmd_t *sescmd);
+static bool sescmd_cursor_can_pipeline(sescmd_cursor_t *scur, int position);
+static void sescmd_classify(mysql_sescmd_t *sescmd);
+static void sescmd_history_compact(ROUTER_CLIENT_SES *rses, mysql_sescmd_t *sescmd);
+static void sescmd_history_remove(ROUTER_CLIENT_SES *rses, rses_property_t **pp);
 
 static bool execute_sescmd_in_backend(backend_ref_t *backend_ref);
 
@@ -208,9 +225,11 @@ static GWBUF *sescmd_cursor_clone_querybuf(sescmd_cursor_t *scur);
 static mysql_sescmd_t *sescmd_cursor_get_command(sescmd_cursor_t *scur);
 
 static bool sescmd_cursor_next(sescmd_cursor_t *scur);
+static GWBUF *sescmd_take_response(GWBUF **replybuf);
 
 static GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
-                                            backend_ref_t *bref, bool *);
+                                            backend_ref_t *bref, bool *,
+                                            GWBUF **);
 
 static void tracelog_routed_query(ROUTER_CLIENT_SES *rses, char *funcname,
                                   backend_ref_t *bref, GWBUF *buf);
@@ -248,6 +267,13 @@ static int hashcmpfun(const void *, const void *);
 static bool check_for_multi_stmt(ROUTER_CLIENT_SES *rses, GWBUF *buf,
                                  mysql_server_cmd_t packet_type);
 static bool send_readonly_error(DCB *dcb);
+static bool route_causal_read(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                              backend_ref_t *bref, GWBUF *querybuf);
+static bool route_causal_read_to_master(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                        GWBUF *querybuf);
+static void handle_causal_read_reply(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                     backend_ref_t *bref, GWBUF *reply);
+static void store_last_gtid(ROUTER_CLIENT_SES *rses, GWBUF *reply);
 
 static int hashkeyfun(const void *key)
 {
@@ -537,6 +563,8 @@ static ROUTER *createInstance(SERVICE *service, char **options)
         router->servers[nservers]->backend_conn_count = 0;
         router->servers[nservers]->be_valid = false;
         router->servers[nservers]->weight = 1000;
+        memset(router->servers[nservers]->be_response_times, 0,
+               sizeof(router->servers[nservers]->be_response_times));
 #if defined(SS_DEBUG)
         router->servers[nservers]->be_chk_top = CHK_NUM_BACKEND;
         router->servers[nservers]->be_chk_tail = CHK_NUM_BACKEND;
@@ -633,6 +661,8 @@ static ROUTER *createInstance(SERVICE *service, char **options)
      * failure is detected */
     router->rwsplit_config.rw_master_failure_mode = RW_FAIL_INSTANTLY;
 
+    router->rwsplit_config.rw_causal_reads_timeout = CONFIG_CAUSAL_READS_TIMEOUT;
+
     /** Call this before refreshInstance */
     if (options && !rwsplit_process_router_options(router, options))
     {
@@ -640,6 +670,12 @@ static ROUTER *createInstance(SERVICE *service, char **options)
         return NULL;
     }
 
+    /** Causal reads need the GTIDs of the writes from the OK packets */
+    if (router->rwsplit_config.rw_causal_reads)
+    {
+        service->session_track = true;
+    }
+
     /** These options cancel each other out */
     if (router->rwsplit_config.rw_disable_sescmd_hist &&
         router->rwsplit_config.rw_max_sescmd_history_size > 0)
@@ -758,6 +794,17 @@ static void *newSession(ROUTER *router_inst, SESSION *session)
     memcpy(&client_rses->rses_config, &router->rwsplit_config, sizeof(rwsplit_config_t));
 
     spinlock_release(&router->lock);
+
+    if (client_rses->rses_config.rw_causal_reads &&
+        !(((MySQLProtocol *)session->client_dcb->protocol)->client_capabilities &
+          GW_MYSQL_CAPABILITIES_SESSION_TRACK) &&
+        !__sync_lock_test_and_set(&router->causal_reads_warned, 1))
+    {
+        MXS_WARNING("[%s] 'causal_reads' is enabled but the client %s@%s does not support "
+                    "session state tracking. The GTIDs of its writes are not known and the "
+                    "reads that follow them are routed to the master.", router->service->name,
+                    session->client_dcb->user, session->client_dcb->remote);
+    }
     /**
      * Set defaults to session variables.
      */
@@ -805,6 +852,7 @@ static void *newSession(ROUTER *router_inst, SESSION *session)
         backend_ref[i].bref_sescmd_cur.scmd_cur_ptr_property =
             &client_rses->rses_properties[RSES_PROP_TYPE_SESCMD];
         backend_ref[i].bref_sescmd_cur.scmd_cur_cmd = NULL;
+        backend_ref[i].bref_sescmd_cur.scmd_cur_sent = -1;
     }
     max_nslaves = rses_get_max_slavecount(client_rses, router_nservers);
     max_slave_rlag = rses_get_max_replication_lag(client_rses);
@@ -1016,6 +1064,11 @@ static void freeSession(ROUTER *router_instance, void *router_client_session)
             p = q;
         }
     }
+    for (i = 0; i < router_cli_ses->rses_nbackends; i++)
+    {
+        gwbuf_free(router_cli_ses->rses_backend_ref[i].bref_gtid_reply);
+    }
+
     /*
      * We are no longer in the linked list, free
      * all the memory and other resources associated
@@ -1097,6 +1150,18 @@ static bool get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
         }
     }
 
+    if (btype == BE_SLAVE && rses->rses_config.rw_slave_select_criteria == ADAPTIVE_ROUTING)
+    {
+        backend_ref_t *bref = get_adaptive_slave(rses, master_bref, max_rlag);
+
+        if (bref)
+        {
+            *p_dcb = bref->bref_dcb;
+            succp = true;
+            goto return_succp;
+        }
+    }
+
     if (btype == BE_SLAVE)
     {
         backend_ref_t *candidate_bref = NULL;
@@ -1267,6 +1332,61 @@ static backend_ref_t *check_candidate_bref(backend_ref_t *cand,
     }
 }
 
+/**
+ * Choose a slave with the power of two choices: two random slaves are picked
+ * and the one with the shorter expected response time wins. Unlike always
+ * picking the fastest slave, this doesn't send all reads to one slave and
+ * keeps measuring the response times of all of them.
+ *
+ * @param rses        Router client session
+ * @param master_bref The master, a candidate if reads may be sent to it
+ * @param max_rlag    Maximum allowed replication lag
+ * @return The chosen backend or NULL if no slave can be used
+ */
+static backend_ref_t *get_adaptive_slave(ROUTER_CLIENT_SES *rses, backend_ref_t *master_bref,
+                                         int max_rlag)
+{
+    backend_ref_t *candidates[rses->rses_nbackends];
+    int n = 0;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+        SERVER *serv = bref->bref_backend->backend_server;
+        SERVER server;
+        server.status = serv->status;
+
+        if (!BREF_IS_IN_USE(bref))
+        {
+            continue;
+        }
+
+        if ((SERVER_IS_SLAVE(&server) &&
+             (max_rlag == MAX_RLAG_UNDEFINED ||
+              (serv->rlag != MAX_RLAG_NOT_AVAILABLE && serv->rlag <= max_rlag))) ||
+            (rses->rses_config.rw_master_reads && bref == master_bref && SERVER_IS_MASTER(&server)))
+        {
+            candidates[n++] = bref;
+        }
+    }
+
+    if (n < 2)
+    {
+        return n == 1 ? candidates[0] : NULL;
+    }
+
+    int first = random_jkiss() % n;
+    int second = random_jkiss() % (n - 1);
+
+    if (second >= first)
+    {
+        second++;
+    }
+
+    return bref_cmp_response_time(candidates[first], candidates[second]) <= 0 ?
+           candidates[first] : candidates[second];
+}
+
 /**
  * Examine the query type, transaction state and routing hints. Find out the
  * target for query routing.
@@ -2062,6 +2182,23 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
          */
         route_target = get_route_target(rses, qtype, querybuf->hint);
 
+        /**
+         * A slave can only be made to wait for a write whose GTID is known.
+         * Until the master reports the GTID of a write, the reads that follow
+         * it are routed to the master.
+         */
+        if (rses->rses_config.rw_causal_reads)
+        {
+            if (QUERY_IS_TYPE(qtype, QUERY_TYPE_WRITE))
+            {
+                rses->rses_gtid_unknown = true;
+            }
+            else if (rses->rses_gtid_unknown && TARGET_IS_SLAVE(route_target))
+            {
+                route_target = TARGET_MASTER;
+            }
+        }
+
         if (TARGET_IS_ALL(route_target))
         {
             /** Multiple, conflicting routing target. Return error */
@@ -2302,6 +2439,19 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
                  (SERVER_IS_MASTER(bref->bref_backend->backend_server) ? "master"
                   : "slave"), bref->bref_backend->backend_server->name,
                  bref->bref_backend->backend_server->port);
+
+        /**
+         * A read that follows a write of the session may only be served
+         * by a slave that has replicated the write.
+         */
+        if (rses->rses_config.rw_causal_reads && TARGET_IS_SLAVE(route_target) &&
+            bref != rses->rses_master_ref && bref->bref_gtid_version != rses->rses_gtid_version)
+        {
+            succp = route_causal_read(inst, rses, bref, querybuf);
+
+            rses_end_locked_router_action(rses);
+            goto retblock;
+        }
         /**
          * Store current stmt if execution of previous session command
          * haven't completed yet.
@@ -2316,7 +2466,9 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
          * somehow wrong, or client is sending more queries before
          * previous is received.
          */
-        if (sescmd_cursor_is_active(scur))
+        if (sescmd_cursor_is_active(scur) &&
+            !(rses->rses_config.rw_pipeline_sescmd &&
+              sescmd_cursor_can_pipeline(scur, rses->pos_generator)))
         {
             ss_dassert(bref->bref_pending_cmd == NULL);
             bref->bref_pending_cmd = gwbuf_clone(querybuf);
@@ -2324,6 +2476,12 @@ static bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
             rses_end_locked_router_action(rses);
             goto retblock;
         }
+        else if (sescmd_cursor_is_active(scur))
+        {
+            /** The protocol passes on what follows the session command replies */
+            ((MySQLProtocol *)target_dcb->protocol)->pipelined = true;
+            atomic_add(&inst->stats.n_pipelined, 1);
+        }
 
         if ((ret = target_dcb->func.write(target_dcb, gwbuf_clone(querybuf))) == 1)
         {
@@ -2441,12 +2599,18 @@ static void diagnostic(ROUTER *instance, DCB *dcb)
     int i = 0;
     BACKEND *backend;
     char *weightby;
+    int hist_len = 0, hist_max = 0;
+    size_t hist_bytes = 0;
 
+    /** Only the totals are collected while the router is locked */
     spinlock_acquire(&router->lock);
     router_cli_ses = router->connections;
     while (router_cli_ses)
     {
         i++;
+        hist_len += router_cli_ses->rses_sescmd_hist_len;
+        hist_bytes += router_cli_ses->rses_sescmd_hist_bytes;
+        hist_max = MAX(hist_max, router_cli_ses->rses_sescmd_hist_len);
         router_cli_ses = router_cli_ses->next;
     }
     spinlock_release(&router->lock);
@@ -2472,6 +2636,23 @@ static void diagnostic(ROUTER *instance, DCB *dcb)
     dcb_printf(dcb, "\tNumber of queries forwarded to all:   	%d (%.2f%%)\n",
                router->stats.n_all, all_pct);
 
+    if (router->rwsplit_config.rw_causal_reads)
+    {
+        dcb_printf(dcb, "\tNumber of causal reads served by slaves:	%d\n",
+                   router->stats.n_causal_slave);
+        dcb_printf(dcb, "\tNumber of causal reads sent to master:  	%d\n",
+                   router->stats.n_causal_master);
+    }
+
+    dcb_printf(dcb, "\tSession commands removed from history:	%d\n",
+               router->stats.n_sescmd_compacted);
+
+    if (router->rwsplit_config.rw_pipeline_sescmd)
+    {
+        dcb_printf(dcb, "\tNumber of pipelined commands:         	%d\n",
+                   router->stats.n_pipelined);
+    }
+
     if ((weightby = serviceGetWeightingParameter(router->service)) != NULL)
     {
         dcb_printf(dcb, "\tConnection distribution based on %s "
@@ -2489,6 +2670,27 @@ static void diagnostic(ROUTER *instance, DCB *dcb)
                        backend->backend_server->stats.n_current_ops);
         }
     }
+
+    if (i > 0)
+    {
+        dcb_printf(dcb, "\tSession command history:\n");
+        dcb_printf(dcb, "\t\tTotal commands:         %d\n", hist_len);
+        dcb_printf(dcb, "\t\tTotal bytes:            %lu\n", hist_bytes);
+        dcb_printf(dcb, "\t\tLongest history:        %d\n", hist_max);
+        dcb_printf(dcb, "\t\tAverage history:        %.1f\n", (double)hist_len / i);
+    }
+
+    dcb_printf(dcb, "\tResponse times in microseconds:\n");
+    dcb_printf(dcb, "\t\tServer               Average     p50         p99\n");
+    for (i = 0; router->servers[i]; i++)
+    {
+        backend = router->servers[i];
+        dcb_printf(dcb, "\t\t%-20s %-11d %-11d %d\n",
+                   backend->backend_server->unique_name,
+                   backend->backend_server->stats.response_time,
+                   response_time_percentile(backend, 0.5),
+                   response_time_percentile(backend, 0.99));
+    }
 }
 
 /**
@@ -2509,6 +2711,7 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *writebuf,
     ROUTER_CLIENT_SES *router_cli_ses;
     sescmd_cursor_t *scur = NULL;
     backend_ref_t *bref;
+    GWBUF *query_reply = NULL;
 
     router_cli_ses = (ROUTER_CLIENT_SES *)router_session;
     router_inst = (ROUTER_INSTANCE *)instance;
@@ -2564,6 +2767,16 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *writebuf,
 
     CHK_BACKEND_REF(bref);
     scur = &bref->bref_sescmd_cur;
+
+    if (BREF_IS_WAITING_GTID(bref))
+    {
+        /** The reply is to the GTID wait of a causal read */
+        handle_causal_read_reply(router_inst, router_cli_ses, bref, writebuf);
+
+        rses_end_locked_router_action(router_cli_ses);
+        goto lock_failed;
+    }
+
     /**
      * Active cursor means that reply is from session command
      * execution.
@@ -2597,7 +2810,7 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *writebuf,
              * needs to be sent to client or NULL.
              */
             bool rconn = false;
-            writebuf = sescmd_cursor_process_replies(writebuf, bref, &rconn);
+            writebuf = sescmd_cursor_process_replies(writebuf, bref, &rconn, &query_reply);
 
             if (rconn && !router_inst->rwsplit_config.rw_disable_sescmd_hist)
             {
@@ -2619,6 +2832,25 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *writebuf,
 
         /** Set response status as replied */
         bref_clear_state(bref, BREF_WAITING_RESULT);
+
+        if (query_reply)
+        {
+            /** The reply to a query pipelined behind the session commands */
+            if (BREF_IS_QUERY_ACTIVE(bref))
+            {
+                bref_record_response_time(bref);
+                bref_clear_state(bref, BREF_QUERY_ACTIVE);
+                bref_clear_state(bref, BREF_WAITING_RESULT);
+
+                if (router_cli_ses->rses_config.rw_causal_reads &&
+                    bref == router_cli_ses->rses_master_ref)
+                {
+                    store_last_gtid(router_cli_ses, query_reply);
+                }
+            }
+
+            writebuf = gwbuf_append(writebuf, query_reply);
+        }
     }
     /**
      * Clear BREF_QUERY_ACTIVE flag and decrease waiter counter.
@@ -2626,9 +2858,16 @@ static void clientReply(ROUTER *instance, void *router_session, GWBUF *writebuf,
      */
     else if (BREF_IS_QUERY_ACTIVE(bref))
     {
+        bref_record_response_time(bref);
         bref_clear_state(bref, BREF_QUERY_ACTIVE);
         /** Set response status as replied */
         bref_clear_state(bref, BREF_WAITING_RESULT);
+
+        if (router_cli_ses->rses_config.rw_causal_reads &&
+            bref == router_cli_ses->rses_master_ref)
+        {
+            store_last_gtid(router_cli_ses, writebuf);
+        }
     }
 
     if (writebuf != NULL && client_dcb != NULL)
@@ -2788,6 +3027,44 @@ int bref_cmp_current_load(const void *bref1, const void *bref2)
            ((1000 * s2->stats.n_current_ops) - b2->weight);
 }
 
+/**
+ * The expected time a new query would take on a server: the average response
+ * time of the server, scaled by the operations already queued on it and
+ * divided by the weight of the server.
+ */
+static double response_time_score(BACKEND *b)
+{
+    SERVER *s = b->backend_server;
+
+    return (1.0 + s->stats.response_time) * (1.0 + s->stats.n_current_ops) * 1000.0 / b->weight;
+}
+
+/** Compare expected response times of backend servers */
+int bref_cmp_response_time(const void *bref1, const void *bref2)
+{
+    BACKEND *b1 = ((backend_ref_t *)bref1)->bref_backend;
+    BACKEND *b2 = ((backend_ref_t *)bref2)->bref_backend;
+
+    if (b1->weight == 0 && b2->weight == 0)
+    {
+        return b1->backend_server->stats.n_current -
+               b2->backend_server->stats.n_current;
+    }
+    else if (b1->weight == 0)
+    {
+        return 1;
+    }
+    else if (b2->weight == 0)
+    {
+        return -1;
+    }
+
+    double score1 = response_time_score(b1);
+    double score2 = response_time_score(b2);
+
+    return score1 < score2 ? -1 : (score1 > score2 ? 1 : 0);
+}
+
 static void bref_clear_state(backend_ref_t *bref, bref_state_t state)
 {
     if (bref == NULL)
@@ -2835,6 +3112,13 @@ static void bref_set_state(backend_ref_t *bref, bref_state_t state)
     }
     if (state != BREF_WAITING_RESULT)
     {
+        if (state == BREF_QUERY_ACTIVE)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            bref->bref_query_started = ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+        }
+
         bref->bref_state |= state;
     }
     else
@@ -2865,6 +3149,94 @@ static void bref_set_state(backend_ref_t *bref, bref_state_t state)
     }
 }
 
+/**
+ * The histogram bucket of a response time. Times below four microseconds have
+ * a bucket of their own, above that each power of two is split in four.
+ */
+static int response_time_bucket(int us)
+{
+    if (us < 4)
+    {
+        return us < 0 ? 0 : us;
+    }
+
+    int msb = 31 - __builtin_clz(us);
+    return (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+}
+
+/** The longest response time that falls into a histogram bucket */
+static int response_time_bucket_max(int bucket)
+{
+    if (bucket < 4)
+    {
+        return bucket;
+    }
+
+    int msb = bucket / 4 + 1;
+    long limit = (long)(4 + bucket % 4 + 1) << (msb - 2);
+
+    return limit > INT_MAX ? INT_MAX : limit - 1;
+}
+
+/**
+ * Record the response time of the query that was active on a backend. The
+ * time is from when the query was sent until the first reply arrives.
+ *
+ * The average of the server is updated without a lock: it is only used to
+ * compare servers and a lost sample merely slows its adaptation down.
+ *
+ * @param bref The backend that replied
+ */
+static void bref_record_response_time(backend_ref_t *bref)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    long elapsed = ts.tv_sec * 1000000L + ts.tv_nsec / 1000 - bref->bref_query_started;
+    int us = elapsed > INT_MAX ? INT_MAX : (elapsed < 0 ? 0 : elapsed);
+    SERVER_STATS *stats = &bref->bref_backend->backend_server->stats;
+    int64_t sample = (int64_t)us << RWSPLIT_RESPONSE_TIME_FRACTION_BITS;
+    int64_t avg = stats->response_time_scaled;
+
+    avg = avg == 0 ? sample : avg + (sample - avg) / RWSPLIT_RESPONSE_TIME_DECAY;
+    stats->response_time_scaled = avg;
+    stats->response_time = (avg + (1 << (RWSPLIT_RESPONSE_TIME_FRACTION_BITS - 1))) >>
+                           RWSPLIT_RESPONSE_TIME_FRACTION_BITS;
+    atomic_add_uint64(&bref->bref_backend->be_response_times[response_time_bucket(us)], 1);
+}
+
+/**
+ * Get a percentile of the response times of a backend
+ *
+ * @param backend    The backend
+ * @param percentile The percentile as a fraction, e.g. 0.99
+ * @return Upper bound of the percentile in microseconds, 0 if there are no samples
+ */
+static int response_time_percentile(BACKEND *backend, double percentile)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < RWSPLIT_RESPONSE_TIME_BUCKETS; i++)
+    {
+        total += backend->be_response_times[i];
+    }
+
+    uint64_t rank = (uint64_t)(total * percentile + 0.5);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < RWSPLIT_RESPONSE_TIME_BUCKETS && total > 0; i++)
+    {
+        seen += backend->be_response_times[i];
+
+        if (seen >= rank && seen > 0)
+        {
+            return response_time_bucket_max(i);
+        }
+    }
+
+    return 0;
+}
+
 /**
  * @brief Connect a server
  *
@@ -2929,7 +3301,8 @@ void log_server_connections(select_criteria_t select_criteria,
     if (select_criteria == LEAST_GLOBAL_CONNECTIONS ||
         select_criteria == LEAST_ROUTER_CONNECTIONS ||
         select_criteria == LEAST_BEHIND_MASTER ||
-        select_criteria == LEAST_CURRENT_OPERATIONS)
+        select_criteria == LEAST_CURRENT_OPERATIONS ||
+        select_criteria == ADAPTIVE_ROUTING)
     {
         MXS_INFO("Servers and %s connection counts:",
                  select_criteria == LEAST_GLOBAL_CONNECTIONS ? "all MaxScale"
@@ -2964,6 +3337,14 @@ void log_server_connections(select_criteria_t select_criteria,
                     MXS_INFO("replication lag : %d in \t%s:%d %s",
                              b->backend_server->rlag, b->backend_server->name,
                              b->backend_server->port, STRSRVSTATUS(b->backend_server));
+                    break;
+
+                case ADAPTIVE_ROUTING:
+                    MXS_INFO("response time : %d us in \t%s:%d %s",
+                             b->backend_server->stats.response_time, b->backend_server->name,
+                             b->backend_server->port, STRSRVSTATUS(b->backend_server));
+                    break;
+
                 default:
                     break;
             }
@@ -3289,6 +3670,7 @@ static mysql_sescmd_t *mysql_sescmd_init(rses_property_t *rses_prop,
     sescmd->my_sescmd_buf = sescmd_buf;
     sescmd->my_sescmd_packet_type = packet_type;
     sescmd->position = atomic_add(&rses->pos_generator, 1);
+    sescmd_classify(sescmd);
 
     return sescmd;
 }
@@ -3305,77 +3687,588 @@ static void mysql_sescmd_done(mysql_sescmd_t *sescmd)
     memset(sescmd, 0, sizeof(mysql_sescmd_t));
 }
 
+static const char *sescmd_skip_space(const char *ptr, const char *end)
+{
+    while (ptr < end && isspace(*ptr))
+    {
+        ptr++;
+    }
+
+    return ptr;
+}
+
+static bool sescmd_is_ident_char(char c)
+{
+    return isalnum(c) || c == '_' || c == '$';
+}
+
+/** Consume a keyword and the whitespace after it */
+static bool sescmd_match_keyword(const char **pptr, const char *end, const char *keyword)
+{
+    size_t len = strlen(keyword);
+    const char *ptr = *pptr;
+
+    if ((size_t)(end - ptr) < len || strncasecmp(ptr, keyword, len) != 0 ||
+        (ptr + len < end && sescmd_is_ident_char(ptr[len])))
+    {
+        return false;
+    }
+
+    *pptr = sescmd_skip_space(ptr + len, end);
+    return true;
+}
+
 /**
- * All cases where backend message starts at least with one response to session
- * command are handled here.
- * Read session commands from property list. If command is already replied,
- * discard packet. Else send reply to client. In both cases move cursor forward
- * until all session command replies are handled.
- *
- * Cases that are expected to happen and which are handled:
- * s = response not yet replied to client, S = already replied response,
- * q = query
- * 1. q+        for example : select * from mysql.user
- * 2. s+        for example : set autocommit=1
- * 3. S+
- * 4. sq+
- * 5. Sq+
- * 6. Ss+
- * 7. Ss+q+
- * 8. S+q+
- * 9. s+q+
+ * Consume an identifier, plain or quoted with backticks, and the whitespace
+ * after it. The identifier is appended in lower case to @c dest.
  */
-static GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
-                                            backend_ref_t *bref,
-                                            bool *reconnect)
+static bool sescmd_parse_ident(const char **pptr, const char *end, char *dest, size_t size)
 {
-    mysql_sescmd_t *scmd;
-    sescmd_cursor_t *scur;
-    ROUTER_CLIENT_SES *ses;
+    const char *ptr = *pptr;
+    size_t len = strlen(dest);
+    bool quoted = ptr < end && *ptr == '`';
 
-    scur = &bref->bref_sescmd_cur;
-    ss_dassert(SPINLOCK_IS_LOCKED(&(scur->scmd_cur_rses->rses_lock)));
-    scmd = sescmd_cursor_get_command(scur);
-    ses = (*scur->scmd_cur_ptr_property)->rses_prop_rsession;
-    CHK_GWBUF(replybuf);
+    if (quoted)
+    {
+        ptr++;
+    }
 
-    /**
-     * Walk through packets in the message and the list of session
-     * commands.
-     */
-    while (scmd != NULL && replybuf != NULL)
+    const char *start = ptr;
+
+    while (ptr < end && (quoted ? *ptr != '`' : sescmd_is_ident_char(*ptr)))
     {
-        bref->reply_cmd = *((unsigned char *)replybuf->start + 4);
-        scur->position = scmd->position;
-        /** Faster backend has already responded to client : discard */
-        if (scmd->my_sescmd_is_replied)
+        if (len + 1 >= size)
         {
-            bool last_packet = false;
+            return false;
+        }
 
-            CHK_GWBUF(replybuf);
+        dest[len++] = tolower(*ptr++);
+    }
 
-            while (!last_packet)
-            {
-                int buflen;
+    if (ptr == start || (quoted && ptr == end))
+    {
+        return false;
+    }
 
-                buflen = GWBUF_LENGTH(replybuf);
-                last_packet = GWBUF_IS_TYPE_RESPONSE_END(replybuf);
-                /** discard packet */
-                replybuf = gwbuf_consume(replybuf, buflen);
-            }
-            /** Set response status received */
-            bref_clear_state(bref, BREF_WAITING_RESULT);
+    dest[len] = '\0';
+    *pptr = sescmd_skip_space(quoted ? ptr + 1 : ptr, end);
+    return true;
+}
 
-            if (bref->reply_cmd != scmd->reply_cmd)
+/**
+ * Consume a literal value and the whitespace after it. Only values that can't
+ * refer to variables are accepted: single quoted strings, numbers and words
+ * such as ON or DEFAULT.
+ */
+static bool sescmd_parse_literal(const char **pptr, const char *end)
+{
+    const char *ptr = *pptr;
+
+    if (ptr < end && *ptr == '\'')
+    {
+        for (ptr++; ptr < end && *ptr != '\''; ptr++)
+        {
+            if (*ptr == '\\')
             {
-                MXS_ERROR("Slave server '%s': response differs from master's response. "
-                          "Closing connection due to inconsistent session state.",
-                          bref->bref_backend->backend_server->unique_name);
-                sescmd_cursor_set_active(scur, false);
-                bref_clear_state(bref, BREF_QUERY_ACTIVE);
-                bref_clear_state(bref, BREF_IN_USE);
-                bref_set_state(bref, BREF_CLOSED);
-                bref_set_state(bref, BREF_SESCMD_FAILED);
+                ptr++;
+            }
+        }
+
+        if (ptr >= end)
+        {
+            return false;
+        }
+
+        ptr++;
+    }
+    else
+    {
+        if (ptr < end && (*ptr == '-' || *ptr == '+'))
+        {
+            ptr++;
+        }
+
+        const char *start = ptr;
+
+        while (ptr < end && (sescmd_is_ident_char(*ptr) || *ptr == '.'))
+        {
+            ptr++;
+        }
+
+        if (ptr == start)
+        {
+            return false;
+        }
+    }
+
+    *pptr = sescmd_skip_space(ptr, end);
+    return true;
+}
+
+/** Check that nothing but an optional semicolon follows */
+static bool sescmd_at_end(const char *ptr, const char *end)
+{
+    if (ptr < end && *ptr == ';')
+    {
+        ptr = sescmd_skip_space(ptr + 1, end);
+    }
+
+    return ptr == end;
+}
+
+/**
+ * Classify the SET statement that follows the SET keyword.
+ *
+ * @return SESCMD_VARIABLE if a literal is assigned to one variable whose name
+ * is stored in @c key, SESCMD_INDEPENDENT if literals are assigned to several
+ * variables and SESCMD_OTHER otherwise
+ */
+static sescmd_kind_t sescmd_classify_set(const char *ptr, const char *end, char *key, size_t size)
+{
+    if (sescmd_match_keyword(&ptr, end, "GLOBAL"))
+    {
+        return SESCMD_OTHER;
+    }
+
+    if (!sescmd_match_keyword(&ptr, end, "SESSION"))
+    {
+        sescmd_match_keyword(&ptr, end, "LOCAL");
+    }
+
+    if (sescmd_match_keyword(&ptr, end, "TRANSACTION"))
+    {
+        /** Only affects the next transaction unless SESSION is given */
+        return SESCMD_INDEPENDENT;
+    }
+
+    if (sescmd_match_keyword(&ptr, end, "NAMES"))
+    {
+        strcpy(key, "names");
+
+        if (!sescmd_parse_literal(&ptr, end) ||
+            (sescmd_match_keyword(&ptr, end, "COLLATE") && !sescmd_parse_literal(&ptr, end)))
+        {
+            return SESCMD_OTHER;
+        }
+
+        return sescmd_at_end(ptr, end) ? SESCMD_VARIABLE : SESCMD_OTHER;
+    }
+
+    if (sescmd_match_keyword(&ptr, end, "CHARSET") ||
+        (sescmd_match_keyword(&ptr, end, "CHARACTER") && sescmd_match_keyword(&ptr, end, "SET")))
+    {
+        strcpy(key, "character set");
+        return sescmd_parse_literal(&ptr, end) && sescmd_at_end(ptr, end) ?
+               SESCMD_VARIABLE : SESCMD_OTHER;
+    }
+
+    int n_vars = 0;
+
+    while (true)
+    {
+        *key = '\0';
+
+        if (end - ptr > 2 && ptr[0] == '@' && ptr[1] == '@')
+        {
+            ptr += 2;
+
+            if (sescmd_match_keyword(&ptr, end, "GLOBAL") ||
+                ((sescmd_match_keyword(&ptr, end, "SESSION") ||
+                  sescmd_match_keyword(&ptr, end, "LOCAL")) && (ptr >= end || *ptr++ != '.')))
+            {
+                /** Either a global variable or a variable called SESSION or LOCAL */
+                return SESCMD_OTHER;
+            }
+        }
+        else if (ptr < end && *ptr == '@')
+        {
+            strcpy(key, "@");
+            ptr++;
+        }
+
+        if (!sescmd_parse_ident(&ptr, end, key, size))
+        {
+            return SESCMD_OTHER;
+        }
+
+        if (ptr < end && *ptr == '=')
+        {
+            ptr++;
+        }
+        else if (end - ptr > 1 && ptr[0] == ':' && ptr[1] == '=')
+        {
+            ptr += 2;
+        }
+        else
+        {
+            return SESCMD_OTHER;
+        }
+
+        ptr = sescmd_skip_space(ptr, end);
+
+        if (!sescmd_parse_literal(&ptr, end))
+        {
+            return SESCMD_OTHER;
+        }
+
+        n_vars++;
+
+        if (ptr < end && *ptr == ',')
+        {
+            ptr = sescmd_skip_space(ptr + 1, end);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (!sescmd_at_end(ptr, end))
+    {
+        return SESCMD_OTHER;
+    }
+
+    return n_vars == 1 ? SESCMD_VARIABLE : SESCMD_INDEPENDENT;
+}
+
+/**
+ * Find out what a session command does so that the commands it makes
+ * redundant can be removed from the history. Anything that isn't recognized
+ * is classified as SESCMD_OTHER which is never removed and prevents the
+ * removal of variable assignments before it.
+ *
+ * @param sescmd The session command
+ */
+static void sescmd_classify(mysql_sescmd_t *sescmd)
+{
+    GWBUF *buf = sescmd->my_sescmd_buf;
+    char *sql;
+    int len;
+
+    sescmd->my_sescmd_kind = SESCMD_OTHER;
+    sescmd->my_sescmd_key[0] = '\0';
+
+    if (sescmd->my_sescmd_packet_type == MYSQL_COM_INIT_DB)
+    {
+        sescmd->my_sescmd_kind = SESCMD_DATABASE;
+    }
+    else if (modutil_extract_SQL(buf, &sql, &len) &&
+             len + MYSQL_HEADER_LEN + 1 <= (int)GWBUF_LENGTH(buf))
+    {
+        const char *end = sql + len;
+        const char *ptr = sescmd_skip_space(sql, end);
+        char *key = sescmd->my_sescmd_key;
+        size_t size = sizeof(sescmd->my_sescmd_key);
+
+        if (sescmd_match_keyword(&ptr, end, "SET"))
+        {
+            sescmd->my_sescmd_kind = sescmd_classify_set(ptr, end, key, size);
+        }
+        else if (sescmd_match_keyword(&ptr, end, "USE"))
+        {
+            if (sescmd_parse_ident(&ptr, end, key, size) && sescmd_at_end(ptr, end))
+            {
+                sescmd->my_sescmd_kind = SESCMD_DATABASE;
+            }
+        }
+        else if (sescmd_match_keyword(&ptr, end, "PREPARE"))
+        {
+            if (sescmd_parse_ident(&ptr, end, key, size) &&
+                sescmd_match_keyword(&ptr, end, "FROM"))
+            {
+                sescmd->my_sescmd_kind = SESCMD_PREPARE;
+            }
+        }
+        else if (sescmd_match_keyword(&ptr, end, "DEALLOCATE") ||
+                 sescmd_match_keyword(&ptr, end, "DROP"))
+        {
+            if (sescmd_match_keyword(&ptr, end, "PREPARE") &&
+                sescmd_parse_ident(&ptr, end, key, size) && sescmd_at_end(ptr, end))
+            {
+                sescmd->my_sescmd_kind = SESCMD_DEALLOCATE;
+            }
+        }
+    }
+
+    if (sescmd->my_sescmd_kind != SESCMD_VARIABLE && sescmd->my_sescmd_kind != SESCMD_PREPARE &&
+        sescmd->my_sescmd_kind != SESCMD_DEALLOCATE)
+    {
+        /** Only variables and statements are told apart by their names */
+        sescmd->my_sescmd_key[0] = '\0';
+    }
+}
+
+/**
+ * Remove a session command from the history. Cursors that point to the
+ * location of the next command are moved to the location of the removed one.
+ *
+ * @param rses Router client session
+ * @param pp   The location of the command in the history list
+ */
+static void sescmd_history_remove(ROUTER_CLIENT_SES *rses, rses_property_t **pp)
+{
+    rses_property_t *prop = *pp;
+    mysql_sescmd_t *sescmd = &prop->rses_prop_data.sescmd;
+
+    *pp = prop->rses_prop_next;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        sescmd_cursor_t *scur = &rses->rses_backend_ref[i].bref_sescmd_cur;
+
+        if (scur->scmd_cur_ptr_property == &prop->rses_prop_next)
+        {
+            scur->scmd_cur_ptr_property = pp;
+        }
+
+        if (scur->scmd_cur_cmd == sescmd)
+        {
+            scur->scmd_cur_cmd = NULL;
+        }
+    }
+
+    rses->rses_sescmd_hist_len--;
+    rses->rses_sescmd_hist_bytes -= gwbuf_length(sescmd->my_sescmd_buf);
+    rses_property_done(prop);
+}
+
+/**
+ * Count the backends in use whose next session command is the given one
+ *
+ * @param rses Router client session
+ * @param prop The session command
+ * @return Number of backends
+ */
+static int sescmd_cursors_at(ROUTER_CLIENT_SES *rses, rses_property_t *prop)
+{
+    int n = 0;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) && *bref->bref_sescmd_cur.scmd_cur_ptr_property == prop)
+        {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * Compact the session command history before a new command is added to it.
+ *
+ * The commands the new one makes redundant are marked as superseded:
+ * - an earlier assignment to the same variable, or an earlier change of the
+ *   database, if all commands between them are independent of it
+ * - an earlier preparation of a statement with the same name
+ *
+ * A deallocation is paired with the preparation it deallocates. The pair is
+ * only removed together and only once all backends in use have executed the
+ * deallocation, otherwise a backend that connects in between would replay
+ * the deallocation of a statement it never prepared. A deallocation without
+ * a preparation is superseded by itself. The superseded commands that all
+ * backends in use have executed are then removed.
+ *
+ * Router session must be locked.
+ *
+ * @param rses   Router client session
+ * @param sescmd The new command
+ */
+static void sescmd_history_compact(ROUTER_CLIENT_SES *rses, mysql_sescmd_t *sescmd)
+{
+    rses_property_t *head = rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+    rses_property_t *start = head;
+    rses_property_t *prop;
+
+    switch (sescmd->my_sescmd_kind)
+    {
+        case SESCMD_VARIABLE:
+        case SESCMD_DATABASE:
+            /** A command that may read the variable ends the search */
+            for (prop = head; prop; prop = prop->rses_prop_next)
+            {
+                sescmd_kind_t kind = prop->rses_prop_data.sescmd.my_sescmd_kind;
+
+                if (kind == SESCMD_OTHER || kind == SESCMD_PREPARE)
+                {
+                    start = prop->rses_prop_next;
+                }
+            }
+            break;
+
+        case SESCMD_PREPARE:
+        case SESCMD_DEALLOCATE:
+            break;
+
+        default:
+            start = NULL;
+            break;
+    }
+
+    for (prop = start; prop; prop = prop->rses_prop_next)
+    {
+        mysql_sescmd_t *old = &prop->rses_prop_data.sescmd;
+
+        if (strcmp(old->my_sescmd_key, sescmd->my_sescmd_key) != 0 ||
+            old->my_sescmd_superseded)
+        {
+            continue;
+        }
+
+        switch (sescmd->my_sescmd_kind)
+        {
+            case SESCMD_VARIABLE:
+            case SESCMD_DATABASE:
+                if (old->my_sescmd_kind == sescmd->my_sescmd_kind)
+                {
+                    old->my_sescmd_superseded = true;
+                }
+                break;
+
+            case SESCMD_PREPARE:
+                /** A deallocated preparation goes with its deallocation */
+                if (old->my_sescmd_kind == SESCMD_PREPARE && !old->my_sescmd_deallocated)
+                {
+                    old->my_sescmd_superseded = true;
+                }
+                break;
+
+            case SESCMD_DEALLOCATE:
+                /** The preparation in effect is the only one left to pair with */
+                if (old->my_sescmd_kind == SESCMD_PREPARE && !old->my_sescmd_deallocated)
+                {
+                    old->my_sescmd_deallocated = true;
+                    sescmd->my_sescmd_prepare = old;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if (sescmd->my_sescmd_kind == SESCMD_DEALLOCATE && sescmd->my_sescmd_prepare == NULL)
+    {
+        sescmd->my_sescmd_superseded = true;
+    }
+
+    /**
+     * A command can be removed when no cursor of a backend in use points to
+     * it or to a command before it. A deallocation that can be removed
+     * makes its preparation removable as well.
+     */
+    rses_property_t **pp = &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+    int n_behind = 0;
+
+    for (prop = *pp; prop && n_behind == 0; prop = prop->rses_prop_next)
+    {
+        mysql_sescmd_t *cmd = &prop->rses_prop_data.sescmd;
+        n_behind = sescmd_cursors_at(rses, prop);
+
+        if (n_behind == 0 && cmd->my_sescmd_prepare)
+        {
+            cmd->my_sescmd_superseded = true;
+            cmd->my_sescmd_prepare->my_sescmd_superseded = true;
+        }
+    }
+
+    n_behind = 0;
+
+    while (*pp)
+    {
+        n_behind += sescmd_cursors_at(rses, *pp);
+
+        if (n_behind == 0 && (*pp)->rses_prop_data.sescmd.my_sescmd_superseded)
+        {
+            sescmd_history_remove(rses, pp);
+            atomic_add(&rses->router->stats.n_sescmd_compacted, 1);
+        }
+        else
+        {
+            pp = &(*pp)->rses_prop_next;
+        }
+    }
+}
+
+/**
+ * All cases where backend message starts at least with one response to session
+ * command are handled here.
+ * Read session commands from property list. If command is already replied,
+ * discard packet. Else send reply to client. In both cases move cursor forward
+ * until all session command replies are handled.
+ *
+ * Cases that are expected to happen and which are handled:
+ * s = response not yet replied to client, S = already replied response,
+ * q = query
+ * 1. q+        for example : select * from mysql.user
+ * 2. s+        for example : set autocommit=1
+ * 3. S+
+ * 4. sq+
+ * 5. Sq+
+ * 6. Ss+
+ * 7. Ss+q+
+ * 8. S+q+
+ * 9. s+q+
+ *
+ * The q+ part is only possible if a query was pipelined behind the session
+ * commands. It is returned separately in query_reply.
+ *
+ * @param replybuf    The replies from the backend
+ * @param bref        The backend
+ * @param reconnect   Set to true if backends were closed
+ * @param query_reply Set to the bytes that followed the last session command
+ *                    reply or NULL if there were none
+ * @return The session command replies to send to the client or NULL
+ */
+static GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
+                                            backend_ref_t *bref,
+                                            bool *reconnect,
+                                            GWBUF **query_reply)
+{
+    mysql_sescmd_t *scmd;
+    sescmd_cursor_t *scur;
+    ROUTER_CLIENT_SES *ses;
+    GWBUF *outbuf = NULL;
+
+    *query_reply = NULL;
+
+    scur = &bref->bref_sescmd_cur;
+    ss_dassert(SPINLOCK_IS_LOCKED(&(scur->scmd_cur_rses->rses_lock)));
+    scmd = sescmd_cursor_get_command(scur);
+    ses = (*scur->scmd_cur_ptr_property)->rses_prop_rsession;
+    CHK_GWBUF(replybuf);
+
+    /**
+     * Walk through packets in the message and the list of session
+     * commands.
+     */
+    while (scmd != NULL && replybuf != NULL)
+    {
+        bref->reply_cmd = *((unsigned char *)replybuf->start + 4);
+        scur->position = scmd->position;
+        /** Faster backend has already responded to client : discard */
+        if (scmd->my_sescmd_is_replied)
+        {
+            CHK_GWBUF(replybuf);
+
+            /** discard packets */
+            gwbuf_free(sescmd_take_response(&replybuf));
+
+            /** Set response status received */
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+
+            if (bref->reply_cmd != scmd->reply_cmd)
+            {
+                MXS_ERROR("Slave server '%s': response differs from master's response. "
+                          "Closing connection due to inconsistent session state.",
+                          bref->bref_backend->backend_server->unique_name);
+                sescmd_cursor_set_active(scur, false);
+                bref_clear_state(bref, BREF_QUERY_ACTIVE);
+                bref_clear_state(bref, BREF_IN_USE);
+                bref_set_state(bref, BREF_CLOSED);
+                bref_set_state(bref, BREF_SESCMD_FAILED);
                 if (bref->bref_dcb)
                 {
                     dcb_close(bref->bref_dcb);
@@ -3383,6 +4276,8 @@ static GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
                 *reconnect = true;
                 gwbuf_free(replybuf);
                 replybuf = NULL;
+                gwbuf_free(outbuf);
+                outbuf = NULL;
             }
         }
         /** This is a response from the master and it is the "right" one.
@@ -3400,6 +4295,7 @@ static GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
             /** Mark the rest session commands as replied */
             scmd->my_sescmd_is_replied = true;
             scmd->reply_cmd = *((unsigned char *)replybuf->start + 4);
+            outbuf = gwbuf_append(outbuf, sescmd_take_response(&replybuf));
 
             MXS_INFO("Server '%s' responded to a session command, sending the response "
                      "to the client.", bref->bref_backend->backend_server->unique_name);
@@ -3444,8 +4340,7 @@ static GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
                           serv->unique_name, serv->name, serv->port);
             }
 
-            gwbuf_free(replybuf);
-            replybuf = NULL;
+            gwbuf_free(sescmd_take_response(&replybuf));
         }
 
         if (sescmd_cursor_next(scur))
@@ -3461,7 +4356,34 @@ static GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
     }
     ss_dassert(replybuf == NULL || *scur->scmd_cur_ptr_property == NULL);
 
-    return replybuf;
+    /** The rest is the reply to a query pipelined behind the session commands */
+    *query_reply = replybuf;
+
+    return outbuf;
+}
+
+/**
+ * Take the packets of one response from the start of the replies of a backend
+ *
+ * @param replybuf The replies, the response is removed from them
+ * @return The response up to and including the buffer marked as its end
+ */
+static GWBUF *sescmd_take_response(GWBUF **replybuf)
+{
+    GWBUF *response = NULL;
+    bool last_packet = false;
+
+    while (*replybuf && !last_packet)
+    {
+        GWBUF *buf = *replybuf;
+        size_t buflen = GWBUF_LENGTH(buf);
+
+        last_packet = GWBUF_IS_TYPE_RESPONSE_END(buf);
+        response = gwbuf_append(response, gwbuf_clone_portion(buf, 0, buflen));
+        *replybuf = gwbuf_consume(buf, buflen);
+    }
+
+    return response;
 }
 
 /**
@@ -3567,6 +4489,7 @@ static void sescmd_cursor_reset(sescmd_cursor_t *scur)
 
     CHK_RSES_PROP((*scur->scmd_cur_ptr_property));
     scur->scmd_cur_active = false;
+    scur->scmd_cur_sent = -1;
     scur->scmd_cur_cmd = &(*scur->scmd_cur_ptr_property)->rses_prop_data.sescmd;
 }
 
@@ -3605,11 +4528,8 @@ static bool execute_sescmd_history(backend_ref_t *bref)
  */
 static bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
 {
-    DCB *dcb;
     bool succp;
-    int rc = 0;
     sescmd_cursor_t *scur;
-    GWBUF *buf;
     if (backend_ref == NULL)
     {
         MXS_ERROR("[%s] Error: NULL parameter.", __FUNCTION__);
@@ -3620,9 +4540,8 @@ static bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
         succp = false;
         goto return_succp;
     }
-    dcb = backend_ref->bref_dcb;
 
-    CHK_DCB(dcb);
+    CHK_DCB(backend_ref->bref_dcb);
     CHK_BACKEND_REF(backend_ref);
 
     /**
@@ -3645,12 +4564,41 @@ static bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
         sescmd_cursor_set_active(scur, true);
     }
 
-    switch (scur->scmd_cur_cmd->my_sescmd_packet_type)
+    if (scur->scmd_cur_cmd->position <= scur->scmd_cur_sent)
+    {
+        /** The command was pipelined and only its reply is waited for */
+        succp = true;
+    }
+    else
+    {
+        succp = sescmd_write(backend_ref, scur->scmd_cur_cmd);
+    }
+
+return_succp:
+    return succp;
+}
+
+/**
+ * Write a session command to a backend.
+ *
+ * Router session must be locked.
+ *
+ * @param backend_ref The backend
+ * @param sescmd      The session command
+ * @return True if the command was written
+ */
+static bool sescmd_write(backend_ref_t *backend_ref, mysql_sescmd_t *sescmd)
+{
+    DCB *dcb = backend_ref->bref_dcb;
+    GWBUF *buf;
+    int rc = 0;
+
+    switch (sescmd->my_sescmd_packet_type)
     {
         case MYSQL_COM_CHANGE_USER:
             /** This makes it possible to handle replies correctly */
-            gwbuf_set_type(scur->scmd_cur_cmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
-            buf = sescmd_cursor_clone_querybuf(scur);
+            gwbuf_set_type(sescmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
+            buf = gwbuf_clone_all(sescmd->my_sescmd_buf);
             rc = dcb->func.auth(dcb, NULL, dcb->session, buf);
             break;
 
@@ -3665,7 +4613,7 @@ static bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
 
             data = dcb->session->client_dcb->data;
             *data->db = 0;
-            tmpbuf = scur->scmd_cur_cmd->my_sescmd_buf;
+            tmpbuf = sescmd->my_sescmd_buf;
             qlen = MYSQL_GET_PACKET_LEN((unsigned char *) GWBUF_DATA(tmpbuf));
             if (qlen)
             {
@@ -3689,22 +4637,51 @@ static bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
              * MySQL command to protocol
              */
 
-            gwbuf_set_type(scur->scmd_cur_cmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
-            buf = sescmd_cursor_clone_querybuf(scur);
+            gwbuf_set_type(sescmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
+            buf = gwbuf_clone_all(sescmd->my_sescmd_buf);
             rc = dcb->func.write(dcb, buf);
             break;
     }
 
     if (rc == 1)
     {
-        succp = true;
+        backend_ref->bref_sescmd_cur.scmd_cur_sent = sescmd->position;
     }
-    else
+
+    return rc == 1;
+}
+
+/**
+ * Check whether a command can be written to a backend before the replies to
+ * the session commands it is executing have arrived. This is possible if all
+ * of them have already been written and none is a COM_CHANGE_USER, which
+ * needs the reply before anything else can be written.
+ *
+ * Router session must be locked.
+ *
+ * @param scur     Session command cursor of the backend
+ * @param position Position the command would have in the history, the position
+ *                 of the last session command plus one for other commands
+ * @return True if the command can be written
+ */
+static bool sescmd_cursor_can_pipeline(sescmd_cursor_t *scur, int position)
+{
+    if (scur->scmd_cur_sent != position - 1)
     {
-        succp = false;
+        return false;
     }
-return_succp:
-    return succp;
+
+    for (rses_property_t *prop = *scur->scmd_cur_ptr_property; prop; prop = prop->rses_prop_next)
+    {
+        unsigned char type = prop->rses_prop_data.sescmd.my_sescmd_packet_type;
+
+        if (type != MYSQL_COM_QUERY && type != MYSQL_COM_INIT_DB)
+        {
+            return false;
+        }
+    }
+
+    return true;
 }
 
 /**
@@ -3949,7 +4926,7 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
     }
 
     if (router_cli_ses->rses_config.rw_max_sescmd_history_size > 0 &&
-        router_cli_ses->rses_nsescmd >=
+        router_cli_ses->rses_sescmd_hist_len >=
         router_cli_ses->rses_config.rw_max_sescmd_history_size)
     {
         MXS_WARNING("Router session exceeded session command history limit. "
@@ -3962,7 +4939,7 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
 
     if (router_cli_ses->rses_config.rw_disable_sescmd_hist)
     {
-        rses_property_t *prop, *tmp;
+        rses_property_t *prop;
         backend_ref_t *bref;
         bool conflict;
 
@@ -3991,9 +4968,7 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
                 break;
             }
 
-            tmp = prop;
-            router_cli_ses->rses_properties[RSES_PROP_TYPE_SESCMD] = prop->rses_prop_next;
-            rses_property_done(tmp);
+            sescmd_history_remove(router_cli_ses, &router_cli_ses->rses_properties[RSES_PROP_TYPE_SESCMD]);
             prop = router_cli_ses->rses_properties[RSES_PROP_TYPE_SESCMD];
         }
     }
@@ -4011,6 +4986,7 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
     }
 
     mysql_sescmd_init(prop, querybuf, packet_type, router_cli_ses);
+    sescmd_history_compact(router_cli_ses, &prop->rses_prop_data.sescmd);
 
     /** Add sescmd property to router client session */
     if (rses_property_add(router_cli_ses, prop) != 0)
@@ -4020,6 +4996,9 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
         return false;
     }
 
+    router_cli_ses->rses_sescmd_hist_len++;
+    router_cli_ses->rses_sescmd_hist_bytes += gwbuf_length(querybuf);
+
     for (i = 0; i < router_cli_ses->rses_nbackends; i++)
     {
         if (BREF_IS_IN_USE((&backend_ref[i])))
@@ -4052,10 +5031,30 @@ static bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
              */
             if (sescmd_cursor_is_active(scur))
             {
-                nsucc += 1;
-                MXS_INFO("Backend %s:%d already executing sescmd.",
-                         backend_ref[i].bref_backend->backend_server->name,
-                         backend_ref[i].bref_backend->backend_server->port);
+                mysql_sescmd_t *sescmd = &prop->rses_prop_data.sescmd;
+
+                if (router_cli_ses->rses_config.rw_pipeline_sescmd &&
+                    sescmd_cursor_can_pipeline(scur, sescmd->position))
+                {
+                    if (sescmd_write(&backend_ref[i], sescmd))
+                    {
+                        nsucc += 1;
+                        atomic_add(&inst->stats.n_pipelined, 1);
+                    }
+                    else
+                    {
+                        MXS_ERROR("Failed to execute session command in %s:%d",
+                                  backend_ref[i].bref_backend->backend_server->name,
+                                  backend_ref[i].bref_backend->backend_server->port);
+                    }
+                }
+                else
+                {
+                    nsucc += 1;
+                    MXS_INFO("Backend %s:%d already executing sescmd.",
+                             backend_ref[i].bref_backend->backend_server->name,
+                             backend_ref[i].bref_backend->backend_server->port);
+                }
             }
             else
             {
@@ -4160,14 +5159,15 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
                 c = GET_SELECT_CRITERIA(value);
                 ss_dassert(c == LEAST_GLOBAL_CONNECTIONS ||
                            c == LEAST_ROUTER_CONNECTIONS || c == LEAST_BEHIND_MASTER ||
-                           c == LEAST_CURRENT_OPERATIONS || c == UNDEFINED_CRITERIA);
+                           c == LEAST_CURRENT_OPERATIONS || c == ADAPTIVE_ROUTING ||
+                           c == UNDEFINED_CRITERIA);
 
                 if (c == UNDEFINED_CRITERIA)
                 {
                     MXS_ERROR("Unknown slave selection criteria \"%s\". "
                                 "Allowed values are LEAST_GLOBAL_CONNECTIONS, "
-                                "LEAST_ROUTER_CONNECTIONS, LEAST_BEHIND_MASTER,"
-                                "and LEAST_CURRENT_OPERATIONS.",
+                                "LEAST_ROUTER_CONNECTIONS, LEAST_BEHIND_MASTER, "
+                                "LEAST_CURRENT_OPERATIONS and ADAPTIVE_ROUTING.",
                                 STRCRITERIA(router->rwsplit_config.rw_slave_select_criteria));
                     success = false;
                 }
@@ -4212,6 +5212,28 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
                     success = false;
                 }
             }
+            else if (strcmp(options[i], "pipeline_session_commands") == 0)
+            {
+                router->rwsplit_config.rw_pipeline_sescmd = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "causal_reads") == 0)
+            {
+                router->rwsplit_config.rw_causal_reads = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "causal_reads_timeout") == 0)
+            {
+                int timeout = atoi(value);
+
+                if (timeout > 0)
+                {
+                    router->rwsplit_config.rw_causal_reads_timeout = timeout;
+                }
+                else
+                {
+                    MXS_ERROR("Invalid value for 'causal_reads_timeout': %s", value);
+                    success = false;
+                }
+            }
             else
             {
                 MXS_ERROR("Unknown router option \"%s=%s\" for readwritesplit router.",
@@ -4979,3 +6001,257 @@ static bool send_readonly_error(DCB *dcb)
 
     return succp;
 }
+
+/**
+ * Store the GTID of the latest write of the session. The master reports it
+ * in the OK packet of the write when last_gtid is listed in the server's
+ * session_track_system_variables. The GTID also covers the earlier writes of
+ * the session whose GTIDs were not reported.
+ *
+ * @param rses  Router client session
+ * @param reply Reply from the master
+ */
+static void store_last_gtid(ROUTER_CLIENT_SES *rses, GWBUF *reply)
+{
+    uint8_t *ptr = GWBUF_DATA(reply);
+    uint8_t *end = ptr + GWBUF_LENGTH(reply);
+    char gtid[RWSPLIT_GTID_MAX_LEN];
+
+    /** The OK packets of a multi-statement follow each other */
+    while (ptr + MYSQL_HEADER_LEN < end && MYSQL_GET_COMMAND(ptr) == 0x00)
+    {
+        size_t len = MYSQL_GET_PACKET_LEN(ptr) + MYSQL_HEADER_LEN;
+
+        if (ptr + len > end)
+        {
+            break;
+        }
+
+        if (mxs_mysql_get_tracked_variable(ptr, len, "last_gtid", gtid, sizeof(gtid)) && *gtid)
+        {
+            strcpy(rses->rses_last_gtid, gtid);
+            rses->rses_gtid_version++;
+            rses->rses_gtid_unknown = false;
+        }
+
+        ptr += len;
+    }
+}
+
+/**
+ * Check the reply to a GTID wait.
+ *
+ * @param reply Contiguous reply to SELECT MASTER_GTID_WAIT(...)
+ * @return -1 if the reply is not complete, 1 if the server replicated the GTID
+ * and 0 if it did not or the wait failed
+ */
+static int gtid_wait_result(GWBUF *reply)
+{
+    uint8_t *ptr = GWBUF_DATA(reply);
+    uint8_t *end = ptr + GWBUF_LENGTH(reply);
+    int n_eof = 0;
+    bool replicated = false;
+
+    while (ptr + MYSQL_HEADER_LEN < end)
+    {
+        size_t len = MYSQL_GET_PACKET_LEN(ptr) + MYSQL_HEADER_LEN;
+
+        if (ptr + len > end)
+        {
+            break;
+        }
+
+        if (MYSQL_IS_ERROR_PACKET(ptr))
+        {
+            return 0;
+        }
+        else if (MYSQL_GET_COMMAND(ptr) == 0xfe && len < MYSQL_HEADER_LEN + 9)
+        {
+            if (++n_eof == 2)
+            {
+                return replicated ? 1 : 0;
+            }
+        }
+        else if (n_eof == 1)
+        {
+            /** The only row, MASTER_GTID_WAIT() returns 0 on success */
+            replicated = len == MYSQL_HEADER_LEN + 2 && ptr[4] == 1 && ptr[5] == '0';
+        }
+
+        ptr += len;
+    }
+
+    return -1;
+}
+
+/**
+ * Route a read that must see the latest write of the session to a slave.
+ * The slave is first asked to wait until it has replicated the write and
+ * the read is sent when the wait has succeeded.
+ *
+ * @param inst     Router instance
+ * @param rses     Router client session
+ * @param bref     The slave
+ * @param querybuf The read
+ * @return True if the wait was sent or the read routed to the master
+ */
+static bool route_causal_read(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                              backend_ref_t *bref, GWBUF *querybuf)
+{
+    if (sescmd_cursor_is_active(&bref->bref_sescmd_cur))
+    {
+        /** The wait can't be sent before the session command has been executed */
+        return route_causal_read_to_master(inst, rses, gwbuf_clone(querybuf));
+    }
+
+    char sql[RWSPLIT_GTID_MAX_LEN + 64];
+    snprintf(sql, sizeof(sql), "SELECT MASTER_GTID_WAIT('%s', %d)",
+             rses->rses_last_gtid, rses->rses_config.rw_causal_reads_timeout);
+
+    GWBUF *wait = modutil_create_query(sql);
+
+    if (wait == NULL || bref->bref_dcb->func.write(bref->bref_dcb, wait) != 1)
+    {
+        MXS_ERROR("Routing the GTID wait of a causal read to %s:%d failed.",
+                  bref->bref_backend->backend_server->name,
+                  bref->bref_backend->backend_server->port);
+        return false;
+    }
+
+    ss_dassert(bref->bref_pending_cmd == NULL);
+    bref->bref_pending_cmd = gwbuf_clone(querybuf);
+    bref_set_state(bref, BREF_WAITING_GTID);
+    bref_set_state(bref, BREF_WAITING_RESULT);
+
+    return true;
+}
+
+/**
+ * Route a causal read to the master because no slave could serve it. If there
+ * is no master, or the master is executing session commands and already has
+ * a query waiting for them, an error is sent to the client.
+ *
+ * @param inst     Router instance
+ * @param rses     Router client session
+ * @param querybuf The read, freed by this function
+ * @return True if the read was routed or the error sent
+ */
+static bool route_causal_read_to_master(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                        GWBUF *querybuf)
+{
+    backend_ref_t *master = rses->rses_master_ref;
+    const char *errmsg = NULL;
+    bool succp = false;
+
+    /** The read was counted as one to a slave when it was routed */
+    atomic_add(&inst->stats.n_slave, -1);
+    atomic_add(&inst->stats.n_causal_master, 1);
+
+    if (master == NULL || !BREF_IS_IN_USE(master))
+    {
+        errmsg = "No slave replicated the latest write in time and no master is available";
+    }
+    else if (sescmd_cursor_is_active(&master->bref_sescmd_cur))
+    {
+        /**
+         * The read is sent by clientReply once the session commands have
+         * been executed. Writing it now would put it in the middle of them.
+         */
+        if (master->bref_pending_cmd == NULL)
+        {
+            atomic_add(&inst->stats.n_master, 1);
+            master->bref_pending_cmd = querybuf;
+            querybuf = NULL;
+            succp = true;
+        }
+        else
+        {
+            errmsg = "No slave replicated the latest write in time and the master "
+                     "already has a query waiting for its session commands";
+        }
+    }
+    else
+    {
+        atomic_add(&inst->stats.n_master, 1);
+
+        if ((succp = master->bref_dcb->func.write(master->bref_dcb, querybuf) == 1))
+        {
+            atomic_add(&inst->stats.n_queries, 1);
+            bref_set_state(master, BREF_QUERY_ACTIVE);
+            bref_set_state(master, BREF_WAITING_RESULT);
+        }
+        else
+        {
+            MXS_ERROR("Routing causal read to master failed.");
+        }
+
+        querybuf = NULL;
+    }
+
+    if (errmsg)
+    {
+        GWBUF *err = modutil_create_mysql_err_msg(1, 0, ER_UNKNOWN_ERROR, "HY000", errmsg);
+        succp = err && rses->client_dcb->func.write(rses->client_dcb, err);
+    }
+
+    gwbuf_free(querybuf);
+    return succp;
+}
+
+/**
+ * Handle the reply to the GTID wait of a causal read. Once the reply is
+ * complete, the read is sent to the slave if the slave replicated the write
+ * and to the master if it did not.
+ *
+ * @param inst  Router instance
+ * @param rses  Router client session
+ * @param bref  The slave
+ * @param reply Reply from the slave
+ */
+static void handle_causal_read_reply(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                     backend_ref_t *bref, GWBUF *reply)
+{
+    bref->bref_gtid_reply = gwbuf_make_contiguous(gwbuf_append(bref->bref_gtid_reply, reply));
+
+    int result = gtid_wait_result(bref->bref_gtid_reply);
+
+    if (result == -1)
+    {
+        return;
+    }
+
+    GWBUF *querybuf = bref->bref_pending_cmd;
+
+    gwbuf_free(bref->bref_gtid_reply);
+    bref->bref_gtid_reply = NULL;
+    bref->bref_pending_cmd = NULL;
+    bref_clear_state(bref, BREF_WAITING_GTID);
+    bref_clear_state(bref, BREF_WAITING_RESULT);
+
+    if (result == 1)
+    {
+        bref->bref_gtid_version = rses->rses_gtid_version;
+
+        if (bref->bref_dcb->func.write(bref->bref_dcb, querybuf) == 1)
+        {
+            atomic_add(&inst->stats.n_queries, 1);
+            atomic_add(&inst->stats.n_causal_slave, 1);
+            bref_set_state(bref, BREF_QUERY_ACTIVE);
+            bref_set_state(bref, BREF_WAITING_RESULT);
+        }
+        else
+        {
+            MXS_ERROR("Routing causal read to %s:%d failed.",
+                      bref->bref_backend->backend_server->name,
+                      bref->bref_backend->backend_server->port);
+        }
+    }
+    else
+    {
+        MXS_INFO("%s:%d did not replicate GTID %s in %d seconds, routing the read to master.",
+                 bref->bref_backend->backend_server->name,
+                 bref->bref_backend->backend_server->port,
+                 rses->rses_last_gtid, rses->rses_config.rw_causal_reads_timeout);
+        route_causal_read_to_master(inst, rses, querybuf);
+    }
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testsescmdhistory.c Tests of the session command history of
+ * readwritesplit
+ *
+ * The history functions are internal to the router, the router source is
+ * included here to reach them.
+ */
+
+// To ensure that ss_info_assert asserts also when building in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+
+#include "../readwritesplit.c"
+
+#define N_BACKENDS 2
+
+static ROUTER_INSTANCE test_router;
+static backend_ref_t test_brefs[N_BACKENDS];
+
+static ROUTER_CLIENT_SES *make_session()
+{
+    ROUTER_CLIENT_SES *rses = MXS_CALLOC(1, sizeof(ROUTER_CLIENT_SES));
+    ss_info_dassert(rses, "Allocating the session should succeed");
+
+    rses->rses_chk_top = CHK_NUM_ROUTER_SES;
+    rses->rses_chk_tail = CHK_NUM_ROUTER_SES;
+    spinlock_init(&rses->rses_lock);
+    spinlock_acquire(&rses->rses_lock);
+    rses->router = &test_router;
+    rses->rses_backend_ref = test_brefs;
+    rses->rses_nbackends = N_BACKENDS;
+    memset(test_brefs, 0, sizeof(test_brefs));
+
+    return rses;
+}
+
+/**
+ * Add a command to the history the way route_session_write() does
+ */
+static void add_command(ROUTER_CLIENT_SES *rses, const char *sql)
+{
+    GWBUF *buf = modutil_create_query((char*)sql);
+    rses_property_t *prop = rses_property_init(RSES_PROP_TYPE_SESCMD);
+    ss_info_dassert(buf && prop, "Creating the command should succeed");
+
+    mysql_sescmd_init(prop, buf, MYSQL_COM_QUERY, rses);
+    sescmd_history_compact(rses, &prop->rses_prop_data.sescmd);
+    rses_property_add(rses, prop);
+    rses->rses_sescmd_hist_len++;
+    rses->rses_sescmd_hist_bytes += gwbuf_length(buf);
+}
+
+/** A backend starts to use the session, it replays the whole history */
+static void connect_backend(ROUTER_CLIENT_SES *rses, int i)
+{
+    rses->rses_backend_ref[i].bref_state = BREF_IN_USE;
+    rses->rses_backend_ref[i].bref_sescmd_cur.scmd_cur_ptr_property =
+        &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+}
+
+/** A backend executes its next command */
+static void execute_next(ROUTER_CLIENT_SES *rses, int i)
+{
+    sescmd_cursor_t *scur = &rses->rses_backend_ref[i].bref_sescmd_cur;
+    ss_info_dassert(*scur->scmd_cur_ptr_property, "The backend should have a command to execute");
+    scur->scmd_cur_ptr_property = &(*scur->scmd_cur_ptr_property)->rses_prop_next;
+}
+
+static void execute_all(ROUTER_CLIENT_SES *rses, int i)
+{
+    while (*rses->rses_backend_ref[i].bref_sescmd_cur.scmd_cur_ptr_property)
+    {
+        execute_next(rses, i);
+    }
+}
+
+/**
+ * Check that replaying the history from the start only deallocates
+ * statements that it has prepared
+ */
+static bool history_is_replayable(ROUTER_CLIENT_SES *rses)
+{
+    for (rses_property_t *prop = rses->rses_properties[RSES_PROP_TYPE_SESCMD]; prop;
+         prop = prop->rses_prop_next)
+    {
+        mysql_sescmd_t *cmd = &prop->rses_prop_data.sescmd;
+
+        if (cmd->my_sescmd_kind == SESCMD_DEALLOCATE)
+        {
+            bool prepared = false;
+
+            for (rses_property_t *p = rses->rses_properties[RSES_PROP_TYPE_SESCMD]; p != prop;
+                 p = p->rses_prop_next)
+            {
+                mysql_sescmd_t *old = &p->rses_prop_data.sescmd;
+
+                if (strcmp(old->my_sescmd_key, cmd->my_sescmd_key) == 0)
+                {
+                    if (old->my_sescmd_kind == SESCMD_PREPARE)
+                    {
+                        prepared = true;
+                    }
+                    else if (old->my_sescmd_kind == SESCMD_DEALLOCATE)
+                    {
+                        prepared = false;
+                    }
+                }
+            }
+
+            if (!prepared)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static int count_kind(ROUTER_CLIENT_SES *rses, sescmd_kind_t kind)
+{
+    int n = 0;
+
+    for (rses_property_t *prop = rses->rses_properties[RSES_PROP_TYPE_SESCMD]; prop;
+         prop = prop->rses_prop_next)
+    {
+        if (prop->rses_prop_data.sescmd.my_sescmd_kind == kind)
+        {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+static void free_session(ROUTER_CLIENT_SES *rses)
+{
+    while (rses->rses_properties[RSES_PROP_TYPE_SESCMD])
+    {
+        sescmd_history_remove(rses, &rses->rses_properties[RSES_PROP_TYPE_SESCMD]);
+    }
+
+    spinlock_release(&rses->rses_lock);
+    MXS_FREE(rses);
+}
+
+/**
+ * A backend connects after the preparation was executed but before the
+ * deallocation was
+ */
+static int test_deallocate()
+{
+    ROUTER_CLIENT_SES *rses = make_session();
+
+    connect_backend(rses, 0);
+    add_command(rses, "PREPARE p FROM 'SELECT 1'");
+    execute_all(rses, 0);
+    add_command(rses, "DEALLOCATE PREPARE p");
+    add_command(rses, "SET @a = 1");
+
+    ss_info_dassert(count_kind(rses, SESCMD_PREPARE) == 1,
+                    "The preparation should be kept until the deallocation is executed");
+    ss_info_dassert(history_is_replayable(rses), "The history should be replayable");
+
+    connect_backend(rses, 1);
+    execute_all(rses, 0);
+    add_command(rses, "SET @b = 1");
+    ss_info_dassert(count_kind(rses, SESCMD_PREPARE) == 1 &&
+                    count_kind(rses, SESCMD_DEALLOCATE) == 1,
+                    "The pair should be kept while a backend is replaying it");
+    ss_info_dassert(history_is_replayable(rses), "The history should be replayable");
+
+    execute_all(rses, 1);
+    add_command(rses, "SET @c = 1");
+    ss_info_dassert(count_kind(rses, SESCMD_PREPARE) == 0 &&
+                    count_kind(rses, SESCMD_DEALLOCATE) == 0,
+                    "The pair should be removed once all backends have executed it");
+    ss_info_dassert(rses->rses_sescmd_hist_len == 3, "Only the assignments should be left");
+
+    free_session(rses);
+    return 0;
+}
+
+/**
+ * A statement prepared again after a deallocation
+ */
+static int test_prepare_again()
+{
+    ROUTER_CLIENT_SES *rses = make_session();
+
+    connect_backend(rses, 0);
+    add_command(rses, "PREPARE p FROM 'SELECT 1'");
+    add_command(rses, "PREPARE p FROM 'SELECT 2'");
+    execute_next(rses, 0);
+    add_command(rses, "DEALLOCATE PREPARE p");
+    ss_info_dassert(count_kind(rses, SESCMD_PREPARE) == 1,
+                    "A preparation that is prepared again should be removed");
+
+    execute_next(rses, 0);
+    add_command(rses, "PREPARE p FROM 'SELECT 3'");
+    ss_info_dassert(count_kind(rses, SESCMD_PREPARE) == 2,
+                    "A preparation should not be superseded before its deallocation");
+    ss_info_dassert(history_is_replayable(rses), "The history should be replayable");
+
+    execute_all(rses, 0);
+    add_command(rses, "SET @a = 1");
+    ss_info_dassert(count_kind(rses, SESCMD_PREPARE) == 1 &&
+                    count_kind(rses, SESCMD_DEALLOCATE) == 0,
+                    "Only the last preparation should be left");
+
+    /** A deallocation of a statement that isn't prepared is dropped alone */
+    add_command(rses, "DEALLOCATE PREPARE q");
+    execute_all(rses, 0);
+    add_command(rses, "SET @a = 2");
+    ss_info_dassert(count_kind(rses, SESCMD_DEALLOCATE) == 0,
+                    "An unpaired deallocation should be removed");
+    ss_info_dassert(history_is_replayable(rses), "The history should be replayable");
+
+    free_session(rses);
+    return 0;
+}
+
+static GWBUF *make_ok(uint8_t seq, gwbuf_type_t type)
+{
+    uint8_t ok[] = {7, 0, 0, seq, 0, 0, 0, 2, 0, 0, 0};
+    GWBUF *buf = gwbuf_alloc_and_load(sizeof(ok), ok);
+    gwbuf_set_type(buf, type);
+    return buf;
+}
+
+/**
+ * The reply to a query pipelined behind a session command is told apart
+ * from the session command reply
+ */
+static int test_pipelined_reply()
+{
+    ROUTER_CLIENT_SES *rses = make_session();
+    SERVER server = {.unique_name = "server1", .name = "127.0.0.1", .port = 3306};
+    BACKEND backend = {.backend_server = &server};
+    backend_ref_t *bref = &rses->rses_backend_ref[0];
+    DCB *dcb = (DCB *)&backend; // Only compared to the DCB of the master
+    bool reconnect = false;
+    GWBUF *query_reply;
+
+    connect_backend(rses, 0);
+    bref->bref_backend = &backend;
+    bref->bref_dcb = dcb;
+    bref->bref_num_result_wait = 1;
+    bref->bref_sescmd_cur.scmd_cur_rses = rses;
+    bref->bref_sescmd_cur.scmd_cur_chk_top = CHK_NUM_SESCMD_CUR;
+    bref->bref_sescmd_cur.scmd_cur_chk_tail = CHK_NUM_SESCMD_CUR;
+    rses->rses_master_ref = bref;
+
+    add_command(rses, "SET @a = 1");
+    add_command(rses, "SET @b = 1");
+    sescmd_cursor_reset(&bref->bref_sescmd_cur);
+    sescmd_cursor_set_active(&bref->bref_sescmd_cur, true);
+
+    /** The reply to the first command only */
+    GWBUF *reply = make_ok(1, GWBUF_TYPE_SESCMD_RESPONSE | GWBUF_TYPE_RESPONSE_END);
+    reply = sescmd_cursor_process_replies(reply, bref, &reconnect, &query_reply);
+    ss_info_dassert(reply && gwbuf_length(reply) == 11 && query_reply == NULL,
+                    "A session command reply should not be taken for a query reply");
+    ss_info_dassert(sescmd_cursor_is_active(&bref->bref_sescmd_cur),
+                    "The second command should still be waited for");
+    gwbuf_free(reply);
+
+    /** The reply to the second command and the query behind it */
+    reply = make_ok(1, GWBUF_TYPE_SESCMD_RESPONSE | GWBUF_TYPE_RESPONSE_END);
+    reply = gwbuf_append(reply, make_ok(1, GWBUF_TYPE_SESCMD_RESPONSE));
+    reply = sescmd_cursor_process_replies(reply, bref, &reconnect, &query_reply);
+    ss_info_dassert(reply && gwbuf_length(reply) == 11,
+                    "Only the session command reply should be returned as such");
+    ss_info_dassert(query_reply && gwbuf_length(query_reply) == 11,
+                    "The bytes after the last session command reply should be the query reply");
+    ss_info_dassert(!sescmd_cursor_is_active(&bref->bref_sescmd_cur) && !reconnect,
+                    "All session commands should be replied");
+    gwbuf_free(reply);
+    gwbuf_free(query_reply);
+
+    rses->rses_master_ref = NULL;
+    free_session(rses);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rval = 0;
+
+    rval += test_deallocate();
+    rval += test_prepare_again();
+    rval += test_pipelined_reply();
+
+    return rval;
+}
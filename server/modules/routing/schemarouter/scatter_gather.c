@@ -0,0 +1,2011 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file scatter_gather.c Merging of the results of a SELECT executed on several shards
+ *
+ * The statement is inspected with a small tokenizer that only looks at the
+ * top level clauses of the SELECT. The replies of the shards are collected
+ * until they are complete and then merged using the column definitions of
+ * the first shard. Values are compared numerically if the column has a
+ * numeric type and byte by byte if it has the binary character set. The
+ * shards compare other values with the collation of the column, so results
+ * that are sorted by them or take their MIN or MAX are not merged.
+ */
+
+#include "scatter_gather.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <mysql.h>
+#include <maxscale/alloc.h>
+#include <log_manager.h>
+#include <skygw_utils.h>
+#include <modutil.h>
+#include <mysql_client_server_protocol.h>
+
+/** The decimals of a column definition for floating point values */
+#define SCATTER_NOT_FIXED_DEC 31
+
+/** The payload length of a packet that is continued in the next packet */
+#define SCATTER_MAX_PAYLOAD 0xffffff
+
+/** The error sent to the client when the replies can't be merged */
+#define SCATTER_ERRNO 1815
+#define SCATTER_ERRSTATE "HY000"
+
+/** The character set of binary strings and temporal values */
+#define SCATTER_BINARY_CHARSET 63
+
+/**
+ * The digits of the exact sums of integer and DECIMAL columns. A DECIMAL has
+ * at most 65 digits and 38 of them after the decimal point.
+ */
+#define SCATTER_SUM_INT_DIGITS 80
+#define SCATTER_SUM_FRAC_DIGITS 40
+#define SCATTER_SUM_DIGITS (SCATTER_SUM_INT_DIGITS + SCATTER_SUM_FRAC_DIGITS)
+
+/** Size of a formatted sum: the sign, the digits, the decimal point and the terminator */
+#define SCATTER_NUMBER_LEN (SCATTER_SUM_DIGITS + 3)
+
+typedef enum sql_token_type
+{
+    TOKEN_WORD,         /*< Keyword, identifier or number */
+    TOKEN_IDENTIFIER,   /*< Quoted identifier */
+    TOKEN_STRING,       /*< String literal */
+    TOKEN_PUNCTUATION
+} sql_token_type_t;
+
+typedef struct sql_token
+{
+    const char*      start;
+    int              len;
+    int              depth; /*< Depth of parentheses the token is in */
+    sql_token_type_t type;
+} sql_token_t;
+
+/** A value of a row */
+typedef struct field
+{
+    const uint8_t* data;
+    size_t         len;
+    bool           null;
+} field_t;
+
+/** A column definition */
+typedef struct column
+{
+    field_t name;
+    field_t org_name;
+    uint16_t charset;
+    uint8_t type;
+    uint8_t decimals;
+} column_t;
+
+/** The packets of a result set */
+typedef struct result
+{
+    uint8_t* header;    /*< The column count packet */
+    uint8_t* rows;      /*< The first row, after the EOF of the column definitions */
+    uint8_t* eof;       /*< The EOF after the rows */
+    uint8_t* end;
+    int      n_columns;
+    int      n_rows;
+} result_t;
+
+/** What the rows are sorted by */
+typedef struct sort_context
+{
+    int            n_keys;
+    bool           numeric[SCATTER_MAX_ORDER];
+    bool           desc[SCATTER_MAX_ORDER];
+} sort_context_t;
+
+/**
+ * An exact sum of decimal numbers. The digits are in fixed point with
+ * SCATTER_SUM_FRAC_DIGITS digits after the decimal point, the most significant
+ * digit first.
+ */
+typedef struct decimal_sum
+{
+    uint8_t positive[SCATTER_SUM_DIGITS]; /*< Sum of the positive values */
+    uint8_t negative[SCATTER_SUM_DIGITS]; /*< Sum of the absolute values of the negative values */
+} decimal_sum_t;
+
+typedef struct merge_row
+{
+    uint8_t*              packet;
+    size_t                len;   /*< Length of the packet with the header */
+    int                   index; /*< Order of arrival, keeps the sort stable */
+    field_t*              keys;
+    const sort_context_t* ctx;
+} merge_row_t;
+
+static const char* aggregate_functions[] =
+{
+    "AVG", "BIT_AND", "BIT_OR", "BIT_XOR", "COUNT", "GROUP_CONCAT", "JSON_ARRAYAGG",
+    "JSON_OBJECTAGG", "MAX", "MIN", "STD", "STDDEV", "STDDEV_POP", "STDDEV_SAMP",
+    "SUM", "VARIANCE", "VAR_POP", "VAR_SAMP", NULL
+};
+
+static const char* select_modifiers[] =
+{
+    "ALL", "DISTINCT", "DISTINCTROW", "HIGH_PRIORITY", "STRAIGHT_JOIN", "SQL_SMALL_RESULT",
+    "SQL_BIG_RESULT", "SQL_BUFFER_RESULT", "SQL_CACHE", "SQL_NO_CACHE", "SQL_CALC_FOUND_ROWS",
+    NULL
+};
+
+/** Top level clauses whose results can't be merged */
+static const char* unsupported_clauses[] =
+{
+    "GROUP", "HAVING", "UNION", "INTO", "FOR", "LOCK", "PROCEDURE", "WINDOW", NULL
+};
+
+static bool is_word(const sql_token_t* tok, const char* word)
+{
+    return tok->type == TOKEN_WORD && tok->len == (int)strlen(word) &&
+           strncasecmp(tok->start, word, tok->len) == 0;
+}
+
+static bool is_punct(const sql_token_t* tok, char c)
+{
+    return tok->type == TOKEN_PUNCTUATION && *tok->start == c;
+}
+
+static bool is_one_of(const sql_token_t* tok, const char** words)
+{
+    for (int i = 0; words[i]; i++)
+    {
+        if (is_word(tok, words[i]))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool is_number(const sql_token_t* tok)
+{
+    for (int i = 0; i < tok->len; i++)
+    {
+        if (!isdigit(tok->start[i]))
+        {
+            return false;
+        }
+    }
+
+    return tok->type == TOKEN_WORD;
+}
+
+static bool is_name(const sql_token_t* tok)
+{
+    return tok->type == TOKEN_IDENTIFIER || (tok->type == TOKEN_WORD && !is_number(tok));
+}
+
+/**
+ * Split a statement into tokens. Comments are skipped.
+ *
+ * @param sql      The statement
+ * @param n_tokens Where the number of tokens is stored
+ * @return The tokens or NULL if memory allocation failed
+ */
+static sql_token_t* tokenize(const char* sql, int* n_tokens)
+{
+    int size = 64;
+    int n = 0;
+    int depth = 0;
+    sql_token_t* tokens = MXS_MALLOC(size * sizeof(sql_token_t));
+    const char* ptr = sql;
+
+    while (tokens && *ptr)
+    {
+        if (isspace(*ptr))
+        {
+            ptr++;
+            continue;
+        }
+        else if (*ptr == '#' || (ptr[0] == '-' && ptr[1] == '-' && (ptr[2] == '\0' || isspace(ptr[2]))))
+        {
+            while (*ptr && *ptr != '\n')
+            {
+                ptr++;
+            }
+            continue;
+        }
+        else if (ptr[0] == '/' && ptr[1] == '*')
+        {
+            const char* end = strstr(ptr + 2, "*/");
+            ptr = end ? end + 2 : ptr + strlen(ptr);
+            continue;
+        }
+
+        if (n == size)
+        {
+            size *= 2;
+            sql_token_t* tmp = MXS_REALLOC(tokens, size * sizeof(sql_token_t));
+
+            if (tmp == NULL)
+            {
+                MXS_FREE(tokens);
+                return NULL;
+            }
+            tokens = tmp;
+        }
+
+        sql_token_t* tok = &tokens[n++];
+        tok->start = ptr;
+        tok->depth = depth;
+
+        if (isalnum(*ptr) || *ptr == '_' || *ptr == '$')
+        {
+            while (isalnum(*ptr) || *ptr == '_' || *ptr == '$')
+            {
+                ptr++;
+            }
+            tok->type = TOKEN_WORD;
+        }
+        else if (*ptr == '`' || *ptr == '\'' || *ptr == '"')
+        {
+            char quote = *ptr++;
+
+            while (*ptr && *ptr != quote)
+            {
+                if (*ptr == '\\' && quote != '`' && ptr[1])
+                {
+                    ptr++;
+                }
+                ptr++;
+            }
+
+            if (*ptr)
+            {
+                ptr++;
+            }
+            tok->type = quote == '`' ? TOKEN_IDENTIFIER : TOKEN_STRING;
+        }
+        else
+        {
+            if (*ptr == '(')
+            {
+                depth++;
+            }
+            else if (*ptr == ')' && depth > 0)
+            {
+                tok->depth = --depth;
+            }
+            ptr++;
+            tok->type = TOKEN_PUNCTUATION;
+        }
+
+        tok->len = ptr - tok->start;
+    }
+
+    *n_tokens = n;
+    return tokens;
+}
+
+/**
+ * Copy a name token without the quotes
+ */
+static void copy_name(const sql_token_t* tok, char* dest)
+{
+    const char* start = tok->start;
+    int len = tok->len;
+
+    if (tok->type == TOKEN_IDENTIFIER && len >= 2)
+    {
+        start++;
+        len -= 2;
+    }
+
+    len = MIN(len, SCATTER_NAME_MAXLEN);
+    memcpy(dest, start, len);
+    dest[len] = '\0';
+}
+
+static bool same_name(const sql_token_t* tok, const char* name)
+{
+    char buf[SCATTER_NAME_MAXLEN + 1];
+    copy_name(tok, buf);
+    return strcasecmp(buf, name) == 0;
+}
+
+/**
+ * Find the name of a column of the select list: the alias or, for a
+ * column reference, the name of the column.
+ *
+ * @param tokens The tokens of the column
+ * @param n      Number of tokens
+ * @param star   Set to true if the column is a wildcard
+ * @return The token with the name or NULL if the column has no name
+ */
+static const sql_token_t* column_name(const sql_token_t* tokens, int n, bool* star)
+{
+    const sql_token_t* last = &tokens[n - 1];
+
+    if (is_punct(last, '*') && (n == 1 || is_punct(&tokens[n - 2], '.')))
+    {
+        *star = true;
+        return NULL;
+    }
+
+    if (!is_name(last))
+    {
+        return NULL;
+    }
+
+    if (n >= 2 && is_word(&tokens[n - 2], "AS"))
+    {
+        return last;
+    }
+
+    /** A column reference is a chain of names separated by dots */
+    for (int i = 0; i < n; i++)
+    {
+        if ((i % 2 == 0 && !is_name(&tokens[i])) || (i % 2 == 1 && !is_punct(&tokens[i], '.')))
+        {
+            /** An expression followed by an alias without AS */
+            return n >= 2 && !is_punct(&tokens[n - 2], '.') ? last : NULL;
+        }
+    }
+
+    return n % 2 == 1 ? last : NULL;
+}
+
+/**
+ * Check how a column of the select list is merged
+ *
+ * @param tokens The tokens of the column
+ * @param n      Number of tokens
+ * @param agg    Where the aggregate function of the column is stored
+ * @return False if the column can't be merged
+ */
+static bool column_aggregate(const sql_token_t* tokens, int n, scatter_aggregate_t* agg)
+{
+    *agg = SCATTER_AGG_NONE;
+
+    if (n >= 3 && is_punct(&tokens[1], '('))
+    {
+        if (is_word(&tokens[0], "COUNT"))
+        {
+            *agg = SCATTER_AGG_COUNT;
+        }
+        else if (is_word(&tokens[0], "SUM"))
+        {
+            *agg = SCATTER_AGG_SUM;
+        }
+        else if (is_word(&tokens[0], "MIN"))
+        {
+            *agg = SCATTER_AGG_MIN;
+        }
+        else if (is_word(&tokens[0], "MAX"))
+        {
+            *agg = SCATTER_AGG_MAX;
+        }
+    }
+
+    if (*agg != SCATTER_AGG_NONE)
+    {
+        int close = 2;
+
+        while (close < n && !(is_punct(&tokens[close], ')') && tokens[close].depth == tokens[1].depth))
+        {
+            close++;
+        }
+
+        int rest = n - close - 1;
+
+        /** The aggregate must be the whole column, optionally with an alias */
+        return close < n && !is_word(&tokens[2], "DISTINCT") &&
+               (rest == 0 ||
+                (rest == 1 && is_name(&tokens[n - 1])) ||
+                (rest == 2 && is_word(&tokens[n - 2], "AS") && is_name(&tokens[n - 1])));
+    }
+
+    /** Aggregates inside other expressions can't be merged */
+    for (int i = 0; i < n - 1; i++)
+    {
+        if (is_one_of(&tokens[i], aggregate_functions) && is_punct(&tokens[i + 1], '('))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Parse the ORDER BY clause
+ */
+static bool parse_order_by(const sql_token_t* tokens, int start, int end, scatter_plan_t* plan,
+                           const sql_token_t** names, int n_names, bool star)
+{
+    while (start < end)
+    {
+        int stop = start;
+
+        while (stop < end && !(tokens[stop].depth == 0 && is_punct(&tokens[stop], ',')))
+        {
+            stop++;
+        }
+
+        if (stop == start || plan->n_order == SCATTER_MAX_ORDER)
+        {
+            return false;
+        }
+
+        scatter_order_t* order = &plan->order[plan->n_order++];
+        int last = stop - 1;
+
+        if (is_word(&tokens[last], "DESC") || is_word(&tokens[last], "ASC"))
+        {
+            order->desc = is_word(&tokens[last], "DESC");
+            last--;
+        }
+
+        if (last == start && is_number(&tokens[start]))
+        {
+            order->position = atoi(tokens[start].start);
+
+            if (order->position < 1 || (!star && order->position > n_names))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            for (int i = start; i <= last; i++)
+            {
+                if (((i - start) % 2 == 0 && !is_name(&tokens[i])) ||
+                    ((i - start) % 2 == 1 && !is_punct(&tokens[i], '.')))
+                {
+                    return false;
+                }
+            }
+
+            if (last < start || (last - start) % 2 == 1)
+            {
+                return false;
+            }
+
+            copy_name(&tokens[last], order->name);
+
+            /** The column must be in the results for the rows to be sorted */
+            bool found = star;
+
+            for (int i = 0; i < n_names && !found; i++)
+            {
+                found = names[i] && same_name(names[i], order->name);
+            }
+
+            if (!found)
+            {
+                return false;
+            }
+        }
+
+        start = stop + 1;
+    }
+
+    return true;
+}
+
+/**
+ * Parse the LIMIT clause
+ */
+static bool parse_limit(const char* sql, const sql_token_t* tokens, int start, int end,
+                        scatter_plan_t* plan)
+{
+    int n = end - start - 1;
+    const sql_token_t* args = &tokens[start + 1];
+
+    if (n == 1 && is_number(&args[0]))
+    {
+        plan->limit = strtoll(args[0].start, NULL, 10);
+    }
+    else if (n == 3 && is_number(&args[0]) && is_punct(&args[1], ',') && is_number(&args[2]))
+    {
+        plan->offset = strtoll(args[0].start, NULL, 10);
+        plan->limit = strtoll(args[2].start, NULL, 10);
+    }
+    else if (n == 3 && is_number(&args[0]) && is_word(&args[1], "OFFSET") && is_number(&args[2]))
+    {
+        plan->limit = strtoll(args[0].start, NULL, 10);
+        plan->offset = strtoll(args[2].start, NULL, 10);
+    }
+    else
+    {
+        return false;
+    }
+
+    plan->limit_start = tokens[start].start - sql;
+    plan->limit_end = args[n - 1].start + args[n - 1].len - sql;
+
+    return true;
+}
+
+bool scatter_plan_create(const char* sql, scatter_plan_t* plan)
+{
+    memset(plan, 0, sizeof(*plan));
+    plan->limit = -1;
+    plan->limit_start = -1;
+    plan->limit_end = -1;
+
+    int n = 0;
+    sql_token_t* tokens = tokenize(sql, &n);
+    bool rval = tokens && n > 1 && is_word(&tokens[0], "SELECT");
+    int i = 1;
+
+    while (rval && i < n && is_one_of(&tokens[i], select_modifiers))
+    {
+        rval = !is_word(&tokens[i], "DISTINCT") && !is_word(&tokens[i], "DISTINCTROW") &&
+               !is_word(&tokens[i], "SQL_CALC_FOUND_ROWS");
+        i++;
+    }
+
+    int list_start = i;
+    int from = -1;
+    int order = -1;
+    int limit = -1;
+    int end = n;
+
+    for (; rval && i < n; i++)
+    {
+        const sql_token_t* tok = &tokens[i];
+
+        if (tok->depth > 0)
+        {
+            continue;
+        }
+
+        if (is_punct(tok, ';'))
+        {
+            end = i;
+
+            while (++i < n && rval)
+            {
+                rval = is_punct(&tokens[i], ';');
+            }
+        }
+        else if (is_word(tok, "FROM") && from == -1 && order == -1 && limit == -1)
+        {
+            from = i;
+        }
+        else if (is_word(tok, "ORDER") && i + 1 < n && is_word(&tokens[i + 1], "BY") &&
+                 order == -1 && limit == -1)
+        {
+            order = i;
+        }
+        else if (is_word(tok, "LIMIT") && limit == -1)
+        {
+            limit = i;
+        }
+        else if (is_one_of(tok, unsupported_clauses))
+        {
+            rval = false;
+        }
+    }
+
+    int list_end = from != -1 ? from : order != -1 ? order : limit != -1 ? limit : end;
+    const sql_token_t* names[SCATTER_MAX_COLUMNS];
+    int n_aggregates = 0;
+    bool star = false;
+
+    /** The columns of the select list */
+    for (i = list_start; rval && i < list_end;)
+    {
+        int stop = i;
+
+        while (stop < list_end && !(tokens[stop].depth == 0 && is_punct(&tokens[stop], ',')))
+        {
+            stop++;
+        }
+
+        scatter_aggregate_t agg;
+
+        if (stop == i || plan->n_columns == SCATTER_MAX_COLUMNS ||
+            !column_aggregate(&tokens[i], stop - i, &agg))
+        {
+            rval = false;
+            break;
+        }
+
+        names[plan->n_columns] = column_name(&tokens[i], stop - i, &star);
+        plan->columns[plan->n_columns++] = agg;
+        n_aggregates += agg != SCATTER_AGG_NONE;
+        i = stop + 1;
+    }
+
+    /** Aggregates can only be merged if all columns are aggregates */
+    if (rval && n_aggregates > 0)
+    {
+        rval = n_aggregates == plan->n_columns;
+        plan->aggregate = true;
+    }
+
+    if (rval && order != -1)
+    {
+        int order_end = limit != -1 ? limit : end;
+        rval = parse_order_by(tokens, order + 2, order_end, plan, names, plan->n_columns, star);
+    }
+
+    if (rval && limit != -1)
+    {
+        rval = parse_limit(sql, tokens, limit, end, plan);
+    }
+
+    if (plan->aggregate)
+    {
+        /** The shards return one row each and the merged result is one row */
+        plan->n_order = 0;
+    }
+
+    MXS_FREE(tokens);
+    return rval;
+}
+
+char* scatter_plan_rewrite(const char* sql, const scatter_plan_t* plan)
+{
+    char* rval = NULL;
+
+    if (plan->limit_start >= 0 && plan->offset > 0)
+    {
+        char limit[64];
+        int len = snprintf(limit, sizeof(limit), "LIMIT %lld", plan->offset + plan->limit);
+
+        if ((rval = MXS_MALLOC(strlen(sql) + len + 1)))
+        {
+            memcpy(rval, sql, plan->limit_start);
+            memcpy(rval + plan->limit_start, limit, len);
+            strcpy(rval + plan->limit_start + len, sql + plan->limit_end);
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Free the buffers of a reply
+ */
+static void scatter_reply_reset(scatter_reply_t* reply)
+{
+    gwbuf_free(reply->reply);
+    gwbuf_free(reply->partial);
+    reply->reply = NULL;
+    reply->partial = NULL;
+    reply->n_packets = 0;
+    reply->n_eof = 0;
+    reply->n_rows = 0;
+}
+
+/**
+ * Read a length-encoded integer
+ *
+ * @param ptr   Pointer to the integer, advanced past it
+ * @param end   End of the data
+ * @param value Where the value is stored
+ * @return False if the data ends or the integer is a NULL
+ */
+static bool read_lenenc_int(const uint8_t** ptr, const uint8_t* end, uint64_t* value)
+{
+    const uint8_t* p = *ptr;
+    int bytes;
+
+    if (p >= end || *p == 0xfb || *p == 0xff)
+    {
+        return false;
+    }
+
+    switch (*p)
+    {
+    case 0xfc:
+        bytes = 2;
+        break;
+
+    case 0xfd:
+        bytes = 3;
+        break;
+
+    case 0xfe:
+        bytes = 8;
+        break;
+
+    default:
+        *value = *p;
+        *ptr = p + 1;
+        return true;
+    }
+
+    if (p + bytes >= end)
+    {
+        return false;
+    }
+
+    *value = 0;
+
+    for (int i = bytes; i > 0; i--)
+    {
+        *value = (*value << 8) | p[i];
+    }
+
+    *ptr = p + bytes + 1;
+    return true;
+}
+
+/**
+ * Read a length-encoded string
+ */
+static bool read_field(const uint8_t** ptr, const uint8_t* end, field_t* field)
+{
+    uint64_t len;
+
+    if (*ptr < end && **ptr == 0xfb)
+    {
+        field->data = NULL;
+        field->len = 0;
+        field->null = true;
+        (*ptr)++;
+        return true;
+    }
+
+    if (!read_lenenc_int(ptr, end, &len) || len > (uint64_t)(end - *ptr))
+    {
+        return false;
+    }
+
+    field->data = *ptr;
+    field->len = len;
+    field->null = false;
+    *ptr += len;
+    return true;
+}
+
+static int write_lenenc_int(uint8_t* dest, uint64_t value)
+{
+    int bytes;
+
+    if (value < 251)
+    {
+        *dest = value;
+        return 1;
+    }
+    else if (value < 0x10000)
+    {
+        *dest = 0xfc;
+        bytes = 2;
+    }
+    else if (value < 0x1000000)
+    {
+        *dest = 0xfd;
+        bytes = 3;
+    }
+    else
+    {
+        *dest = 0xfe;
+        bytes = 8;
+    }
+
+    for (int i = 1; i <= bytes; i++)
+    {
+        dest[i] = value >> (8 * (i - 1));
+    }
+
+    return bytes + 1;
+}
+
+/**
+ * Read the fields of a row
+ *
+ * @param packet   The row packet
+ * @param fields   Where the fields are stored
+ * @param n_fields Number of fields to read
+ * @return False if the row is malformed
+ */
+static bool read_row(const uint8_t* packet, field_t* fields, int n_fields)
+{
+    const uint8_t* ptr = packet + 4;
+    const uint8_t* end = ptr + MYSQL_GET_PACKET_LEN(packet);
+
+    for (int i = 0; i < n_fields; i++)
+    {
+        if (!read_field(&ptr, end, &fields[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool read_column(const uint8_t* packet, column_t* column)
+{
+    const uint8_t* ptr = packet + 4;
+    const uint8_t* end = ptr + MYSQL_GET_PACKET_LEN(packet);
+    field_t skip;
+    uint64_t fixed_len;
+
+    /** The catalog, schema, table and original table are not needed */
+    for (int i = 0; i < 4; i++)
+    {
+        if (!read_field(&ptr, end, &skip))
+        {
+            return false;
+        }
+    }
+
+    if (!read_field(&ptr, end, &column->name) ||
+        !read_field(&ptr, end, &column->org_name) ||
+        !read_lenenc_int(&ptr, end, &fixed_len) || end - ptr < 10)
+    {
+        return false;
+    }
+
+    /** Character set (2), column length (4), type (1), flags (2), decimals (1) */
+    column->charset = ptr[0] | (ptr[1] << 8);
+    column->type = ptr[6];
+    column->decimals = ptr[9];
+    return true;
+}
+
+static bool is_numeric_type(uint8_t type)
+{
+    switch (type)
+    {
+    case MYSQL_TYPE_DECIMAL:
+    case MYSQL_TYPE_TINY:
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_FLOAT:
+    case MYSQL_TYPE_DOUBLE:
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_YEAR:
+    case MYSQL_TYPE_NEWDECIMAL:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/**
+ * Check whether the order of the values of a column is the same here and in
+ * the shards. Strings with a character set are ordered by their collation
+ * and negative or long TIME values don't sort byte by byte.
+ */
+static bool is_comparable(const column_t* column)
+{
+    return is_numeric_type(column->type) ||
+           (column->charset == SCATTER_BINARY_CHARSET && column->type != MYSQL_TYPE_TIME);
+}
+
+/**
+ * Check whether the values of a numeric column are exact, that is, integers
+ * or DECIMAL values
+ */
+static bool is_exact_type(const column_t* column)
+{
+    return is_numeric_type(column->type) && column->type != MYSQL_TYPE_FLOAT &&
+           column->type != MYSQL_TYPE_DOUBLE && column->decimals < SCATTER_NOT_FIXED_DEC;
+}
+
+static bool field_to_number(const field_t* field, long double* value)
+{
+    char buf[100];
+    char* end;
+
+    if (field->null || field->len == 0 || field->len >= sizeof(buf))
+    {
+        return false;
+    }
+
+    memcpy(buf, field->data, field->len);
+    buf[field->len] = '\0';
+    *value = strtold(buf, &end);
+
+    return *end == '\0';
+}
+
+/**
+ * Compare two values. NULL is smaller than any other value.
+ */
+static int compare_fields(const field_t* a, const field_t* b, bool numeric)
+{
+    long double x, y;
+
+    if (a->null || b->null)
+    {
+        return a->null == b->null ? 0 : a->null ? -1 : 1;
+    }
+
+    if (numeric && field_to_number(a, &x) && field_to_number(b, &y))
+    {
+        return x < y ? -1 : x > y ? 1 : 0;
+    }
+
+    int rval = memcmp(a->data, b->data, MIN(a->len, b->len));
+
+    return rval ? rval : a->len < b->len ? -1 : a->len > b->len ? 1 : 0;
+}
+
+static int compare_rows(const void* left, const void* right)
+{
+    const merge_row_t* a = (const merge_row_t*)left;
+    const merge_row_t* b = (const merge_row_t*)right;
+    const sort_context_t* ctx = a->ctx;
+
+    for (int i = 0; i < ctx->n_keys; i++)
+    {
+        int rval = compare_fields(&a->keys[i], &b->keys[i], ctx->numeric[i]);
+
+        if (rval)
+        {
+            return ctx->desc[i] ? -rval : rval;
+        }
+    }
+
+    return a->index - b->index;
+}
+
+/**
+ * Find the packets of a result set
+ *
+ * @param buffer A contiguous reply with a result set
+ * @param result The result set to fill
+ * @return False if the reply is not a complete result set
+ */
+static bool read_result(GWBUF* buffer, result_t* result)
+{
+    uint8_t* ptr = GWBUF_DATA(buffer);
+    uint8_t* end = ptr + GWBUF_LENGTH(buffer);
+    const uint8_t* payload = ptr + 4;
+    uint64_t n_columns;
+
+    memset(result, 0, sizeof(*result));
+    result->header = ptr;
+    result->end = end;
+
+    if (end - ptr < 5 || !read_lenenc_int(&payload, ptr + 4 + MYSQL_GET_PACKET_LEN(ptr), &n_columns))
+    {
+        return false;
+    }
+
+    result->n_columns = n_columns;
+
+    /** The column count, column definitions and their EOF */
+    for (uint64_t i = 0; i < n_columns + 2 && ptr < end; i++)
+    {
+        if (MYSQL_GET_PACKET_LEN(ptr) == SCATTER_MAX_PAYLOAD)
+        {
+            return false;
+        }
+        ptr += MYSQL_GET_PACKET_LEN(ptr) + 4;
+    }
+
+    result->rows = ptr;
+
+    while (ptr < end && !PTR_IS_EOF(ptr))
+    {
+        /** Rows split into several packets are not supported */
+        if (MYSQL_GET_PACKET_LEN(ptr) == SCATTER_MAX_PAYLOAD || PTR_IS_ERR(ptr))
+        {
+            return false;
+        }
+        result->n_rows++;
+        ptr += MYSQL_GET_PACKET_LEN(ptr) + 4;
+    }
+
+    result->eof = ptr;
+    return ptr < end && ptr + MYSQL_GET_PACKET_LEN(ptr) + 4 <= end;
+}
+
+/**
+ * Copy a packet to the merged reply with a new sequence number
+ */
+static uint8_t* copy_packet(uint8_t* dest, const uint8_t* packet, uint8_t* seq)
+{
+    size_t len = MYSQL_GET_PACKET_LEN(packet) + 4;
+
+    memcpy(dest, packet, len);
+    dest[3] = (*seq)++;
+    return dest + len;
+}
+
+static GWBUF* create_error(const char* msg)
+{
+    return modutil_create_mysql_err_msg(1, 0, SCATTER_ERRNO, SCATTER_ERRSTATE, msg);
+}
+
+/**
+ * Find the first error packet of the replies
+ */
+static GWBUF* find_error(GWBUF** replies, int n_replies)
+{
+    for (int i = 0; i < n_replies; i++)
+    {
+        uint8_t* ptr = GWBUF_DATA(replies[i]);
+        uint8_t* end = ptr + GWBUF_LENGTH(replies[i]);
+
+        while (ptr + 4 < end)
+        {
+            if (PTR_IS_ERR(ptr))
+            {
+                GWBUF* rval = gwbuf_alloc_and_load(MYSQL_GET_PACKET_LEN(ptr) + 4, ptr);
+
+                if (rval)
+                {
+                    ((uint8_t*)GWBUF_DATA(rval))[3] = 1;
+                }
+                return rval;
+            }
+            ptr += MYSQL_GET_PACKET_LEN(ptr) + 4;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Add a decimal value to an exact sum
+ *
+ * @param sum   The sum
+ * @param field A value of the form [-]digits[.digits]
+ * @return False if the value is not a decimal number or the sum overflows
+ */
+static bool decimal_sum_add(decimal_sum_t* sum, const field_t* field)
+{
+    const uint8_t* ptr = field->data;
+    const uint8_t* end = ptr + field->len;
+    uint8_t* digits = sum->positive;
+
+    if (ptr < end && *ptr == '-')
+    {
+        digits = sum->negative;
+        ptr++;
+    }
+
+    const uint8_t* point = memchr(ptr, '.', end - ptr);
+    int n_int = (point ? point : end) - ptr;
+    int n_frac = point ? end - point - 1 : 0;
+
+    if ((n_int == 0 && n_frac == 0) || n_int > SCATTER_SUM_INT_DIGITS || n_frac > SCATTER_SUM_FRAC_DIGITS)
+    {
+        return false;
+    }
+
+    uint8_t value[SCATTER_SUM_DIGITS] = {0};
+
+    for (int i = 0; i < n_int; i++)
+    {
+        if (!isdigit(ptr[i]))
+        {
+            return false;
+        }
+        value[SCATTER_SUM_INT_DIGITS - n_int + i] = ptr[i] - '0';
+    }
+
+    for (int i = 0; i < n_frac; i++)
+    {
+        if (!isdigit(point[i + 1]))
+        {
+            return false;
+        }
+        value[SCATTER_SUM_INT_DIGITS + i] = point[i + 1] - '0';
+    }
+
+    int carry = 0;
+
+    for (int i = SCATTER_SUM_DIGITS - 1; i >= 0; i--)
+    {
+        int digit = digits[i] + value[i] + carry;
+        digits[i] = digit % 10;
+        carry = digit / 10;
+    }
+
+    return carry == 0;
+}
+
+/**
+ * Format an exact sum
+ *
+ * @param sum      The sum
+ * @param decimals The number of digits after the decimal point
+ * @param dest     Where the sum is written, SCATTER_NUMBER_LEN bytes
+ */
+static void decimal_sum_format(const decimal_sum_t* sum, int decimals, char* dest)
+{
+    bool negative = memcmp(sum->negative, sum->positive, SCATTER_SUM_DIGITS) > 0;
+    const uint8_t* big = negative ? sum->negative : sum->positive;
+    const uint8_t* small = negative ? sum->positive : sum->negative;
+    uint8_t digits[SCATTER_SUM_DIGITS];
+    int borrow = 0;
+
+    for (int i = SCATTER_SUM_DIGITS - 1; i >= 0; i--)
+    {
+        int digit = big[i] - small[i] - borrow;
+        borrow = digit < 0;
+        digits[i] = digit + (borrow ? 10 : 0);
+    }
+
+    int first = 0;
+
+    while (first < SCATTER_SUM_INT_DIGITS - 1 && digits[first] == 0)
+    {
+        first++;
+    }
+
+    if (negative)
+    {
+        *dest++ = '-';
+    }
+
+    for (int i = first; i < SCATTER_SUM_INT_DIGITS; i++)
+    {
+        *dest++ = '0' + digits[i];
+    }
+
+    if (decimals > 0)
+    {
+        *dest++ = '.';
+
+        for (int i = 0; i < decimals; i++)
+        {
+            *dest++ = '0' + digits[SCATTER_SUM_INT_DIGITS + i];
+        }
+    }
+
+    *dest = '\0';
+}
+
+/**
+ * Format an aggregated sum
+ */
+static void format_sum(long double sum, const column_t* column, char* dest, size_t size)
+{
+    if (column->decimals < SCATTER_NOT_FIXED_DEC)
+    {
+        snprintf(dest, size, "%.*Lf", column->decimals, sum);
+    }
+    else
+    {
+        /** The shortest representation that converts back to the same double */
+        for (int precision = 15; precision <= 17; precision++)
+        {
+            snprintf(dest, size, "%.*Lg", precision, sum);
+
+            if (strtod(dest, NULL) == (double)sum)
+            {
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Aggregate the rows of the shards into one row
+ *
+ * @param plan      The plan of the statement
+ * @param columns   The column definitions
+ * @param n_columns Number of columns
+ * @param rows      The rows of the shards
+ * @param n_rows    Number of rows
+ * @param seq       Sequence number of the row packet
+ * @param error     The reason of a failure is stored here
+ * @return The row packet or NULL on error
+ */
+static uint8_t* aggregate_rows(const scatter_plan_t* plan, const column_t* columns, int n_columns,
+                               merge_row_t* rows, int n_rows, uint8_t seq, const char** error)
+{
+    field_t values[n_rows][n_columns];
+    field_t results[n_columns];
+    char numbers[n_columns][SCATTER_NUMBER_LEN];
+    size_t len = 0;
+
+    for (int i = 0; i < n_rows; i++)
+    {
+        if (!read_row(rows[i].packet, values[i], n_columns))
+        {
+            return NULL;
+        }
+    }
+
+    for (int c = 0; c < n_columns; c++)
+    {
+        scatter_aggregate_t agg = plan->columns[c];
+        bool numeric = is_numeric_type(columns[c].type);
+        field_t* result = &results[c];
+
+        result->null = true;
+
+        if (agg == SCATTER_AGG_COUNT || agg == SCATTER_AGG_SUM)
+        {
+            /** Integers and DECIMAL values are summed exactly, a long double has about 19 digits */
+            bool exact = agg == SCATTER_AGG_COUNT || is_exact_type(&columns[c]);
+            decimal_sum_t exact_sum;
+            long double sum = 0;
+            bool found = false;
+
+            memset(&exact_sum, 0, sizeof(exact_sum));
+
+            for (int i = 0; i < n_rows; i++)
+            {
+                const field_t* field = &values[i][c];
+                long double value;
+
+                if (field->null)
+                {
+                    continue;
+                }
+                else if (exact ? !decimal_sum_add(&exact_sum, field) : !field_to_number(field, &value))
+                {
+                    *error = "A sum of the results of the shards is not a number or is out of range.";
+                    return NULL;
+                }
+
+                sum += exact ? 0 : value;
+                found = true;
+            }
+
+            if (agg == SCATTER_AGG_COUNT)
+            {
+                decimal_sum_format(&exact_sum, 0, numbers[c]);
+            }
+            else if (found && exact)
+            {
+                decimal_sum_format(&exact_sum, columns[c].decimals, numbers[c]);
+            }
+            else if (found)
+            {
+                format_sum(sum, &columns[c], numbers[c], sizeof(numbers[c]));
+            }
+
+            if (agg == SCATTER_AGG_COUNT || found)
+            {
+                result->data = (uint8_t*)numbers[c];
+                result->len = strlen(numbers[c]);
+                result->null = false;
+            }
+        }
+        else
+        {
+            for (int i = 0; i < n_rows; i++)
+            {
+                field_t* value = &values[i][c];
+
+                if (!value->null)
+                {
+                    int cmp = result->null ? 0 : compare_fields(value, result, numeric);
+
+                    if (result->null || (agg == SCATTER_AGG_MIN ? cmp < 0 : cmp > 0))
+                    {
+                        *result = *value;
+                    }
+                }
+            }
+        }
+
+        len += result->null ? 1 : result->len + 9;
+    }
+
+    uint8_t* packet = MXS_MALLOC(len + 4);
+
+    if (packet)
+    {
+        uint8_t* ptr = packet + 4;
+
+        for (int c = 0; c < n_columns; c++)
+        {
+            if (results[c].null)
+            {
+                *ptr++ = 0xfb;
+            }
+            else
+            {
+                ptr += write_lenenc_int(ptr, results[c].len);
+                memcpy(ptr, results[c].data, results[c].len);
+                ptr += results[c].len;
+            }
+        }
+
+        len = ptr - packet - 4;
+        packet[0] = len;
+        packet[1] = len >> 8;
+        packet[2] = len >> 16;
+        packet[3] = seq;
+    }
+
+    return packet;
+}
+
+/**
+ * Find the columns the rows are sorted by
+ *
+ * @return False if a column was not found in the results
+ */
+static bool resolve_sort_keys(const scatter_plan_t* plan, const column_t* columns, int n_columns,
+                              int* keys, sort_context_t* ctx)
+{
+    ctx->n_keys = plan->n_order;
+
+    for (int i = 0; i < plan->n_order; i++)
+    {
+        const scatter_order_t* order = &plan->order[i];
+        keys[i] = -1;
+
+        if (order->position > 0)
+        {
+            keys[i] = order->position <= n_columns ? order->position - 1 : -1;
+        }
+        else
+        {
+            size_t len = strlen(order->name);
+
+            /** Match the alias first and then the original name of the column */
+            for (int pass = 0; pass < 2 && keys[i] == -1; pass++)
+            {
+                for (int c = 0; c < n_columns && keys[i] == -1; c++)
+                {
+                    const field_t* name = pass == 0 ? &columns[c].name : &columns[c].org_name;
+
+                    if (name->len == len && strncasecmp((const char*)name->data, order->name, len) == 0)
+                    {
+                        keys[i] = c;
+                    }
+                }
+            }
+        }
+
+        if (keys[i] == -1)
+        {
+            return false;
+        }
+
+        ctx->numeric[i] = is_numeric_type(columns[keys[i]].type);
+        ctx->desc[i] = order->desc;
+    }
+
+    return true;
+}
+
+static bool sort_keys_comparable(const column_t* columns, const int* keys, int n_keys)
+{
+    for (int i = 0; i < n_keys; i++)
+    {
+        if (!is_comparable(&columns[keys[i]]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool aggregates_comparable(const scatter_plan_t* plan, const column_t* columns, int n_columns)
+{
+    for (int c = 0; c < n_columns; c++)
+    {
+        if ((plan->columns[c] == SCATTER_AGG_MIN || plan->columns[c] == SCATTER_AGG_MAX) &&
+            !is_comparable(&columns[c]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Read the values of the sort columns of the rows
+ */
+static bool read_sort_keys(merge_row_t* rows, int n_rows, const int* keys, int n_keys, field_t* storage)
+{
+    int n_fields = 0;
+
+    for (int i = 0; i < n_keys; i++)
+    {
+        n_fields = MAX(n_fields, keys[i] + 1);
+    }
+
+    field_t fields[n_fields];
+
+    for (int r = 0; r < n_rows; r++)
+    {
+        if (!read_row(rows[r].packet, fields, n_fields))
+        {
+            return false;
+        }
+
+        rows[r].keys = &storage[r * n_keys];
+
+        for (int i = 0; i < n_keys; i++)
+        {
+            rows[r].keys[i] = fields[keys[i]];
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Merge complete result sets
+ */
+static GWBUF* merge_results(const scatter_plan_t* plan, result_t* results, int n_results)
+{
+    int n_columns = results[0].n_columns;
+    int n_rows = 0;
+
+    for (int i = 0; i < n_results; i++)
+    {
+        if (results[i].n_columns != n_columns)
+        {
+            return create_error("The shards returned result sets with different columns.");
+        }
+        n_rows += results[i].n_rows;
+    }
+
+    column_t columns[n_columns];
+    uint8_t* ptr = results[0].header + MYSQL_GET_PACKET_LEN(results[0].header) + 4;
+
+    for (int c = 0; c < n_columns; c++)
+    {
+        if (!read_column(ptr, &columns[c]))
+        {
+            return create_error("Malformed column definition in the result of a shard.");
+        }
+        ptr += MYSQL_GET_PACKET_LEN(ptr) + 4;
+    }
+
+    merge_row_t* rows = MXS_CALLOC(n_rows + 1, sizeof(merge_row_t));
+    field_t* keys = MXS_CALLOC(n_rows * plan->n_order + 1, sizeof(field_t));
+    sort_context_t ctx = {};
+    GWBUF* rval = NULL;
+
+    if (rows == NULL || keys == NULL)
+    {
+        MXS_FREE(rows);
+        MXS_FREE(keys);
+        return NULL;
+    }
+
+    int n = 0;
+
+    for (int i = 0; i < n_results; i++)
+    {
+        for (ptr = results[i].rows; ptr < results[i].eof; ptr += MYSQL_GET_PACKET_LEN(ptr) + 4)
+        {
+            rows[n].packet = ptr;
+            rows[n].len = MYSQL_GET_PACKET_LEN(ptr) + 4;
+            rows[n].index = n;
+            rows[n].ctx = &ctx;
+            n++;
+        }
+    }
+
+    uint8_t* aggregate = NULL;
+    const char* error = NULL;
+    int first = 0;
+    int count = n_rows;
+
+    if (plan->aggregate)
+    {
+        if (plan->n_columns != n_columns)
+        {
+            error = "The shards returned a different number of aggregates than was expected.";
+        }
+        else if (!aggregates_comparable(plan, columns, n_columns))
+        {
+            error = "MIN and MAX of a column with a collation can't be merged from several shards.";
+        }
+        else if (n_rows > 0 &&
+                 (aggregate = aggregate_rows(plan, columns, n_columns, rows, n_rows, 0, &error)) == NULL &&
+                 error == NULL)
+        {
+            error = "Failed to aggregate the results of the shards.";
+        }
+        count = aggregate ? 1 : 0;
+    }
+    else
+    {
+        int sort_keys[SCATTER_MAX_ORDER];
+
+        if (plan->n_order > 0)
+        {
+            if (!resolve_sort_keys(plan, columns, n_columns, sort_keys, &ctx))
+            {
+                MXS_WARNING("Failed to find the ORDER BY columns in the results of the shards, "
+                            "the rows are not sorted.");
+            }
+            else if (!sort_keys_comparable(columns, sort_keys, ctx.n_keys))
+            {
+                error = "Rows sorted by a column with a collation can't be merged from several shards.";
+            }
+            else if (read_sort_keys(rows, n_rows, sort_keys, ctx.n_keys, keys))
+            {
+                qsort(rows, n_rows, sizeof(merge_row_t), compare_rows);
+            }
+            else
+            {
+                MXS_WARNING("Failed to read the ORDER BY columns in the results of the shards, "
+                            "the rows are not sorted.");
+            }
+        }
+
+        if (plan->limit >= 0)
+        {
+            first = MIN(plan->offset, n_rows);
+            count = MIN(plan->limit, n_rows - first);
+        }
+    }
+
+    if (error)
+    {
+        rval = create_error(error);
+    }
+    else
+    {
+        size_t len = (results[0].rows - results[0].header) + MYSQL_GET_PACKET_LEN(results[0].eof) + 4;
+
+        for (int i = first; i < first + count; i++)
+        {
+            len += aggregate ? MYSQL_GET_PACKET_LEN(aggregate) + 4 : rows[i].len;
+        }
+
+        if ((rval = gwbuf_alloc(len)))
+        {
+            uint8_t seq = 1;
+            uint8_t* dest = GWBUF_DATA(rval);
+
+            /** The column count, the column definitions and their EOF */
+            for (ptr = results[0].header; ptr < results[0].rows; ptr += MYSQL_GET_PACKET_LEN(ptr) + 4)
+            {
+                dest = copy_packet(dest, ptr, &seq);
+            }
+
+            for (int i = first; i < first + count; i++)
+            {
+                dest = copy_packet(dest, aggregate ? aggregate : rows[i].packet, &seq);
+            }
+
+            copy_packet(dest, results[0].eof, &seq);
+        }
+    }
+
+    MXS_FREE(aggregate);
+    MXS_FREE(keys);
+    MXS_FREE(rows);
+    return rval;
+}
+
+GWBUF* scatter_merge(const scatter_plan_t* plan, GWBUF** replies, int n_replies)
+{
+    GWBUF* rval;
+
+    if (n_replies == 0)
+    {
+        return create_error("No shards replied to the query.");
+    }
+
+    if ((rval = find_error(replies, n_replies)))
+    {
+        return rval;
+    }
+
+    uint8_t* first = GWBUF_DATA(replies[0]);
+
+    if (PTR_IS_OK(first))
+    {
+        return gwbuf_alloc_and_load(GWBUF_LENGTH(replies[0]), GWBUF_DATA(replies[0]));
+    }
+
+    result_t results[n_replies];
+
+    for (int i = 0; i < n_replies; i++)
+    {
+        if (!read_result(replies[i], &results[i]))
+        {
+            return create_error("The result of a shard could not be merged.");
+        }
+    }
+
+    return merge_results(plan, results, n_replies);
+}
+
+scatter_query_t* scatter_query_alloc(int n_replies, size_t max_size)
+{
+    scatter_query_t* rval = MXS_CALLOC(1, sizeof(scatter_query_t));
+
+    if (rval)
+    {
+        if ((rval->replies = MXS_CALLOC(n_replies, sizeof(scatter_reply_t))))
+        {
+            rval->n_replies = n_replies;
+            rval->max_size = max_size;
+            rval->seq = 1;
+        }
+        else
+        {
+            MXS_FREE(rval);
+            rval = NULL;
+        }
+    }
+
+    return rval;
+}
+
+void scatter_query_free(scatter_query_t* query)
+{
+    if (query)
+    {
+        for (int i = 0; i < query->n_replies; i++)
+        {
+            scatter_reply_reset(&query->replies[i]);
+        }
+
+        gwbuf_free(query->error);
+        MXS_FREE(query->replies);
+        MXS_FREE(query);
+    }
+}
+
+/**
+ * Whether the rows are sent to the client as they arrive. Only rows that
+ * are sorted or aggregated need to be buffered.
+ */
+static bool is_streamed(const scatter_plan_t* plan)
+{
+    return !plan->aggregate && plan->n_order == 0;
+}
+
+/**
+ * A run of consecutive packets of a buffer that are moved to the same place
+ */
+typedef struct packet_run
+{
+    GWBUF*   packets; /*< The contiguous buffer of the packets */
+    uint8_t* start;
+    uint8_t* end;
+    GWBUF**  dest;    /*< Where the packets are appended, NULL if there is no run */
+} packet_run_t;
+
+static void run_flush(packet_run_t* run)
+{
+    if (run->dest && run->end > run->start)
+    {
+        size_t offset = run->start - (uint8_t*)GWBUF_DATA(run->packets);
+        GWBUF* part = gwbuf_clone_portion(run->packets, offset, run->end - run->start);
+        MXS_ABORT_IF_NULL(part);
+        *run->dest = gwbuf_append(*run->dest, part);
+    }
+
+    run->dest = NULL;
+}
+
+/**
+ * Move a packet to the end of a buffer. Packets that are not added are dropped.
+ */
+static void run_add(packet_run_t* run, uint8_t* packet, GWBUF** dest)
+{
+    if (run->dest != dest || run->end != packet)
+    {
+        run_flush(run);
+        run->start = packet;
+        run->dest = dest;
+    }
+
+    run->end = packet + MYSQL_GET_PACKET_LEN(packet) + 4;
+}
+
+/**
+ * Record the first error of a streamed query
+ */
+static void set_stream_error(scatter_query_t* query, const uint8_t* packet)
+{
+    if (query->error == NULL)
+    {
+        query->error = gwbuf_alloc_and_load(MYSQL_GET_PACKET_LEN(packet) + 4, (void*)packet);
+        MXS_ABORT_IF_NULL(query->error);
+    }
+}
+
+/**
+ * Send the column definitions of a streamed result once the first shard
+ * has sent them. The definitions of the other shards are only checked.
+ */
+static GWBUF* stream_header(scatter_query_t* query, scatter_reply_t* reply)
+{
+    GWBUF* rval = NULL;
+
+    if ((reply->reply = gwbuf_make_contiguous(reply->reply)) == NULL)
+    {
+        return NULL;
+    }
+
+    uint8_t* start = GWBUF_DATA(reply->reply);
+    uint8_t* end = start + GWBUF_LENGTH(reply->reply);
+    const uint8_t* payload = start + 4;
+    uint64_t n_columns = 0;
+
+    read_lenenc_int(&payload, start + 4 + MYSQL_GET_PACKET_LEN(start), &n_columns);
+
+    if (query->error)
+    {
+        /** Nothing is sent after an error */
+    }
+    else if (!query->header_sent)
+    {
+        if ((rval = gwbuf_alloc(end - start)))
+        {
+            uint8_t* dest = GWBUF_DATA(rval);
+
+            for (uint8_t* ptr = start; ptr < end; ptr += MYSQL_GET_PACKET_LEN(ptr) + 4)
+            {
+                dest = copy_packet(dest, ptr, &query->seq);
+            }
+
+            query->header_sent = true;
+            query->n_columns = n_columns;
+        }
+    }
+    else if (query->n_columns != (int)n_columns)
+    {
+        query->error = create_error("The shards returned result sets with different columns.");
+    }
+
+    gwbuf_free(reply->reply);
+    reply->reply = NULL;
+    return rval;
+}
+
+/**
+ * Check whether a row is sent to the client or buffered
+ */
+static bool keep_row(const scatter_query_t* query, scatter_reply_t* reply)
+{
+    const scatter_plan_t* plan = &query->plan;
+
+    if (is_streamed(plan))
+    {
+        return query->n_rows > plan->offset &&
+               (plan->limit < 0 || query->n_rows <= plan->offset + plan->limit);
+    }
+
+    /** A shard can't contribute more sorted rows than the LIMIT returns */
+    return plan->aggregate || plan->limit < 0 || reply->n_rows <= plan->offset + plan->limit;
+}
+
+/**
+ * Drop the buffered replies once they have grown too large. The query
+ * fails when all shards have replied.
+ */
+static void check_size(scatter_query_t* query)
+{
+    if (query->max_size > 0 && query->size > query->max_size && !query->overflow)
+    {
+        MXS_WARNING("The results of a scatter-gather query exceed %lu bytes, the query fails.",
+                    query->max_size);
+        query->overflow = true;
+
+        for (int i = 0; i < query->n_replies; i++)
+        {
+            gwbuf_free(query->replies[i].reply);
+            query->replies[i].reply = NULL;
+        }
+    }
+}
+
+/**
+ * Create the end of the reply sent to the client once all shards have replied
+ */
+static GWBUF* finish_query(scatter_query_t* query)
+{
+    GWBUF* rval = NULL;
+
+    if (query->overflow)
+    {
+        char msg[200];
+        snprintf(msg, sizeof(msg), "The results of the shards exceed the scatter_gather_max_size "
+                 "of %lu bytes.", query->max_size);
+        rval = create_error(msg);
+    }
+    else if (is_streamed(&query->plan) && (query->error || query->header_sent))
+    {
+        if (query->error)
+        {
+            /** An error in place of the EOF ends the result */
+            rval = query->error;
+            query->error = NULL;
+        }
+        else
+        {
+            for (int i = 0; i < query->n_replies && rval == NULL; i++)
+            {
+                GWBUF* reply = query->replies[i].reply;
+                uint8_t* packet = reply ? GWBUF_DATA(reply) : NULL;
+
+                if (packet && GWBUF_LENGTH(reply) >= 9 && PTR_IS_EOF(packet))
+                {
+                    rval = gwbuf_alloc_and_load(9, packet);
+                }
+            }
+
+            if (rval == NULL)
+            {
+                rval = create_error("The shards returned different kinds of results.");
+            }
+        }
+
+        if (rval)
+        {
+            ((uint8_t*)GWBUF_DATA(rval))[3] = query->header_sent ? query->seq : 1;
+        }
+    }
+    else
+    {
+        /** All shards returned an OK or the results are merged */
+        GWBUF* replies[query->n_replies];
+        int n = 0;
+
+        for (int i = 0; i < query->n_replies; i++)
+        {
+            scatter_reply_t* reply = &query->replies[i];
+
+            if (reply->reply && (reply->reply = gwbuf_make_contiguous(reply->reply)))
+            {
+                replies[n++] = reply->reply;
+            }
+        }
+
+        rval = scatter_merge(&query->plan, replies, n);
+    }
+
+    return rval;
+}
+
+static GWBUF* reply_complete(scatter_query_t* query, scatter_reply_t* reply, GWBUF* output)
+{
+    reply->active = false;
+
+    if (--query->n_pending == 0)
+    {
+        output = gwbuf_append(output, finish_query(query));
+    }
+
+    return output;
+}
+
+GWBUF* scatter_query_add(scatter_query_t* query, int index, GWBUF* buffer)
+{
+    scatter_reply_t* reply = &query->replies[index];
+    bool streamed = is_streamed(&query->plan);
+    bool complete = false;
+    GWBUF* output = NULL;
+
+    ss_dassert(reply->active);
+    reply->partial = gwbuf_append(reply->partial, buffer);
+    GWBUF* packets = modutil_get_complete_packets(&reply->partial);
+
+    if (packets && (packets = gwbuf_make_contiguous(packets)))
+    {
+        uint8_t* ptr = GWBUF_DATA(packets);
+        uint8_t* end = ptr + GWBUF_LENGTH(packets);
+        packet_run_t run = {.packets = packets};
+
+        for (; ptr < end && !complete; ptr += MYSQL_GET_PACKET_LEN(ptr) + 4)
+        {
+            size_t len = MYSQL_GET_PACKET_LEN(ptr) + 4;
+            GWBUF** dest = query->overflow ? NULL : &reply->reply;
+            bool row = false;
+
+            if (PTR_IS_ERR(ptr) || (reply->n_packets == 0 && PTR_IS_OK(ptr)))
+            {
+                complete = true;
+
+                if (streamed && PTR_IS_ERR(ptr))
+                {
+                    set_stream_error(query, ptr);
+                    dest = NULL;
+                }
+            }
+            else if (PTR_IS_EOF(ptr) && ++reply->n_eof == 2)
+            {
+                complete = true;
+            }
+            else if (reply->n_eof == 1 && !PTR_IS_EOF(ptr))
+            {
+                row = true;
+                reply->n_rows++;
+
+                if (streamed)
+                {
+                    query->n_rows++;
+                    dest = query->error || !query->header_sent ? NULL : &output;
+                }
+
+                if (!keep_row(query, reply))
+                {
+                    dest = NULL;
+                }
+                else if (dest == &output)
+                {
+                    ptr[3] = query->seq++;
+                }
+            }
+
+            reply->n_packets++;
+
+            if (dest)
+            {
+                run_add(&run, ptr, dest);
+
+                if (!streamed)
+                {
+                    query->size += len;
+                }
+            }
+
+            if (streamed && reply->n_eof == 1 && PTR_IS_EOF(ptr) && !row)
+            {
+                /** The column definitions are complete */
+                run_flush(&run);
+                output = gwbuf_append(output, stream_header(query, reply));
+            }
+        }
+
+        run_flush(&run);
+        gwbuf_free(packets);
+
+        if (!streamed)
+        {
+            check_size(query);
+        }
+    }
+
+    if (complete)
+    {
+        gwbuf_free(reply->partial);
+        reply->partial = NULL;
+        output = reply_complete(query, reply, output);
+    }
+
+    return output;
+}
+
+GWBUF* scatter_query_set_error(scatter_query_t* query, int index, GWBUF* errmsg)
+{
+    scatter_reply_t* reply = &query->replies[index];
+    GWBUF* rval = NULL;
+
+    if (reply->active)
+    {
+        GWBUF* err = errmsg ? gwbuf_clone_all(errmsg) : create_error("A shard failed to reply.");
+
+        scatter_reply_reset(reply);
+
+        if (is_streamed(&query->plan) && err)
+        {
+            set_stream_error(query, GWBUF_DATA(err));
+            gwbuf_free(err);
+        }
+        else
+        {
+            reply->reply = err;
+        }
+
+        rval = reply_complete(query, reply, NULL);
+    }
+
+    return rval;
+}
@@ -0,0 +1,196 @@
+#ifndef _MAXSCALE_ROUTING_SCHEMAROUTER_SCATTER_GATHER_H
+#define _MAXSCALE_ROUTING_SCHEMAROUTER_SCATTER_GATHER_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file scatter_gather.h Merging of the results of a SELECT executed on several shards
+ *
+ * A read-only SELECT whose tables are on more than one shard is sent to all
+ * of them and the result sets are merged into one. The rows are concatenated
+ * as with UNION ALL, sorted if the statement has an ORDER BY and cut to the
+ * LIMIT of the statement. If all columns are COUNT, SUM, MIN or MAX aggregates
+ * and the statement has no GROUP BY, the single rows of the shards are
+ * aggregated into one.
+ *
+ * Rows that are not sorted or aggregated are sent to the client as they
+ * arrive. Other results are buffered until all shards have replied.
+ */
+
+#include <stdbool.h>
+#include <buffer.h>
+#include <skygw_debug.h>
+
+EXTERN_C_BLOCK_BEGIN
+
+enum
+{
+    SCATTER_MAX_COLUMNS = 64, /*< Maximum number of aggregated columns */
+    SCATTER_MAX_ORDER = 8,    /*< Maximum number of ORDER BY expressions */
+    SCATTER_NAME_MAXLEN = 64  /*< Maximum length of a column name in ORDER BY */
+};
+
+/**
+ * How a column of the shard results is combined
+ */
+typedef enum scatter_aggregate
+{
+    SCATTER_AGG_NONE,
+    SCATTER_AGG_COUNT,
+    SCATTER_AGG_SUM,
+    SCATTER_AGG_MIN,
+    SCATTER_AGG_MAX
+} scatter_aggregate_t;
+
+/**
+ * An ORDER BY expression, either a position or a column name
+ */
+typedef struct scatter_order
+{
+    int  position;                       /*< 1-based position of the column, 0 if by name */
+    char name[SCATTER_NAME_MAXLEN + 1];  /*< Name of the column if position is 0 */
+    bool desc;                           /*< Descending order */
+} scatter_order_t;
+
+/**
+ * How the results of a SELECT are merged
+ */
+typedef struct scatter_plan
+{
+    bool                aggregate;    /*< Whether all columns are aggregates */
+    int                 n_columns;    /*< Number of aggregated columns */
+    scatter_aggregate_t columns[SCATTER_MAX_COLUMNS];
+    int                 n_order;      /*< Number of ORDER BY expressions */
+    scatter_order_t     order[SCATTER_MAX_ORDER];
+    long long           offset;       /*< Rows skipped by LIMIT */
+    long long           limit;        /*< Maximum number of rows, -1 for no limit */
+    int                 limit_start;  /*< Offset of the LIMIT clause in the statement, -1 if none */
+    int                 limit_end;    /*< Offset of the end of the LIMIT clause */
+} scatter_plan_t;
+
+/**
+ * The reply of one shard
+ */
+typedef struct scatter_reply
+{
+    GWBUF*    reply;     /*< The complete packets of the reply that are buffered */
+    GWBUF*    partial;   /*< A partially received packet */
+    int       n_packets; /*< Number of complete packets */
+    int       n_eof;     /*< Number of EOF packets */
+    long long n_rows;    /*< Number of rows received */
+    bool      active;    /*< Whether the reply is still being waited for */
+} scatter_reply_t;
+
+/**
+ * A scatter-gather query of a router session
+ */
+typedef struct scatter_query
+{
+    scatter_plan_t   plan;
+    scatter_reply_t* replies;     /*< One for each backend of the session */
+    int              n_replies;
+    int              n_pending;   /*< Number of replies still being waited for */
+    size_t           max_size;    /*< Maximum size of the buffered replies, 0 for no limit */
+    size_t           size;        /*< Size of the buffered replies */
+    bool             overflow;    /*< Whether the buffered replies exceeded max_size */
+    bool             header_sent; /*< Whether the column definitions have been streamed */
+    int              n_columns;   /*< Number of columns of the streamed result */
+    long long        n_rows;      /*< Number of rows received for streaming */
+    uint8_t          seq;         /*< Sequence number of the next streamed packet */
+    GWBUF*           error;       /*< The first error of a streamed result */
+} scatter_query_t;
+
+/**
+ * Create the merge plan of a SELECT statement.
+ *
+ * Statements that can't be merged correctly are rejected. These include
+ * statements with DISTINCT, GROUP BY, HAVING, UNION, INTO or a locking
+ * clause, aggregates other than COUNT, SUM, MIN and MAX, aggregates mixed
+ * with other columns and ORDER BY expressions that are not column names
+ * or positions.
+ *
+ * @param sql  The SQL statement
+ * @param plan The plan to fill
+ * @return True if the results of the statement can be merged
+ */
+bool scatter_plan_create(const char* sql, scatter_plan_t* plan);
+
+/**
+ * Create the statement sent to the shards. The shards can't skip the rows
+ * of a LIMIT offset so the offset is added to the row count.
+ *
+ * @param sql  The SQL statement
+ * @param plan The plan of the statement
+ * @return The rewritten statement or NULL if the statement needs no rewriting
+ */
+char* scatter_plan_rewrite(const char* sql, const scatter_plan_t* plan);
+
+/**
+ * Merge the replies of the shards into the reply sent to the client. If
+ * a shard returned an error, the first error is the reply.
+ *
+ * @param plan      The plan of the statement
+ * @param replies   The complete replies, one for each shard
+ * @param n_replies Number of replies
+ * @return The merged reply or NULL if memory allocation failed
+ */
+GWBUF* scatter_merge(const scatter_plan_t* plan, GWBUF** replies, int n_replies);
+
+/**
+ * Allocate a scatter-gather query
+ *
+ * @param n_replies Number of backends of the session
+ * @param max_size  Maximum size of the replies buffered for sorting or
+ *                  aggregation, 0 for no limit
+ * @return New query or NULL if memory allocation failed
+ */
+scatter_query_t* scatter_query_alloc(int n_replies, size_t max_size);
+
+/**
+ * Free a scatter-gather query and the replies it has received
+ *
+ * @param query Query to free
+ */
+void scatter_query_free(scatter_query_t* query);
+
+/**
+ * Add data received from a shard to its reply. The reply must be active.
+ *
+ * Streamed rows are returned as soon as they are complete. When the reply of
+ * the shard is complete, the reply is no longer active. When the replies of
+ * all shards are complete, the end of the result or the merged result is
+ * returned. If the buffered replies grow larger than the maximum size, the
+ * rest of the replies are discarded and the result is an error.
+ *
+ * @param query  The query
+ * @param index  Index of the backend the data came from
+ * @param buffer Data received from the shard
+ * @return Data to send to the client or NULL if there is none
+ */
+GWBUF* scatter_query_add(scatter_query_t* query, int index, GWBUF* buffer);
+
+/**
+ * Replace the reply of a shard with an error. Does nothing if the reply is
+ * not active.
+ *
+ * @param query  The query
+ * @param index  Index of the backend that failed
+ * @param errmsg A MySQL error packet, copied into the reply, or NULL for a
+ *               generic error
+ * @return Data to send to the client or NULL if there is none
+ */
+GWBUF* scatter_query_set_error(scatter_query_t* query, int index, GWBUF* errmsg);
+
+EXTERN_C_BLOCK_END
+
+#endif
@@ -32,14 +32,22 @@
 #include <maxscale/alloc.h>
 #include <maxscale/poll.h>
 #include <pcre.h>
+#include <housekeeper.h>
+#include <thread.h>
+#include <maxconfig.h>
+#include <mysql_utils.h>
+#include <users.h>
+#include <dbusers.h>
+#include "scatter_gather.h"
 
 #define DEFAULT_REFRESH_INTERVAL 30.0
+#define DEFAULT_SCATTER_GATHER_MAX_SIZE (64 * 1024 * 1024)
 
 /** Size of the hashtable used to store ignored databases */
 #define SCHEMAROUTER_HASHSIZE 100
 
-/** Hashtable size for the per user shard maps */
-#define SCHEMAROUTER_USERHASH_SIZE 10
+/** How often the housekeeper checks whether the shard map needs to be rebuilt, in seconds */
+#define SHARD_MAP_CHECK_INTERVAL 1
 
 MODULE_INFO info =
 {
@@ -177,7 +185,11 @@ int inspect_backend_mapping_states(ROUTER_CLIENT_SES *router_cli_ses,
                                    GWBUF** wbuf);
 bool handle_default_db(ROUTER_CLIENT_SES *router_cli_ses);
 void route_queued_query(ROUTER_CLIENT_SES *router_cli_ses);
-void synchronize_shard_map(ROUTER_CLIENT_SES *client);
+static void shard_map_free(shard_map_t *map);
+static void shard_map_release(ROUTER_INSTANCE *router, shard_map_t *map);
+static void shard_map_check(void *data);
+static void shard_map_update_session(ROUTER_CLIENT_SES *rses);
+static char* shard_map_find(ROUTER_CLIENT_SES *rses, const char *db);
 
 static int hashkeyfun(const void* key)
 {
@@ -208,6 +220,22 @@ void keyfreefun(void* data)
     MXS_FREE(data);
 }
 
+/**
+ * Free a shard_table_t stored in the table map of a shard map
+ * @param data The shard_table_t to free
+ */
+static void shard_table_free(void* data)
+{
+    shard_table_t *table = (shard_table_t*)data;
+
+    for (int i = 0; i < table->n_servers; i++)
+    {
+        MXS_FREE(table->servers[i]);
+    }
+    MXS_FREE(table->servers);
+    MXS_FREE(table);
+}
+
 /**
  * Allocate a shard map and initialize it.
  * @return Pointer to new shard_map_t or NULL if memory allocation failed
@@ -218,21 +246,720 @@ shard_map_t* shard_map_alloc()
 
     if (rval)
     {
-        if ((rval->hash = hashtable_alloc(SCHEMAROUTER_HASHSIZE, hashkeyfun, hashcmpfun)))
+        rval->hash = hashtable_alloc(SCHEMAROUTER_HASHSIZE, hashkeyfun, hashcmpfun);
+        rval->tables = hashtable_alloc(SCHEMAROUTER_HASHSIZE, hashkeyfun, hashcmpfun);
+
+        if (rval->hash && rval->tables)
         {
             HASHCOPYFN kcopy = (HASHCOPYFN)strdup;
             hashtable_memory_fns(rval->hash, kcopy, kcopy, keyfreefun, keyfreefun);
+            hashtable_memory_fns(rval->tables, kcopy, NULL, keyfreefun, shard_table_free);
             spinlock_init(&rval->lock);
             rval->last_updated = 0;
             rval->state = SHMAP_UNINIT;
+            rval->shared = false;
+            rval->refcount = 0;
+        }
+        else
+        {
+            hashtable_free(rval->hash);
+            hashtable_free(rval->tables);
+            MXS_FREE(rval);
+            rval = NULL;
+        }
+    }
+    return rval;
+}
+
+/**
+ * Free a shard map
+ * @param map Shard map to free
+ */
+static void shard_map_free(shard_map_t *map)
+{
+    hashtable_free(map->hash);
+    hashtable_free(map->tables);
+    MXS_FREE(map);
+}
+
+/**
+ * Take a reference to the router-wide shard map
+ * @param router Router instance
+ * @param version Where the version of the shard map is stored
+ * @return The router-wide shard map or NULL if it has not been built yet
+ */
+static shard_map_t* shard_map_get(ROUTER_INSTANCE *router, int *version)
+{
+    spinlock_acquire(&router->lock);
+    shard_map_t *map = router->shard_map;
+
+    if (map)
+    {
+        map->refcount++;
+    }
+    *version = router->shard_map_version;
+    spinlock_release(&router->lock);
+
+    return map;
+}
+
+/**
+ * Release a reference to a shard map. A shard map of a single session is
+ * freed immediately, the router-wide shard map when the last reference to
+ * it is released.
+ * @param router Router instance
+ * @param map Shard map to release
+ */
+static void shard_map_release(ROUTER_INSTANCE *router, shard_map_t *map)
+{
+    bool last = true;
+
+    if (map->shared)
+    {
+        spinlock_acquire(&router->lock);
+        last = --map->refcount == 0;
+        spinlock_release(&router->lock);
+    }
+
+    if (last)
+    {
+        shard_map_free(map);
+    }
+}
+
+/**
+ * Replace the router-wide shard map. The sessions take the new shard map into
+ * use when they route their next query.
+ * @param router Router instance
+ * @param map The new shard map, the router takes the ownership of it
+ */
+static void shard_map_publish(ROUTER_INSTANCE *router, shard_map_t *map)
+{
+    map->shared = true;
+    map->refcount = 1;
+    map->state = SHMAP_READY;
+
+    spinlock_acquire(&router->lock);
+    shard_map_t *old = router->shard_map;
+    router->shard_map = map;
+    router->shard_map_version++;
+    bool last = old && --old->refcount == 0;
+    spinlock_release(&router->lock);
+
+    if (last)
+    {
+        shard_map_free(old);
+    }
+}
+
+/**
+ * Check whether the user of a session has privileges on a database. The
+ * check is done against the users of the listener the client connected to.
+ * @param rses Router client session
+ * @param db Database name
+ * @return True if the database is visible to the user
+ */
+static bool database_is_visible(ROUTER_CLIENT_SES *rses, const char *db)
+{
+    DCB *dcb = rses->rses_client_dcb;
+
+    if (strcasecmp(db, "information_schema") == 0 || dcb->user == NULL ||
+        dcb->listener == NULL || dcb->listener->users == NULL)
+    {
+        return true;
+    }
+
+    MYSQL_USER_HOST key = {};
+    key.user = dcb->user;
+    memcpy(&key.ipv4, &dcb->ipv4, sizeof(struct sockaddr_in));
+    key.netmask = 32;
+    key.resource = (char*)db;
+
+    if (dcb->remote && strlen(dcb->remote) < MYSQL_HOST_MAXLEN)
+    {
+        strcpy(key.hostname, dcb->remote);
+    }
+
+    bool match_wildcard = key.ipv4.sin_addr.s_addr != 0x0100007F ||
+                          rses->router->service->localhost_match_wildcard_host;
+
+    USERS *users = listener_users_get(dcb->listener);
+    bool rval = mysql_users_find(users, &key, match_wildcard) != NULL;
+    listener_users_put(users);
+
+    return rval;
+}
+
+/**
+ * Find the server of a database from the shard map of a session. The databases
+ * of the router-wide shard map are filtered by the privileges of the user, the
+ * shard map of a single session only has the databases visible to the user.
+ * The caller must hold the lock of the shard map.
+ * @param rses Router client session
+ * @param db Database name
+ * @return The unique name of the server or NULL if the database was not found
+ */
+static char* shard_map_find(ROUTER_CLIENT_SES *rses, const char *db)
+{
+    char *rval = (char*)hashtable_fetch(rses->shardmap->hash, (char*)db);
+
+    if (rval && rses->shardmap->shared && !database_is_visible(rses, db))
+    {
+        rval = NULL;
+    }
+
+    return rval;
+}
+
+/**
+ * Take the newest router-wide shard map into use if the session is not
+ * mapping the databases itself. The caller must hold the router session lock.
+ * @param rses Router client session
+ */
+static void shard_map_update_session(ROUTER_CLIENT_SES *rses)
+{
+    ROUTER_INSTANCE *router = rses->router;
+
+    if (rses->shardmap_version != router->shard_map_version &&
+        (rses->init & (INIT_MAPPING | INIT_FAILED)) == 0)
+    {
+        int version;
+        shard_map_t *map = shard_map_get(router, &version);
+
+        if (map)
+        {
+            shard_map_release(router, rses->shardmap);
+            rses->shardmap = map;
+            rses->shardmap_version = version;
+            rses->init &= ~INIT_UNINT;
+        }
+    }
+}
+
+/**
+ * The databases and tables of one server, queried for the router-wide shard map
+ */
+typedef struct shard_map_server
+{
+    ROUTER_INSTANCE *router;
+    SERVER *server;
+    bool running;       /*< Whether the server was running when the build started */
+    bool queried;       /*< Whether the databases were queried successfully */
+    bool tables_queried; /*< Whether the tables were queried successfully */
+    char **databases;
+    int n_databases;
+    char **tables;      /*< Database and table name pairs */
+    int n_tables;
+} SHARD_MAP_SERVER;
+
+/** Query for the tables of a server, the tables of the system databases are not mapped */
+#define SHARD_MAP_TABLES_QUERY "SELECT TABLE_SCHEMA, TABLE_NAME FROM information_schema.TABLES " \
+    "WHERE TABLE_SCHEMA NOT IN ('information_schema', 'performance_schema', 'mysql')"
+
+/**
+ * Query the tables of a server
+ * @param srv The server
+ * @param con Connection to the server
+ */
+static void shard_map_query_tables(SHARD_MAP_SERVER *srv, MYSQL *con)
+{
+    MYSQL_RES *result;
+
+    if (mysql_query(con, SHARD_MAP_TABLES_QUERY) == 0 && (result = mysql_store_result(con)))
+    {
+        int n_rows = mysql_num_rows(result);
+        MYSQL_ROW row;
+
+        srv->tables = MXS_CALLOC(2 * n_rows + 1, sizeof(char*));
+
+        while (srv->tables && (row = mysql_fetch_row(result)))
+        {
+            char **pair = &srv->tables[2 * srv->n_tables];
+
+            if (row[0] && row[1] && (pair[0] = MXS_STRDUP(row[0])))
+            {
+                if ((pair[1] = MXS_STRDUP(row[1])))
+                {
+                    srv->n_tables++;
+                }
+                else
+                {
+                    MXS_FREE(pair[0]);
+                    pair[0] = NULL;
+                }
+            }
+        }
+
+        srv->tables_queried = srv->tables != NULL;
+        mysql_free_result(result);
+    }
+    else
+    {
+        MXS_ERROR("[%s] Failed to query the tables of server '%s': %s",
+                  srv->router->service->name, srv->server->unique_name, mysql_error(con));
+    }
+}
+
+/**
+ * Query the databases and tables of a server with the credentials of the service
+ * @param data The SHARD_MAP_SERVER of the server
+ */
+static void shard_map_query_server(void *data)
+{
+    SHARD_MAP_SERVER *srv = (SHARD_MAP_SERVER*)data;
+    SERVICE *service = srv->router->service;
+    GATEWAY_CONF *cnf = config_get_global_options();
+    char *user, *password;
+    MYSQL *con;
+
+    if (mysql_thread_init())
+    {
+        MXS_ERROR("mysql_thread_init failed when building the shard map.");
+        return;
+    }
+
+    if (serviceGetUser(service, &user, &password) && (con = mysql_init(NULL)))
+    {
+        char *dpwd = decryptPassword(password);
+
+        mysql_options(con, MYSQL_OPT_READ_TIMEOUT, &cnf->auth_read_timeout);
+        mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &cnf->auth_conn_timeout);
+        mysql_options(con, MYSQL_OPT_WRITE_TIMEOUT, &cnf->auth_write_timeout);
+
+        MYSQL_RES *result;
+
+        if (mxs_mysql_real_connect(con, srv->server, user, dpwd) &&
+            mysql_query(con, "SHOW DATABASES") == 0 &&
+            (result = mysql_store_result(con)))
+        {
+            int n_rows = mysql_num_rows(result);
+            MYSQL_ROW row;
+
+            srv->databases = MXS_CALLOC(n_rows + 1, sizeof(char*));
+
+            while (srv->databases && (row = mysql_fetch_row(result)))
+            {
+                if (row[0] && (srv->databases[srv->n_databases] = MXS_STRDUP(row[0])))
+                {
+                    srv->n_databases++;
+                }
+            }
+
+            srv->queried = srv->databases != NULL;
+            mysql_free_result(result);
+
+            if (srv->queried)
+            {
+                shard_map_query_tables(srv, con);
+            }
+        }
+        else
+        {
+            MXS_ERROR("[%s] Failed to query the databases of server '%s': %s",
+                      service->name, srv->server->unique_name, mysql_error(con));
+        }
+
+        mysql_close(con);
+        MXS_FREE(dpwd);
+    }
+
+    mysql_thread_end();
+}
+
+/**
+ * Add a database to a shard map being built
+ * @param router Router instance
+ * @param map Shard map
+ * @param match_data Match data for the regex of ignored databases or NULL
+ * @param db Database name
+ * @param server Unique name of the server
+ * @return True if the database was already found on another server and it
+ * is not ignored
+ */
+static bool shard_map_add(ROUTER_INSTANCE *router, shard_map_t *map,
+                          pcre2_match_data *match_data, char *db, char *server)
+{
+    bool rval = false;
+
+    if (hashtable_add(map->hash, db, server) == 0)
+    {
+        char *other = hashtable_fetch(map->hash, db);
+
+        if (other && strcmp(other, server) != 0 &&
+            !(hashtable_fetch(router->ignored_dbs, db) ||
+              (match_data && pcre2_match(router->ignore_regex, (PCRE2_SPTR)db,
+                                         PCRE2_ZERO_TERMINATED, 0, 0, match_data, NULL) >= 0)))
+        {
+            MXS_INFO("[%s] Database '%s' found on servers '%s' and '%s', mapping its tables.",
+                     router->service->name, db, other, server);
+            rval = true;
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Add a table to the table map of a shard map being built
+ * @param map Shard map
+ * @param key The db.table name of the table
+ * @param server Unique name of the server
+ */
+static void shard_map_add_table(shard_map_t *map, char *key, char *server)
+{
+    shard_table_t *table = hashtable_fetch(map->tables, key);
+
+    if (table == NULL)
+    {
+        if ((table = MXS_CALLOC(1, sizeof(shard_table_t))) &&
+            hashtable_add(map->tables, key, table) == 0)
+        {
+            MXS_FREE(table);
+            table = NULL;
+        }
+    }
+
+    if (table)
+    {
+        for (int i = 0; i < table->n_servers; i++)
+        {
+            if (strcmp(table->servers[i], server) == 0)
+            {
+                return;
+            }
+        }
+
+        char **servers = MXS_REALLOC(table->servers, (table->n_servers + 1) * sizeof(char*));
+
+        if (servers)
+        {
+            table->servers = servers;
+
+            if ((servers[table->n_servers] = MXS_STRDUP(server)))
+            {
+                table->n_servers++;
+            }
+        }
+    }
+}
+
+/**
+ * Check whether the database of a db.table name is one of the given databases
+ * @param dbs Hashtable of database names
+ * @param key The db.table name
+ * @return True if the database of the table is in the hashtable
+ */
+static bool table_in_databases(HASHTABLE *dbs, const char *key)
+{
+    const char *dot = strchr(key, '.');
+    bool rval = false;
+
+    if (dot && dot - key <= MYSQL_DATABASE_MAXLEN)
+    {
+        char db[MYSQL_DATABASE_MAXLEN + 1];
+        memcpy(db, key, dot - key);
+        db[dot - key] = '\0';
+        rval = hashtable_fetch(dbs, db) != NULL;
+    }
+
+    return rval;
+}
+
+/**
+ * Check whether two shard maps map the same databases and tables to the same servers
+ * @param a Shard map
+ * @param b Shard map
+ * @return True if the shard maps are equal
+ */
+static bool shard_map_equal(shard_map_t *a, shard_map_t *b)
+{
+    bool rval = hashtable_size(a->hash) == hashtable_size(b->hash) &&
+                hashtable_size(a->tables) == hashtable_size(b->tables);
+    HASHITERATOR *iter = rval ? hashtable_iterator(a->hash) : NULL;
+
+    if (iter)
+    {
+        char *key;
+
+        while (rval && (key = hashtable_next(iter)))
+        {
+            char *server = hashtable_fetch(b->hash, key);
+            rval = server && strcmp(server, hashtable_fetch(a->hash, key)) == 0;
+        }
+
+        hashtable_iterator_free(iter);
+    }
+
+    iter = rval ? hashtable_iterator(a->tables) : NULL;
+
+    if (iter)
+    {
+        char *key;
+
+        while (rval && (key = hashtable_next(iter)))
+        {
+            shard_table_t *ta = hashtable_fetch(a->tables, key);
+            shard_table_t *tb = hashtable_fetch(b->tables, key);
+            rval = tb && ta->n_servers == tb->n_servers;
+
+            for (int i = 0; rval && i < ta->n_servers; i++)
+            {
+                rval = strcmp(ta->servers[i], tb->servers[i]) == 0;
+            }
+        }
+
+        hashtable_iterator_free(iter);
+    }
+
+    return rval;
+}
+
+/**
+ * Build the router-wide shard map
+ *
+ * The databases of the servers are queried in parallel, each by a thread of its
+ * own. The map is built incrementally from the previous one: the databases of
+ * a running server that could not be queried are taken from the previous map.
+ * The tables of the databases that are found on more than one server are added
+ * to the table map. The new map replaces the previous one only if it is different.
+ *
+ * @param data Router instance
+ */
+static void shard_map_build(void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE*)data;
+    struct timespec start, end;
+    int n_servers = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (router->servers[n_servers])
+    {
+        n_servers++;
+    }
+
+    SHARD_MAP_SERVER servers[n_servers];
+    THREAD threads[n_servers];
+    bool started[n_servers];
+
+    for (int i = 0; i < n_servers; i++)
+    {
+        memset(&servers[i], 0, sizeof(servers[i]));
+        servers[i].router = router;
+        servers[i].server = router->servers[i]->backend_server;
+        servers[i].running = SERVER_IS_RUNNING(servers[i].server);
+        started[i] = servers[i].running &&
+                     thread_start(&threads[i], shard_map_query_server, &servers[i]) != NULL;
+    }
+
+    for (int i = 0; i < n_servers; i++)
+    {
+        if (started[i])
+        {
+            thread_wait(threads[i]);
+        }
+    }
+
+    int version;
+    shard_map_t *old = shard_map_get(router, &version);
+    shard_map_t *map = shard_map_alloc();
+    HASHTABLE *split = hashtable_alloc(SCHEMAROUTER_HASHSIZE, hashkeyfun, hashcmpfun);
+    pcre2_match_data *match_data = router->ignore_regex ?
+                                   pcre2_match_data_create_from_pattern(router->ignore_regex, NULL) : NULL;
+
+    if (split)
+    {
+        hashtable_memory_fns(split, hashtable_item_strdup, NULL, hashtable_item_free, NULL);
+    }
+    else if (map)
+    {
+        shard_map_free(map);
+        map = NULL;
+    }
+
+    for (int i = 0; map && i < n_servers; i++)
+    {
+        char *name = servers[i].server->unique_name;
+
+        if (servers[i].queried)
+        {
+            for (int j = 0; j < servers[i].n_databases; j++)
+            {
+                if (shard_map_add(router, map, match_data, servers[i].databases[j], name))
+                {
+                    hashtable_add(split, servers[i].databases[j], "");
+                }
+            }
+        }
+        else if (servers[i].running && old)
+        {
+            /** Keep the previous databases of a server that failed to respond */
+            HASHITERATOR *iter = hashtable_iterator(old->hash);
+            char *key;
+
+            while (iter && (key = hashtable_next(iter)))
+            {
+                if (strcmp(hashtable_fetch(old->hash, key), name) == 0 &&
+                    shard_map_add(router, map, match_data, key, name))
+                {
+                    hashtable_add(split, key, "");
+                }
+            }
+
+            hashtable_iterator_free(iter);
+        }
+    }
+
+    /** Map the tables of the databases that were found on more than one server */
+    for (int i = 0; map && hashtable_size(split) > 0 && i < n_servers; i++)
+    {
+        char *name = servers[i].server->unique_name;
+
+        if (servers[i].tables_queried)
+        {
+            for (int j = 0; j < servers[i].n_tables; j++)
+            {
+                char *db = servers[i].tables[2 * j];
+                char *table = servers[i].tables[2 * j + 1];
+
+                if (hashtable_fetch(split, db))
+                {
+                    char key[strlen(db) + strlen(table) + 2];
+                    sprintf(key, "%s.%s", db, table);
+                    shard_map_add_table(map, key, name);
+                }
+            }
+        }
+        else if (servers[i].running && old)
+        {
+            /** Keep the previous tables of a server that failed to respond */
+            HASHITERATOR *iter = hashtable_iterator(old->tables);
+            char *key;
+
+            while (iter && (key = hashtable_next(iter)))
+            {
+                shard_table_t *table = hashtable_fetch(old->tables, key);
+
+                for (int j = 0; j < table->n_servers; j++)
+                {
+                    if (strcmp(table->servers[j], name) == 0 && table_in_databases(split, key))
+                    {
+                        shard_map_add_table(map, key, name);
+                    }
+                }
+            }
+
+            hashtable_iterator_free(iter);
+        }
+    }
+
+    for (int i = 0; i < n_servers; i++)
+    {
+        for (int j = 0; j < servers[i].n_databases; j++)
+        {
+            MXS_FREE(servers[i].databases[j]);
+        }
+        MXS_FREE(servers[i].databases);
+
+        for (int j = 0; j < 2 * servers[i].n_tables; j++)
+        {
+            MXS_FREE(servers[i].tables[j]);
+        }
+        MXS_FREE(servers[i].tables);
+        router->shard_map_running[i] = servers[i].running;
+    }
+
+    hashtable_free(split);
+
+    if (match_data)
+    {
+        pcre2_match_data_free(match_data);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    router->shard_map_build_time = (end.tv_sec - start.tv_sec) +
+                                   (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+    atomic_add(&router->shard_map_builds, 1);
+
+    if (map)
+    {
+        map->last_updated = time(NULL);
+
+        if (old && shard_map_equal(old, map))
+        {
+            spinlock_acquire(&old->lock);
+            old->last_updated = map->last_updated;
+            spinlock_release(&old->lock);
+            shard_map_free(map);
+        }
+        else
+        {
+            MXS_INFO("[%s] Shard map rebuilt with %d databases and %d tables in %.3f seconds.",
+                     router->service->name, hashtable_size(map->hash),
+                     hashtable_size(map->tables), router->shard_map_build_time);
+            shard_map_publish(router, map);
+            atomic_add(&router->shard_map_changes, 1);
+        }
+    }
+
+    if (old)
+    {
+        shard_map_release(router, old);
+    }
+
+    __sync_lock_release(&router->shard_map_building);
+}
+
+/**
+ * The housekeeper task that starts a rebuild of the router-wide shard map when
+ * it is missing, older than the refresh interval, a rebuild was requested or
+ * the running state of a server has changed since the last build
+ * @param data Router instance
+ */
+static void shard_map_check(void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE*)data;
+    time_t now = time(NULL);
+    bool rebuild = router->shard_map_requested || router->shard_map == NULL;
+
+    spinlock_acquire(&router->lock);
+    if (router->shard_map &&
+        difftime(now, router->shard_map->last_updated) > router->schemarouter_config.refresh_min_interval)
+    {
+        rebuild = true;
+    }
+    spinlock_release(&router->lock);
+
+    for (int i = 0; !rebuild && router->servers[i]; i++)
+    {
+        rebuild = SERVER_IS_RUNNING(router->servers[i]->backend_server) != router->shard_map_running[i];
+    }
+
+    /** Failed builds are retried at most once in the refresh interval */
+    if (rebuild && router->shard_map == NULL &&
+        difftime(now, router->shard_map_attempt) < router->schemarouter_config.refresh_min_interval)
+    {
+        rebuild = false;
+    }
+
+    if (rebuild && !__sync_lock_test_and_set(&router->shard_map_building, 1))
+    {
+        THREAD thread;
+
+        router->shard_map_requested = false;
+        router->shard_map_attempt = now;
+
+        if (thread_start(&thread, shard_map_build, router))
+        {
+            thread_detach(thread);
         }
         else
         {
-            MXS_FREE(rval);
-            rval = NULL;
+            MXS_ERROR("[%s] Failed to start the thread that builds the shard map.",
+                      router->service->name);
+            __sync_lock_release(&router->shard_map_building);
         }
     }
-    return rval;
 }
 
 /**
@@ -488,14 +1215,12 @@ char* get_shard_target_name(ROUTER_INSTANCE* router,
 
     dbnms = qc_get_database_names(buffer, &sz);
 
-    HASHTABLE* ht = client->shardmap->hash;
-
     if (sz > 0)
     {
         for (i = 0; i < sz; i++)
         {
             char* name;
-            if ((name = (char*)hashtable_fetch(ht, dbnms[i])))
+            if ((name = shard_map_find(client, dbnms[i])))
             {
                 if (strcmp(dbnms[i], "information_schema") == 0 && rval == NULL)
                 {
@@ -533,7 +1258,7 @@ char* get_shard_target_name(ROUTER_INSTANCE* router,
             char *saved, *tok = strtok_r(tmp, " ;", &saved);
             tok = strtok_r(NULL, " ;", &saved);
             ss_dassert(tok != NULL);
-            tmp = (char*) hashtable_fetch(ht, tok);
+            tmp = shard_map_find(client, tok);
 
             if (tmp)
             {
@@ -544,7 +1269,7 @@ char* get_shard_target_name(ROUTER_INSTANCE* router,
 
         if (tmp == NULL)
         {
-            rval = (char*) hashtable_fetch(ht, client->current_db);
+            rval = shard_map_find(client, client->current_db);
             MXS_INFO("schemarouter: SHOW TABLES query, current database '%s' on server '%s'",
                      client->current_db, rval);
         }
@@ -577,7 +1302,7 @@ char* get_shard_target_name(ROUTER_INSTANCE* router,
              * active database, set is as the target
              */
 
-            rval = (char*) hashtable_fetch(ht, client->current_db);
+            rval = shard_map_find(client, client->current_db);
             if (rval)
             {
                 MXS_INFO("schemarouter: Using active database '%s'", client->current_db);
@@ -588,6 +1313,116 @@ char* get_shard_target_name(ROUTER_INSTANCE* router,
     return rval;
 }
 
+/**
+ * Find the servers of the tables of a query from the table map. The tables of
+ * a database that is found on more than one server are mapped individually.
+ * If the tables are on several servers, the query is sent to all of them and
+ * the results are merged. This is possible only if every table is on every
+ * one of the servers: a sharded table can be joined with a table that is
+ * copied to all of its shards, not with a table that is only on some of them.
+ * The caller must hold the lock of the shard map.
+ * @param client Router client session
+ * @param buffer Query to inspect
+ * @param servers Where the unique names of the servers are stored
+ * @param max_servers Size of @c servers
+ * @return Number of servers stored in @c servers, 0 if none of the tables of
+ * the query is in the table map
+ */
+static int get_shard_table_servers(ROUTER_CLIENT_SES* client, GWBUF* buffer,
+                                   char** servers, int max_servers)
+{
+    HASHTABLE *tables = client->shardmap->tables;
+    int n_servers = 0;
+    int n_tables = 0;
+    char **names;
+
+    if (hashtable_size(tables) == 0 ||
+        (names = qc_get_table_names(buffer, &n_tables, true)) == NULL)
+    {
+        return 0;
+    }
+
+    /** The servers of each table, a table that is not in the table map is
+     * on the server of its database */
+    shard_table_t found[n_tables];
+    char *db_server[n_tables];
+    bool mapped = false;
+
+    for (int i = 0; i < n_tables; i++)
+    {
+        char key[MYSQL_DATABASE_MAXLEN + MYSQL_TABLE_MAXLEN + 2];
+        char db[MYSQL_DATABASE_MAXLEN + 1];
+        char *dot = strchr(names[i], '.');
+
+        if (dot && dot - names[i] <= MYSQL_DATABASE_MAXLEN)
+        {
+            memcpy(db, names[i], dot - names[i]);
+            db[dot - names[i]] = '\0';
+            snprintf(key, sizeof(key), "%s", names[i]);
+        }
+        else
+        {
+            strcpy(db, client->current_db);
+            snprintf(key, sizeof(key), "%s.%s", db, names[i]);
+        }
+
+        shard_table_t *table = db[0] && database_is_visible(client, db) ?
+                               hashtable_fetch(tables, key) : NULL;
+        found[i].n_servers = 0;
+
+        if (table)
+        {
+            found[i] = *table;
+            mapped = true;
+        }
+        else if (db[0] && (db_server[i] = shard_map_find(client, db)))
+        {
+            found[i].n_servers = 1;
+            found[i].servers = &db_server[i];
+        }
+
+        for (int j = 0; j < found[i].n_servers; j++)
+        {
+            int k = 0;
+
+            while (k < n_servers && strcmp(servers[k], found[i].servers[j]) != 0)
+            {
+                k++;
+            }
+
+            if (k == n_servers && n_servers < max_servers)
+            {
+                servers[n_servers++] = found[i].servers[j];
+            }
+        }
+    }
+
+    if (!mapped)
+    {
+        n_servers = 0;
+    }
+
+    for (int i = 0; i < n_tables && n_servers > 1; i++)
+    {
+        if (found[i].n_servers > 0 && found[i].n_servers != n_servers)
+        {
+            MXS_ERROR("Schemarouter: Query targets table '%s' which is only on some "
+                      "of the servers '%s' and '%s' of the other tables. Cross server "
+                      "queries are not supported, using server '%s'.",
+                      names[i], servers[0], servers[1], servers[0]);
+            n_servers = 1;
+        }
+    }
+
+    for (int i = 0; i < n_tables; i++)
+    {
+        MXS_FREE(names[i]);
+    }
+    MXS_FREE(names);
+
+    return n_servers;
+}
+
 /**
  * Check if the backend is still running. If the backend is not running the
  * hashtable is updated with up-to-date values.
@@ -713,16 +1548,6 @@ static ROUTER* createInstance(SERVICE *service, char **options)
     }
     hashtable_memory_fns(router->ignored_dbs, hashtable_item_strdup, NULL, hashtable_item_free, NULL);
 
-    if ((router->shard_maps = hashtable_alloc(SCHEMAROUTER_USERHASH_SIZE, hashkeyfun, hashcmpfun)) == NULL)
-    {
-        MXS_ERROR("Memory allocation failed when allocating schemarouter database ignore list.");
-        hashtable_free(router->ignored_dbs);
-        MXS_FREE(router);
-        return NULL;
-    }
-
-    hashtable_memory_fns(router->shard_maps, hashtable_item_strdup, NULL, keyfreefun, NULL);
-
     /** Add default system databases to ignore */
     hashtable_add(router->ignored_dbs, "mysql", "");
     hashtable_add(router->ignored_dbs, "information_schema", "");
@@ -732,6 +1557,8 @@ static ROUTER* createInstance(SERVICE *service, char **options)
     router->schemarouter_config.last_refresh = time(NULL);
     router->schemarouter_config.refresh_databases = false;
     router->schemarouter_config.refresh_min_interval = DEFAULT_REFRESH_INTERVAL;
+    router->schemarouter_config.scatter_gather = true;
+    router->schemarouter_config.scatter_gather_max_size = DEFAULT_SCATTER_GATHER_MAX_SIZE;
     router->stats.longest_sescmd = 0;
     router->stats.n_hist_exceeded = 0;
     router->stats.n_queries = 0;
@@ -832,6 +1659,14 @@ static ROUTER* createInstance(SERVICE *service, char **options)
         {
             router->schemarouter_config.debug = config_truth_value(value);
         }
+        else if (strcmp(options[i], "scatter_gather") == 0)
+        {
+            router->schemarouter_config.scatter_gather = config_truth_value(value);
+        }
+        else if (strcmp(options[i], "scatter_gather_max_size") == 0)
+        {
+            router->schemarouter_config.scatter_gather_max_size = strtoull(value, NULL, 10);
+        }
         else
         {
             MXS_ERROR("Unknown router options for Schemarouter: %s", options[i]);
@@ -858,9 +1693,12 @@ static ROUTER* createInstance(SERVICE *service, char **options)
         server = server->next;
     }
     router->servers = (BACKEND **)MXS_CALLOC(nservers + 1, sizeof(BACKEND *));
+    router->shard_map_running = (bool *)MXS_CALLOC(nservers + 1, sizeof(bool));
 
-    if (router->servers == NULL)
+    if (router->servers == NULL || router->shard_map_running == NULL)
     {
+        MXS_FREE(router->servers);
+        MXS_FREE(router->shard_map_running);
         MXS_FREE(router);
         return NULL;
     }
@@ -924,6 +1762,13 @@ static ROUTER* createInstance(SERVICE *service, char **options)
     router->next = instances;
     instances = router;
     spinlock_release(&instlock);
+
+    /** The shard map is built in the background and shared by all sessions */
+    {
+        char task_name[strlen(service->name) + sizeof("Shard map of ")];
+        sprintf(task_name, "Shard map of %s", service->name);
+        hktask_add(task_name, shard_map_check, router, SHARD_MAP_CHECK_INTERVAL);
+    }
     goto retblock;
 
 clean_up:
@@ -933,6 +1778,7 @@ clean_up:
         MXS_FREE(router->servers[i]);
     }
     MXS_FREE(router->servers);
+    MXS_FREE(router->shard_map_running);
     MXS_FREE(router);
     router = NULL;
     /** Fallthrough */
@@ -940,25 +1786,6 @@ retblock:
     return (ROUTER *)router;
 }
 
-/**
- * Check if the shard map is out of date and update its state if necessary.
- * @param router Router instance
- * @param map Shard map to update
- * @return Current state of the shard map
- */
-enum shard_map_state shard_map_update_state(shard_map_t *self, ROUTER_INSTANCE* router)
-{
-    spinlock_acquire(&self->lock);
-    double tdiff = difftime(time(NULL), self->last_updated);
-    if (tdiff > router->schemarouter_config.refresh_min_interval)
-    {
-        self->state = SHMAP_STALE;
-    }
-    enum shard_map_state state = self->state;
-    spinlock_release(&self->lock);
-    return state;
-}
-
 /**
  * Associate a new session with this instance of the router.
  *
@@ -1023,20 +1850,15 @@ static void* newSession(ROUTER* router_inst, SESSION* session)
     client_rses->rses_mysql_session = (MYSQL_session*)session->client_dcb->data;
     client_rses->rses_client_dcb = (DCB*)session->client_dcb;
 
-    spinlock_acquire(&router->lock);
-
-    shard_map_t *map = hashtable_fetch(router->shard_maps, session->client_dcb->user);
-    enum shard_map_state state;
-
-    if (map)
-    {
-        state = shard_map_update_state(map, router);
-    }
-
-    spinlock_release(&router->lock);
+    int version;
+    shard_map_t *map = shard_map_get(router, &version);
 
-    if (map == NULL || state != SHMAP_READY)
+    if (map == NULL)
     {
+        /**
+         * The router-wide shard map has not been built yet, this session maps
+         * the databases visible to the user itself.
+         */
         if ((map = shard_map_alloc()) == NULL)
         {
             MXS_ERROR("Failed to allocate enough memory to create"
@@ -1045,6 +1867,8 @@ static void* newSession(ROUTER* router_inst, SESSION* session)
             return NULL;
         }
         client_rses->init = INIT_UNINT;
+        router->shard_map_requested = true;
+        atomic_add(&router->stats.shmap_cache_miss, 1);
     }
     else
     {
@@ -1053,6 +1877,7 @@ static void* newSession(ROUTER* router_inst, SESSION* session)
     }
 
     client_rses->shardmap = map;
+    client_rses->shardmap_version = version;
     client_rses->dcb_reply = dcb_alloc(DCB_ROLE_INTERNAL, NULL);
     client_rses->dcb_reply->func.read = internalReply;
     client_rses->dcb_reply->state = DCB_STATE_POLLING;
@@ -1090,6 +1915,7 @@ static void* newSession(ROUTER* router_inst, SESSION* session)
     if (backend_ref == NULL)
     {
         /** log this */
+        shard_map_release(router, client_rses->shardmap);
         MXS_FREE(client_rses);
         MXS_FREE(backend_ref);
         client_rses = NULL;
@@ -1129,6 +1955,7 @@ static void* newSession(ROUTER* router_inst, SESSION* session)
     if (!(succp = rses_begin_locked_router_action(client_rses)))
     {
         MXS_FREE(client_rses->rses_backend_ref);
+        shard_map_release(router, client_rses->shardmap);
         MXS_FREE(client_rses);
         client_rses = NULL;
         goto return_rses;
@@ -1149,6 +1976,7 @@ static void* newSession(ROUTER* router_inst, SESSION* session)
     if (!succp)
     {
         MXS_FREE(client_rses->rses_backend_ref);
+        shard_map_release(router, client_rses->shardmap);
         MXS_FREE(client_rses);
         client_rses = NULL;
         goto return_rses;
@@ -1160,6 +1988,7 @@ static void* newSession(ROUTER* router_inst, SESSION* session)
     if (!(succp = rses_begin_locked_router_action(client_rses)))
     {
         MXS_FREE(client_rses->rses_backend_ref);
+        shard_map_release(router, client_rses->shardmap);
         MXS_FREE(client_rses);
 
         client_rses = NULL;
@@ -1372,6 +2201,10 @@ static void freeSession(ROUTER* router_instance, void* router_client_session)
             p = q;
         }
     }
+
+    shard_map_release(router, router_cli_ses->shardmap);
+    scatter_query_free(router_cli_ses->scatter);
+
     /*
      * We are no longer in the linked list, free
      * all the memory and other resources associated
@@ -1778,9 +2611,9 @@ bool send_database_list(ROUTER_INSTANCE* router, ROUTER_CLIENT_SES* client)
             int i = 0;
             while ((key = hashtable_next(iter)))
             {
-                char *value = hashtable_fetch(client->shardmap->hash, key);
-                SERVER * server = server_find_by_unique_name(value);
-                if (SERVER_IS_RUNNING(server))
+                char *value = shard_map_find(client, key);
+                SERVER * server = value ? server_find_by_unique_name(value) : NULL;
+                if (server && SERVER_IS_RUNNING(server))
                 {
                     strarray.array[i++] = key;
                 }
@@ -1802,6 +2635,116 @@ bool send_database_list(ROUTER_INSTANCE* router, ROUTER_CLIENT_SES* client)
     return rval;
 }
 
+/**
+ * Send a SELECT to all of the servers of its tables. The replies are collected
+ * in clientReply and merged into one result once all of them have arrived.
+ * The caller must hold the router session lock.
+ * @param inst Router instance
+ * @param rses Router client session
+ * @param querybuf The query
+ * @param query The scatter-gather query, owned by the session if the query was routed
+ * @param servers Unique names of the servers
+ * @param n_servers Number of servers
+ * @return True if the query was routed
+ */
+static bool route_scatter_query(ROUTER_INSTANCE* inst, ROUTER_CLIENT_SES* rses, GWBUF* querybuf,
+                                scatter_query_t* query, char** servers, int n_servers)
+{
+    DCB* dcbs[n_servers];
+
+    for (int i = 0; i < n_servers; i++)
+    {
+        dcbs[i] = NULL;
+
+        if (!get_shard_dcb(&dcbs[i], rses, servers[i]))
+        {
+            MXS_INFO("Was supposed to route to named server "
+                     "%s but couldn't find the server in a "
+                     "suitable state.", servers[i]);
+            return false;
+        }
+    }
+
+    /** The shards can't skip the rows of a LIMIT offset, the offset is added to the row count */
+    char* sql = modutil_get_SQL(querybuf);
+    char* rewritten = sql ? scatter_plan_rewrite(sql, &query->plan) : NULL;
+    GWBUF* stmt = rewritten ? modutil_create_query(rewritten) : gwbuf_clone(querybuf);
+    MXS_FREE(rewritten);
+    MXS_FREE(sql);
+
+    if (stmt == NULL)
+    {
+        return false;
+    }
+
+    rses->scatter = query;
+    atomic_add(&inst->stats.n_queries, 1);
+    atomic_add(&inst->stats.n_scatter, 1);
+
+    for (int i = 0; i < n_servers; i++)
+    {
+        backend_ref_t* bref = get_bref_from_dcb(rses, dcbs[i]);
+        int index = bref - rses->rses_backend_ref;
+
+        query->replies[index].active = true;
+        query->n_pending++;
+    }
+
+    for (int i = 0; i < n_servers; i++)
+    {
+        backend_ref_t* bref = get_bref_from_dcb(rses, dcbs[i]);
+        int index = bref - rses->rses_backend_ref;
+
+        MXS_INFO("Route scatter-gather query to \t%s:%d <",
+                 bref->bref_backend->backend_server->name,
+                 bref->bref_backend->backend_server->port);
+
+        if (sescmd_cursor_is_active(&bref->bref_sescmd_cur))
+        {
+            /** Sent by clientReply once the session command has been executed */
+            ss_dassert(bref->bref_pending_cmd == NULL || rses->rses_closed);
+            bref->bref_pending_cmd = gwbuf_clone(stmt);
+        }
+        else if (dcbs[i]->func.write(dcbs[i], gwbuf_clone(stmt)) == 1)
+        {
+            bref_set_state(bref, BREF_QUERY_ACTIVE);
+            bref_set_state(bref, BREF_WAITING_RESULT);
+            atomic_add(&bref->bref_backend->stats.queries, 1);
+        }
+        else
+        {
+            char errmsg[MAX_SERVER_NAME_LEN + 64];
+            snprintf(errmsg, sizeof(errmsg), "Routing the query to server '%s' failed.",
+                     bref->bref_backend->backend_server->unique_name);
+            MXS_ERROR("%s", errmsg);
+
+            GWBUF* err = modutil_create_mysql_err_msg(1, 0, 2003, "HY000", errmsg);
+            GWBUF* reply = scatter_query_set_error(query, index, err);
+            gwbuf_free(err);
+
+            if (query->n_pending == 0)
+            {
+                /** None of the servers could be sent the query, reply with the error */
+                scatter_query_free(query);
+                rses->scatter = NULL;
+
+                if (reply)
+                {
+                    rses->rses_client_dcb->func.write(rses->rses_client_dcb, reply);
+                }
+            }
+            else
+            {
+                ss_dassert(reply == NULL);
+            }
+        }
+    }
+
+    gwbuf_free(stmt);
+
+    return true;
+}
+
 /**
  * The main routing entry, this is called with every packet that is
  * received and has to be forwarded to the backend database.
@@ -1843,6 +2786,9 @@ static int routeQuery(ROUTER* instance,
     GWBUF* querybuf = qbuf;
     char db[MYSQL_DATABASE_MAXLEN + 1];
     char errbuf[26 + MYSQL_DATABASE_MAXLEN];
+    scatter_query_t* scatter = NULL;
+    char* scatter_servers[router_cli_ses->rses_nbackends + 1];
+    int n_scatter_servers = 0;
     CHK_CLIENT_RSES(router_cli_ses);
 
     ss_dassert(!GWBUF_IS_TYPE_UNDEFINED(querybuf));
@@ -1856,6 +2802,8 @@ static int routeQuery(ROUTER* instance,
 
     if (!(rses_is_closed = router_cli_ses->rses_closed))
     {
+        shard_map_update_session(router_cli_ses);
+
         if (router_cli_ses->init & INIT_UNINT)
         {
             /* Generate database list */
@@ -2028,10 +2976,20 @@ static int routeQuery(ROUTER* instance,
 
     if (packet_type == MYSQL_COM_INIT_DB || op == QUERY_OP_CHANGE_DB)
     {
+        char previous_db[MYSQL_DATABASE_MAXLEN + 1];
+        strcpy(previous_db, router_cli_ses->current_db);
+
         spinlock_acquire(&router_cli_ses->shardmap->lock);
         change_successful = change_current_db(router_cli_ses->current_db,
                                               router_cli_ses->shardmap->hash,
                                               querybuf);
+
+        if (change_successful && shard_map_find(router_cli_ses, router_cli_ses->current_db) == NULL)
+        {
+            /** The database is not visible to the user */
+            strcpy(router_cli_ses->current_db, previous_db);
+            change_successful = false;
+        }
         spinlock_release(&router_cli_ses->shardmap->lock);
         if (!change_successful)
         {
@@ -2040,18 +2998,24 @@ static int routeQuery(ROUTER* instance,
                 difftime(now, router_cli_ses->rses_config.last_refresh) >
                 router_cli_ses->rses_config.refresh_min_interval)
             {
-                spinlock_acquire(&router_cli_ses->shardmap->lock);
-                router_cli_ses->shardmap->state = SHMAP_STALE;
-                spinlock_release(&router_cli_ses->shardmap->lock);
+                /**
+                 * Map the databases of this session to find the new database
+                 * and have the router-wide shard map rebuilt. The session takes
+                 * the router-wide shard map back into use once it is rebuilt.
+                 */
+                inst->shard_map_requested = true;
 
                 rses_begin_locked_router_action(router_cli_ses);
 
                 router_cli_ses->rses_config.last_refresh = now;
                 router_cli_ses->queue = querybuf;
                 int rc_refresh = 1;
+                shard_map_t *map = shard_map_alloc();
 
-                if ((router_cli_ses->shardmap = shard_map_alloc()))
+                if (map)
                 {
+                    shard_map_release(inst, router_cli_ses->shardmap);
+                    router_cli_ses->shardmap = map;
                     gen_databaselist(inst, router_cli_ses);
                 }
                 else
@@ -2100,7 +3064,7 @@ static int routeQuery(ROUTER* instance,
         route_target = TARGET_UNDEFINED;
 
         spinlock_acquire(&router_cli_ses->shardmap->lock);
-        tname = hashtable_fetch(router_cli_ses->shardmap->hash, router_cli_ses->current_db);
+        tname = shard_map_find(router_cli_ses, router_cli_ses->current_db);
 
 
         if (tname)
@@ -2124,7 +3088,52 @@ static int routeQuery(ROUTER* instance,
          * we just want the server to send an error back. */
 
         spinlock_acquire(&router_cli_ses->shardmap->lock);
-        if ((tname = get_shard_target_name(inst, router_cli_ses, querybuf, qtype)) != NULL)
+        char* table_servers[router_cli_ses->rses_nbackends + 1];
+        int n = packet_type == MYSQL_COM_QUERY ?
+                get_shard_table_servers(router_cli_ses, querybuf, table_servers,
+                                        router_cli_ses->rses_nbackends) : 0;
+
+        if (n > 1 && router_cli_ses->rses_config.scatter_gather &&
+            op == QUERY_OP_SELECT && !QUERY_IS_TYPE(qtype, QUERY_TYPE_WRITE) &&
+            (scatter = scatter_query_alloc(router_cli_ses->rses_nbackends,
+                                           router_cli_ses->rses_config.scatter_gather_max_size)))
+        {
+            char* sql = modutil_get_SQL(querybuf);
+
+            if (sql && scatter_plan_create(sql, &scatter->plan))
+            {
+                for (i = 0; i < n; i++)
+                {
+                    scatter_servers[n_scatter_servers++] = MXS_STRDUP_A(table_servers[i]);
+                }
+                route_target = TARGET_NAMED_SERVER;
+                MXS_INFO("schemarouter: Scatter-gather query to %d servers", n);
+            }
+            else
+            {
+                MXS_INFO("schemarouter: The results of the query can't be merged, "
+                         "routing it to server '%s'", table_servers[0]);
+                scatter_query_free(scatter);
+                scatter = NULL;
+                n = 1;
+            }
+            MXS_FREE(sql);
+        }
+
+        if (scatter)
+        {
+            tname = NULL;
+        }
+        else if (n > 0)
+        {
+            tname = table_servers[0];
+        }
+        else
+        {
+            tname = get_shard_target_name(inst, router_cli_ses, querybuf, qtype);
+        }
+
+        if (tname != NULL)
         {
             bool shard_ok = check_shard_status(inst, tname);
 
@@ -2224,6 +3233,18 @@ static int routeQuery(ROUTER* instance,
         goto retblock;
     }
 
+    if (scatter)
+    {
+        if (route_scatter_query(inst, router_cli_ses, querybuf, scatter,
+                                scatter_servers, n_scatter_servers))
+        {
+            scatter = NULL;
+            ret = 1;
+        }
+        rses_end_locked_router_action(router_cli_ses);
+        goto retblock;
+    }
+
     if (TARGET_IS_ANY(route_target))
     {
         int z;
@@ -2322,6 +3343,12 @@ static int routeQuery(ROUTER* instance,
 retblock:
     MXS_FREE(targetserver);
     gwbuf_free(querybuf);
+    scatter_query_free(scatter);
+
+    for (i = 0; i < n_scatter_servers; i++)
+    {
+        MXS_FREE(scatter_servers[i]);
+    }
 
     return ret;
 }
@@ -2451,6 +3478,29 @@ static void diagnostic(ROUTER *instance, DCB *dcb)
     }
     dcb_printf(dcb, "Shard map cache hits: %d\n", router->stats.shmap_cache_hit);
     dcb_printf(dcb, "Shard map cache misses: %d\n", router->stats.shmap_cache_miss);
+    dcb_printf(dcb, "Scatter-gather queries: %d\n", router->stats.n_scatter);
+
+    /** Shared shard map statistics */
+    int version;
+    shard_map_t *map = shard_map_get(router, &version);
+
+    dcb_printf(dcb, "\n\33[1;4mShard Map Statistics\33[0m\n");
+    dcb_printf(dcb, "Shard map builds: %d\n", router->shard_map_builds);
+    dcb_printf(dcb, "Shard map changes: %d\n", router->shard_map_changes);
+    dcb_printf(dcb, "Last build time: %.1lf ms\n", router->shard_map_build_time * 1000.0);
+
+    if (map)
+    {
+        dcb_printf(dcb, "Shard map version: %d\n", version);
+        dcb_printf(dcb, "Mapped databases: %d\n", hashtable_size(map->hash));
+        dcb_printf(dcb, "Mapped tables: %d\n", hashtable_size(map->tables));
+        dcb_printf(dcb, "Shard map age: %.0lf seconds\n", difftime(time(NULL), map->last_updated));
+        shard_map_release(router, map);
+    }
+    else
+    {
+        dcb_printf(dcb, "Shard map: not built\n");
+    }
     dcb_printf(dcb, "\n");
 }
 
@@ -2540,15 +3590,6 @@ static void clientReply(ROUTER* instance,
             router_cli_ses->shardmap->last_updated = time(NULL);
             spinlock_release(&router_cli_ses->shardmap->lock);
 
-            rses_end_locked_router_action(router_cli_ses);
-
-            synchronize_shard_map(router_cli_ses);
-
-            if (!rses_begin_locked_router_action(router_cli_ses))
-            {
-                return;
-            }
-
             /*
              * Check if the session is reconnecting with a database name
              * that is not in the hashtable. If the database is not found
@@ -2672,6 +3713,31 @@ static void clientReply(ROUTER* instance,
             bref_clear_state(bref, BREF_WAITING_RESULT);
         }
     }
+    /**
+     * Collect the reply of a scatter-gather query. Rows that need no merging
+     * are sent to the client as they arrive, the rest once the replies of all
+     * servers have been received.
+     */
+    else if (router_cli_ses->scatter &&
+             router_cli_ses->scatter->replies[bref - router_cli_ses->rses_backend_ref].active)
+    {
+        scatter_query_t* query = router_cli_ses->scatter;
+        int index = bref - router_cli_ses->rses_backend_ref;
+
+        writebuf = scatter_query_add(query, index, writebuf);
+
+        if (!query->replies[index].active)
+        {
+            bref_clear_state(bref, BREF_QUERY_ACTIVE);
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+
+            if (query->n_pending == 0)
+            {
+                scatter_query_free(query);
+                router_cli_ses->scatter = NULL;
+            }
+        }
+    }
     /**
      * Clear BREF_QUERY_ACTIVE flag and decrease waiter counter.
      * This applies for queries  other than session commands.
@@ -4056,12 +5122,39 @@ static bool handle_error_new_connection(ROUTER_INSTANCE*   inst,
 
     CHK_BACKEND_REF(bref);
 
+    int index = bref - rses->rses_backend_ref;
+
+    /**
+     * If the server was executing a scatter-gather query, the error replaces
+     * its result. The client is sent the error once all servers have replied.
+     */
+    if (rses->scatter && rses->scatter->replies[index].active)
+    {
+        GWBUF* reply = scatter_query_set_error(rses->scatter, index, errmsg);
+
+        if (rses->scatter->n_pending == 0)
+        {
+            scatter_query_free(rses->scatter);
+            rses->scatter = NULL;
+        }
+
+        if (reply)
+        {
+            ses->client_dcb->func.write(ses->client_dcb, reply);
+        }
+
+        bref_clear_state(bref, BREF_QUERY_ACTIVE);
+        if (BREF_IS_WAITING_RESULT(bref))
+        {
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+        }
+    }
     /**
      * If query was sent through the bref and it is waiting for reply from
      * the backend server it is necessary to send an error to the client
      * because it is waiting for reply.
      */
-    if (BREF_IS_WAITING_RESULT(bref))
+    else if (BREF_IS_WAITING_RESULT(bref))
     {
         DCB* client_dcb;
         client_dcb = ses->client_dcb;
@@ -4282,12 +5375,18 @@ struct shard_list
  */
 RESULT_ROW* shard_list_cb(struct resultset* rset, void* data)
 {
-    char *key, *value;
+    char *key, *value = NULL;
     struct shard_list *sl = (struct shard_list*)data;
     RESULT_ROW* rval = NULL;
 
-    if ((key = hashtable_next(sl->iter)) &&
-        (value = hashtable_fetch(sl->rses->shardmap->hash, key)))
+    /** Skip the databases that are not visible to the user */
+    while ((key = hashtable_next(sl->iter)) &&
+           (value = shard_map_find(sl->rses, key)) == NULL)
+    {
+        ;
+    }
+
+    if (key && value)
     {
         if ((rval = resultset_make_row(sl->rset)))
         {
@@ -4377,7 +5476,7 @@ bool handle_default_db(ROUTER_CLIENT_SES *router_cli_ses)
     spinlock_acquire(&router_cli_ses->shardmap->lock);
     if (router_cli_ses->shardmap->state != SHMAP_UNINIT)
     {
-        target = hashtable_fetch(router_cli_ses->shardmap->hash, router_cli_ses->connect_db);
+        target = shard_map_find(router_cli_ses, router_cli_ses->connect_db);
     }
     spinlock_release(&router_cli_ses->shardmap->lock);
 
@@ -4550,75 +5649,3 @@ int inspect_backend_mapping_states(ROUTER_CLIENT_SES *router_cli_ses,
     *wbuf = writebuf;
     return mapped ? 1 : 0;
 }
-
-/**
- * Replace a shard map with another one. This function copies the contents of
- * the source shard map to the target and frees the source memory.
- * @param target Target shard map to replace
- * @param source Source shard map to use
- */
-void replace_shard_map(shard_map_t **target, shard_map_t **source)
-{
-    shard_map_t *tgt = *target;
-    shard_map_t *src = *source;
-    tgt->last_updated = src->last_updated;
-    tgt->state = src->state;
-    hashtable_free(tgt->hash);
-    tgt->hash = src->hash;
-    MXS_FREE(src);
-    *source = NULL;
-}
-
-/**
- * Synchronize the router client session shard map with the global shard map for
- * this user.
- *
- * If the router doesn't have a shard map for this user then the current shard map
- * of the client session is added to the router. If the shard map in the router is
- * out of date, its contents are replaced with the contents of the current client
- * session. If the router has a usable shard map, the current shard map of the client
- * is discarded and the router's shard map is used.
- * @param client Router session
- */
-void synchronize_shard_map(ROUTER_CLIENT_SES *client)
-{
-    spinlock_acquire(&client->router->lock);
-
-    client->router->stats.shmap_cache_miss++;
-
-    shard_map_t *map = hashtable_fetch(client->router->shard_maps,
-                                       client->rses_client_dcb->user);
-    if (map)
-    {
-        spinlock_acquire(&map->lock);
-        if (map->state == SHMAP_STALE)
-        {
-            replace_shard_map(&map, &client->shardmap);
-        }
-        else if (map->state != SHMAP_READY)
-        {
-            MXS_WARNING("Shard map state is not ready but"
-                        "it is in use. Replacing it with a newer one.");
-            replace_shard_map(&map, &client->shardmap);
-        }
-        else
-        {
-            /**
-             * Another thread has already updated the shard map for this user
-             */
-            hashtable_free(client->shardmap->hash);
-            MXS_FREE(client->shardmap);
-        }
-        spinlock_release(&map->lock);
-        client->shardmap = map;
-    }
-    else
-    {
-        hashtable_add(client->router->shard_maps,
-                      client->rses_client_dcb->user,
-                      client->shardmap);
-        ss_dassert(hashtable_fetch(client->router->shard_maps,
-                                   client->rses_client_dcb->user) == client->shardmap);
-    }
-    spinlock_release(&client->router->lock);
-}
@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testscattergather.c Tests of the merging of scatter-gather results
+ */
+
+// To ensure that ss_info_assert asserts also when building in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mysql.h>
+
+#include <maxscale/alloc.h>
+#include <buffer.h>
+#include <mysql_client_server_protocol.h>
+#include "../scatter_gather.h"
+
+typedef struct test_column
+{
+    const char* name;
+    uint8_t     type;
+    uint8_t     decimals;
+    uint16_t    charset;
+} test_column_t;
+
+/** Character sets of the test columns */
+#define TEST_UTF8 33
+#define TEST_BINARY 63
+
+static uint8_t* add_packet(uint8_t* ptr, const uint8_t* payload, size_t len, uint8_t* seq)
+{
+    ptr[0] = len;
+    ptr[1] = len >> 8;
+    ptr[2] = len >> 16;
+    ptr[3] = (*seq)++;
+    memcpy(ptr + 4, payload, len);
+    return ptr + 4 + len;
+}
+
+static size_t add_string(uint8_t* ptr, const char* str)
+{
+    size_t len = strlen(str);
+    *ptr = len;
+    memcpy(ptr + 1, str, len);
+    return len + 1;
+}
+
+/**
+ * Create the result set of a shard
+ *
+ * @param columns   The columns
+ * @param n_columns Number of columns
+ * @param rows      The values of the rows, row by row, NULL for SQL NULL
+ * @param n_rows    Number of rows
+ * @return The result set
+ */
+static GWBUF* create_result(const test_column_t* columns, int n_columns,
+                            const char** rows, int n_rows)
+{
+    uint8_t data[4096];
+    uint8_t payload[512];
+    uint8_t eof[] = {0xfe, 0, 0, 0x02, 0};
+    uint8_t* ptr = data;
+    uint8_t seq = 1;
+
+    payload[0] = n_columns;
+    ptr = add_packet(ptr, payload, 1, &seq);
+
+    for (int i = 0; i < n_columns; i++)
+    {
+        size_t len = 0;
+        len += add_string(payload + len, "def");
+        len += add_string(payload + len, "test");
+        len += add_string(payload + len, "t1");
+        len += add_string(payload + len, "t1");
+        len += add_string(payload + len, columns[i].name);
+        len += add_string(payload + len, columns[i].name);
+        payload[len++] = 0x0c;
+        memset(payload + len, 0, 10);
+        payload[len] = columns[i].charset;
+        payload[len + 1] = columns[i].charset >> 8;
+        payload[len + 6] = columns[i].type;
+        payload[len + 9] = columns[i].decimals;
+        len += 12;
+        ptr = add_packet(ptr, payload, len, &seq);
+    }
+
+    ptr = add_packet(ptr, eof, sizeof(eof), &seq);
+
+    for (int r = 0; r < n_rows; r++)
+    {
+        size_t len = 0;
+
+        for (int i = 0; i < n_columns; i++)
+        {
+            const char* value = rows[r * n_columns + i];
+
+            if (value)
+            {
+                len += add_string(payload + len, value);
+            }
+            else
+            {
+                payload[len++] = 0xfb;
+            }
+        }
+
+        ptr = add_packet(ptr, payload, len, &seq);
+    }
+
+    ptr = add_packet(ptr, eof, sizeof(eof), &seq);
+
+    GWBUF* rval = gwbuf_alloc_and_load(ptr - data, data);
+    MXS_ABORT_IF_NULL(rval);
+    return rval;
+}
+
+static GWBUF* create_error(const char* msg)
+{
+    uint8_t data[256];
+    uint8_t payload[200] = {0xff, 0x7a, 0x04, '#', '4', '2', 'S', '0', '2'};
+    uint8_t seq = 1;
+    size_t len = 9 + strlen(msg);
+
+    memcpy(payload + 9, msg, strlen(msg));
+    add_packet(data, payload, len, &seq);
+
+    GWBUF* rval = gwbuf_alloc_and_load(len + 4, data);
+    MXS_ABORT_IF_NULL(rval);
+    return rval;
+}
+
+/**
+ * Read the values of the rows of a merged result as one string
+ *
+ * @param buffer The merged result
+ * @param dest   Where the values are written, separated by spaces
+ * @return Number of rows
+ */
+static int read_rows(GWBUF* buffer, char* dest)
+{
+    uint8_t* ptr = GWBUF_DATA(buffer);
+    uint8_t* end = ptr + GWBUF_LENGTH(buffer);
+    int n_columns = ptr[4];
+    int n_rows = 0;
+    uint8_t seq = 1;
+
+    *dest = '\0';
+
+    /** Skip the column count, the column definitions and their EOF */
+    for (int i = 0; i < n_columns + 2; i++)
+    {
+        ss_info_dassert(ptr[3] == seq++, "Sequence numbers should be consecutive");
+        ptr += gw_mysql_get_byte3(ptr) + 4;
+    }
+
+    while (ptr < end && !(ptr[4] == 0xfe && gw_mysql_get_byte3(ptr) < 9))
+    {
+        uint8_t* field = ptr + 4;
+        ss_info_dassert(ptr[3] == seq++, "Sequence numbers should be consecutive");
+
+        for (int i = 0; i < n_columns; i++)
+        {
+            if (*dest)
+            {
+                strcat(dest, " ");
+            }
+
+            if (*field == 0xfb)
+            {
+                strcat(dest, "NULL");
+                field++;
+            }
+            else
+            {
+                strncat(dest, (char*)field + 1, *field);
+                field += *field + 1;
+            }
+        }
+
+        n_rows++;
+        ptr += gw_mysql_get_byte3(ptr) + 4;
+    }
+
+    ss_info_dassert(ptr + 9 == end, "The result should end with an EOF packet");
+    ss_info_dassert(ptr[3] == seq, "Sequence numbers should be consecutive");
+
+    return n_rows;
+}
+
+static void test_plan()
+{
+    scatter_plan_t plan;
+
+    ss_info_dassert(scatter_plan_create("SELECT * FROM t1", &plan), "Plain SELECT is supported");
+    ss_info_dassert(!plan.aggregate && plan.n_order == 0 && plan.limit == -1, "Plan should be empty");
+
+    ss_info_dassert(scatter_plan_create("SELECT a, b AS x FROM t1 WHERE c = 'ORDER BY' "
+                                        "ORDER BY x DESC, 1 LIMIT 10, 5", &plan),
+                    "ORDER BY and LIMIT are supported");
+    ss_info_dassert(plan.n_order == 2, "Two ORDER BY columns");
+    ss_info_dassert(strcmp(plan.order[0].name, "x") == 0 && plan.order[0].desc, "Order by x DESC");
+    ss_info_dassert(plan.order[1].position == 1 && !plan.order[1].desc, "Order by 1 ASC");
+    ss_info_dassert(plan.offset == 10 && plan.limit == 5, "LIMIT 10, 5");
+
+    ss_info_dassert(scatter_plan_create("select count(*), SUM(a) s, min(`b`), MAX(c) AS m from t1", &plan),
+                    "Aggregates are supported");
+    ss_info_dassert(plan.aggregate && plan.n_columns == 4, "Four aggregated columns");
+    ss_info_dassert(plan.columns[0] == SCATTER_AGG_COUNT && plan.columns[1] == SCATTER_AGG_SUM &&
+                    plan.columns[2] == SCATTER_AGG_MIN && plan.columns[3] == SCATTER_AGG_MAX,
+                    "Aggregates should be detected");
+
+    ss_info_dassert(scatter_plan_create("SELECT a FROM (SELECT a FROM t1 GROUP BY a) AS d", &plan),
+                    "GROUP BY in a subquery is supported");
+    ss_info_dassert(scatter_plan_create("SELECT a FROM t1 ORDER BY t1.a LIMIT 3 OFFSET 2;", &plan),
+                    "Qualified ORDER BY column and OFFSET are supported");
+    ss_info_dassert(plan.offset == 2 && plan.limit == 3, "LIMIT 3 OFFSET 2");
+
+    const char* unsupported[] =
+    {
+        "SELECT DISTINCT a FROM t1",
+        "SELECT a, COUNT(*) FROM t1 GROUP BY a",
+        "SELECT a, COUNT(*) FROM t1",
+        "SELECT AVG(a) FROM t1",
+        "SELECT COUNT(DISTINCT a) FROM t1",
+        "SELECT COUNT(*) + 1 FROM t1",
+        "SELECT a FROM t1 UNION SELECT a FROM t2",
+        "SELECT a FROM t1 ORDER BY a + 1",
+        "SELECT a FROM t1 ORDER BY b",
+        "SELECT a FROM t1 LIMIT ?",
+        "SELECT a FROM t1 FOR UPDATE",
+        "SELECT a INTO @a FROM t1",
+        "SELECT a FROM t1; SELECT b FROM t2",
+        "UPDATE t1 SET a = 1",
+        NULL
+    };
+
+    for (int i = 0; unsupported[i]; i++)
+    {
+        if (scatter_plan_create(unsupported[i], &plan))
+        {
+            printf("Statement should not be supported: %s\n", unsupported[i]);
+            ss_dassert(false);
+        }
+    }
+}
+
+static void test_rewrite()
+{
+    scatter_plan_t plan;
+    char* sql;
+
+    ss_dassert(scatter_plan_create("SELECT a FROM t1 ORDER BY a LIMIT 10", &plan));
+    ss_info_dassert(scatter_plan_rewrite("SELECT a FROM t1 ORDER BY a LIMIT 10", &plan) == NULL,
+                    "LIMIT without an offset needs no rewriting");
+
+    const char* query = "SELECT a FROM t1 ORDER BY a LIMIT 20, 10 -- comment";
+    ss_dassert(scatter_plan_create(query, &plan));
+    sql = scatter_plan_rewrite(query, &plan);
+    ss_info_dassert(sql && strcmp(sql, "SELECT a FROM t1 ORDER BY a LIMIT 30 -- comment") == 0,
+                    "Offset should be added to the row count");
+    MXS_FREE(sql);
+}
+
+/**
+ * Feed the result of a shard to a query in parts that split packets
+ *
+ * @return What the query returned for the client
+ */
+static GWBUF* feed(scatter_query_t* query, int index, GWBUF* result)
+{
+    size_t len = gwbuf_length(result);
+    GWBUF* output = NULL;
+
+    for (size_t offset = 0; offset < len; offset += 7)
+    {
+        size_t part = len - offset < 7 ? len - offset : 7;
+        GWBUF* buf = gwbuf_alloc_and_load(part, (uint8_t*)GWBUF_DATA(result) + offset);
+
+        ss_info_dassert(query->replies[index].active, "Reply should be complete only at the end");
+        output = gwbuf_append(output, scatter_query_add(query, index, buf));
+    }
+
+    ss_info_dassert(!query->replies[index].active, "Reply should be complete at the end");
+    gwbuf_free(result);
+    return output;
+}
+
+static scatter_query_t* start_query(const char* sql, size_t max_size)
+{
+    scatter_query_t* query = scatter_query_alloc(2, max_size);
+    MXS_ABORT_IF_NULL(query);
+    ss_info_dassert(scatter_plan_create(sql, &query->plan), "Statement should be supported");
+
+    for (int i = 0; i < 2; i++)
+    {
+        query->replies[i].active = true;
+        query->n_pending++;
+    }
+
+    return query;
+}
+
+static bool is_error(GWBUF* buf)
+{
+    return buf && ((uint8_t*)GWBUF_DATA(buf))[4] == 0xff;
+}
+
+static void test_reply()
+{
+    char values[1024];
+    test_column_t columns[] = {{"a", MYSQL_TYPE_LONG, 0, TEST_BINARY}};
+    const char* rows[] = {"1", "2", "3"};
+    GWBUF* output;
+
+    /** Sorted rows are returned when all shards have replied */
+    scatter_query_t* query = start_query("SELECT a FROM t1 ORDER BY a", 0);
+    output = feed(query, 0, create_result(columns, 1, rows, 3));
+    ss_info_dassert(output == NULL, "Nothing should be returned before all shards have replied");
+    ss_info_dassert(query->replies[0].n_packets == 7, "The reply has seven packets");
+    output = feed(query, 1, create_error("Table doesn't exist"));
+    ss_info_dassert(query->n_pending == 0 && is_error(output), "The error should be the reply");
+    gwbuf_free(output);
+    scatter_query_free(query);
+
+    /** A shard can't contribute more rows to the result than the LIMIT */
+    GWBUF* one_row = create_result(columns, 1, rows, 1);
+    query = start_query("SELECT a FROM t1 ORDER BY a DESC LIMIT 1", 0);
+    gwbuf_free(feed(query, 0, create_result(columns, 1, rows, 3)));
+    ss_info_dassert(query->replies[0].n_rows == 3 &&
+                    gwbuf_length(query->replies[0].reply) == gwbuf_length(one_row),
+                    "Only the rows within the LIMIT should be buffered");
+    gwbuf_free(one_row);
+    output = feed(query, 1, create_result(columns, 1, rows + 2, 1));
+    ss_info_dassert(read_rows(output, values) == 1 && strcmp(values, "3") == 0,
+                    "The largest value should be the result");
+    gwbuf_free(output);
+    scatter_query_free(query);
+
+    /** The buffered replies are limited */
+    query = start_query("SELECT a FROM t1 ORDER BY a", 100);
+    output = feed(query, 0, create_result(columns, 1, rows, 3));
+    output = gwbuf_append(output, feed(query, 1, create_result(columns, 1, rows, 3)));
+    ss_info_dassert(query->overflow && is_error(output), "Too large results should be an error");
+    ss_info_dassert(query->replies[0].reply == NULL, "The buffered replies should be freed");
+    gwbuf_free(output);
+    scatter_query_free(query);
+}
+
+static void test_stream()
+{
+    char values[1024];
+    test_column_t columns[] = {{"a", MYSQL_TYPE_LONG, 0, TEST_BINARY}};
+    const char* rows1[] = {"1", "2", "3"};
+    const char* rows2[] = {"4", "5"};
+    GWBUF* output;
+
+    /** Rows that are not sorted are sent as they arrive */
+    scatter_query_t* query = start_query("SELECT a FROM t1", 0);
+    output = feed(query, 1, create_result(columns, 1, rows2, 2));
+    ss_info_dassert(output && query->header_sent && query->replies[1].reply &&
+                    gwbuf_length(query->replies[1].reply) == 9,
+                    "The columns and rows should be sent and only the EOF buffered");
+    output = gwbuf_append(output, feed(query, 0, create_result(columns, 1, rows1, 3)));
+    output = gwbuf_make_contiguous(output);
+    ss_info_dassert(read_rows(output, values) == 5 && strcmp(values, "4 5 1 2 3") == 0,
+                    "Rows should be streamed in the order of arrival");
+    gwbuf_free(output);
+    scatter_query_free(query);
+
+    /** The LIMIT is applied to the streamed rows */
+    query = start_query("SELECT a FROM t1 LIMIT 1, 3", 0);
+    output = feed(query, 0, create_result(columns, 1, rows1, 3));
+    output = gwbuf_append(output, feed(query, 1, create_result(columns, 1, rows2, 2)));
+    output = gwbuf_make_contiguous(output);
+    ss_info_dassert(read_rows(output, values) == 3 && strcmp(values, "2 3 4") == 0,
+                    "The offset and the row count should be applied");
+    gwbuf_free(output);
+    scatter_query_free(query);
+
+    /** An error after the streamed rows takes the place of the EOF */
+    query = start_query("SELECT a FROM t1", 0);
+    output = feed(query, 0, create_result(columns, 1, rows1, 3));
+    output = gwbuf_append(output, feed(query, 1, create_error("Table doesn't exist")));
+    output = gwbuf_make_contiguous(output);
+
+    uint8_t* ptr = GWBUF_DATA(output);
+    uint8_t* end = ptr + GWBUF_LENGTH(output);
+    uint8_t seq = 1;
+
+    while (ptr + gw_mysql_get_byte3(ptr) + 4 < end)
+    {
+        ss_info_dassert(ptr[3] == seq++, "Sequence numbers should be consecutive");
+        ptr += gw_mysql_get_byte3(ptr) + 4;
+    }
+
+    ss_info_dassert(ptr[4] == 0xff && ptr[3] == seq, "The result should end with the error");
+    gwbuf_free(output);
+    scatter_query_free(query);
+}
+
+static GWBUF* merge(const char* sql, const test_column_t* columns, int n_columns,
+                    const char** rows1, int n_rows1, const char** rows2, int n_rows2)
+{
+    scatter_plan_t plan;
+    GWBUF* replies[2];
+
+    ss_info_dassert(scatter_plan_create(sql, &plan), "Statement should be supported");
+    replies[0] = create_result(columns, n_columns, rows1, n_rows1);
+    replies[1] = create_result(columns, n_columns, rows2, n_rows2);
+
+    GWBUF* rval = scatter_merge(&plan, replies, 2);
+    ss_info_dassert(rval, "Merge should succeed");
+
+    gwbuf_free(replies[0]);
+    gwbuf_free(replies[1]);
+    return rval;
+}
+
+static void test_merge()
+{
+    char values[1024];
+    GWBUF* buf;
+    test_column_t columns[] =
+    {
+        {"id", MYSQL_TYPE_LONG, 0, TEST_BINARY},
+        {"name", MYSQL_TYPE_VAR_STRING, 0, TEST_UTF8}
+    };
+    test_column_t bin_columns[] =
+    {
+        {"id", MYSQL_TYPE_LONG, 0, TEST_BINARY},
+        {"code", MYSQL_TYPE_VAR_STRING, 0, TEST_BINARY}
+    };
+    const char* rows1[] = {"1", "a", "10", "c", "3", NULL};
+    const char* rows2[] = {"2", "b", "20", "d"};
+
+    buf = merge("SELECT id, name FROM t1", columns, 2, rows1, 3, rows2, 2);
+    ss_info_dassert(read_rows(buf, values) == 5, "UNION ALL of the rows");
+    ss_info_dassert(strcmp(values, "1 a 10 c 3 NULL 2 b 20 d") == 0, "Rows should be concatenated");
+    gwbuf_free(buf);
+
+    buf = merge("SELECT id, name FROM t1 ORDER BY id", columns, 2, rows1, 3, rows2, 2);
+    read_rows(buf, values);
+    ss_info_dassert(strcmp(values, "1 a 2 b 3 NULL 10 c 20 d") == 0, "Rows should be sorted numerically");
+    gwbuf_free(buf);
+
+    buf = merge("SELECT id, code FROM t1 ORDER BY code DESC LIMIT 1, 2", bin_columns, 2, rows1, 3, rows2, 2);
+    ss_info_dassert(read_rows(buf, values) == 2, "LIMIT should cut the rows");
+    ss_info_dassert(strcmp(values, "10 c 2 b") == 0, "Rows should be sorted in descending order");
+    gwbuf_free(buf);
+
+    /** The shards sort strings with a collation, the order can't be reproduced */
+    buf = merge("SELECT id, name FROM t1 ORDER BY name", columns, 2, rows1, 3, rows2, 2);
+    ss_info_dassert(((uint8_t*)GWBUF_DATA(buf))[4] == 0xff, "Sorting by a string should be an error");
+    gwbuf_free(buf);
+
+    test_column_t agg_columns[] =
+    {
+        {"COUNT(*)", MYSQL_TYPE_LONGLONG, 0, TEST_BINARY},
+        {"SUM(price)", MYSQL_TYPE_NEWDECIMAL, 2, TEST_BINARY},
+        {"MIN(code)", MYSQL_TYPE_VAR_STRING, 0, TEST_BINARY},
+        {"MAX(id)", MYSQL_TYPE_LONG, 0, TEST_BINARY},
+        {"SUM(x)", MYSQL_TYPE_DOUBLE, 31, TEST_BINARY}
+    };
+    const char* agg1[] = {"3", "10.25", "bob", "9", NULL};
+    const char* agg2[] = {"4", "0.50", "alice", "10", NULL};
+
+    buf = merge("SELECT COUNT(*), SUM(price), MIN(code), MAX(id), SUM(x) FROM t1",
+                agg_columns, 5, agg1, 1, agg2, 1);
+    ss_info_dassert(read_rows(buf, values) == 1, "Aggregates should be merged into one row");
+    ss_info_dassert(strcmp(values, "7 10.75 alice 10 NULL") == 0, "Aggregates should be combined");
+    gwbuf_free(buf);
+
+    /** Sums beyond the precision of a long double are exact */
+    test_column_t sum_columns[] =
+    {
+        {"COUNT(*)", MYSQL_TYPE_LONGLONG, 0, TEST_BINARY},
+        {"SUM(big)", MYSQL_TYPE_NEWDECIMAL, 0, TEST_BINARY},
+        {"SUM(d)", MYSQL_TYPE_NEWDECIMAL, 30, TEST_BINARY},
+        {"SUM(n)", MYSQL_TYPE_NEWDECIMAL, 2, TEST_BINARY}
+    };
+    const char* sum1[] = {"9223372036854775807", "9223372036854775807",
+                          "12345678901234567890123456789012345.123456789012345678901234567890",
+                          "-10.25"};
+    const char* sum2[] = {"9223372036854775807", "9223372036854775807",
+                          "0.000000000000000000000000000001", "5.50"};
+
+    buf = merge("SELECT COUNT(*), SUM(big), SUM(d), SUM(n) FROM t1", sum_columns, 4, sum1, 1, sum2, 1);
+    read_rows(buf, values);
+    ss_info_dassert(strcmp(values, "18446744073709551614 18446744073709551614 "
+                           "12345678901234567890123456789012345.123456789012345678901234567891 "
+                           "-4.75") == 0, "Integer and DECIMAL sums should be exact");
+    gwbuf_free(buf);
+
+    const char* bad1[] = {"1", "1", "1.5", "abc"};
+    buf = merge("SELECT COUNT(*), SUM(big), SUM(d), SUM(n) FROM t1", sum_columns, 4, bad1, 1, sum2, 1);
+    ss_info_dassert(((uint8_t*)GWBUF_DATA(buf))[4] == 0xff, "A value that is not a number should be an error");
+    gwbuf_free(buf);
+
+    test_column_t min_column[] = {{"MIN(name)", MYSQL_TYPE_VAR_STRING, 0, TEST_UTF8}};
+    const char* min1[] = {"bob"};
+    const char* min2[] = {"Alice"};
+
+    buf = merge("SELECT MIN(name) FROM t1", min_column, 1, min1, 1, min2, 1);
+    ss_info_dassert(((uint8_t*)GWBUF_DATA(buf))[4] == 0xff, "MIN of a string should be an error");
+    gwbuf_free(buf);
+
+    scatter_plan_t plan;
+    GWBUF* replies[2];
+    ss_dassert(scatter_plan_create("SELECT id FROM t1", &plan));
+    replies[0] = create_result(columns, 1, rows2, 1);
+    replies[1] = create_error("Table 'test.t1' doesn't exist");
+    buf = scatter_merge(&plan, replies, 2);
+    ss_info_dassert(buf && ((uint8_t*)GWBUF_DATA(buf))[4] == 0xff, "An error should be the reply");
+    ss_info_dassert(((uint8_t*)GWBUF_DATA(buf))[3] == 1, "The error should have the sequence number 1");
+    gwbuf_free(buf);
+    gwbuf_free(replies[0]);
+    gwbuf_free(replies[1]);
+}
+
+int main(int argc, char **argv)
+{
+    test_plan();
+    test_rewrite();
+    test_reply();
+    test_stream();
+    test_merge();
+    return 0;
+}